@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file bench_common.cpp
+ *
+ * @brief Implementation of the helpers shared by the benchmarks and the stress test.
+ */
+
+#include "bench_common.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+#include <ctime>
+#include <thread>
+
+namespace bench
+{
+
+option uint_option(const char *name, const char *description, uint32_t &value, bool allow_zero)
+{
+   return { name, "N", description, [&value, allow_zero](const char *arg) {
+              return parse_uint(arg, value) && (allow_zero || value != 0);
+           } };
+}
+
+option string_option(const char *name, const char *value_name, const char *description, const char *&value)
+{
+   return { name, value_name, description, [&value](const char *arg) {
+              value = arg;
+              return true;
+           } };
+}
+
+option flag_option(const char *name, const char *description, bool &value)
+{
+   return { name, nullptr, description, [&value](const char *) {
+              value = true;
+              return true;
+           } };
+}
+
+bool parse_uint(const char *arg, uint32_t &value)
+{
+   char *end = nullptr;
+   unsigned long parsed = std::strtoul(arg, &end, 10);
+   if (end == arg || *end != '\0' || parsed > UINT32_MAX)
+   {
+      return false;
+   }
+   value = static_cast<uint32_t>(parsed);
+   return true;
+}
+
+bool parse_options(int argc, char **argv, const std::vector<option> &options)
+{
+   for (int i = 1; i < argc; i++)
+   {
+      const char *arg = argv[i];
+      auto it = std::find_if(options.begin(), options.end(),
+                             [arg](const option &opt) { return std::strcmp(opt.name, arg) == 0; });
+      if (it == options.end())
+      {
+         return false;
+      }
+
+      const char *value = nullptr;
+      if (it->value_name != nullptr)
+      {
+         if (i + 1 == argc)
+         {
+            return false;
+         }
+         value = argv[++i];
+      }
+      if (!it->parse(value))
+      {
+         return false;
+      }
+   }
+   return true;
+}
+
+void print_usage(const char *program, const std::vector<option> &options)
+{
+   auto usage_name = [](const option &opt) {
+      std::string name = opt.name;
+      if (opt.value_name != nullptr)
+      {
+         name = name + " " + opt.value_name;
+      }
+      return name;
+   };
+
+   size_t width = 0;
+   for (const option &opt : options)
+   {
+      width = std::max(width, usage_name(opt).size());
+   }
+
+   std::fprintf(stderr, "Usage: %s [options]\n", program);
+   for (const option &opt : options)
+   {
+      std::fprintf(stderr, "  %-*s %s\n", static_cast<int>(width), usage_name(opt).c_str(), opt.description);
+   }
+}
+
+bool has_extension(const std::vector<VkExtensionProperties> &extensions, const char *name)
+{
+   return std::any_of(extensions.begin(), extensions.end(),
+                      [name](const VkExtensionProperties &ext) { return std::strcmp(ext.extensionName, name) == 0; });
+}
+
+uint64_t now_ns()
+{
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * @brief Write a string as a JSON string, escaping the characters that JSON requires to be escaped.
+ */
+static void write_json_string(FILE *file, const char *str)
+{
+   std::fputc('"', file);
+   for (const char *c = str; *c != '\0'; c++)
+   {
+      if (*c == '"' || *c == '\\')
+      {
+         std::fprintf(file, "\\%c", *c);
+      }
+      else if (static_cast<unsigned char>(*c) < 0x20)
+      {
+         std::fprintf(file, "\\u%04x", static_cast<unsigned>(*c));
+      }
+      else
+      {
+         std::fputc(*c, file);
+      }
+   }
+   std::fputc('"', file);
+}
+
+bool write_benchmark_json(const char *path, const char *executable, const std::vector<benchmark_result> &results)
+{
+   const bool to_stdout = std::strcmp(path, "-") == 0;
+   FILE *file = to_stdout ? stdout : std::fopen(path, "w");
+   if (file == nullptr)
+   {
+      std::fprintf(stderr, "Failed to open %s\n", path);
+      return false;
+   }
+
+   char date[64] = {};
+   const time_t now = std::time(nullptr);
+   tm local_time = {};
+   localtime_r(&now, &local_time);
+   std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", &local_time);
+
+   std::fprintf(file, "{\n  \"context\": {\n    \"date\": ");
+   write_json_string(file, date);
+   std::fprintf(file, ",\n    \"executable\": ");
+   write_json_string(file, executable);
+   std::fprintf(file, ",\n    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+#ifdef NDEBUG
+   std::fprintf(file, "    \"library_build_type\": \"release\"\n  },\n");
+#else
+   std::fprintf(file, "    \"library_build_type\": \"debug\"\n  },\n");
+#endif
+
+   std::fprintf(file, "  \"benchmarks\": [");
+   for (size_t i = 0; i < results.size(); i++)
+   {
+      const benchmark_result &r = results[i];
+      std::fprintf(file, "%s\n    {\n      \"name\": ", i == 0 ? "" : ",");
+      write_json_string(file, r.name.c_str());
+      std::fprintf(file, ",\n      \"run_name\": ");
+      write_json_string(file, r.name.c_str());
+      std::fprintf(file,
+                   ",\n      \"run_type\": \"iteration\",\n"
+                   "      \"repetition_index\": %u,\n"
+                   "      \"threads\": 1,\n"
+                   "      \"iterations\": %" PRIu64 ",\n"
+                   "      \"real_time\": %.3f,\n"
+                   "      \"cpu_time\": %.3f,\n"
+                   "      \"time_unit\": \"ns\"\n    }",
+                   r.repetition, r.iterations, r.real_ns, r.cpu_ns);
+   }
+   std::fprintf(file, "\n  ]\n}\n");
+
+   if (!to_stdout)
+   {
+      return std::fclose(file) == 0;
+   }
+   return true;
+}
+
+VkSurfaceKHR create_surface(const context &ctx, const VkAllocationCallbacks *allocator)
+{
+   VkHeadlessSurfaceCreateInfoEXT surface_info = {};
+   surface_info.sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT;
+   VkSurfaceKHR surface = VK_NULL_HANDLE;
+   CHECK_VK(ctx.create_headless_surface(ctx.instance, &surface_info, allocator, &surface));
+   return surface;
+}
+
+void create_context(const context_create_info &create_info, context &ctx)
+{
+   std::vector<const char *> instance_extensions = { VK_KHR_SURFACE_EXTENSION_NAME,
+                                                     VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME };
+   instance_extensions.insert(instance_extensions.end(), create_info.instance_extensions.begin(),
+                              create_info.instance_extensions.end());
+   const char *layer_name = "VK_LAYER_window_system_integration";
+
+   VkApplicationInfo app_info = {};
+   app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+   app_info.pApplicationName = create_info.application_name;
+   app_info.apiVersion = VK_API_VERSION_1_1;
+
+   VkInstanceCreateInfo instance_info = {};
+   instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+   instance_info.pApplicationInfo = &app_info;
+   instance_info.enabledLayerCount = 1;
+   instance_info.ppEnabledLayerNames = &layer_name;
+   instance_info.enabledExtensionCount = static_cast<uint32_t>(instance_extensions.size());
+   instance_info.ppEnabledExtensionNames = instance_extensions.data();
+   ctx.allocator = create_info.allocator;
+   CHECK_VK(vkCreateInstance(&instance_info, ctx.allocator, &ctx.instance));
+
+   ctx.create_headless_surface = reinterpret_cast<PFN_vkCreateHeadlessSurfaceEXT>(
+      vkGetInstanceProcAddr(ctx.instance, "vkCreateHeadlessSurfaceEXT"));
+   if (ctx.create_headless_surface == nullptr)
+   {
+      std::fprintf(stderr, "vkCreateHeadlessSurfaceEXT is not available\n");
+      std::exit(EXIT_FAILURE);
+   }
+
+   uint32_t physical_device_count = 1;
+   VkResult result = vkEnumeratePhysicalDevices(ctx.instance, &physical_device_count, &ctx.physical_device);
+   CHECK_VK(result);
+   if (physical_device_count == 0)
+   {
+      std::fprintf(stderr, "No physical device\n");
+      std::exit(EXIT_FAILURE);
+   }
+
+   /* Any queue family that can present and execute pipeline barriers will do. */
+   VkSurfaceKHR surface = create_surface(ctx, ctx.allocator);
+   uint32_t family_count = 0;
+   vkGetPhysicalDeviceQueueFamilyProperties(ctx.physical_device, &family_count, nullptr);
+   std::vector<VkQueueFamilyProperties> families(family_count);
+   vkGetPhysicalDeviceQueueFamilyProperties(ctx.physical_device, &family_count, families.data());
+   bool found = false;
+   for (uint32_t i = 0; i < family_count && !found; i++)
+   {
+      VkBool32 supported = VK_FALSE;
+      CHECK_VK(vkGetPhysicalDeviceSurfaceSupportKHR(ctx.physical_device, i, surface, &supported));
+      if (supported && (families[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) != 0)
+      {
+         ctx.queue_family_index = i;
+         found = true;
+      }
+   }
+   vkDestroySurfaceKHR(ctx.instance, surface, ctx.allocator);
+   if (!found)
+   {
+      std::fprintf(stderr, "No queue family can present to headless surfaces\n");
+      std::exit(EXIT_FAILURE);
+   }
+
+   uint32_t extension_count = 0;
+   CHECK_VK(vkEnumerateDeviceExtensionProperties(ctx.physical_device, nullptr, &extension_count, nullptr));
+   std::vector<VkExtensionProperties> extensions(extension_count);
+   CHECK_VK(vkEnumerateDeviceExtensionProperties(ctx.physical_device, nullptr, &extension_count, extensions.data()));
+
+   std::vector<const char *> device_extensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+   for (const char *extension : create_info.device_extensions)
+   {
+      if (!has_extension(extensions, extension))
+      {
+         std::fprintf(stderr, "%s is not supported\n", extension);
+         std::exit(EXIT_FAILURE);
+      }
+      device_extensions.push_back(extension);
+   }
+
+   /* Threads get their own queue when possible, so that they only contend in the layer. */
+   const uint32_t queue_count = std::min(create_info.queue_count, families[ctx.queue_family_index].queueCount);
+   std::vector<float> priorities(queue_count, 1.0f);
+   VkDeviceQueueCreateInfo queue_info = {};
+   queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+   queue_info.queueFamilyIndex = ctx.queue_family_index;
+   queue_info.queueCount = queue_count;
+   queue_info.pQueuePriorities = priorities.data();
+
+   VkDeviceCreateInfo device_info = {};
+   device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+   device_info.pNext = create_info.device_features;
+   device_info.queueCreateInfoCount = 1;
+   device_info.pQueueCreateInfos = &queue_info;
+   device_info.enabledExtensionCount = static_cast<uint32_t>(device_extensions.size());
+   device_info.ppEnabledExtensionNames = device_extensions.data();
+   CHECK_VK(vkCreateDevice(ctx.physical_device, &device_info, ctx.allocator, &ctx.device));
+
+   ctx.queues = std::vector<shared_queue>(queue_count);
+   for (uint32_t i = 0; i < queue_count; i++)
+   {
+      vkGetDeviceQueue(ctx.device, ctx.queue_family_index, i, &ctx.queues[i].queue);
+   }
+}
+
+void destroy_context(context &ctx)
+{
+   vkDestroyDevice(ctx.device, ctx.allocator);
+   vkDestroyInstance(ctx.instance, ctx.allocator);
+}
+
+} /* namespace bench */
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file bench_common.hpp
+ *
+ * @brief Helpers shared by the benchmarks and the stress test: error checking, command line parsing, the JSON output of
+ * the results and the creation of a device with the layer enabled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#define CHECK_VK(expr)                                                                               \
+   do                                                                                                \
+   {                                                                                                 \
+      VkResult check_result = (expr);                                                                \
+      if (check_result < 0)                                                                          \
+      {                                                                                              \
+         std::fprintf(stderr, "%s:%d: %s failed with %d\n", __FILE__, __LINE__, #expr, check_result); \
+         std::exit(EXIT_FAILURE);                                                                    \
+      }                                                                                              \
+   } while (0)
+
+namespace bench
+{
+
+/**
+ * @brief A command line option.
+ */
+struct option
+{
+   const char *name;
+   /* Name of the value of the option in the usage, nullptr for options that take no value. */
+   const char *value_name;
+   const char *description;
+   /* Parses the value of the option, which is nullptr for options that take no value. */
+   std::function<bool(const char *value)> parse;
+};
+
+/**
+ * @brief An option whose value is an unsigned integer.
+ */
+option uint_option(const char *name, const char *description, uint32_t &value, bool allow_zero = false);
+
+/**
+ * @brief An option whose value is a string, which is kept pointing into the command line.
+ */
+option string_option(const char *name, const char *value_name, const char *description, const char *&value);
+
+/**
+ * @brief An option without a value, which sets @p value when given.
+ */
+option flag_option(const char *name, const char *description, bool &value);
+
+bool parse_uint(const char *arg, uint32_t &value);
+
+/**
+ * @brief Parse the command line against @p options.
+ *
+ * @return false if an argument is not one of the options or has an invalid value.
+ */
+bool parse_options(int argc, char **argv, const std::vector<option> &options);
+
+void print_usage(const char *program, const std::vector<option> &options);
+
+bool has_extension(const std::vector<VkExtensionProperties> &extensions, const char *name);
+
+uint64_t now_ns();
+
+/**
+ * @brief The result of one run of a microbenchmark, with the times of one iteration.
+ */
+struct benchmark_result
+{
+   std::string name;
+   uint32_t repetition;
+   uint64_t iterations;
+   double real_ns;
+   double cpu_ns;
+};
+
+/**
+ * @brief Write the results in the JSON format of Google Benchmark, so that they can be compared with its tools.
+ *
+ * @param path       File to write, - for the standard output.
+ * @param executable Path of the benchmark, recorded in the context of the results.
+ * @param results    The results to write.
+ *
+ * @return false if the file could not be written.
+ */
+bool write_benchmark_json(const char *path, const char *executable, const std::vector<benchmark_result> &results);
+
+/**
+ * @brief A queue shared by several threads, which must not use it concurrently.
+ */
+struct shared_queue
+{
+   VkQueue queue = VK_NULL_HANDLE;
+   std::mutex mutex;
+};
+
+struct context_create_info
+{
+   const char *application_name = nullptr;
+   std::vector<const char *> instance_extensions;
+   /* Device extensions, the creation fails if one of them is not supported. */
+   std::vector<const char *> device_extensions;
+   /* Chain of feature structures enabled on the device. */
+   void *device_features = nullptr;
+   /* Number of queues to create, less if their family has fewer. */
+   uint32_t queue_count = 1;
+   const VkAllocationCallbacks *allocator = nullptr;
+};
+
+/**
+ * @brief An instance with the layer enabled and a device with queues that can present to headless surfaces.
+ */
+struct context
+{
+   const VkAllocationCallbacks *allocator = nullptr;
+   VkInstance instance = VK_NULL_HANDLE;
+   VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+   VkDevice device = VK_NULL_HANDLE;
+   uint32_t queue_family_index = 0;
+   std::vector<shared_queue> queues;
+   PFN_vkCreateHeadlessSurfaceEXT create_headless_surface = nullptr;
+};
+
+/**
+ * @brief Create the instance and the device of @p ctx, exiting on failure.
+ */
+void create_context(const context_create_info &create_info, context &ctx);
+
+void destroy_context(context &ctx);
+
+VkSurfaceKHR create_surface(const context &ctx, const VkAllocationCallbacks *allocator);
+
+} /* namespace bench */
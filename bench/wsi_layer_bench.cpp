@@ -0,0 +1,424 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file wsi_layer_bench.cpp
+ *
+ * @brief Benchmark of the acquire and present paths of the layer on headless surfaces.
+ *
+ * Each thread creates a headless surface and a swapchain, then acquires and presents images in a loop, measuring the
+ * time spent in vkAcquireNextImageKHR and vkQueuePresentKHR. The headless backend has no compositor, so the results
+ * reflect the cost of the layer itself.
+ *
+ * The layer must be found by the Vulkan loader, for example by setting VK_ADD_LAYER_PATH to the build directory.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "bench_common.hpp"
+
+using bench::now_ns;
+
+namespace
+{
+
+struct options
+{
+   uint32_t image_count = 3;
+   VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+   uint32_t thread_count = 1;
+   uint32_t frame_count = 1000;
+   uint32_t warmup_frame_count = 60;
+   bool present_fences = false;
+};
+
+struct present_mode_name
+{
+   const char *name;
+   VkPresentModeKHR mode;
+};
+
+const present_mode_name present_mode_names[] = {
+   { "immediate", VK_PRESENT_MODE_IMMEDIATE_KHR },
+   { "mailbox", VK_PRESENT_MODE_MAILBOX_KHR },
+   { "fifo", VK_PRESENT_MODE_FIFO_KHR },
+   { "fifo_relaxed", VK_PRESENT_MODE_FIFO_RELAXED_KHR },
+};
+
+const char *get_present_mode_name(VkPresentModeKHR mode)
+{
+   for (const auto &entry : present_mode_names)
+   {
+      if (entry.mode == mode)
+      {
+         return entry.name;
+      }
+   }
+   return "unknown";
+}
+
+std::vector<bench::option> get_options(options &opts)
+{
+   auto parse_present_mode = [&opts](const char *value) {
+      auto matches = [value](const present_mode_name &entry) { return std::strcmp(entry.name, value) == 0; };
+      auto it = std::find_if(std::begin(present_mode_names), std::end(present_mode_names), matches);
+      if (it == std::end(present_mode_names))
+      {
+         return false;
+      }
+      opts.present_mode = it->mode;
+      return true;
+   };
+
+   return {
+      bench::uint_option("--images", "Minimum number of images of the swapchains (default 3)", opts.image_count),
+      { "--present-mode", "MODE", "immediate, mailbox, fifo or fifo_relaxed (default fifo)", parse_present_mode },
+      bench::uint_option("--threads", "Number of threads, each with its own swapchain (default 1)", opts.thread_count),
+      bench::uint_option("--frames", "Number of frames measured on each thread (default 1000)", opts.frame_count),
+      bench::uint_option("--warmup", "Number of frames presented before measuring (default 60)",
+                         opts.warmup_frame_count, true),
+      bench::flag_option("--present-fences", "Wait on present fences from VK_EXT_swapchain_maintenance1",
+                         opts.present_fences),
+   };
+}
+
+struct context : bench::context
+{
+   options opts;
+};
+
+struct thread_results
+{
+   std::vector<uint64_t> acquire_ns;
+   std::vector<uint64_t> present_ns;
+   uint64_t elapsed_ns = 0;
+};
+
+VkSwapchainKHR create_swapchain(const context &ctx, VkSurfaceKHR surface)
+{
+   VkSurfaceCapabilitiesKHR caps = {};
+   CHECK_VK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(ctx.physical_device, surface, &caps));
+
+   uint32_t format_count = 1;
+   VkSurfaceFormatKHR format = {};
+   CHECK_VK(vkGetPhysicalDeviceSurfaceFormatsKHR(ctx.physical_device, surface, &format_count, &format));
+
+   uint32_t mode_count = 0;
+   CHECK_VK(vkGetPhysicalDeviceSurfacePresentModesKHR(ctx.physical_device, surface, &mode_count, nullptr));
+   std::vector<VkPresentModeKHR> modes(mode_count);
+   CHECK_VK(vkGetPhysicalDeviceSurfacePresentModesKHR(ctx.physical_device, surface, &mode_count, modes.data()));
+   if (std::find(modes.begin(), modes.end(), ctx.opts.present_mode) == modes.end())
+   {
+      std::fprintf(stderr, "Present mode %s is not supported\n", get_present_mode_name(ctx.opts.present_mode));
+      std::exit(EXIT_FAILURE);
+   }
+
+   uint32_t image_count = std::max(ctx.opts.image_count, caps.minImageCount);
+   if (caps.maxImageCount != 0 && image_count > caps.maxImageCount)
+   {
+      std::fprintf(stderr, "At most %" PRIu32 " images are supported\n", caps.maxImageCount);
+      std::exit(EXIT_FAILURE);
+   }
+
+   VkSwapchainCreateInfoKHR swapchain_info = {};
+   swapchain_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+   swapchain_info.surface = surface;
+   swapchain_info.minImageCount = image_count;
+   swapchain_info.imageFormat = format.format;
+   swapchain_info.imageColorSpace = format.colorSpace;
+   swapchain_info.imageExtent = caps.currentExtent.width != UINT32_MAX ? caps.currentExtent : VkExtent2D{ 256, 256 };
+   swapchain_info.imageArrayLayers = 1;
+   swapchain_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+   swapchain_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+   swapchain_info.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+   swapchain_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+   swapchain_info.presentMode = ctx.opts.present_mode;
+   swapchain_info.clipped = VK_TRUE;
+
+   VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+   CHECK_VK(vkCreateSwapchainKHR(ctx.device, &swapchain_info, nullptr, &swapchain));
+   return swapchain;
+}
+
+VkSemaphore create_semaphore(VkDevice device)
+{
+   VkSemaphoreCreateInfo semaphore_info = {};
+   semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+   VkSemaphore semaphore = VK_NULL_HANDLE;
+   CHECK_VK(vkCreateSemaphore(device, &semaphore_info, nullptr, &semaphore));
+   return semaphore;
+}
+
+VkFence create_signaled_fence(VkDevice device)
+{
+   VkFenceCreateInfo fence_info = {};
+   fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+   fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+   VkFence fence = VK_NULL_HANDLE;
+   CHECK_VK(vkCreateFence(device, &fence_info, nullptr, &fence));
+   return fence;
+}
+
+/**
+ * @brief Acquire and present images on a swapchain of its own, recording the time spent in each call.
+ */
+void run_thread(context &ctx, uint32_t thread_index, thread_results &results)
+{
+   VkDevice device = ctx.device;
+   bench::shared_queue &queue = ctx.queues[thread_index % ctx.queues.size()];
+   VkSurfaceKHR surface = bench::create_surface(ctx, nullptr);
+   VkSwapchainKHR swapchain = create_swapchain(ctx, surface);
+
+   uint32_t image_count = 0;
+   CHECK_VK(vkGetSwapchainImagesKHR(device, swapchain, &image_count, nullptr));
+   std::vector<VkImage> images(image_count);
+   CHECK_VK(vkGetSwapchainImagesKHR(device, swapchain, &image_count, images.data()));
+
+   /* The command buffer of each image only moves it to the layout it is presented in. */
+   VkCommandPoolCreateInfo pool_info = {};
+   pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+   pool_info.queueFamilyIndex = ctx.queue_family_index;
+   VkCommandPool pool = VK_NULL_HANDLE;
+   CHECK_VK(vkCreateCommandPool(device, &pool_info, nullptr, &pool));
+
+   VkCommandBufferAllocateInfo command_buffer_info = {};
+   command_buffer_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+   command_buffer_info.commandPool = pool;
+   command_buffer_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+   command_buffer_info.commandBufferCount = image_count;
+   std::vector<VkCommandBuffer> command_buffers(image_count);
+   CHECK_VK(vkAllocateCommandBuffers(device, &command_buffer_info, command_buffers.data()));
+
+   std::vector<VkSemaphore> present_semaphores(image_count);
+   for (uint32_t i = 0; i < image_count; i++)
+   {
+      VkCommandBufferBeginInfo begin_info = {};
+      begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      CHECK_VK(vkBeginCommandBuffer(command_buffers[i], &begin_info));
+
+      VkImageMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.image = images[i];
+      barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+      vkCmdPipelineBarrier(command_buffers[i], VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                           VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+      CHECK_VK(vkEndCommandBuffer(command_buffers[i]));
+
+      present_semaphores[i] = create_semaphore(device);
+   }
+
+   /* One set of synchronization objects per frame in flight, waited on before being reused. */
+   const uint32_t frames_in_flight = image_count;
+   std::vector<VkSemaphore> acquire_semaphores(frames_in_flight);
+   std::vector<VkFence> submit_fences(frames_in_flight);
+   std::vector<VkFence> present_fences(ctx.opts.present_fences ? frames_in_flight : 0);
+   for (uint32_t i = 0; i < frames_in_flight; i++)
+   {
+      acquire_semaphores[i] = create_semaphore(device);
+      submit_fences[i] = create_signaled_fence(device);
+      if (ctx.opts.present_fences)
+      {
+         present_fences[i] = create_signaled_fence(device);
+      }
+   }
+
+   const uint32_t total_frames = ctx.opts.warmup_frame_count + ctx.opts.frame_count;
+   results.acquire_ns.reserve(ctx.opts.frame_count);
+   results.present_ns.reserve(ctx.opts.frame_count);
+   uint64_t start_time = now_ns();
+   for (uint32_t frame = 0; frame < total_frames; frame++)
+   {
+      const bool measured = frame >= ctx.opts.warmup_frame_count;
+      if (frame == ctx.opts.warmup_frame_count)
+      {
+         start_time = now_ns();
+      }
+
+      const uint32_t slot = frame % frames_in_flight;
+      std::vector<VkFence> wait_fences = { submit_fences[slot] };
+      if (ctx.opts.present_fences)
+      {
+         wait_fences.push_back(present_fences[slot]);
+      }
+      CHECK_VK(vkWaitForFences(device, static_cast<uint32_t>(wait_fences.size()), wait_fences.data(), VK_TRUE,
+                               UINT64_MAX));
+      CHECK_VK(vkResetFences(device, static_cast<uint32_t>(wait_fences.size()), wait_fences.data()));
+
+      uint32_t image_index = 0;
+      uint64_t acquire_start = now_ns();
+      CHECK_VK(vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, acquire_semaphores[slot], VK_NULL_HANDLE,
+                                     &image_index));
+      uint64_t acquire_end = now_ns();
+
+      VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+      VkSubmitInfo submit_info = {};
+      submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submit_info.waitSemaphoreCount = 1;
+      submit_info.pWaitSemaphores = &acquire_semaphores[slot];
+      submit_info.pWaitDstStageMask = &wait_stage;
+      submit_info.commandBufferCount = 1;
+      submit_info.pCommandBuffers = &command_buffers[image_index];
+      submit_info.signalSemaphoreCount = 1;
+      submit_info.pSignalSemaphores = &present_semaphores[image_index];
+
+      VkSwapchainPresentFenceInfoEXT present_fence_info = {};
+      present_fence_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT;
+      present_fence_info.swapchainCount = 1;
+      present_fence_info.pFences = ctx.opts.present_fences ? &present_fences[slot] : nullptr;
+
+      VkPresentInfoKHR present_info = {};
+      present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+      present_info.pNext = ctx.opts.present_fences ? &present_fence_info : nullptr;
+      present_info.waitSemaphoreCount = 1;
+      present_info.pWaitSemaphores = &present_semaphores[image_index];
+      present_info.swapchainCount = 1;
+      present_info.pSwapchains = &swapchain;
+      present_info.pImageIndices = &image_index;
+
+      uint64_t present_start = 0;
+      uint64_t present_end = 0;
+      {
+         std::lock_guard<std::mutex> lock(queue.mutex);
+         CHECK_VK(vkQueueSubmit(queue.queue, 1, &submit_info, submit_fences[slot]));
+         present_start = now_ns();
+         CHECK_VK(vkQueuePresentKHR(queue.queue, &present_info));
+         present_end = now_ns();
+      }
+
+      if (measured)
+      {
+         results.acquire_ns.push_back(acquire_end - acquire_start);
+         results.present_ns.push_back(present_end - present_start);
+      }
+   }
+   results.elapsed_ns = now_ns() - start_time;
+
+   {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      CHECK_VK(vkQueueWaitIdle(queue.queue));
+   }
+   std::vector<VkFence> all_fences = submit_fences;
+   all_fences.insert(all_fences.end(), present_fences.begin(), present_fences.end());
+   CHECK_VK(vkWaitForFences(device, static_cast<uint32_t>(all_fences.size()), all_fences.data(), VK_TRUE, UINT64_MAX));
+
+   vkDestroySwapchainKHR(device, swapchain, nullptr);
+   for (VkFence fence : all_fences)
+   {
+      vkDestroyFence(device, fence, nullptr);
+   }
+   for (VkSemaphore semaphore : acquire_semaphores)
+   {
+      vkDestroySemaphore(device, semaphore, nullptr);
+   }
+   for (VkSemaphore semaphore : present_semaphores)
+   {
+      vkDestroySemaphore(device, semaphore, nullptr);
+   }
+   vkDestroyCommandPool(device, pool, nullptr);
+   vkDestroySurfaceKHR(ctx.instance, surface, nullptr);
+}
+
+void print_latencies(const char *name, std::vector<uint64_t> &samples)
+{
+   std::sort(samples.begin(), samples.end());
+   auto percentile = [&samples](double p) {
+      size_t index = static_cast<size_t>(p * static_cast<double>(samples.size() - 1) + 0.5);
+      return static_cast<double>(samples[index]) / 1000.0;
+   };
+   std::printf("%-22s p50 %8.2f us  p90 %8.2f us  p99 %8.2f us  p99.9 %8.2f us  max %8.2f us\n", name,
+               percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), percentile(1.0));
+}
+
+} /* anonymous namespace */
+
+int main(int argc, char **argv)
+{
+   context ctx;
+   const std::vector<bench::option> opts = get_options(ctx.opts);
+   if (!bench::parse_options(argc, argv, opts))
+   {
+      bench::print_usage(argv[0], opts);
+      return EXIT_FAILURE;
+   }
+
+   bench::context_create_info create_info;
+   create_info.application_name = "wsi_layer_bench";
+   create_info.queue_count = ctx.opts.thread_count;
+   VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT maintenance1_features = {};
+   maintenance1_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT;
+   maintenance1_features.swapchainMaintenance1 = VK_TRUE;
+   if (ctx.opts.present_fences)
+   {
+      create_info.instance_extensions = { VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME,
+                                          VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME };
+      create_info.device_extensions = { VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME };
+      create_info.device_features = &maintenance1_features;
+   }
+   bench::create_context(create_info, ctx);
+
+   std::vector<thread_results> results(ctx.opts.thread_count);
+   std::vector<std::thread> threads;
+   for (uint32_t i = 0; i < ctx.opts.thread_count; i++)
+   {
+      threads.emplace_back(run_thread, std::ref(ctx), i, std::ref(results[i]));
+   }
+   for (auto &thread : threads)
+   {
+      thread.join();
+   }
+
+   bench::destroy_context(ctx);
+
+   std::vector<uint64_t> acquire_ns;
+   std::vector<uint64_t> present_ns;
+   double fps = 0.0;
+   for (const auto &result : results)
+   {
+      acquire_ns.insert(acquire_ns.end(), result.acquire_ns.begin(), result.acquire_ns.end());
+      present_ns.insert(present_ns.end(), result.present_ns.begin(), result.present_ns.end());
+      fps += static_cast<double>(result.acquire_ns.size()) * 1e9 / static_cast<double>(result.elapsed_ns);
+   }
+
+   std::printf("images %" PRIu32 ", present mode %s, threads %" PRIu32 ", frames %" PRIu32 ", present fences %s\n",
+               ctx.opts.image_count, get_present_mode_name(ctx.opts.present_mode), ctx.opts.thread_count,
+               ctx.opts.frame_count, ctx.opts.present_fences ? "on" : "off");
+   print_latencies("vkAcquireNextImageKHR", acquire_ns);
+   print_latencies("vkQueuePresentKHR", present_ns);
+   std::printf("frames per second     %.1f (%.1f per thread)\n", fps, fps / ctx.opts.thread_count);
+   return EXIT_SUCCESS;
+}
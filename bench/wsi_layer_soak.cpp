@@ -0,0 +1,726 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file wsi_layer_soak.cpp
+ *
+ * @brief Multi-threaded stress test of the layer on headless surfaces, reporting the tail latency of its entrypoints.
+ *
+ * Each thread creates several headless surfaces and swapchains, then acquires and presents images on them in turn
+ * until the duration of the test has elapsed. Along the way, swapchains are recreated with oldSwapchain, switch
+ * between present modes with VkSwapchainPresentModeInfoEXT and give acquired images back with
+ * vkReleaseSwapchainImagesEXT, so that these paths run concurrently with the presents of the other threads.
+ *
+ * For each entrypoint, the test reports the latency percentiles and the number of calls that blocked, which is the
+ * number of calls during which the thread was switched out voluntarily, waiting on a lock or for an image. Host
+ * allocations go through counting allocation callbacks, so that allocations that are still live once everything has
+ * been destroyed are reported as leaks. The test fails if the layer returns an error, hands out an image that is
+ * already acquired or leaks allocations.
+ *
+ * The layer must be found by the Vulkan loader, for example by setting VK_ADD_LAYER_PATH to the build directory.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <vulkan/vulkan.h>
+
+#include "bench_common.hpp"
+
+using bench::now_ns;
+
+namespace
+{
+
+struct options
+{
+   uint32_t thread_count = 4;
+   uint32_t swapchain_count = 2;
+   uint32_t image_count = 3;
+   uint32_t duration_s = 10;
+   uint32_t recreate_interval = 100;
+   uint32_t switch_interval = 10;
+   uint32_t release_interval = 25;
+};
+
+std::vector<bench::option> get_options(options &opts)
+{
+   return {
+      bench::uint_option("--threads", "Number of threads (default 4)", opts.thread_count),
+      bench::uint_option("--swapchains", "Number of swapchains of each thread (default 2)", opts.swapchain_count),
+      bench::uint_option("--images", "Minimum number of images of the swapchains (default 3)", opts.image_count),
+      bench::uint_option("--duration", "Duration of the test in seconds (default 10)", opts.duration_s),
+      bench::uint_option("--recreate-interval",
+                         "Frames between recreations of a swapchain, 0 to disable (default 100)",
+                         opts.recreate_interval, true),
+      bench::uint_option("--switch-interval", "Frames between present mode switches, 0 to disable (default 10)",
+                         opts.switch_interval, true),
+      bench::uint_option("--release-interval",
+                         "Frames between releases of an acquired image, 0 to disable (default 25)",
+                         opts.release_interval, true),
+   };
+}
+
+/**
+ * @brief Number of times the calling thread gave up the CPU voluntarily, which it does when blocking on a futex.
+ */
+uint64_t get_voluntary_context_switches()
+{
+   struct rusage usage = {};
+   getrusage(RUSAGE_THREAD, &usage);
+   return static_cast<uint64_t>(usage.ru_nvcsw);
+}
+
+/**
+ * @brief Host allocation callbacks counting the allocations that are live.
+ */
+class allocation_counter
+{
+public:
+   allocation_counter()
+   {
+      m_callbacks.pUserData = this;
+      m_callbacks.pfnAllocation = allocate;
+      m_callbacks.pfnReallocation = reallocate;
+      m_callbacks.pfnFree = free;
+   }
+
+   const VkAllocationCallbacks *get_callbacks() const
+   {
+      return &m_callbacks;
+   }
+
+   int64_t get_live_allocations() const
+   {
+      return m_live_allocations.load(std::memory_order_relaxed);
+   }
+
+   int64_t get_live_bytes() const
+   {
+      return m_live_bytes.load(std::memory_order_relaxed);
+   }
+
+   uint64_t get_total_allocations() const
+   {
+      return m_total_allocations.load(std::memory_order_relaxed);
+   }
+
+private:
+   /* Stored in front of each allocation, to free it and to know how much to copy when reallocating. */
+   struct header
+   {
+      void *block;
+      size_t size;
+   };
+
+   static VKAPI_ATTR void *VKAPI_CALL allocate(void *user_data, size_t size, size_t alignment,
+                                               VkSystemAllocationScope)
+   {
+      alignment = std::max(alignment, alignof(header));
+      void *block = std::malloc(sizeof(header) + alignment + size);
+      if (block == nullptr)
+      {
+         return nullptr;
+      }
+
+      uintptr_t address = reinterpret_cast<uintptr_t>(block) + sizeof(header);
+      address = (address + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+      auto *memory = reinterpret_cast<void *>(address);
+      *get_header(memory) = header{ block, size };
+
+      auto *counter = static_cast<allocation_counter *>(user_data);
+      counter->m_live_allocations.fetch_add(1, std::memory_order_relaxed);
+      counter->m_live_bytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+      counter->m_total_allocations.fetch_add(1, std::memory_order_relaxed);
+      return memory;
+   }
+
+   static VKAPI_ATTR void *VKAPI_CALL reallocate(void *user_data, void *original, size_t size, size_t alignment,
+                                                 VkSystemAllocationScope scope)
+   {
+      if (original == nullptr)
+      {
+         return allocate(user_data, size, alignment, scope);
+      }
+      if (size == 0)
+      {
+         free(user_data, original);
+         return nullptr;
+      }
+
+      void *memory = allocate(user_data, size, alignment, scope);
+      if (memory != nullptr)
+      {
+         std::memcpy(memory, original, std::min(size, get_header(original)->size));
+         free(user_data, original);
+      }
+      return memory;
+   }
+
+   static VKAPI_ATTR void VKAPI_CALL free(void *user_data, void *memory)
+   {
+      if (memory == nullptr)
+      {
+         return;
+      }
+
+      const header allocation = *get_header(memory);
+      auto *counter = static_cast<allocation_counter *>(user_data);
+      counter->m_live_allocations.fetch_sub(1, std::memory_order_relaxed);
+      counter->m_live_bytes.fetch_sub(static_cast<int64_t>(allocation.size), std::memory_order_relaxed);
+      std::free(allocation.block);
+   }
+
+   static header *get_header(void *memory)
+   {
+      return reinterpret_cast<header *>(static_cast<char *>(memory) - sizeof(header));
+   }
+
+   VkAllocationCallbacks m_callbacks = {};
+   std::atomic<int64_t> m_live_allocations{ 0 };
+   std::atomic<int64_t> m_live_bytes{ 0 };
+   std::atomic<uint64_t> m_total_allocations{ 0 };
+};
+
+/**
+ * @brief The entrypoints whose latency is measured.
+ */
+enum class entrypoint
+{
+   acquire,
+   present,
+   create_swapchain,
+   destroy_swapchain,
+   release_images,
+   count,
+};
+
+const char *const entrypoint_names[] = {
+   "vkAcquireNextImageKHR", "vkQueuePresentKHR", "vkCreateSwapchainKHR", "vkDestroySwapchainKHR",
+   "vkReleaseSwapchainImagesEXT",
+};
+static_assert(sizeof(entrypoint_names) / sizeof(entrypoint_names[0]) == static_cast<size_t>(entrypoint::count),
+              "Every entrypoint needs a name");
+
+struct entrypoint_samples
+{
+   std::vector<uint64_t> latency_ns;
+   uint64_t blocked_calls = 0;
+};
+
+struct thread_results
+{
+   std::array<entrypoint_samples, static_cast<size_t>(entrypoint::count)> entrypoints;
+   uint64_t frames = 0;
+   uint64_t recreations = 0;
+   uint64_t present_mode_switches = 0;
+   uint64_t released_images = 0;
+   /* Images handed out by vkAcquireNextImageKHR while the application still held them. */
+   uint64_t double_acquires = 0;
+};
+
+/**
+ * @brief Call a function, recording its latency and whether it blocked.
+ */
+template <typename Function>
+VkResult measure(thread_results &results, entrypoint ep, Function &&function)
+{
+   const uint64_t switches_start = get_voluntary_context_switches();
+   const uint64_t start = now_ns();
+   const VkResult result = function();
+   const uint64_t end = now_ns();
+
+   entrypoint_samples &samples = results.entrypoints[static_cast<size_t>(ep)];
+   samples.latency_ns.push_back(end - start);
+   if (get_voluntary_context_switches() != switches_start)
+   {
+      samples.blocked_calls++;
+   }
+   return result;
+}
+
+struct context : bench::context
+{
+   options opts;
+   allocation_counter instance_allocations;
+   allocation_counter swapchain_allocations;
+   PFN_vkReleaseSwapchainImagesEXT release_swapchain_images = nullptr;
+   /* The present modes the swapchains switch between, which must be compatible with each other. */
+   std::array<VkPresentModeKHR, 2> present_modes = { VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR };
+};
+
+VkSurfaceKHR create_surface(context &ctx)
+{
+   return bench::create_surface(ctx, ctx.swapchain_allocations.get_callbacks());
+}
+
+void create_context(context &ctx)
+{
+   VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT maintenance1_features = {};
+   maintenance1_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT;
+   maintenance1_features.swapchainMaintenance1 = VK_TRUE;
+
+   bench::context_create_info create_info;
+   create_info.application_name = "wsi_layer_soak";
+   create_info.instance_extensions = { VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME,
+                                       VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME };
+   create_info.device_extensions = { VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME };
+   create_info.device_features = &maintenance1_features;
+   create_info.queue_count = ctx.opts.thread_count;
+   create_info.allocator = ctx.instance_allocations.get_callbacks();
+   bench::create_context(create_info, ctx);
+
+   VkSurfaceKHR surface = create_surface(ctx);
+   uint32_t mode_count = 0;
+   CHECK_VK(vkGetPhysicalDeviceSurfacePresentModesKHR(ctx.physical_device, surface, &mode_count, nullptr));
+   std::vector<VkPresentModeKHR> modes(mode_count);
+   CHECK_VK(vkGetPhysicalDeviceSurfacePresentModesKHR(ctx.physical_device, surface, &mode_count, modes.data()));
+   vkDestroySurfaceKHR(ctx.instance, surface, ctx.swapchain_allocations.get_callbacks());
+   for (VkPresentModeKHR mode : ctx.present_modes)
+   {
+      if (std::find(modes.begin(), modes.end(), mode) == modes.end())
+      {
+         std::fprintf(stderr, "Present mode %d is not supported\n", static_cast<int>(mode));
+         std::exit(EXIT_FAILURE);
+      }
+   }
+
+   ctx.release_swapchain_images = reinterpret_cast<PFN_vkReleaseSwapchainImagesEXT>(
+      vkGetDeviceProcAddr(ctx.device, "vkReleaseSwapchainImagesEXT"));
+   if (ctx.release_swapchain_images == nullptr)
+   {
+      std::fprintf(stderr, "vkReleaseSwapchainImagesEXT is not available\n");
+      std::exit(EXIT_FAILURE);
+   }
+}
+
+VkSemaphore create_semaphore(VkDevice device)
+{
+   VkSemaphoreCreateInfo semaphore_info = {};
+   semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+   VkSemaphore semaphore = VK_NULL_HANDLE;
+   CHECK_VK(vkCreateSemaphore(device, &semaphore_info, nullptr, &semaphore));
+   return semaphore;
+}
+
+VkFence create_fence(VkDevice device, bool signaled)
+{
+   VkFenceCreateInfo fence_info = {};
+   fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+   fence_info.flags = signaled ? VK_FENCE_CREATE_SIGNALED_BIT : 0;
+   VkFence fence = VK_NULL_HANDLE;
+   CHECK_VK(vkCreateFence(device, &fence_info, nullptr, &fence));
+   return fence;
+}
+
+/**
+ * @brief A swapchain together with the objects used to render to and present its images.
+ */
+struct swapchain_state
+{
+   VkSurfaceKHR surface = VK_NULL_HANDLE;
+   VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+   VkCommandPool pool = VK_NULL_HANDLE;
+   std::vector<VkCommandBuffer> command_buffers;
+   std::vector<VkSemaphore> present_semaphores;
+   /* Whether the application holds each image, to check that the layer does not hand it out twice. */
+   std::vector<bool> acquired;
+   uint32_t present_mode_index = 0;
+   uint64_t frames = 0;
+};
+
+/**
+ * @brief Create the swapchain of a state, replacing its current one if any, and record the command buffers of its
+ * images.
+ *
+ * The caller must have waited for the previous swapchain's images to be done with.
+ */
+void create_swapchain(context &ctx, swapchain_state &state, thread_results &results)
+{
+   VkDevice device = ctx.device;
+   VkSurfaceCapabilitiesKHR caps = {};
+   CHECK_VK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(ctx.physical_device, state.surface, &caps));
+
+   uint32_t format_count = 1;
+   VkSurfaceFormatKHR format = {};
+   CHECK_VK(vkGetPhysicalDeviceSurfaceFormatsKHR(ctx.physical_device, state.surface, &format_count, &format));
+
+   uint32_t image_count = std::max(ctx.opts.image_count, caps.minImageCount);
+   if (caps.maxImageCount != 0 && image_count > caps.maxImageCount)
+   {
+      std::fprintf(stderr, "At most %" PRIu32 " images are supported\n", caps.maxImageCount);
+      std::exit(EXIT_FAILURE);
+   }
+
+   VkSwapchainPresentModesCreateInfoEXT present_modes_info = {};
+   present_modes_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_MODES_CREATE_INFO_EXT;
+   present_modes_info.presentModeCount = static_cast<uint32_t>(ctx.present_modes.size());
+   present_modes_info.pPresentModes = ctx.present_modes.data();
+
+   VkSwapchainCreateInfoKHR swapchain_info = {};
+   swapchain_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+   swapchain_info.pNext = &present_modes_info;
+   swapchain_info.surface = state.surface;
+   swapchain_info.minImageCount = image_count;
+   swapchain_info.imageFormat = format.format;
+   swapchain_info.imageColorSpace = format.colorSpace;
+   swapchain_info.imageExtent = caps.currentExtent.width != UINT32_MAX ? caps.currentExtent : VkExtent2D{ 256, 256 };
+   swapchain_info.imageArrayLayers = 1;
+   swapchain_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+   swapchain_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+   swapchain_info.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+   swapchain_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+   swapchain_info.presentMode = ctx.present_modes[state.present_mode_index];
+   swapchain_info.clipped = VK_TRUE;
+   swapchain_info.oldSwapchain = state.swapchain;
+
+   VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+   CHECK_VK(measure(results, entrypoint::create_swapchain, [&]() {
+      return vkCreateSwapchainKHR(device, &swapchain_info, ctx.swapchain_allocations.get_callbacks(), &swapchain);
+   }));
+
+   if (state.swapchain != VK_NULL_HANDLE)
+   {
+      measure(results, entrypoint::destroy_swapchain, [&]() {
+         vkDestroySwapchainKHR(device, state.swapchain, ctx.swapchain_allocations.get_callbacks());
+         return VK_SUCCESS;
+      });
+      for (VkSemaphore semaphore : state.present_semaphores)
+      {
+         vkDestroySemaphore(device, semaphore, nullptr);
+      }
+      vkFreeCommandBuffers(device, state.pool, static_cast<uint32_t>(state.command_buffers.size()),
+                           state.command_buffers.data());
+   }
+   state.swapchain = swapchain;
+
+   CHECK_VK(vkGetSwapchainImagesKHR(device, swapchain, &image_count, nullptr));
+   std::vector<VkImage> images(image_count);
+   CHECK_VK(vkGetSwapchainImagesKHR(device, swapchain, &image_count, images.data()));
+
+   /* The command buffer of each image only moves it to the layout it is presented in. */
+   VkCommandBufferAllocateInfo command_buffer_info = {};
+   command_buffer_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+   command_buffer_info.commandPool = state.pool;
+   command_buffer_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+   command_buffer_info.commandBufferCount = image_count;
+   state.command_buffers.resize(image_count);
+   CHECK_VK(vkAllocateCommandBuffers(device, &command_buffer_info, state.command_buffers.data()));
+
+   state.present_semaphores.resize(image_count);
+   for (uint32_t i = 0; i < image_count; i++)
+   {
+      VkCommandBufferBeginInfo begin_info = {};
+      begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      CHECK_VK(vkBeginCommandBuffer(state.command_buffers[i], &begin_info));
+
+      VkImageMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.image = images[i];
+      barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+      vkCmdPipelineBarrier(state.command_buffers[i], VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                           VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+      CHECK_VK(vkEndCommandBuffer(state.command_buffers[i]));
+
+      state.present_semaphores[i] = create_semaphore(device);
+   }
+   state.acquired.assign(image_count, false);
+}
+
+/**
+ * @brief Acquire an image and check that the application did not hold it already.
+ */
+uint32_t acquire_image(context &ctx, swapchain_state &state, VkSemaphore semaphore, VkFence fence,
+                       thread_results &results)
+{
+   uint32_t image_index = 0;
+   CHECK_VK(measure(results, entrypoint::acquire, [&]() {
+      return vkAcquireNextImageKHR(ctx.device, state.swapchain, UINT64_MAX, semaphore, fence, &image_index);
+   }));
+   if (image_index >= state.acquired.size() || state.acquired[image_index])
+   {
+      results.double_acquires++;
+   }
+   else
+   {
+      state.acquired[image_index] = true;
+   }
+   return image_index;
+}
+
+/**
+ * @brief Run one of the swapchains of a thread through their frames in turn, until the test ends.
+ */
+void run_thread(context &ctx, uint32_t thread_index, uint64_t end_time, thread_results &results)
+{
+   VkDevice device = ctx.device;
+   bench::shared_queue &queue = ctx.queues[thread_index % ctx.queues.size()];
+
+   VkCommandPoolCreateInfo pool_info = {};
+   pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+   pool_info.queueFamilyIndex = ctx.queue_family_index;
+
+   std::vector<swapchain_state> states(ctx.opts.swapchain_count);
+   for (auto &state : states)
+   {
+      state.surface = create_surface(ctx);
+      CHECK_VK(vkCreateCommandPool(device, &pool_info, nullptr, &state.pool));
+      create_swapchain(ctx, state, results);
+   }
+
+   /* One set of synchronization objects per frame in flight, waited on before being reused. */
+   const uint32_t frames_in_flight = ctx.opts.image_count;
+   std::vector<VkSemaphore> acquire_semaphores(frames_in_flight);
+   std::vector<VkFence> submit_fences(frames_in_flight);
+   for (uint32_t i = 0; i < frames_in_flight; i++)
+   {
+      acquire_semaphores[i] = create_semaphore(device);
+      submit_fences[i] = create_fence(device, true);
+   }
+   VkFence release_fence = create_fence(device, false);
+
+   /* Wait until the swapchain images are no longer used by the device, before replacing the swapchain. */
+   auto wait_idle = [&]() {
+      CHECK_VK(vkWaitForFences(device, frames_in_flight, submit_fences.data(), VK_TRUE, UINT64_MAX));
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      CHECK_VK(vkQueueWaitIdle(queue.queue));
+   };
+
+   for (uint64_t frame = 0; now_ns() < end_time; frame++)
+   {
+      swapchain_state &state = states[frame % states.size()];
+      state.frames++;
+
+      if (ctx.opts.recreate_interval != 0 && state.frames % ctx.opts.recreate_interval == 0)
+      {
+         wait_idle();
+         create_swapchain(ctx, state, results);
+         results.recreations++;
+      }
+
+      /* Give an image back without presenting it, as an application that skips a frame would. */
+      if (ctx.opts.release_interval != 0 && state.frames % ctx.opts.release_interval == 0)
+      {
+         const uint32_t released_index = acquire_image(ctx, state, VK_NULL_HANDLE, release_fence, results);
+         CHECK_VK(vkWaitForFences(device, 1, &release_fence, VK_TRUE, UINT64_MAX));
+         CHECK_VK(vkResetFences(device, 1, &release_fence));
+
+         VkReleaseSwapchainImagesInfoEXT release_info = {};
+         release_info.sType = VK_STRUCTURE_TYPE_RELEASE_SWAPCHAIN_IMAGES_INFO_EXT;
+         release_info.swapchain = state.swapchain;
+         release_info.imageIndexCount = 1;
+         release_info.pImageIndices = &released_index;
+         CHECK_VK(measure(results, entrypoint::release_images,
+                          [&]() { return ctx.release_swapchain_images(device, &release_info); }));
+         state.acquired[released_index] = false;
+         results.released_images++;
+      }
+
+      if (ctx.opts.switch_interval != 0 && state.frames % ctx.opts.switch_interval == 0)
+      {
+         state.present_mode_index = (state.present_mode_index + 1) % ctx.present_modes.size();
+         results.present_mode_switches++;
+      }
+
+      const uint32_t slot = frame % frames_in_flight;
+      CHECK_VK(vkWaitForFences(device, 1, &submit_fences[slot], VK_TRUE, UINT64_MAX));
+      CHECK_VK(vkResetFences(device, 1, &submit_fences[slot]));
+
+      uint32_t image_index = acquire_image(ctx, state, acquire_semaphores[slot], VK_NULL_HANDLE, results);
+
+      VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+      VkSubmitInfo submit_info = {};
+      submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submit_info.waitSemaphoreCount = 1;
+      submit_info.pWaitSemaphores = &acquire_semaphores[slot];
+      submit_info.pWaitDstStageMask = &wait_stage;
+      submit_info.commandBufferCount = 1;
+      submit_info.pCommandBuffers = &state.command_buffers[image_index];
+      submit_info.signalSemaphoreCount = 1;
+      submit_info.pSignalSemaphores = &state.present_semaphores[image_index];
+
+      VkSwapchainPresentModeInfoEXT present_mode_info = {};
+      present_mode_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_MODE_INFO_EXT;
+      present_mode_info.swapchainCount = 1;
+      present_mode_info.pPresentModes = &ctx.present_modes[state.present_mode_index];
+
+      VkPresentInfoKHR present_info = {};
+      present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+      present_info.pNext = &present_mode_info;
+      present_info.waitSemaphoreCount = 1;
+      present_info.pWaitSemaphores = &state.present_semaphores[image_index];
+      present_info.swapchainCount = 1;
+      present_info.pSwapchains = &state.swapchain;
+      present_info.pImageIndices = &image_index;
+
+      {
+         std::lock_guard<std::mutex> lock(queue.mutex);
+         CHECK_VK(vkQueueSubmit(queue.queue, 1, &submit_info, submit_fences[slot]));
+         CHECK_VK(measure(results, entrypoint::present,
+                          [&]() { return vkQueuePresentKHR(queue.queue, &present_info); }));
+      }
+      state.acquired[image_index] = false;
+      results.frames++;
+   }
+
+   wait_idle();
+   for (auto &state : states)
+   {
+      measure(results, entrypoint::destroy_swapchain, [&]() {
+         vkDestroySwapchainKHR(device, state.swapchain, ctx.swapchain_allocations.get_callbacks());
+         return VK_SUCCESS;
+      });
+      for (VkSemaphore semaphore : state.present_semaphores)
+      {
+         vkDestroySemaphore(device, semaphore, nullptr);
+      }
+      vkDestroyCommandPool(device, state.pool, nullptr);
+      vkDestroySurfaceKHR(ctx.instance, state.surface, ctx.swapchain_allocations.get_callbacks());
+   }
+   for (VkFence fence : submit_fences)
+   {
+      vkDestroyFence(device, fence, nullptr);
+   }
+   vkDestroyFence(device, release_fence, nullptr);
+   for (VkSemaphore semaphore : acquire_semaphores)
+   {
+      vkDestroySemaphore(device, semaphore, nullptr);
+   }
+}
+
+void print_latencies(const char *name, entrypoint_samples &samples)
+{
+   std::vector<uint64_t> &latencies = samples.latency_ns;
+   if (latencies.empty())
+   {
+      std::printf("%-28s %10d\n", name, 0);
+      return;
+   }
+
+   std::sort(latencies.begin(), latencies.end());
+   auto percentile = [&latencies](double p) {
+      size_t index = static_cast<size_t>(p * static_cast<double>(latencies.size() - 1) + 0.5);
+      return static_cast<double>(latencies[index]) / 1000.0;
+   };
+   std::printf("%-28s %10zu %10.2f %10.2f %10.2f %10.2f %10" PRIu64 "\n", name, latencies.size(), percentile(0.5),
+               percentile(0.99), percentile(0.999), percentile(1.0), samples.blocked_calls);
+}
+
+} /* anonymous namespace */
+
+int main(int argc, char **argv)
+{
+   context ctx;
+   const std::vector<bench::option> opts = get_options(ctx.opts);
+   if (!bench::parse_options(argc, argv, opts))
+   {
+      bench::print_usage(argv[0], opts);
+      return EXIT_FAILURE;
+   }
+
+   create_context(ctx);
+
+   const uint64_t end_time = now_ns() + static_cast<uint64_t>(ctx.opts.duration_s) * 1000000000ull;
+   std::vector<thread_results> results(ctx.opts.thread_count);
+   std::vector<std::thread> threads;
+   for (uint32_t i = 0; i < ctx.opts.thread_count; i++)
+   {
+      threads.emplace_back(run_thread, std::ref(ctx), i, end_time, std::ref(results[i]));
+   }
+   for (auto &thread : threads)
+   {
+      thread.join();
+   }
+
+   /* Everything created with the swapchain callbacks has been destroyed by now, whatever is left has leaked. */
+   const int64_t leaked_swapchain_allocations = ctx.swapchain_allocations.get_live_allocations();
+   const int64_t leaked_swapchain_bytes = ctx.swapchain_allocations.get_live_bytes();
+   bench::destroy_context(ctx);
+   const int64_t leaked_instance_allocations = ctx.instance_allocations.get_live_allocations();
+   const int64_t leaked_instance_bytes = ctx.instance_allocations.get_live_bytes();
+
+   thread_results total;
+   for (auto &result : results)
+   {
+      for (size_t i = 0; i < total.entrypoints.size(); i++)
+      {
+         auto &samples = total.entrypoints[i];
+         samples.latency_ns.insert(samples.latency_ns.end(), result.entrypoints[i].latency_ns.begin(),
+                                   result.entrypoints[i].latency_ns.end());
+         samples.blocked_calls += result.entrypoints[i].blocked_calls;
+      }
+      total.frames += result.frames;
+      total.recreations += result.recreations;
+      total.present_mode_switches += result.present_mode_switches;
+      total.released_images += result.released_images;
+      total.double_acquires += result.double_acquires;
+   }
+
+   std::printf("threads %" PRIu32 ", swapchains per thread %" PRIu32 ", images %" PRIu32 ", duration %" PRIu32 " s\n",
+               ctx.opts.thread_count, ctx.opts.swapchain_count, ctx.opts.image_count, ctx.opts.duration_s);
+   std::printf("%-28s %10s %10s %10s %10s %10s %10s\n", "entrypoint", "calls", "p50 us", "p99 us", "p99.9 us",
+               "max us", "blocked");
+   for (size_t i = 0; i < total.entrypoints.size(); i++)
+   {
+      print_latencies(entrypoint_names[i], total.entrypoints[i]);
+   }
+   std::printf("frames %" PRIu64 ", recreations %" PRIu64 ", present mode switches %" PRIu64
+               ", released images %" PRIu64 "\n",
+               total.frames, total.recreations, total.present_mode_switches, total.released_images);
+   std::printf("host allocations %" PRIu64 " by surfaces and swapchains, %" PRIu64 " by the instance and device\n",
+               ctx.swapchain_allocations.get_total_allocations(), ctx.instance_allocations.get_total_allocations());
+   std::printf("leaked allocations %" PRId64 " (%" PRId64 " bytes) by surfaces and swapchains, %" PRId64 " (%" PRId64
+               " bytes) by the instance and device\n",
+               leaked_swapchain_allocations, leaked_swapchain_bytes, leaked_instance_allocations,
+               leaked_instance_bytes);
+
+   bool failed = false;
+   if (total.double_acquires != 0)
+   {
+      std::fprintf(stderr, "%" PRIu64 " images were acquired while the application held them\n",
+                   total.double_acquires);
+      failed = true;
+   }
+   if (leaked_swapchain_allocations != 0 || leaked_instance_allocations != 0)
+   {
+      std::fprintf(stderr, "Host allocations leaked\n");
+      failed = true;
+   }
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
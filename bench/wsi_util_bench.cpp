@@ -0,0 +1,740 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file wsi_util_bench.cpp
+ *
+ * @brief Microbenchmarks of the util primitives and of the fence cycles the layer runs for every present.
+ *
+ * Each benchmark runs its loop for a number of iterations that grows until the loop takes at least the minimum time,
+ * then reports the real and CPU time of one iteration. The results can also be written as JSON, in the format of
+ * Google Benchmark, so that they can be compared between builds with its tools.
+ *
+ * The fence benchmarks create a device through the Vulkan loader, without the layer, and run the Vulkan calls that
+ * wsi::fence_sync and wsi::sync_fd_fence_sync make when a payload is set, waited and exported. They are skipped if
+ * there is no device, or if its fences cannot be exported as sync FDs.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <vulkan/vulkan.h>
+
+#include "bench_common.hpp"
+#include "util/custom_allocator.hpp"
+#include "util/flat_map.hpp"
+#include "util/ring_buffer.hpp"
+#include "util/spsc_ring_buffer.hpp"
+#include "util/timed_semaphore.hpp"
+#include "util/unordered_map.hpp"
+#include "util/unordered_set.hpp"
+
+#if WSI_BENCH_DRM_UTILS
+#include "util/drm/drm_utils.hpp"
+#endif
+
+using bench::benchmark_result;
+using bench::now_ns;
+
+namespace
+{
+
+struct options
+{
+   uint32_t min_time_ms = 500;
+   uint32_t repetitions = 1;
+   const char *filter = nullptr;
+   const char *json_path = nullptr;
+};
+
+std::vector<bench::option> get_options(options &opts)
+{
+   return {
+      bench::uint_option("--min-time-ms", "Minimum time each benchmark runs for, in milliseconds (default 500)",
+                         opts.min_time_ms),
+      bench::uint_option("--repetitions", "Number of times each benchmark is run (default 1)", opts.repetitions),
+      bench::string_option("--filter", "STRING", "Only run the benchmarks whose name contains STRING", opts.filter),
+      bench::string_option("--json", "FILE", "Also write the results as JSON to FILE, - for the standard output",
+                           opts.json_path),
+   };
+}
+
+uint64_t timespec_to_ns(const timespec &ts)
+{
+   return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+uint64_t thread_cpu_ns()
+{
+   timespec ts = {};
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+   return timespec_to_ns(ts);
+}
+
+/**
+ * @brief Keep the compiler from removing the computation of a value that the benchmark does not otherwise use.
+ */
+template <typename T>
+inline void do_not_optimize(const T &value)
+{
+   asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * @brief Times the loop of a benchmark, which starts it after its setup and stops it before its teardown.
+ */
+class timer
+{
+public:
+   void start()
+   {
+      m_real_start = now_ns();
+      m_cpu_start = thread_cpu_ns();
+   }
+
+   void stop()
+   {
+      m_cpu_ns = thread_cpu_ns() - m_cpu_start;
+      m_real_ns = now_ns() - m_real_start;
+   }
+
+   uint64_t real_ns() const
+   {
+      return m_real_ns;
+   }
+
+   uint64_t cpu_ns() const
+   {
+      return m_cpu_ns;
+   }
+
+private:
+   uint64_t m_real_start = 0;
+   uint64_t m_cpu_start = 0;
+   uint64_t m_real_ns = 0;
+   uint64_t m_cpu_ns = 0;
+};
+
+struct benchmark
+{
+   std::string name;
+   std::function<void(uint64_t iterations, timer &t)> run;
+};
+
+/**
+ * @brief Run a benchmark with more iterations each time until its loop lasts the minimum time.
+ *
+ * As in Google Benchmark, the next number of iterations is predicted from the time of the last run, with some margin,
+ * but grows by at most 10 times so that a noisy short run does not make the next one very long.
+ */
+benchmark_result run_benchmark(const benchmark &bench, uint32_t repetition, uint64_t min_time_ns)
+{
+   constexpr uint64_t max_iterations = 1000000000;
+   uint64_t iterations = 1;
+   while (true)
+   {
+      timer t;
+      bench.run(iterations, t);
+      if (t.real_ns() >= min_time_ns || iterations >= max_iterations)
+      {
+         return { bench.name, repetition, iterations, static_cast<double>(t.real_ns()) / iterations,
+                  static_cast<double>(t.cpu_ns()) / iterations };
+      }
+
+      const double multiplier = t.real_ns() == 0 ? 10.0 :
+                                                   std::min(10.0, 1.4 * min_time_ns / static_cast<double>(t.real_ns()));
+      iterations = std::min(max_iterations, std::max(iterations + 1, static_cast<uint64_t>(iterations * multiplier)));
+   }
+}
+
+/* Keys that look like the handles the layer keys its maps with, which are mostly alignment zeros in their low bits. */
+constexpr uint64_t handle_base = 0x7f3a10000000ull;
+constexpr uint64_t handle_stride = 0x1000;
+constexpr uint64_t map_size = 64;
+
+uint64_t handle_key(uint64_t i)
+{
+   return handle_base + (i % map_size) * handle_stride;
+}
+
+uint64_t missing_handle_key(uint64_t i)
+{
+   return handle_base + (map_size + i % map_size) * handle_stride;
+}
+
+void add_container_benchmarks(std::vector<benchmark> &benchmarks)
+{
+   benchmarks.push_back({ "ring_buffer/push_pop", [](uint64_t iterations, timer &t) {
+                            util::ring_buffer<uint64_t, 8> buffer;
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               buffer.push_back(i);
+                               auto item = buffer.pop_front();
+                               do_not_optimize(item);
+                            }
+                            t.stop();
+                         } });
+
+   benchmarks.push_back({ "ring_buffer/fill_drain", [](uint64_t iterations, timer &t) {
+                            util::ring_buffer<uint64_t, 8> buffer;
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               while (buffer.push_back(i))
+                               {
+                               }
+                               while (auto item = buffer.pop_front())
+                               {
+                                  do_not_optimize(item);
+                               }
+                            }
+                            t.stop();
+                         } });
+
+   benchmarks.push_back({ "spsc_ring_buffer/push_pop", [](uint64_t iterations, timer &t) {
+                            util::spsc_ring_buffer<uint64_t, 8> buffer;
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               buffer.push_back(i);
+                               auto item = buffer.pop_front();
+                               do_not_optimize(item);
+                            }
+                            t.stop();
+                         } });
+
+   benchmarks.push_back({ "unordered_map/try_insert_erase", [](uint64_t iterations, timer &t) {
+                            util::unordered_map<uint64_t, uint64_t> map(util::allocator::get_generic());
+                            for (uint64_t i = 0; i < map_size; i++)
+                            {
+                               map.try_insert({ handle_key(i), i });
+                            }
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               auto inserted = map.try_insert({ missing_handle_key(i), i });
+                               do_not_optimize(inserted);
+                               map.erase(missing_handle_key(i));
+                            }
+                            t.stop();
+                         } });
+
+   benchmarks.push_back({ "unordered_map/find_hit", [](uint64_t iterations, timer &t) {
+                            util::unordered_map<uint64_t, uint64_t> map(util::allocator::get_generic());
+                            for (uint64_t i = 0; i < map_size; i++)
+                            {
+                               map.try_insert({ handle_key(i), i });
+                            }
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               auto it = map.find(handle_key(i));
+                               do_not_optimize(it->second);
+                            }
+                            t.stop();
+                         } });
+
+   benchmarks.push_back({ "unordered_map/find_miss", [](uint64_t iterations, timer &t) {
+                            util::unordered_map<uint64_t, uint64_t> map(util::allocator::get_generic());
+                            for (uint64_t i = 0; i < map_size; i++)
+                            {
+                               map.try_insert({ handle_key(i), i });
+                            }
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               bool found = map.find(missing_handle_key(i)) != map.end();
+                               do_not_optimize(found);
+                            }
+                            t.stop();
+                         } });
+
+   benchmarks.push_back({ "unordered_set/try_insert_erase", [](uint64_t iterations, timer &t) {
+                            util::unordered_set<uint64_t> set(util::allocator::get_generic());
+                            for (uint64_t i = 0; i < map_size; i++)
+                            {
+                               set.try_insert(handle_key(i));
+                            }
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               auto inserted = set.try_insert(missing_handle_key(i));
+                               do_not_optimize(inserted);
+                               set.erase(missing_handle_key(i));
+                            }
+                            t.stop();
+                         } });
+
+   benchmarks.push_back({ "unordered_set/find_hit", [](uint64_t iterations, timer &t) {
+                            util::unordered_set<uint64_t> set(util::allocator::get_generic());
+                            for (uint64_t i = 0; i < map_size; i++)
+                            {
+                               set.try_insert(handle_key(i));
+                            }
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               bool found = set.find(handle_key(i)) != set.end();
+                               do_not_optimize(found);
+                            }
+                            t.stop();
+                         } });
+
+   /* The same operations on the open addressing map, to compare it with the node based one. */
+   benchmarks.push_back({ "flat_map/try_insert_erase", [](uint64_t iterations, timer &t) {
+                            util::flat_map<uint64_t, uint64_t> map(util::allocator::get_generic());
+                            for (uint64_t i = 0; i < map_size; i++)
+                            {
+                               map.try_insert({ handle_key(i), i });
+                            }
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               auto inserted = map.try_insert({ missing_handle_key(i), i });
+                               do_not_optimize(inserted);
+                               map.erase(missing_handle_key(i));
+                            }
+                            t.stop();
+                         } });
+
+   benchmarks.push_back({ "flat_map/find_hit", [](uint64_t iterations, timer &t) {
+                            util::flat_map<uint64_t, uint64_t> map(util::allocator::get_generic());
+                            for (uint64_t i = 0; i < map_size; i++)
+                            {
+                               map.try_insert({ handle_key(i), i });
+                            }
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               auto it = map.find(handle_key(i));
+                               do_not_optimize(it->second);
+                            }
+                            t.stop();
+                         } });
+
+   benchmarks.push_back({ "flat_map/find_miss", [](uint64_t iterations, timer &t) {
+                            util::flat_map<uint64_t, uint64_t> map(util::allocator::get_generic());
+                            for (uint64_t i = 0; i < map_size; i++)
+                            {
+                               map.try_insert({ handle_key(i), i });
+                            }
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               bool found = map.find(missing_handle_key(i)) != map.end();
+                               do_not_optimize(found);
+                            }
+                            t.stop();
+                         } });
+
+   /* A vector that keeps its capacity, as the layer's per frame vectors do, and one that allocates every time. */
+   benchmarks.push_back({ "vector/try_push_back_16", [](uint64_t iterations, timer &t) {
+                            util::vector<uint64_t> vec(util::allocator::get_generic());
+                            vec.try_reserve(16);
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               for (uint64_t j = 0; j < 16; j++)
+                               {
+                                  vec.try_push_back(j);
+                               }
+                               do_not_optimize(vec.data());
+                               vec.clear();
+                            }
+                            t.stop();
+                         } });
+
+   benchmarks.push_back({ "vector/try_push_back_16_allocating", [](uint64_t iterations, timer &t) {
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               util::vector<uint64_t> vec(util::allocator::get_generic());
+                               for (uint64_t j = 0; j < 16; j++)
+                               {
+                                  vec.try_push_back(j);
+                               }
+                               do_not_optimize(vec.data());
+                            }
+                            t.stop();
+                         } });
+
+   benchmarks.push_back({ "vector/try_resize_16", [](uint64_t iterations, timer &t) {
+                            util::vector<uint64_t> vec(util::allocator::get_generic());
+                            vec.try_reserve(16);
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               vec.try_resize(16);
+                               do_not_optimize(vec.data());
+                               vec.clear();
+                            }
+                            t.stop();
+                         } });
+
+   benchmarks.push_back({ "vector/try_reserve_16_allocating", [](uint64_t iterations, timer &t) {
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               util::vector<uint64_t> vec(util::allocator::get_generic());
+                               vec.try_reserve(16);
+                               do_not_optimize(vec.data());
+                            }
+                            t.stop();
+                         } });
+}
+
+void add_semaphore_benchmarks(std::vector<benchmark> &benchmarks)
+{
+   benchmarks.push_back({ "timed_semaphore/post_wait", [](uint64_t iterations, timer &t) {
+                            util::timed_semaphore semaphore;
+                            CHECK_VK(semaphore.init(0));
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               semaphore.post();
+                               CHECK_VK(semaphore.wait(0));
+                            }
+                            t.stop();
+                         } });
+
+   /* Hands a token back and forth between two threads, as the application thread and the page flip thread do, so
+    * each iteration is a wake up of the other thread and a wait to be woken up in turn. */
+   benchmarks.push_back({ "timed_semaphore/ping_pong", [](uint64_t iterations, timer &t) {
+                            util::timed_semaphore ping;
+                            util::timed_semaphore pong;
+                            CHECK_VK(ping.init(0));
+                            CHECK_VK(pong.init(0));
+                            std::thread other([&ping, &pong, iterations]() {
+                               for (uint64_t i = 0; i < iterations; i++)
+                               {
+                                  CHECK_VK(ping.wait(UINT64_MAX));
+                                  pong.post();
+                               }
+                            });
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               ping.post();
+                               CHECK_VK(pong.wait(UINT64_MAX));
+                            }
+                            t.stop();
+                            other.join();
+                         } });
+}
+
+#if WSI_BENCH_DRM_UTILS
+void add_drm_format_benchmarks(std::vector<benchmark> &benchmarks)
+{
+   static constexpr std::array<VkFormat, 8> vk_formats = {
+      VK_FORMAT_R8G8B8A8_UNORM,      VK_FORMAT_B8G8R8A8_UNORM,           VK_FORMAT_R8G8B8A8_SRGB,
+      VK_FORMAT_B8G8R8A8_SRGB,       VK_FORMAT_A2B10G10R10_UNORM_PACK32, VK_FORMAT_R5G6B5_UNORM_PACK16,
+      VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R8G8B8_UNORM,
+   };
+
+   benchmarks.push_back({ "drm_utils/vk_to_drm_format", [](uint64_t iterations, timer &t) {
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               uint32_t drm_format = util::drm::vk_to_drm_format(vk_formats[i % vk_formats.size()]);
+                               do_not_optimize(drm_format);
+                            }
+                            t.stop();
+                         } });
+
+   benchmarks.push_back({ "drm_utils/drm_to_vk_format", [](uint64_t iterations, timer &t) {
+                            std::array<uint32_t, vk_formats.size()> drm_formats;
+                            std::transform(vk_formats.begin(), vk_formats.end(), drm_formats.begin(),
+                                           util::drm::vk_to_drm_format);
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               VkFormat vk_format = util::drm::drm_to_vk_format(drm_formats[i % drm_formats.size()]);
+                               do_not_optimize(vk_format);
+                            }
+                            t.stop();
+                         } });
+
+   benchmarks.push_back({ "drm_utils/drm_fourcc_format_get_num_planes", [](uint64_t iterations, timer &t) {
+                            std::array<uint32_t, vk_formats.size()> drm_formats;
+                            std::transform(vk_formats.begin(), vk_formats.end(), drm_formats.begin(),
+                                           util::drm::vk_to_drm_format);
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               uint32_t planes =
+                                  util::drm::drm_fourcc_format_get_num_planes(drm_formats[i % drm_formats.size()]);
+                               do_not_optimize(planes);
+                            }
+                            t.stop();
+                         } });
+}
+#endif
+
+struct device_context
+{
+   VkInstance instance = VK_NULL_HANDLE;
+   VkDevice device = VK_NULL_HANDLE;
+   VkQueue queue = VK_NULL_HANDLE;
+   PFN_vkGetFenceFdKHR get_fence_fd = nullptr;
+};
+
+/**
+ * @brief Create a device with one queue, enabling VK_KHR_external_fence_fd if its fences can be exported as sync FDs.
+ *
+ * @return false if there is no Vulkan device, in which case the fence benchmarks are skipped.
+ */
+bool create_device_context(device_context &ctx)
+{
+   VkApplicationInfo app_info = {};
+   app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+   app_info.pApplicationName = "wsi_util_bench";
+   app_info.apiVersion = VK_API_VERSION_1_1;
+
+   VkInstanceCreateInfo instance_info = {};
+   instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+   instance_info.pApplicationInfo = &app_info;
+   if (vkCreateInstance(&instance_info, nullptr, &ctx.instance) != VK_SUCCESS)
+   {
+      return false;
+   }
+
+   uint32_t physical_device_count = 1;
+   VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+   VkResult result = vkEnumeratePhysicalDevices(ctx.instance, &physical_device_count, &physical_device);
+   if (result < 0 || physical_device_count == 0)
+   {
+      vkDestroyInstance(ctx.instance, nullptr);
+      ctx.instance = VK_NULL_HANDLE;
+      return false;
+   }
+
+   /* The same check as sync_fd_fence_sync::is_supported. */
+   VkPhysicalDeviceExternalFenceInfo external_fence_info = {};
+   external_fence_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_FENCE_INFO;
+   external_fence_info.handleType = VK_EXTERNAL_FENCE_HANDLE_TYPE_SYNC_FD_BIT;
+   VkExternalFenceProperties fence_properties = {};
+   fence_properties.sType = VK_STRUCTURE_TYPE_EXTERNAL_FENCE_PROPERTIES;
+   vkGetPhysicalDeviceExternalFenceProperties(physical_device, &external_fence_info, &fence_properties);
+
+   uint32_t extension_count = 0;
+   CHECK_VK(vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &extension_count, nullptr));
+   std::vector<VkExtensionProperties> extensions(extension_count);
+   CHECK_VK(vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &extension_count, extensions.data()));
+   const bool sync_fd_supported =
+      bench::has_extension(extensions, VK_KHR_EXTERNAL_FENCE_FD_EXTENSION_NAME) &&
+      (fence_properties.externalFenceFeatures & VK_EXTERNAL_FENCE_FEATURE_EXPORTABLE_BIT) != 0;
+
+   /* Submissions without command buffers, which are all the benchmarks make, are valid on any queue. */
+   const float priority = 1.0f;
+   VkDeviceQueueCreateInfo queue_info = {};
+   queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+   queue_info.queueFamilyIndex = 0;
+   queue_info.queueCount = 1;
+   queue_info.pQueuePriorities = &priority;
+
+   const char *device_extension = VK_KHR_EXTERNAL_FENCE_FD_EXTENSION_NAME;
+   VkDeviceCreateInfo device_info = {};
+   device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+   device_info.queueCreateInfoCount = 1;
+   device_info.pQueueCreateInfos = &queue_info;
+   device_info.enabledExtensionCount = sync_fd_supported ? 1 : 0;
+   device_info.ppEnabledExtensionNames = &device_extension;
+   CHECK_VK(vkCreateDevice(physical_device, &device_info, nullptr, &ctx.device));
+   vkGetDeviceQueue(ctx.device, 0, 0, &ctx.queue);
+
+   if (sync_fd_supported)
+   {
+      ctx.get_fence_fd =
+         reinterpret_cast<PFN_vkGetFenceFdKHR>(vkGetDeviceProcAddr(ctx.device, "vkGetFenceFdKHR"));
+   }
+   return true;
+}
+
+void destroy_device_context(device_context &ctx)
+{
+   if (ctx.device != VK_NULL_HANDLE)
+   {
+      vkDestroyDevice(ctx.device, nullptr);
+   }
+   if (ctx.instance != VK_NULL_HANDLE)
+   {
+      vkDestroyInstance(ctx.instance, nullptr);
+   }
+}
+
+VkFence create_fence(const device_context &ctx, bool exportable)
+{
+   VkExportFenceCreateInfo export_info = {};
+   export_info.sType = VK_STRUCTURE_TYPE_EXPORT_FENCE_CREATE_INFO;
+   export_info.handleTypes = VK_EXTERNAL_FENCE_HANDLE_TYPE_SYNC_FD_BIT;
+   VkFenceCreateInfo fence_info = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, exportable ? &export_info : nullptr, 0 };
+   VkFence fence = VK_NULL_HANDLE;
+   CHECK_VK(vkCreateFence(ctx.device, &fence_info, nullptr, &fence));
+   return fence;
+}
+
+/**
+ * @brief Set the payload of a fence as fence_sync::set_payload does, resetting it and then signalling it from an
+ *        empty submission.
+ */
+void set_fence_payload(const device_context &ctx, VkFence fence)
+{
+   CHECK_VK(vkResetFences(ctx.device, 1, &fence));
+   VkSubmitInfo submit_info = {};
+   submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+   CHECK_VK(vkQueueSubmit(ctx.queue, 1, &submit_info, fence));
+}
+
+void add_fence_benchmarks(std::vector<benchmark> &benchmarks, const device_context &ctx)
+{
+   benchmarks.push_back({ "fence_sync/set_wait", [&ctx](uint64_t iterations, timer &t) {
+                            VkFence fence = create_fence(ctx, false);
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               set_fence_payload(ctx, fence);
+                               CHECK_VK(vkWaitForFences(ctx.device, 1, &fence, VK_TRUE, UINT64_MAX));
+                            }
+                            t.stop();
+                            vkDestroyFence(ctx.device, fence, nullptr);
+                         } });
+
+   /* A wait once the payload has finished, which is what most waits of the presentation engine find. */
+   benchmarks.push_back({ "fence_sync/wait_signaled", [&ctx](uint64_t iterations, timer &t) {
+                            VkFence fence = create_fence(ctx, false);
+                            set_fence_payload(ctx, fence);
+                            CHECK_VK(vkWaitForFences(ctx.device, 1, &fence, VK_TRUE, UINT64_MAX));
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               CHECK_VK(vkWaitForFences(ctx.device, 1, &fence, VK_TRUE, UINT64_MAX));
+                            }
+                            t.stop();
+                            vkDestroyFence(ctx.device, fence, nullptr);
+                         } });
+
+   if (ctx.get_fence_fd == nullptr)
+   {
+      std::fprintf(stderr, "Fences cannot be exported as sync FDs, skipping the sync_fd_fence_sync benchmarks\n");
+      return;
+   }
+
+   /* The export of sync_fd_fence_sync::export_sync_fd, then the wait of the backends on the sync FD. A sync FD of
+    * -1 means that the payload has already finished. */
+   benchmarks.push_back({ "sync_fd_fence_sync/set_export_wait", [&ctx](uint64_t iterations, timer &t) {
+                            VkFence fence = create_fence(ctx, true);
+                            VkFenceGetFdInfoKHR fd_info = {};
+                            fd_info.sType = VK_STRUCTURE_TYPE_FENCE_GET_FD_INFO_KHR;
+                            fd_info.fence = fence;
+                            fd_info.handleType = VK_EXTERNAL_FENCE_HANDLE_TYPE_SYNC_FD_BIT;
+                            t.start();
+                            for (uint64_t i = 0; i < iterations; i++)
+                            {
+                               set_fence_payload(ctx, fence);
+                               int fd = -1;
+                               CHECK_VK(ctx.get_fence_fd(ctx.device, &fd_info, &fd));
+                               if (fd >= 0)
+                               {
+                                  pollfd pfd = { fd, POLLIN, 0 };
+                                  poll(&pfd, 1, -1);
+                                  close(fd);
+                               }
+                            }
+                            t.stop();
+                            vkDestroyFence(ctx.device, fence, nullptr);
+                         } });
+}
+
+} /* anonymous namespace */
+
+int main(int argc, char **argv)
+{
+   options opts;
+   const std::vector<bench::option> option_list = get_options(opts);
+   if (!bench::parse_options(argc, argv, option_list))
+   {
+      bench::print_usage(argv[0], option_list);
+      return EXIT_FAILURE;
+   }
+
+   std::vector<benchmark> benchmarks;
+   add_container_benchmarks(benchmarks);
+   add_semaphore_benchmarks(benchmarks);
+#if WSI_BENCH_DRM_UTILS
+   add_drm_format_benchmarks(benchmarks);
+#endif
+
+   device_context ctx;
+   if (create_device_context(ctx))
+   {
+      add_fence_benchmarks(benchmarks, ctx);
+   }
+   else
+   {
+      std::fprintf(stderr, "No Vulkan device, skipping the fence benchmarks\n");
+   }
+
+   /* The table goes to the standard error when the JSON goes to the standard output, so that it stays parsable. */
+   const bool json_to_stdout = opts.json_path != nullptr && std::strcmp(opts.json_path, "-") == 0;
+   FILE *table = json_to_stdout ? stderr : stdout;
+   std::fprintf(table, "%-45s %15s %15s %12s\n", "Benchmark", "Time (ns)", "CPU (ns)", "Iterations");
+
+   std::vector<benchmark_result> results;
+   const uint64_t min_time_ns = static_cast<uint64_t>(opts.min_time_ms) * 1000000;
+   for (const benchmark &bench : benchmarks)
+   {
+      if (opts.filter != nullptr && bench.name.find(opts.filter) == std::string::npos)
+      {
+         continue;
+      }
+      for (uint32_t repetition = 0; repetition < opts.repetitions; repetition++)
+      {
+         benchmark_result r = run_benchmark(bench, repetition, min_time_ns);
+         std::fprintf(table, "%-45s %15.1f %15.1f %12" PRIu64 "\n", r.name.c_str(), r.real_ns, r.cpu_ns,
+                      r.iterations);
+         results.push_back(r);
+      }
+   }
+
+   destroy_device_context(ctx);
+
+   if (opts.json_path != nullptr && !bench::write_benchmark_json(opts.json_path, argv[0], results))
+   {
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
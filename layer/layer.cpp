@@ -24,7 +24,9 @@
 
 #include <cassert>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include <array>
 
 #include <vulkan/vk_layer.h>
@@ -40,11 +42,16 @@
 #include "util/log.hpp"
 #include "util/macros.hpp"
 #include "util/helpers.hpp"
+#include "util/perfect_hash.hpp"
 
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
 #include "wsi_layer_experimental.hpp"
 #endif
 
+#if ENABLE_INSTRUMENTATION && VULKAN_WSI_LAYER_EXPERIMENTAL
+#include "wsi/gpu_timestamps.hpp"
+#endif
+
 #define VK_LAYER_API_VERSION VK_MAKE_VERSION(1, 2, VK_HEADER_VERSION)
 
 namespace layer
@@ -135,7 +142,7 @@ VKAPI_ATTR VkResult create_instance(const VkInstanceCreateInfo *pCreateInfo, con
     * vkCreateInstance is called.
     */
    util::allocator allocator{ VK_SYSTEM_ALLOCATION_SCOPE_COMMAND, pAllocator };
-   util::vector<const char *> modified_enabled_extensions{ allocator };
+   util::extension_string_list modified_enabled_extensions{ allocator };
    util::extension_list extensions{ allocator };
 
    /* Find all the platforms that the layer can handle based on pCreateInfo->ppEnabledExtensionNames. */
@@ -176,19 +183,14 @@ VKAPI_ATTR VkResult create_instance(const VkInstanceCreateInfo *pCreateInfo, con
     * otherwise use the default callbacks.
     */
    util::allocator instance_allocator{ VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE, pAllocator };
-   std::optional<instance_dispatch_table> table = instance_dispatch_table::create(instance_allocator);
-   if (!table.has_value())
-   {
-      return VK_ERROR_OUT_OF_HOST_MEMORY;
-   }
-
-   TRY_LOG_CALL(table->populate(*pInstance, fpGetInstanceProcAddr));
-   table->set_user_enabled_extensions(pCreateInfo->ppEnabledExtensionNames, pCreateInfo->enabledExtensionCount);
+   instance_dispatch_table table{};
+   TRY_LOG_CALL(table.populate(*pInstance, fpGetInstanceProcAddr));
+   table.set_user_enabled_extensions(pCreateInfo->ppEnabledExtensionNames, pCreateInfo->enabledExtensionCount);
 
    uint32_t api_version =
       pCreateInfo->pApplicationInfo != nullptr ? pCreateInfo->pApplicationInfo->apiVersion : VK_API_VERSION_1_3;
 
-   TRY_LOG_CALL(instance_private_data::associate(*pInstance, std::move(*table), loader_callback,
+   TRY_LOG_CALL(instance_private_data::associate(*pInstance, std::move(table), loader_callback,
                                                  layer_platforms_to_enable, api_version, instance_allocator));
 
    /*
@@ -207,6 +209,124 @@ VKAPI_ATTR VkResult create_instance(const VkInstanceCreateInfo *pCreateInfo, con
    return VK_SUCCESS;
 }
 
+/**
+ * @brief Check whether the WSI_DEDICATED_QUEUE environment variable asks the layer to reserve a queue of its own.
+ */
+static bool is_dedicated_queue_requested()
+{
+   static const bool requested = [] {
+      const char *env = std::getenv("WSI_DEDICATED_QUEUE");
+      return env != nullptr && strcmp(env, "1") == 0;
+   }();
+   return requested;
+}
+
+/**
+ * @brief Add a queue the application does not request to the create info of a device, for the layer's submissions.
+ *
+ * The queue is taken from the first family with a queue left over that supports graphics, compute or transfer, or
+ * from the first family with a queue left over if there is none. When the application requests queues of that
+ * family, the queue is appended after them, so the indices of the application's queues are unchanged.
+ *
+ * @param inst_data               The instance of the physical device.
+ * @param physical_device         The physical device.
+ * @param allocator               Allocator for the temporary queue family properties.
+ * @param[in,out] create_info     The device create info, whose queue create infos are replaced if a queue is reserved.
+ * @param[out] queue_infos        Storage for the replacement queue create infos.
+ * @param[out] priorities         Storage for the queue priorities of the family of the reserved queue.
+ * @param[out] queue_family_index The family of the reserved queue, UINT32_MAX if the application requests every queue.
+ * @param[out] queue_index        The index of the reserved queue in its family.
+ *
+ * @return VK_SUCCESS if successful, otherwise an error.
+ */
+static VkResult reserve_dedicated_queue(instance_private_data &inst_data, VkPhysicalDevice physical_device,
+                                        const util::allocator &allocator, VkDeviceCreateInfo &create_info,
+                                        util::vector<VkDeviceQueueCreateInfo> &queue_infos,
+                                        util::vector<float> &priorities, uint32_t &queue_family_index,
+                                        uint32_t &queue_index)
+{
+   queue_family_index = UINT32_MAX;
+   queue_index = 0;
+
+   uint32_t family_count = 0;
+   inst_data.disp.GetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, nullptr);
+   util::vector<VkQueueFamilyProperties> families{ allocator };
+   if (!families.try_resize(family_count))
+   {
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+   inst_data.disp.GetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, families.data());
+
+   /* Families without graphics, compute or transfer support, such as video or optical flow families, may not be able to
+    * execute the layer's submissions, so they are only used when no other family has a queue left over. */
+   constexpr VkQueueFlags submit_flags = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT;
+   for (VkQueueFlags required_flags : { submit_flags, VkQueueFlags{ 0 } })
+   {
+      for (uint32_t family = 0; family < family_count && queue_family_index == UINT32_MAX; family++)
+      {
+         if (required_flags != 0 && (families[family].queueFlags & required_flags) == 0)
+         {
+            continue;
+         }
+
+         uint32_t requested = 0;
+         for (uint32_t i = 0; i < create_info.queueCreateInfoCount; i++)
+         {
+            if (create_info.pQueueCreateInfos[i].queueFamilyIndex == family)
+            {
+               requested += create_info.pQueueCreateInfos[i].queueCount;
+            }
+         }
+         if (requested < families[family].queueCount)
+         {
+            queue_family_index = family;
+         }
+      }
+   }
+
+   if (queue_family_index == UINT32_MAX)
+   {
+      WSI_LOG_WARNING("The application requests every queue of the device, the layer submits to its queues.");
+      return VK_SUCCESS;
+   }
+
+   if (!queue_infos.try_resize(create_info.queueCreateInfoCount))
+   {
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+   std::copy(create_info.pQueueCreateInfos, create_info.pQueueCreateInfos + create_info.queueCreateInfoCount,
+             queue_infos.begin());
+
+   auto family_info = std::find_if(queue_infos.begin(), queue_infos.end(), [&](const VkDeviceQueueCreateInfo &info) {
+      return info.queueFamilyIndex == queue_family_index && info.flags == 0;
+   });
+   if (family_info == queue_infos.end())
+   {
+      VkDeviceQueueCreateInfo info = {};
+      info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+      info.queueFamilyIndex = queue_family_index;
+      if (!queue_infos.try_push_back(info))
+      {
+         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+      family_info = queue_infos.end() - 1;
+   }
+
+   /* The layer's submissions only signal and wait, they get the highest priority so they are not held up. */
+   queue_index = family_info->queueCount;
+   if (!priorities.try_resize(queue_index + 1, 1.0f))
+   {
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+   std::copy(family_info->pQueuePriorities, family_info->pQueuePriorities + queue_index, priorities.begin());
+   family_info->queueCount = queue_index + 1;
+   family_info->pQueuePriorities = priorities.data();
+
+   create_info.queueCreateInfoCount = static_cast<uint32_t>(queue_infos.size());
+   create_info.pQueueCreateInfos = queue_infos.data();
+   return VK_SUCCESS;
+}
+
 VKAPI_ATTR VkResult create_device(VkPhysicalDevice physicalDevice, const VkDeviceCreateInfo *pCreateInfo,
                                   const VkAllocationCallbacks *pAllocator, VkDevice *pDevice)
 {
@@ -243,7 +363,7 @@ VKAPI_ATTR VkResult create_device(VkPhysicalDevice physicalDevice, const VkDevic
 
    auto &inst_data = instance_private_data::get(physicalDevice);
    util::allocator allocator{ inst_data.get_allocator(), VK_SYSTEM_ALLOCATION_SCOPE_COMMAND, pAllocator };
-   util::vector<const char *> modified_enabled_extensions{ allocator };
+   util::extension_string_list modified_enabled_extensions{ allocator };
    util::extension_list enabled_extensions{ allocator };
 
    const util::wsi_platform_set &enabled_platforms = inst_data.get_enabled_platforms();
@@ -298,6 +418,19 @@ VKAPI_ATTR VkResult create_device(VkPhysicalDevice physicalDevice, const VkDevic
       }
    }
 
+   /* Reserve a queue for the layer's own submissions, which would otherwise contend with the application for its
+    * externally synchronized queues. */
+   util::vector<VkDeviceQueueCreateInfo> modified_queue_infos{ allocator };
+   util::vector<float> dedicated_queue_priorities{ allocator };
+   uint32_t dedicated_queue_family_index = UINT32_MAX;
+   uint32_t dedicated_queue_index = 0;
+   if (is_dedicated_queue_requested())
+   {
+      TRY_LOG_CALL(reserve_dedicated_queue(inst_data, physicalDevice, allocator, modified_info, modified_queue_infos,
+                                           dedicated_queue_priorities, dedicated_queue_family_index,
+                                           dedicated_queue_index));
+   }
+
    /* Now call create device on the chain further down the list. */
    TRY_LOG(fpCreateDevice(physicalDevice, &modified_info, pAllocator, pDevice), "Failed to create the device");
 
@@ -309,23 +442,17 @@ VKAPI_ATTR VkResult create_device(VkPhysicalDevice physicalDevice, const VkDevic
     * provided to the instance (if no allocator callbacks was provided to the instance, it will use default ones).
     */
    util::allocator device_allocator{ inst_data.get_allocator(), VK_SYSTEM_ALLOCATION_SCOPE_DEVICE, pAllocator };
-   std::optional<device_dispatch_table> table = device_dispatch_table::create(device_allocator);
-   if (!table.has_value())
-   {
-      fn_destroy_device(*pDevice, pAllocator);
-      return VK_ERROR_OUT_OF_HOST_MEMORY;
-   }
-
-   VkResult result = table->populate(*pDevice, fpGetDeviceProcAddr);
+   device_dispatch_table table{};
+   VkResult result = table.populate(*pDevice, fpGetDeviceProcAddr);
    if (result != VK_SUCCESS)
    {
       fn_destroy_device(*pDevice, pAllocator);
       return result;
    }
 
-   table->set_user_enabled_extensions(pCreateInfo->ppEnabledExtensionNames, pCreateInfo->enabledExtensionCount);
+   table.set_user_enabled_extensions(pCreateInfo->ppEnabledExtensionNames, pCreateInfo->enabledExtensionCount);
 
-   result = device_private_data::associate(*pDevice, inst_data, physicalDevice, std::move(*table), loader_callback,
+   result = device_private_data::associate(*pDevice, inst_data, physicalDevice, std::move(table), loader_callback,
                                            device_allocator);
    if (result != VK_SUCCESS)
    {
@@ -339,6 +466,7 @@ VKAPI_ATTR VkResult create_device(VkPhysicalDevice physicalDevice, const VkDevic
     */
    auto &device_data = layer::device_private_data::get(*pDevice);
    device_data.set_layer_frame_boundary_handling_enabled(should_layer_handle_frame_boundary_events);
+   device_data.detect_sync_fd_import_support();
 
    result = device_data.set_device_enabled_extensions(modified_info.ppEnabledExtensionNames,
                                                       modified_info.enabledExtensionCount);
@@ -349,6 +477,30 @@ VKAPI_ATTR VkResult create_device(VkPhysicalDevice physicalDevice, const VkDevic
       return result;
    }
 
+   if (dedicated_queue_family_index != UINT32_MAX)
+   {
+      result = device_data.set_dedicated_queue(dedicated_queue_family_index, dedicated_queue_index);
+      if (result != VK_SUCCESS)
+      {
+         layer::device_private_data::disassociate(*pDevice);
+         fn_destroy_device(*pDevice, pAllocator);
+         return result;
+      }
+   }
+
+#if ENABLE_INSTRUMENTATION && VULKAN_WSI_LAYER_EXPERIMENTAL
+   if (should_layer_handle_frame_boundary_events && wsi::gpu_timestamps::is_enabled())
+   {
+      result = device_data.record_queue_families(*pCreateInfo);
+      if (result != VK_SUCCESS)
+      {
+         layer::device_private_data::disassociate(*pDevice);
+         fn_destroy_device(*pDevice, pAllocator);
+         return result;
+      }
+   }
+#endif
+
 #if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
    const auto *swapchain_compression_feature =
       util::find_extension<VkPhysicalDeviceImageCompressionControlSwapchainFeaturesEXT>(
@@ -367,6 +519,20 @@ VKAPI_ATTR VkResult create_device(VkPhysicalDevice physicalDevice, const VkDevic
       device_data.set_present_id_feature_enabled(present_id_features->presentId);
    }
 
+   /* Timeline semaphores are only used for present synchronization when the application enabled them. */
+   const auto *timeline_semaphore_features = util::find_extension<VkPhysicalDeviceTimelineSemaphoreFeatures>(
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES, pCreateInfo->pNext);
+   const auto *vulkan_12_features = util::find_extension<VkPhysicalDeviceVulkan12Features>(
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES, pCreateInfo->pNext);
+   if (timeline_semaphore_features != nullptr)
+   {
+      device_data.set_timeline_semaphore_enabled(timeline_semaphore_features->timelineSemaphore);
+   }
+   else if (vulkan_12_features != nullptr)
+   {
+      device_data.set_timeline_semaphore_enabled(vulkan_12_features->timelineSemaphore);
+   }
+
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
    auto *physical_device_swapchain_maintenance1_features =
       util::find_extension<VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT>(
@@ -490,6 +656,13 @@ wsi_layer_vkGetPhysicalDeviceFeatures2KHR(VkPhysicalDevice physicalDevice,
       present_id_features->presentId = true;
    }
 
+   auto *present_wait_features = util::find_extension<VkPhysicalDevicePresentWaitFeaturesKHR>(
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR, pFeatures->pNext);
+   if (present_wait_features != nullptr)
+   {
+      present_wait_features->presentWait = true;
+   }
+
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
    auto *physical_device_swapchain_maintenance1_features =
       util::find_extension<VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT>(
@@ -510,97 +683,148 @@ wsi_layer_vkGetPhysicalDeviceFeatures2KHR(VkPhysicalDevice physicalDevice,
 #endif
 }
 
-#define GET_PROC_ADDR(func)      \
-   if (!strcmp(funcName, #func)) \
-      return (PFN_vkVoidFunction)&wsi_layer_##func;
+/* Masks of the extensions that must be enabled for the layer to expose an entrypoint. */
+#define EXT(name) util::known_extension_bit(util::known_extension::name)
+
+/* Entrypoints that the layer implements, resolved with a compile time perfect hash of their names.
+ *
+ * Format of an entry is: EP(entrypoint_name, implementation, required_extensions)
+ * entrypoint_name: Name of the entrypoint, without the "vk" prefix.
+ * implementation: Name of the wsi_layer_vk function implementing it, without the prefix.
+ * required_extensions: Mask of the known extensions that must all be enabled to expose the entrypoint.
+ */
+#define LAYER_INSTANCE_ENTRYPOINTS_LIST(EP)                                                               \
+   EP(GetDeviceProcAddr, GetDeviceProcAddr, 0)                                                            \
+   EP(GetInstanceProcAddr, GetInstanceProcAddr, 0)                                                        \
+   EP(CreateInstance, CreateInstance, 0)                                                                  \
+   EP(DestroyInstance, DestroyInstance, 0)                                                                \
+   EP(CreateDevice, CreateDevice, 0)                                                                      \
+   EP(GetPhysicalDevicePresentRectanglesKHR, GetPhysicalDevicePresentRectanglesKHR, 0)                    \
+   EP(GetPhysicalDeviceFeatures2, GetPhysicalDeviceFeatures2KHR, 0)                                       \
+   EP(GetPhysicalDeviceFeatures2KHR, GetPhysicalDeviceFeatures2KHR,                                       \
+      EXT(KHR_get_physical_device_properties2))                                                           \
+   EP(GetPhysicalDeviceSurfaceSupportKHR, GetPhysicalDeviceSurfaceSupportKHR, EXT(KHR_surface))           \
+   EP(GetPhysicalDeviceSurfaceCapabilitiesKHR, GetPhysicalDeviceSurfaceCapabilitiesKHR, EXT(KHR_surface)) \
+   EP(GetPhysicalDeviceSurfaceFormatsKHR, GetPhysicalDeviceSurfaceFormatsKHR, EXT(KHR_surface))           \
+   EP(GetPhysicalDeviceSurfacePresentModesKHR, GetPhysicalDeviceSurfacePresentModesKHR, EXT(KHR_surface)) \
+   EP(DestroySurfaceKHR, DestroySurfaceKHR, EXT(KHR_surface))                                             \
+   EP(GetPhysicalDeviceSurfaceCapabilities2KHR, GetPhysicalDeviceSurfaceCapabilities2KHR,                 \
+      EXT(KHR_surface) | EXT(KHR_get_surface_capabilities2))                                              \
+   EP(GetPhysicalDeviceSurfaceFormats2KHR, GetPhysicalDeviceSurfaceFormats2KHR,                           \
+      EXT(KHR_surface) | EXT(KHR_get_surface_capabilities2))
+
+#define LAYER_DEVICE_ENTRYPOINTS_LIST(EP)                                                             \
+   EP(CreateSwapchainKHR, CreateSwapchainKHR, EXT(KHR_swapchain))                                     \
+   EP(DestroySwapchainKHR, DestroySwapchainKHR, EXT(KHR_swapchain))                                   \
+   EP(GetSwapchainImagesKHR, GetSwapchainImagesKHR, EXT(KHR_swapchain))                               \
+   EP(AcquireNextImageKHR, AcquireNextImageKHR, EXT(KHR_swapchain))                                   \
+   EP(QueuePresentKHR, QueuePresentKHR, EXT(KHR_swapchain))                                           \
+   EP(AcquireNextImage2KHR, AcquireNextImage2KHR, EXT(KHR_swapchain))                                 \
+   EP(GetDeviceGroupPresentCapabilitiesKHR, GetDeviceGroupPresentCapabilitiesKHR, EXT(KHR_swapchain)) \
+   EP(GetDeviceGroupSurfacePresentModesKHR, GetDeviceGroupSurfacePresentModesKHR, EXT(KHR_swapchain)) \
+   EP(GetSwapchainStatusKHR, GetSwapchainStatusKHR, EXT(KHR_shared_presentable_image))                \
+   EP(WaitForPresentKHR, WaitForPresentKHR, EXT(KHR_present_wait))                                    \
+   EP(DestroyDevice, DestroyDevice, 0)                                                                \
+   EP(CreateImage, CreateImage, 0)                                                                    \
+   EP(BindImageMemory2, BindImageMemory2, 0)                                                          \
+   LAYER_DEVICE_ENTRYPOINTS_LIST_EXPERIMENTAL(EP)
 
-VWL_VKAPI_CALL(PFN_vkVoidFunction)
-wsi_layer_vkGetDeviceProcAddr(VkDevice device, const char *funcName) VWL_API_POST
-{
-   if (layer::device_private_data::get(device).is_device_extension_enabled(VK_KHR_SWAPCHAIN_EXTENSION_NAME))
-   {
-      GET_PROC_ADDR(vkCreateSwapchainKHR);
-      GET_PROC_ADDR(vkDestroySwapchainKHR);
-      GET_PROC_ADDR(vkGetSwapchainImagesKHR);
-      GET_PROC_ADDR(vkAcquireNextImageKHR);
-      GET_PROC_ADDR(vkQueuePresentKHR);
-      GET_PROC_ADDR(vkAcquireNextImage2KHR);
-      GET_PROC_ADDR(vkGetDeviceGroupPresentCapabilitiesKHR);
-      GET_PROC_ADDR(vkGetDeviceGroupSurfacePresentModesKHR);
-   }
-   if (layer::device_private_data::get(device).is_device_extension_enabled(
-          VK_KHR_SHARED_PRESENTABLE_IMAGE_EXTENSION_NAME))
-   {
-      GET_PROC_ADDR(vkGetSwapchainStatusKHR);
-   }
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
-   if (layer::device_private_data::get(device).is_device_extension_enabled(VK_EXT_PRESENT_TIMING_EXTENSION_NAME))
-   {
-      GET_PROC_ADDR(vkSetSwapchainPresentTimingQueueSizeEXT);
-      GET_PROC_ADDR(vkGetSwapchainTimingPropertiesEXT);
-      GET_PROC_ADDR(vkGetSwapchainTimeDomainPropertiesEXT);
-      GET_PROC_ADDR(vkGetPastPresentationTimingEXT);
-   }
+#define LAYER_DEVICE_ENTRYPOINTS_LIST_EXPERIMENTAL(EP)                                                       \
+   EP(GetSwapchainLatencyStatisticsARM, GetSwapchainLatencyStatisticsARM, EXT(KHR_swapchain))                \
+   EP(GetSwapchainMemoryFootprintARM, GetSwapchainMemoryFootprintARM, EXT(KHR_swapchain))                    \
+   EP(SetSwapchainImageConsumerARM, SetSwapchainImageConsumerARM, EXT(KHR_swapchain))                        \
+   EP(ReleaseSwapchainImageARM, ReleaseSwapchainImageARM, EXT(KHR_swapchain))                                \
+   EP(SetSwapchainPresentTimingQueueSizeEXT, SetSwapchainPresentTimingQueueSizeEXT, EXT(KHR_present_timing)) \
+   EP(GetSwapchainTimingPropertiesEXT, GetSwapchainTimingPropertiesEXT, EXT(KHR_present_timing))             \
+   EP(GetSwapchainTimeDomainPropertiesEXT, GetSwapchainTimeDomainPropertiesEXT, EXT(KHR_present_timing))     \
+   EP(GetPastPresentationTimingEXT, GetPastPresentationTimingEXT, EXT(KHR_present_timing))                   \
+   EP(ReleaseSwapchainImagesEXT, ReleaseSwapchainImagesEXT, EXT(EXT_swapchain_maintenance1))
+#else
+#define LAYER_DEVICE_ENTRYPOINTS_LIST_EXPERIMENTAL(EP)
 #endif
-   GET_PROC_ADDR(vkDestroyDevice);
 
-   GET_PROC_ADDR(vkCreateImage);
-   GET_PROC_ADDR(vkBindImageMemory2);
+/**
+ * @brief An entrypoint implemented by the layer.
+ */
+struct layer_entrypoint
+{
+   PFN_vkVoidFunction fn;
+   util::known_extension_set required_extensions;
+};
+
+#define LAYER_ENTRYPOINT_NAME(name, unused1, unused2) "vk" #name,
+#define LAYER_ENTRYPOINT(unused, implementation, required_extensions)                            \
+   { reinterpret_cast<PFN_vkVoidFunction>(&wsi_layer_vk##implementation), required_extensions },
+
+static constexpr std::array instance_layer_entrypoint_names = {
+   LAYER_INSTANCE_ENTRYPOINTS_LIST(LAYER_ENTRYPOINT_NAME)
+};
+static constexpr util::perfect_hash_index<instance_layer_entrypoint_names.size()> instance_layer_entrypoint_index{
+   instance_layer_entrypoint_names
+};
+static_assert(instance_layer_entrypoint_index.is_perfect(), "No perfect hash of the layer entrypoint names was found");
+static const std::array<layer_entrypoint, instance_layer_entrypoint_names.size()> instance_layer_entrypoints = { {
+   LAYER_INSTANCE_ENTRYPOINTS_LIST(LAYER_ENTRYPOINT) } };
+
+static constexpr std::array device_layer_entrypoint_names = {
+   LAYER_DEVICE_ENTRYPOINTS_LIST(LAYER_ENTRYPOINT_NAME)
+};
+static constexpr util::perfect_hash_index<device_layer_entrypoint_names.size()> device_layer_entrypoint_index{
+   device_layer_entrypoint_names
+};
+static_assert(device_layer_entrypoint_index.is_perfect(), "No perfect hash of the layer entrypoint names was found");
+static const std::array<layer_entrypoint, device_layer_entrypoint_names.size()> device_layer_entrypoints = { {
+   LAYER_DEVICE_ENTRYPOINTS_LIST(LAYER_ENTRYPOINT) } };
+
+#undef LAYER_ENTRYPOINT
+#undef LAYER_ENTRYPOINT_NAME
+#undef EXT
 
-#if VULKAN_WSI_LAYER_EXPERIMENTAL
-   /* VK_EXT_swapchain_maintenance1 */
-   if (layer::device_private_data::get(device).is_device_extension_enabled(
-          VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME))
+VWL_VKAPI_CALL(PFN_vkVoidFunction)
+wsi_layer_vkGetDeviceProcAddr(VkDevice device, const char *funcName) VWL_API_POST
+{
+   auto &device_data = layer::device_private_data::get(device);
+
+   const size_t index = device_layer_entrypoint_index.find(funcName);
+   if (index != device_layer_entrypoint_index.npos)
    {
-      GET_PROC_ADDR(vkReleaseSwapchainImagesEXT);
+      const layer_entrypoint &entrypoint = device_layer_entrypoints[index];
+      if (device_data.is_device_extension_enabled(entrypoint.required_extensions))
+      {
+         return entrypoint.fn;
+      }
    }
-#endif
 
-   return layer::device_private_data::get(device).disp.get_user_enabled_entrypoint(
-      device, layer::device_private_data::get(device).instance_data.api_version, funcName);
+   return device_data.disp.get_user_enabled_entrypoint(device, device_data.instance_data.api_version, funcName);
 }
 
 VWL_VKAPI_CALL(PFN_vkVoidFunction)
 wsi_layer_vkGetInstanceProcAddr(VkInstance instance, const char *funcName) VWL_API_POST
 {
-   GET_PROC_ADDR(vkGetDeviceProcAddr);
-   GET_PROC_ADDR(vkGetInstanceProcAddr);
-   GET_PROC_ADDR(vkCreateInstance);
-   GET_PROC_ADDR(vkDestroyInstance);
-   GET_PROC_ADDR(vkCreateDevice);
-   GET_PROC_ADDR(vkGetPhysicalDevicePresentRectanglesKHR);
-
-   if (!strcmp(funcName, "vkGetPhysicalDeviceFeatures2"))
+   /* Entrypoints without extension requirements are resolved before the instance exists, e.g. vkCreateInstance. */
+   const size_t index = instance_layer_entrypoint_index.find(funcName);
+   if (index != instance_layer_entrypoint_index.npos && instance_layer_entrypoints[index].required_extensions.none())
    {
-      return (PFN_vkVoidFunction)wsi_layer_vkGetPhysicalDeviceFeatures2KHR;
+      return instance_layer_entrypoints[index].fn;
    }
 
    auto &instance_data = layer::instance_private_data::get(instance);
-
-   if (instance_data.is_instance_extension_enabled(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME))
+   if (index != instance_layer_entrypoint_index.npos)
    {
-      GET_PROC_ADDR(vkGetPhysicalDeviceFeatures2KHR);
+      const layer_entrypoint &entrypoint = instance_layer_entrypoints[index];
+      if (instance_data.is_instance_extension_enabled(entrypoint.required_extensions))
+      {
+         return entrypoint.fn;
+      }
    }
-
-   if (instance_data.is_instance_extension_enabled(VK_KHR_SURFACE_EXTENSION_NAME))
+   else if (instance_data.is_instance_extension_enabled(util::known_extension::KHR_surface))
    {
       PFN_vkVoidFunction wsi_func = wsi::get_proc_addr(funcName, instance_data);
       if (wsi_func)
       {
          return wsi_func;
       }
-
-      GET_PROC_ADDR(vkGetPhysicalDeviceSurfaceSupportKHR);
-      GET_PROC_ADDR(vkGetPhysicalDeviceSurfaceCapabilitiesKHR);
-      GET_PROC_ADDR(vkGetPhysicalDeviceSurfaceFormatsKHR);
-      GET_PROC_ADDR(vkGetPhysicalDeviceSurfacePresentModesKHR);
-      GET_PROC_ADDR(vkDestroySurfaceKHR);
-
-      if (instance_data.is_instance_extension_enabled(VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME))
-      {
-         GET_PROC_ADDR(vkGetPhysicalDeviceSurfaceCapabilities2KHR);
-         GET_PROC_ADDR(vkGetPhysicalDeviceSurfaceFormats2KHR);
-      }
    }
 
    return instance_data.disp.get_user_enabled_entrypoint(instance, instance_data.api_version, funcName);
@@ -25,7 +25,7 @@
 /**
  * @file present_timing.cpp
  *
- * @brief Contains the Vulkan entrypoints for the present timing.
+ * @brief Contains the Vulkan entrypoints for the present timing and the swapchain latency statistics.
  */
 #include <cassert>
 #include "wsi_layer_experimental.hpp"
@@ -83,7 +83,86 @@ wsi_layer_vkGetPastPresentationTimingEXT(
    VkDevice device, const VkPastPresentationTimingInfoEXT *pPastPresentationTimingInfo,
    VkPastPresentationTimingPropertiesEXT *pPastPresentationTimingProperties) VWL_API_POST
 {
-   VkResult result = VK_SUCCESS;
-   return result;
+   assert(pPastPresentationTimingInfo != nullptr);
+   assert(pPastPresentationTimingInfo->swapchain != VK_NULL_HANDLE);
+   assert(pPastPresentationTimingProperties != nullptr);
+   auto *sc = reinterpret_cast<wsi::swapchain_base *>(pPastPresentationTimingInfo->swapchain);
+   return sc->get_past_presentation_timing(pPastPresentationTimingProperties);
+}
+
+/**
+ * @brief Implements the vkGetSwapchainLatencyStatisticsARM layer query.
+ */
+VWL_VKAPI_CALL(VkResult)
+wsi_layer_vkGetSwapchainLatencyStatisticsARM(VkDevice device, VkSwapchainKHR swapchain, uint32_t *pStatisticsCount,
+                                             VkSwapchainLatencyStatisticsARM *pStatistics) VWL_API_POST
+{
+   auto &device_data = layer::device_private_data::get(device);
+
+   /* The query is only implemented by the layer, so there is nothing to forward it to. */
+   if (!device_data.layer_owns_swapchain(swapchain))
+   {
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+   }
+   auto *sc = reinterpret_cast<wsi::swapchain_base *>(swapchain);
+   return sc->get_latency_statistics(pStatisticsCount, pStatistics);
+}
+
+/**
+ * @brief Implements the vkGetSwapchainMemoryFootprintARM layer query.
+ */
+VWL_VKAPI_CALL(VkResult)
+wsi_layer_vkGetSwapchainMemoryFootprintARM(VkDevice device, VkSwapchainKHR swapchain,
+                                           VkSwapchainMemoryFootprintARM *pFootprint) VWL_API_POST
+{
+   auto &device_data = layer::device_private_data::get(device);
+
+   if (!device_data.layer_owns_swapchain(swapchain))
+   {
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+   }
+   assert(pFootprint != nullptr);
+   auto *sc = reinterpret_cast<wsi::swapchain_base *>(swapchain);
+   const wsi::swapchain_memory_footprint footprint = sc->get_memory_footprint();
+   pFootprint->dmaBufBytes = footprint.dma_buf_bytes;
+   pFootprint->deviceMemoryBytes = footprint.device_memory_bytes;
+   pFootprint->hostBytes = footprint.host_bytes;
+   pFootprint->framebufferCount = footprint.framebuffer_count;
+   pFootprint->imageCount = footprint.image_count;
+   return VK_SUCCESS;
+}
+
+/**
+ * @brief Implements the vkSetSwapchainImageConsumerARM layer entrypoint.
+ */
+VWL_VKAPI_CALL(VkResult)
+wsi_layer_vkSetSwapchainImageConsumerARM(VkDevice device, VkSwapchainKHR swapchain,
+                                         PFN_vkSwapchainImageConsumerARM pfnConsumer, void *pUserData) VWL_API_POST
+{
+   auto &device_data = layer::device_private_data::get(device);
+
+   if (!device_data.layer_owns_swapchain(swapchain))
+   {
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+   }
+   auto *sc = reinterpret_cast<wsi::swapchain_base *>(swapchain);
+   return sc->set_image_consumer(pfnConsumer, pUserData);
+}
+
+/**
+ * @brief Implements the vkReleaseSwapchainImageARM layer entrypoint.
+ */
+VWL_VKAPI_CALL(VkResult)
+wsi_layer_vkReleaseSwapchainImageARM(VkDevice device, VkSwapchainKHR swapchain, uint32_t imageIndex,
+                                     int releaseSyncFd) VWL_API_POST
+{
+   auto &device_data = layer::device_private_data::get(device);
+
+   if (!device_data.layer_owns_swapchain(swapchain))
+   {
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+   }
+   auto *sc = reinterpret_cast<wsi::swapchain_base *>(swapchain);
+   return sc->release_consumer_image(imageIndex, releaseSyncFd);
 }
 #endif /* VULKAN_WSI_LAYER_EXPERIMENTAL */
@@ -28,121 +28,155 @@
 #include "wsi/wsi_factory.hpp"
 #include "wsi/surface.hpp"
 #include "util/unordered_map.hpp"
+#include "util/concurrent_lookup_table.hpp"
 #include "util/log.hpp"
 #include "util/helpers.hpp"
+#include "util/perfect_hash.hpp"
 
 namespace layer
 {
 
-static std::mutex g_data_lock;
+/* Initial number of slots of the instance and device tables, which grow when more objects are associated. */
+static constexpr size_t INITIAL_DISPATCHABLE_KEYS = 64;
 
-/* The dictionaries below use plain pointers to store the instance/device private data objects.
+/* The tables below use plain pointers to store the instance/device private data objects.
  * This means that these objects are leaked if the application terminates without calling vkDestroyInstance
  * or vkDestroyDevice. This is fine as it is the application's responsibility to call these.
+ *
+ * Lookups happen on every intercepted call and never block. Writers are serialized inside the tables.
  */
-static util::unordered_map<void *, instance_private_data *> g_instance_data{ util::allocator::get_generic() };
-static util::unordered_map<void *, device_private_data *> g_device_data{ util::allocator::get_generic() };
+static util::concurrent_lookup_table<void *, instance_private_data *, INITIAL_DISPATCHABLE_KEYS> g_instance_data;
+static util::concurrent_lookup_table<void *, device_private_data *, INITIAL_DISPATCHABLE_KEYS> g_device_data;
 
-VkResult instance_dispatch_table::populate(VkInstance instance, PFN_vkGetInstanceProcAddr get_proc)
+/* Entrypoints are looked up by name for every vkGet*ProcAddr call that the layer passes down the chain, so the names
+ * of the dispatch tables are hashed at compile time. */
+#define DISPATCH_TABLE_NAME(name, unused1, unused2, unused3) "vk" #name,
+static constexpr std::array<const char *, static_cast<size_t>(instance_entrypoint_index::count)>
+   instance_entrypoint_names = { INSTANCE_ENTRYPOINTS_LIST(DISPATCH_TABLE_NAME) };
+static constexpr std::array<const char *, static_cast<size_t>(device_entrypoint_index::count)> device_entrypoint_names =
+   { DEVICE_ENTRYPOINTS_LIST(DISPATCH_TABLE_NAME) };
+#undef DISPATCH_TABLE_NAME
+
+static constexpr util::perfect_hash_index<instance_entrypoint_names.size()> instance_entrypoint_name_index{
+   instance_entrypoint_names
+};
+static constexpr util::perfect_hash_index<device_entrypoint_names.size()> device_entrypoint_name_index{
+   device_entrypoint_names
+};
+static_assert(instance_entrypoint_name_index.is_perfect() && device_entrypoint_name_index.is_perfect(),
+              "No perfect hash of the entrypoint names was found");
+
+template <typename EntrypointIndex>
+static size_t find_entrypoint_index(const char *fn_name);
+
+template <>
+size_t find_entrypoint_index<instance_entrypoint_index>(const char *fn_name)
 {
-   static constexpr entrypoint entrypoints_init[] = {
-#define DISPATCH_TABLE_ENTRY(name, ext_name, api_version, required) \
-   { "vk" #name, ext_name, nullptr, api_version, false, required },
-      INSTANCE_ENTRYPOINTS_LIST(DISPATCH_TABLE_ENTRY)
-#undef DISPATCH_TABLE_ENTRY
-#if VULKAN_WSI_LAYER_EXPERIMENTAL
-         { "GetSwapchainTimeDomainPropertiesEXT", VK_EXT_PRESENT_TIMING_EXTENSION_NAME, nullptr, API_VERSION_MAX, false,
-           false }
-#endif /* VULKAN_WSI_LAYER_EXPERIMENTAL */
-   };
+   return instance_entrypoint_name_index.find(fn_name);
+}
 
-   static constexpr auto num_entrypoints = std::distance(std::begin(entrypoints_init), std::end(entrypoints_init));
+template <>
+size_t find_entrypoint_index<device_entrypoint_index>(const char *fn_name)
+{
+   return device_entrypoint_name_index.find(fn_name);
+}
 
-   for (size_t i = 0; i < num_entrypoints; i++)
-   {
-      const entrypoint *entrypoint = &entrypoints_init[i];
-      PFN_vkVoidFunction ret = get_proc(instance, entrypoint->name);
-      if (!ret && entrypoint->required)
-      {
-         return VK_ERROR_INITIALIZATION_FAILED;
-      }
-      struct entrypoint e = *entrypoint;
-      e.fn = ret;
-      e.user_visible = false;
+template <typename EntrypointIndex>
+const entrypoint *dispatch_table<EntrypointIndex>::find_entrypoint(const char *fn_name) const
+{
+   const size_t index = find_entrypoint_index<EntrypointIndex>(fn_name);
+   return index < entrypoint_count ? &m_entrypoints[index] : nullptr;
+}
 
-      if (!m_entrypoints->try_insert(std::make_pair(e.name, e)).has_value())
+template <typename EntrypointIndex>
+void dispatch_table<EntrypointIndex>::set_user_enabled_extensions(const char *const *extension_names,
+                                                                  size_t extension_count)
+{
+   for (size_t i = 0; i < extension_count; i++)
+   {
+      for (auto &entrypoint : m_entrypoints)
       {
-         WSI_LOG_ERROR("Failed to allocate memory for instance dispatch table entry.");
-         return VK_ERROR_OUT_OF_HOST_MEMORY;
+         if (!strcmp(entrypoint.ext_name, extension_names[i]))
+         {
+            entrypoint.user_visible = true;
+         }
       }
    }
+}
 
-   return VK_SUCCESS;
+template class dispatch_table<instance_entrypoint_index>;
+template class dispatch_table<device_entrypoint_index>;
+
+/**
+ * @brief Check whether a dispatch table entrypoint can be exposed to the application.
+ *
+ * An entrypoint is allowed to use if it has been enabled by the user or is included in the core specification of the
+ * API version. Entrypoints included in API version 1.0 are allowed by default.
+ */
+static bool is_entrypoint_user_enabled(const entrypoint &item, uint32_t api_version)
+{
+   return item.user_visible || item.api_version <= api_version || item.api_version == VK_API_VERSION_1_0;
 }
 
-void dispatch_table::set_user_enabled_extensions(const char *const *extension_names, size_t extension_count)
+static constexpr instance_dispatch_table::entrypoint_list instance_entrypoints_init = { {
+#define DISPATCH_TABLE_ENTRY(name, ext_name, api_version, required) \
+   { "vk" #name, ext_name, nullptr, api_version, false, required },
+   INSTANCE_ENTRYPOINTS_LIST(DISPATCH_TABLE_ENTRY)
+#undef DISPATCH_TABLE_ENTRY
+} };
+
+instance_dispatch_table::instance_dispatch_table()
+   : dispatch_table{ instance_entrypoints_init }
 {
-   for (size_t i = 0; i < extension_count; i++)
+}
+
+VkResult instance_dispatch_table::populate(VkInstance instance, PFN_vkGetInstanceProcAddr get_proc)
+{
+   for (auto &entrypoint : m_entrypoints)
    {
-      for (auto &entrypoint : *m_entrypoints)
+      entrypoint.fn = get_proc(instance, entrypoint.name);
+      if (!entrypoint.fn && entrypoint.required)
       {
-         if (!strcmp(entrypoint.second.ext_name, extension_names[i]))
-         {
-            entrypoint.second.user_visible = true;
-         }
+         return VK_ERROR_INITIALIZATION_FAILED;
       }
    }
+
+   return VK_SUCCESS;
 }
 
 PFN_vkVoidFunction instance_dispatch_table::get_user_enabled_entrypoint(VkInstance instance, uint32_t api_version,
                                                                         const char *fn_name) const
 {
-   auto item = m_entrypoints->find(fn_name);
-   if (item != m_entrypoints->end())
+   const entrypoint *item = find_entrypoint(fn_name);
+   if (item != nullptr)
    {
-      /* An entrypoint is allowed to use if it has been enabled by the user or is included in the core specficiation of the API version.
-       * Entrypoints included in API version 1.0 are allowed by default. */
-      if (item->second.user_visible || item->second.api_version <= api_version ||
-          item->second.api_version == VK_API_VERSION_1_0)
-      {
-         return item->second.fn;
-      }
-      else
-      {
-         return nullptr;
-      }
+      return is_entrypoint_user_enabled(*item, api_version) ? item->fn : nullptr;
    }
 
    return GetInstanceProcAddr(instance, fn_name).value_or(nullptr);
 }
 
-VkResult device_dispatch_table::populate(VkDevice dev, PFN_vkGetDeviceProcAddr get_proc_fn)
-{
-   static constexpr entrypoint entrypoints_init[] = {
+static constexpr device_dispatch_table::entrypoint_list device_entrypoints_init = { {
 #define DISPATCH_TABLE_ENTRY(name, ext_name, api_version, required) \
    { "vk" #name, ext_name, nullptr, api_version, false, required },
-      DEVICE_ENTRYPOINTS_LIST(DISPATCH_TABLE_ENTRY)
+   DEVICE_ENTRYPOINTS_LIST(DISPATCH_TABLE_ENTRY)
 #undef DISPATCH_TABLE_ENTRY
-   };
-   static constexpr auto num_entrypoints = std::distance(std::begin(entrypoints_init), std::end(entrypoints_init));
+} };
+
+device_dispatch_table::device_dispatch_table()
+   : dispatch_table{ device_entrypoints_init }
+{
+}
 
-   for (size_t i = 0; i < num_entrypoints; i++)
+VkResult device_dispatch_table::populate(VkDevice dev, PFN_vkGetDeviceProcAddr get_proc_fn)
+{
+   for (auto &entrypoint : m_entrypoints)
    {
-      const entrypoint entrypoint = entrypoints_init[i];
-      PFN_vkVoidFunction ret = get_proc_fn(dev, entrypoint.name);
-      if (!ret && entrypoint.required)
+      entrypoint.fn = get_proc_fn(dev, entrypoint.name);
+      if (!entrypoint.fn && entrypoint.required)
       {
          return VK_ERROR_INITIALIZATION_FAILED;
       }
-      struct entrypoint e = entrypoint;
-      e.fn = ret;
-      e.user_visible = false;
-
-      if (!m_entrypoints->try_insert(std::make_pair(e.name, e)).has_value())
-      {
-         WSI_LOG_ERROR("Failed to allocate memory for device dispatch table entry.");
-         return VK_ERROR_OUT_OF_HOST_MEMORY;
-      }
    }
 
    return VK_SUCCESS;
@@ -151,20 +185,10 @@ VkResult device_dispatch_table::populate(VkDevice dev, PFN_vkGetDeviceProcAddr g
 PFN_vkVoidFunction device_dispatch_table::get_user_enabled_entrypoint(VkDevice device, uint32_t api_version,
                                                                       const char *fn_name) const
 {
-   auto item = m_entrypoints->find(fn_name);
-   if (item != m_entrypoints->end())
+   const entrypoint *item = find_entrypoint(fn_name);
+   if (item != nullptr)
    {
-      /* An entrypoint is allowed to use if it has been enabled by the user or is included in the core specficiation of the API version.
-       * Entrypoints included in API version 1.0 are allowed by default. */
-      if (item->second.user_visible || item->second.api_version <= api_version ||
-          item->second.api_version == VK_API_VERSION_1_0)
-      {
-         return item->second.fn;
-      }
-      else
-      {
-         return nullptr;
-      }
+      return is_entrypoint_user_enabled(*item, api_version) ? item->fn : nullptr;
    }
 
    return GetDeviceProcAddr(device, fn_name).value_or(nullptr);
@@ -180,6 +204,7 @@ instance_private_data::instance_private_data(instance_dispatch_table table, PFN_
    , allocator{ alloc }
    , surfaces{ alloc }
    , enabled_extensions{ allocator }
+   , image_format_cache{ allocator }
 {
 }
 
@@ -210,48 +235,33 @@ VkResult instance_private_data::associate(VkInstance instance, instance_dispatch
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
 
-   const auto key = get_key(instance);
-   scoped_mutex lock(g_data_lock);
-
-   auto it = g_instance_data.find(key);
-   if (it != g_instance_data.end())
+   instance_private_data *replaced = nullptr;
+   if (!g_instance_data.try_insert(get_key(instance), instance_data.get(), replaced))
    {
-      WSI_LOG_WARNING("Hash collision when adding new instance (%p)", reinterpret_cast<void *>(instance));
+      WSI_LOG_WARNING("Failed to insert instance_private_data for instance (%p) as the host is out of memory",
+                      reinterpret_cast<void *>(instance));
 
-      destroy(it->second);
-      g_instance_data.erase(it);
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
 
-   auto result = g_instance_data.try_insert(std::make_pair(key, instance_data.get()));
-   if (result.has_value())
+   if (replaced != nullptr)
    {
-      instance_data.release(); // NOLINT(bugprone-unused-return-value)
-      return VK_SUCCESS;
+      WSI_LOG_WARNING("Hash collision when adding new instance (%p)", reinterpret_cast<void *>(instance));
+      destroy(replaced);
    }
-   else
-   {
-      WSI_LOG_WARNING("Failed to insert instance_private_data for instance (%p) as host is out of memory",
-                      reinterpret_cast<void *>(instance));
 
-      return VK_ERROR_OUT_OF_HOST_MEMORY;
-   }
+   instance_data.release(); // NOLINT(bugprone-unused-return-value)
+   return VK_SUCCESS;
 }
 
 void instance_private_data::disassociate(VkInstance instance)
 {
    assert(instance != VK_NULL_HANDLE);
-   instance_private_data *instance_data = nullptr;
+   instance_private_data *instance_data = g_instance_data.erase(get_key(instance));
+   if (instance_data == nullptr)
    {
-      scoped_mutex lock(g_data_lock);
-      auto it = g_instance_data.find(get_key(instance));
-      if (it == g_instance_data.end())
-      {
-         WSI_LOG_WARNING("Failed to find private data for instance (%p)", reinterpret_cast<void *>(instance));
-         return;
-      }
-
-      instance_data = it->second;
-      g_instance_data.erase(it);
+      WSI_LOG_WARNING("Failed to find private data for instance (%p)", reinterpret_cast<void *>(instance));
+      return;
    }
 
    destroy(instance_data);
@@ -260,8 +270,9 @@ void instance_private_data::disassociate(VkInstance instance)
 template <typename dispatchable_type>
 static instance_private_data &get_instance_private_data(dispatchable_type dispatchable_object)
 {
-   scoped_mutex lock(g_data_lock);
-   return *g_instance_data.at(get_key(dispatchable_object));
+   instance_private_data *instance_data = g_instance_data.find(get_key(dispatchable_object));
+   assert(instance_data != nullptr);
+   return *instance_data;
 }
 
 instance_private_data &instance_private_data::get(VkInstance instance)
@@ -276,7 +287,7 @@ instance_private_data &instance_private_data::get(VkPhysicalDevice phys_dev)
 
 VkResult instance_private_data::add_surface(VkSurfaceKHR vk_surface, util::unique_ptr<wsi::surface> &wsi_surface)
 {
-   scoped_mutex lock(surfaces_lock);
+   std::unique_lock<std::shared_mutex> lock(surfaces_lock);
 
    auto it = surfaces.find(vk_surface);
    if (it != surfaces.end())
@@ -299,7 +310,7 @@ VkResult instance_private_data::add_surface(VkSurfaceKHR vk_surface, util::uniqu
 
 wsi::surface *instance_private_data::get_surface(VkSurfaceKHR vk_surface)
 {
-   scoped_mutex lock(surfaces_lock);
+   std::shared_lock<std::shared_mutex> lock(surfaces_lock);
    auto it = surfaces.find(vk_surface);
    if (it != surfaces.end())
    {
@@ -311,7 +322,7 @@ wsi::surface *instance_private_data::get_surface(VkSurfaceKHR vk_surface)
 
 void instance_private_data::remove_surface(VkSurfaceKHR vk_surface, const util::allocator &alloc)
 {
-   scoped_mutex lock(surfaces_lock);
+   std::unique_lock<std::shared_mutex> lock(surfaces_lock);
    auto it = surfaces.find(vk_surface);
    if (it != surfaces.end())
    {
@@ -325,7 +336,7 @@ void instance_private_data::remove_surface(VkSurfaceKHR vk_surface, const util::
 
 bool instance_private_data::does_layer_support_surface(VkSurfaceKHR surface)
 {
-   scoped_mutex lock(surfaces_lock);
+   std::shared_lock<std::shared_mutex> lock(surfaces_lock);
    auto it = surfaces.find(surface);
    return it != surfaces.end();
 }
@@ -361,6 +372,17 @@ bool instance_private_data::should_layer_handle_surface(VkPhysicalDevice phys_de
    return ret;
 }
 
+wsi::surface *instance_private_data::get_layer_handled_surface(VkPhysicalDevice phys_dev, VkSurfaceKHR surface)
+{
+   /* See should_layer_handle_surface() for why calling down is always safe when the layer does not own the surface. */
+   if (do_icds_support_surface(phys_dev, surface))
+   {
+      return nullptr;
+   }
+
+   return get_surface(surface);
+}
+
 #if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
 bool instance_private_data::has_image_compression_support(VkPhysicalDevice phys_dev)
 {
@@ -414,6 +436,7 @@ device_private_data::device_private_data(instance_private_data &inst_data, VkPhy
 #endif /* WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN */
    , present_id_enabled { false }
    , swapchain_maintenance1_enabled{ false }
+   , queue_families{ allocator }
 /* clang-format on */
 {
 }
@@ -432,47 +455,33 @@ VkResult device_private_data::associate(VkDevice dev, instance_private_data &ins
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
 
-   const auto key = get_key(dev);
-   scoped_mutex lock(g_data_lock);
-
-   auto it = g_device_data.find(key);
-   if (it != g_device_data.end())
+   device_private_data *replaced = nullptr;
+   if (!g_device_data.try_insert(get_key(dev), device_data.get(), replaced))
    {
-      WSI_LOG_WARNING("Hash collision when adding new device (%p)", reinterpret_cast<void *>(dev));
-      destroy(it->second);
-      g_device_data.erase(it);
+      WSI_LOG_WARNING("Failed to insert device_private_data for device (%p) as the host is out of memory",
+                      reinterpret_cast<void *>(dev));
+
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
 
-   auto result = g_device_data.try_insert(std::make_pair(key, device_data.get()));
-   if (result.has_value())
+   if (replaced != nullptr)
    {
-      device_data.release(); // NOLINT(bugprone-unused-return-value)
-      return VK_SUCCESS;
+      WSI_LOG_WARNING("Hash collision when adding new device (%p)", reinterpret_cast<void *>(dev));
+      destroy(replaced);
    }
-   else
-   {
-      WSI_LOG_WARNING("Failed to insert device_private_data for device (%p) as host is out of memory",
-                      reinterpret_cast<void *>(dev));
 
-      return VK_ERROR_OUT_OF_HOST_MEMORY;
-   }
+   device_data.release(); // NOLINT(bugprone-unused-return-value)
+   return VK_SUCCESS;
 }
 
 void device_private_data::disassociate(VkDevice dev)
 {
    assert(dev != VK_NULL_HANDLE);
-   device_private_data *device_data = nullptr;
+   device_private_data *device_data = g_device_data.erase(get_key(dev));
+   if (device_data == nullptr)
    {
-      scoped_mutex lock(g_data_lock);
-      auto it = g_device_data.find(get_key(dev));
-      if (it == g_device_data.end())
-      {
-         WSI_LOG_WARNING("Failed to find private data for device (%p)", reinterpret_cast<void *>(dev));
-         return;
-      }
-
-      device_data = it->second;
-      g_device_data.erase(it);
+      WSI_LOG_WARNING("Failed to find private data for device (%p)", reinterpret_cast<void *>(dev));
+      return;
    }
 
    destroy(device_data);
@@ -481,9 +490,9 @@ void device_private_data::disassociate(VkDevice dev)
 template <typename dispatchable_type>
 static device_private_data &get_device_private_data(dispatchable_type dispatchable_object)
 {
-   scoped_mutex lock(g_data_lock);
-
-   return *g_device_data.at(get_key(dispatchable_object));
+   device_private_data *device_data = g_device_data.find(get_key(dispatchable_object));
+   assert(device_data != nullptr);
+   return *device_data;
 }
 
 device_private_data &device_private_data::get(VkDevice device)
@@ -586,9 +595,128 @@ void device_private_data::set_swapchain_maintenance1_enabled(bool enable)
    swapchain_maintenance1_enabled = enable;
 }
 
+void device_private_data::set_timeline_semaphore_enabled(bool enable)
+{
+   timeline_semaphore_enabled = enable;
+}
+
+bool device_private_data::is_timeline_semaphore_enabled() const
+{
+   return timeline_semaphore_enabled &&
+          disp.get_fn<PFN_vkWaitSemaphoresKHR>(device_entrypoint_index::WaitSemaphoresKHR).has_value();
+}
+
+void device_private_data::detect_sync_fd_import_support()
+{
+   if (disp.get_fn<PFN_vkImportFenceFdKHR>(device_entrypoint_index::ImportFenceFdKHR).has_value() &&
+       instance_data.disp
+          .get_fn<PFN_vkGetPhysicalDeviceExternalFencePropertiesKHR>(
+             instance_entrypoint_index::GetPhysicalDeviceExternalFencePropertiesKHR)
+          .has_value())
+   {
+      VkPhysicalDeviceExternalFenceInfo external_fence_info = {};
+      external_fence_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_FENCE_INFO;
+      external_fence_info.handleType = VK_EXTERNAL_FENCE_HANDLE_TYPE_SYNC_FD_BIT;
+      VkExternalFenceProperties fence_properties = {};
+      fence_properties.sType = VK_STRUCTURE_TYPE_EXTERNAL_FENCE_PROPERTIES;
+      instance_data.disp.GetPhysicalDeviceExternalFencePropertiesKHR(physical_device, &external_fence_info,
+                                                                     &fence_properties);
+      sync_fd_fence_import_supported.store(
+         (fence_properties.externalFenceFeatures & VK_EXTERNAL_FENCE_FEATURE_IMPORTABLE_BIT) != 0,
+         std::memory_order_relaxed);
+   }
+
+   if (disp.get_fn<PFN_vkImportSemaphoreFdKHR>(device_entrypoint_index::ImportSemaphoreFdKHR).has_value() &&
+       instance_data.disp
+          .get_fn<PFN_vkGetPhysicalDeviceExternalSemaphorePropertiesKHR>(
+             instance_entrypoint_index::GetPhysicalDeviceExternalSemaphorePropertiesKHR)
+          .has_value())
+   {
+      VkPhysicalDeviceExternalSemaphoreInfo external_semaphore_info = {};
+      external_semaphore_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO;
+      external_semaphore_info.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+      VkExternalSemaphoreProperties semaphore_properties = {};
+      semaphore_properties.sType = VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES;
+      instance_data.disp.GetPhysicalDeviceExternalSemaphorePropertiesKHR(physical_device, &external_semaphore_info,
+                                                                         &semaphore_properties);
+      sync_fd_semaphore_import_supported.store(
+         (semaphore_properties.externalSemaphoreFeatures & VK_EXTERNAL_SEMAPHORE_FEATURE_IMPORTABLE_BIT) != 0,
+         std::memory_order_relaxed);
+   }
+}
+
+bool device_private_data::is_sync_fd_fence_import_supported() const
+{
+   return sync_fd_fence_import_supported.load(std::memory_order_relaxed);
+}
+
+bool device_private_data::is_sync_fd_semaphore_import_supported() const
+{
+   return sync_fd_semaphore_import_supported.load(std::memory_order_relaxed);
+}
+
+void device_private_data::disable_sync_fd_fence_import()
+{
+   sync_fd_fence_import_supported.store(false, std::memory_order_relaxed);
+}
+
+void device_private_data::disable_sync_fd_semaphore_import()
+{
+   sync_fd_semaphore_import_supported.store(false, std::memory_order_relaxed);
+}
+
 bool device_private_data::is_swapchain_maintenance1_enabled() const
 {
    return swapchain_maintenance1_enabled;
 }
 
+uint32_t device_private_data::get_dma_buf_memory_type_index(bool protected_memory) const
+{
+   return dma_buf_memory_type_indices[protected_memory ? 1 : 0].load(std::memory_order_relaxed);
+}
+
+void device_private_data::set_dma_buf_memory_type_index(bool protected_memory, uint32_t index)
+{
+   dma_buf_memory_type_indices[protected_memory ? 1 : 0].store(index, std::memory_order_relaxed);
+}
+
+VkResult device_private_data::record_queue_families(const VkDeviceCreateInfo &create_info)
+{
+   for (uint32_t i = 0; i < create_info.queueCreateInfoCount; i++)
+   {
+      const VkDeviceQueueCreateInfo &queue_info = create_info.pQueueCreateInfos[i];
+      if (queue_info.flags != 0)
+      {
+         continue;
+      }
+
+      for (uint32_t queue_index = 0; queue_index < queue_info.queueCount; queue_index++)
+      {
+         VkQueue queue = VK_NULL_HANDLE;
+         disp.GetDeviceQueue(device, queue_info.queueFamilyIndex, queue_index, &queue);
+         TRY_LOG_CALL(SetDeviceLoaderData(device, queue));
+         if (!queue_families.try_insert(std::make_pair(queue, queue_info.queueFamilyIndex)).has_value())
+         {
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+         }
+      }
+   }
+   return VK_SUCCESS;
+}
+
+uint32_t device_private_data::get_queue_family_index(VkQueue queue) const
+{
+   auto it = queue_families.find(queue);
+   return it != queue_families.end() ? it->second : UINT32_MAX;
+}
+
+VkResult device_private_data::set_dedicated_queue(uint32_t queue_family_index, uint32_t queue_index)
+{
+   VkQueue queue = VK_NULL_HANDLE;
+   disp.GetDeviceQueue(device, queue_family_index, queue_index, &queue);
+   TRY_LOG_CALL(SetDeviceLoaderData(device, queue));
+   dedicated_queue = queue;
+   return VK_SUCCESS;
+}
+
 } /* namespace layer */
@@ -27,18 +27,22 @@
 #include "util/platform_set.hpp"
 #include "util/custom_allocator.hpp"
 #include "util/unordered_set.hpp"
-#include "util/unordered_map.hpp"
+#include "util/flat_map.hpp"
 #include "util/extension_list.hpp"
+#include "util/format_modifiers.hpp"
 
 #include <vulkan/vulkan.h>
 #include <vulkan/vk_layer.h>
 #include <vulkan/vk_icd.h>
 #include <vulkan/vulkan_wayland.h>
 
+#include <array>
+#include <atomic>
 #include <memory>
 #include <unordered_set>
 #include <cassert>
 #include <mutex>
+#include <shared_mutex>
 #include <limits>
 #include <cstring>
 #include "wsi_layer_experimental.hpp"
@@ -70,38 +74,54 @@ struct entrypoint
  * @brief Dispatch table base.
  *
  * This struct defines generic get and call function templates for a dispatch table.
+ * The entrypoints are stored in a fixed size array indexed by @p EntrypointIndex, an enum generated from the
+ * entrypoint list of the derived table, so that the internal calls of the layer resolve to a direct array access.
+ * Lookups by name are only needed for the vkGet*ProcAddr paths.
+ *
+ * @tparam EntrypointIndex Enum with one value per entrypoint, followed by a terminating count value.
  */
+template <typename EntrypointIndex>
 class dispatch_table
 {
 public:
-   using entrypoint_list = util::unordered_map<std::string, entrypoint>;
+   /** @brief Number of entrypoints in the dispatch table. */
+   static constexpr size_t entrypoint_count = static_cast<size_t>(EntrypointIndex::count);
+
+   using entrypoint_list = std::array<entrypoint, entrypoint_count>;
 
    /**
-    * @brief Construct a new dispatch table object
+    * @brief Get the function object from the entrypoints.
     *
-    * @param allocator Pre-allocated entrypoint storage container
+    * @tparam FunctionType The signature of the requested function.
+    * @param fn_name The name of the function.
+    * @return the requested function pointer, or std::nullopt.
     */
-   dispatch_table(util::unique_ptr<entrypoint_list> entrypoints)
-      : m_entrypoints(std::move(entrypoints))
+   template <typename FunctionType>
+   std::optional<FunctionType> get_fn(const char *fn_name) const
    {
-      /* This pointer is expected to be valid */
-      assert(m_entrypoints != nullptr);
+      const entrypoint *item = find_entrypoint(fn_name);
+      if (item != nullptr && item->fn != nullptr)
+      {
+         return reinterpret_cast<FunctionType>(item->fn);
+      }
+
+      return std::nullopt;
    }
 
    /**
-    * @brief Get the function object from the entrypoints.
+    * @brief Get the function object from the entrypoints using its compile time index.
     *
     * @tparam FunctionType The signature of the requested function.
-    * @param fn_name The name of the function.
+    * @param index The index of the entrypoint.
     * @return the requested function pointer, or std::nullopt.
     */
    template <typename FunctionType>
-   std::optional<FunctionType> get_fn(const char *fn_name) const
+   std::optional<FunctionType> get_fn(EntrypointIndex index) const
    {
-      auto fn = m_entrypoints->find(fn_name);
-      if (fn != m_entrypoints->end())
+      PFN_vkVoidFunction fn = m_entrypoints[static_cast<size_t>(index)].fn;
+      if (fn != nullptr)
       {
-         return reinterpret_cast<FunctionType>(fn->second.fn);
+         return reinterpret_cast<FunctionType>(fn);
       }
 
       return std::nullopt;
@@ -116,25 +136,56 @@ public:
    void set_user_enabled_extensions(const char *const *extension_names, size_t extension_count);
 
 protected:
+   /**
+    * @brief Construct a new dispatch table object
+    *
+    * @param entrypoints Initial entrypoint descriptions, without the function pointers.
+    */
+   dispatch_table(const entrypoint_list &entrypoints)
+      : m_entrypoints(entrypoints)
+   {
+   }
+
+   /**
+    * @brief Find an entrypoint by name.
+    *
+    * @param fn_name The name of the function.
+    * @return pointer to the entrypoint or nullptr if the dispatch table does not contain it.
+    */
+   const entrypoint *find_entrypoint(const char *fn_name) const;
+
+   /**
+    * @brief Get the function pointer stored at a compile time index.
+    *
+    * @tparam FunctionType The signature of the requested function.
+    * @param index The index of the entrypoint.
+    * @return the function pointer, which is nullptr if it was not resolved.
+    */
+   template <typename FunctionType>
+   FunctionType get_fn_ptr(EntrypointIndex index) const
+   {
+      return reinterpret_cast<FunctionType>(m_entrypoints[static_cast<size_t>(index)].fn);
+   }
+
    /**
     * @brief Call function from the dispatch table entrypoints.
     *
     * @tparam FunctionType The signature of the function to call.
     * @tparam Args Argument types of the function to call.
     *
-    * @param fn_name Name of the function to call.
+    * @param fn     Resolved function pointer, or nullptr if the function is not present in entrypoints.
+    * @param fn_name Name of the function to call, used for diagnostics.
     * @param args Arguments to the function to call.
     * @return function return value or std::nullopt if function is not present in entrypoints
     */
    template <
       typename FunctionType, class... Args, typename ReturnType = std::invoke_result_t<FunctionType, Args...>,
       std::enable_if_t<!std::is_void<ReturnType>::value && !std::is_same<ReturnType, VkResult>::value, bool> = true>
-   std::optional<ReturnType> call_fn(const char *fn_name, Args &&...args) const
+   std::optional<ReturnType> call_fn(FunctionType fn, const char *fn_name, Args &&...args) const
    {
-      auto fn = get_fn<FunctionType>(fn_name);
-      if (fn.has_value())
+      if (fn != nullptr)
       {
-         return (*fn)(std::forward<Args>(args)...);
+         return fn(std::forward<Args>(args)...);
       }
 
       WSI_LOG_WARNING("Call to %s failed, dispatch table does not contain the function.", fn_name);
@@ -149,17 +200,17 @@ protected:
     * @tparam FunctionType The signature of the function to call.
     * @tparam Args Argument types of the function to call.
     *
-    * @param fn_name Name of the function to call.
+    * @param fn     Resolved function pointer, or nullptr if the function is not present in entrypoints.
+    * @param fn_name Name of the function to call, used for diagnostics.
     * @param args Arguments to the function to call.
     */
    template <typename FunctionType, class... Args, typename ReturnType = std::invoke_result_t<FunctionType, Args...>,
              std::enable_if_t<std::is_void<ReturnType>::value, bool> = true>
-   void call_fn(const char *fn_name, Args &&...args) const
+   void call_fn(FunctionType fn, const char *fn_name, Args &&...args) const
    {
-      auto fn = get_fn<FunctionType>(fn_name);
-      if (fn.has_value())
+      if (fn != nullptr)
       {
-         return (*fn)(std::forward<Args>(args)...);
+         return fn(std::forward<Args>(args)...);
       }
 
       WSI_LOG_WARNING("Call to %s failed, dispatch table does not contain the function.", fn_name);
@@ -172,18 +223,18 @@ protected:
     * @tparam FunctionType The signature of the function to call.
     * @tparam Args Argument types of the function to call.
     *
-    * @param fn_name Name of the function to call.
+    * @param fn     Resolved function pointer, or nullptr if the function is not present in entrypoints.
+    * @param fn_name Name of the function to call, used for diagnostics.
     * @param args Arguments to the function to call.
     * @return function return value or VK_ERROR_EXTENSION_NOT_PRESENT if function is not present in entrypoints
     */
    template <typename FunctionType, class... Args, typename ReturnType = std::invoke_result_t<FunctionType, Args...>,
              std::enable_if_t<std::is_same<ReturnType, VkResult>::value, bool> = true>
-   VkResult call_fn(const char *fn_name, Args &&...args) const
+   VkResult call_fn(FunctionType fn, const char *fn_name, Args &&...args) const
    {
-      auto fn = get_fn<FunctionType>(fn_name);
-      if (fn.has_value())
+      if (fn != nullptr)
       {
-         return (*fn)(std::forward<Args>(args)...);
+         return fn(std::forward<Args>(args)...);
       }
 
       WSI_LOG_WARNING("Call to %s failed, dispatch table does not contain the function.", fn_name);
@@ -191,8 +242,8 @@ protected:
       return VK_ERROR_EXTENSION_NOT_PRESENT;
    }
 
-   /** @brief Vector that holds the entrypoints of the dispatch table */
-   util::unique_ptr<entrypoint_list> m_entrypoints;
+   /** @brief Array that holds the entrypoints of the dispatch table */
+   entrypoint_list m_entrypoints;
 };
 
 /* Represents the maximum possible Vulkan API version. */
@@ -215,6 +266,7 @@ static constexpr uint32_t API_VERSION_MAX = UINT32_MAX;
    EP(DestroyInstance, "", VK_API_VERSION_1_0, true)                                                                 \
    EP(GetPhysicalDeviceProperties, "", VK_API_VERSION_1_0, true)                                                     \
    EP(GetPhysicalDeviceImageFormatProperties, "", VK_API_VERSION_1_0, true)                                          \
+   EP(GetPhysicalDeviceQueueFamilyProperties, "", VK_API_VERSION_1_0, true)                                          \
    EP(EnumerateDeviceExtensionProperties, "", VK_API_VERSION_1_0, true)                                              \
    /* VK_KHR_surface */                                                                                              \
    EP(DestroySurfaceKHR, VK_KHR_SURFACE_EXTENSION_NAME, API_VERSION_MAX, false)                                      \
@@ -255,25 +307,38 @@ static constexpr uint32_t API_VERSION_MAX = UINT32_MAX;
    /* 1.1 (without KHR suffix) */                                                                                    \
    EP(GetPhysicalDeviceExternalFencePropertiesKHR, VK_KHR_EXTERNAL_FENCE_CAPABILITIES_EXTENSION_NAME,                \
       VK_API_VERSION_1_1, false)                                                                                     \
+   /* VK_KHR_external_semaphore_capabilities or */                                                                   \
+   /* 1.1 (without KHR suffix) */                                                                                    \
+   EP(GetPhysicalDeviceExternalSemaphorePropertiesKHR, VK_KHR_EXTERNAL_SEMAPHORE_CAPABILITIES_EXTENSION_NAME,        \
+      VK_API_VERSION_1_1, false)                                                                                     \
    EP(GetPhysicalDeviceExternalBufferPropertiesKHR, VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME,              \
       VK_API_VERSION_1_1, false)
 
+/**
+ * @brief Compile time index of each entrypoint in the instance dispatch table.
+ */
+enum class instance_entrypoint_index : size_t
+{
+#define DISPATCH_TABLE_INDEX(name, unused1, unused2, unused3) name,
+   INSTANCE_ENTRYPOINTS_LIST(DISPATCH_TABLE_INDEX)
+#undef DISPATCH_TABLE_INDEX
+      count
+};
+
 /**
  * @brief Struct representing the instance dispatch table.
  */
-class instance_dispatch_table : public dispatch_table
+class instance_dispatch_table : public dispatch_table<instance_entrypoint_index>
 {
 public:
-   static std::optional<instance_dispatch_table> create(const util::allocator &allocator)
-   {
-      auto entrypoints = allocator.make_unique<dispatch_table::entrypoint_list>(allocator);
-      if (entrypoints == nullptr)
-      {
-         return std::nullopt;
-      }
+   using entrypoint_index = instance_entrypoint_index;
 
-      return instance_dispatch_table{ std::move(entrypoints) };
-   }
+   /**
+    * @brief Construct instance dispatch table object
+    *
+    * All function pointers are null until populate() is called.
+    */
+   instance_dispatch_table();
 
    /**
     * @brief Populate the instance dispatch table with functions that it requires.
@@ -302,26 +367,16 @@ public:
     *    disp.GetInstanceProcAddr(instance, fn_name);
     * The result type will be matching the function signature, so there is no need for casting.
     */
-#define DISPATCH_TABLE_SHORTCUT(name, unused1, unused2, unused3)             \
-   template <class... Args>                                                  \
-   auto name(Args &&...args) const                                           \
-   {                                                                         \
-      return call_fn<PFN_vk##name>("vk" #name, std::forward<Args>(args)...); \
+#define DISPATCH_TABLE_SHORTCUT(name, unused1, unused2, unused3)                                                  \
+   template <class... Args>                                                                                       \
+   auto name(Args &&...args) const                                                                                \
+   {                                                                                                              \
+      return call_fn<PFN_vk##name>(get_fn_ptr<PFN_vk##name>(entrypoint_index::name), "vk" #name,                  \
+                                   std::forward<Args>(args)...);                                                  \
    };
 
    INSTANCE_ENTRYPOINTS_LIST(DISPATCH_TABLE_SHORTCUT)
 #undef DISPATCH_TABLE_SHORTCUT
-
-private:
-   /**
-    * @brief Construct instance dispatch table object
-    *
-    * @param table Pre-allocated dispatch table
-    */
-   instance_dispatch_table(util::unique_ptr<dispatch_table::entrypoint_list> table)
-      : dispatch_table{ std::move(table) }
-   {
-   }
 };
 
 /* List of device entrypoints in the layer's device dispatch table.
@@ -352,6 +407,11 @@ private:
    EP(ResetCommandBuffer, "", VK_API_VERSION_1_0, true)                                                            \
    EP(BeginCommandBuffer, "", VK_API_VERSION_1_0, true)                                                            \
    EP(EndCommandBuffer, "", VK_API_VERSION_1_0, true)                                                              \
+   EP(CreateQueryPool, "", VK_API_VERSION_1_0, true)                                                               \
+   EP(DestroyQueryPool, "", VK_API_VERSION_1_0, true)                                                              \
+   EP(GetQueryPoolResults, "", VK_API_VERSION_1_0, true)                                                           \
+   EP(CmdResetQueryPool, "", VK_API_VERSION_1_0, true)                                                             \
+   EP(CmdWriteTimestamp, "", VK_API_VERSION_1_0, true)                                                             \
    EP(CreateImage, "", VK_API_VERSION_1_0, true)                                                                   \
    EP(DestroyImage, "", VK_API_VERSION_1_0, true)                                                                  \
    EP(GetImageMemoryRequirements, "", VK_API_VERSION_1_0, true)                                                    \
@@ -373,6 +433,7 @@ private:
    EP(QueuePresentKHR, VK_KHR_SWAPCHAIN_EXTENSION_NAME, API_VERSION_MAX, false)                                    \
    /* VK_KHR_shared_presentable_image */                                                                           \
    EP(GetSwapchainStatusKHR, VK_KHR_SHARED_PRESENTABLE_IMAGE_EXTENSION_NAME, API_VERSION_MAX, false)               \
+   EP(WaitForPresentKHR, VK_KHR_PRESENT_WAIT_EXTENSION_NAME, API_VERSION_MAX, false)                               \
    /* VK_KHR_device_group + VK_KHR_swapchain or */ /* 1.1 with VK_KHR_swapchain */                                 \
    EP(AcquireNextImage2KHR, VK_KHR_DEVICE_GROUP_EXTENSION_NAME, VK_API_VERSION_1_1, false)                         \
    /* VK_KHR_device_group + VK_KHR_surface or */ /* 1.1 with VK_KHR_swapchain */                                   \
@@ -390,6 +451,9 @@ private:
       false) /* VK_KHR_external_semaphore_fd */                                                                    \
    EP(ImportSemaphoreFdKHR, VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME, API_VERSION_MAX, false)                   \
    EP(GetSemaphoreFdKHR, VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME, API_VERSION_MAX,                             \
+      false) /* VK_KHR_timeline_semaphore or */ /* 1.2 (without KHR suffix) */                                     \
+   EP(WaitSemaphoresKHR, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME, VK_API_VERSION_1_2, false)                      \
+   EP(GetSemaphoreCounterValueKHR, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME, VK_API_VERSION_1_2,                   \
       false) /* VK_KHR_image_drm_format_modifier */                                                                \
    EP(GetImageDrmFormatModifierPropertiesEXT, VK_EXT_IMAGE_DRM_FORMAT_MODIFIER_EXTENSION_NAME, API_VERSION_MAX,    \
       false) /* VK_KHR_sampler_ycbcr_conversion */                                                                 \
@@ -402,24 +466,43 @@ private:
    EP(GetBufferMemoryRequirements2KHR, VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME, VK_API_VERSION_1_1, false) \
    EP(GetImageSparseMemoryRequirements2KHR, VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME, VK_API_VERSION_1_1,   \
       false)                                                                                                       \
-   EP(ReleaseSwapchainImagesEXT, VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME, VK_API_VERSION_1_1, false)
+   EP(ReleaseSwapchainImagesEXT, VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME, VK_API_VERSION_1_1, false)       \
+   DEVICE_ENTRYPOINTS_LIST_EXPERIMENTAL(EP)
+
+/* Device entrypoints that are only available with VULKAN_WSI_LAYER_EXPERIMENTAL. */
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+#define DEVICE_ENTRYPOINTS_LIST_EXPERIMENTAL(EP)                                                         \
+   EP(GetSwapchainTimeDomainPropertiesEXT, VK_EXT_PRESENT_TIMING_EXTENSION_NAME, API_VERSION_MAX, false) \
+   EP(GetCalibratedTimestampsKHR, VK_KHR_CALIBRATED_TIMESTAMPS_EXTENSION_NAME, API_VERSION_MAX, false)
+#else
+#define DEVICE_ENTRYPOINTS_LIST_EXPERIMENTAL(EP)
+#endif
+
+/**
+ * @brief Compile time index of each entrypoint in the device dispatch table.
+ */
+enum class device_entrypoint_index : size_t
+{
+#define DISPATCH_TABLE_INDEX(name, unused1, unused2, unused3) name,
+   DEVICE_ENTRYPOINTS_LIST(DISPATCH_TABLE_INDEX)
+#undef DISPATCH_TABLE_INDEX
+      count
+};
 
 /**
  * @brief Struct representing the device dispatch table.
  */
-class device_dispatch_table : public dispatch_table
+class device_dispatch_table : public dispatch_table<device_entrypoint_index>
 {
 public:
-   static std::optional<device_dispatch_table> create(const util::allocator &allocator)
-   {
-      auto entrypoints = allocator.make_unique<dispatch_table::entrypoint_list>(allocator);
-      if (entrypoints == nullptr)
-      {
-         return std::nullopt;
-      }
+   using entrypoint_index = device_entrypoint_index;
 
-      return device_dispatch_table{ std::move(entrypoints) };
-   }
+   /**
+    * @brief Construct device dispatch table object
+    *
+    * All function pointers are null until populate() is called.
+    */
+   device_dispatch_table();
 
    /**
     * @brief Populate the device dispatch table with functions that it requires.
@@ -448,35 +531,16 @@ public:
     *    disp.GetDeviceProcAddr(instance, fn_name);
     * The result type will be matching the function signature, so there is no need for casting.
     */
-#define DISPATCH_TABLE_SHORTCUT(name, unused1, unused2, unused3)             \
-   template <class... Args>                                                  \
-   auto name(Args &&...args) const                                           \
-   {                                                                         \
-      return call_fn<PFN_vk##name>("vk" #name, std::forward<Args>(args)...); \
+#define DISPATCH_TABLE_SHORTCUT(name, unused1, unused2, unused3)                                                  \
+   template <class... Args>                                                                                       \
+   auto name(Args &&...args) const                                                                                \
+   {                                                                                                              \
+      return call_fn<PFN_vk##name>(get_fn_ptr<PFN_vk##name>(entrypoint_index::name), "vk" #name,                  \
+                                   std::forward<Args>(args)...);                                                  \
    };
 
    DEVICE_ENTRYPOINTS_LIST(DISPATCH_TABLE_SHORTCUT)
 #undef DISPATCH_TABLE_SHORTCUT
-
-#if VULKAN_WSI_LAYER_EXPERIMENTAL
-   template <class... Args>
-   auto GetSwapchainTimeDomainPropertiesEXT(Args &&...args) const
-   {
-      return call_fn<PFN_vkGetSwapchainTimeDomainPropertiesEXT>("vkGetSwapchainTimeDomainPropertiesEXT",
-                                                                std::forward<Args>(args)...);
-   };
-#endif
-
-private:
-   /**
-    * @brief Construct instance dispatch table object
-    *
-    * @param table Pre-allocated dispatch table
-    */
-   device_dispatch_table(util::unique_ptr<dispatch_table::entrypoint_list> table)
-      : dispatch_table{ std::move(table) }
-   {
-   }
 };
 
 /**
@@ -584,6 +648,19 @@ public:
     */
    bool should_layer_handle_surface(VkPhysicalDevice phys_dev, VkSurfaceKHR surface);
 
+   /**
+    * @brief Get the WSI surface for a surface command that should be handled by the WSI layer.
+    *
+    * This is equivalent to @ref should_layer_handle_surface followed by @ref get_surface, but only looks up
+    * @p surface once.
+    *
+    * @param phys_dev Physical device involved in the Vulkan command.
+    * @param surface The surface involved in the Vulkan command.
+    *
+    * @return The WSI surface if the layer should handle commands for @p surface, otherwise nullptr.
+    */
+   wsi::surface *get_layer_handled_surface(VkPhysicalDevice phys_dev, VkSurfaceKHR surface);
+
    /**
     * @brief Check whether the given surface is supported for presentation via the layer.
     *
@@ -634,6 +711,30 @@ public:
     */
    bool is_instance_extension_enabled(const char *extension_name) const;
 
+   /**
+    * @brief Check whether a known instance extension is enabled.
+    */
+   bool is_instance_extension_enabled(util::known_extension extension) const
+   {
+      return enabled_extensions.contains(extension);
+   }
+
+   /**
+    * @brief Check whether all the known instance extensions in @p extensions are enabled.
+    */
+   bool is_instance_extension_enabled(const util::known_extension_set &extensions) const
+   {
+      return enabled_extensions.contains(extensions);
+   }
+
+   /**
+    * @brief Get the cache of the DRM format modifier image properties queried for the instance's physical devices.
+    */
+   util::drm_image_format_cache &get_drm_image_format_cache()
+   {
+      return image_format_cache;
+   }
+
    const instance_dispatch_table disp;
    const uint32_t api_version;
 
@@ -676,17 +777,29 @@ private:
     * Uses plain pointers to store surface data as the lifetime of the object is explicitly controlled by the Vulkan
     * application. The application may also use different but compatible host allocators on creation and destruction.
     */
-   util::unordered_map<VkSurfaceKHR, wsi::surface *> surfaces;
+   util::flat_map<VkSurfaceKHR, wsi::surface *> surfaces;
 
    /**
     * @brief Lock for thread safe access to @ref surfaces
+    *
+    * Surface queries only take the lock in shared mode, so that they do not serialize with each other. The lock is
+    * only taken exclusively when surfaces are created or destroyed.
     */
-   std::mutex surfaces_lock;
+   std::shared_mutex surfaces_lock;
 
    /**
     * @brief List with the names of the enabled instance extensions.
     */
    util::extension_list enabled_extensions;
+
+   /**
+    * @brief Mask of the enabled extensions of LAYER_INSTANCE_EXTENSIONS_LIST.
+    */
+
+   /**
+    * @brief Results of the image format queries made when creating swapchains.
+    */
+   util::drm_image_format_cache image_format_cache;
 };
 
 /**
@@ -791,6 +904,22 @@ public:
     */
    bool is_device_extension_enabled(const char *extension_name) const;
 
+   /**
+    * @brief Check whether a known device extension is enabled.
+    */
+   bool is_device_extension_enabled(util::known_extension extension) const
+   {
+      return enabled_extensions.contains(extension);
+   }
+
+   /**
+    * @brief Check whether all the known device extensions in @p extensions are enabled.
+    */
+   bool is_device_extension_enabled(const util::known_extension_set &extensions) const
+   {
+      return enabled_extensions.contains(extensions);
+   }
+
    const device_dispatch_table disp;
    instance_private_data &instance_data;
    const PFN_vkSetDeviceLoaderData SetDeviceLoaderData;
@@ -841,6 +970,51 @@ public:
     */
    void set_swapchain_maintenance1_enabled(bool enable);
 
+   /**
+    * @brief Set whether the application enabled the timeline semaphore feature on this device.
+    *
+    * @param enable Value to set timeline_semaphore_enabled member variable.
+    */
+   void set_timeline_semaphore_enabled(bool enable);
+
+   /**
+    * @brief Check whether timeline semaphores can be used on this device.
+    *
+    * @return true if enabled, false otherwise.
+    */
+   bool is_timeline_semaphore_enabled() const;
+
+   /**
+    * @brief Query once whether the device can import sync FDs into fences and semaphores.
+    *
+    * Called at device creation so that acquiring an image does not need to query or probe support every time.
+    */
+   void detect_sync_fd_import_support();
+
+   /**
+    * @brief Check whether sync FDs can be imported into fences.
+    *
+    * @return true if supported, false otherwise.
+    */
+   bool is_sync_fd_fence_import_supported() const;
+
+   /**
+    * @brief Check whether sync FDs can be imported into semaphores.
+    *
+    * @return true if supported, false otherwise.
+    */
+   bool is_sync_fd_semaphore_import_supported() const;
+
+   /**
+    * @brief Stop importing sync FDs into fences, after the ICD rejected an import it claimed to support.
+    */
+   void disable_sync_fd_fence_import();
+
+   /**
+    * @brief Stop importing sync FDs into semaphores, after the ICD rejected an import it claimed to support.
+    */
+   void disable_sync_fd_semaphore_import();
+
    /**
     * @brief Check whether the swapchain maintenance1 features are enabled for this device.
     *
@@ -848,6 +1022,74 @@ public:
     */
    bool is_swapchain_maintenance1_enabled() const;
 
+   /**
+    * @brief Get the memory type index cached for dma-bufs imported from a wsialloc heap.
+    *
+    * All the buffers of a heap share a memory type, so the memory type only needs to be queried for one of them.
+    *
+    * @param protected_memory Whether the buffers come from the protected heap.
+    *
+    * @return The memory type index, or UINT32_MAX if none was cached yet.
+    */
+   uint32_t get_dma_buf_memory_type_index(bool protected_memory) const;
+
+   /**
+    * @brief Cache the memory type index of dma-bufs imported from a wsialloc heap.
+    *
+    * @param protected_memory Whether the buffers come from the protected heap.
+    * @param index            The memory type index.
+    */
+   void set_dma_buf_memory_type_index(bool protected_memory, uint32_t index);
+
+   /**
+    * @brief Record the queue family of each queue created with the device.
+    *
+    * The layer needs the family of a queue to record commands for it, which VkQueue handles do not expose. Queues
+    * created with flags are not recorded, as they can only be retrieved with vkGetDeviceQueue2.
+    *
+    * @param create_info The create info of the device.
+    *
+    * @return VK_SUCCESS if successful, otherwise an error.
+    */
+   VkResult record_queue_families(const VkDeviceCreateInfo &create_info);
+
+   /**
+    * @brief Get the queue family of a queue recorded by @ref record_queue_families.
+    *
+    * @param queue The queue.
+    *
+    * @return The queue family index, or UINT32_MAX if the queue was not recorded.
+    */
+   uint32_t get_queue_family_index(VkQueue queue) const;
+
+   /**
+    * @brief Retrieve the queue reserved by the layer at device creation for its own submissions.
+    *
+    * @param queue_family_index The family of the reserved queue.
+    * @param queue_index        The index of the reserved queue in its family.
+    *
+    * @return VK_SUCCESS if successful, otherwise an error.
+    */
+   VkResult set_dedicated_queue(uint32_t queue_family_index, uint32_t queue_index);
+
+   /**
+    * @brief Get the queue reserved by the layer, which the application has no access to.
+    *
+    * @return The queue, or VK_NULL_HANDLE if no queue was reserved.
+    */
+   VkQueue get_dedicated_queue() const
+   {
+      return dedicated_queue;
+   }
+
+   /**
+    * @brief Lock the layer's submissions to its internal queue, which is shared by the swapchains of the device.
+    */
+   std::unique_lock<std::mutex> lock_internal_queue()
+   {
+      return std::unique_lock<std::mutex>(internal_queue_lock);
+   }
+
 private:
    /* Allow util::allocator to access the private constructor */
    friend util::allocator;
@@ -883,6 +1125,10 @@ private:
     */
    util::extension_list enabled_extensions;
 
+   /**
+    * @brief Mask of the enabled extensions of LAYER_DEVICE_EXTENSIONS_LIST.
+    */
+
 #if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
    /**
     * @brief Stores whether the device supports controlling the swapchain image compression.
@@ -906,6 +1152,37 @@ private:
     * @brief Stores whether the device has enabled support for the swapchain maintenance1 features.
     */
    bool swapchain_maintenance1_enabled;
+
+   /**
+    * @brief Stores whether the timeline semaphore feature is enabled for this device.
+    */
+   bool timeline_semaphore_enabled{ false };
+
+   /**
+    * @brief Stores whether sync FDs can be imported into fences and semaphores.
+    */
+   std::atomic<bool> sync_fd_fence_import_supported{ false };
+   std::atomic<bool> sync_fd_semaphore_import_supported{ false };
+
+   /**
+    * @brief Memory type index of imported dma-bufs, for unprotected and protected buffers, or UINT32_MAX if unknown.
+    */
+   std::array<std::atomic<uint32_t>, 2> dma_buf_memory_type_indices{ { UINT32_MAX, UINT32_MAX } };
+
+   /**
+    * @brief Queue family of each queue of the device, written once at device creation.
+    */
+   util::flat_map<VkQueue, uint32_t> queue_families;
+
+   /**
+    * @brief Queue reserved for the layer's submissions, VK_NULL_HANDLE if there is none.
+    */
+   VkQueue dedicated_queue{ VK_NULL_HANDLE };
+
+   /**
+    * @brief Serializes the submissions of the swapchains to the layer's internal queue.
+    */
+   std::mutex internal_queue_lock;
 };
 
 } /* namespace layer */
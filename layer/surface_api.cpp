@@ -24,6 +24,7 @@
 
 #include <cassert>
 #include <wsi/wsi_factory.hpp>
+#include <wsi/surface.hpp>
 #include "private_data.hpp"
 #include "surface_api.hpp"
 
@@ -35,10 +36,10 @@ wsi_layer_vkGetPhysicalDeviceSurfaceCapabilitiesKHR(VkPhysicalDevice physicalDev
                                                     VkSurfaceCapabilitiesKHR *pSurfaceCapabilities) VWL_API_POST
 {
    auto &instance = layer::instance_private_data::get(physicalDevice);
-   if (instance.should_layer_handle_surface(physicalDevice, surface))
+   wsi::surface *wsi_surface = instance.get_layer_handled_surface(physicalDevice, surface);
+   if (wsi_surface != nullptr)
    {
-      wsi::surface_properties *props = wsi::get_surface_properties(instance, surface);
-      assert(props != nullptr);
+      wsi::surface_properties *props = &wsi_surface->get_properties();
       return props->get_surface_capabilities(physicalDevice, pSurfaceCapabilities);
    }
 
@@ -58,10 +59,10 @@ wsi_layer_vkGetPhysicalDeviceSurfaceCapabilities2KHR(VkPhysicalDevice physicalDe
                                                      VkSurfaceCapabilities2KHR *pSurfaceCapabilities) VWL_API_POST
 {
    auto &instance = layer::instance_private_data::get(physicalDevice);
-   if (instance.should_layer_handle_surface(physicalDevice, pSurfaceInfo->surface))
+   wsi::surface *wsi_surface = instance.get_layer_handled_surface(physicalDevice, pSurfaceInfo->surface);
+   if (wsi_surface != nullptr)
    {
-      wsi::surface_properties *props = wsi::get_surface_properties(instance, pSurfaceInfo->surface);
-      assert(props != nullptr);
+      wsi::surface_properties *props = &wsi_surface->get_properties();
 
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
       auto *surf_caps_ext = util::find_extension<VkPresentTimingSurfaceCapabilitiesEXT>(
@@ -93,10 +94,10 @@ wsi_layer_vkGetPhysicalDeviceSurfaceFormatsKHR(VkPhysicalDevice physicalDevice,
                                                VkSurfaceFormatKHR *pSurfaceFormats) VWL_API_POST
 {
    auto &instance = layer::instance_private_data::get(physicalDevice);
-   if (instance.should_layer_handle_surface(physicalDevice, surface))
+   wsi::surface *wsi_surface = instance.get_layer_handled_surface(physicalDevice, surface);
+   if (wsi_surface != nullptr)
    {
-      wsi::surface_properties *props = wsi::get_surface_properties(instance, surface);
-      assert(props != nullptr);
+      wsi::surface_properties *props = &wsi_surface->get_properties();
       return props->get_surface_formats(physicalDevice, pSurfaceFormatCount, pSurfaceFormats);
    }
 
@@ -114,10 +115,10 @@ wsi_layer_vkGetPhysicalDeviceSurfaceFormats2KHR(VkPhysicalDevice physicalDevice,
                                                 VkSurfaceFormat2KHR *pSurfaceFormats) VWL_API_POST
 {
    auto &instance = layer::instance_private_data::get(physicalDevice);
-   if (instance.should_layer_handle_surface(physicalDevice, pSurfaceInfo->surface))
+   wsi::surface *wsi_surface = instance.get_layer_handled_surface(physicalDevice, pSurfaceInfo->surface);
+   if (wsi_surface != nullptr)
    {
-      wsi::surface_properties *props = wsi::get_surface_properties(instance, pSurfaceInfo->surface);
-      assert(props != nullptr);
+      wsi::surface_properties *props = &wsi_surface->get_properties();
       return props->get_surface_formats(physicalDevice, pSurfaceFormatCount, nullptr, pSurfaceFormats);
    }
 
@@ -134,10 +135,10 @@ wsi_layer_vkGetPhysicalDeviceSurfacePresentModesKHR(VkPhysicalDevice physicalDev
                                                     VkPresentModeKHR *pPresentModes) VWL_API_POST
 {
    auto &instance = layer::instance_private_data::get(physicalDevice);
-   if (instance.should_layer_handle_surface(physicalDevice, surface))
+   wsi::surface *wsi_surface = instance.get_layer_handled_surface(physicalDevice, surface);
+   if (wsi_surface != nullptr)
    {
-      wsi::surface_properties *props = wsi::get_surface_properties(instance, surface);
-      assert(props != nullptr);
+      wsi::surface_properties *props = &wsi_surface->get_properties();
       return props->get_surface_present_modes(physicalDevice, surface, pPresentModeCount, pPresentModes);
    }
 
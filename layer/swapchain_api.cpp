@@ -28,15 +28,18 @@
  * @brief Contains the Vulkan entrypoints for the swapchain.
  */
 
+#include <atomic>
 #include <cassert>
 #include <cstdlib>
 #include <new>
 
 #include <wsi/wsi_factory.hpp>
+#include <wsi/surface.hpp>
 
 #include "private_data.hpp"
 #include "swapchain_api.hpp"
 #include <util/helpers.hpp>
+#include <util/small_vector.hpp>
 #include "wsi/synchronization.hpp"
 
 VWL_VKAPI_CALL(VkResult)
@@ -124,40 +127,163 @@ wsi_layer_vkAcquireNextImageKHR(VkDevice device, VkSwapchainKHR swapc, uint64_t
    return sc->acquire_next_image(timeout, semaphore, fence, pImageIndex);
 }
 
-static VkResult submit_wait_request(VkQueue queue, const VkPresentInfoKHR &present_info,
-                                    layer::device_private_data &device_data, bool &frame_boundary_event_handled)
+/* Presents to up to this many swapchains at once do not allocate. */
+static constexpr size_t INLINE_PRESENT_SWAPCHAIN_COUNT = 4;
+
+template <typename T>
+using present_swapchain_list = util::small_vector<T, INLINE_PRESENT_SWAPCHAIN_COUNT>;
+
+/**
+ * @brief Submits the work shared by the presents to several swapchains.
+ *
+ * A single submission waits for the application's semaphores. It signals the payloads of the batched presents, and the
+ * present semaphores of the other images, whose presents then wait for them.
+ */
+static VkResult submit_shared_present_request(VkQueue queue, const VkPresentInfoKHR &present_info,
+                                              const VkFrameBoundaryEXT *present_frame_boundary,
+                                              layer::device_private_data &device_data,
+                                              const present_swapchain_list<wsi::batched_present> &batched_presents,
+                                              const present_swapchain_list<VkResult> &results)
 {
-   util::vector<VkSemaphore> swapchain_semaphores{ util::allocator(device_data.get_allocator(),
-                                                                   VK_SYSTEM_ALLOCATION_SCOPE_COMMAND) };
-   if (!swapchain_semaphores.try_resize(present_info.swapchainCount))
+   util::allocator allocator(device_data.get_allocator(), VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   present_swapchain_list<VkSemaphore> wait_semaphores(allocator);
+   present_swapchain_list<uint64_t> wait_values(allocator);
+   present_swapchain_list<VkPipelineStageFlags> wait_stages(allocator);
+   present_swapchain_list<VkSemaphore> signal_semaphores(allocator);
+   present_swapchain_list<uint64_t> signal_values(allocator);
+   bool uses_timeline = false;
+
+   /* Values for binary semaphores are ignored. */
+   auto add_wait = [&](VkSemaphore semaphore, uint64_t value) {
+      return wait_semaphores.try_push_back(semaphore) && wait_values.try_push_back(value) &&
+             wait_stages.try_push_back(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+   };
+   auto add_signal = [&](VkSemaphore semaphore, uint64_t value) {
+      return signal_semaphores.try_push_back(semaphore) && signal_values.try_push_back(value);
+   };
+
+   for (uint32_t i = 0; i < present_info.waitSemaphoreCount; ++i)
    {
-      return VK_ERROR_OUT_OF_HOST_MEMORY;
+      if (!add_wait(present_info.pWaitSemaphores[i], 0))
+      {
+         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
    }
 
    for (uint32_t i = 0; i < present_info.swapchainCount; ++i)
    {
-      auto swapchain = reinterpret_cast<wsi::swapchain_base *>(present_info.pSwapchains[i]);
-      swapchain_semaphores[i] = swapchain->get_image_present_semaphore(present_info.pImageIndices[i]);
-   }
+      if (results[i] != VK_SUCCESS)
+      {
+         continue;
+      }
+
+      const wsi::batched_present &batched = batched_presents[i];
+      bool added = true;
+      if (batched.payload_signal.semaphore == VK_NULL_HANDLE)
+      {
+         auto swapchain = reinterpret_cast<wsi::swapchain_base *>(present_info.pSwapchains[i]);
+         added = add_signal(swapchain->get_image_present_semaphore(present_info.pImageIndices[i]), 0);
+      }
+      else
+      {
+         uses_timeline = true;
+         added = add_signal(batched.payload_signal.semaphore, batched.payload_signal.value);
+         if (added && batched.payload_wait.semaphore != VK_NULL_HANDLE)
+         {
+            added = add_wait(batched.payload_wait.semaphore, batched.payload_wait.value);
+         }
+         if (added && batched.present_fence_wait != VK_NULL_HANDLE)
+         {
+            added = add_signal(batched.present_fence_wait, 0);
+         }
+      }
 
-   wsi::queue_submit_semaphores semaphores = { present_info.pWaitSemaphores, present_info.waitSemaphoreCount,
-                                               swapchain_semaphores.data(),
-                                               static_cast<uint32_t>(swapchain_semaphores.size()) };
+      if (!added)
+      {
+         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+   }
 
    void *submission_pnext = nullptr;
-   auto frame_boundary = wsi::create_frame_boundary(present_info);
+   auto frame_boundary = wsi::create_frame_boundary(present_frame_boundary);
    if (frame_boundary.has_value())
    {
       submission_pnext = &frame_boundary.value();
    }
 
-   /* Notify that we don't want to pass any further frame boundary events */
-   frame_boundary_event_handled = submission_pnext != nullptr;
+   VkTimelineSemaphoreSubmitInfo timeline_info = {};
+   if (uses_timeline)
+   {
+      timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+      timeline_info.pNext = submission_pnext;
+      timeline_info.waitSemaphoreValueCount = static_cast<uint32_t>(wait_values.size());
+      timeline_info.pWaitSemaphoreValues = wait_values.data();
+      timeline_info.signalSemaphoreValueCount = static_cast<uint32_t>(signal_values.size());
+      timeline_info.pSignalSemaphoreValues = signal_values.data();
+      submission_pnext = &timeline_info;
+   }
 
-   TRY(wsi::sync_queue_submit(device_data, queue, VK_NULL_HANDLE, semaphores, submission_pnext));
+   VkSubmitInfo submit_info = { VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                                submission_pnext,
+                                static_cast<uint32_t>(wait_semaphores.size()),
+                                wait_semaphores.data(),
+                                wait_stages.data(),
+                                0,
+                                nullptr,
+                                static_cast<uint32_t>(signal_semaphores.size()),
+                                signal_semaphores.data() };
+
+   TRY(device_data.disp.QueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE));
    return VK_SUCCESS;
 }
 
+/**
+ * @brief Tag the presents to swapchains of the same present group, so that they are shown together.
+ *
+ * @param present_info   The present info.
+ * @param present_params The presentation parameters of each swapchain of @p present_info.
+ */
+static void assign_present_groups(const VkPresentInfoKHR &present_info,
+                                  present_swapchain_list<wsi::swapchain_presentation_parameters> &present_params)
+{
+   static std::atomic<uint64_t> next_present_group_id{ 1 };
+
+   for (uint32_t i = 0; i < present_info.swapchainCount; ++i)
+   {
+      auto *sc = reinterpret_cast<wsi::swapchain_base *>(present_info.pSwapchains[i]);
+      const void *group = sc->get_present_group(present_params[i]);
+      if (group == nullptr || present_params[i].pending_present.present_group_id != 0)
+      {
+         continue;
+      }
+
+      uint32_t group_size = 0;
+      for (uint32_t j = i; j < present_info.swapchainCount; ++j)
+      {
+         auto *other_sc = reinterpret_cast<wsi::swapchain_base *>(present_info.pSwapchains[j]);
+         if (other_sc->get_present_group(present_params[j]) == group)
+         {
+            group_size++;
+         }
+      }
+      if (group_size < 2)
+      {
+         continue;
+      }
+
+      const uint64_t group_id = next_present_group_id.fetch_add(1, std::memory_order_relaxed);
+      for (uint32_t j = i; j < present_info.swapchainCount; ++j)
+      {
+         auto *other_sc = reinterpret_cast<wsi::swapchain_base *>(present_info.pSwapchains[j]);
+         if (other_sc->get_present_group(present_params[j]) == group)
+         {
+            present_params[j].pending_present.present_group_id = group_id;
+            present_params[j].pending_present.present_group_size = group_size;
+         }
+      }
+   }
+}
+
 VWL_VKAPI_CALL(VkResult)
 wsi_layer_vkQueuePresentKHR(VkQueue queue, const VkPresentInfoKHR *pPresentInfo) VWL_API_POST
 {
@@ -171,64 +297,111 @@ wsi_layer_vkQueuePresentKHR(VkQueue queue, const VkPresentInfoKHR *pPresentInfo)
       return device_data.disp.QueuePresentKHR(queue, pPresentInfo);
    }
 
-   /* Avoid allocating on the heap when there is only one swapchain. */
    const VkPresentInfoKHR *present_info = pPresentInfo;
-   bool use_image_present_semaphore = false;
-   bool frame_boundary_event_handled = true;
-   if (pPresentInfo->swapchainCount > 1)
+   util::allocator allocator(device_data.get_allocator(), VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   present_swapchain_list<wsi::swapchain_presentation_parameters> present_params(allocator);
+   present_swapchain_list<wsi::batched_present> batched_presents(allocator);
+   present_swapchain_list<VkResult> results(allocator);
+   if (!present_params.try_resize(pPresentInfo->swapchainCount) ||
+       !batched_presents.try_resize(pPresentInfo->swapchainCount) || !results.try_resize(pPresentInfo->swapchainCount))
    {
-      TRY_LOG_CALL(submit_wait_request(queue, *pPresentInfo, device_data, frame_boundary_event_handled));
-      use_image_present_semaphore = true;
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
 
-   VkResult ret = VK_SUCCESS;
-
-   auto *present_ids = util::find_extension<VkPresentIdKHR>(VK_STRUCTURE_TYPE_PRESENT_ID_KHR, pPresentInfo->pNext);
-   const auto present_fence_info = util::find_extension<VkSwapchainPresentFenceInfoEXT>(
-      VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT, present_info->pNext);
-   const auto swapchain_present_mode_info = util::find_extension<VkSwapchainPresentModeInfoEXT>(
-      VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_MODE_INFO_EXT, present_info->pNext);
+   /* The pNext chain is walked once, for all the swapchains of the call. */
+   const wsi::present_extensions extensions = wsi::find_present_extensions(*pPresentInfo);
+   const auto *present_ids = extensions.present_ids;
+   const auto *present_fence_info = extensions.present_fence_info;
+   const auto *swapchain_present_mode_info = extensions.present_mode_info;
+   const auto *present_regions = extensions.present_regions;
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
-   const auto present_timings_info =
-      util::find_extension<VkPresentTimingsInfoEXT>(VK_STRUCTURE_TYPE_PRESENT_TIMINGS_INFO_EXT, present_info->pNext);
+   const auto *present_timings_info = extensions.present_timings_info;
    if (present_timings_info)
    {
       assert(present_timings_info->swapchainCount == pPresentInfo->swapchainCount);
    }
 #endif
+
+   /* Presents to several swapchains wait on the image present semaphores signalled by the shared submission, which
+    * also passes the application's frame boundary. Avoid the shared submission when there is only one swapchain.
+    */
+   const bool shared_submission = pPresentInfo->swapchainCount > 1;
+   const bool frame_boundary_event_handled = !shared_submission || extensions.frame_boundary != nullptr;
    for (uint32_t i = 0; i < pPresentInfo->swapchainCount; ++i)
    {
-      VkSwapchainKHR swapc = pPresentInfo->pSwapchains[i];
-      auto *sc = reinterpret_cast<wsi::swapchain_base *>(swapc);
-      assert(sc != nullptr);
-
       uint64_t present_id = 0; /* No present ID by default */
       if (present_ids && present_ids->pPresentIds && present_ids->swapchainCount == pPresentInfo->swapchainCount)
       {
          present_id = present_ids->pPresentIds[i];
       }
 
-      wsi::swapchain_presentation_parameters present_params{};
-      present_params.present_fence = (present_fence_info == nullptr) ? VK_NULL_HANDLE : present_fence_info->pFences[i];
+      wsi::swapchain_presentation_parameters &params = present_params[i];
+      params = {};
+      params.present_fence = (present_fence_info == nullptr) ? VK_NULL_HANDLE : present_fence_info->pFences[i];
       if (swapchain_present_mode_info != nullptr)
       {
-         present_params.switch_presentation_mode = true;
-         present_params.present_mode = swapchain_present_mode_info->pPresentModes[i];
+         params.switch_presentation_mode = true;
+         params.present_mode = swapchain_present_mode_info->pPresentModes[i];
       }
 
-      present_params.pending_present.image_index = pPresentInfo->pImageIndices[i];
-      present_params.pending_present.present_id = present_id;
+      params.pending_present.image_index = pPresentInfo->pImageIndices[i];
+      params.pending_present.present_id = present_id;
 
-      present_params.use_image_present_semaphore = use_image_present_semaphore;
-      present_params.handle_present_frame_boundary_event = frame_boundary_event_handled;
+      if (present_regions && present_regions->pRegions &&
+          present_regions->swapchainCount == pPresentInfo->swapchainCount)
+      {
+         params.present_region = &present_regions->pRegions[i];
+      }
 
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
       if (present_timings_info)
       {
-         present_params.present_timing_info = &(present_timings_info->pTimingInfos[i]);
+         params.present_timing_info = &(present_timings_info->pTimingInfos[i]);
       }
 #endif
-      VkResult res = sc->queue_present(queue, present_info, present_params);
+      params.use_image_present_semaphore = shared_submission;
+      params.handle_present_frame_boundary_event = frame_boundary_event_handled;
+      params.frame_boundary = extensions.frame_boundary;
+      batched_presents[i] = {};
+      results[i] = VK_SUCCESS;
+   }
+
+   if (shared_submission)
+   {
+      assign_present_groups(*pPresentInfo, present_params);
+
+      /* Presents whose payloads can be signalled by the shared submission are batched, so that they need no
+       * submission of their own. */
+      for (uint32_t i = 0; i < pPresentInfo->swapchainCount; ++i)
+      {
+         auto *sc = reinterpret_cast<wsi::swapchain_base *>(pPresentInfo->pSwapchains[i]);
+         if (sc->can_batch_present(present_params[i]))
+         {
+            results[i] = sc->prepare_batched_present(queue, present_params[i], batched_presents[i]);
+         }
+      }
+
+      TRY_LOG_CALL(submit_shared_present_request(queue, *pPresentInfo, extensions.frame_boundary, device_data,
+                                                batched_presents, results));
+   }
+
+   VkResult ret = VK_SUCCESS;
+   for (uint32_t i = 0; i < pPresentInfo->swapchainCount; ++i)
+   {
+      VkSwapchainKHR swapc = pPresentInfo->pSwapchains[i];
+      auto *sc = reinterpret_cast<wsi::swapchain_base *>(swapc);
+      assert(sc != nullptr);
+
+      VkResult res = results[i];
+      if (res == VK_SUCCESS && batched_presents[i].payload_signal.semaphore != VK_NULL_HANDLE)
+      {
+         res = sc->finish_batched_present(queue, present_params[i], batched_presents[i]);
+      }
+      else if (res == VK_SUCCESS)
+      {
+         res = sc->queue_present(queue, present_info, present_params[i]);
+      }
+
       if (pPresentInfo->pResults != nullptr)
       {
          pPresentInfo->pResults[i] = res;
@@ -287,14 +460,14 @@ wsi_layer_vkGetPhysicalDevicePresentRectanglesKHR(VkPhysicalDevice physicalDevic
 
    auto &instance = layer::instance_private_data::get(physicalDevice);
 
-   if (!instance.should_layer_handle_surface(physicalDevice, surface))
+   wsi::surface *wsi_surface = instance.get_layer_handled_surface(physicalDevice, surface);
+   if (wsi_surface == nullptr)
    {
       return instance.disp.GetPhysicalDevicePresentRectanglesKHR(physicalDevice, surface, pRectCount, pRects);
    }
 
    VkResult result;
-   wsi::surface_properties *props = wsi::get_surface_properties(instance, surface);
-   assert(props);
+   wsi::surface_properties *props = &wsi_surface->get_properties();
 
    if (nullptr == pRects)
    {
@@ -371,7 +544,7 @@ wsi_layer_vkBindImageMemory2(VkDevice device, uint32_t bindInfoCount,
    auto &device_data = layer::device_private_data::get(device);
 
    VkResult endpoint_result = VK_SUCCESS;
-   bool maintenance_6 = device_data.is_device_extension_enabled(VK_KHR_MAINTENANCE_6_EXTENSION_NAME);
+   bool maintenance_6 = device_data.is_device_extension_enabled(util::known_extension::KHR_maintenance6);
    for (uint32_t i = 0; i < bindInfoCount; i++)
    {
       VkResult result = VK_SUCCESS;
@@ -431,3 +604,19 @@ wsi_layer_vkGetSwapchainStatusKHR(VkDevice device, VkSwapchainKHR swapchain) VWL
 
    return sc->get_swapchain_status();
 }
+
+VWL_VKAPI_CALL(VkResult)
+wsi_layer_vkWaitForPresentKHR(VkDevice device, VkSwapchainKHR swapchain, uint64_t presentId,
+                              uint64_t timeout) VWL_API_POST
+{
+   auto &device_data = layer::device_private_data::get(device);
+
+   if (!device_data.layer_owns_swapchain(swapchain))
+   {
+      return device_data.disp.WaitForPresentKHR(device, swapchain, presentId, timeout);
+   }
+
+   auto *sc = reinterpret_cast<wsi::swapchain_base *>(swapchain);
+
+   return sc->wait_for_present_id(presentId, timeout);
+}
@@ -189,4 +189,99 @@ VWL_VKAPI_CALL(VkResult)
 wsi_layer_vkGetPastPresentationTimingEXT(
    VkDevice device, const VkPastPresentationTimingInfoEXT *pPastPresentationTimingInfo,
    VkPastPresentationTimingPropertiesEXT *pPastPresentationTimingProperties) VWL_API_POST;
+
+/* Layer query of the latency of the acquire and present paths of a swapchain. */
+#define VK_SWAPCHAIN_LATENCY_HISTOGRAM_BUCKET_COUNT_ARM 64
+
+typedef enum VkSwapchainLatencyIntervalARM
+{
+   VK_SWAPCHAIN_LATENCY_INTERVAL_ACQUIRE_WAIT_ARM = 0,
+   VK_SWAPCHAIN_LATENCY_INTERVAL_QUEUE_PRESENT_ARM = 1,
+   VK_SWAPCHAIN_LATENCY_INTERVAL_PENDING_ARM = 2,
+   VK_SWAPCHAIN_LATENCY_INTERVAL_PRESENT_WAIT_ARM = 3,
+   VK_SWAPCHAIN_LATENCY_INTERVAL_BACKEND_PRESENT_ARM = 4,
+   VK_SWAPCHAIN_LATENCY_INTERVAL_GPU_TO_PRESENT_ARM = 5,
+   VK_SWAPCHAIN_LATENCY_INTERVAL_COUNT_ARM = 6,
+} VkSwapchainLatencyIntervalARM;
+
+/* Durations are in nanoseconds. histogram[0] counts durations of 0, histogram[i] durations in [2^(i-1), 2^i). */
+typedef struct VkSwapchainLatencyStatisticsARM
+{
+   VkSwapchainLatencyIntervalARM interval;
+   uint64_t sampleCount;
+   uint64_t totalDuration;
+   uint64_t maxDuration;
+   uint64_t histogram[VK_SWAPCHAIN_LATENCY_HISTOGRAM_BUCKET_COUNT_ARM];
+} VkSwapchainLatencyStatisticsARM;
+
+typedef VkResult(VKAPI_PTR *PFN_vkGetSwapchainLatencyStatisticsARM)(VkDevice device, VkSwapchainKHR swapchain,
+                                                                     uint32_t *pStatisticsCount,
+                                                                     VkSwapchainLatencyStatisticsARM *pStatistics);
+
+VWL_VKAPI_CALL(VkResult)
+wsi_layer_vkGetSwapchainLatencyStatisticsARM(VkDevice device, VkSwapchainKHR swapchain, uint32_t *pStatisticsCount,
+                                             VkSwapchainLatencyStatisticsARM *pStatistics) VWL_API_POST;
+
+/*
+ * Memory held by a swapchain. dmaBufBytes counts the dma-bufs allocated for the images, which are imported as device
+ * memory, deviceMemoryBytes the other device memory allocated for the images, and hostBytes the host memory of the
+ * swapchain's objects. Images released by the swapchain, or not allocated yet, are not counted.
+ */
+typedef struct VkSwapchainMemoryFootprintARM
+{
+   uint64_t dmaBufBytes;
+   uint64_t deviceMemoryBytes;
+   uint64_t hostBytes;
+   uint32_t framebufferCount;
+   uint32_t imageCount;
+} VkSwapchainMemoryFootprintARM;
+
+typedef VkResult(VKAPI_PTR *PFN_vkGetSwapchainMemoryFootprintARM)(VkDevice device, VkSwapchainKHR swapchain,
+                                                                  VkSwapchainMemoryFootprintARM *pFootprint);
+
+VWL_VKAPI_CALL(VkResult)
+wsi_layer_vkGetSwapchainMemoryFootprintARM(VkDevice device, VkSwapchainKHR swapchain,
+                                           VkSwapchainMemoryFootprintARM *pFootprint) VWL_API_POST;
+
+/* Layer hand over of presented swapchain images to a consumer in the same process, such as a video encoder. */
+#define VK_SWAPCHAIN_IMAGE_MAX_PLANES_ARM 4
+
+/*
+ * A presented image, backed by dma-bufs. The plane file descriptors stay owned by the swapchain and are valid until it
+ * is destroyed. acquireSyncFd is owned by the consumer, it is signalled once rendering to the image has completed, or
+ * -1 if it already has.
+ */
+typedef struct VkSwapchainImageDmaBufARM
+{
+   uint32_t imageIndex;
+   uint64_t presentId;
+   uint32_t width;
+   uint32_t height;
+   uint32_t drmFourcc;
+   uint64_t drmFormatModifier;
+   uint32_t planeCount;
+   int planeFds[VK_SWAPCHAIN_IMAGE_MAX_PLANES_ARM];
+   uint32_t planeOffsets[VK_SWAPCHAIN_IMAGE_MAX_PLANES_ARM];
+   uint32_t planeStrides[VK_SWAPCHAIN_IMAGE_MAX_PLANES_ARM];
+   int acquireSyncFd;
+} VkSwapchainImageDmaBufARM;
+
+/* Called from the presentation thread of the swapchain, the image is held until it is released. */
+typedef void(VKAPI_PTR *PFN_vkSwapchainImageConsumerARM)(void *pUserData, const VkSwapchainImageDmaBufARM *pImage);
+
+typedef VkResult(VKAPI_PTR *PFN_vkSetSwapchainImageConsumerARM)(VkDevice device, VkSwapchainKHR swapchain,
+                                                                 PFN_vkSwapchainImageConsumerARM pfnConsumer,
+                                                                 void *pUserData);
+
+/* Ownership of releaseSyncFd, or -1 if the consumer has stopped accessing the image, passes to the layer on success. */
+typedef VkResult(VKAPI_PTR *PFN_vkReleaseSwapchainImageARM)(VkDevice device, VkSwapchainKHR swapchain,
+                                                             uint32_t imageIndex, int releaseSyncFd);
+
+VWL_VKAPI_CALL(VkResult)
+wsi_layer_vkSetSwapchainImageConsumerARM(VkDevice device, VkSwapchainKHR swapchain,
+                                         PFN_vkSwapchainImageConsumerARM pfnConsumer, void *pUserData) VWL_API_POST;
+
+VWL_VKAPI_CALL(VkResult)
+wsi_layer_vkReleaseSwapchainImageARM(VkDevice device, VkSwapchainKHR swapchain, uint32_t imageIndex,
+                                     int releaseSyncFd) VWL_API_POST;
 #endif
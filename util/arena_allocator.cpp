@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include "arena_allocator.hpp"
+
+namespace util
+{
+
+/* Every allocation is preceded by its size, so that it can be reallocated. */
+static constexpr size_t ALLOCATION_HEADER_SIZE = sizeof(size_t);
+
+static size_t align_up(size_t value, size_t alignment)
+{
+   assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+   return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static size_t get_allocation_size(const void *memory)
+{
+   size_t size;
+   std::memcpy(&size, static_cast<const char *>(memory) - ALLOCATION_HEADER_SIZE, sizeof(size));
+   return size;
+}
+
+static void set_allocation_size(void *memory, size_t size)
+{
+   std::memcpy(static_cast<char *>(memory) - ALLOCATION_HEADER_SIZE, &size, sizeof(size));
+}
+
+arena_allocator::arena_allocator(const allocator &parent, VkSystemAllocationScope scope, size_t block_size)
+   : m_parent(parent, scope)
+   , m_allocator(allocator::redirect_host_allocations(
+        parent, scope, VkAllocationCallbacks{ this, arena_allocation, arena_reallocation, arena_free, nullptr, nullptr }))
+   , m_block_size(block_size)
+   , m_blocks(nullptr)
+   , m_last_allocation(nullptr)
+   , m_last_allocation_start(0)
+{
+}
+
+arena_allocator::~arena_allocator()
+{
+   const auto &callbacks = m_parent.m_callbacks;
+   while (m_blocks != nullptr)
+   {
+      block *next = m_blocks->next;
+      callbacks.pfnFree(callbacks.pUserData, m_blocks);
+      m_blocks = next;
+   }
+}
+
+size_t arena_allocator::get_reserved_size() const
+{
+   const std::lock_guard<std::mutex> lock(m_mutex);
+   size_t size = 0;
+   for (const block *b = m_blocks; b != nullptr; b = b->next)
+   {
+      size += sizeof(block) + b->size;
+   }
+   return size;
+}
+
+VKAPI_ATTR void *VKAPI_CALL arena_allocator::arena_allocation(void *user_data, size_t size, size_t alignment,
+                                                              VkSystemAllocationScope)
+{
+   auto *arena = static_cast<arena_allocator *>(user_data);
+   const std::lock_guard<std::mutex> lock(arena->m_mutex);
+   return arena->allocate(size, alignment);
+}
+
+VKAPI_ATTR void *VKAPI_CALL arena_allocator::arena_reallocation(void *user_data, void *original, size_t size,
+                                                                size_t alignment, VkSystemAllocationScope)
+{
+   auto *arena = static_cast<arena_allocator *>(user_data);
+   const std::lock_guard<std::mutex> lock(arena->m_mutex);
+   return arena->reallocate(original, size, alignment);
+}
+
+VKAPI_ATTR void VKAPI_CALL arena_allocator::arena_free(void *user_data, void *memory)
+{
+   auto *arena = static_cast<arena_allocator *>(user_data);
+   const std::lock_guard<std::mutex> lock(arena->m_mutex);
+   arena->free(memory);
+}
+
+arena_allocator::block *arena_allocator::add_block(size_t min_size)
+{
+   const size_t size = std::max(m_block_size, min_size);
+   if (size > SIZE_MAX - sizeof(block))
+   {
+      return nullptr;
+   }
+
+   const auto &callbacks = m_parent.m_callbacks;
+   void *memory =
+      callbacks.pfnAllocation(callbacks.pUserData, sizeof(block) + size, alignof(std::max_align_t), m_parent.m_scope);
+   if (memory == nullptr)
+   {
+      return nullptr;
+   }
+
+   auto *new_block = static_cast<block *>(memory);
+   new_block->size = size;
+   new_block->used = 0;
+
+   if (size > m_block_size && m_blocks != nullptr)
+   {
+      /* Allocations too large for a regular block get a block of their own, which does not replace the current one so
+       * that its remaining space is still used. */
+      new_block->next = m_blocks->next;
+      m_blocks->next = new_block;
+   }
+   else
+   {
+      new_block->next = m_blocks;
+      m_blocks = new_block;
+      m_last_allocation = nullptr;
+   }
+   return new_block;
+}
+
+void *arena_allocator::allocate(size_t size, size_t alignment)
+{
+   alignment = std::max(alignment, alignof(size_t));
+   if (size > SIZE_MAX - ALLOCATION_HEADER_SIZE - alignment)
+   {
+      return nullptr;
+   }
+
+   /* Offsets are computed on addresses, as the data of a block is only aligned to the block header. */
+   block *current = m_blocks;
+   uintptr_t start = 0;
+   uintptr_t memory = 0;
+   if (current != nullptr)
+   {
+      start = reinterpret_cast<uintptr_t>(current + 1) + current->used;
+      memory = align_up(start + ALLOCATION_HEADER_SIZE, alignment);
+   }
+
+   if (current == nullptr || memory + size > reinterpret_cast<uintptr_t>(current + 1) + current->size)
+   {
+      current = add_block(size + ALLOCATION_HEADER_SIZE + alignment);
+      if (current == nullptr)
+      {
+         return nullptr;
+      }
+      start = reinterpret_cast<uintptr_t>(current + 1) + current->used;
+      memory = align_up(start + ALLOCATION_HEADER_SIZE, alignment);
+   }
+
+   const size_t previous_used = current->used;
+   current->used = memory + size - reinterpret_cast<uintptr_t>(current + 1);
+   set_allocation_size(reinterpret_cast<void *>(memory), size);
+
+   if (current == m_blocks)
+   {
+      m_last_allocation = reinterpret_cast<void *>(memory);
+      m_last_allocation_start = previous_used;
+   }
+   return reinterpret_cast<void *>(memory);
+}
+
+void *arena_allocator::reallocate(void *original, size_t size, size_t alignment)
+{
+   if (original == nullptr)
+   {
+      return allocate(size, alignment);
+   }
+   if (size == 0)
+   {
+      free(original);
+      return nullptr;
+   }
+
+   const size_t original_size = get_allocation_size(original);
+   if (original == m_last_allocation)
+   {
+      /* The latest allocation can grow or shrink in place, as long as it still fits in its block. */
+      const uintptr_t block_data = reinterpret_cast<uintptr_t>(m_blocks + 1);
+      const uintptr_t memory = reinterpret_cast<uintptr_t>(original);
+      if (memory + size <= block_data + m_blocks->size)
+      {
+         m_blocks->used = memory + size - block_data;
+         set_allocation_size(original, size);
+         return original;
+      }
+   }
+   else if (size <= original_size)
+   {
+      set_allocation_size(original, size);
+      return original;
+   }
+
+   void *memory = allocate(size, alignment);
+   if (memory == nullptr)
+   {
+      return nullptr;
+   }
+   std::memcpy(memory, original, std::min(original_size, size));
+   free(original);
+   return memory;
+}
+
+void arena_allocator::free(void *memory)
+{
+   /* Only the latest allocation can be given back, the rest of the memory is released with the arena. */
+   if (memory != nullptr && memory == m_last_allocation)
+   {
+      m_blocks->used = m_last_allocation_start;
+      m_last_allocation = nullptr;
+   }
+}
+
+} /* namespace util */
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file arena_allocator.hpp
+ *
+ * @brief Contains a bump allocator for objects that share the lifetime of their owner.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+
+#include <vulkan/vulkan.h>
+
+#include "custom_allocator.hpp"
+#include "helpers.hpp"
+
+namespace util
+{
+
+/**
+ * @brief Bump allocator releasing all its memory at once, when it is destroyed.
+ *
+ * Memory is carved out of large blocks obtained from a parent allocator, so that owners making many small allocations,
+ * such as swapchains and their images, only make a few calls to the application's allocation callbacks. Freeing
+ * memory only gives it back when it is the latest allocation, so the arena suits allocations that live as long as
+ * their owner, rather than memory that is allocated and freed repeatedly.
+ *
+ * The allocator returned by @ref get_allocator can be used anywhere a util::allocator is expected. Vulkan commands
+ * called with its original callbacks still receive the callbacks of the parent allocator.
+ *
+ * The arena is thread safe, and must outlive every object allocated from it.
+ */
+class arena_allocator : private noncopyable
+{
+public:
+   /**
+    * @brief Default size of the blocks of the arena.
+    */
+   static constexpr size_t DEFAULT_BLOCK_SIZE = 16 * 1024;
+
+   /**
+    * @brief Construct an arena.
+    *
+    * No memory is allocated until the first allocation from the arena.
+    *
+    * @param parent     The allocator the blocks of the arena are allocated from.
+    * @param scope      The scope of the allocations made from the arena.
+    * @param block_size The size of the blocks of the arena. Larger allocations get a block of their own.
+    */
+   arena_allocator(const allocator &parent, VkSystemAllocationScope scope, size_t block_size = DEFAULT_BLOCK_SIZE);
+
+   ~arena_allocator();
+
+   /**
+    * @brief Get the allocator that allocates from the arena.
+    */
+   const allocator &get_allocator() const
+   {
+      return m_allocator;
+   }
+
+   /**
+    * @brief Get the number of bytes of the blocks the arena holds, including the memory not handed out yet.
+    */
+   size_t get_reserved_size() const;
+
+private:
+   /**
+    * @brief Header of a block of the arena, followed by the memory handed out from the block.
+    */
+   struct block
+   {
+      block *next;
+      size_t size;
+      size_t used;
+   };
+
+   static VKAPI_ATTR void *VKAPI_CALL arena_allocation(void *user_data, size_t size, size_t alignment,
+                                                       VkSystemAllocationScope scope);
+   static VKAPI_ATTR void *VKAPI_CALL arena_reallocation(void *user_data, void *original, size_t size,
+                                                         size_t alignment, VkSystemAllocationScope scope);
+   static VKAPI_ATTR void VKAPI_CALL arena_free(void *user_data, void *memory);
+
+   /* The following methods must be called with @ref m_mutex held. */
+   void *allocate(size_t size, size_t alignment);
+   void *reallocate(void *original, size_t size, size_t alignment);
+   void free(void *memory);
+
+   /**
+    * @brief Allocate a new block from the parent allocator and make it the current block.
+    *
+    * @param min_size The minimum number of bytes the block must be able to hand out.
+    *
+    * @return The new block, or nullptr if it could not be allocated.
+    */
+   block *add_block(size_t min_size);
+
+   /**
+    * @brief The allocator the blocks are allocated from.
+    */
+   const allocator m_parent;
+
+   /**
+    * @brief The allocator that allocates from the arena.
+    */
+   allocator m_allocator;
+
+   size_t m_block_size;
+
+   /**
+    * @brief Protects the blocks, as images may be created concurrently.
+    */
+   mutable std::mutex m_mutex;
+
+   /**
+    * @brief List of the blocks of the arena, the first one being the block allocations are made from.
+    */
+   block *m_blocks;
+
+   /**
+    * @brief The most recent allocation, the only one whose memory can be given back before the arena is destroyed.
+    */
+   void *m_last_allocation;
+
+   /**
+    * @brief Offset of the current block before @ref m_last_allocation was made.
+    */
+   size_t m_last_allocation_start;
+};
+
+} /* namespace util */
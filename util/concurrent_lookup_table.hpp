@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file concurrent_lookup_table.hpp
+ *
+ * @brief Contains a pointer map with wait-free lookups.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+
+#include "custom_allocator.hpp"
+#include "helpers.hpp"
+
+namespace util
+{
+
+/**
+ * @brief Map from a pointer key to a pointer value with lock-free lookups.
+ *
+ * The table uses open addressing with linear probing over an array of atomic slots. Insertions and removals are
+ * serialized by an internal mutex, while lookups only perform atomic loads and never block. This suits maps that are
+ * read on every call but only written at object creation and destruction time.
+ *
+ * Removed slots become tombstones, which are reused by later insertions. A tombstone followed by an empty slot is
+ * reset to empty, as no probe sequence can continue past it, so the tombstones of short lived keys do not
+ * accumulate. When live entries and tombstones would fill more than half of the slots, the tombstones are cleared and
+ * the live entries moved back towards their hash slots in place. Lookups that overlap with such a compaction are
+ * detected with a sequence counter and retried. Only when the live entries would fill more than a quarter of the
+ * slots, they are rehashed into a larger array, which is then published with an atomic pointer. Lookups that already
+ * loaded the previous array may still be reading it, so retired arrays are only freed with the table. As each array is
+ * at least twice as large as the one it replaced, they hold fewer slots together than the current one.
+ *
+ * The table never frees the values it stores: callers must guarantee that a value is not used after its removal, as
+ * the Vulkan external synchronization rules do for dispatchable objects.
+ *
+ * @tparam Key   Pointer type used as a key. nullptr is not a valid key.
+ * @tparam Value Pointer type stored as a value.
+ * @tparam N     Number of slots the table starts with, which is also the smallest array it is rehashed into.
+ */
+template <typename Key, typename Value, std::size_t N>
+class concurrent_lookup_table : private noncopyable
+{
+   static_assert(std::is_pointer<Key>::value && std::is_pointer<Value>::value,
+                 "concurrent_lookup_table only supports pointer keys and values");
+   static_assert(N > 0 && (N & (N - 1)) == 0, "The number of slots must be a power of two");
+
+public:
+   concurrent_lookup_table()
+      : m_table(&m_initial_table)
+   {
+   }
+
+   ~concurrent_lookup_table()
+   {
+      table *t = m_table.load(std::memory_order_relaxed);
+      while (t != &m_initial_table)
+      {
+         table *previous = t->previous;
+         allocator::get_generic().destroy<slot>(t->capacity, t->slots);
+         allocator::get_generic().destroy<table>(1, t);
+         t = previous;
+      }
+   }
+
+   /**
+    * @brief Insert or replace an entry.
+    *
+    * @param key   The key, must not be nullptr.
+    * @param value The value to associate to the key.
+    * @param[out] replaced Previous value associated to the key, or nullptr.
+    * @return true on success, false if the table is full and a larger array could not be allocated.
+    */
+   bool try_insert(Key key, Value value, Value &replaced)
+   {
+      assert(key != nullptr);
+      std::lock_guard<std::mutex> lock(m_write_lock);
+
+      replaced = nullptr;
+      table *t = m_table.load(std::memory_order_relaxed);
+      slot *existing = probe(*t, key);
+      if (existing != nullptr)
+      {
+         replaced = existing->value.load(std::memory_order_relaxed);
+         existing->value.store(value, std::memory_order_release);
+         return true;
+      }
+
+      /* Clean up before the probe sequences get long. If a larger array cannot be allocated, carry on with the
+       * current one while it has room. */
+      if ((m_used + 1) * 2 > t->capacity)
+      {
+         if ((m_live + 1) * 4 <= t->capacity)
+         {
+            compact(*t);
+         }
+         else if (rehash())
+         {
+            t = m_table.load(std::memory_order_relaxed);
+         }
+      }
+
+      slot *free_slot = nullptr;
+      for (std::size_t i = 0, idx = hash(key, t->capacity); i < t->capacity; i++, idx = next(idx, t->capacity))
+      {
+         const uintptr_t slot_key = t->slots[idx].key.load(std::memory_order_relaxed);
+         if (slot_key == TOMBSTONE || slot_key == EMPTY)
+         {
+            free_slot = &t->slots[idx];
+            break;
+         }
+      }
+
+      if (free_slot == nullptr)
+      {
+         return false;
+      }
+
+      if (free_slot->key.load(std::memory_order_relaxed) == EMPTY)
+      {
+         m_used++;
+      }
+      m_live++;
+
+      /* Publish the value before the key, so that a reader matching the key always observes the value. */
+      free_slot->value.store(value, std::memory_order_relaxed);
+      free_slot->key.store(to_uint(key), std::memory_order_release);
+      return true;
+   }
+
+   /**
+    * @brief Remove an entry.
+    *
+    * @param key The key to remove.
+    * @return the value that was associated to the key, or nullptr if the key was not found.
+    */
+   Value erase(Key key)
+   {
+      std::lock_guard<std::mutex> lock(m_write_lock);
+      table *t = m_table.load(std::memory_order_relaxed);
+      slot *s = probe(*t, key);
+      if (s == nullptr)
+      {
+         return nullptr;
+      }
+
+      Value value = s->value.load(std::memory_order_relaxed);
+      s->key.store(TOMBSTONE, std::memory_order_release);
+      m_live--;
+
+      /* A probe sequence that reaches an empty slot stops there, so the tombstones just before one are not needed to
+       * find any key and can be emptied too, from the last one backwards. */
+      std::size_t idx = static_cast<std::size_t>(s - t->slots);
+      while (t->slots[idx].key.load(std::memory_order_relaxed) == TOMBSTONE &&
+             t->slots[next(idx, t->capacity)].key.load(std::memory_order_relaxed) == EMPTY)
+      {
+         t->slots[idx].key.store(EMPTY, std::memory_order_release);
+         m_used--;
+         idx = (idx - 1) & (t->capacity - 1);
+      }
+
+      return value;
+   }
+
+   /**
+    * @brief Find the value associated to a key without taking any lock.
+    *
+    * @param key The key to look up.
+    * @return the value that is associated to the key, or nullptr if the key was not found.
+    */
+   Value find(Key key) const
+   {
+      while (true)
+      {
+         const uint32_t sequence = m_sequence.load(std::memory_order_acquire);
+         const slot *s = probe(*m_table.load(std::memory_order_acquire), key);
+         const Value value = s != nullptr ? s->value.load(std::memory_order_acquire) : nullptr;
+
+         /* Entries move while a compaction runs, so a lookup that overlapped with one may have missed its key or read
+          * the value of another. */
+         std::atomic_thread_fence(std::memory_order_acquire);
+         if ((sequence & 1) == 0 && m_sequence.load(std::memory_order_relaxed) == sequence)
+         {
+            return value;
+         }
+      }
+   }
+
+private:
+   static constexpr uintptr_t EMPTY = 0;
+   static constexpr uintptr_t TOMBSTONE = UINTPTR_MAX;
+
+   struct slot
+   {
+      std::atomic<uintptr_t> key{ EMPTY };
+      std::atomic<Value> value{ nullptr };
+   };
+
+   struct table
+   {
+      /** Number of slots, a power of two. */
+      std::size_t capacity;
+      slot *slots;
+      /** The array this one replaced, kept for the lookups that may still read it. */
+      table *previous;
+   };
+
+   static uintptr_t to_uint(Key key)
+   {
+      return reinterpret_cast<uintptr_t>(key);
+   }
+
+   static std::size_t hash(Key key, std::size_t capacity)
+   {
+      /* Keys are heap pointers, so mix the high bits into the low ones which are mostly alignment zeros. */
+      uintptr_t k = to_uint(key);
+      k ^= k >> 17;
+      k *= static_cast<uintptr_t>(0x9E3779B97F4A7C15ull);
+      k ^= k >> 29;
+      return static_cast<std::size_t>(k) & (capacity - 1);
+   }
+
+   static std::size_t next(std::size_t idx, std::size_t capacity)
+   {
+      return (idx + 1) & (capacity - 1);
+   }
+
+   static slot *probe(const table &t, Key key)
+   {
+      for (std::size_t i = 0, idx = hash(key, t.capacity); i < t.capacity; i++, idx = next(idx, t.capacity))
+      {
+         const uintptr_t slot_key = t.slots[idx].key.load(std::memory_order_acquire);
+         if (slot_key == to_uint(key))
+         {
+            return &t.slots[idx];
+         }
+         else if (slot_key == EMPTY)
+         {
+            break;
+         }
+      }
+
+      return nullptr;
+   }
+
+   /**
+    * @brief Clear the tombstones of an array and move its live entries back towards their hash slots, in place.
+    *
+    * The slots are visited once, starting after an empty slot so that no probe sequence wraps past the start. Each
+    * live entry is taken out and inserted again from its hash slot, which puts it at or before its current slot, as
+    * the entries of the probe sequence that precede it were already moved.
+    */
+   void compact(table &t)
+   {
+      /* An odd sequence makes the lookups that overlap with the compaction retry. */
+      const uint32_t sequence = m_sequence.load(std::memory_order_relaxed);
+      m_sequence.store(sequence + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+
+      std::size_t start = 0;
+      for (std::size_t i = 0; i < t.capacity; i++)
+      {
+         const uintptr_t slot_key = t.slots[i].key.load(std::memory_order_relaxed);
+         if (slot_key == TOMBSTONE)
+         {
+            t.slots[i].key.store(EMPTY, std::memory_order_relaxed);
+         }
+         if (slot_key == EMPTY)
+         {
+            start = i;
+         }
+      }
+
+      for (std::size_t i = 0, idx = next(start, t.capacity); i < t.capacity; i++, idx = next(idx, t.capacity))
+      {
+         const uintptr_t slot_key = t.slots[idx].key.load(std::memory_order_relaxed);
+         if (slot_key == EMPTY)
+         {
+            continue;
+         }
+
+         const Value value = t.slots[idx].value.load(std::memory_order_relaxed);
+         t.slots[idx].key.store(EMPTY, std::memory_order_relaxed);
+         std::size_t new_idx = hash(reinterpret_cast<Key>(slot_key), t.capacity);
+         while (t.slots[new_idx].key.load(std::memory_order_relaxed) != EMPTY)
+         {
+            new_idx = next(new_idx, t.capacity);
+         }
+         t.slots[new_idx].value.store(value, std::memory_order_relaxed);
+         t.slots[new_idx].key.store(slot_key, std::memory_order_relaxed);
+      }
+      m_used = m_live;
+
+      m_sequence.store(sequence + 2, std::memory_order_release);
+   }
+
+   /**
+    * @brief Move the live entries into a new array without tombstones, large enough to stay at most a quarter full
+    *        after the next insertion, and publish it.
+    *
+    * @return false if the new array could not be allocated.
+    */
+   bool rehash()
+   {
+      std::size_t capacity = N;
+      while ((m_live + 1) * 4 > capacity)
+      {
+         capacity *= 2;
+      }
+
+      const allocator &alloc = allocator::get_generic();
+      table *new_table = alloc.create<table>(1);
+      slot *new_slots = alloc.create<slot>(capacity);
+      if (new_table == nullptr || new_slots == nullptr)
+      {
+         if (new_table != nullptr)
+         {
+            alloc.destroy<table>(1, new_table);
+         }
+         if (new_slots != nullptr)
+         {
+            alloc.destroy<slot>(capacity, new_slots);
+         }
+         return false;
+      }
+
+      table *old_table = m_table.load(std::memory_order_relaxed);
+      for (std::size_t i = 0; i < old_table->capacity; i++)
+      {
+         const uintptr_t slot_key = old_table->slots[i].key.load(std::memory_order_relaxed);
+         if (slot_key == EMPTY || slot_key == TOMBSTONE)
+         {
+            continue;
+         }
+
+         std::size_t idx = hash(reinterpret_cast<Key>(slot_key), capacity);
+         while (new_slots[idx].key.load(std::memory_order_relaxed) != EMPTY)
+         {
+            idx = next(idx, capacity);
+         }
+         new_slots[idx].value.store(old_table->slots[i].value.load(std::memory_order_relaxed),
+                                    std::memory_order_relaxed);
+         new_slots[idx].key.store(slot_key, std::memory_order_relaxed);
+      }
+
+      new_table->capacity = capacity;
+      new_table->slots = new_slots;
+      new_table->previous = old_table;
+      m_used = m_live;
+
+      /* Release so that a lookup that loads the new array observes its entries. */
+      m_table.store(new_table, std::memory_order_release);
+      return true;
+   }
+
+   std::array<slot, N> m_initial_slots{};
+   table m_initial_table{ N, m_initial_slots.data(), nullptr };
+   std::atomic<table *> m_table;
+   /** Incremented before and after each compaction, so it is odd while one runs. */
+   std::atomic<uint32_t> m_sequence{ 0 };
+   /** Number of live entries in the current array, only accessed with the write lock held. */
+   std::size_t m_live{ 0 };
+   /** Number of live entries and tombstones in the current array, only accessed with the write lock held. */
+   std::size_t m_used{ 0 };
+   std::mutex m_write_lock;
+};
+
+} /* namespace util */
@@ -73,8 +73,22 @@ allocator::allocator(VkSystemAllocationScope scope, const VkAllocationCallbacks
    }
 }
 
+allocator allocator::redirect_host_allocations(const allocator &api_allocator, VkSystemAllocationScope new_scope,
+                                               const VkAllocationCallbacks &host_callbacks)
+{
+   allocator redirected{ new_scope, &host_callbacks };
+   const VkAllocationCallbacks *api_callbacks = api_allocator.get_original_callbacks();
+   redirected.m_redirected = true;
+   redirected.m_api_callbacks = api_callbacks != nullptr ? *api_callbacks : VkAllocationCallbacks{};
+   return redirected;
+}
+
 const VkAllocationCallbacks *allocator::get_original_callbacks() const
 {
+   if (m_redirected)
+   {
+      return m_api_callbacks.pfnAllocation != nullptr ? &m_api_callbacks : nullptr;
+   }
    return m_callbacks.pfnAllocation == default_allocation ? nullptr : &m_callbacks;
 }
 
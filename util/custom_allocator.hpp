@@ -85,6 +85,20 @@ public:
    allocator(const allocator &other, VkSystemAllocationScope new_scope,
              const VkAllocationCallbacks *callbacks = nullptr);
 
+   /**
+    * @brief Construct an allocator whose host allocations use @p host_callbacks, while the callbacks given to Vulkan
+    *        commands remain those of @p api_allocator.
+    *
+    * Used by allocators that manage host memory themselves, such as @ref arena_allocator, so that memory allocated by
+    * the drivers is never placed in them.
+    *
+    * @param api_allocator  The allocator whose original callbacks are returned by #get_original_callbacks.
+    * @param new_scope      The scope to use for allocations.
+    * @param host_callbacks The callbacks used for the host allocations of the layer.
+    */
+   static allocator redirect_host_allocations(const allocator &api_allocator, VkSystemAllocationScope new_scope,
+                                              const VkAllocationCallbacks &host_callbacks);
+
    /**
     * @brief Get a pointer to the allocation callbacks provided while constructing this object.
     * @return a copy of the #VkAllocationCallback argument provided in the allocator constructor
@@ -114,6 +128,12 @@ public:
 
    VkAllocationCallbacks m_callbacks{};
    VkSystemAllocationScope m_scope;
+
+private:
+   /* Whether #m_callbacks differ from the callbacks given to Vulkan commands, see #redirect_host_allocations. */
+   bool m_redirected{ false };
+   /* The callbacks given to Vulkan commands when redirected, with a null pfnAllocation for the default ones. */
+   VkAllocationCallbacks m_api_callbacks{};
 };
 
 /**
@@ -25,56 +25,175 @@
 #include "drm_utils.hpp"
 #include "format_table.h"
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+
 namespace util
 {
 namespace drm
 {
 
-uint32_t vk_to_drm_format(VkFormat vk_format)
+namespace
 {
-   for (size_t i = 0; i < fourcc_format_table_len; i++)
+
+/**
+ * @brief Lookup tables built once from @ref fourcc_format_table and @ref srgb_fourcc_format_table.
+ *
+ * The format tables are shared with wsialloc's C code, so they cannot be constexpr and the tables are built on first
+ * use instead. Vulkan formats are looked up in a dense array indexed by the format, DRM formats with a binary search.
+ */
+class format_lookup
+{
+public:
+   format_lookup()
+      : m_vk_to_drm{}
+      , m_drm_to_vk{}
+      , m_drm_to_vk_srgb{}
    {
-      if (vk_format == fourcc_format_table[i].vk_format)
-      {
-         return fourcc_format_table[i].drm_format;
-      }
+      /* The first entry of a Vulkan format wins, as it did for the linear searches these tables replace. */
+      std::array<bool, MAX_DENSE_VK_FORMAT + 1> valid{};
+      auto add_vk_formats = [this, &valid](const fmt_spec *table, size_t table_len) {
+         for (size_t i = 0; i < table_len; i++)
+         {
+            const auto index = static_cast<size_t>(table[i].vk_format);
+            if (index < valid.size() && !valid[index])
+            {
+               m_vk_to_drm[index] = table[i].drm_format;
+               valid[index] = true;
+            }
+            else if (index >= valid.size())
+            {
+               /* Formats out of range of the dense array, from extensions, keep a linear search. */
+               m_sparse_vk_formats = true;
+            }
+         }
+      };
+      add_vk_formats(fourcc_format_table, fourcc_format_table_len);
+      add_vk_formats(srgb_fourcc_format_table, srgb_fourcc_format_table_len);
+
+      m_drm_to_vk_len = sort_drm_formats(fourcc_format_table, fourcc_format_table_len, m_drm_to_vk);
+      m_drm_to_vk_srgb_len = sort_drm_formats(srgb_fourcc_format_table, srgb_fourcc_format_table_len, m_drm_to_vk_srgb);
    }
 
-   for (size_t i = 0; i < srgb_fourcc_format_table_len; i++)
+   uint32_t vk_to_drm(VkFormat vk_format) const
    {
-      if (vk_format == srgb_fourcc_format_table[i].vk_format)
+      const auto index = static_cast<size_t>(vk_format);
+      if (index < m_vk_to_drm.size())
       {
-         return srgb_fourcc_format_table[i].drm_format;
+         return m_vk_to_drm[index];
       }
+
+      return m_sparse_vk_formats ? vk_to_drm_sparse(vk_format) : 0;
    }
 
-   return 0;
-}
+   VkFormat drm_to_vk(uint32_t drm_format) const
+   {
+      return find_drm_format(m_drm_to_vk, m_drm_to_vk_len, drm_format);
+   }
 
-VkFormat drm_to_vk_format(uint32_t drm_format)
-{
-   for (size_t i = 0; i < fourcc_format_table_len; i++)
+   VkFormat drm_to_vk_srgb(uint32_t drm_format) const
    {
-      if (drm_format == fourcc_format_table[i].drm_format)
+      return find_drm_format(m_drm_to_vk_srgb, m_drm_to_vk_srgb_len, drm_format);
+   }
+
+private:
+   /* Last core Vulkan 1.0 format, all formats of the tables fall in this range. */
+   static constexpr size_t MAX_DENSE_VK_FORMAT = VK_FORMAT_ASTC_12x12_SRGB_BLOCK;
+   static constexpr size_t MAX_DRM_FORMATS = 64;
+
+   struct drm_format_entry
+   {
+      uint32_t drm_format;
+      VkFormat vk_format;
+   };
+
+   using drm_format_array = std::array<drm_format_entry, MAX_DRM_FORMATS>;
+
+   static size_t sort_drm_formats(const fmt_spec *table, size_t table_len, drm_format_array &sorted)
+   {
+      assert(table_len <= sorted.size());
+      const size_t len = std::min(table_len, sorted.size());
+
+      /* Insertion sort, which is stable so the first entry of a duplicated DRM format is found first, and does not
+       * allocate. The tables are tiny. */
+      for (size_t i = 0; i < len; i++)
       {
-         return fourcc_format_table[i].vk_format;
+         const drm_format_entry entry{ table[i].drm_format, table[i].vk_format };
+         size_t j = i;
+         for (; j > 0 && sorted[j - 1].drm_format > entry.drm_format; j--)
+         {
+            sorted[j] = sorted[j - 1];
+         }
+         sorted[j] = entry;
       }
+      return len;
    }
 
-   return VK_FORMAT_UNDEFINED;
-}
+   static VkFormat find_drm_format(const drm_format_array &sorted, size_t len, uint32_t drm_format)
+   {
+      auto it = std::lower_bound(
+         sorted.begin(), sorted.begin() + len, drm_format,
+         [](const drm_format_entry &entry, uint32_t format) { return entry.drm_format < format; });
+      if (it != sorted.begin() + len && it->drm_format == drm_format)
+      {
+         return it->vk_format;
+      }
 
-VkFormat drm_to_vk_srgb_format(uint32_t drm_format)
-{
-   for (size_t i = 0; i < srgb_fourcc_format_table_len; i++)
+      return VK_FORMAT_UNDEFINED;
+   }
+
+   static uint32_t vk_to_drm_sparse(VkFormat vk_format)
    {
-      if (drm_format == srgb_fourcc_format_table[i].drm_format)
+      for (size_t i = 0; i < fourcc_format_table_len; i++)
       {
-         return srgb_fourcc_format_table[i].vk_format;
+         if (vk_format == fourcc_format_table[i].vk_format)
+         {
+            return fourcc_format_table[i].drm_format;
+         }
       }
+
+      for (size_t i = 0; i < srgb_fourcc_format_table_len; i++)
+      {
+         if (vk_format == srgb_fourcc_format_table[i].vk_format)
+         {
+            return srgb_fourcc_format_table[i].drm_format;
+         }
+      }
+
+      return 0;
    }
 
-   return VK_FORMAT_UNDEFINED;
+   std::array<uint32_t, MAX_DENSE_VK_FORMAT + 1> m_vk_to_drm;
+   bool m_sparse_vk_formats{ false };
+
+   drm_format_array m_drm_to_vk;
+   size_t m_drm_to_vk_len{ 0 };
+   drm_format_array m_drm_to_vk_srgb;
+   size_t m_drm_to_vk_srgb_len{ 0 };
+};
+
+const format_lookup &get_format_lookup()
+{
+   static const format_lookup lookup;
+   return lookup;
+}
+
+} // namespace
+
+uint32_t vk_to_drm_format(VkFormat vk_format)
+{
+   return get_format_lookup().vk_to_drm(vk_format);
+}
+
+VkFormat drm_to_vk_format(uint32_t drm_format)
+{
+   return get_format_lookup().drm_to_vk(drm_format);
+}
+
+VkFormat drm_to_vk_srgb_format(uint32_t drm_format)
+{
+   return get_format_lookup().drm_to_vk_srgb(drm_format);
 }
 
 /* Returns the number of planes represented by a fourcc format. */
@@ -24,6 +24,7 @@
 
 #include "extension_list.hpp"
 #include "util/custom_allocator.hpp"
+#include "util/perfect_hash.hpp"
 #include <layer/private_data.hpp>
 #include <cstdio>
 #include <cstring>
@@ -32,38 +33,60 @@
 namespace util
 {
 
+#define KNOWN_EXTENSION_NAME(name) "VK_" #name,
+static constexpr std::array<const char *, static_cast<size_t>(known_extension::count)> known_extension_names = {
+   UTIL_KNOWN_EXTENSIONS_LIST(KNOWN_EXTENSION_NAME)
+};
+#undef KNOWN_EXTENSION_NAME
+
+static constexpr perfect_hash_index<known_extension_names.size()> known_extension_index{ known_extension_names };
+static_assert(known_extension_index.is_perfect(), "No perfect hash of the known extension names was found");
+
 extension_list::extension_list(const util::allocator &allocator)
    : m_alloc{ allocator }
    , m_ext_props(allocator)
 {
 }
 
-VkResult extension_list::add(const char *const *extensions, size_t count)
+VkResult extension_list::add_unknown(const char *extension)
 {
-   auto initial_size = m_ext_props.size();
-   if (!m_ext_props.try_resize(initial_size + count))
+   VkExtensionProperties ext_prop{};
+
+   const size_t len = strlen(extension);
+   bool success = false;
+   if (len < sizeof(ext_prop.extensionName))
+   {
+      int chars_printed = snprintf(ext_prop.extensionName, len + 1, "%s", extension);
+      if (chars_printed >= 0 && (static_cast<size_t>(chars_printed) == len))
+      {
+         success = true;
+      }
+   }
+
+   if (!success)
+   {
+      abort();
+   }
+
+   if (!m_ext_props.try_push_back(ext_prop))
    {
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
+   return VK_SUCCESS;
+}
 
+VkResult extension_list::add(const char *const *extensions, size_t count)
+{
    for (size_t i = 0; i < count; i++)
    {
-      auto &dst = m_ext_props[initial_size + i];
-
-      const size_t len = strlen(extensions[i]);
-      bool success = false;
-      if (len < sizeof(dst.extensionName))
+      const size_t known_index = known_extension_index.find(extensions[i]);
+      if (known_index != known_extension_index.npos)
       {
-         int chars_printed = snprintf(dst.extensionName, len + 1, "%s", extensions[i]);
-         if (chars_printed >= 0 && (static_cast<size_t>(chars_printed) == len))
-         {
-            success = true;
-         }
+         m_known_extensions.set(known_index);
       }
-
-      if (!success)
+      else
       {
-         abort();
+         TRY(add_unknown(extensions[i]));
       }
    }
    return VK_SUCCESS;
@@ -98,7 +121,12 @@ VkResult extension_list::add(const char *const *extensions, size_t count, const
 
 VkResult extension_list::add(VkExtensionProperties ext_prop)
 {
-   if (!contains(ext_prop.extensionName))
+   const size_t known_index = known_extension_index.find(ext_prop.extensionName);
+   if (known_index != known_extension_index.npos)
+   {
+      m_known_extensions.set(known_index);
+   }
+   else if (!contains(ext_prop.extensionName))
    {
       if (!m_ext_props.try_push_back(ext_prop))
       {
@@ -110,47 +138,63 @@ VkResult extension_list::add(VkExtensionProperties ext_prop)
 
 VkResult extension_list::add(const VkExtensionProperties *props, size_t count)
 {
-   auto initial_size = m_ext_props.size();
-   if (!m_ext_props.try_resize(initial_size + count))
-   {
-      return VK_ERROR_OUT_OF_HOST_MEMORY;
-   }
    for (size_t i = 0; i < count; i++)
    {
-      m_ext_props[initial_size + i] = props[i];
+      const size_t known_index = known_extension_index.find(props[i].extensionName);
+      if (known_index != known_extension_index.npos)
+      {
+         m_known_extensions.set(known_index);
+      }
+      else if (!m_ext_props.try_push_back(props[i]))
+      {
+         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
    }
    return VK_SUCCESS;
 }
 
 VkResult extension_list::add(const extension_list &ext_list)
 {
-   util::vector<const char *> ext_vect{ m_alloc };
-   VkResult result = ext_list.get_extension_strings(ext_vect);
-   if (result != VK_SUCCESS)
+   m_known_extensions |= ext_list.m_known_extensions;
+   if (!m_ext_props.try_push_back_many(ext_list.m_ext_props.data(),
+                                       ext_list.m_ext_props.data() + ext_list.m_ext_props.size()))
    {
-      return result;
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
-   return add(ext_vect.data(), ext_vect.size());
+   return VK_SUCCESS;
 }
 
-VkResult extension_list::get_extension_strings(util::vector<const char *> &out) const
+VkResult extension_list::get_extension_strings(extension_string_list &out) const
 {
    size_t old_size = out.size();
-   size_t new_size = old_size + m_ext_props.size();
+   size_t new_size = old_size + m_known_extensions.count() + m_ext_props.size();
    if (!out.try_resize(new_size))
    {
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
 
-   for (size_t i = old_size; i < new_size; i++)
+   size_t i = old_size;
+   for (size_t known_index = 0; known_index < m_known_extensions.size(); known_index++)
+   {
+      if (m_known_extensions.test(known_index))
+      {
+         out[i++] = known_extension_names[known_index];
+      }
+   }
+   for (const auto &p : m_ext_props)
    {
-      out[i] = m_ext_props[i - old_size].extensionName;
+      out[i++] = p.extensionName;
    }
    return VK_SUCCESS;
 }
 
 bool extension_list::contains(const extension_list &req) const
 {
+   if (!contains(req.m_known_extensions))
+   {
+      return false;
+   }
+
    for (const auto &req_ext : req.m_ext_props)
    {
       if (!contains(req_ext.extensionName))
@@ -163,6 +207,12 @@ bool extension_list::contains(const extension_list &req) const
 
 bool extension_list::contains(const char *extension_name) const
 {
+   const size_t known_index = known_extension_index.find(extension_name);
+   if (known_index != known_extension_index.npos)
+   {
+      return m_known_extensions.test(known_index);
+   }
+
    for (const auto &p : m_ext_props)
    {
       if (strcmp(p.extensionName, extension_name) == 0)
@@ -175,8 +225,16 @@ bool extension_list::contains(const char *extension_name) const
 
 void extension_list::remove(const char *ext)
 {
-   m_ext_props.erase(std::remove_if(m_ext_props.begin(), m_ext_props.end(), [&ext](VkExtensionProperties ext_prop) {
+   const size_t known_index = known_extension_index.find(ext);
+   if (known_index != known_extension_index.npos)
+   {
+      m_known_extensions.reset(known_index);
+      return;
+   }
+
+   auto it = std::remove_if(m_ext_props.begin(), m_ext_props.end(), [&ext](VkExtensionProperties ext_prop) {
       return (strcmp(ext_prop.extensionName, ext) == 0);
-   }));
+   });
+   m_ext_props.erase(it, m_ext_props.end());
 }
 } // namespace util
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2019, 2021-2022 Arm Limited.
+ * Copyright (c) 2019, 2021-2022, 2024 Arm Limited.
  *
  * SPDX-License-Identifier: MIT
  *
@@ -25,18 +25,96 @@
 
 #include "custom_allocator.hpp"
 #include "helpers.hpp"
+#include "small_vector.hpp"
 
 #include <vector>
 #include <algorithm>
+#include <bitset>
 
 #include <vulkan/vulkan.h>
 
 namespace util
 {
 
+/**
+ * @brief List of pointers to extension names, sized so that the lists built on instance and device creation do not
+ * usually allocate.
+ */
+using extension_string_list = small_vector<const char *, 32>;
+
+/**
+ * @brief Extensions that the layer queries, interned so that they are tracked as bits instead of strings.
+ *
+ * Format of an entry is: EXT(name) for the extension VK_<name>.
+ */
+#define UTIL_KNOWN_EXTENSIONS_LIST(EXT)       \
+   EXT(KHR_surface)                           \
+   EXT(KHR_get_physical_device_properties2)   \
+   EXT(KHR_get_surface_capabilities2)         \
+   EXT(KHR_external_fence_capabilities)       \
+   EXT(KHR_external_memory_capabilities)      \
+   EXT(KHR_external_semaphore_capabilities)   \
+   EXT(KHR_wayland_surface)                   \
+   EXT(KHR_display)                           \
+   EXT(EXT_headless_surface)                  \
+   EXT(EXT_surface_maintenance1)              \
+   EXT(KHR_swapchain)                         \
+   EXT(KHR_shared_presentable_image)          \
+   EXT(KHR_present_wait)                      \
+   EXT(KHR_present_timing)                    \
+   EXT(EXT_swapchain_maintenance1)            \
+   EXT(EXT_frame_boundary)                    \
+   EXT(KHR_maintenance1)                      \
+   EXT(KHR_maintenance6)                      \
+   EXT(KHR_device_group)                      \
+   EXT(KHR_bind_memory2)                      \
+   EXT(KHR_get_memory_requirements2)          \
+   EXT(KHR_image_format_list)                 \
+   EXT(KHR_sampler_ycbcr_conversion)          \
+   EXT(KHR_external_fence)                    \
+   EXT(KHR_external_fence_fd)                 \
+   EXT(KHR_external_memory)                   \
+   EXT(KHR_external_memory_fd)                \
+   EXT(EXT_external_memory_dma_buf)           \
+   EXT(EXT_image_drm_format_modifier)         \
+   EXT(KHR_external_semaphore)                \
+   EXT(KHR_external_semaphore_fd)             \
+   EXT(KHR_timeline_semaphore)                \
+   EXT(KHR_calibrated_timestamps)
+
+/**
+ * @brief Index of each extension of UTIL_KNOWN_EXTENSIONS_LIST.
+ */
+enum class known_extension : uint32_t
+{
+#define KNOWN_EXTENSION_INDEX(name) name,
+   UTIL_KNOWN_EXTENSIONS_LIST(KNOWN_EXTENSION_INDEX)
+#undef KNOWN_EXTENSION_INDEX
+      count
+};
+
+static_assert(static_cast<uint32_t>(known_extension::count) <= 64,
+              "Sets of known extensions are built from 64-bit masks, see known_extension_bit");
+
+/**
+ * @brief A set of known extensions.
+ */
+using known_extension_set = std::bitset<static_cast<size_t>(known_extension::count)>;
+
+/**
+ * @brief Get the mask of a known extension, used to build a @ref known_extension_set at compile time.
+ */
+constexpr unsigned long long known_extension_bit(known_extension extension)
+{
+   return 1ull << static_cast<uint32_t>(extension);
+}
+
 /**
  * @brief A helper class for storing a vector of extension names
  *
+ * Extensions of UTIL_KNOWN_EXTENSIONS_LIST are kept in a bitset, so checking them does not compare strings. Only
+ * the names of other extensions are stored.
+ *
  * @note This class does not store the extension versions.
  */
 class extension_list : private noncopyable
@@ -63,7 +141,7 @@ public:
     * @return Indicates whether the operation was successful. If this is @c VK_ERROR_OUT_OF_HOST_MEMORY,
     * then @p out is unmodified.
     */
-   VkResult get_extension_strings(util::vector<const char *> &out) const;
+   VkResult get_extension_strings(extension_string_list &out) const;
 
    /**
     * @brief Check if this extension list contains all the extensions listed in req.
@@ -75,6 +153,22 @@ public:
     */
    bool contains(const char *ext) const;
 
+   /**
+    * @brief Check if this extension list contains a known extension.
+    */
+   bool contains(known_extension ext) const
+   {
+      return m_known_extensions.test(static_cast<size_t>(ext));
+   }
+
+   /**
+    * @brief Check if this extension list contains all the known extensions in req.
+    */
+   bool contains(const known_extension_set &req) const
+   {
+      return (m_known_extensions & req) == req;
+   }
+
    /**
     * @brief Remove an extension from a extension list
     */
@@ -105,9 +199,21 @@ public:
    VkResult add(const char *const *extensions, size_t count, const char *const *extensions_subset, size_t subset_count);
 
 private:
+   /**
+    * @brief Append the name of an extension that is not part of UTIL_KNOWN_EXTENSIONS_LIST.
+    */
+   VkResult add_unknown(const char *extension);
+
    util::allocator m_alloc;
 
    /**
+    * @brief The extensions of UTIL_KNOWN_EXTENSIONS_LIST in the list.
+    */
+   known_extension_set m_known_extensions;
+
+   /**
+    * @brief The extensions that are not part of UTIL_KNOWN_EXTENSIONS_LIST.
+    *
     * @note We are using VkExtensionProperties to store the extension name only
     */
    util::vector<VkExtensionProperties> m_ext_props;
@@ -30,6 +30,8 @@
 
 #pragma once
 
+#include <cerrno>
+#include <poll.h>
 #include <unistd.h>
 #include <utility>
 
@@ -83,4 +85,38 @@ private:
    int fd_handle{ -1 };
 };
 
+/**
+ * @brief Wait for a sync FD to be signalled.
+ *
+ * Waits interrupted by a signal are restarted.
+ *
+ * @param sync_fd    The sync FD, an invalid one counts as already signalled.
+ * @param timeout_ms Timeout in milliseconds, -1 waits indefinitely and 0 only checks whether it is signalled.
+ *
+ * @return 1 once signalled, 0 if the timeout elapsed first, otherwise -1 with errno set.
+ */
+inline int wait_sync_fd(const fd_owner &sync_fd, int timeout_ms)
+{
+   if (!sync_fd.is_valid())
+   {
+      return 1;
+   }
+
+   struct pollfd pfd = {};
+   pfd.fd = sync_fd.get();
+   pfd.events = POLLIN;
+   int res;
+   do
+   {
+      res = poll(&pfd, 1, timeout_ms);
+   } while (res < 0 && (errno == EINTR || errno == EAGAIN));
+
+   if (res > 0 && (pfd.revents & (POLLERR | POLLNVAL)))
+   {
+      errno = EINVAL;
+      return -1;
+   }
+   return res;
+}
+
 } /* namespace util */
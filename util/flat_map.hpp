@@ -0,0 +1,431 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file flat_map.hpp
+ *
+ * @brief Contains a hash map that stores its entries in a single array.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "custom_allocator.hpp"
+#include "helpers.hpp"
+
+namespace util
+{
+
+/**
+ * @brief Default hash of @ref flat_map.
+ *
+ * Handles, both dispatchable pointers and non-dispatchable 64-bit integers, are mostly alignment zeros in their low
+ * bits, which is where the map takes its slot index from. Their bits are therefore mixed, like
+ * @ref concurrent_lookup_table does. Other keys use std::hash.
+ */
+template <typename Key, typename Enable = void>
+struct flat_map_hash : std::hash<Key>
+{
+};
+
+template <typename Key>
+struct flat_map_hash<Key, std::enable_if_t<std::is_pointer<Key>::value || std::is_integral<Key>::value>>
+{
+   size_t operator()(Key key) const
+   {
+      uint64_t k;
+      if constexpr (std::is_pointer<Key>::value)
+      {
+         k = reinterpret_cast<uintptr_t>(key);
+      }
+      else
+      {
+         k = static_cast<uint64_t>(key);
+      }
+      k ^= k >> 17;
+      k *= 0x9E3779B97F4A7C15ull;
+      k ^= k >> 29;
+      return static_cast<size_t>(k);
+   }
+};
+
+/**
+ * @brief Hash map using open addressing with linear probing over a single array of entries.
+ *
+ * A lookup reads consecutive slots of one array, instead of following the nodes of a bucket chain as
+ * std::unordered_map does, and inserting does not allocate unless the array grows. Entries are removed by shifting
+ * the following entries of the probe sequence back, so no tombstones accumulate and lookups of missing keys stay short.
+ *
+ * Like @ref unordered_map, the operations that allocate do not throw, and report out of memory instead. Unlike it,
+ * inserting may move the entries, which invalidates iterators and pointers to entries, as does erasing. Key and Value
+ * must be default constructible and nothrow move assignable.
+ */
+template <typename Key, typename Value, typename Hash = flat_map_hash<Key>, typename Comparator = std::equal_to<Key>>
+class flat_map : private noncopyable
+{
+public:
+   using value_type = std::pair<Key, Value>;
+   using size_type = size_t;
+
+private:
+   struct slot
+   {
+      bool occupied{ false };
+      value_type entry{};
+   };
+
+   template <typename SlotType, typename EntryType>
+   class iterator_base
+   {
+   public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = EntryType;
+      using difference_type = std::ptrdiff_t;
+      using pointer = EntryType *;
+      using reference = EntryType &;
+
+      iterator_base() = default;
+
+      iterator_base(SlotType *slot, SlotType *end)
+         : m_slot(slot)
+         , m_end(end)
+      {
+         skip_empty();
+      }
+
+      /* Conversion from iterator to const_iterator. */
+      template <typename OtherSlot, typename OtherEntry,
+                typename = std::enable_if_t<std::is_convertible<OtherSlot *, SlotType *>::value>>
+      iterator_base(const iterator_base<OtherSlot, OtherEntry> &other)
+         : m_slot(other.m_slot)
+         , m_end(other.m_end)
+      {
+      }
+
+      reference operator*() const
+      {
+         return m_slot->entry;
+      }
+
+      pointer operator->() const
+      {
+         return &m_slot->entry;
+      }
+
+      iterator_base &operator++()
+      {
+         m_slot++;
+         skip_empty();
+         return *this;
+      }
+
+      iterator_base operator++(int)
+      {
+         iterator_base previous = *this;
+         ++*this;
+         return previous;
+      }
+
+      bool operator==(const iterator_base &other) const
+      {
+         return m_slot == other.m_slot;
+      }
+
+      bool operator!=(const iterator_base &other) const
+      {
+         return m_slot != other.m_slot;
+      }
+
+   private:
+      friend class flat_map;
+      template <typename, typename>
+      friend class iterator_base;
+
+      void skip_empty()
+      {
+         while (m_slot != m_end && !m_slot->occupied)
+         {
+            m_slot++;
+         }
+      }
+
+      SlotType *m_slot{ nullptr };
+      SlotType *m_end{ nullptr };
+   };
+
+public:
+   using iterator = iterator_base<slot, value_type>;
+   using const_iterator = iterator_base<const slot, const value_type>;
+
+   /**
+    * @brief Construct an empty map, which allocates nothing until the first insertion.
+    *
+    * @param allocator The allocator used for the array of entries.
+    */
+   explicit flat_map(const util::allocator &allocator)
+      : m_allocator(allocator)
+   {
+   }
+
+   ~flat_map()
+   {
+      m_allocator.destroy<slot>(m_capacity, m_slots);
+   }
+
+   iterator begin()
+   {
+      return iterator(m_slots, m_slots + m_capacity);
+   }
+
+   iterator end()
+   {
+      return iterator(m_slots + m_capacity, m_slots + m_capacity);
+   }
+
+   const_iterator begin() const
+   {
+      return const_iterator(m_slots, m_slots + m_capacity);
+   }
+
+   const_iterator end() const
+   {
+      return const_iterator(m_slots + m_capacity, m_slots + m_capacity);
+   }
+
+   size_type size() const
+   {
+      return m_size;
+   }
+
+   bool empty() const
+   {
+      return m_size == 0;
+   }
+
+   /**
+    * @brief Find the entry of a key.
+    *
+    * @param key The key to look up.
+    * @return an iterator to the entry, or end() if the key is not in the map.
+    */
+   iterator find(const Key &key)
+   {
+      slot *s = find_slot(key);
+      return s != nullptr ? iterator(s, m_slots + m_capacity) : end();
+   }
+
+   const_iterator find(const Key &key) const
+   {
+      const slot *s = const_cast<flat_map *>(this)->find_slot(key);
+      return s != nullptr ? const_iterator(s, m_slots + m_capacity) : end();
+   }
+
+   /**
+    * @brief Like std::unordered_map.insert but doesn't throw on out of memory errors.
+    *
+    * @param value The entry to insert, nothing is inserted if its key is already in the map.
+    * @return std::optional<std::pair<iterator, bool>> If successful, the optional contains an iterator to the entry
+    *         of the key and whether it was inserted, otherwise if out of memory, the function returns std::nullopt.
+    */
+   std::optional<std::pair<iterator, bool>> try_insert(const value_type &value)
+   {
+      slot *existing = find_slot(value.first);
+      if (existing != nullptr)
+      {
+         return std::make_pair(iterator(existing, m_slots + m_capacity), false);
+      }
+
+      /* Grow at a load factor of 3/4, beyond which probe sequences get long. */
+      if ((m_size + 1) * 4 > m_capacity * 3 && !try_reserve(m_size + 1))
+      {
+         return std::nullopt;
+      }
+
+      slot *s = &m_slots[probe_start(value.first)];
+      while (s->occupied)
+      {
+         s = next_slot(s);
+      }
+      s->entry = value;
+      s->occupied = true;
+      m_size++;
+      return std::make_pair(iterator(s, m_slots + m_capacity), true);
+   }
+
+   /**
+    * @brief Make room for a number of entries, so that inserting up to them does not allocate.
+    *
+    * @param size The number of entries.
+    * @return true If the map has room for them.
+    * @return false If the host has run out of memory.
+    */
+   bool try_reserve(size_type size)
+   {
+      size_type capacity = MIN_CAPACITY;
+      while (size * 4 > capacity * 3)
+      {
+         capacity *= 2;
+      }
+      if (capacity <= m_capacity)
+      {
+         return true;
+      }
+
+      slot *slots = m_allocator.create<slot>(capacity);
+      if (slots == nullptr)
+      {
+         return false;
+      }
+
+      slot *old_slots = m_slots;
+      const size_type old_capacity = m_capacity;
+      m_slots = slots;
+      m_capacity = capacity;
+      for (size_type i = 0; i < old_capacity; i++)
+      {
+         if (old_slots[i].occupied)
+         {
+            slot *s = &m_slots[probe_start(old_slots[i].entry.first)];
+            while (s->occupied)
+            {
+               s = next_slot(s);
+            }
+            s->entry = std::move(old_slots[i].entry);
+            s->occupied = true;
+         }
+      }
+      m_allocator.destroy<slot>(old_capacity, old_slots);
+      return true;
+   }
+
+   /**
+    * @brief Remove an entry.
+    *
+    * @param it Iterator to the entry, which must be valid.
+    */
+   void erase(iterator it)
+   {
+      assert(it.m_slot != nullptr && it.m_slot->occupied);
+      slot *hole = it.m_slot;
+
+      /* Move back the entries of the probe sequence after the hole that can reach it, so that lookups, which stop at
+       * the first empty slot, still find them. */
+      for (slot *s = next_slot(hole); s->occupied; s = next_slot(s))
+      {
+         const size_type start = probe_start(s->entry.first);
+         const size_type hole_distance = (index_of(hole) - start) & (m_capacity - 1);
+         const size_type slot_distance = (index_of(s) - start) & (m_capacity - 1);
+         if (hole_distance < slot_distance)
+         {
+            hole->entry = std::move(s->entry);
+            hole = s;
+         }
+      }
+
+      hole->entry = value_type{};
+      hole->occupied = false;
+      m_size--;
+   }
+
+   /**
+    * @brief Remove the entry of a key, if there is one.
+    *
+    * @param key The key to remove.
+    * @return The number of entries removed.
+    */
+   size_type erase(const Key &key)
+   {
+      slot *s = find_slot(key);
+      if (s == nullptr)
+      {
+         return 0;
+      }
+      erase(iterator(s, m_slots + m_capacity));
+      return 1;
+   }
+
+   /**
+    * @brief Remove all the entries, keeping the array allocated.
+    */
+   void clear()
+   {
+      for (size_type i = 0; i < m_capacity; i++)
+      {
+         m_slots[i] = slot{};
+      }
+      m_size = 0;
+   }
+
+private:
+   /** Capacity of the first allocation, which has to be a power of two. */
+   static constexpr size_type MIN_CAPACITY = 8;
+
+   size_type probe_start(const Key &key) const
+   {
+      return Hash()(key) & (m_capacity - 1);
+   }
+
+   size_type index_of(const slot *s) const
+   {
+      return static_cast<size_type>(s - m_slots);
+   }
+
+   slot *next_slot(slot *s) const
+   {
+      return s + 1 != m_slots + m_capacity ? s + 1 : m_slots;
+   }
+
+   slot *find_slot(const Key &key)
+   {
+      if (m_size == 0)
+      {
+         return nullptr;
+      }
+
+      /* The load factor keeps an empty slot, which ends the probe sequence of a missing key. */
+      for (slot *s = &m_slots[probe_start(key)]; s->occupied; s = next_slot(s))
+      {
+         if (Comparator()(s->entry.first, key))
+         {
+            return s;
+         }
+      }
+      return nullptr;
+   }
+
+   util::allocator m_allocator;
+   slot *m_slots{ nullptr };
+   size_type m_capacity{ 0 };
+   size_type m_size{ 0 };
+};
+
+} /* namespace util */
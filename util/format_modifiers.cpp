@@ -23,16 +23,229 @@
  */
 
 #include "format_modifiers.hpp"
+#include "persistent_cache.hpp"
 #include "layer/private_data.hpp"
 
+#include <algorithm>
+#include <cstring>
+
 namespace util
 {
 
+bool drm_image_format_cache::key::operator==(const key &other) const
+{
+   return physical_device == other.physical_device && format == other.format && modifier == other.modifier &&
+          type == other.type && usage == other.usage && flags == other.flags && sharing_mode == other.sharing_mode &&
+#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
+          compression_flags == other.compression_flags && fixed_rate_flags == other.fixed_rate_flags &&
+#endif
+          queue_families == other.queue_families;
+}
+
+size_t drm_image_format_cache::key_hash::operator()(const key &k) const
+{
+   /* Plain FNV-1a over the fields, the few entries of the cache do not need anything better. */
+   uint64_t hash = 14695981039346656037ull;
+   auto combine = [&hash](uint64_t value) {
+      hash ^= value;
+      hash *= 1099511628211ull;
+   };
+
+   combine(reinterpret_cast<uintptr_t>(k.physical_device));
+   combine(k.format);
+   combine(k.modifier);
+   combine(k.type);
+   combine(k.usage);
+   combine(k.flags);
+   combine(k.sharing_mode);
+   combine(k.queue_families);
+#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
+   combine(k.compression_flags);
+   for (auto fixed_rate_flags : k.fixed_rate_flags)
+   {
+      combine(fixed_rate_flags);
+   }
+#endif
+   return static_cast<size_t>(hash);
+}
+
+drm_image_format_cache::drm_image_format_cache(const util::allocator &allocator)
+   : m_entries(allocator)
+{
+}
+
+std::optional<drm_image_format_cache::entry> drm_image_format_cache::find(const key &k)
+{
+   const std::lock_guard<std::mutex> lock(m_mutex);
+   auto it = m_entries.find(k);
+   if (it == m_entries.end())
+   {
+      return std::nullopt;
+   }
+   return it->second;
+}
+
+void drm_image_format_cache::insert(const key &k, const entry &value)
+{
+   const std::lock_guard<std::mutex> lock(m_mutex);
+   if (m_entries.size() >= MAX_ENTRIES)
+   {
+      m_entries.clear();
+   }
+   m_entries.try_insert(std::make_pair(k, value));
+}
+
+VkResult get_drm_image_format_properties(VkPhysicalDevice physical_device, const VkImageCreateInfo &info,
+                                         uint64_t modifier, drm_image_format_properties &properties)
+{
+   auto &instance_data = layer::instance_private_data::get(physical_device);
+
+   drm_image_format_cache::key key = {};
+   key.physical_device = physical_device;
+   key.format = info.format;
+   key.modifier = modifier;
+   key.type = info.imageType;
+   key.usage = info.usage;
+   key.flags = info.flags;
+   key.sharing_mode = info.sharingMode;
+
+   bool cacheable = true;
+   if (info.sharingMode == VK_SHARING_MODE_CONCURRENT)
+   {
+      for (uint32_t i = 0; i < info.queueFamilyIndexCount; i++)
+      {
+         /* Queue family indices past the bitmask are unusual enough to simply not be cached. */
+         if (info.pQueueFamilyIndices[i] >= 64)
+         {
+            cacheable = false;
+            break;
+         }
+         key.queue_families |= 1ull << info.pQueueFamilyIndices[i];
+      }
+   }
+
+#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
+   auto *compression_control = util::find_extension<VkImageCompressionControlEXT>(
+      VK_STRUCTURE_TYPE_IMAGE_COMPRESSION_CONTROL_EXT, info.pNext);
+   if (compression_control != nullptr)
+   {
+      key.compression_flags = compression_control->flags;
+      if (compression_control->compressionControlPlaneCount > MAX_PLANES)
+      {
+         cacheable = false;
+      }
+      else if (compression_control->pFixedRateFlags != nullptr)
+      {
+         std::copy(compression_control->pFixedRateFlags,
+                   compression_control->pFixedRateFlags + compression_control->compressionControlPlaneCount,
+                   key.fixed_rate_flags.begin());
+      }
+   }
+#endif
+
+   auto &cache = instance_data.get_drm_image_format_cache();
+   if (cacheable)
+   {
+      auto cached = cache.find(key);
+      if (cached.has_value())
+      {
+         properties = cached->properties;
+         return cached->result;
+      }
+   }
+
+   VkExternalImageFormatPropertiesKHR external_props = {};
+   external_props.sType = VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES_KHR;
+
+   VkImageFormatProperties2KHR format_props = {};
+   format_props.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2_KHR;
+   format_props.pNext = &external_props;
+
+   VkPhysicalDeviceExternalImageFormatInfoKHR external_info = {};
+   external_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO_KHR;
+   external_info.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
+
+   VkPhysicalDeviceImageDrmFormatModifierInfoEXT drm_mod_info = {};
+   drm_mod_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_DRM_FORMAT_MODIFIER_INFO_EXT;
+   drm_mod_info.pNext = &external_info;
+   drm_mod_info.drmFormatModifier = modifier;
+   drm_mod_info.sharingMode = info.sharingMode;
+   drm_mod_info.queueFamilyIndexCount = info.queueFamilyIndexCount;
+   drm_mod_info.pQueueFamilyIndices = info.pQueueFamilyIndices;
+
+   VkPhysicalDeviceImageFormatInfo2KHR image_info = {};
+   image_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2_KHR;
+   image_info.pNext = &drm_mod_info;
+   image_info.format = info.format;
+   image_info.type = info.imageType;
+   image_info.tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT;
+   image_info.usage = info.usage;
+   image_info.flags = info.flags;
+
+#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
+   VkImageCompressionControlEXT compression_control_copy = {};
+   if (compression_control != nullptr)
+   {
+      compression_control_copy = *compression_control;
+      compression_control_copy.pNext = image_info.pNext;
+      image_info.pNext = &compression_control_copy;
+   }
+#endif
+
+   VkResult result =
+      instance_data.disp.GetPhysicalDeviceImageFormatProperties2KHR(physical_device, &image_info, &format_props);
+   properties.image_format_properties = format_props.imageFormatProperties;
+   properties.external_memory_features = external_props.externalMemoryProperties.externalMemoryFeatures;
+
+   /* Running out of memory says nothing about the format, so it is not worth remembering. */
+   if (cacheable && result != VK_ERROR_OUT_OF_HOST_MEMORY && result != VK_ERROR_OUT_OF_DEVICE_MEMORY)
+   {
+      cache.insert(key, drm_image_format_cache::entry{ result, properties });
+   }
+
+   return result;
+}
+
+/**
+ * @brief Hash everything the DRM format modifier properties of a format depend on, to key their persistent cache
+ *        entry.
+ */
+static uint64_t get_drm_format_properties_cache_key(const layer::instance_private_data &instance_data,
+                                                    VkPhysicalDevice physical_device, VkFormat format)
+{
+   VkPhysicalDeviceProperties device_props = {};
+   instance_data.disp.GetPhysicalDeviceProperties(physical_device, &device_props);
+
+   const uint32_t ids[] = { device_props.vendorID, device_props.deviceID, device_props.driverVersion,
+                            device_props.apiVersion, static_cast<uint32_t>(format) };
+   uint64_t key = persistent_cache_hash(ids, sizeof(ids));
+   return persistent_cache_hash(device_props.pipelineCacheUUID, sizeof(device_props.pipelineCacheUUID), key);
+}
+
 VkResult get_drm_format_properties(VkPhysicalDevice physical_device, VkFormat format,
-                                   util::vector<VkDrmFormatModifierPropertiesEXT> &format_props_list)
+                                   drm_format_properties_list &format_props_list)
 {
    auto &instance_data = layer::instance_private_data::get(physical_device);
 
+   const bool use_persistent_cache = is_persistent_cache_enabled();
+   uint64_t cache_key = 0;
+   if (use_persistent_cache)
+   {
+      cache_key = get_drm_format_properties_cache_key(instance_data, physical_device, format);
+
+      persistent_cache_entry cached;
+      if (cached.load("vk_drm_format_properties", cache_key) &&
+          cached.size() % sizeof(VkDrmFormatModifierPropertiesEXT) == 0)
+      {
+         if (!format_props_list.try_resize(cached.size() / sizeof(VkDrmFormatModifierPropertiesEXT)))
+         {
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+         }
+         memcpy(format_props_list.data(), cached.data(), cached.size());
+         return VK_SUCCESS;
+      }
+   }
+
    VkDrmFormatModifierPropertiesListEXT format_modifier_props = {};
    format_modifier_props.sType = VK_STRUCTURE_TYPE_DRM_FORMAT_MODIFIER_PROPERTIES_LIST_EXT;
 
@@ -49,6 +262,12 @@ VkResult get_drm_format_properties(VkPhysicalDevice physical_device, VkFormat fo
 
    format_modifier_props.pDrmFormatModifierProperties = format_props_list.data();
    instance_data.disp.GetPhysicalDeviceFormatProperties2KHR(physical_device, format, &format_props);
+
+   if (use_persistent_cache)
+   {
+      persistent_cache_entry::store("vk_drm_format_properties", cache_key, format_props_list.data(),
+                                    format_props_list.size() * sizeof(VkDrmFormatModifierPropertiesEXT));
+   }
    return VK_SUCCESS;
 }
 } /* namespace util */
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2022 Arm Limited.
+ * Copyright (c) 2022, 2024 Arm Limited.
  *
  * SPDX-License-Identifier: MIT
  *
@@ -25,11 +25,128 @@
 #pragma once
 
 #include <vulkan/vulkan.h>
+#include <array>
+#include <mutex>
+#include <optional>
 #include "custom_allocator.hpp"
+#include "helpers.hpp"
+#include "small_vector.hpp"
+#include "flat_map.hpp"
 
 namespace util
 {
 
+/**
+ * @brief Properties of an image with a DRM format modifier that is imported or exported as a dma-buf.
+ */
+struct drm_image_format_properties
+{
+   VkImageFormatProperties image_format_properties;
+   VkExternalMemoryFeatureFlags external_memory_features;
+};
+
+/**
+ * @brief Cache of @ref get_drm_image_format_properties results.
+ *
+ * The results do not depend on the extent of the image, so swapchains that are recreated with a different size, e.g.
+ * on window resizes, only hit the cache. Image format properties of a physical device do not change, so entries never
+ * go stale. The cache is shared by all threads of an instance.
+ */
+class drm_image_format_cache
+{
+public:
+   /**
+    * @brief Everything the result of a query depends on.
+    */
+   struct key
+   {
+      VkPhysicalDevice physical_device;
+      VkFormat format;
+      uint64_t modifier;
+      VkImageType type;
+      VkImageUsageFlags usage;
+      VkImageCreateFlags flags;
+      VkSharingMode sharing_mode;
+      /* Bitmask of the queue family indices for VK_SHARING_MODE_CONCURRENT. */
+      uint64_t queue_families;
+#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
+      VkImageCompressionFlagsEXT compression_flags;
+      std::array<VkImageCompressionFixedRateFlagsEXT, MAX_PLANES> fixed_rate_flags;
+#endif
+
+      bool operator==(const key &other) const;
+   };
+
+   struct key_hash
+   {
+      size_t operator()(const key &k) const;
+   };
+
+   /**
+    * @brief Result of a query.
+    */
+   struct entry
+   {
+      VkResult result;
+      drm_image_format_properties properties;
+   };
+
+   explicit drm_image_format_cache(const util::allocator &allocator);
+
+   /**
+    * @brief Look a query up.
+    *
+    * @param k The query.
+    *
+    * @return The cached result of the query, std::nullopt if it is not cached.
+    */
+   std::optional<entry> find(const key &k);
+
+   /**
+    * @brief Cache the result of a query.
+    *
+    * Caching is best effort, nothing is cached if the host is out of memory.
+    *
+    * @param k     The query.
+    * @param value Its result.
+    */
+   void insert(const key &k, const entry &value);
+
+private:
+   /**
+    * @brief Limit on the number of cached queries, the cache is emptied when it is reached.
+    *
+    * Applications only use a handful of usage and format combinations, so this is only a safeguard.
+    */
+   static constexpr size_t MAX_ENTRIES = 1024;
+
+   std::mutex m_mutex;
+   util::flat_map<key, entry, key_hash> m_entries;
+};
+
+/**
+ * @brief Get the properties of an image with a DRM format modifier that is imported or exported as a dma-buf.
+ *
+ * Wraps vkGetPhysicalDeviceImageFormatProperties2KHR with a @ref drm_image_format_cache owned by the instance of
+ * @p physical_device.
+ *
+ * @param      physical_device The physical device.
+ * @param      info            Create info of the image. The extent, mip levels, array layers and samples are ignored
+ *                             and left for the caller to check against @p properties. The pNext chain is ignored,
+ *                             except for a VkImageCompressionControlEXT.
+ * @param      modifier        The DRM format modifier of the image.
+ * @param[out] properties      The properties of the image, only valid on success.
+ *
+ * @return The result of vkGetPhysicalDeviceImageFormatProperties2KHR.
+ */
+VkResult get_drm_image_format_properties(VkPhysicalDevice physical_device, const VkImageCreateInfo &info,
+                                         uint64_t modifier, drm_image_format_properties &properties);
+
+/**
+ * @brief List of the properties of a format for each DRM modifier, sized so that a query does not usually allocate.
+ */
+using drm_format_properties_list = small_vector<VkDrmFormatModifierPropertiesEXT, 16>;
+
 /**
  * @brief Get the properties a format has when combined with a DRM modifier.
  *
@@ -42,6 +159,6 @@ namespace util
  * the host gets out of memory.
  */
 VkResult get_drm_format_properties(VkPhysicalDevice physical_device, VkFormat format,
-                                   util::vector<VkDrmFormatModifierPropertiesEXT> &format_props_list);
+                                   drm_format_properties_list &format_props_list);
 
 } /* namespace util */
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2021-2023 Arm Limited.
+ * Copyright (c) 2021-2024 Arm Limited.
  *
  * SPDX-License-Identifier: MIT
  *
@@ -23,23 +23,36 @@
  */
 
 #include "log.hpp"
-#include <iostream>
+#include "timed_semaphore.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <charconv>
 #include <cstdarg>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
-#include <string>
 #include <cstring>
+#include <new>
+#include <system_error>
+#include <thread>
 
 namespace util
 {
 
 #ifndef NDEBUG
 
+/* Longest message written, including the level, the source location and the newline. Longer messages are truncated. */
+static constexpr size_t LOG_MESSAGE_SIZE = 512;
+
+/* Number of messages that can be waiting to be written, must be a power of 2. */
+static constexpr size_t LOG_QUEUE_SIZE = 128;
+static_assert((LOG_QUEUE_SIZE & (LOG_QUEUE_SIZE - 1)) == 0, "LOG_QUEUE_SIZE must be a power of 2");
+
 /**
- * @brief check if a log level is enabled, and print it
+ * @brief Get the log level set with VULKAN_WSI_DEBUG_LEVEL.
  */
-static bool check_and_print_log_level(int level)
+static int get_log_level()
 {
    struct log_state
    {
@@ -53,42 +66,239 @@ static bool check_and_print_log_level(int level)
       }
    };
    static log_state state;
+   return state.level;
+}
+
+/**
+ * @brief Format a message as a single line.
+ *
+ * @return The length of the line, which always ends with a newline, truncating the message if needed.
+ */
+static size_t format_message(std::array<char, LOG_MESSAGE_SIZE> &buffer, int level, const char *file, int line,
+                             const char *format, std::va_list args)
+{
+   int prefix_length = 0;
+   switch (level)
+   {
+   case 0:
+      /* Reserved for no logging */
+      prefix_length = std::snprintf(buffer.data(), buffer.size(), "(%s:%d): ", file, line);
+      break;
+   case 1:
+      prefix_length = std::snprintf(buffer.data(), buffer.size(), "ERROR(%s:%d): ", file, line);
+      break;
+   case 2:
+      prefix_length = std::snprintf(buffer.data(), buffer.size(), "WARNING(%s:%d): ", file, line);
+      break;
+   case 3:
+      prefix_length = std::snprintf(buffer.data(), buffer.size(), "INFO(%s:%d): ", file, line);
+      break;
+   default:
+      prefix_length = std::snprintf(buffer.data(), buffer.size(), "LEVEL_%d(%s:%d): ", level, file, line);
+      break;
+   }
+
+   /* Keep the last byte for the newline. */
+   const size_t max_length = buffer.size() - 1;
+   size_t length = std::min(static_cast<size_t>(std::max(prefix_length, 0)), max_length);
+   int message_length = std::vsnprintf(buffer.data() + length, buffer.size() - length, format, args);
+   length = std::min(length + static_cast<size_t>(std::max(message_length, 0)), max_length);
+
+   buffer[length++] = '\n';
+   return length;
+}
+
+/**
+ * @brief Sink writing log messages to stderr from a background thread.
+ *
+ * Messages go through a bounded lock-free queue, so that threads logging messages, such as the presentation threads,
+ * never wait for each other nor for stderr. When the queue is full, messages are dropped rather than blocking the
+ * caller. If the background thread is not running, messages are written by the calling thread.
+ */
+class log_sink
+{
+public:
+   log_sink()
+   {
+      for (size_t i = 0; i < m_slots.size(); i++)
+      {
+         m_slots[i].sequence.store(i, std::memory_order_relaxed);
+      }
+      m_pending.init(0);
+
+      try
+      {
+         m_thread = std::thread(&log_sink::write_thread, this);
+         m_running.store(true, std::memory_order_release);
+      }
+      catch (const std::system_error &)
+      {
+         /* Write messages from the calling threads instead. */
+      }
+   }
+
+   /**
+    * @brief Format and write a message.
+    */
+   void log(int level, const char *file, int line, const char *format, std::va_list args)
+   {
+      /* Announce the message before checking whether the thread runs, so that stop() either sees it in flight or makes
+       * it write the message itself. */
+      m_producers.fetch_add(1, std::memory_order_seq_cst);
+      if (!m_running.load(std::memory_order_seq_cst))
+      {
+         m_producers.fetch_sub(1, std::memory_order_release);
+         thread_local std::array<char, LOG_MESSAGE_SIZE> buffer;
+         size_t length = format_message(buffer, level, file, line, format, args);
+         std::fwrite(buffer.data(), 1, length, stderr);
+         return;
+      }
+
+      enqueue(level, file, line, format, args);
+      m_producers.fetch_sub(1, std::memory_order_release);
+   }
+
+   /**
+    * @brief Write the messages in the queue and stop the background thread.
+    */
+   void stop()
+   {
+      if (m_thread.joinable())
+      {
+         m_running.store(false, std::memory_order_seq_cst);
+         m_stop.store(true, std::memory_order_relaxed);
+         m_pending.post();
+         m_thread.join();
+
+         /* Messages still being queued by the threads that saw the background thread running. */
+         while (m_producers.load(std::memory_order_acquire) != 0)
+         {
+            std::this_thread::yield();
+         }
+         write_pending();
+      }
+   }
+
+private:
+   struct slot
+   {
+      /* Position in the queue this slot is ready to be written at, or position + 1 once it holds a message. */
+      std::atomic<size_t> sequence;
+      size_t length;
+      std::array<char, LOG_MESSAGE_SIZE> text;
+   };
+
+   /**
+    * @brief Format a message into a slot of the queue, or drop it if the queue is full.
+    */
+   void enqueue(int level, const char *file, int line, const char *format, std::va_list args)
+   {
+      size_t position = m_enqueue_position.load(std::memory_order_relaxed);
+      slot *target = nullptr;
+      while (target == nullptr)
+      {
+         slot &candidate = m_slots[position & (LOG_QUEUE_SIZE - 1)];
+         const size_t sequence = candidate.sequence.load(std::memory_order_acquire);
+         const auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+         if (difference == 0)
+         {
+            if (m_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+               target = &candidate;
+            }
+         }
+         else if (difference < 0)
+         {
+            /* The queue is full. */
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+         }
+         else
+         {
+            position = m_enqueue_position.load(std::memory_order_relaxed);
+         }
+      }
+
+      target->length = format_message(target->text, level, file, line, format, args);
+      target->sequence.store(position + 1, std::memory_order_release);
+      m_pending.post();
+   }
+
+   /**
+    * @brief Write the messages in the queue, only called from a single thread at a time.
+    */
+   void write_pending()
+   {
+      while (true)
+      {
+         slot &source = m_slots[m_dequeue_position & (LOG_QUEUE_SIZE - 1)];
+         if (source.sequence.load(std::memory_order_acquire) != m_dequeue_position + 1)
+         {
+            break;
+         }
+
+         std::fwrite(source.text.data(), 1, source.length, stderr);
+         source.sequence.store(m_dequeue_position + LOG_QUEUE_SIZE, std::memory_order_release);
+         m_dequeue_position++;
+      }
+
+      const uint64_t dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+      if (dropped > 0)
+      {
+         std::fprintf(stderr, "WARNING: %llu log messages were dropped\n", static_cast<unsigned long long>(dropped));
+      }
+   }
 
-   bool result = level <= state.level;
-   if (result)
+   void write_thread()
    {
-      switch (level)
+      while (!m_stop.load(std::memory_order_relaxed))
       {
-      case 0:
-         /* Reserved for no logging */
-         break;
-      case 1:
-         std::fprintf(stderr, "ERROR");
-         break;
-      case 2:
-         std::fprintf(stderr, "WARNING");
-         break;
-      case 3:
-         std::fprintf(stderr, "INFO");
-         break;
-      default:
-         std::fprintf(stderr, "LEVEL_%d", level);
-         break;
+         m_pending.wait(UINT64_MAX);
+         write_pending();
       }
    }
-   return result;
+
+   std::array<slot, LOG_QUEUE_SIZE> m_slots;
+   std::atomic<size_t> m_enqueue_position{ 0 };
+   /* Only accessed by the thread writing the messages. */
+   size_t m_dequeue_position{ 0 };
+   std::atomic<uint64_t> m_dropped{ 0 };
+   timed_semaphore m_pending;
+   std::atomic<bool> m_running{ false };
+   /* Number of threads between checking m_running and queueing their message. */
+   std::atomic<uint32_t> m_producers{ 0 };
+   std::atomic<bool> m_stop{ false };
+   std::thread m_thread;
+};
+
+/**
+ * @brief Get the log sink.
+ *
+ * The sink is never destroyed, so that messages logged while the layer is being unloaded are still written. Its
+ * background thread is stopped, after writing the queued messages, when the layer is unloaded.
+ */
+static log_sink &get_log_sink()
+{
+   alignas(log_sink) static unsigned char storage[sizeof(log_sink)];
+   static log_sink *sink = new (storage) log_sink();
+   static struct sink_stopper
+   {
+      ~sink_stopper()
+      {
+         sink->stop();
+      }
+   } stopper;
+   return *sink;
 }
 
 void wsi_log_message(int level, const char *file, int line, const char *format, ...)
 {
-   if (check_and_print_log_level(level))
+   if (level <= get_log_level())
    {
-      std::fprintf(stderr, "(%s:%d): ", file, line);
       std::va_list args;
       va_start(args, format);
-      std::vfprintf(stderr, format, args);
+      get_log_sink().log(level, file, line, format, args);
       va_end(args);
-      std::putc('\n', stderr);
    }
 }
 
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2021-2023 Arm Limited.
+ * Copyright (c) 2021-2024 Arm Limited.
  *
  * SPDX-License-Identifier: MIT
  *
@@ -27,6 +27,11 @@ namespace util
 {
 #define WSI_DEFAULT_LOG_LEVEL 1
 
+/* Most verbose log level compiled in the layer, messages of higher levels are removed at compile time. */
+#ifndef WSI_MAX_LOG_LEVEL
+#define WSI_MAX_LOG_LEVEL 3
+#endif
+
 /**
  * @brief Log a message to a certain log level
  *
@@ -37,6 +42,11 @@ namespace util
  * is set to 2, messages with log level 1 and 2 are printed. Please note that
  * the newline character '\n' is automatically appended.
  *
+ * Messages are formatted by the calling thread and written to stderr by a
+ * background thread, so that logging does not block the caller on stderr.
+ * Messages are dropped, and the number of dropped messages reported, when
+ * they are logged faster than they can be written.
+ *
  * @param[in] level     The log level of this message, you can set an arbitary
  *                      integer however please refer to the included macros for
  *                      the sensible defaults.
@@ -60,7 +70,7 @@ static constexpr bool wsi_log_enable = true;
 #define WSI_LOG(level, ...)                                               \
    do                                                                     \
    {                                                                      \
-      if (::util::wsi_log_enable)                                         \
+      if (::util::wsi_log_enable && (level) <= WSI_MAX_LOG_LEVEL)         \
          ::util::wsi_log_message(level, __FILE__, __LINE__, __VA_ARGS__); \
    } while (0)
 
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file perfect_hash.hpp
+ *
+ * @brief Compile time perfect hashing of a fixed set of strings.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace util
+{
+
+/**
+ * @brief 32-bit FNV-1a hash of a null terminated string.
+ */
+constexpr uint32_t fnv1a_hash(const char *str)
+{
+   uint32_t hash = 2166136261u;
+   for (; *str != '\0'; str++)
+   {
+      hash ^= static_cast<uint8_t>(*str);
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+/**
+ * @brief Mix a seed into a hash so that every bit of the result depends on every bit of both.
+ *
+ * FNV-1a alone only carries bits upwards, so the low bits of a seeded FNV-1a hash depend on the low bits of the seed
+ * only. The multiply and xorshift finalizer spreads them over the whole word, and the slot is taken from the high bits.
+ */
+constexpr uint32_t perfect_hash_mix(uint32_t hash, uint32_t seed)
+{
+   uint32_t x = hash ^ (seed * 0x9e3779b9u);
+   x ^= x >> 16;
+   x *= 0x7feb352du;
+   x ^= x >> 15;
+   x *= 0x846ca68bu;
+   x ^= x >> 16;
+   return x;
+}
+
+/**
+ * @brief Not defined, calling it while building a @ref perfect_hash_index at compile time fails the build.
+ */
+void perfect_hash_duplicate_key();
+
+/**
+ * @brief Maps each of a fixed set of strings to its index in the set, with a single hash and string compare.
+ *
+ * The seed of the hash is searched for when the index is constructed, which is meant to happen at compile time, so
+ * that none of the strings share a slot of the table. A limited number of seeds is tried for each table size, starting
+ * with at least twice as many slots as strings and doubling the slots used when no seed separates the strings.
+ * @ref is_perfect tells whether a seed was found, the users of the index check it with a static_assert.
+ *
+ * @tparam N Number of strings in the set.
+ */
+template <size_t N>
+class perfect_hash_index
+{
+public:
+   /**
+    * @brief Smallest number of slots tried, a power of two with at least twice as many slots as strings.
+    */
+   static constexpr uint32_t min_table_bits = [] {
+      uint32_t bits = 1;
+      while ((size_t{ 1 } << bits) < 2 * N)
+      {
+         bits++;
+      }
+      return bits;
+   }();
+
+   /**
+    * @brief Largest number of slots tried, which is also the size of the table.
+    */
+   static constexpr uint32_t max_table_bits = min_table_bits + 3;
+   static constexpr size_t table_size = size_t{ 1 } << max_table_bits;
+
+   /**
+    * @brief Number of seeds tried for each table size.
+    */
+   static constexpr uint32_t seeds_per_table_size = 256;
+
+   /**
+    * @brief Index returned by @ref find for strings that are not in the set.
+    */
+   static constexpr size_t npos = N;
+
+   /**
+    * @brief Build the index of a set of strings, which must all differ.
+    *
+    * @param keys The strings, which must outlive the index. String literals are expected.
+    */
+   constexpr perfect_hash_index(const std::array<const char *, N> &keys)
+      : m_keys(keys)
+      , m_hashes{}
+      , m_seed(0)
+      , m_shift(0)
+      , m_slots{}
+   {
+      for (size_t i = 0; i < N; i++)
+      {
+         m_hashes[i] = fnv1a_hash(m_keys[i]);
+      }
+
+      for (uint32_t bits = min_table_bits; bits <= max_table_bits; bits++)
+      {
+         for (uint32_t seed = 0; seed < seeds_per_table_size; seed++)
+         {
+            if (try_seed(seed, bits))
+            {
+               m_seed = seed;
+               m_shift = 32 - bits;
+               return;
+            }
+         }
+      }
+   }
+
+   /**
+    * @brief Whether a seed was found that gives each string a slot of its own.
+    */
+   constexpr bool is_perfect() const
+   {
+      return m_shift != 0;
+   }
+
+   /**
+    * @brief Find a string in the set.
+    *
+    * @return The index of the string in the set, or @ref npos if it is not in the set.
+    */
+   size_t find(const char *key) const
+   {
+      const uint16_t slot = m_slots[perfect_hash_mix(fnv1a_hash(key), m_seed) >> m_shift];
+      if (slot != 0 && strcmp(m_keys[slot - 1], key) == 0)
+      {
+         return slot - 1;
+      }
+      return npos;
+   }
+
+private:
+   static_assert(N < UINT16_MAX, "Too many keys for a perfect_hash_index");
+   static_assert(max_table_bits < 32, "Too many keys for a perfect_hash_index");
+
+   static constexpr bool equal(const char *a, const char *b)
+   {
+      for (; *a != '\0' && *a == *b; a++, b++)
+      {
+      }
+      return *a == *b;
+   }
+
+   /**
+    * @brief Fill the first 2^bits slots using a seed.
+    *
+    * @return false if two strings share a slot with this seed.
+    */
+   constexpr bool try_seed(uint32_t seed, uint32_t bits)
+   {
+      for (size_t i = 0; i < (size_t{ 1 } << bits); i++)
+      {
+         m_slots[i] = 0;
+      }
+
+      for (size_t i = 0; i < N; i++)
+      {
+         uint16_t &slot = m_slots[perfect_hash_mix(m_hashes[i], seed) >> (32 - bits)];
+         if (slot != 0)
+         {
+            if (m_hashes[slot - 1] == m_hashes[i] && equal(m_keys[slot - 1], m_keys[i]))
+            {
+               /* No seed separates identical strings. */
+               perfect_hash_duplicate_key();
+            }
+            return false;
+         }
+         /* Slots store the index plus one, 0 marks an empty slot. */
+         slot = static_cast<uint16_t>(i + 1);
+      }
+      return true;
+   }
+
+   std::array<const char *, N> m_keys;
+   std::array<uint32_t, N> m_hashes;
+   uint32_t m_seed;
+   uint32_t m_shift;
+   std::array<uint16_t, table_size> m_slots;
+};
+
+} /* namespace util */
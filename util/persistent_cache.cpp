@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "persistent_cache.hpp"
+#include "util/file_descriptor.hpp"
+#include "util/log.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace util
+{
+
+/**
+ * @brief Header of a persistent cache file, followed by the cached data.
+ */
+struct persistent_cache_header
+{
+   uint32_t magic;
+   uint32_t version;
+   uint64_t key;
+   uint64_t size;
+   uint64_t hash;
+};
+
+/* "WSIC" */
+static constexpr uint32_t PERSISTENT_CACHE_MAGIC = 0x43495357;
+
+/* Bumped when the layout of the header or of the cached data changes. */
+static constexpr uint32_t PERSISTENT_CACHE_VERSION = 1;
+
+static constexpr const char *PERSISTENT_CACHE_DIRECTORY = "vulkan_wsi_layer";
+
+bool is_persistent_cache_enabled()
+{
+   static const bool enabled = [] {
+      const char *env = std::getenv("WSI_PERSISTENT_CACHE");
+      return env != nullptr && strcmp(env, "1") == 0;
+   }();
+   return enabled;
+}
+
+uint64_t persistent_cache_hash(const void *data, size_t size, uint64_t seed)
+{
+   const auto *bytes = static_cast<const uint8_t *>(data);
+   uint64_t hash = seed;
+   for (size_t i = 0; i < size; i++)
+   {
+      hash ^= bytes[i];
+      hash *= 1099511628211ull;
+   }
+   return hash;
+}
+
+/**
+ * @brief Get the path of the file of a cache entry, creating the cache directory if requested.
+ *
+ * @return true on success, false if there is no cache directory or the path does not fit @p path.
+ */
+static bool get_entry_path(const char *name, uint64_t key, bool create_directory, char (&path)[PATH_MAX])
+{
+   int len = 0;
+   if (const char *xdg_cache_home = std::getenv("XDG_CACHE_HOME"); xdg_cache_home != nullptr && *xdg_cache_home)
+   {
+      len = snprintf(path, sizeof(path), "%s", xdg_cache_home);
+   }
+   else if (const char *home = std::getenv("HOME"); home != nullptr && *home)
+   {
+      len = snprintf(path, sizeof(path), "%s/.cache", home);
+   }
+   else
+   {
+      return false;
+   }
+
+   if (len < 0 || static_cast<size_t>(len) >= sizeof(path))
+   {
+      return false;
+   }
+
+   if (create_directory)
+   {
+      /* The base directory may not exist yet either, e.g. on freshly installed systems. */
+      mkdir(path, 0700);
+   }
+
+   len += snprintf(path + len, sizeof(path) - len, "/%s", PERSISTENT_CACHE_DIRECTORY);
+   if (static_cast<size_t>(len) >= sizeof(path))
+   {
+      return false;
+   }
+
+   if (create_directory && mkdir(path, 0700) != 0 && errno != EEXIST)
+   {
+      return false;
+   }
+
+   len += snprintf(path + len, sizeof(path) - len, "/%s-%016llx.bin", name, static_cast<unsigned long long>(key));
+   return static_cast<size_t>(len) < sizeof(path);
+}
+
+persistent_cache_entry::~persistent_cache_entry()
+{
+   if (m_mapping != nullptr)
+   {
+      munmap(m_mapping, m_mapping_size);
+   }
+}
+
+bool persistent_cache_entry::load(const char *name, uint64_t key)
+{
+   if (m_mapping != nullptr)
+   {
+      munmap(m_mapping, m_mapping_size);
+      m_mapping = nullptr;
+      m_mapping_size = 0;
+      m_size = 0;
+   }
+
+   char path[PATH_MAX];
+   if (!get_entry_path(name, key, false, path))
+   {
+      return false;
+   }
+
+   fd_owner fd{ open(path, O_RDONLY | O_CLOEXEC) };
+   if (!fd.is_valid())
+   {
+      return false;
+   }
+
+   struct stat file_stat = {};
+   if (fstat(fd.get(), &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < sizeof(persistent_cache_header))
+   {
+      return false;
+   }
+
+   const size_t file_size = static_cast<size_t>(file_stat.st_size);
+   void *mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+   if (mapping == MAP_FAILED)
+   {
+      return false;
+   }
+
+   persistent_cache_header header;
+   memcpy(&header, mapping, sizeof(header));
+   const void *cached_data = static_cast<const uint8_t *>(mapping) + sizeof(header);
+   if (header.magic != PERSISTENT_CACHE_MAGIC || header.version != PERSISTENT_CACHE_VERSION || header.key != key ||
+       header.size != file_size - sizeof(header) || header.hash != persistent_cache_hash(cached_data, header.size))
+   {
+      WSI_LOG_INFO("Ignoring stale persistent cache entry %s.", path);
+      munmap(mapping, file_size);
+      return false;
+   }
+
+   m_mapping = mapping;
+   m_mapping_size = file_size;
+   m_size = header.size;
+   return true;
+}
+
+const void *persistent_cache_entry::data() const
+{
+   return m_mapping != nullptr ? static_cast<const uint8_t *>(m_mapping) + sizeof(persistent_cache_header) : nullptr;
+}
+
+/**
+ * @brief Write a whole buffer to a file, retrying partial writes.
+ */
+static bool write_all(int fd, const void *data, size_t size)
+{
+   const auto *bytes = static_cast<const uint8_t *>(data);
+   while (size > 0)
+   {
+      ssize_t written = write(fd, bytes, size);
+      if (written < 0)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+         return false;
+      }
+      bytes += written;
+      size -= static_cast<size_t>(written);
+   }
+   return true;
+}
+
+void persistent_cache_entry::store(const char *name, uint64_t key, const void *data, size_t size)
+{
+   char path[PATH_MAX];
+   if (!get_entry_path(name, key, true, path))
+   {
+      return;
+   }
+
+   /* Write to a temporary file that is renamed over the entry, so that concurrent processes never map a partially
+    * written entry. */
+   char temp_path[PATH_MAX];
+   int len = snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, static_cast<int>(getpid()));
+   if (len < 0 || static_cast<size_t>(len) >= sizeof(temp_path))
+   {
+      return;
+   }
+
+   fd_owner fd{ open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) };
+   if (!fd.is_valid())
+   {
+      return;
+   }
+
+   persistent_cache_header header = {};
+   header.magic = PERSISTENT_CACHE_MAGIC;
+   header.version = PERSISTENT_CACHE_VERSION;
+   header.key = key;
+   header.size = size;
+   header.hash = persistent_cache_hash(data, size);
+
+   if (!write_all(fd.get(), &header, sizeof(header)) || !write_all(fd.get(), data, size) ||
+       rename(temp_path, path) != 0)
+   {
+      WSI_LOG_INFO("Failed to store persistent cache entry %s.", path);
+      unlink(temp_path);
+   }
+}
+
+} /* namespace util */
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file persistent_cache.hpp
+ *
+ * @brief Opt-in cache of capabilities that are slow to query, persisted across processes in the user's cache
+ *        directory.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "helpers.hpp"
+
+namespace util
+{
+
+/**
+ * @brief Check whether the persistent cache is enabled.
+ *
+ * The cache is opt-in: it is only used when the WSI_PERSISTENT_CACHE environment variable is set to 1. Entries are
+ * stored in $XDG_CACHE_HOME/vulkan_wsi_layer, or in $HOME/.cache/vulkan_wsi_layer if XDG_CACHE_HOME is not set.
+ */
+bool is_persistent_cache_enabled();
+
+/**
+ * @brief Hash data with FNV-1a, e.g. to build the key of a persistent cache entry.
+ *
+ * @param data The data to hash.
+ * @param size The size of the data in bytes.
+ * @param seed The hash to continue from, so that several pieces of data can be combined.
+ */
+uint64_t persistent_cache_hash(const void *data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+/**
+ * @brief A persistent cache entry, memory-mapped read-only from its file.
+ */
+class persistent_cache_entry : private noncopyable
+{
+public:
+   persistent_cache_entry() = default;
+   ~persistent_cache_entry();
+
+   /**
+    * @brief Map the entry of a cache, validating it against its key.
+    *
+    * Entries that are missing, truncated, corrupted or stored for another key are ignored, so that a stale cache is
+    * simply refilled.
+    *
+    * @param name Name of the cache, which must be usable in a file name.
+    * @param key  Hash of everything the cached data depends on, e.g. driver versions.
+    *
+    * @return true if the entry is mapped, false otherwise.
+    */
+   bool load(const char *name, uint64_t key);
+
+   /**
+    * @brief Get the cached data, only valid after a successful @ref load.
+    */
+   const void *data() const;
+
+   /**
+    * @brief Get the size of the cached data in bytes.
+    */
+   size_t size() const
+   {
+      return m_size;
+   }
+
+   /**
+    * @brief Store the entry of a cache, replacing its previous content atomically.
+    *
+    * Storing is best effort, failures are silently ignored.
+    *
+    * @param name Name of the cache, which must be usable in a file name.
+    * @param key  Hash of everything the data depends on.
+    * @param data The data to store.
+    * @param size The size of the data in bytes.
+    */
+   static void store(const char *name, uint64_t key, const void *data, size_t size);
+
+private:
+   /**
+    * @brief The mapping of the whole file, including its header.
+    */
+   void *m_mapping{ nullptr };
+
+   /**
+    * @brief Size of @ref m_mapping.
+    */
+   size_t m_mapping_size{ 0 };
+
+   /**
+    * @brief Size of the cached data, which follows the header.
+    */
+   size_t m_size{ 0 };
+};
+
+} /* namespace util */
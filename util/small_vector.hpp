@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file small_vector.hpp
+ *
+ * @brief Contains a vector that stores its first elements inline and only allocates when it grows beyond them.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "custom_allocator.hpp"
+#include "helpers.hpp"
+
+namespace util
+{
+
+/**
+ * @brief Vector with an inline capacity, for the short lists built on query paths.
+ *
+ * Up to @p N elements are stored inside the object, so a vector that stays within its inline capacity never
+ * allocates. Beyond that, the elements move to memory allocated through the given util::allocator. Like util::vector,
+ * the methods that may allocate are non throwing and report allocation failures.
+ *
+ * @tparam T Type of the elements, which must be trivially copyable.
+ * @tparam N Number of elements stored inline.
+ */
+template <typename T, std::size_t N>
+class small_vector : private noncopyable
+{
+   static_assert(std::is_trivially_copyable<T>::value, "small_vector elements must be trivially copyable");
+   static_assert(N > 0, "small_vector must have an inline capacity");
+
+public:
+   using value_type = T;
+   using iterator = T *;
+   using const_iterator = const T *;
+
+   explicit small_vector(const allocator &alloc)
+      : m_alloc(alloc)
+      , m_inline_data{}
+      , m_data(m_inline_data.data())
+      , m_size(0)
+      , m_capacity(N)
+   {
+   }
+
+   ~small_vector()
+   {
+      if (m_data != m_inline_data.data())
+      {
+         m_alloc.m_callbacks.pfnFree(m_alloc.m_callbacks.pUserData, m_data);
+      }
+   }
+
+   std::size_t size() const
+   {
+      return m_size;
+   }
+
+   std::size_t capacity() const
+   {
+      return m_capacity;
+   }
+
+   bool empty() const
+   {
+      return m_size == 0;
+   }
+
+   /**
+    * @brief Like std::vector::reserve, but non throwing.
+    *
+    * @param capacity The minimum capacity of the vector.
+    *
+    * @return false iff the operation could not be performed due to an allocation failure, in which case the vector is
+    * not modified.
+    */
+   bool try_reserve(std::size_t capacity) noexcept
+   {
+      if (capacity <= m_capacity)
+      {
+         return true;
+      }
+      if (capacity > SIZE_MAX / sizeof(T))
+      {
+         return false;
+      }
+
+      auto &cb = m_alloc.m_callbacks;
+      void *memory = cb.pfnAllocation(cb.pUserData, capacity * sizeof(T), alignof(T), m_alloc.m_scope);
+      if (memory == nullptr)
+      {
+         return false;
+      }
+
+      T *data = static_cast<T *>(memory);
+      std::copy(m_data, m_data + m_size, data);
+      if (m_data != m_inline_data.data())
+      {
+         cb.pfnFree(cb.pUserData, m_data);
+      }
+      m_data = data;
+      m_capacity = capacity;
+      return true;
+   }
+
+   /**
+    * @brief Like std::vector::resize, but non throwing.
+    *
+    * New elements are value initialized.
+    *
+    * @return false iff the operation could not be performed due to an allocation failure, in which case the vector is
+    * not modified.
+    */
+   bool try_resize(std::size_t size) noexcept
+   {
+      if (size > m_capacity && !try_reserve(std::max(size, grown_capacity())))
+      {
+         return false;
+      }
+
+      std::fill(m_data + std::min(m_size, size), m_data + size, T{});
+      m_size = size;
+      return true;
+   }
+
+   /**
+    * @brief Like std::vector::push_back, but non throwing.
+    *
+    * @return false iff the operation could not be performed due to an allocation failure.
+    */
+   bool try_push_back(const T &value) noexcept
+   {
+      if (m_size == m_capacity)
+      {
+         /* Copy first, as value may be an element of the vector. */
+         const T copy = value;
+         if (!try_reserve(grown_capacity()))
+         {
+            return false;
+         }
+         m_data[m_size++] = copy;
+         return true;
+      }
+
+      m_data[m_size++] = value;
+      return true;
+   }
+
+   /**
+    * @brief Push back multiple elements at once.
+    *
+    * @return false iff the operation could not be performed due to an allocation failure, in which case the vector is
+    * not modified.
+    */
+   bool try_push_back_many(const T *begin, const T *end) noexcept
+   {
+      const auto count = static_cast<std::size_t>(end - begin);
+      if (m_size + count > m_capacity && !try_reserve(std::max(m_size + count, grown_capacity())))
+      {
+         return false;
+      }
+
+      std::copy(begin, end, m_data + m_size);
+      m_size += count;
+      return true;
+   }
+
+   void pop_back()
+   {
+      assert(m_size > 0);
+      m_size--;
+   }
+
+   /**
+    * @brief Remove all the elements of the vector, keeping its capacity.
+    */
+   void clear()
+   {
+      m_size = 0;
+   }
+
+   T &operator[](std::size_t index)
+   {
+      assert(index < m_size);
+      return m_data[index];
+   }
+
+   const T &operator[](std::size_t index) const
+   {
+      assert(index < m_size);
+      return m_data[index];
+   }
+
+   T *data()
+   {
+      return m_data;
+   }
+
+   const T *data() const
+   {
+      return m_data;
+   }
+
+   iterator begin()
+   {
+      return m_data;
+   }
+
+   iterator end()
+   {
+      return m_data + m_size;
+   }
+
+   const_iterator begin() const
+   {
+      return m_data;
+   }
+
+   const_iterator end() const
+   {
+      return m_data + m_size;
+   }
+
+   /**
+    * @brief Get the allocator used once the elements no longer fit inline.
+    */
+   const allocator &get_allocator() const
+   {
+      return m_alloc;
+   }
+
+private:
+   std::size_t grown_capacity() const
+   {
+      return m_capacity > SIZE_MAX / 2 ? SIZE_MAX : m_capacity * 2;
+   }
+
+   const allocator m_alloc;
+   std::array<T, N> m_inline_data;
+   T *m_data;
+   std::size_t m_size;
+   std::size_t m_capacity;
+};
+
+} /* namespace util */
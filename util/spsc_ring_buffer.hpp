@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file spsc_ring_buffer.hpp
+ *
+ * @brief Contains a lock-free single producer, single consumer ring buffer.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <type_traits>
+
+namespace util
+{
+
+/**
+ * @brief Size used to keep data written by different threads on separate cache lines.
+ */
+static constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+/**
+ * @brief Fixed capacity ring buffer with one producer thread and one consumer thread.
+ *
+ * Unlike @ref ring_buffer this does not need external locking as long as only one thread calls push_back() and only
+ * one thread calls pop_front() at any time. The head and tail indices are kept on separate cache lines so that the
+ * producer and the consumer do not contend on the same line.
+ *
+ * @tparam T Type of the items, which must be trivially copyable.
+ * @tparam N Capacity of the ring buffer.
+ */
+template <typename T, std::size_t N>
+class spsc_ring_buffer
+{
+   static_assert(std::is_trivially_copyable<T>::value, "spsc_ring_buffer items must be trivially copyable");
+
+public:
+   /**
+    * @brief Return maximum capacity of the ring buffer.
+    */
+   constexpr std::size_t capacity() const
+   {
+      return N;
+   }
+
+   /**
+    * @brief Return current size of the ring buffer.
+    *
+    * The value may already be out of date when it is returned if the other thread is using the buffer.
+    */
+   std::size_t size() const
+   {
+      return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+   }
+
+   /**
+    * @brief Places item into next slot of the ring buffer. Must only be called by the producer thread.
+    * @return Boolean to indicate success or failure.
+    */
+   bool push_back(const T &item)
+   {
+      const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+      if (tail - m_head.load(std::memory_order_acquire) == N)
+      {
+         return false;
+      }
+
+      m_data[tail % N] = item;
+      m_tail.store(tail + 1, std::memory_order_release);
+
+      return true;
+   }
+
+   /**
+    * @brief Peek the front of the ring buffer without popping it. Must only be called by the consumer thread.
+    *
+    * The item stays valid until it is popped, as the producer does not reuse its slot before then.
+    *
+    * @return Pointer to the front item, or nullptr if the ring buffer is empty.
+    */
+   const T *front() const
+   {
+      const std::size_t head = m_head.load(std::memory_order_relaxed);
+      if (head == m_tail.load(std::memory_order_acquire))
+      {
+         return nullptr;
+      }
+
+      return &m_data[head % N];
+   }
+
+   /**
+    * @brief Pop the front of the ring buffer. Must only be called by the consumer thread.
+    *
+    * @return Item wrapped in an optional, or std::nullopt if the ring buffer is empty.
+    */
+   std::optional<T> pop_front()
+   {
+      const std::size_t head = m_head.load(std::memory_order_relaxed);
+      if (head == m_tail.load(std::memory_order_acquire))
+      {
+         return std::nullopt;
+      }
+
+      T value = m_data[head % N];
+      m_head.store(head + 1, std::memory_order_release);
+
+      return value;
+   }
+
+private:
+   std::array<T, N> m_data{};
+
+   /* Index of the next item to pop, only written by the consumer. */
+   std::atomic<std::size_t> m_head{ 0 };
+
+   /* Padding rather than alignas, as the layer allocators do not honour extended alignments. Placing the indices a
+    * full cache line apart is enough to keep them on different lines. */
+   char m_padding[CACHE_LINE_SIZE - sizeof(std::atomic<std::size_t>)];
+
+   /* Index of the next slot to fill, only written by the producer. */
+   std::atomic<std::size_t> m_tail{ 0 };
+};
+
+} /* namespace util */
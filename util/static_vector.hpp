@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file static_vector.hpp
+ *
+ * @brief Contains a vector with a fixed capacity whose elements are stored inline.
+ */
+
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+
+namespace util
+{
+
+/**
+ * @brief Vector with a compile time capacity, storing its elements inside the object rather than on the heap.
+ *
+ * Elements beyond the current size are kept value initialized, so resizing never allocates and cannot fail for sizes
+ * up to the capacity.
+ *
+ * @tparam T Type of the elements, which must be trivially copyable.
+ * @tparam N Capacity of the vector.
+ */
+template <typename T, std::size_t N>
+class static_vector
+{
+   static_assert(std::is_trivially_copyable<T>::value, "static_vector elements must be trivially copyable");
+
+public:
+   using iterator = T *;
+   using const_iterator = const T *;
+
+   /**
+    * @brief Return the maximum number of elements of the vector.
+    */
+   constexpr std::size_t capacity() const
+   {
+      return N;
+   }
+
+   std::size_t size() const
+   {
+      return m_size;
+   }
+
+   bool empty() const
+   {
+      return m_size == 0;
+   }
+
+   /**
+    * @brief Change the number of elements of the vector.
+    *
+    * New elements are value initialized.
+    *
+    * @param size The new number of elements.
+    *
+    * @return false if @p size exceeds the capacity, in which case the vector is not modified.
+    */
+   bool try_resize(std::size_t size)
+   {
+      if (size > N)
+      {
+         return false;
+      }
+
+      for (std::size_t i = m_size; i < size; i++)
+      {
+         m_data[i] = T{};
+      }
+      m_size = size;
+      return true;
+   }
+
+   /**
+    * @brief Remove all the elements of the vector.
+    */
+   void clear()
+   {
+      m_size = 0;
+   }
+
+   T &operator[](std::size_t index)
+   {
+      assert(index < m_size);
+      return m_data[index];
+   }
+
+   const T &operator[](std::size_t index) const
+   {
+      assert(index < m_size);
+      return m_data[index];
+   }
+
+   T *data()
+   {
+      return m_data.data();
+   }
+
+   const T *data() const
+   {
+      return m_data.data();
+   }
+
+   iterator begin()
+   {
+      return m_data.data();
+   }
+
+   iterator end()
+   {
+      return m_data.data() + m_size;
+   }
+
+   const_iterator begin() const
+   {
+      return m_data.data();
+   }
+
+   const_iterator end() const
+   {
+      return m_data.data() + m_size;
+   }
+
+private:
+   std::array<T, N> m_data{};
+   std::size_t m_size{ 0 };
+};
+
+} /* namespace util */
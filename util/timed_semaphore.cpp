@@ -24,147 +24,149 @@
 
 #include <cassert>
 #include <cerrno>
+#include <ctime>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "timed_semaphore.hpp"
 
 namespace util
 {
 
-VkResult timed_semaphore::init(unsigned count)
+static constexpr uint64_t NSEC_PER_SEC = 1000 * 1000 * 1000;
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && std::atomic<uint32_t>::is_always_lock_free,
+              "std::atomic<uint32_t> cannot be used as a futex word");
+
+static long futex(std::atomic<uint32_t> *word, int op, uint32_t val, const struct timespec *timeout, uint32_t val3)
 {
-   int res;
+   return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), op, val, timeout, nullptr, val3);
+}
 
-   m_count = count;
+uint64_t get_monotonic_time_ns()
+{
+   struct timespec now = {};
+   int res = clock_gettime(CLOCK_MONOTONIC, &now);
+   assert(res == 0); /* only fails with programming error (EINVAL, EFAULT, EPERM) */
+   (void)res;
 
-   pthread_condattr_t attr;
-   res = pthread_condattr_init(&attr);
-   /* the only failure that can occur is ENOMEM */
-   assert(res == 0 || res == ENOMEM);
-   if (res != 0)
+   return static_cast<uint64_t>(now.tv_sec) * NSEC_PER_SEC + static_cast<uint64_t>(now.tv_nsec);
+}
+
+uint64_t timeout_to_deadline(uint64_t timeout)
+{
+   if (timeout == UINT64_MAX)
    {
-      return VK_ERROR_OUT_OF_HOST_MEMORY;
+      return UINT64_MAX;
    }
 
-   res = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
-   /* only programming error can cause _setclock to fail */
-   assert(res == 0);
+   const uint64_t now = get_monotonic_time_ns();
+   /* Saturate instead of overflowing for very long timeouts. */
+   return timeout >= UINT64_MAX - now ? UINT64_MAX : now + timeout;
+}
 
-   res = pthread_cond_init(&m_cond, &attr);
-   /* the only failure that can occur that is not programming error is ENOMEM */
-   assert(res == 0 || res == ENOMEM);
-   if (res != 0)
+uint64_t deadline_to_timeout(uint64_t deadline)
+{
+   if (deadline == UINT64_MAX)
    {
-      res = pthread_condattr_destroy(&attr);
-      assert(res == 0);
-      return VK_ERROR_OUT_OF_HOST_MEMORY;
+      return UINT64_MAX;
    }
 
-   res = pthread_condattr_destroy(&attr);
-   /* only programming error can cause _destroy to fail */
-   assert(res == 0);
-
-   res = pthread_mutex_init(&m_mutex, nullptr);
-   /* only programming errors can result in failure */
-   assert(res == 0);
+   const uint64_t now = get_monotonic_time_ns();
+   return deadline > now ? deadline - now : 0;
+}
 
+VkResult timed_semaphore::init(unsigned count)
+{
+   m_count.store(count, std::memory_order_relaxed);
+   m_waiters.store(0, std::memory_order_relaxed);
    initialized = true;
 
    return VK_SUCCESS;
 }
 
-timed_semaphore::~timed_semaphore()
+bool timed_semaphore::try_decrement()
 {
-   int res;
-   (void)res; /* unused when NDEBUG */
-
-   if (initialized)
+   uint32_t count = m_count.load(std::memory_order_relaxed);
+   while (count > 0)
    {
-      res = pthread_cond_destroy(&m_cond);
-      assert(res == 0); /* only programming error (EBUSY, EINVAL) */
-
-      res = pthread_mutex_destroy(&m_mutex);
-      assert(res == 0); /* only programming error (EBUSY, EINVAL) */
+      if (m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire, std::memory_order_relaxed))
+      {
+         return true;
+      }
    }
+
+   return false;
 }
 
 VkResult timed_semaphore::wait(uint64_t timeout)
 {
-   VkResult retval = VK_SUCCESS;
-   int res;
-
    assert(initialized);
 
-   res = pthread_mutex_lock(&m_mutex);
-   assert(res == 0); /* only fails with programming error (EINVAL) */
+   if (try_decrement())
+   {
+      return VK_SUCCESS;
+   }
+   else if (timeout == 0)
+   {
+      return VK_NOT_READY;
+   }
+
+   return wait_until(timeout_to_deadline(timeout));
+}
 
-   if (m_count == 0)
+VkResult timed_semaphore::wait_until(uint64_t deadline)
+{
+   assert(initialized);
+
+   while (!try_decrement())
    {
-      switch (timeout)
+      struct timespec end = {};
+      const struct timespec *end_ptr = nullptr;
+      if (deadline != UINT64_MAX)
       {
-      case 0:
-         retval = VK_NOT_READY;
-         break;
-      case UINT64_MAX:
-         res = pthread_cond_wait(&m_cond, &m_mutex);
-         assert(res == 0); /* only fails with programming error (EINVAL) */
-
-         break;
-      default:
-         struct timespec diff = { /* narrowing casts */
-                                  static_cast<time_t>(timeout / (1000 * 1000 * 1000)),
-                                  static_cast<long>(timeout % (1000 * 1000 * 1000))
-         };
-
-         struct timespec now = {};
-         res = clock_gettime(CLOCK_MONOTONIC, &now);
-         assert(res == 0); /* only fails with programming error (EINVAL, EFAULT, EPERM) */
-
-         /* add diff to now, handling overflow */
-         struct timespec end = { now.tv_sec + diff.tv_sec, now.tv_nsec + diff.tv_nsec };
-
-         if (end.tv_nsec >= 1000 * 1000 * 1000)
+         if (get_monotonic_time_ns() >= deadline)
          {
-            end.tv_nsec -= 1000 * 1000 * 1000;
-            end.tv_sec++;
+            return VK_TIMEOUT;
          }
 
-         res = pthread_cond_timedwait(&m_cond, &m_mutex, &end);
-         /* only fails with programming error, other than timeout */
-         assert(res == 0 || res == ETIMEDOUT);
-         if (res != 0)
-         {
-            retval = VK_TIMEOUT;
-         }
+         /* FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout, so retries do not extend the wait. */
+         end.tv_sec = static_cast<time_t>(deadline / NSEC_PER_SEC);
+         end.tv_nsec = static_cast<long>(deadline % NSEC_PER_SEC);
+         end_ptr = &end;
+      }
+
+      /* The waiter count is published before sleeping. Either post() observes it and wakes us, or the kernel observes
+       * the incremented count and returns immediately, so no wake up is lost. */
+      m_waiters.fetch_add(1, std::memory_order_seq_cst);
+      long res = futex(&m_count, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, 0, end_ptr, FUTEX_BITSET_MATCH_ANY);
+      int error = errno;
+      m_waiters.fetch_sub(1, std::memory_order_relaxed);
+
+      /* EAGAIN (the count changed before sleeping) and EINTR simply retry. */
+      assert(res == 0 || error == EAGAIN || error == EINTR || error == ETIMEDOUT);
+      if (res != 0 && error == ETIMEDOUT)
+      {
+         return try_decrement() ? VK_SUCCESS : VK_TIMEOUT;
       }
    }
-   if (retval == VK_SUCCESS)
-   {
-      assert(m_count > 0);
-      m_count--;
-   }
-   res = pthread_mutex_unlock(&m_mutex);
-   assert(res == 0); /* only fails with programming error (EPERM) */
 
-   return retval;
+   return VK_SUCCESS;
 }
 
 void timed_semaphore::post()
 {
-   int res;
-   (void)res; /* unused when NDEBUG */
-
    assert(initialized);
 
-   res = pthread_mutex_lock(&m_mutex);
-   assert(res == 0); /* only fails with programming error (EINVAL) */
-
-   m_count++;
-
-   res = pthread_cond_signal(&m_cond);
-   assert(res == 0); /* only fails with programming error (EINVAL) */
+   m_count.fetch_add(1, std::memory_order_seq_cst);
 
-   res = pthread_mutex_unlock(&m_mutex);
-   assert(res == 0); /* only fails with programming error (EPERM) */
+   /* Only enter the kernel if a thread is blocked, or about to block, on the futex. */
+   if (m_waiters.load(std::memory_order_seq_cst) > 0)
+   {
+      futex(&m_count, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, 1, nullptr, 0);
+   }
 }
 
 } /* namespace util */
@@ -25,23 +25,23 @@
 /**
  * @file timed_semaphore.hpp
  *
- * @brief Contains the class definition for a semaphore with a relative timedwait
+ * @brief Contains the class definition for a semaphore with relative and absolute timed waits
  *
  * sem_timedwait takes an absolute time, based on CLOCK_REALTIME. Simply
  * taking the current time and adding on a relative timeout is not correct,
  * as the system time may change, resulting in an incorrect timeout period
  * (potentially by a significant amount).
  *
- * We therefore have to re-engineer semaphores using condition variables.
+ * We therefore implement the semaphore on top of a futex, which can wait on
+ * an absolute CLOCK_MONOTONIC deadline.
  *
- * This code does not use the C++ standard library to avoid exceptions.
+ * This code does not use the C++ standard library, except for atomics, to avoid exceptions.
  */
 
 #pragma once
 
-extern "C" {
-#include <pthread.h>
-}
+#include <atomic>
+#include <cstdint>
 
 #include <vulkan/vulkan.h>
 #include "helpers.hpp"
@@ -50,29 +50,48 @@ namespace util
 {
 
 /**
- * brief semaphore with a safe relative timed wait
+ * @brief Get the current time of CLOCK_MONOTONIC.
  *
- * sem_timedwait takes an absolute time, based on CLOCK_REALTIME. Simply
- * taking the current time and adding on a relative timeout is not correct,
- * as the system time may change, resulting in an incorrect timeout period
- * (potentially by a significant amount).
+ * @return The current time in nanoseconds.
+ */
+uint64_t get_monotonic_time_ns();
+
+/**
+ * @brief Convert a relative timeout to an absolute CLOCK_MONOTONIC deadline.
  *
- * We therefore have to re-engineer semaphores using condition variables.
+ * @param timeout Relative timeout in nanoseconds. UINT64_MAX means no timeout.
+ * @return The deadline in nanoseconds, or UINT64_MAX if there is no deadline.
+ */
+uint64_t timeout_to_deadline(uint64_t timeout);
+
+/**
+ * @brief Convert an absolute CLOCK_MONOTONIC deadline to the relative timeout left until it expires.
  *
- * This code does not use the C++ standard library to avoid exceptions.
+ * @param deadline The deadline in nanoseconds, or UINT64_MAX if there is no deadline.
+ * @return The time left in nanoseconds, 0 if the deadline has passed or UINT64_MAX if there is no deadline.
+ */
+uint64_t deadline_to_timeout(uint64_t deadline);
+
+/**
+ * brief semaphore with a safe relative timed wait
+ *
+ * The count is kept in an atomic which doubles as a futex word. Posting and waiting on a semaphore with a non-zero
+ * count never enters the kernel, and post() only issues a wake up when a thread is actually blocked.
+ *
+ * Timed waits are based on CLOCK_MONOTONIC absolute deadlines so that retries do not extend the overall wait.
  */
 class timed_semaphore : private noncopyable
 {
 public:
-   ~timed_semaphore();
    timed_semaphore()
-      : initialized(false){};
+      : initialized(false)
+      , m_count(0)
+      , m_waiters(0){};
 
    /**
     * @brief initializes the semaphore
     *
     * @param count initial value of the semaphore
-    * @retval VK_ERROR_OUT_OF_HOST_MEMORY out of memory condition from pthread calls
     * @retval VK_SUCCESS on success
     */
    VkResult init(unsigned count);
@@ -87,6 +106,15 @@ public:
     */
    VkResult wait(uint64_t timeout);
 
+   /**
+    * @brief decrement semaphore, waiting until an absolute deadline if the value is 0
+    *
+    * @param deadline CLOCK_MONOTONIC deadline (ns), see @ref timeout_to_deadline. UINT64_MAX waits indefinately.
+    * @retval VK_TIMEOUT the deadline was reached
+    * @retval VK_SUCCESS on success
+    */
+   VkResult wait_until(uint64_t deadline);
+
    /**
     * @brief increment semaphore, potentially unblocking a waiting thread
     */
@@ -94,18 +122,25 @@ public:
 
 private:
    /**
-    * @brief true if the semaphore has been initialized
+    * @brief Decrement the count if it is not 0, without blocking.
     *
-    * Determines if the destructor should cleanup the mutex and cond.
+    * @return true if the count was decremented.
+    */
+   bool try_decrement();
+
+   /**
+    * @brief true if the semaphore has been initialized
     */
    bool initialized;
    /**
-    * @brief semaphore value
+    * @brief semaphore value, also used as the futex word.
     */
-   unsigned m_count;
+   std::atomic<uint32_t> m_count;
 
-   pthread_mutex_t m_mutex;
-   pthread_cond_t m_cond;
+   /**
+    * @brief Number of threads that are about to block or are blocked on the futex.
+    */
+   std::atomic<uint32_t> m_waiters;
 };
 
 } /* namespace util */
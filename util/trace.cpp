@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trace.hpp"
+
+namespace util
+{
+namespace trace
+{
+
+/* Longest event written, longer events are truncated. */
+static constexpr size_t TRACE_EVENT_SIZE = 256;
+
+struct trace_marker
+{
+   int fd{ -1 };
+   pid_t pid{ 0 };
+
+   trace_marker()
+   {
+      if (!WSI_TRACE_EVENTS_ENABLED)
+      {
+         return;
+      }
+
+      /* tracefs is mounted on its own in recent kernels, and under debugfs in older ones. */
+      static const char *const paths[] = { "/sys/kernel/tracing/trace_marker",
+                                           "/sys/kernel/debug/tracing/trace_marker" };
+      for (const char *path : paths)
+      {
+         fd = open(path, O_WRONLY | O_CLOEXEC);
+         if (fd >= 0)
+         {
+            break;
+         }
+      }
+      pid = getpid();
+   }
+
+   ~trace_marker()
+   {
+      if (fd >= 0)
+      {
+         close(fd);
+      }
+   }
+};
+
+static const trace_marker &get_trace_marker()
+{
+   static trace_marker marker;
+   return marker;
+}
+
+bool is_enabled()
+{
+   return get_trace_marker().fd >= 0;
+}
+
+/**
+ * @brief Write an event made of a prefix, a formatted name and an optional suffix with a single write.
+ */
+static void write_event(char phase, const char *format, std::va_list args, const uint64_t *cookie)
+{
+   const trace_marker &marker = get_trace_marker();
+   if (marker.fd < 0)
+   {
+      return;
+   }
+
+   char buffer[TRACE_EVENT_SIZE];
+   const size_t max_length = sizeof(buffer) - 1;
+   int res = std::snprintf(buffer, sizeof(buffer), "%c|%d|", phase, static_cast<int>(marker.pid));
+   size_t length = res > 0 ? std::min(static_cast<size_t>(res), max_length) : 0;
+   if (format != nullptr)
+   {
+      res = std::vsnprintf(buffer + length, sizeof(buffer) - length, format, args);
+      length = res > 0 ? std::min(length + static_cast<size_t>(res), max_length) : length;
+   }
+   if (cookie != nullptr)
+   {
+      res = std::snprintf(buffer + length, sizeof(buffer) - length, "|%" PRIu64, *cookie);
+      length = res > 0 ? std::min(length + static_cast<size_t>(res), max_length) : length;
+   }
+
+   /* Each write to trace_marker is a single event, a failed write only loses the event. */
+   ssize_t written = write(marker.fd, buffer, length);
+   (void)written;
+}
+
+void begin_slice(const char *format, ...)
+{
+   std::va_list args;
+   va_start(args, format);
+   write_event('B', format, args, nullptr);
+   va_end(args);
+}
+
+void end_slice()
+{
+   std::va_list args{};
+   write_event('E', nullptr, args, nullptr);
+}
+
+void begin_async(uint64_t cookie, const char *format, ...)
+{
+   std::va_list args;
+   va_start(args, format);
+   write_event('S', format, args, &cookie);
+   va_end(args);
+}
+
+void end_async(uint64_t cookie, const char *format, ...)
+{
+   std::va_list args;
+   va_start(args, format);
+   write_event('F', format, args, &cookie);
+   va_end(args);
+}
+
+void instant(const char *format, ...)
+{
+   std::va_list args;
+   va_start(args, format);
+   write_event('I', format, args, nullptr);
+   va_end(args);
+}
+
+} /* namespace trace */
+} /* namespace util */
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file trace.hpp
+ *
+ * @brief Contains functions to emit trace events of the frame lifecycle to the ftrace trace_marker.
+ *
+ * Events use the atrace format, which Perfetto and systrace import as slices on the thread tracks of the process, so
+ * that they can be lined up with the GPU and DRM kernel tracks of the same trace. Trace events are only compiled in
+ * when WSI_TRACE_EVENTS_ENABLED is set, and only written while the trace_marker file can be opened.
+ */
+
+#pragma once
+
+#include <cinttypes>
+#include <cstdint>
+
+#include "helpers.hpp"
+
+#ifndef WSI_TRACE_EVENTS_ENABLED
+#define WSI_TRACE_EVENTS_ENABLED 0
+#endif
+
+namespace util
+{
+namespace trace
+{
+
+/**
+ * @brief Check whether trace events are written, i.e. whether the trace_marker file could be opened.
+ */
+bool is_enabled();
+
+/**
+ * @brief Begin a slice on the calling thread, ended by @ref end_slice.
+ */
+void begin_slice(const char *format, ...)
+#ifdef __GNUC__
+   __attribute__((format(printf, 1, 2)))
+#endif
+   ;
+
+/**
+ * @brief End the most recent slice begun on the calling thread.
+ */
+void end_slice();
+
+/**
+ * @brief Begin an asynchronous slice, which may end on another thread.
+ *
+ * @param cookie Identifies the slice among the slices with the same name, an asynchronous slice is ended by the
+ *               @ref end_async call with the same name and cookie.
+ */
+void begin_async(uint64_t cookie, const char *format, ...)
+#ifdef __GNUC__
+   __attribute__((format(printf, 2, 3)))
+#endif
+   ;
+
+/**
+ * @brief End an asynchronous slice begun by @ref begin_async.
+ */
+void end_async(uint64_t cookie, const char *format, ...)
+#ifdef __GNUC__
+   __attribute__((format(printf, 2, 3)))
+#endif
+   ;
+
+/**
+ * @brief Emit an instant event on the calling thread.
+ */
+void instant(const char *format, ...)
+#ifdef __GNUC__
+   __attribute__((format(printf, 1, 2)))
+#endif
+   ;
+
+/**
+ * @brief Slice covering the lifetime of the object.
+ */
+class scoped_slice : private noncopyable
+{
+public:
+   template <typename... arg_types>
+   scoped_slice(const char *format, arg_types... args)
+      : m_active(WSI_TRACE_EVENTS_ENABLED && is_enabled())
+   {
+      if (m_active)
+      {
+         begin_slice(format, args...);
+      }
+   }
+
+   ~scoped_slice()
+   {
+      if (m_active)
+      {
+         end_slice();
+      }
+   }
+
+private:
+   bool m_active;
+};
+
+} /* namespace trace */
+} /* namespace util */
+
+/* The arguments are only evaluated when trace events are written. */
+#define WSI_TRACE_EVENT(function, ...)                                    \
+   do                                                                     \
+   {                                                                      \
+      if (WSI_TRACE_EVENTS_ENABLED && ::util::trace::is_enabled())        \
+         ::util::trace::function(__VA_ARGS__);                            \
+   } while (0)
+
+#define WSI_TRACE_INSTANT(...) WSI_TRACE_EVENT(instant, __VA_ARGS__)
+#define WSI_TRACE_BEGIN_ASYNC(...) WSI_TRACE_EVENT(begin_async, __VA_ARGS__)
+#define WSI_TRACE_END_ASYNC(...) WSI_TRACE_EVENT(end_async, __VA_ARGS__)
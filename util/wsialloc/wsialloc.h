@@ -64,8 +64,11 @@ extern "C" {
  * 2 - Added WSIALLOC_ALLOCATE_HIGHEST_FIXED_RATE_COMPRESSION
  * 3 - Grouped the return values of wsialloc_alloc to wsialloc_allocate_result and added another value for returning
  *     whether or not the allocation will be disjoint.
+ * 4 - Added wsialloc_release and WSIALLOC_ALLOCATE_RECYCLE to reuse the buffers of previous allocations.
+ * 5 - Added wsialloc_alloc_batch to allocate several identical buffers at once.
+ * 6 - Added WSIALLOC_ALLOCATE_SCANOUT and WSIALLOC_ALLOCATE_NO_CPU_READ to select the heap by usage.
  */
-#define WSIALLOC_INTERFACE_VERSION 3
+#define WSIALLOC_INTERFACE_VERSION 6
 
 #define WSIALLOC_CONCAT(x, y) x##y
 #define WSIALLOC_SYMBOL_VERSION(symbol, version) WSIALLOC_CONCAT(symbol, version)
@@ -154,6 +157,14 @@ enum wsialloc_allocate_flag
    WSIALLOC_ALLOCATE_NO_MEMORY = 0x2,
    /** Sets a preference for selecting the format with the highest fixed compression rate. */
    WSIALLOC_ALLOCATE_HIGHEST_FIXED_RATE_COMPRESSION = 0x4,
+   /** Allows reusing a buffer given back with wsialloc_release() instead of allocating a new one. */
+   WSIALLOC_ALLOCATE_RECYCLE = 0x8,
+   /** The buffer may be scanned out directly by the display, so it is allocated from memory the display can access,
+    * e.g. a contiguous heap. Buffers without this flag may come from a heap the display cannot scan out from. */
+   WSIALLOC_ALLOCATE_SCANOUT = 0x10,
+   /** The buffer is not read by the CPU, so it may be allocated uncached (write-combined) to avoid the cost of cache
+    * maintenance when it is accessed by devices. */
+   WSIALLOC_ALLOCATE_NO_CPU_READ = 0x20,
 };
 
 typedef struct wsialloc_format
@@ -229,7 +240,8 @@ typedef struct wsialloc_allocate_result
  * are pointers to storage large enough to hold per-plane information.
  * @pre @p info::width >=1 && @p info::height >= 1
  * @pre @p allocator is a currently valid WSI Allocator from wsialloc_new()
- * @post The allocated buffer will be zeroed.
+ * @post The allocated buffer will be zeroed, unless @p info::flags has WSIALLOC_ALLOCATE_RECYCLE and the buffer was
+ * reused. Reused buffers keep the contents they had when they were released.
  *
  * @param      allocator  The WSI Allocator to allocate from.
  * @param[in]  info       The requested allocation information.
@@ -246,6 +258,46 @@ typedef struct wsialloc_allocate_result
 wsialloc_error wsialloc_alloc(wsialloc_allocator *allocator, const wsialloc_allocate_info *info,
                               wsialloc_allocate_result *result);
 
+/**
+ * @brief Allocate several identical buffers from the WSI Allocator
+ *
+ * Equivalent to @p count calls to wsialloc_alloc() with the same @p info, e.g. for the images of a swapchain, except
+ * that the format is selected and the plane layout is calculated only once. All the results use the same format,
+ * strides and offsets. Each buffer still has its own file descriptors, so buffers can be freed independently.
+ *
+ * @pre @p results points to an array of at least @p count elements.
+ * @pre The preconditions of wsialloc_alloc() hold for each element of @p results.
+ *
+ * @param      allocator The WSI Allocator to allocate from.
+ * @param[in]  info      The requested allocation information, shared by all the buffers.
+ * @param      count     The number of buffers to allocate, must be at least 1.
+ * @param[out] results   The allocations' results.
+ *
+ * @return The errors of wsialloc_alloc(). On failure none of the buffers are allocated.
+ */
+wsialloc_error wsialloc_alloc_batch(wsialloc_allocator *allocator, const wsialloc_allocate_info *info, unsigned count,
+                                    wsialloc_allocate_result *results);
+
+/**
+ * @brief Give the buffer of a previous allocation back to the WSI Allocator.
+ *
+ * Freeing a buffer with this function instead of closing its file descriptors allows the implementation to keep it,
+ * and hand it out again to a later wsialloc_alloc() with WSIALLOC_ALLOCATE_RECYCLE that needs a buffer of similar size.
+ * This avoids new allocations from slow or fragmentation prone memory, e.g. when swapchains are recreated.
+ * Implementations that do not recycle buffers close the file descriptors.
+ *
+ * The client must not use the file descriptors after this call, nor keep other references to the buffer that could
+ * access it while it is reused, as its contents will be overwritten. The same file descriptor can be present more
+ * than once in @p buffer_fds and is only released once. Negative file descriptors are ignored.
+ *
+ * @pre @p allocator is a currently valid WSI Allocator from wsialloc_new()
+ *
+ * @param allocator  The WSI Allocator the buffer was allocated from.
+ * @param flags      The @r wsialloc_allocate_flag flags the buffer was allocated with.
+ * @param buffer_fds Per plane file descriptor of the buffer, as returned in @p result::buffer_fds.
+ */
+void wsialloc_release(wsialloc_allocator *allocator, uint64_t flags, const int buffer_fds[WSIALLOC_MAX_PLANES]);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
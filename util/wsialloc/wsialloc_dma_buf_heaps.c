@@ -28,6 +28,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -43,7 +44,7 @@
  *
  * This should only be increased when this implementation is updated to match newer versions of wsialloc.h.
  */
-#define WSIALLOC_IMPLEMENTATION_VERSION 3
+#define WSIALLOC_IMPLEMENTATION_VERSION 6
 
 /* Ensure we are implementing the wsialloc version matching the wsialloc.h header we are using. */
 #if WSIALLOC_IMPLEMENTATION_VERSION != WSIALLOC_INTERFACE_VERSION
@@ -56,19 +57,233 @@ const uint32_t WSIALLOC_IMPLEMENTATION_VERSION_SYMBOL = WSIALLOC_IMPLEMENTATION_
 #define STR_EXPAND(tok...) #tok
 #define STR(tok) STR_EXPAND(tok)
 
+/* Heaps for buffers that are not scanned out directly, the empty string disables them. */
+#ifndef WSIALLOC_SYSTEM_HEAP_NAME
+#define WSIALLOC_SYSTEM_HEAP_NAME system
+#endif
+
+#ifndef WSIALLOC_UNCACHED_HEAP_NAME
+#define WSIALLOC_UNCACHED_HEAP_NAME system-uncached
+#endif
+
+/* Heap for protected buffers, the empty string disables protected allocations. */
+#ifndef WSIALLOC_PROTECTED_HEAP_NAME
+#define WSIALLOC_PROTECTED_HEAP_NAME
+#endif
+
+enum heap_type
+{
+   /* WSIALLOC_MEMORY_HEAP_NAME, memory accessible to the windowing system (display, compositor, etc.), used for
+    * buffers that may be scanned out and instead of the other heaps when they are not available. */
+   HEAP_SCANOUT,
+   /* Cached memory that the display may not be able to scan out from. */
+   HEAP_SYSTEM,
+   /* Uncached memory that the display may not be able to scan out from. */
+   HEAP_UNCACHED,
+   /* Protected memory accessible to the windowing system. */
+   HEAP_PROTECTED,
+   HEAP_COUNT,
+};
+
 struct wsialloc_allocator
 {
-   /* File descriptor for a DMA-BUF heap for allocating memory accessible to
-    * the windowing system (display, compositor, etc.)
-    */
-   int memory_fd;
+   /* File descriptor of the DMA-BUF heap of each heap type, -1 if the heap is not available. */
+   int heap_fds[HEAP_COUNT];
+};
 
-   /* File descriptor for a DMA-BUF heap for allocating protected memory
-    * accessible to the windowing system.
-    */
-   int protected_fd;
+/**
+ * @brief Select the heap to allocate a buffer from based on its @r wsialloc_allocate_flag flags.
+ *
+ * Contiguous memory is scarce, so it is only used for buffers that may be scanned out. Other buffers prefer uncached
+ * memory when the CPU does not read them, as cached memory adds cache maintenance on device accesses.
+ */
+static enum heap_type select_heap(const wsialloc_allocator *allocator, uint64_t flags)
+{
+   if (flags & WSIALLOC_ALLOCATE_PROTECTED)
+   {
+      return HEAP_PROTECTED;
+   }
+   if (flags & WSIALLOC_ALLOCATE_SCANOUT)
+   {
+      return HEAP_SCANOUT;
+   }
+   if ((flags & WSIALLOC_ALLOCATE_NO_CPU_READ) && allocator->heap_fds[HEAP_UNCACHED] >= 0)
+   {
+      return HEAP_UNCACHED;
+   }
+   if (allocator->heap_fds[HEAP_SYSTEM] >= 0)
+   {
+      return HEAP_SYSTEM;
+   }
+   return HEAP_SCANOUT;
+}
+
+/* Size of the pool of released buffers in MiB, 0 disables recycling. */
+#ifndef WSIALLOC_BUFFER_POOL_SIZE_MB
+#define WSIALLOC_BUFFER_POOL_SIZE_MB 0
+#endif
+
+/* Size of the pool of released protected buffers in MiB, 0 disables their recycling. Protected buffers have a budget
+ * of their own, as they come from a separate and usually much smaller heap. */
+#ifndef WSIALLOC_PROTECTED_BUFFER_POOL_SIZE_MB
+#define WSIALLOC_PROTECTED_BUFFER_POOL_SIZE_MB 0
+#endif
+
+#define BUFFER_POOL_MAX_SIZE ((uint64_t)(WSIALLOC_BUFFER_POOL_SIZE_MB) * 1024 * 1024)
+#define PROTECTED_BUFFER_POOL_MAX_SIZE ((uint64_t)(WSIALLOC_PROTECTED_BUFFER_POOL_SIZE_MB) * 1024 * 1024)
+#define BUFFER_POOL_MAX_BUFFERS 32
+
+/* Buffers of each class count against a budget of their own. */
+enum buffer_class
+{
+   BUFFER_CLASS_UNPROTECTED,
+   BUFFER_CLASS_PROTECTED,
+   BUFFER_CLASS_COUNT,
 };
 
+static enum buffer_class get_buffer_class(enum heap_type heap)
+{
+   return heap == HEAP_PROTECTED ? BUFFER_CLASS_PROTECTED : BUFFER_CLASS_UNPROTECTED;
+}
+
+static uint64_t get_buffer_pool_max_size(enum buffer_class buffer_class)
+{
+   return buffer_class == BUFFER_CLASS_PROTECTED ? PROTECTED_BUFFER_POOL_MAX_SIZE : BUFFER_POOL_MAX_SIZE;
+}
+
+struct pooled_buffer
+{
+   int fd;
+   uint64_t size;
+   enum heap_type heap;
+};
+
+/* Released buffers, shared by all allocators so that they outlive the swapchain that released them. Buffers are
+ * kept oldest first and the oldest ones are closed when the pool is full. The pool is emptied when the last allocator
+ * is deleted. */
+static struct
+{
+   pthread_mutex_t mutex;
+   struct pooled_buffer buffers[BUFFER_POOL_MAX_BUFFERS];
+   unsigned count;
+   /* Total size of the buffers of each class, kept up to date so that no buffer is probed to enforce the budgets. */
+   uint64_t sizes[BUFFER_CLASS_COUNT];
+   unsigned allocator_count;
+} buffer_pool = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+/* Must be called with the pool mutex held. */
+static void buffer_pool_remove(unsigned index)
+{
+   assert(index < buffer_pool.count);
+   buffer_pool.sizes[get_buffer_class(buffer_pool.buffers[index].heap)] -= buffer_pool.buffers[index].size;
+   for (unsigned i = index + 1; i < buffer_pool.count; i++)
+   {
+      buffer_pool.buffers[i - 1] = buffer_pool.buffers[i];
+   }
+   buffer_pool.count--;
+}
+
+/* Must be called with the pool mutex held. */
+static void buffer_pool_clear(void)
+{
+   for (unsigned i = 0; i < buffer_pool.count; i++)
+   {
+      close(buffer_pool.buffers[i].fd);
+   }
+   buffer_pool.count = 0;
+   for (int buffer_class = 0; buffer_class < BUFFER_CLASS_COUNT; buffer_class++)
+   {
+      buffer_pool.sizes[buffer_class] = 0;
+   }
+}
+
+/* Must be called with the pool mutex held. */
+static void buffer_pool_drop_oldest(enum buffer_class buffer_class)
+{
+   for (unsigned i = 0; i < buffer_pool.count; i++)
+   {
+      if (get_buffer_class(buffer_pool.buffers[i].heap) == buffer_class)
+      {
+         close(buffer_pool.buffers[i].fd);
+         buffer_pool_remove(i);
+         return;
+      }
+   }
+   assert(false);
+}
+
+/**
+ * @brief Take a buffer of at least @p size bytes out of the pool.
+ *
+ * Buffers are bucketed by heap and by size: a buffer matches if it wastes at most an eighth of its size, so that
+ * small changes such as a different stride alignment can still reuse it.
+ *
+ * @return The file descriptor of the buffer or -1 if none matches.
+ */
+static int buffer_pool_take(uint64_t size, enum heap_type heap)
+{
+   int fd = -1;
+   pthread_mutex_lock(&buffer_pool.mutex);
+
+   /* Search newest first, those are the most likely to match the current swapchain size. */
+   for (unsigned i = buffer_pool.count; i > 0; i--)
+   {
+      const struct pooled_buffer *buffer = &buffer_pool.buffers[i - 1];
+      if (buffer->heap == heap && buffer->size >= size && buffer->size - size <= buffer->size / 8)
+      {
+         fd = buffer->fd;
+         buffer_pool_remove(i - 1);
+         break;
+      }
+   }
+
+   pthread_mutex_unlock(&buffer_pool.mutex);
+   return fd;
+}
+
+/**
+ * @brief Give a buffer to the pool, which takes ownership of @p fd.
+ */
+static void buffer_pool_give(int fd, enum heap_type heap)
+{
+   const enum buffer_class buffer_class = get_buffer_class(heap);
+   const uint64_t max_size = get_buffer_pool_max_size(buffer_class);
+   const off_t size = lseek(fd, 0, SEEK_END);
+   if (size <= 0 || (uint64_t)size > max_size)
+   {
+      close(fd);
+      return;
+   }
+
+   pthread_mutex_lock(&buffer_pool.mutex);
+
+   /* Without live allocators there is no one left to reuse the buffer. */
+   if (buffer_pool.allocator_count == 0)
+   {
+      pthread_mutex_unlock(&buffer_pool.mutex);
+      close(fd);
+      return;
+   }
+
+   /* Keep the buffers of the class under their high-water mark by dropping the oldest ones, so that buffers of one
+    * class never push out those of the other. */
+   while (buffer_pool.sizes[buffer_class] + (uint64_t)size > max_size)
+   {
+      buffer_pool_drop_oldest(buffer_class);
+   }
+   if (buffer_pool.count == BUFFER_POOL_MAX_BUFFERS)
+   {
+      close(buffer_pool.buffers[0].fd);
+      buffer_pool_remove(0);
+   }
+
+   buffer_pool.buffers[buffer_pool.count] = (struct pooled_buffer){ fd, (uint64_t)size, heap };
+   buffer_pool.count++;
+   buffer_pool.sizes[buffer_class] += (uint64_t)size;
+
+   pthread_mutex_unlock(&buffer_pool.mutex);
+}
+
 static int allocate(int fd, uint64_t size)
 {
    assert(size > 0);
@@ -96,20 +311,46 @@ static int dma_allocate(const wsialloc_allocator *allocator, const wsialloc_allo
 
    /* The only error that can be encountered on allocations is lack of resources. Other parameter validation and
     * support checks are done on format selection. */
-   int alloc_fd = allocator->memory_fd;
-   if (info->flags & WSIALLOC_ALLOCATE_PROTECTED)
-   {
-      alloc_fd = allocator->protected_fd;
-   }
+   const enum heap_type heap = select_heap(allocator, info->flags);
+   int alloc_fd = allocator->heap_fds[heap];
    if (alloc_fd < 0)
    {
       assert(false);
       return -1;
    }
 
+   if (info->flags & WSIALLOC_ALLOCATE_RECYCLE)
+   {
+      const int pooled_fd = buffer_pool_take(size, heap);
+      if (pooled_fd >= 0)
+      {
+         return pooled_fd;
+      }
+   }
+
    return allocate(alloc_fd, size);
 }
 
+static void close_fd(int fd)
+{
+   if (fd >= 0)
+   {
+      close(fd);
+   }
+}
+
+/* Close the heaps and free the allocator, without touching the buffer pool. */
+static void wsialloc_delete_heaps(wsialloc_allocator *allocator)
+{
+   for (int heap = 0; heap < HEAP_COUNT; heap++)
+   {
+      close_fd(allocator->heap_fds[heap]);
+      allocator->heap_fds[heap] = -1;
+   }
+
+   free(allocator);
+}
+
 wsialloc_error wsialloc_new(wsialloc_allocator **allocator)
 {
    assert(allocator != NULL);
@@ -120,27 +361,27 @@ wsialloc_error wsialloc_new(wsialloc_allocator **allocator)
       return WSIALLOC_ERROR_NO_RESOURCE;
    }
 
-   dma_buf_heaps->memory_fd = open("/dev/dma_heap/" STR(WSIALLOC_MEMORY_HEAP_NAME), O_RDWR);
-   dma_buf_heaps->protected_fd = -1;
+   dma_buf_heaps->heap_fds[HEAP_SCANOUT] = open("/dev/dma_heap/" STR(WSIALLOC_MEMORY_HEAP_NAME), O_RDWR | O_CLOEXEC);
+   dma_buf_heaps->heap_fds[HEAP_SYSTEM] = open("/dev/dma_heap/" STR(WSIALLOC_SYSTEM_HEAP_NAME), O_RDWR | O_CLOEXEC);
+   dma_buf_heaps->heap_fds[HEAP_UNCACHED] =
+      open("/dev/dma_heap/" STR(WSIALLOC_UNCACHED_HEAP_NAME), O_RDWR | O_CLOEXEC);
+   dma_buf_heaps->heap_fds[HEAP_PROTECTED] =
+      open("/dev/dma_heap/" STR(WSIALLOC_PROTECTED_HEAP_NAME), O_RDWR | O_CLOEXEC);
 
-   if (dma_buf_heaps->memory_fd < 0)
+   if (dma_buf_heaps->heap_fds[HEAP_SCANOUT] < 0)
    {
-      free(dma_buf_heaps);
+      wsialloc_delete_heaps(dma_buf_heaps);
       return WSIALLOC_ERROR_NO_RESOURCE;
    }
 
+   pthread_mutex_lock(&buffer_pool.mutex);
+   buffer_pool.allocator_count++;
+   pthread_mutex_unlock(&buffer_pool.mutex);
+
    *allocator = dma_buf_heaps;
    return WSIALLOC_ERROR_NONE;
 }
 
-static void close_fd(int fd)
-{
-   if (fd >= 0)
-   {
-      close(fd);
-   }
-}
-
 void wsialloc_delete(wsialloc_allocator *allocator)
 {
    assert(allocator != NULL);
@@ -149,26 +390,57 @@ void wsialloc_delete(wsialloc_allocator *allocator)
       return;
    }
 
-   close_fd(allocator->memory_fd);
-   close_fd(allocator->protected_fd);
-
-   allocator->memory_fd = -1;
-   allocator->protected_fd = -1;
+   wsialloc_delete_heaps(allocator);
 
-   free(allocator);
+   pthread_mutex_lock(&buffer_pool.mutex);
+   assert(buffer_pool.allocator_count > 0);
+   buffer_pool.allocator_count--;
+   if (buffer_pool.allocator_count == 0)
+   {
+      buffer_pool_clear();
+   }
+   pthread_mutex_unlock(&buffer_pool.mutex);
 }
 
 wsialloc_error wsialloc_alloc(wsialloc_allocator *allocator, const wsialloc_allocate_info *info,
                               wsialloc_allocate_result *result)
 {
-   int fd_to_use = allocator->memory_fd;
-   if (info->flags & WSIALLOC_ALLOCATE_PROTECTED)
+   if (allocator->heap_fds[select_heap(allocator, info->flags)] < 0)
    {
-      fd_to_use = allocator->protected_fd;
+      return WSIALLOC_ERROR_NO_RESOURCE;
    }
-   if (fd_to_use < 0)
+   return wsiallocp_alloc(allocator, dma_allocate, info, result);
+}
+
+wsialloc_error wsialloc_alloc_batch(wsialloc_allocator *allocator, const wsialloc_allocate_info *info, unsigned count,
+                                    wsialloc_allocate_result *results)
+{
+   if (allocator->heap_fds[select_heap(allocator, info->flags)] < 0)
    {
       return WSIALLOC_ERROR_NO_RESOURCE;
    }
-   return wsiallocp_alloc(allocator, dma_allocate, info, result);
+   return wsiallocp_alloc_batch(allocator, dma_allocate, info, count, results);
+}
+
+void wsialloc_release(wsialloc_allocator *allocator, uint64_t flags, const int buffer_fds[WSIALLOC_MAX_PLANES])
+{
+   assert(allocator != NULL);
+
+   const enum heap_type heap = select_heap(allocator, flags);
+   for (int plane = 0; plane < WSIALLOC_MAX_PLANES; plane++)
+   {
+      if (!wsiallocp_is_unique_fd(buffer_fds, plane))
+      {
+         continue;
+      }
+
+      if (get_buffer_pool_max_size(get_buffer_class(heap)) > 0)
+      {
+         buffer_pool_give(buffer_fds[plane], heap);
+      }
+      else
+      {
+         close(buffer_fds[plane]);
+      }
+   }
 }
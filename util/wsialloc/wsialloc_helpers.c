@@ -26,6 +26,7 @@
 #include "format_table.h"
 
 #include <assert.h>
+#include <unistd.h>
 
 /** Default alignment */
 #define WSIALLOCP_MIN_ALIGN_SZ (64u)
@@ -133,7 +134,14 @@ static bool validate_parameters(const wsialloc_allocator *allocator, const wsial
 wsialloc_error wsiallocp_alloc(wsialloc_allocator *allocator, wsiallocp_alloc_callback fn_alloc,
                                const wsialloc_allocate_info *info, wsialloc_allocate_result *result)
 {
-   if (!validate_parameters(allocator, info, result))
+   return wsiallocp_alloc_batch(allocator, fn_alloc, info, 1, result);
+}
+
+wsialloc_error wsiallocp_alloc_batch(wsialloc_allocator *allocator, wsiallocp_alloc_callback fn_alloc,
+                                     const wsialloc_allocate_info *info, unsigned count,
+                                     wsialloc_allocate_result *results)
+{
+   if (count == 0 || !validate_parameters(allocator, info, results))
    {
       return WSIALLOC_ERROR_INVALID;
    }
@@ -143,6 +151,7 @@ wsialloc_error wsiallocp_alloc(wsialloc_allocator *allocator, wsiallocp_alloc_ca
    wsialloc_error err = WSIALLOC_ERROR_NONE;
    wsialloc_format_descriptor selected_format_desc = {};
 
+   /* The format and the layout are the same for all the buffers of a batch, so they are only selected once. */
    uint64_t total_size = 0;
    for (size_t i = 0; i < info->format_count; i++)
    {
@@ -171,29 +180,56 @@ wsialloc_error wsiallocp_alloc(wsialloc_allocator *allocator, wsiallocp_alloc_ca
       return err;
    }
 
-   int local_fds[WSIALLOC_MAX_PLANES] = { -1, -1, -1, -1 };
-   if (!(info->flags & WSIALLOC_ALLOCATE_NO_MEMORY))
+   for (unsigned i = 0; i < count; i++)
    {
-      local_fds[0] = fn_alloc(allocator, info, total_size);
-      if (local_fds[0] < 0)
+      wsialloc_allocate_result *result = &results[i];
+      if (!(info->flags & WSIALLOC_ALLOCATE_NO_MEMORY))
       {
-         return WSIALLOC_ERROR_NO_RESOURCE;
+         const int fd = fn_alloc(allocator, info, total_size);
+         if (fd < 0)
+         {
+            /* Free the buffers of the batch allocated so far, the batch either fully succeeds or fails. */
+            for (unsigned allocated = 0; allocated < i; allocated++)
+            {
+               close(results[allocated].buffer_fds[0]);
+            }
+            return WSIALLOC_ERROR_NO_RESOURCE;
+         }
+
+         assert(result->buffer_fds != NULL);
+         result->buffer_fds[0] = fd;
+         for (size_t plane = 1; plane < selected_format_desc.format_spec.nr_planes; plane++)
+         {
+            result->buffer_fds[plane] = result->buffer_fds[0];
+         }
       }
-
-      assert(result->buffer_fds != NULL);
-      result->buffer_fds[0] = local_fds[0];
-      for (size_t plane = 1; plane < selected_format_desc.format_spec.nr_planes; plane++)
+      result->format = selected_format_desc.format;
+      for (size_t plane = 0; plane < selected_format_desc.format_spec.nr_planes; plane++)
       {
-         result->buffer_fds[plane] = result->buffer_fds[0];
+         result->average_row_strides[plane] = local_strides[plane];
+         result->offsets[plane] = local_offsets[plane];
       }
+
+      result->is_disjoint = false;
    }
-   result->format = selected_format_desc.format;
-   for (size_t plane = 0; plane < selected_format_desc.format_spec.nr_planes; plane++)
+
+   return WSIALLOC_ERROR_NONE;
+}
+
+bool wsiallocp_is_unique_fd(const int buffer_fds[WSIALLOC_MAX_PLANES], int plane)
+{
+   assert(plane >= 0 && plane < WSIALLOC_MAX_PLANES);
+   if (buffer_fds[plane] < 0)
    {
-      result->average_row_strides[plane] = local_strides[plane];
-      result->offsets[plane] = local_offsets[plane];
+      return false;
    }
 
-   result->is_disjoint = false;
-   return WSIALLOC_ERROR_NONE;
-}
\ No newline at end of file
+   for (int other = 0; other < plane; other++)
+   {
+      if (buffer_fds[other] == buffer_fds[plane])
+      {
+         return false;
+      }
+   }
+   return true;
+}
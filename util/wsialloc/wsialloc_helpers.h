@@ -49,4 +49,32 @@ typedef int (*wsiallocp_alloc_callback)(const wsialloc_allocator *allocator, con
  *                                               * The allocator does not support allocating with the selected flags
  */
 wsialloc_error wsiallocp_alloc(wsialloc_allocator *allocator, wsiallocp_alloc_callback fn_alloc,
-                               const wsialloc_allocate_info *info, wsialloc_allocate_result *result);
\ No newline at end of file
+                               const wsialloc_allocate_info *info, wsialloc_allocate_result *result);
+
+/**
+ * @brief Allocate several buffers with the same allocation info using the allocator
+ *
+ * Like wsiallocp_alloc(), but the format is selected and the layout is calculated once for all the buffers.
+ *
+ * @param      allocator The wsialloc allocator
+ * @param      fn_alloc  The function that will be called to perform the actual memory allocations
+ * @param      info      The requested allocation info, shared by all the buffers
+ * @param      count     The number of buffers to allocate
+ * @param[out] results   Array of @p count allocation results.
+ * @retval     WSIALLOC_ERROR_NONE on success, otherwise the errors of wsiallocp_alloc(). On failure no buffer is
+ *             allocated.
+ */
+wsialloc_error wsiallocp_alloc_batch(wsialloc_allocator *allocator, wsiallocp_alloc_callback fn_alloc,
+                                     const wsialloc_allocate_info *info, unsigned count,
+                                     wsialloc_allocate_result *results);
+
+/**
+ * @brief Check if a plane holds the first occurrence of a valid file descriptor in a list of buffer planes.
+ *
+ * Planes can share a file descriptor, which must only be released once.
+ *
+ * @param buffer_fds Per plane file descriptors of a buffer.
+ * @param plane      The plane to check.
+ * @return true if the file descriptor of @p plane is valid and is not used by an earlier plane.
+ */
+bool wsiallocp_is_unique_fd(const int buffer_fds[WSIALLOC_MAX_PLANES], int plane);
\ No newline at end of file
@@ -44,7 +44,7 @@
  *
  * This should only be increased when this implementation is updated to match newer versions of wsialloc.h.
  */
-#define WSIALLOC_IMPLEMENTATION_VERSION 3
+#define WSIALLOC_IMPLEMENTATION_VERSION 6
 
 /* Ensure we are implementing the wsialloc version matching the wsialloc.h header we are using. */
 #if WSIALLOC_IMPLEMENTATION_VERSION != WSIALLOC_INTERFACE_VERSION
@@ -57,14 +57,17 @@ struct wsialloc_allocator
 {
    /* File descriptor of /dev/ion. */
    int fd;
-   /* Allocator heap id. */
+   /* Allocator heap id, a contiguous heap used for buffers that may be scanned out. */
    uint32_t alloc_heap_id;
+   /* System heap id for the other buffers, used if system_heap_exists. */
+   uint32_t system_alloc_heap_id;
+   bool system_heap_exists;
    /* Protected allocator heap id */
    uint32_t protected_alloc_heap_id;
    bool protected_heap_exists;
 };
 
-static int find_alloc_heap_id(int fd)
+static int find_alloc_heap_id(int fd, enum ion_heap_type type)
 {
    assert(fd != -1);
 
@@ -83,7 +86,7 @@ static int find_alloc_heap_id(int fd)
    int alloc_heap_id = -1;
    for (uint32_t i = 0; i < query.cnt; ++i)
    {
-      if (ION_HEAP_TYPE_DMA == heaps[i].type)
+      if (type == heaps[i].type)
       {
          alloc_heap_id = heaps[i].heap_id;
          break;
@@ -93,7 +96,7 @@ static int find_alloc_heap_id(int fd)
    return alloc_heap_id;
 }
 
-static int allocate(int fd, size_t size, uint32_t heap_id)
+static int allocate(int fd, size_t size, uint32_t heap_id, uint32_t flags)
 {
    assert(size > 0);
    assert(fd != -1);
@@ -101,7 +104,7 @@ static int allocate(int fd, size_t size, uint32_t heap_id)
    struct ion_allocation_data alloc = {
       .len = size,
       .heap_id_mask = 1u << heap_id,
-      .flags = 0,
+      .flags = flags,
    };
    int ret = ioctl(fd, ION_IOC_ALLOC, &alloc);
    if (ret < 0)
@@ -129,13 +132,17 @@ wsialloc_error wsialloc_new(wsialloc_allocator **allocator)
       return WSIALLOC_ERROR_NO_RESOURCE;
    }
 
-   ion->alloc_heap_id = find_alloc_heap_id(ion->fd);
+   ion->alloc_heap_id = find_alloc_heap_id(ion->fd, ION_HEAP_TYPE_DMA);
    if (ion->alloc_heap_id < 0)
    {
       wsialloc_delete(ion);
       return WSIALLOC_ERROR_NO_RESOURCE;
    }
 
+   const int system_heap_id = find_alloc_heap_id(ion->fd, ION_HEAP_TYPE_SYSTEM);
+   ion->system_heap_exists = system_heap_id >= 0;
+   ion->system_alloc_heap_id = ion->system_heap_exists ? (uint32_t)system_heap_id : 0;
+
    ion->protected_heap_exists = false;
    *allocator = ion;
    return WSIALLOC_ERROR_NONE;
@@ -167,7 +174,20 @@ static int ion_allocate(const wsialloc_allocator *allocator, const wsialloc_allo
 
    /* The only error that can be encountered on allocations is lack of resources. Other parameter validation and
     * support checks are done on format selection. */
+
+   /* Contiguous memory is scarce, so it is only used for buffers that may be scanned out. Buffers the CPU reads are
+    * cached, the others are write-combined to avoid the cost of cache maintenance on device accesses. */
    uint32_t alloc_heap_id = allocator->alloc_heap_id;
+   uint32_t alloc_flags = 0;
+   if (!(info->flags & WSIALLOC_ALLOCATE_SCANOUT) && allocator->system_heap_exists)
+   {
+      alloc_heap_id = allocator->system_alloc_heap_id;
+      if (!(info->flags & WSIALLOC_ALLOCATE_NO_CPU_READ))
+      {
+         alloc_flags = ION_FLAG_CACHED;
+      }
+   }
+
    if (info->flags & WSIALLOC_ALLOCATE_PROTECTED)
    {
       /* Exit if we don't support allocating protected memory. */
@@ -177,9 +197,10 @@ static int ion_allocate(const wsialloc_allocator *allocator, const wsialloc_allo
          return -1;
       }
       alloc_heap_id = allocator->protected_alloc_heap_id;
+      alloc_flags = 0;
    }
 
-   return allocate(allocator->fd, size, alloc_heap_id);
+   return allocate(allocator->fd, size, alloc_heap_id, alloc_flags);
 }
 
 wsialloc_error wsialloc_alloc(wsialloc_allocator *allocator, const wsialloc_allocate_info *info,
@@ -192,3 +213,30 @@ wsialloc_error wsialloc_alloc(wsialloc_allocator *allocator, const wsialloc_allo
 
    return wsiallocp_alloc(allocator, ion_allocate, info, result);
 }
+
+wsialloc_error wsialloc_alloc_batch(wsialloc_allocator *allocator, const wsialloc_allocate_info *info, unsigned count,
+                                    wsialloc_allocate_result *results)
+{
+   if ((info->flags & WSIALLOC_ALLOCATE_PROTECTED) && (!allocator->protected_heap_exists))
+   {
+      return WSIALLOC_ERROR_NO_RESOURCE;
+   }
+
+   return wsiallocp_alloc_batch(allocator, ion_allocate, info, count, results);
+}
+
+void wsialloc_release(wsialloc_allocator *allocator, uint64_t flags, const int buffer_fds[WSIALLOC_MAX_PLANES])
+{
+   assert(allocator != NULL);
+   (void)allocator;
+   (void)flags;
+
+   /* Buffers are not recycled. */
+   for (int plane = 0; plane < WSIALLOC_MAX_PLANES; plane++)
+   {
+      if (wsiallocp_is_unique_fd(buffer_fds, plane))
+      {
+         close(buffer_fds[plane]);
+      }
+   }
+}
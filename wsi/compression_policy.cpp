@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file compression_policy.cpp
+ *
+ * @brief Automatic selection of fixed-rate compression for swapchain images from a memory bandwidth budget.
+ */
+
+#include <cstdlib>
+
+#include "compression_policy.hpp"
+#include "util/log.hpp"
+
+namespace wsi
+{
+
+/**
+ * @brief Layout of the texels of a format, as far as fixed-rate compression is concerned.
+ */
+struct texel_layout
+{
+   /* Number of components, each compressed to the fixed rate. */
+   uint32_t components;
+
+   /* Uncompressed size of a texel in bits. */
+   uint32_t bits;
+};
+
+/**
+ * @brief Get the texel layout of the usual swapchain formats, or { 0, 0 } for other formats.
+ */
+static texel_layout get_texel_layout(VkFormat format)
+{
+   switch (format)
+   {
+   case VK_FORMAT_R8G8B8A8_UNORM:
+   case VK_FORMAT_R8G8B8A8_SRGB:
+   case VK_FORMAT_B8G8R8A8_UNORM:
+   case VK_FORMAT_B8G8R8A8_SRGB:
+   case VK_FORMAT_A8B8G8R8_UNORM_PACK32:
+   case VK_FORMAT_A8B8G8R8_SRGB_PACK32:
+   case VK_FORMAT_A2R10G10B10_UNORM_PACK32:
+   case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+      return { 4, 32 };
+   case VK_FORMAT_R8G8B8_UNORM:
+   case VK_FORMAT_R8G8B8_SRGB:
+   case VK_FORMAT_B8G8R8_UNORM:
+   case VK_FORMAT_B8G8R8_SRGB:
+      return { 3, 24 };
+   case VK_FORMAT_R5G6B5_UNORM_PACK16:
+   case VK_FORMAT_B5G6R5_UNORM_PACK16:
+      return { 3, 16 };
+   case VK_FORMAT_R16G16B16A16_SFLOAT:
+      return { 4, 64 };
+   default:
+      return { 0, 0 };
+   }
+}
+
+uint64_t get_compression_bandwidth_budget()
+{
+   static const uint64_t budget = []() -> uint64_t {
+      const char *env = std::getenv("WSI_COMPRESSION_BANDWIDTH_BUDGET");
+      if (env == nullptr)
+      {
+         return 0;
+      }
+
+      char *end = nullptr;
+      const unsigned long long megabytes = std::strtoull(env, &end, 10);
+      if (end == env || *end != '\0')
+      {
+         WSI_LOG_WARNING("Ignoring invalid WSI_COMPRESSION_BANDWIDTH_BUDGET \"%s\".", env);
+         return 0;
+      }
+      return megabytes * 1000000;
+   }();
+   return budget;
+}
+
+VkImageCompressionFixedRateFlagsEXT select_fixed_compression_rate(VkFormat format, VkExtent2D extent,
+                                                                  uint64_t refresh_interval, uint64_t budget,
+                                                                  VkImageCompressionFixedRateFlagsEXT supported_rates)
+{
+   const texel_layout layout = get_texel_layout(format);
+   if (layout.components == 0 || supported_rates == 0)
+   {
+      return 0;
+   }
+
+   if (refresh_interval == 0)
+   {
+      refresh_interval = DEFAULT_COMPRESSION_REFRESH_INTERVAL;
+   }
+
+   /* Bytes per second for every bit of a texel: each image is written once and read once per refresh. */
+   constexpr uint64_t NSEC_PER_SEC = 1000000000;
+   const uint64_t texels_per_second =
+      static_cast<uint64_t>(extent.width) * extent.height * NSEC_PER_SEC / refresh_interval;
+   const uint64_t bytes_per_texel_bit = 2 * texels_per_second / 8;
+
+   if (budget != 0 && bytes_per_texel_bit * layout.bits <= budget)
+   {
+      return 0;
+   }
+
+   /* VK_IMAGE_COMPRESSION_FIXED_RATE_<n>BPC_BIT_EXT is bit n - 1, so higher bits are less lossy. */
+   VkImageCompressionFixedRateFlagsEXT selected = 0;
+   for (uint32_t bit = 0; bit < 24; bit++)
+   {
+      const VkImageCompressionFixedRateFlagsEXT rate = 1u << bit;
+      const uint32_t bits_per_texel = (bit + 1) * layout.components;
+      if ((supported_rates & rate) == 0 || bits_per_texel >= layout.bits)
+      {
+         continue;
+      }
+
+      if (selected == 0 || budget == 0 || bytes_per_texel_bit * bits_per_texel <= budget)
+      {
+         selected = rate;
+      }
+   }
+
+   return selected;
+}
+
+} /* namespace wsi */
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file compression_policy.hpp
+ *
+ * @brief Automatic selection of fixed-rate compression for swapchain images from a memory bandwidth budget.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vulkan/vulkan.h>
+
+namespace wsi
+{
+
+/**
+ * @brief Refresh interval assumed for surfaces that do not report one yet, in nanoseconds (60 Hz).
+ */
+static constexpr uint64_t DEFAULT_COMPRESSION_REFRESH_INTERVAL = 16666667;
+
+/**
+ * @brief Get the memory bandwidth budget of the presented images.
+ *
+ * Set with the WSI_COMPRESSION_BANDWIDTH_BUDGET environment variable, in megabytes per second, and read once.
+ *
+ * @return The budget in bytes per second, or 0 if no budget is set.
+ */
+uint64_t get_compression_bandwidth_budget();
+
+/**
+ * @brief Select the fixed compression rate of the images of a swapchain.
+ *
+ * Each presented image is assumed to be written once when it is rendered and read once when it is shown. The least
+ * lossy supported rate that keeps this traffic within the budget is selected, or the strongest supported rate when
+ * none does. Without a budget the least lossy supported rate is selected.
+ *
+ * @param format              Format of the images.
+ * @param extent              Size of the images.
+ * @param refresh_interval    Time between presents in nanoseconds, 0 if unknown.
+ * @param budget              Bandwidth budget in bytes per second, 0 for none.
+ * @param supported_rates     Fixed rates the images can be compressed with.
+ *
+ * @return A single VkImageCompressionFixedRateFlagBitsEXT, or 0 if the images are better left uncompressed, because
+ *         they fit in the budget or the format is unknown.
+ */
+VkImageCompressionFixedRateFlagsEXT select_fixed_compression_rate(VkFormat format, VkExtent2D extent,
+                                                                  uint64_t refresh_interval, uint64_t budget,
+                                                                  VkImageCompressionFixedRateFlagsEXT supported_rates);
+
+} /* namespace wsi */
@@ -24,15 +24,22 @@
 
 #include "drm_display.hpp"
 #include "util/custom_allocator.hpp"
+#include "util/macros.hpp"
+#include "util/persistent_cache.hpp"
+#include "util/timed_semaphore.hpp"
 #include "wsi/surface.hpp"
 
 #include <cstdlib>
 #include <cstring>
 #include <cerrno>
+#include <sys/eventfd.h>
+#include <sys/select.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
+#include <algorithm>
+#include <chrono>
 #include <mutex>
 #include <drm_fourcc.h>
 namespace wsi
@@ -43,37 +50,48 @@ namespace display
 
 const std::string default_dri_device_name{ "/dev/dri/card0" };
 
-drm_display::drm_display(util::fd_owner drm_fd, int crtc_id, drm_connector_owner drm_connector,
-                         util::unique_ptr<util::vector<drm_format_pair>> supported_formats,
-                         util::unique_ptr<drm_display_mode> display_modes, size_t num_display_modes, uint32_t max_width,
-                         uint32_t max_height, bool supports_fb_modifiers)
-   : m_drm_fd(std::move(drm_fd))
+drm_plane::drm_plane(const drm_device &device, uint32_t plane_id, uint32_t possible_crtcs, bool primary,
+                     util::unique_ptr<supported_formats> formats,
+                     std::optional<drm_atomic_plane_properties> atomic_plane_properties)
+   : m_device(&device)
+   , m_plane_id(plane_id)
+   , m_possible_crtcs(possible_crtcs)
+   , m_primary(primary)
+   , m_supported_formats(std::move(formats))
+   , m_atomic_plane_properties(atomic_plane_properties)
+{
+}
+
+drm_display::drm_display(drm_device &device, int crtc_id, uint32_t crtc_index, drm_plane &primary_plane,
+                         drm_connector_owner drm_connector, util::unique_ptr<drm_display_mode> display_modes,
+                         size_t num_display_modes, uint32_t max_width, uint32_t max_height,
+                         uint32_t vrr_enabled_property, bool adaptive_sync_enabled, uint32_t out_fence_ptr_property,
+                         const drm_atomic_mode_set_properties &mode_set_properties)
+   : m_device(&device)
    , m_crtc_id(crtc_id)
+   , m_crtc_index(crtc_index)
+   , m_primary_plane(&primary_plane)
    , m_drm_connector(std::move(drm_connector))
-   , m_supported_formats(std::move(supported_formats))
    , m_display_modes(std::move(display_modes))
    , m_num_display_modes(num_display_modes)
    , m_max_width(max_width)
    , m_max_height(max_height)
-   , m_supports_fb_modifiers(supports_fb_modifiers)
+   , m_vrr_enabled_property(vrr_enabled_property)
+   , m_adaptive_sync_enabled(adaptive_sync_enabled)
+   , m_out_fence_ptr_property(out_fence_ptr_property)
+   , m_mode_set_properties(mode_set_properties)
 {
 }
 
-drm_display::~drm_display()
-{
-   if (m_drm_fd.is_valid())
-   {
-      /* Finish using the DRM device. */
-      drmDropMaster(m_drm_fd.get());
-   }
-}
-
 /**
- * @brief Utility function to find a compatible CRTC to drive this display's connector.
+ * @brief Utility function to find a CRTC to drive this display's connector that no other display uses.
+ *
+ * @param[out] crtc_index The index of the CRTC in the DRM resources.
  *
  * @return An integer < 0 on failure, otherwise a valid CRTC id.
  */
-static int find_compatible_crtc(int fd, drm_resources_owner &resources, drm_connector_owner &connector)
+static int find_compatible_crtc(int fd, const drm_resources_owner &resources, const drm_connector_owner &connector,
+                                const util::vector<drm_display> &other_displays, uint32_t &crtc_index)
 {
    assert(resources);
    assert(connector);
@@ -97,9 +115,16 @@ static int find_compatible_crtc(int fd, drm_resources_owner &resources, drm_conn
             continue;
          }
 
-         /* Make the assumption that only one connector will be in use at a time so there is no
-          * need to check that any other connectors are being driven by this CRTC. */
-         return resources->crtcs[j];
+         /* A CRTC scans out a single framebuffer, so each display needs its own. */
+         const int crtc_id = static_cast<int>(resources->crtcs[j]);
+         if (std::any_of(other_displays.begin(), other_displays.end(),
+                         [crtc_id](const drm_display &other) { return other.get_crtc_id() == crtc_id; }))
+         {
+            continue;
+         }
+
+         crtc_index = static_cast<uint32_t>(j);
+         return crtc_id;
       }
    }
 
@@ -108,50 +133,77 @@ static int find_compatible_crtc(int fd, drm_resources_owner &resources, drm_conn
    return -ENODEV;
 }
 
-static bool find_primary_plane(const util::fd_owner &drm_fd, const drm_plane_resources_owner &plane_res,
-                               drm_plane_owner &primary_plane, uint32_t &primary_plane_index)
+/**
+ * @brief Utility function to get the value of a named property of a DRM object.
+ *
+ * @return false if the object has no such property, otherwise true.
+ */
+static bool find_property_value(int fd, uint32_t object_id, uint32_t object_type, const char *name, uint64_t &value)
+{
+   drm_object_properties_owner props{ drmModeObjectGetProperties(fd, object_id, object_type) };
+   if (props == nullptr)
+   {
+      return false;
+   }
+
+   for (uint32_t j = 0; j < props->count_props; j++)
+   {
+      drm_property_owner prop{ drmModeGetProperty(fd, props->props[j]) };
+      if (prop != nullptr && !strcmp(prop->name, name))
+      {
+         value = props->prop_values[j];
+         return true;
+      }
+   }
+   return false;
+}
+
+/**
+ * @brief Utility function to get the type of a plane, one of DRM_PLANE_TYPE_*.
+ *
+ * @return false if the plane has no type property, otherwise true.
+ */
+static bool get_plane_type(int fd, uint32_t plane_id, uint64_t &type)
+{
+   return find_property_value(fd, plane_id, DRM_MODE_OBJECT_PLANE, "type", type);
+}
+
+/**
+ * @brief Utility function to find a primary plane that can scan out from a CRTC and that no other display uses.
+ */
+static bool find_primary_plane(int fd, const drm_plane_resources_owner &plane_res, uint32_t crtc_index,
+                               const util::vector<drm_plane> &other_planes, drm_plane_owner &primary_plane)
 {
    for (uint32_t i = 0; i < plane_res->count_planes; i++)
    {
-      drm_plane_owner temp_plane{ drmModeGetPlane(drm_fd.get(), plane_res->planes[i]) };
-      if (temp_plane != nullptr)
+      const uint32_t plane_id = plane_res->planes[i];
+      if (std::any_of(other_planes.begin(), other_planes.end(),
+                      [plane_id](const drm_plane &other) { return other.get_plane_id() == plane_id; }))
       {
-         drm_object_properties_owner props{ drmModeObjectGetProperties(drm_fd.get(), plane_res->planes[i],
-                                                                       DRM_MODE_OBJECT_PLANE) };
-         if (props == nullptr)
-         {
-            continue;
-         }
+         continue;
+      }
 
-         for (uint32_t j = 0; j < props->count_props; j++)
-         {
-            drm_property_owner prop{ drmModeGetProperty(drm_fd.get(), props->props[j]) };
-            if (prop == nullptr)
-            {
-               continue;
-            }
+      drm_plane_owner temp_plane{ drmModeGetPlane(fd, plane_id) };
+      if (temp_plane == nullptr || !(temp_plane->possible_crtcs & (1u << crtc_index)))
+      {
+         continue;
+      }
 
-            if (!strcmp(prop->name, "type"))
-            {
-               if (props->prop_values[j] == DRM_PLANE_TYPE_PRIMARY)
-               {
-                  primary_plane = std::move(temp_plane);
-                  primary_plane_index = i;
-                  return true;
-               }
-            }
-         }
+      uint64_t type = 0;
+      if (get_plane_type(fd, plane_id, type) && type == DRM_PLANE_TYPE_PRIMARY)
+      {
+         primary_plane = std::move(temp_plane);
+         return true;
       }
    }
    return false;
 }
 
-static bool fill_supported_formats(const drm_plane_owner &primary_plane,
-                                   util::vector<drm_format_pair> &supported_formats)
+static bool fill_supported_formats(const drm_plane_owner &plane, util::vector<drm_format_pair> &supported_formats)
 {
-   for (uint32_t i = 0; i < primary_plane->count_formats; i++)
+   for (uint32_t i = 0; i < plane->count_formats; i++)
    {
-      if (!supported_formats.try_push_back(drm_format_pair{ primary_plane->formats[i], DRM_FORMAT_MOD_LINEAR }))
+      if (!supported_formats.try_push_back(drm_format_pair{ plane->formats[i], DRM_FORMAT_MOD_LINEAR }))
       {
          WSI_LOG_ERROR("Out of host memory.");
          return false;
@@ -161,12 +213,11 @@ static bool fill_supported_formats(const drm_plane_owner &primary_plane,
    return true;
 }
 
-static bool fill_supported_formats_with_modifiers(uint32_t primary_plane_index, const util::fd_owner &drm_fd,
-                                                  const drm_plane_resources_owner &plane_res,
+static bool fill_supported_formats_with_modifiers(int drm_fd, uint32_t plane_id,
                                                   util::vector<drm_format_pair> &supported_formats)
 {
-   drm_object_properties_owner object_properties{ drmModeObjectGetProperties(
-      drm_fd.get(), plane_res->planes[primary_plane_index], DRM_MODE_OBJECT_PLANE) };
+   drm_object_properties_owner object_properties{ drmModeObjectGetProperties(drm_fd, plane_id,
+                                                                             DRM_MODE_OBJECT_PLANE) };
    if (object_properties == nullptr)
    {
       return false;
@@ -174,7 +225,7 @@ static bool fill_supported_formats_with_modifiers(uint32_t primary_plane_index,
 
    for (uint32_t i = 0; i < object_properties->count_props; i++)
    {
-      drm_property_owner property{ drmModeGetProperty(drm_fd.get(), object_properties->props[i]) };
+      drm_property_owner property{ drmModeGetProperty(drm_fd, object_properties->props[i]) };
       if (property == nullptr)
       {
          continue;
@@ -183,7 +234,7 @@ static bool fill_supported_formats_with_modifiers(uint32_t primary_plane_index,
       if (!strcmp(property->name, "IN_FORMATS"))
       {
          drmModeFormatModifierIterator iter{};
-         drm_property_blob_owner blob{ drmModeGetPropertyBlob(drm_fd.get(), object_properties->prop_values[i]) };
+         drm_property_blob_owner blob{ drmModeGetPropertyBlob(drm_fd, object_properties->prop_values[i]) };
          if (blob == nullptr)
          {
             return false;
@@ -202,55 +253,121 @@ static bool fill_supported_formats_with_modifiers(uint32_t primary_plane_index,
    return true;
 }
 
-std::optional<drm_display> drm_display::make_display(const util::allocator &allocator, const char *drm_device)
+/**
+ * @brief Utility function to find the id of a named property of a DRM object.
+ *
+ * @return The property id, or 0 if the object has no such property.
+ */
+static uint32_t find_property_id(int fd, uint32_t object_id, uint32_t object_type, const char *name)
 {
-   util::fd_owner drm_fd{ open(drm_device, O_RDWR | O_CLOEXEC, 0) };
-
-   if (!drm_fd.is_valid())
+   drm_object_properties_owner props{ drmModeObjectGetProperties(fd, object_id, object_type) };
+   if (props == nullptr)
    {
-      WSI_LOG_ERROR("Failed to open DRM device %s.", drm_device);
-      return std::nullopt;
+      return 0;
    }
 
-   /* Get the DRM master permission so that mode can be set on the drm device later. */
-   if (!drmIsMaster(drm_fd.get()))
+   for (uint32_t i = 0; i < props->count_props; i++)
    {
-      if (drmSetMaster(drm_fd.get()) != 0)
+      drm_property_owner prop{ drmModeGetProperty(fd, props->props[i]) };
+      if (prop != nullptr && !strcmp(prop->name, name))
       {
-         WSI_LOG_ERROR("Failed to set DRM master: %s.", std::strerror(errno));
-         return std::nullopt;
+         return prop->prop_id;
       }
    }
 
-   drm_resources_owner resources{ drmModeGetResources(drm_fd.get()) };
-   if (resources == nullptr)
+   return 0;
+}
+
+/**
+ * @brief Look up the properties needed to flip a plane with an atomic commit.
+ *
+ * @return The atomic plane properties, or std::nullopt if page flips must use the legacy KMS API.
+ */
+static std::optional<drm_atomic_plane_properties> find_atomic_plane_properties(int drm_fd, bool supports_atomic,
+                                                                               const drm_plane_owner &plane,
+                                                                               bool primary)
+{
+   if (!supports_atomic)
    {
-      WSI_LOG_ERROR("Failed to get DRM resources.");
       return std::nullopt;
    }
 
-   drm_connector_owner connector{ nullptr };
-   int crtc_id = -1;
-   for (int i = 0; i < resources->count_connectors; ++i)
+   const uint32_t plane_id = plane->plane_id;
+   drm_atomic_plane_properties properties{};
+   properties.plane_id = plane_id;
+   properties.fb_id_property = find_property_id(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID");
+   properties.crtc_id_property = find_property_id(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID");
+   if (properties.fb_id_property == 0 || properties.crtc_id_property == 0)
+   {
+      WSI_LOG_INFO("Plane %u is missing atomic properties, using legacy page flips.", plane_id);
+      return std::nullopt;
+   }
+
+   /* The kernel waits for the fence of a framebuffer itself when it can, see drm_plane::add_to_atomic_request. */
+   properties.in_fence_fd_property = find_property_id(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE, "IN_FENCE_FD");
+
+   properties.src_x_property = find_property_id(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_X");
+   properties.src_y_property = find_property_id(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_Y");
+   properties.src_w_property = find_property_id(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_W");
+   properties.src_h_property = find_property_id(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE, "SRC_H");
+   properties.crtc_x_property = find_property_id(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_X");
+   properties.crtc_y_property = find_property_id(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_Y");
+   properties.crtc_w_property = find_property_id(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_W");
+   properties.crtc_h_property = find_property_id(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_H");
+   if (properties.src_x_property == 0 || properties.src_y_property == 0 || properties.src_w_property == 0 ||
+       properties.src_h_property == 0 || properties.crtc_x_property == 0 || properties.crtc_y_property == 0 ||
+       properties.crtc_w_property == 0 || properties.crtc_h_property == 0)
    {
-      drm_connector_owner temp_connector{ drmModeGetConnector(drm_fd.get(), resources->connectors[i]) };
-      if (temp_connector != nullptr && temp_connector->connection == DRM_MODE_CONNECTED)
+      if (!primary)
       {
-         crtc_id = find_compatible_crtc(drm_fd.get(), resources, temp_connector);
-         if (crtc_id >= 0)
-         {
-            connector = std::move(temp_connector);
-            break;
-         }
+         WSI_LOG_INFO("Overlay plane %u is missing atomic properties.", plane_id);
+         return std::nullopt;
       }
+
+      /* Primary planes are still flipped with atomic commits, at the position set by the mode set. */
+      drm_atomic_plane_properties unpositioned{};
+      unpositioned.plane_id = plane_id;
+      unpositioned.fb_id_property = properties.fb_id_property;
+      unpositioned.crtc_id_property = properties.crtc_id_property;
+      unpositioned.in_fence_fd_property = properties.in_fence_fd_property;
+      return unpositioned;
    }
 
-   if (connector == nullptr)
+   return properties;
+}
+
+std::optional<drm_plane> drm_plane::make_plane(drm_device &device, const util::allocator &allocator,
+                                               const drm_plane_owner &plane, bool primary)
+{
+   const int drm_fd = device.get_drm_fd();
+
+   auto atomic_plane_properties =
+      find_atomic_plane_properties(drm_fd, device.supports_atomic_modesetting(), plane, primary);
+   if (!primary && !atomic_plane_properties.has_value())
    {
-      WSI_LOG_ERROR("Failed to find connector for DRM device.");
+      /* Overlay planes can only be positioned with atomic commits. */
+      return std::nullopt;
+   }
+
+   /* The formats are only queried once they are needed, see drm_plane::get_formats. */
+   auto formats = allocator.make_unique<supported_formats>(allocator);
+   if (formats == nullptr)
+   {
+      WSI_LOG_ERROR("Failed to allocate memory for the supported formats.");
       return std::nullopt;
    }
 
+   drm_plane new_plane{
+      device, plane->plane_id, plane->possible_crtcs, primary, std::move(formats), atomic_plane_properties
+   };
+
+   return std::make_optional(std::move(new_plane));
+}
+
+std::optional<drm_display> drm_display::make_display(drm_device &device, const util::allocator &allocator,
+                                                     drm_connector_owner connector, int crtc_id, uint32_t crtc_index,
+                                                     drm_plane &primary_plane)
+{
    uint32_t max_width = 0;
    uint32_t max_height = 0;
    util::vector<drm_display_mode> display_modes{ allocator };
@@ -283,75 +400,270 @@ std::optional<drm_display> drm_display::make_display(const util::allocator &allo
       return std::nullopt;
    }
 
-   /* Allow userspace to query native primary plane information */
-   if (drmSetClientCap(drm_fd.get(), DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) != 0)
+   std::copy(display_modes.begin(), display_modes.end(), display_modes_mem.get());
+
+   /* Variable refresh rates are enabled with an atomic commit of the CRTC, when the panel supports them. */
+   uint32_t vrr_enabled_property = 0;
+   uint64_t vrr_enabled = 0;
+   uint64_t vrr_capable = 0;
+   if (device.supports_atomic_modesetting() &&
+       find_property_value(device.get_drm_fd(), connector->connector_id, DRM_MODE_OBJECT_CONNECTOR, "vrr_capable",
+                           vrr_capable) &&
+       vrr_capable != 0)
    {
-      return std::nullopt;
+      vrr_enabled_property = find_property_id(device.get_drm_fd(), crtc_id, DRM_MODE_OBJECT_CRTC, "VRR_ENABLED");
+      if (vrr_enabled_property != 0)
+      {
+         find_property_value(device.get_drm_fd(), crtc_id, DRM_MODE_OBJECT_CRTC, "VRR_ENABLED", vrr_enabled);
+      }
    }
 
-   drm_plane_resources_owner plane_res{ drmModeGetPlaneResources(drm_fd.get()) };
-   if (plane_res == nullptr || plane_res->count_planes == 0)
+   const uint32_t out_fence_ptr_property =
+      device.supports_atomic_modesetting() ?
+         find_property_id(device.get_drm_fd(), crtc_id, DRM_MODE_OBJECT_CRTC, "OUT_FENCE_PTR") :
+         0;
+
+   /* Setting the mode with an atomic commit lets the primary plane scale framebuffers smaller than the mode. */
+   drm_atomic_mode_set_properties mode_set_properties{};
+   if (device.supports_atomic_modesetting())
    {
-      return std::nullopt;
+      mode_set_properties.mode_id_property =
+         find_property_id(device.get_drm_fd(), crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID");
+      mode_set_properties.active_property =
+         find_property_id(device.get_drm_fd(), crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE");
+      mode_set_properties.connector_crtc_id_property =
+         find_property_id(device.get_drm_fd(), connector->connector_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID");
    }
 
-   uint32_t primary_plane_index = std::numeric_limits<uint32_t>::max();
-   drm_plane_owner primary_plane{ nullptr };
+   drm_display display{ device,
+                        crtc_id,
+                        crtc_index,
+                        primary_plane,
+                        std::move(connector),
+                        std::move(display_modes_mem),
+                        display_modes.size(),
+                        max_width,
+                        max_height,
+                        vrr_enabled_property,
+                        vrr_enabled != 0,
+                        out_fence_ptr_property,
+                        mode_set_properties };
+
+   return std::make_optional(std::move(display));
+}
+
+/**
+ * @brief Hash everything the capabilities of a DRM device depend on, to key its persistent cache entries.
+ */
+static uint64_t compute_persistent_cache_key(int drm_fd, bool supports_fb_modifiers)
+{
+   uint64_t key = util::persistent_cache_hash(&supports_fb_modifiers, sizeof(supports_fb_modifiers));
 
-   if (!find_primary_plane(drm_fd, plane_res, primary_plane, primary_plane_index))
+   struct stat device_stat = {};
+   if (fstat(drm_fd, &device_stat) == 0)
    {
-      WSI_LOG_ERROR("Failed to find primary plane for display.");
-      return std::nullopt;
+      key = util::persistent_cache_hash(&device_stat.st_rdev, sizeof(device_stat.st_rdev), key);
+   }
+
+   drmVersionPtr version = drmGetVersion(drm_fd);
+   if (version != nullptr)
+   {
+      const int numbers[] = { version->version_major, version->version_minor, version->version_patchlevel };
+      key = util::persistent_cache_hash(numbers, sizeof(numbers), key);
+      key = util::persistent_cache_hash(version->name, version->name_len, key);
+      key = util::persistent_cache_hash(version->date, version->date_len, key);
+      drmFreeVersion(version);
+   }
+
+   return key;
+}
+
+drm_device::drm_device(const util::allocator &allocator, util::fd_owner drm_fd)
+   : m_allocator(allocator)
+   , m_drm_fd(std::move(drm_fd))
+   , m_supports_fb_modifiers(false)
+   , m_persistent_cache_key(0)
+   , m_supports_atomic_modesetting(false)
+   , m_supports_async_page_flip(false)
+   , m_supports_atomic_async_page_flip(false)
+   , m_framebuffer_cache(nullptr)
+   , m_displays(allocator)
+   , m_planes(allocator)
+   , m_event_reader_active(false)
+   , m_flip_groups(allocator)
+{
+}
+
+drm_device::~drm_device()
+{
+   if (m_drm_fd.is_valid())
+   {
+      /* Finish using the DRM device. */
+      drmDropMaster(m_drm_fd.get());
+   }
+}
+
+VkResult drm_device::init()
+{
+   drm_resources_owner resources{ drmModeGetResources(m_drm_fd.get()) };
+   if (resources == nullptr)
+   {
+      WSI_LOG_ERROR("Failed to get DRM resources.");
+      return VK_ERROR_INITIALIZATION_FAILED;
    }
 
-   assert(primary_plane != nullptr);
-   assert(primary_plane_index != std::numeric_limits<uint32_t>::max());
+   /* Allow userspace to query native primary plane information */
+   if (drmSetClientCap(m_drm_fd.get(), DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) != 0)
+   {
+      return VK_ERROR_INITIALIZATION_FAILED;
+   }
 
-   bool supports_fb_modifiers = false;
+   drm_plane_resources_owner plane_res{ drmModeGetPlaneResources(m_drm_fd.get()) };
+   if (plane_res == nullptr || plane_res->count_planes == 0)
+   {
+      return VK_ERROR_INITIALIZATION_FAILED;
+   }
 
 #if WSI_DISPLAY_SUPPORT_FORMAT_MODIFIERS
    uint64_t addfb2_modifier_support = 0;
-   if (drmGetCap(drm_fd.get(), DRM_CAP_ADDFB2_MODIFIERS, &addfb2_modifier_support) == 0)
+   if (drmGetCap(m_drm_fd.get(), DRM_CAP_ADDFB2_MODIFIERS, &addfb2_modifier_support) == 0)
    {
-      supports_fb_modifiers = addfb2_modifier_support;
+      m_supports_fb_modifiers = addfb2_modifier_support;
    }
 #endif
 
-   auto supported_formats = allocator.make_unique<util::vector<drm_format_pair>>(allocator);
+#if WSI_DISPLAY_SUPPORT_ATOMIC_MODESETTING
+   m_supports_atomic_modesetting = drmSetClientCap(m_drm_fd.get(), DRM_CLIENT_CAP_ATOMIC, 1) == 0;
+   if (!m_supports_atomic_modesetting)
+   {
+      WSI_LOG_INFO("Atomic mode setting not supported, using legacy page flips.");
+   }
+#endif
 
-   if (supports_fb_modifiers)
+   /* Tearing page flips are optional, the immediate present mode flips on vblank without them. */
+   uint64_t async_page_flip_support = 0;
+   if (drmGetCap(m_drm_fd.get(), DRM_CAP_ASYNC_PAGE_FLIP, &async_page_flip_support) == 0)
+   {
+      m_supports_async_page_flip = async_page_flip_support;
+   }
+#ifdef DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP
+   async_page_flip_support = 0;
+   if (m_supports_atomic_modesetting &&
+       drmGetCap(m_drm_fd.get(), DRM_CAP_ATOMIC_ASYNC_PAGE_FLIP, &async_page_flip_support) == 0)
+   {
+      m_supports_atomic_async_page_flip = async_page_flip_support;
+   }
+#endif
+
+   if (util::is_persistent_cache_enabled())
+   {
+      m_persistent_cache_key = compute_persistent_cache_key(m_drm_fd.get(), m_supports_fb_modifiers);
+   }
+
+   /* Wakes up the thread reading the page flip events when a page flip it may wait for is cancelled. Without it, the
+    * reader only notices on its next timeout. */
+   m_event_wake_fd = util::fd_owner{ eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK) };
+
+   m_framebuffer_cache =
+      m_allocator.make_unique<drm_framebuffer_cache>(m_allocator, m_drm_fd.get(), m_supports_fb_modifiers);
+   if (m_framebuffer_cache == nullptr)
+   {
+      WSI_LOG_ERROR("Failed to allocate memory for the framebuffer cache.");
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+
+   /* Pointers to the displays and planes are handed out as Vulkan handles, so the storage must never be
+    * reallocated. */
+   if (!m_displays.try_reserve(resources->count_connectors) || !m_planes.try_reserve(plane_res->count_planes))
+   {
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+
+   for (int i = 0; i < resources->count_connectors; ++i)
    {
-      if (!fill_supported_formats_with_modifiers(primary_plane_index, drm_fd, plane_res, *supported_formats))
+      drm_connector_owner connector{ drmModeGetConnector(m_drm_fd.get(), resources->connectors[i]) };
+      if (connector == nullptr || connector->connection != DRM_MODE_CONNECTED)
       {
-         /* Fall back to the linear formats */
-         if (!fill_supported_formats(primary_plane, *supported_formats))
-         {
-            return std::nullopt;
-         }
+         continue;
+      }
+
+      uint32_t crtc_index = 0;
+      int crtc_id = find_compatible_crtc(m_drm_fd.get(), resources, connector, m_displays, crtc_index);
+      if (crtc_id < 0)
+      {
+         continue;
+      }
+
+      drm_plane_owner primary_plane{ nullptr };
+      if (!find_primary_plane(m_drm_fd.get(), plane_res, crtc_index, m_planes, primary_plane))
+      {
+         WSI_LOG_ERROR("Failed to find primary plane for display.");
+         continue;
+      }
+
+      auto plane = drm_plane::make_plane(*this, m_allocator, primary_plane, true);
+      if (!plane.has_value())
+      {
+         continue;
+      }
+      bool res = m_planes.try_push_back(std::move(*plane));
+      assert(res);
+
+      auto display = drm_display::make_display(*this, m_allocator, std::move(connector), crtc_id, crtc_index,
+                                               m_planes.back());
+      if (!display.has_value())
+      {
+         WSI_LOG_WARNING("Failed to set up the display of connector %u.", resources->connectors[i]);
+         m_planes.pop_back();
+         continue;
       }
+
+      res = m_displays.try_push_back(std::move(*display));
+      assert(res);
+      UNUSED(res);
    }
-   else
+
+   if (m_displays.empty())
+   {
+      WSI_LOG_ERROR("Failed to find connector for DRM device.");
+      return VK_ERROR_INITIALIZATION_FAILED;
+   }
+
+   /* The overlay planes follow the primary planes, so that the index of a display is the index of its primary
+    * plane. Only the overlay planes that can be used with one of the displays are exposed. */
+   for (uint32_t i = 0; i < plane_res->count_planes && m_supports_atomic_modesetting; i++)
    {
-      if (!fill_supported_formats(primary_plane, *supported_formats))
+      uint64_t type = 0;
+      if (!get_plane_type(m_drm_fd.get(), plane_res->planes[i], type) || type != DRM_PLANE_TYPE_OVERLAY)
       {
-         return std::nullopt;
+         continue;
       }
-   }
 
-   std::copy(display_modes.begin(), display_modes.end(), display_modes_mem.get());
+      drm_plane_owner overlay_plane{ drmModeGetPlane(m_drm_fd.get(), plane_res->planes[i]) };
+      if (overlay_plane == nullptr)
+      {
+         continue;
+      }
 
-   drm_display display{
-      std::move(drm_fd),    crtc_id,   std::move(connector), std::move(supported_formats), std::move(display_modes_mem),
-      display_modes.size(), max_width, max_height,           supports_fb_modifiers
-   };
+      auto plane = drm_plane::make_plane(*this, m_allocator, overlay_plane, false);
+      auto usable = [&plane](const drm_display &display) { return plane->can_scan_out(display); };
+      if (!plane.has_value() || std::none_of(m_displays.begin(), m_displays.end(), usable))
+      {
+         continue;
+      }
 
-   return std::make_optional(std::move(display));
+      bool res = m_planes.try_push_back(std::move(*plane));
+      assert(res);
+      UNUSED(res);
+   }
+
+   return VK_SUCCESS;
 }
 
-std::optional<drm_display> &drm_display::get_display()
+drm_device *drm_device::get_device()
 {
    static std::once_flag flag{};
-   static std::optional<drm_display> display{ std::nullopt };
+   static util::unique_ptr<drm_device> device{ nullptr };
 
    std::call_once(flag, []() {
       const char *dri_device = std::getenv("WSI_DISPLAY_DRI_DEV");
@@ -360,92 +672,803 @@ std::optional<drm_display> &drm_display::get_display()
          dri_device = default_dri_device_name.c_str();
       }
 
-      display = drm_display::make_display(util::allocator::get_generic(), dri_device);
-   });
-   return display;
-}
+      util::fd_owner drm_fd{ open(dri_device, O_RDWR | O_CLOEXEC, 0) };
+      if (!drm_fd.is_valid())
+      {
+         WSI_LOG_ERROR("Failed to open DRM device %s.", dri_device);
+         return;
+      }
 
-const util::vector<drm_format_pair> *drm_display::get_supported_formats() const
-{
-   return m_supported_formats.get();
+      /* Get the DRM master permission so that mode can be set on the drm device later. */
+      if (!drmIsMaster(drm_fd.get()))
+      {
+         if (drmSetMaster(drm_fd.get()) != 0)
+         {
+            WSI_LOG_ERROR("Failed to set DRM master: %s.", std::strerror(errno));
+            return;
+         }
+      }
+
+      auto &allocator = util::allocator::get_generic();
+      auto new_device = allocator.make_unique<drm_device>(allocator, std::move(drm_fd));
+      if (new_device == nullptr || new_device->init() != VK_SUCCESS)
+      {
+         return;
+      }
+      device = std::move(new_device);
+   });
+   return device.get();
 }
 
-bool drm_display::is_format_supported(const drm_format_pair &format) const
+int drm_device::get_drm_fd() const
 {
-   auto supported_format =
-      std::find_if(m_supported_formats->begin(), m_supported_formats->end(), [format](const auto &supported_format) {
-         return format.fourcc == supported_format.fourcc && format.modifier == supported_format.modifier;
-      });
-
-   return supported_format != m_supported_formats->end();
+   return m_drm_fd.get();
 }
 
-bool drm_display::supports_fb_modifiers() const
+bool drm_device::supports_fb_modifiers() const
 {
    return m_supports_fb_modifiers;
 }
 
-drm_display_mode::drm_display_mode()
-   : m_drm_mode_info{}
-   , m_preferred(false)
+uint64_t drm_device::get_persistent_cache_key() const
 {
+   return m_persistent_cache_key;
 }
 
-uint16_t drm_display_mode::get_width() const
+bool drm_device::supports_atomic_modesetting() const
 {
-   return m_drm_mode_info.hdisplay;
+   return m_supports_atomic_modesetting;
 }
 
-uint16_t drm_display_mode::get_height() const
+bool drm_device::supports_async_page_flip() const
 {
-   return m_drm_mode_info.vdisplay;
+   return m_supports_async_page_flip;
 }
 
-uint32_t drm_display_mode::get_refresh_rate() const
+bool drm_device::supports_atomic_async_page_flip() const
 {
-   /* DRM provides refresh rate in Hz and vulkan expects mHz */
-   return m_drm_mode_info.vrefresh * 1000;
+   return m_supports_atomic_async_page_flip;
 }
 
-drmModeModeInfo drm_display_mode::get_drm_mode() const
+drm_framebuffer_cache &drm_device::get_framebuffer_cache() const
 {
-   return m_drm_mode_info;
+   return *m_framebuffer_cache;
 }
 
-void drm_display_mode::set_drm_mode(drmModeModeInfo mode)
+size_t drm_device::get_num_displays() const
 {
-   m_drm_mode_info = mode;
+   return m_displays.size();
 }
 
-bool drm_display_mode::is_preferred() const
+drm_display &drm_device::get_display(size_t index)
 {
-   return m_preferred;
+   assert(index < m_displays.size());
+   return m_displays[index];
 }
 
-void drm_display_mode::set_preferred(bool preferred)
+size_t drm_device::get_num_planes() const
 {
-   m_preferred = preferred;
+   return m_planes.size();
 }
 
-drm_display_mode *drm_display::get_display_modes_begin() const
+drm_plane &drm_device::get_plane(size_t index)
 {
-   return m_display_modes.get();
+   assert(index < m_planes.size());
+   return m_planes[index];
 }
 
-drm_display_mode *drm_display::get_display_modes_end() const
+drm_display *drm_device::find_display(const drm_display_mode *mode)
 {
-   return m_display_modes.get() + m_num_display_modes;
+   for (auto &display : m_displays)
+   {
+      if (display.owns_display_mode(mode))
+      {
+         return &display;
+      }
+   }
+   return nullptr;
 }
 
-size_t drm_display::get_num_display_modes() const
+drm_display *drm_device::find_display_by_crtc(uint32_t crtc_id)
 {
-   return m_num_display_modes;
+   for (auto &display : m_displays)
+   {
+      if (static_cast<uint32_t>(display.get_crtc_id()) == crtc_id)
+      {
+         return &display;
+      }
+   }
+   return nullptr;
 }
 
-int drm_display::get_drm_fd() const
+void drm_device::page_flip_event(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec,
+                                 unsigned int crtc_id, void *user_data)
 {
-   return m_drm_fd.get();
-}
+   UNUSED(fd);
+
+   /* Events are only read once the device has been created. A commit flipping several CRTCs delivers an event for
+    * each of them, all with the same user data, so the display is found from the CRTC. Kernels that predate
+    * reporting the CRTC only see page flips of a single display, which is passed as the user data. */
+   drm_device *device = get_device();
+   const drm_display *display = crtc_id != 0 ? device->find_display_by_crtc(crtc_id) : nullptr;
+   if (display == nullptr)
+   {
+      display = reinterpret_cast<const drm_display *>(user_data);
+   }
+   if (display == nullptr)
+   {
+      WSI_LOG_WARNING("Page flip event for unknown CRTC %u.", crtc_id);
+      return;
+   }
+
+   /* DRM reports the time scanout of the new framebuffer started, in CLOCK_MONOTONIC. */
+   const uint64_t vblank_time =
+      static_cast<uint64_t>(tv_sec) * 1000000000ull + static_cast<uint64_t>(tv_usec) * 1000ull;
+
+   /* All the planes flipped on the CRTC are part of the commit the event is for. */
+   for (auto &plane : device->m_planes)
+   {
+      if (plane.m_page_flip_display == display)
+      {
+         plane.m_page_flip_time = vblank_time;
+         plane.m_page_flip_sequence = sequence;
+         plane.m_page_flip_complete = true;
+         plane.m_page_flip_display = nullptr;
+         plane.m_page_flip_group_id = 0;
+      }
+   }
+}
+
+bool drm_device::handle_events(std::unique_lock<std::mutex> &lock)
+{
+   assert(lock.owns_lock());
+
+   /* Another thread is reading the events, which may include the ones waited for. */
+   if (m_event_reader_active)
+   {
+      m_event_condition.wait(lock);
+      return true;
+   }
+
+   m_event_reader_active = true;
+   lock.unlock();
+
+   fd_set fds;
+   FD_ZERO(&fds);
+   FD_SET(m_drm_fd.get(), &fds);
+   int max_fd = m_drm_fd.get();
+   if (m_event_wake_fd.is_valid())
+   {
+      FD_SET(m_event_wake_fd.get(), &fds);
+      max_fd = std::max(max_fd, m_event_wake_fd.get());
+   }
+   struct timeval t;
+   t.tv_sec = 1;
+   t.tv_usec = 0;
+   int drm_res = select(max_fd + 1, &fds, NULL, NULL, &t);
+
+   lock.lock();
+   bool success = true;
+   if (drm_res < 0)
+   {
+      if (errno != EINTR && errno != EAGAIN)
+      {
+         WSI_LOG_ERROR("select() failed with errno: %d\n", errno);
+         success = false;
+      }
+      else
+      {
+         WSI_LOG_ERROR("select() failed with %d, carrying on with page flip\n", errno);
+      }
+   }
+   else if (drm_res == 0)
+   {
+      WSI_LOG_ERROR("select() timed out, carrying on with page flip\n");
+   }
+   else
+   {
+      if (m_event_wake_fd.is_valid() && FD_ISSET(m_event_wake_fd.get(), &fds))
+      {
+         uint64_t wake_count = 0;
+         ssize_t read_res = read(m_event_wake_fd.get(), &wake_count, sizeof(wake_count));
+         UNUSED(read_res);
+      }
+
+      if (FD_ISSET(m_drm_fd.get(), &fds))
+      {
+         drmEventContext ev = {};
+         ev.version = DRM_EVENT_CONTEXT_VERSION;
+         ev.page_flip_handler2 = page_flip_event;
+
+         /* The handler updates the page flip state of the planes, hence the event mutex is held. */
+         drmHandleEvent(m_drm_fd.get(), &ev);
+      }
+   }
+
+   m_event_reader_active = false;
+   m_event_condition.notify_all();
+   return success;
+}
+
+bool drm_device::begin_page_flip(drm_plane &plane, const drm_display &display, uint64_t group_id)
+{
+   std::unique_lock<std::mutex> lock(m_event_mutex);
+   auto crtc_busy = [this, &plane, &display, group_id]() {
+      return std::any_of(m_planes.begin(), m_planes.end(), [&plane, &display, group_id](const drm_plane &other) {
+         return &other != &plane && other.m_page_flip_display == &display &&
+                (group_id == 0 || other.m_page_flip_group_id != group_id);
+      });
+   };
+
+   while (crtc_busy())
+   {
+      if (!handle_events(lock))
+      {
+         return false;
+      }
+   }
+
+   plane.m_page_flip_display = &display;
+   plane.m_page_flip_group_id = group_id;
+   plane.m_page_flip_complete = false;
+   return true;
+}
+
+void drm_device::cancel_page_flip(drm_plane &plane)
+{
+   std::lock_guard<std::mutex> lock(m_event_mutex);
+   plane.m_page_flip_display = nullptr;
+   plane.m_page_flip_group_id = 0;
+
+   /* Threads waiting to flip on the same CRTC may go ahead. */
+   if (m_event_reader_active && m_event_wake_fd.is_valid())
+   {
+      const uint64_t wake_count = 1;
+      ssize_t write_res = write(m_event_wake_fd.get(), &wake_count, sizeof(wake_count));
+      UNUSED(write_res);
+   }
+   m_event_condition.notify_all();
+}
+
+bool drm_device::wait_for_page_flip(drm_plane &plane, uint32_t &sequence, uint64_t &vblank_time)
+{
+   std::unique_lock<std::mutex> lock(m_event_mutex);
+   while (!plane.m_page_flip_complete)
+   {
+      if (!handle_events(lock))
+      {
+         return false;
+      }
+   }
+
+   sequence = plane.m_page_flip_sequence;
+   vblank_time = plane.m_page_flip_time;
+   return true;
+}
+
+drm_device::page_flip_group *drm_device::get_flip_group(uint64_t group_id, uint32_t group_size)
+{
+   purge_flip_groups();
+
+   for (auto &group : m_flip_groups)
+   {
+      if (group.id == group_id)
+      {
+         return &group;
+      }
+   }
+
+   page_flip_group group{};
+   group.id = group_id;
+   group.remaining = group_size;
+   group.waiting = 0;
+   group.group_state = page_flip_group::state::GATHERING;
+   group.deadline = util::get_monotonic_time_ns() + FLIP_GROUP_TIMEOUT_NS;
+   if (!m_flip_groups.try_push_back(group))
+   {
+      return nullptr;
+   }
+   return &m_flip_groups.back();
+}
+
+void drm_device::purge_flip_groups()
+{
+   /* Groups are dropped once all their members are done with them. Members that never reach the presentation
+    * engine, e.g. because their present failed, leave groups behind that are dropped some time after their commit. */
+   constexpr uint64_t STALE_GROUP_TIME_NS = 1000000000;
+   const uint64_t now = util::get_monotonic_time_ns();
+   auto stale = std::remove_if(m_flip_groups.begin(), m_flip_groups.end(), [now](const page_flip_group &group) {
+      return group.group_state != page_flip_group::state::GATHERING && group.waiting == 0 &&
+             (group.remaining == 0 || now > group.deadline + STALE_GROUP_TIME_NS);
+   });
+   m_flip_groups.erase(stale, m_flip_groups.end());
+}
+
+void drm_device::commit_flip_group(page_flip_group &group)
+{
+   assert(group.group_state == page_flip_group::state::GATHERING);
+
+   group.group_state = page_flip_group::state::FAILED;
+   if (std::none_of(m_planes.begin(), m_planes.end(),
+                    [&group](const drm_plane &plane) { return plane.m_flip_group_id == group.id; }))
+   {
+      /* Every member left the group. */
+      return;
+   }
+
+   drm_atomic_req_owner request{ drmModeAtomicAlloc() };
+   if (request == nullptr)
+   {
+      m_flip_group_condition.notify_all();
+      return;
+   }
+
+   for (const auto &plane : m_planes)
+   {
+      if (plane.m_flip_group_id == group.id &&
+          !plane.add_to_atomic_request(request.get(), *plane.m_flip_group_display, plane.m_flip_group_fb_id,
+                                       plane.m_flip_group_placement, plane.m_flip_group_in_fence_fd))
+      {
+         m_flip_group_condition.notify_all();
+         return;
+      }
+   }
+
+   int drm_res =
+      drmModeAtomicCommit(m_drm_fd.get(), request.get(), DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, nullptr);
+   if (drm_res == 0)
+   {
+      group.group_state = page_flip_group::state::COMMITTED;
+   }
+   else
+   {
+      WSI_LOG_WARNING("Synchronized page flip failed: %s, flipping the planes separately.", std::strerror(errno));
+   }
+   m_flip_group_condition.notify_all();
+}
+
+bool drm_device::queue_group_page_flip(uint64_t group_id, uint32_t group_size, drm_plane &plane,
+                                       const drm_display &display, uint32_t fb_id,
+                                       const drm_plane_placement &placement, int in_fence_fd)
+{
+   assert(group_id != 0);
+   assert(plane.supports_atomic_modesetting());
+
+   std::unique_lock<std::mutex> lock(m_flip_group_mutex);
+   page_flip_group *group = get_flip_group(group_id, group_size);
+   if (group == nullptr)
+   {
+      return false;
+   }
+
+   assert(group->remaining > 0);
+   group->remaining--;
+   if (group->group_state != page_flip_group::state::GATHERING)
+   {
+      /* Joined after the others gave up waiting. */
+      return false;
+   }
+
+   plane.m_flip_group_id = group_id;
+   plane.m_flip_group_display = &display;
+   plane.m_flip_group_fb_id = fb_id;
+   plane.m_flip_group_placement = placement;
+   plane.m_flip_group_in_fence_fd = in_fence_fd;
+   if (group->remaining == 0)
+   {
+      commit_flip_group(*group);
+   }
+   else
+   {
+      group->waiting++;
+      const uint64_t deadline = group->deadline;
+      while (group->group_state == page_flip_group::state::GATHERING)
+      {
+         const uint64_t now = util::get_monotonic_time_ns();
+         if (now >= deadline)
+         {
+            WSI_LOG_WARNING("Not all the swapchains of a synchronized present arrived in time.");
+            commit_flip_group(*group);
+            break;
+         }
+         m_flip_group_condition.wait_for(lock, std::chrono::nanoseconds(deadline - now));
+
+         /* Other groups may have been created while waiting, moving this one. */
+         group = get_flip_group(group_id, group_size);
+         assert(group != nullptr);
+      }
+      group->waiting--;
+   }
+
+   plane.m_flip_group_id = 0;
+   plane.m_flip_group_in_fence_fd = -1;
+   return group->group_state == page_flip_group::state::COMMITTED;
+}
+
+void drm_device::leave_page_flip_group(uint64_t group_id, uint32_t group_size)
+{
+   assert(group_id != 0);
+
+   std::unique_lock<std::mutex> lock(m_flip_group_mutex);
+   page_flip_group *group = get_flip_group(group_id, group_size);
+   if (group == nullptr)
+   {
+      /* The members that have joined commit without this one once they stop waiting. */
+      return;
+   }
+
+   assert(group->remaining > 0);
+   group->remaining--;
+   if (group->remaining == 0 && group->group_state == page_flip_group::state::GATHERING)
+   {
+      /* Every other member has joined or left, those that joined wait for this one. */
+      commit_flip_group(*group);
+   }
+}
+
+uint32_t drm_plane::get_plane_id() const
+{
+   return m_plane_id;
+}
+
+bool drm_plane::is_primary() const
+{
+   return m_primary;
+}
+
+bool drm_plane::can_scan_out(const drm_display &display) const
+{
+   return (m_possible_crtcs & (1u << display.get_crtc_index())) != 0;
+}
+
+/**
+ * @brief Query the formats a plane supports from the DRM device.
+ *
+ * @return true on success, false if the formats could not be queried or when out of memory.
+ */
+static bool load_supported_formats(int drm_fd, uint32_t plane_id, bool supports_fb_modifiers,
+                                   util::vector<drm_format_pair> &supported_formats)
+{
+   if (supports_fb_modifiers)
+   {
+      if (fill_supported_formats_with_modifiers(drm_fd, plane_id, supported_formats))
+      {
+         return true;
+      }
+
+      /* Fall back to the linear formats */
+      supported_formats.clear();
+   }
+
+   drm_plane_owner plane{ drmModeGetPlane(drm_fd, plane_id) };
+   if (plane == nullptr)
+   {
+      return false;
+   }
+
+   return fill_supported_formats(plane, supported_formats);
+}
+
+bool drm_plane::supported_formats::build_index()
+{
+   for (const drm_format_pair &format : formats)
+   {
+      if (!modifiers.try_push_back(format.modifier))
+      {
+         return false;
+      }
+   }
+   std::sort(modifiers.begin(), modifiers.end());
+   modifiers.erase(std::unique(modifiers.begin(), modifiers.end()), modifiers.end());
+   if (modifiers.size() > MAX_PLANE_MODIFIERS)
+   {
+      /* Keeps the formats with the smaller modifier values, which include DRM_FORMAT_MOD_LINEAR. */
+      WSI_LOG_WARNING("Plane has %zu modifiers, only the first %zu are used.", modifiers.size(), MAX_PLANE_MODIFIERS);
+      modifiers.erase(modifiers.begin() + MAX_PLANE_MODIFIERS, modifiers.end());
+   }
+
+   for (const drm_format_pair &format : formats)
+   {
+      auto modifier = std::lower_bound(modifiers.begin(), modifiers.end(), format.modifier);
+      if (modifier == modifiers.end() || *modifier != format.modifier)
+      {
+         continue;
+      }
+
+      auto entry = format_modifiers.try_insert(std::make_pair(format.fourcc, modifier_mask{}));
+      if (!entry.has_value())
+      {
+         return false;
+      }
+      entry->first->second.set(static_cast<size_t>(modifier - modifiers.begin()));
+   }
+   return true;
+}
+
+const drm_plane::supported_formats &drm_plane::get_formats() const
+{
+   supported_formats &formats = *m_supported_formats;
+   std::call_once(formats.loaded, [this, &formats]() {
+      bool success = false;
+      const bool use_persistent_cache = util::is_persistent_cache_enabled();
+      const uint64_t cache_key =
+         util::persistent_cache_hash(&m_plane_id, sizeof(m_plane_id), m_device->get_persistent_cache_key());
+
+      util::persistent_cache_entry cached;
+      if (use_persistent_cache && cached.load("drm_plane_formats", cache_key) &&
+          cached.size() % sizeof(drm_format_pair) == 0)
+      {
+         const auto *cached_formats = static_cast<const drm_format_pair *>(cached.data());
+         success = formats.formats.try_push_back_many(cached_formats,
+                                                      cached_formats + cached.size() / sizeof(drm_format_pair));
+      }
+      else
+      {
+         success = load_supported_formats(m_device->get_drm_fd(), m_plane_id, m_device->supports_fb_modifiers(),
+                                          formats.formats);
+         if (success && use_persistent_cache)
+         {
+            util::persistent_cache_entry::store("drm_plane_formats", cache_key, formats.formats.data(),
+                                                formats.formats.size() * sizeof(drm_format_pair));
+         }
+      }
+
+      success = success && formats.build_index();
+
+      if (!success)
+      {
+         WSI_LOG_ERROR("Failed to query the supported formats of plane %u.", m_plane_id);
+         formats.formats.clear();
+         formats.modifiers.clear();
+         formats.format_modifiers.clear();
+      }
+   });
+
+   return formats;
+}
+
+const util::vector<drm_format_pair> *drm_plane::get_supported_formats() const
+{
+   return &get_formats().formats;
+}
+
+bool drm_plane::is_format_supported(const drm_format_pair &format) const
+{
+   const supported_formats &formats = get_formats();
+   auto modifiers = formats.format_modifiers.find(format.fourcc);
+   if (modifiers == formats.format_modifiers.end())
+   {
+      return false;
+   }
+
+   auto modifier = std::lower_bound(formats.modifiers.begin(), formats.modifiers.end(), format.modifier);
+   return modifier != formats.modifiers.end() && *modifier == format.modifier &&
+          modifiers->second.test(static_cast<size_t>(modifier - formats.modifiers.begin()));
+}
+
+bool drm_plane::supports_atomic_modesetting() const
+{
+   return m_atomic_plane_properties.has_value();
+}
+
+const drm_atomic_plane_properties &drm_plane::get_atomic_plane_properties() const
+{
+   assert(m_atomic_plane_properties.has_value());
+   return *m_atomic_plane_properties;
+}
+
+bool drm_plane::supports_scaling() const
+{
+   return supports_atomic_modesetting() && get_atomic_plane_properties().src_w_property != 0;
+}
+
+bool drm_plane::add_to_atomic_request(drmModeAtomicReq *request, const drm_display &display, uint32_t fb_id,
+                                      const drm_plane_placement &placement, int in_fence_fd) const
+{
+   const auto &properties = get_atomic_plane_properties();
+   auto add_property = [request, &properties](uint32_t property_id, uint64_t value) {
+      return drmModeAtomicAddProperty(request, properties.plane_id, property_id, value) >= 0;
+   };
+
+   if (!add_property(properties.fb_id_property, fb_id) ||
+       !add_property(properties.crtc_id_property, static_cast<uint64_t>(display.get_crtc_id())))
+   {
+      return false;
+   }
+
+   if (in_fence_fd >= 0)
+   {
+      assert(properties.in_fence_fd_property != 0);
+      if (!add_property(properties.in_fence_fd_property, static_cast<uint64_t>(in_fence_fd)))
+      {
+         return false;
+      }
+   }
+
+   if (!placement.positioned)
+   {
+      assert(m_primary);
+      return true;
+   }
+
+   /* Source coordinates are in 16.16 fixed point. */
+   assert(supports_scaling());
+   const VkRect2D &src = placement.source;
+   const VkRect2D &dst = placement.destination;
+   return add_property(properties.src_x_property, static_cast<uint64_t>(src.offset.x) << 16) &&
+          add_property(properties.src_y_property, static_cast<uint64_t>(src.offset.y) << 16) &&
+          add_property(properties.src_w_property, static_cast<uint64_t>(src.extent.width) << 16) &&
+          add_property(properties.src_h_property, static_cast<uint64_t>(src.extent.height) << 16) &&
+          add_property(properties.crtc_x_property, static_cast<uint64_t>(dst.offset.x)) &&
+          add_property(properties.crtc_y_property, static_cast<uint64_t>(dst.offset.y)) &&
+          add_property(properties.crtc_w_property, dst.extent.width) &&
+          add_property(properties.crtc_h_property, dst.extent.height);
+}
+
+bool drm_display::supports_fb_modifiers() const
+{
+   return m_device->supports_fb_modifiers();
+}
+
+bool drm_display::supports_adaptive_sync() const
+{
+   return m_vrr_enabled_property != 0;
+}
+
+bool drm_display::is_adaptive_sync_enabled() const
+{
+   return m_adaptive_sync_enabled;
+}
+
+bool drm_display::set_adaptive_sync(bool enable)
+{
+   assert(supports_adaptive_sync());
+
+   drm_atomic_req_owner request{ drmModeAtomicAlloc() };
+   if (request == nullptr ||
+       drmModeAtomicAddProperty(request.get(), static_cast<uint32_t>(m_crtc_id), m_vrr_enabled_property,
+                                enable ? 1 : 0) < 0)
+   {
+      return false;
+   }
+
+   /* Blocks until the commit has been applied, the caller makes sure that no page flip is in flight. */
+   if (drmModeAtomicCommit(get_drm_fd(), request.get(), 0, nullptr) != 0)
+   {
+      WSI_LOG_WARNING("Failed to %s adaptive sync: %s.", enable ? "enable" : "disable", std::strerror(errno));
+      return false;
+   }
+
+   m_adaptive_sync_enabled = enable;
+   return true;
+}
+
+bool drm_display::supports_out_fence() const
+{
+   return m_out_fence_ptr_property != 0;
+}
+
+bool drm_display::add_out_fence_to_atomic_request(drmModeAtomicReq *request, int32_t *out_fence_fd) const
+{
+   assert(supports_out_fence());
+
+   *out_fence_fd = -1;
+   return drmModeAtomicAddProperty(request, static_cast<uint32_t>(m_crtc_id), m_out_fence_ptr_property,
+                                   static_cast<uint64_t>(reinterpret_cast<uintptr_t>(out_fence_fd))) >= 0;
+}
+
+bool drm_display::supports_atomic_mode_set() const
+{
+   return m_mode_set_properties.mode_id_property != 0 && m_mode_set_properties.active_property != 0 &&
+          m_mode_set_properties.connector_crtc_id_property != 0;
+}
+
+int drm_display::set_mode_atomic(const drm_display_mode &mode, const drm_plane &plane, uint32_t fb_id,
+                                 const drm_plane_placement &placement)
+{
+   assert(supports_atomic_mode_set());
+
+   drmModeModeInfo mode_info = mode.get_drm_mode();
+   uint32_t mode_blob_id = 0;
+   if (drmModeCreatePropertyBlob(get_drm_fd(), &mode_info, sizeof(mode_info), &mode_blob_id) != 0)
+   {
+      return -1;
+   }
+
+   const auto crtc_id = static_cast<uint32_t>(m_crtc_id);
+   drm_atomic_req_owner request{ drmModeAtomicAlloc() };
+   if (request == nullptr ||
+       drmModeAtomicAddProperty(request.get(), get_connector_id(), m_mode_set_properties.connector_crtc_id_property,
+                                crtc_id) < 0 ||
+       drmModeAtomicAddProperty(request.get(), crtc_id, m_mode_set_properties.mode_id_property, mode_blob_id) < 0 ||
+       drmModeAtomicAddProperty(request.get(), crtc_id, m_mode_set_properties.active_property, 1) < 0 ||
+       !plane.add_to_atomic_request(request.get(), *this, fb_id, placement, -1))
+   {
+      drmModeDestroyPropertyBlob(get_drm_fd(), mode_blob_id);
+      errno = ENOMEM;
+      return -1;
+   }
+
+   int drm_res = drmModeAtomicCommit(get_drm_fd(), request.get(), DRM_MODE_ATOMIC_ALLOW_MODESET, nullptr);
+   const int commit_errno = errno;
+
+   /* The CRTC keeps a reference to the mode blob while it uses it. */
+   drmModeDestroyPropertyBlob(get_drm_fd(), mode_blob_id);
+   errno = commit_errno;
+   return drm_res;
+}
+
+drm_display_mode::drm_display_mode()
+   : m_drm_mode_info{}
+   , m_preferred(false)
+{
+}
+
+uint16_t drm_display_mode::get_width() const
+{
+   return m_drm_mode_info.hdisplay;
+}
+
+uint16_t drm_display_mode::get_height() const
+{
+   return m_drm_mode_info.vdisplay;
+}
+
+uint32_t drm_display_mode::get_refresh_rate() const
+{
+   /* DRM provides refresh rate in Hz and vulkan expects mHz */
+   return m_drm_mode_info.vrefresh * 1000;
+}
+
+drmModeModeInfo drm_display_mode::get_drm_mode() const
+{
+   return m_drm_mode_info;
+}
+
+void drm_display_mode::set_drm_mode(drmModeModeInfo mode)
+{
+   m_drm_mode_info = mode;
+}
+
+bool drm_display_mode::is_preferred() const
+{
+   return m_preferred;
+}
+
+void drm_display_mode::set_preferred(bool preferred)
+{
+   m_preferred = preferred;
+}
+
+drm_display_mode *drm_display::get_display_modes_begin() const
+{
+   return m_display_modes.get();
+}
+
+drm_display_mode *drm_display::get_display_modes_end() const
+{
+   return m_display_modes.get() + m_num_display_modes;
+}
+
+size_t drm_display::get_num_display_modes() const
+{
+   return m_num_display_modes;
+}
+
+bool drm_display::owns_display_mode(const drm_display_mode *mode) const
+{
+   return mode >= get_display_modes_begin() && mode < get_display_modes_end();
+}
+
+drm_device &drm_display::get_device() const
+{
+   return *m_device;
+}
+
+int drm_display::get_drm_fd() const
+{
+   return m_device->get_drm_fd();
+}
 
 uint32_t drm_display::get_connector_id() const
 {
@@ -457,6 +1480,16 @@ int drm_display::get_crtc_id() const
    return m_crtc_id;
 }
 
+uint32_t drm_display::get_crtc_index() const
+{
+   return m_crtc_index;
+}
+
+drm_plane &drm_display::get_primary_plane() const
+{
+   return *m_primary_plane;
+}
+
 drmModeConnector *drm_display::get_connector() const
 {
    return m_drm_connector.get();
@@ -471,6 +1504,141 @@ uint32_t drm_display::get_max_height() const
    return m_max_height;
 }
 
+drm_framebuffer_cache &drm_display::get_framebuffer_cache() const
+{
+   return m_device->get_framebuffer_cache();
+}
+
+bool drm_framebuffer_key::operator==(const drm_framebuffer_key &other) const
+{
+   return inodes == other.inodes && format.fourcc == other.format.fourcc && format.modifier == other.format.modifier &&
+          width == other.width && height == other.height && num_planes == other.num_planes &&
+          strides == other.strides && offsets == other.offsets;
+}
+
+drm_framebuffer_cache::drm_framebuffer_cache(const util::allocator &allocator, int drm_fd, bool supports_fb_modifiers)
+   : m_drm_fd(drm_fd)
+   , m_supports_fb_modifiers(supports_fb_modifiers)
+   , m_release_counter(0)
+   , m_entries(allocator)
+{
+}
+
+drm_framebuffer_cache::~drm_framebuffer_cache()
+{
+   for (const auto &cached : m_entries)
+   {
+      /* All swapchains have been destroyed by now, so only unused framebuffers are left. */
+      assert(cached.ref_count == 0);
+      drmModeRmFB(m_drm_fd, cached.fb_id);
+   }
+}
+
+VkResult drm_framebuffer_cache::acquire(const drm_framebuffer_key &key,
+                                        const std::array<int, util::MAX_PLANES> &buffer_fds, uint32_t &fb_id)
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+
+   for (auto &cached : m_entries)
+   {
+      if (cached.key == key)
+      {
+         cached.ref_count++;
+         fb_id = cached.fb_id;
+         return VK_SUCCESS;
+      }
+   }
+
+   /* Reserve the slot first so that a framebuffer is never created without being tracked. */
+   if (!m_entries.try_push_back(entry{ key, 0, 1, 0 }))
+   {
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+
+   /* The framebuffer keeps its own reference to the buffer, so the GEM handles are only needed to create it. */
+   drm_gem_handle_array<util::MAX_PLANES> buffer_handles{ m_drm_fd };
+   std::array<uint64_t, util::MAX_PLANES> modifiers{ 0, 0, 0, 0 };
+   for (uint32_t plane = 0; plane < key.num_planes; plane++)
+   {
+      modifiers[plane] = key.format.modifier;
+      if (drmPrimeFDToHandle(m_drm_fd, buffer_fds[plane], &buffer_handles[plane]) != 0)
+      {
+         WSI_LOG_ERROR("Failed to convert buffer FD to GEM handle: %s", std::strerror(errno));
+         m_entries.pop_back();
+         return VK_ERROR_INITIALIZATION_FAILED;
+      }
+   }
+
+   int error = 0;
+   uint32_t new_fb_id = 0;
+   if (m_supports_fb_modifiers)
+   {
+      error = drmModeAddFB2WithModifiers(m_drm_fd, key.width, key.height, key.format.fourcc, buffer_handles.data(),
+                                         key.strides.data(), key.offsets.data(), modifiers.data(), &new_fb_id,
+                                         DRM_MODE_FB_MODIFIERS);
+   }
+   else
+   {
+      error = drmModeAddFB2(m_drm_fd, key.width, key.height, key.format.fourcc, buffer_handles.data(),
+                            key.strides.data(), key.offsets.data(), &new_fb_id, 0);
+   }
+
+   if (error != 0)
+   {
+      WSI_LOG_ERROR("Failed to create framebuffer: %s", strerror(errno));
+      m_entries.pop_back();
+      return VK_ERROR_INITIALIZATION_FAILED;
+   }
+
+   m_entries.back().fb_id = new_fb_id;
+   fb_id = new_fb_id;
+   return VK_SUCCESS;
+}
+
+void drm_framebuffer_cache::release(uint32_t fb_id)
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+
+   auto cached = std::find_if(m_entries.begin(), m_entries.end(),
+                              [fb_id](const entry &candidate) { return candidate.fb_id == fb_id; });
+   assert(cached != m_entries.end());
+   if (cached == m_entries.end())
+   {
+      return;
+   }
+
+   assert(cached->ref_count > 0);
+   if (--cached->ref_count == 0)
+   {
+      cached->last_release = ++m_release_counter;
+      trim();
+   }
+}
+
+void drm_framebuffer_cache::trim()
+{
+   size_t unused = std::count_if(m_entries.begin(), m_entries.end(),
+                                 [](const entry &candidate) { return candidate.ref_count == 0; });
+
+   while (unused > MAX_UNUSED_FRAMEBUFFERS)
+   {
+      auto oldest = m_entries.end();
+      for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+      {
+         if (it->ref_count == 0 && (oldest == m_entries.end() || it->last_release < oldest->last_release))
+         {
+            oldest = it;
+         }
+      }
+
+      int result = drmModeRmFB(m_drm_fd, oldest->fb_id);
+      assert(result == 0);
+      UNUSED(result);
+      m_entries.erase(oldest);
+      unused--;
+   }
+}
+
 } /* namespace display */
 
 } /* namespace wsi */
@@ -27,10 +27,17 @@
 #include <vulkan/vulkan.h>
 #include <xf86drmMode.h>
 #include <xf86drm.h>
+#include <sys/types.h>
+#include <array>
+#include <bitset>
+#include <condition_variable>
+#include <mutex>
 #include <optional>
 
 #include "util/custom_allocator.hpp"
 #include "util/file_descriptor.hpp"
+#include "util/flat_map.hpp"
+#include "util/helpers.hpp"
 #include "wsi/surface.hpp"
 
 namespace wsi
@@ -62,6 +69,66 @@ using drm_plane_resources_owner = drm_owner<_drmModePlaneRes, drmModeFreePlaneRe
 using drm_object_properties_owner = drm_owner<_drmModeObjectProperties, drmModeFreeObjectProperties>;
 using drm_property_owner = drm_owner<_drmModeProperty, drmModeFreeProperty>;
 using drm_property_blob_owner = drm_owner<_drmModePropertyBlob, drmModeFreePropertyBlob>;
+using drm_atomic_req_owner = drm_owner<_drmModeAtomicReq, drmModeAtomicFree>;
+
+/**
+ * @brief The DRM object and property ids needed to flip a plane with an atomic commit.
+ */
+struct drm_atomic_plane_properties
+{
+   /* Id of the plane. */
+   uint32_t plane_id{ 0 };
+
+   /* Id of the plane's FB_ID property. */
+   uint32_t fb_id_property{ 0 };
+
+   /* Id of the plane's CRTC_ID property. */
+   uint32_t crtc_id_property{ 0 };
+
+   /* Ids of the properties positioning the plane. Overlay planes always have them. For primary planes they are
+    * optional and only used to scale the framebuffer, the mode set configures them otherwise. */
+   uint32_t src_x_property{ 0 };
+   uint32_t src_y_property{ 0 };
+   uint32_t src_w_property{ 0 };
+   uint32_t src_h_property{ 0 };
+   uint32_t crtc_x_property{ 0 };
+   uint32_t crtc_y_property{ 0 };
+   uint32_t crtc_w_property{ 0 };
+   uint32_t crtc_h_property{ 0 };
+
+   /* Id of the plane's IN_FENCE_FD property, 0 if the kernel cannot wait for fences before scanning out. */
+   uint32_t in_fence_fd_property{ 0 };
+};
+
+/**
+ * @brief Where a plane scans out a framebuffer on the display.
+ */
+struct drm_plane_placement
+{
+   /* The part of the framebuffer scanned out, in pixels. */
+   VkRect2D source{};
+
+   /* The area of the display the source is scaled to, in pixels. */
+   VkRect2D destination{};
+
+   /* Whether the source and destination are set with page flips of a primary plane. If not, the plane keeps those
+    * of the mode set, which scans out the framebuffer unscaled over the whole display. Always set for overlay
+    * planes. */
+   bool positioned{ false };
+};
+
+/**
+ * @brief The property ids needed to set the mode of a display with an atomic commit.
+ */
+struct drm_atomic_mode_set_properties
+{
+   /* Ids of the CRTC's MODE_ID and ACTIVE properties. */
+   uint32_t mode_id_property{ 0 };
+   uint32_t active_property{ 0 };
+
+   /* Id of the connector's CRTC_ID property. */
+   uint32_t connector_crtc_id_property{ 0 };
+};
 
 /**
  * @brief Owner class for an array of DRM GEM buffer handles.
@@ -101,6 +168,100 @@ private:
    std::array<uint32_t, array_size> m_handle{ UINT32_MAX };
 };
 
+/**
+ * @brief Description of the buffer a framebuffer scans out.
+ *
+ * Images with equal keys scan out the same memory with the same layout, so they can share one framebuffer.
+ */
+struct drm_framebuffer_key
+{
+   /* Inode of the dma-buf of each plane, which identifies the underlying buffer. */
+   std::array<ino_t, util::MAX_PLANES> inodes{};
+
+   /* Format and modifier of the buffer. */
+   drm_format_pair format{};
+
+   uint32_t width{ 0 };
+   uint32_t height{ 0 };
+   uint32_t num_planes{ 0 };
+   std::array<uint32_t, util::MAX_PLANES> strides{};
+   std::array<uint32_t, util::MAX_PLANES> offsets{};
+
+   bool operator==(const drm_framebuffer_key &other) const;
+};
+
+/**
+ * @brief Cache of the framebuffers created on a DRM device.
+ *
+ * Creating a framebuffer imports the GEM handles of the buffer and calls drmModeAddFB2, which is costly when
+ * swapchains are recreated repeatedly, e.g. on resizes. Framebuffers are reference counted and kept in the cache
+ * after their last user releases them, so recreated swapchains that are handed the same buffers, for instance
+ * recycled dma-bufs, reuse them. The number of unused framebuffers is bounded as each one keeps its buffer alive.
+ */
+class drm_framebuffer_cache : private util::noncopyable
+{
+public:
+   /**
+    * @brief Maximum number of unused framebuffers kept in the cache.
+    */
+   static constexpr size_t MAX_UNUSED_FRAMEBUFFERS = 8;
+
+   /**
+    * @brief drm_framebuffer_cache constructor.
+    *
+    * @param allocator             The allocator that the cache will use.
+    * @param drm_fd                File descriptor of the DRM device, which must outlive the cache.
+    * @param supports_fb_modifiers Whether framebuffers can be created with format modifiers.
+    */
+   drm_framebuffer_cache(const util::allocator &allocator, int drm_fd, bool supports_fb_modifiers);
+
+   ~drm_framebuffer_cache();
+
+   /**
+    * @brief Get a framebuffer for a buffer, creating one only if there is none cached for it.
+    *
+    * @param key        Description of the buffer.
+    * @param buffer_fds The dma-buf file descriptor of each plane of the buffer.
+    * @param[out] fb_id The framebuffer id, to be passed to @ref release once no longer used.
+    *
+    * @return VK_SUCCESS on success, VK_ERROR_OUT_OF_HOST_MEMORY or VK_ERROR_INITIALIZATION_FAILED otherwise.
+    */
+   VkResult acquire(const drm_framebuffer_key &key, const std::array<int, util::MAX_PLANES> &buffer_fds,
+                    uint32_t &fb_id);
+
+   /**
+    * @brief Drop a reference to a framebuffer returned by @ref acquire.
+    *
+    * @param fb_id The framebuffer id.
+    */
+   void release(uint32_t fb_id);
+
+private:
+   struct entry
+   {
+      drm_framebuffer_key key;
+      uint32_t fb_id;
+      uint32_t ref_count;
+      /* Value of @ref m_release_counter when the framebuffer was last released, used to evict the oldest. */
+      uint64_t last_release;
+   };
+
+   /**
+    * @brief Remove the least recently released unused framebuffers beyond @ref MAX_UNUSED_FRAMEBUFFERS.
+    */
+   void trim();
+
+   int m_drm_fd;
+   bool m_supports_fb_modifiers;
+   uint64_t m_release_counter;
+   util::vector<entry> m_entries;
+
+   /**
+    * @brief Serializes swapchains of different threads using the cache.
+    */
+   std::mutex m_mutex;
+};
+
 /* Forward declaration */
 class drm_display;
 
@@ -176,31 +337,257 @@ private:
    bool m_preferred = false;
 };
 
+/* Forward declarations */
+class drm_device;
+class drm_display;
+
 /**
- * @brief The vulkan's display object.
- * The display class wraps a VkDisplayKHR.
+ * @brief A hardware plane of the DRM device that swapchains can scan out from.
+ *
+ * The primary plane of each display is exposed as a display plane, followed by the overlay planes, which let
+ * swapchains be composited by the display controller instead of the GPU. Overlay planes are only exposed when the
+ * device supports atomic mode setting.
  */
-class drm_display
+class drm_plane
 {
 public:
+   drm_plane(drm_plane &&other) = default;
+
+   drm_plane &operator=(drm_plane &&other) = default;
+
+   /**
+    * @brief Get the DRM id of the plane.
+    */
+   uint32_t get_plane_id() const;
+
+   /**
+    * @brief Whether the plane is the primary plane of a display, rather than an overlay plane.
+    */
+   bool is_primary() const;
+
+   /**
+    * @brief Whether the plane can scan out from the CRTC of a display.
+    */
+   bool can_scan_out(const drm_display &display) const;
+
    /**
-    * @brief Construct and initialize a display object.
+    * @brief Get the supported formats for the plane.
     *
-    * @param allocator The allocator object that the display will use.
-    * @return std::optional<drm_display> containing a display if initialization went well, otherwise std::nullopt.
+    * @return Pointer to vector of supported formats.
+    */
+   const util::vector<drm_format_pair> *get_supported_formats() const;
+
+   /**
+    * @brief Query the plane for support of a specific format and modifier combination.
+    *
+    * @param format The format to query support for.
+    * @return true if the format can be scanned out by the plane, otherwise false.
     */
-   static std::optional<drm_display> make_display(const util::allocator &allocator, const char *drm_device);
+   bool is_format_supported(const drm_format_pair &format) const;
 
-   static std::optional<drm_display> &get_display();
+   /**
+    * @brief Query the plane for support for atomic mode setting, which overlay planes always support.
+    */
+   bool supports_atomic_modesetting() const;
 
-   drm_display(drm_display &&other) = default;
+   /**
+    * @brief Get the properties used to flip the plane with an atomic commit.
+    *
+    * Only valid if @ref supports_atomic_modesetting returns true.
+    */
+   const drm_atomic_plane_properties &get_atomic_plane_properties() const;
 
-   drm_display &operator=(drm_display &&other) = default;
+   /**
+    * @brief Whether atomic commits can scale and position the framebuffers scanned out on the plane.
+    *
+    * The display controller may still reject some scale factors, which fails the commits.
+    */
+   bool supports_scaling() const;
+
+   /**
+    * @brief Add the properties flipping the plane to a framebuffer to an atomic request.
+    *
+    * The plane is also placed as described by @p placement when it is positioned.
+    *
+    * @param request     The atomic request.
+    * @param display     The display to scan out to.
+    * @param fb_id       The framebuffer to scan out.
+    * @param placement   Where the framebuffer is scanned out on the display.
+    * @param in_fence_fd Sync FD the kernel waits for before scanning out the framebuffer, -1 if it can be scanned
+    *                    out right away. Must be -1 unless the plane supports IN_FENCE_FD.
+    *
+    * @return true on success, false when out of memory.
+    */
+   bool add_to_atomic_request(drmModeAtomicReq *request, const drm_display &display, uint32_t fb_id,
+                              const drm_plane_placement &placement, int in_fence_fd) const;
+
+private:
+   friend class drm_device;
 
    /**
-    * @brief display destructor.
+    * @brief Construct and initialize a plane object.
+    *
+    * @param device    The DRM device the plane belongs to.
+    * @param allocator The allocator object that the plane will use.
+    * @param plane     The DRM plane.
+    * @param primary   Whether the plane is a primary plane.
+    *
+    * @return std::optional<drm_plane> containing a plane if initialization went well, otherwise std::nullopt.
     */
-   ~drm_display();
+   static std::optional<drm_plane> make_plane(drm_device &device, const util::allocator &allocator,
+                                              const drm_plane_owner &plane, bool primary);
+
+   /**
+    * @brief Limit on the number of distinct modifiers of a plane that @ref is_format_supported can report.
+    */
+   static constexpr size_t MAX_PLANE_MODIFIERS = 128;
+
+   /**
+    * @brief Set of the plane modifiers a format supports, indexed as @ref supported_formats::modifiers.
+    */
+   using modifier_mask = std::bitset<MAX_PLANE_MODIFIERS>;
+
+   /**
+    * @brief The formats supported by a plane, loaded on first use.
+    */
+   struct supported_formats
+   {
+      supported_formats(const util::allocator &allocator)
+         : formats(allocator)
+         , modifiers(allocator)
+         , format_modifiers(allocator)
+      {
+      }
+
+      /**
+       * @brief Guards loading the formats, which is only done once.
+       */
+      std::once_flag loaded;
+
+      /**
+       * @brief Vector of supported formats for use with the plane.
+       */
+      util::vector<drm_format_pair> formats;
+
+      /**
+       * @brief The distinct modifiers of @ref formats, sorted.
+       */
+      util::vector<uint64_t> modifiers;
+
+      /**
+       * @brief The modifiers supported with each fourcc, for @ref is_format_supported.
+       */
+      util::flat_map<uint32_t, modifier_mask> format_modifiers;
+
+      /**
+       * @brief Index @ref formats into @ref modifiers and @ref format_modifiers.
+       *
+       * @return false if the host is out of memory.
+       */
+      bool build_index();
+   };
+
+   drm_plane(const drm_device &device, uint32_t plane_id, uint32_t possible_crtcs, bool primary,
+             util::unique_ptr<supported_formats> formats,
+             std::optional<drm_atomic_plane_properties> atomic_plane_properties);
+
+   /**
+    * @brief Get the supported formats of the plane, querying them from the DRM device on first use.
+    *
+    * Reading the IN_FORMATS blob of every plane is deferred until swapchains or format queries need them, so that
+    * enumerating the displays stays cheap.
+    */
+   const supported_formats &get_formats() const;
+
+   /**
+    * @brief The DRM device the plane belongs to.
+    */
+   const drm_device *m_device;
+
+   /**
+    * @brief Id of the plane.
+    */
+   uint32_t m_plane_id;
+
+   /**
+    * @brief Mask of the indices of the CRTCs the plane can scan out from.
+    */
+   uint32_t m_possible_crtcs;
+
+   /**
+    * @brief Whether the plane is a primary plane.
+    */
+   bool m_primary;
+
+   /**
+    * @brief The supported formats of the plane, see @ref get_formats.
+    */
+   util::unique_ptr<supported_formats> m_supported_formats;
+
+   /**
+    * @brief Properties for atomic page flips, or std::nullopt if the plane only supports the legacy KMS API.
+    */
+   std::optional<drm_atomic_plane_properties> m_atomic_plane_properties;
+
+   /**
+    * @brief The display the page flip of the plane is queued, or about to be queued, on. nullptr if none.
+    *
+    * Only one commit can be in flight on a CRTC, so a plane can only start a page flip once no other plane of the
+    * display has one in flight. The page flip state is protected by the event mutex of the device.
+    */
+   const drm_display *m_page_flip_display{ nullptr };
+
+   /**
+    * @brief The flip group the page flip of the plane is part of, 0 if none.
+    *
+    * Planes of the same flip group share their commit, so they can start page flips on the same display.
+    */
+   uint64_t m_page_flip_group_id{ 0 };
+
+   /**
+    * @brief Set by the page flip event of the CRTC once the page flip in flight has completed.
+    */
+   bool m_page_flip_complete{ false };
+
+   /**
+    * @brief Vblank sequence number of the last completed page flip.
+    */
+   uint32_t m_page_flip_sequence{ 0 };
+
+   /**
+    * @brief CLOCK_MONOTONIC time, in nanoseconds, of the vblank of the last completed page flip.
+    */
+   uint64_t m_page_flip_time{ 0 };
+
+   /**
+    * @brief The flip group the plane waits in, 0 if none. Protected by the flip group mutex of the device.
+    */
+   uint64_t m_flip_group_id{ 0 };
+
+   /**
+    * @brief The display, framebuffer and placement to flip to with the commit of @ref m_flip_group_id.
+    */
+   const drm_display *m_flip_group_display{ nullptr };
+   uint32_t m_flip_group_fb_id{ 0 };
+   drm_plane_placement m_flip_group_placement{};
+
+   /**
+    * @brief The sync FD the commit of @ref m_flip_group_id waits for, owned by the swapchain queuing the page flip.
+    */
+   int m_flip_group_in_fence_fd{ -1 };
+};
+
+/**
+ * @brief The vulkan's display object.
+ * The display class wraps a VkDisplayKHR, one for each connected connector of the DRM device. Each display is
+ * driven by its own CRTC and primary plane.
+ */
+class drm_display
+{
+public:
+   drm_display(drm_display &&other) = default;
+
+   drm_display &operator=(drm_display &&other) = default;
 
    /**
     * @brief Get the display modes begin pointer.
@@ -223,6 +610,19 @@ public:
     */
    size_t get_num_display_modes() const;
 
+   /**
+    * @brief Check whether a display mode belongs to this display.
+    *
+    * @param mode The display mode.
+    * @return true if @p mode is one of the display modes of this display, otherwise false.
+    */
+   bool owns_display_mode(const drm_display_mode *mode) const;
+
+   /**
+    * @brief Get the DRM device the display is connected to.
+    */
+   drm_device &get_device() const;
+
    /**
     * @brief Get function for drm device file descriptor.
     *
@@ -245,81 +645,161 @@ public:
    drmModeConnector *get_connector() const;
 
    /**
-    * @brief Get drm resources.
+    * @brief Query the display for support for adding framebuffers with format modifiers.
     *
-    * @return The drm resources pointer.
+    * @return true if supported, otherwise false.
     */
-   drmModeResPtr get_drm_resources() const;
+   bool supports_fb_modifiers() const;
 
    /**
-    * @brief Get the supported formats for the display.
+    * @brief Returns the CRTC driving this display's connector, which no other display uses.
     *
-    * @return Pointer to vector of supported formats.
+    * @return The CRTC id.
     */
-   const util::vector<drm_format_pair> *get_supported_formats() const;
+   int get_crtc_id() const;
 
    /**
-    * @brief Query the display for support for adding framebuffers with format modifiers.
-    *
-    * @return true if supported, otherwise false.
+    * @brief Get the index of the CRTC in the DRM resources, as used by the possible CRTCs of planes.
     */
-   bool supports_fb_modifiers() const;
+   uint32_t get_crtc_index() const;
+
+   /**
+    * @brief Get the primary plane the display scans out from, which no other display uses.
+    */
+   drm_plane &get_primary_plane() const;
+
+   /**
+    * @brief Get the max width of the display in pixels.
+    */
+   uint32_t get_max_width() const;
+
+   /**
+    * @brief Get the max height of the display in pixels.
+    */
+   uint32_t get_max_height() const;
+
+   /**
+    * @brief Get the cache of the framebuffers created on the display's DRM device.
+    */
+   drm_framebuffer_cache &get_framebuffer_cache() const;
+
+   /**
+    * @brief Whether the panel supports variable refresh rates and the CRTC can enable them with an atomic commit.
+    */
+   bool supports_adaptive_sync() const;
+
+   /**
+    * @brief Whether variable refresh rates are enabled on the CRTC.
+    */
+   bool is_adaptive_sync_enabled() const;
 
    /**
-    * @brief Query the display for support of a specific format and modifier combination.
+    * @brief Enable or disable variable refresh rates on the CRTC.
     *
-    * @param format The format to query support for.
-    * @return true if the format is supported by the display, otherwise false.
+    * With variable refresh rates enabled, a page flip is scanned out as soon as it is queued, provided it is within
+    * the refresh rate range of the panel, instead of on the next fixed rate vblank. The display must support
+    * adaptive sync and the caller must have started a page flip of a plane of the display with
+    * @ref drm_device::begin_page_flip, so that no other commit is in flight on the CRTC.
+    *
+    * @param enable Whether to enable variable refresh rates.
+    *
+    * @return true on success, otherwise false with the CRTC unchanged.
     */
-   bool is_format_supported(const drm_format_pair &format) const;
+   bool set_adaptive_sync(bool enable);
+
+   /**
+    * @brief Whether atomic commits can return a fence signalled once they have been scanned out.
+    */
+   bool supports_out_fence() const;
 
    /**
-    * @brief Returns a CRTC compatible with this display's connector.
+    * @brief Ask for the OUT_FENCE_PTR fence of the CRTC in an atomic request.
     *
-    * @return The CRTC id.
+    * Once the request is committed, the kernel stores a sync FD in @p out_fence_fd that is signalled when the new
+    * framebuffers are scanned out, i.e. when the ones they replace are no longer read. The display must support out
+    * fences and @p out_fence_fd must stay valid until the commit returns.
+    *
+    * @param request      The atomic request.
+    * @param out_fence_fd Where the kernel stores the sync FD, which the caller becomes responsible for closing.
+    *
+    * @return true on success, false when out of memory.
     */
-   int get_crtc_id() const;
+   bool add_out_fence_to_atomic_request(drmModeAtomicReq *request, int32_t *out_fence_fd) const;
 
    /**
-    * @brief Get the max width of the display in pixels.
+    * @brief Whether the mode of the display can be set with an atomic commit, see @ref set_mode_atomic.
     */
-   uint32_t get_max_width() const;
+   bool supports_atomic_mode_set() const;
 
    /**
-    * @brief Get the max height of the display in pixels.
+    * @brief Set the mode of the display with an atomic commit that also flips a plane to a framebuffer.
+    *
+    * Unlike drmModeSetCrtc, the framebuffer does not have to cover the mode, as the plane can scale it. The display
+    * must support atomic mode sets and the caller must have started a page flip of the plane with
+    * @ref drm_device::begin_page_flip. Blocks until the commit has been applied.
+    *
+    * @param mode      The mode to set.
+    * @param plane     The plane to flip, which must support atomic mode setting.
+    * @param fb_id     The framebuffer to scan out.
+    * @param placement Where the framebuffer is scanned out on the display.
+    *
+    * @return 0 on success, otherwise a negative value with errno set.
     */
-   uint32_t get_max_height() const;
+   int set_mode_atomic(const drm_display_mode &mode, const drm_plane &plane, uint32_t fb_id,
+                       const drm_plane_placement &placement);
 
 private:
+   friend class drm_device;
+
    /**
-    * @brief display constructor.
+    * @brief Construct and initialize the display of a connector.
+    *
+    * @param device        The DRM device the connector belongs to.
+    * @param allocator     The allocator object that the display will use.
+    * @param connector     The connected connector.
+    * @param crtc_id       The CRTC driving the connector.
+    * @param crtc_index    The index of the CRTC in the DRM resources.
+    * @param primary_plane The primary plane scanning out from the CRTC.
     *
-    * @param allocator The allocator that the display will use.
+    * @return std::optional<drm_display> containing a display if initialization went well, otherwise std::nullopt.
     */
-   drm_display(util::fd_owner drm_fd, int crtc_id, drm_connector_owner drm_connector,
-               util::unique_ptr<util::vector<drm_format_pair>> supported_formats,
-               util::unique_ptr<drm_display_mode> display_modes, size_t num_display_modes, uint32_t max_width,
-               uint32_t max_height, bool supports_fb_modifiers);
+   static std::optional<drm_display> make_display(drm_device &device, const util::allocator &allocator,
+                                                  drm_connector_owner connector, int crtc_id, uint32_t crtc_index,
+                                                  drm_plane &primary_plane);
 
    /**
-    * @brief File descriptor for the display device.
+    * @brief display constructor.
     */
-   util::fd_owner m_drm_fd;
+   drm_display(drm_device &device, int crtc_id, uint32_t crtc_index, drm_plane &primary_plane,
+               drm_connector_owner drm_connector, util::unique_ptr<drm_display_mode> display_modes,
+               size_t num_display_modes, uint32_t max_width, uint32_t max_height, uint32_t vrr_enabled_property,
+               bool adaptive_sync_enabled, uint32_t out_fence_ptr_property,
+               const drm_atomic_mode_set_properties &mode_set_properties);
 
    /**
-    * @brief Id of CRTC compatible with the chosen connector.
+    * @brief The DRM device the display is connected to, which owns the display.
+    */
+   drm_device *m_device;
+
+   /**
+    * @brief Id of the CRTC driving the connector.
     */
    int m_crtc_id;
 
    /**
-    * @brief Handle to the drm connector.
+    * @brief Index of @ref m_crtc_id in the DRM resources.
     */
-   drm_connector_owner m_drm_connector;
+   uint32_t m_crtc_index;
+
+   /**
+    * @brief The primary plane scanning out from @ref m_crtc_id, owned by the device.
+    */
+   drm_plane *m_primary_plane;
 
    /**
-    * @brief Vector of supported formats for use with the display.
+    * @brief Handle to the drm connector.
     */
-   util::unique_ptr<util::vector<drm_format_pair>> m_supported_formats;
+   drm_connector_owner m_drm_connector;
 
    /**
     * @brief Pointer to available display modes for the connected display.
@@ -342,9 +822,359 @@ private:
    uint32_t m_max_height;
 
    /**
-    * @brief Flag to indicate if the display supports framebuffers with format modifiers.
+    * @brief Id of the VRR_ENABLED property of the CRTC, 0 if the display does not support adaptive sync.
+    */
+   uint32_t m_vrr_enabled_property;
+
+   /**
+    * @brief Whether variable refresh rates are enabled on the CRTC, as last committed.
+    */
+   bool m_adaptive_sync_enabled;
+
+   /**
+    * @brief Id of the OUT_FENCE_PTR property of the CRTC, 0 if atomic commits cannot return fences.
+    */
+   uint32_t m_out_fence_ptr_property;
+
+   /**
+    * @brief Ids of the properties setting the mode with an atomic commit, 0 if the mode can only be set with
+    * drmModeSetCrtc.
+    */
+   drm_atomic_mode_set_properties m_mode_set_properties;
+};
+
+/**
+ * @brief The DRM device driving the displays.
+ *
+ * Owns the file descriptor of the DRM device, a display for each of its connected connectors and the planes
+ * swapchains can scan out from. Page flip events of all the displays are read from the same file descriptor, so
+ * they are dispatched here to the planes flipped on their CRTC. With atomic mode setting, swapchains presented
+ * together can flip in a single commit, so that all their planes update on the same vblank.
+ */
+class drm_device : private util::noncopyable
+{
+public:
+   /**
+    * @brief Get the DRM device, opening it on first use.
+    *
+    * The device node is taken from the WSI_DISPLAY_DRI_DEV environment variable, /dev/dri/card0 by default.
+    *
+    * @return The device, or nullptr if it could not be opened or none of its connectors can be driven.
+    */
+   static drm_device *get_device();
+
+   /**
+    * @brief drm_device constructor, the device is not usable before @ref init succeeds.
+    *
+    * @param allocator The allocator that the device will use.
+    * @param drm_fd    File descriptor of the DRM device, which must be the DRM master.
+    */
+   drm_device(const util::allocator &allocator, util::fd_owner drm_fd);
+
+   /**
+    * @brief drm_device destructor.
+    */
+   ~drm_device();
+
+   /**
+    * @brief Get the file descriptor of the DRM device.
+    */
+   int get_drm_fd() const;
+
+   /**
+    * @brief Query the device for support for adding framebuffers with format modifiers.
+    */
+   bool supports_fb_modifiers() const;
+
+   /**
+    * @brief Get the key of the persistent cache entries of the device.
+    *
+    * It hashes the identity and version of the DRM driver, so entries are not reused after a driver update. Only
+    * valid if util::is_persistent_cache_enabled returns true.
+    */
+   uint64_t get_persistent_cache_key() const;
+
+   /**
+    * @brief Query the device for support for atomic mode setting.
+    */
+   bool supports_atomic_modesetting() const;
+
+   /**
+    * @brief Query the device for support for legacy page flips that do not wait for vblank.
+    */
+   bool supports_async_page_flip() const;
+
+   /**
+    * @brief Query the device for support for atomic commits that do not wait for vblank.
+    */
+   bool supports_atomic_async_page_flip() const;
+
+   /**
+    * @brief Get the cache of the framebuffers created on the device.
+    */
+   drm_framebuffer_cache &get_framebuffer_cache() const;
+
+   /**
+    * @brief Get the number of displays of the device, which is at least 1.
+    */
+   size_t get_num_displays() const;
+
+   /**
+    * @brief Get a display of the device.
+    *
+    * @param index The index of the display, less than @ref get_num_displays.
+    */
+   drm_display &get_display(size_t index);
+
+   /**
+    * @brief Find the display a display mode belongs to.
+    *
+    * @return The display, or nullptr if the mode does not belong to any display of the device.
+    */
+   drm_display *find_display(const drm_display_mode *mode);
+
+   /**
+    * @brief Get the number of planes of the device.
+    */
+   size_t get_num_planes() const;
+
+   /**
+    * @brief Get a plane of the device.
+    *
+    * The first @ref get_num_displays planes are the primary planes of the displays, in the same order, and the
+    * others are overlay planes.
+    *
+    * @param index The index of the plane, less than @ref get_num_planes.
+    */
+   drm_plane &get_plane(size_t index);
+
+   /**
+    * @brief Start a page flip of a plane, before it is queued.
+    *
+    * Only one commit can be in flight on a CRTC, so this waits for the page flips in flight on the display's CRTC,
+    * unless they are part of the same flip group.
+    *
+    * @param plane    The plane to flip.
+    * @param display  The display the plane scans out to.
+    * @param group_id The flip group the page flip will be committed with, 0 if it is committed on its own.
+    *
+    * @return false if the events of the device could not be read, otherwise true.
+    */
+   bool begin_page_flip(drm_plane &plane, const drm_display &display, uint64_t group_id);
+
+   /**
+    * @brief Stop tracking a page flip started by @ref begin_page_flip that has not been queued.
+    */
+   void cancel_page_flip(drm_plane &plane);
+
+   /**
+    * @brief Wait for the page flip of a plane started by @ref begin_page_flip to complete.
+    *
+    * Page flip events are read by one waiting thread at a time, which dispatches them to the planes of all the
+    * waiting threads.
+    *
+    * @param plane             The plane the page flip was queued on.
+    * @param[out] sequence     The vblank sequence number of the page flip.
+    * @param[out] vblank_time  CLOCK_MONOTONIC time of the vblank in nanoseconds.
+    *
+    * @return false if the events of the device could not be read, otherwise true.
+    */
+   bool wait_for_page_flip(drm_plane &plane, uint32_t &sequence, uint64_t &vblank_time);
+
+   /**
+    * @brief Queue a page flip of a plane in a single atomic commit with the other members of a flip group.
+    *
+    * Blocks until all the members of the group have joined or left it, or until @ref FLIP_GROUP_TIMEOUT_NS has
+    * elapsed, in which case the members that have joined are committed without the others. The page flip must have
+    * been started with @ref begin_page_flip for the group and completes as for any other page flip, see
+    * @ref wait_for_page_flip.
+    *
+    * @param group_id   The id of the flip group, which must not be 0.
+    * @param group_size The number of swapchains in the group.
+    * @param plane      The plane to flip, which must support atomic mode setting.
+    * @param display    The display the plane scans out to.
+    * @param fb_id       The framebuffer to scan out.
+    * @param placement   Where the framebuffer is scanned out on the display.
+    * @param in_fence_fd Sync FD the kernel waits for before scanning out the framebuffer, -1 if none. See
+    *                    @ref drm_plane::add_to_atomic_request.
+    *
+    * @return true if the page flip has been queued, false if the caller has to queue it on its own, for instance
+    *         because it joined too late or the commit failed.
+    */
+   bool queue_group_page_flip(uint64_t group_id, uint32_t group_size, drm_plane &plane, const drm_display &display,
+                              uint32_t fb_id, const drm_plane_placement &placement, int in_fence_fd);
+
+   /**
+    * @brief Leave a flip group without flipping, so that its other members do not wait for this one.
+    *
+    * @param group_id   The id of the flip group, which must not be 0.
+    * @param group_size The number of swapchains in the group.
+    */
+   void leave_page_flip_group(uint64_t group_id, uint32_t group_size);
+
+   /**
+    * @brief Time the members of a flip group wait for the latecomers, in nanoseconds.
+    */
+   static constexpr uint64_t FLIP_GROUP_TIMEOUT_NS = 50000000;
+
+private:
+   /**
+    * @brief Open the displays of the connected connectors and the overlay planes.
+    *
+    * @return VK_SUCCESS if at least one display is usable, otherwise an error code.
+    */
+   VkResult init();
+
+   /**
+    * @brief Wait for and dispatch the page flip events of the device, or for another thread to do so.
+    *
+    * @param lock The lock of @ref m_event_mutex, which is held on entry and on return.
+    *
+    * @return false if the events of the device could not be read, otherwise true.
+    */
+   bool handle_events(std::unique_lock<std::mutex> &lock);
+
+   /**
+    * @brief The state of the presents of a vkQueuePresentKHR call that flip together.
+    */
+   struct page_flip_group
+   {
+      enum class state
+      {
+         GATHERING,
+         COMMITTED,
+         FAILED,
+      };
+
+      uint64_t id;
+      /* Number of members that have neither joined nor left the group yet. */
+      uint32_t remaining;
+      /* Number of members blocked in queue_group_page_flip. */
+      uint32_t waiting;
+      state group_state;
+      /* CLOCK_MONOTONIC time, in nanoseconds, after which the members that have joined are committed. */
+      uint64_t deadline;
+   };
+
+   /**
+    * @brief Find the flip group with an id, creating it if there is none.
+    *
+    * Must be called with @ref m_flip_group_mutex held.
+    *
+    * @return The group, or nullptr when out of memory.
+    */
+   page_flip_group *get_flip_group(uint64_t group_id, uint32_t group_size);
+
+   /**
+    * @brief Flip the planes that have joined a flip group in a single atomic commit.
+    *
+    * Must be called with @ref m_flip_group_mutex held.
+    */
+   void commit_flip_group(page_flip_group &group);
+
+   /**
+    * @brief Forget the flip groups no member uses anymore.
+    *
+    * Must be called with @ref m_flip_group_mutex held.
+    */
+   void purge_flip_groups();
+
+   /**
+    * @brief Find the display driven by a CRTC.
+    *
+    * @return The display, or nullptr if no display of the device uses the CRTC.
+    */
+   drm_display *find_display_by_crtc(uint32_t crtc_id);
+
+   /**
+    * @brief DRM page flip event handler.
+    *
+    * @param user_data The display the page flip was queued on, used when the kernel does not report the CRTC.
+    */
+   static void page_flip_event(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec,
+                               unsigned int crtc_id, void *user_data);
+
+   util::allocator m_allocator;
+
+   /**
+    * @brief File descriptor for the DRM device.
+    */
+   util::fd_owner m_drm_fd;
+
+   /**
+    * @brief Flag to indicate if the device supports framebuffers with format modifiers.
     */
    bool m_supports_fb_modifiers;
+
+   /**
+    * @brief Key of the persistent cache entries of the device, see @ref get_persistent_cache_key.
+    */
+   uint64_t m_persistent_cache_key;
+
+   /**
+    * @brief Flag to indicate if atomic mode setting has been enabled on the device.
+    */
+   bool m_supports_atomic_modesetting;
+
+   /**
+    * @brief Flag to indicate if the device supports DRM_MODE_PAGE_FLIP_ASYNC with the legacy page flip API.
+    */
+   bool m_supports_async_page_flip;
+
+   /**
+    * @brief Flag to indicate if the device supports DRM_MODE_PAGE_FLIP_ASYNC with atomic commits.
+    */
+   bool m_supports_atomic_async_page_flip;
+
+   /**
+    * @brief Framebuffers created on @ref m_drm_fd. Declared after it so that it is destroyed first.
+    */
+   util::unique_ptr<drm_framebuffer_cache> m_framebuffer_cache;
+
+   /**
+    * @brief The displays of the device. Not modified after @ref init, so pointers to the displays remain valid.
+    */
+   util::vector<drm_display> m_displays;
+
+   /**
+    * @brief The planes of the device, see @ref get_plane. Not modified after @ref init either.
+    */
+   util::vector<drm_plane> m_planes;
+
+   /**
+    * @brief Protects the page flip state of the planes and @ref m_event_reader_active.
+    */
+   std::mutex m_event_mutex;
+
+   /**
+    * @brief Signalled when the thread reading the page flip events has dispatched them.
+    */
+   std::condition_variable m_event_condition;
+
+   /**
+    * @brief Whether a thread is reading the page flip events of the device.
+    */
+   bool m_event_reader_active;
+
+   /**
+    * @brief eventfd waking up the thread reading the page flip events, may be invalid.
+    */
+   util::fd_owner m_event_wake_fd;
+
+   /**
+    * @brief Protects @ref m_flip_groups and the flip group membership of the planes.
+    */
+   std::mutex m_flip_group_mutex;
+
+   /**
+    * @brief Signalled when a flip group is committed.
+    */
+   std::condition_variable m_flip_group_condition;
+
+   /**
+    * @brief The flip groups that members have joined or left.
+    */
+   util::vector<page_flip_group> m_flip_groups;
 };
 
 } /* namespace display */
@@ -35,8 +35,10 @@ namespace wsi
 namespace display
 {
 
-surface::surface(drm_display_mode *display_mode, VkExtent2D extent)
-   : m_display_mode(display_mode)
+surface::surface(drm_display *display, drm_plane *plane, drm_display_mode *display_mode, VkExtent2D extent)
+   : m_display(display)
+   , m_plane(plane)
+   , m_display_mode(display_mode)
    , m_extent(extent)
    , m_surface_properties(this)
 {
@@ -64,5 +66,21 @@ drm_display_mode *surface::get_display_mode()
    return m_display_mode;
 }
 
+drm_display *surface::get_display()
+{
+   return m_display;
+}
+
+drm_plane *surface::get_plane()
+{
+   return m_plane;
+}
+
+bool surface::supports_present_scaling() const
+{
+   /* drmModeSetCrtc needs a framebuffer covering the mode, so scaled primary planes need an atomic mode set. */
+   return m_plane->supports_scaling() && (!m_plane->is_primary() || m_display->supports_atomic_mode_set());
+}
+
 } /* namespace display */
 } /* namespace wsi */
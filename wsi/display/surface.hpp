@@ -43,10 +43,12 @@ public:
    /**
     * @brief Construct a new surface.
     *
+    * @param display The display the surface is presented on.
+    * @param plane The plane the surface is scanned out on.
     * @param mode The display mode to be used with the surface.
     * @param extent The extent of the surface.
     */
-   surface(drm_display_mode *mode, VkExtent2D extent);
+   surface(drm_display *display, drm_plane *plane, drm_display_mode *mode, VkExtent2D extent);
 
    wsi::surface_properties &get_properties() override;
    util::unique_ptr<swapchain_base> allocate_swapchain(layer::device_private_data &dev_data,
@@ -62,7 +64,33 @@ public:
     */
    drm_display_mode *get_display_mode();
 
+   /**
+    * @brief Get the display the surface is presented on.
+    */
+   drm_display *get_display();
+
+   /**
+    * @brief Get the plane the surface is scanned out on.
+    */
+   drm_plane *get_plane();
+
+   /**
+    * @brief Whether swapchain images smaller than the surface can be scaled by the plane, rather than scanned out at
+    * their own size.
+    */
+   bool supports_present_scaling() const;
+
 private:
+   /**
+    * @brief The display the surface is presented on, which owns @ref m_display_mode.
+    */
+   drm_display *m_display;
+
+   /**
+    * @brief The plane the surface is scanned out on, which can scan out to @ref m_display.
+    */
+   drm_plane *m_plane;
+
    /**
     * @brief Pointer to the DRM display mode used with this surface.
     */
@@ -39,14 +39,26 @@ constexpr int max_core_1_0_formats = VK_FORMAT_ASTC_12x12_SRGB_BLOCK + 1;
 
 void surface_properties::populate_present_mode_compatibilities()
 {
-   std::array<present_mode_compatibility, 1> compatible_present_modes_list = { present_mode_compatibility{
-      VK_PRESENT_MODE_FIFO_KHR, 1, { VK_PRESENT_MODE_FIFO_KHR } } };
-   m_compatible_present_modes = compatible_present_modes<1>(compatible_present_modes_list);
+   std::array<present_mode_compatibility, 6> compatible_present_modes_list = {
+      present_mode_compatibility{
+         VK_PRESENT_MODE_FIFO_KHR, 2, { VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR } },
+      present_mode_compatibility{
+         VK_PRESENT_MODE_FIFO_RELAXED_KHR, 2, { VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR } },
+      present_mode_compatibility{ VK_PRESENT_MODE_MAILBOX_KHR, 1, { VK_PRESENT_MODE_MAILBOX_KHR } },
+      present_mode_compatibility{ VK_PRESENT_MODE_IMMEDIATE_KHR, 1, { VK_PRESENT_MODE_IMMEDIATE_KHR } },
+      present_mode_compatibility{
+         VK_PRESENT_MODE_SHARED_DEMAND_REFRESH_KHR, 1, { VK_PRESENT_MODE_SHARED_DEMAND_REFRESH_KHR } },
+      present_mode_compatibility{
+         VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR, 1, { VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR } }
+   };
+   m_compatible_present_modes = compatible_present_modes<6>(compatible_present_modes_list);
 }
 
 surface_properties::surface_properties(surface *wsi_surface)
    : m_specific_surface(wsi_surface)
-   , m_supported_modes({ VK_PRESENT_MODE_FIFO_KHR })
+   , m_supported_modes({ VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_MAILBOX_KHR,
+                         VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_SHARED_DEMAND_REFRESH_KHR,
+                         VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR })
 {
    populate_present_mode_compatibilities();
 }
@@ -88,6 +100,16 @@ VkResult surface_properties::get_surface_capabilities(VkPhysicalDevice physical_
    /* Image count limits */
    get_surface_capabilities(physical_device, &pSurfaceCapabilities->surfaceCapabilities);
 
+   /* Shared present modes scan out a single image, which the application renders into while it is on screen. */
+   const auto *present_mode =
+      util::find_extension<VkSurfacePresentModeEXT>(VK_STRUCTURE_TYPE_SURFACE_PRESENT_MODE_EXT, pSurfaceInfo);
+   if (present_mode != nullptr && (present_mode->presentMode == VK_PRESENT_MODE_SHARED_DEMAND_REFRESH_KHR ||
+                                   present_mode->presentMode == VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR))
+   {
+      pSurfaceCapabilities->surfaceCapabilities.minImageCount = 1;
+      pSurfaceCapabilities->surfaceCapabilities.maxImageCount = 1;
+   }
+
    m_compatible_present_modes.get_surface_present_mode_compatibility_common(pSurfaceInfo, pSurfaceCapabilities);
 
    auto surface_scaling_capabilities = util::find_extension<VkSurfacePresentScalingCapabilitiesEXT>(
@@ -97,6 +119,11 @@ VkResult surface_properties::get_surface_capabilities(VkPhysicalDevice physical_
       get_surface_present_scaling_and_gravity(surface_scaling_capabilities);
       surface_scaling_capabilities->minScaledImageExtent = pSurfaceCapabilities->surfaceCapabilities.minImageExtent;
       surface_scaling_capabilities->maxScaledImageExtent = pSurfaceCapabilities->surfaceCapabilities.maxImageExtent;
+      if (m_specific_surface != nullptr && m_specific_surface->supports_present_scaling())
+      {
+         /* The display controller upscales smaller images to the surface, which costs no GPU time. */
+         surface_scaling_capabilities->minScaledImageExtent = { 1, 1 };
+      }
    }
 
    return VK_SUCCESS;
@@ -106,13 +133,24 @@ VkResult surface_properties::get_surface_formats(VkPhysicalDevice physical_devic
                                                  VkSurfaceFormatKHR *surfaceFormats,
                                                  VkSurfaceFormat2KHR *extended_surface_formats)
 {
-   auto &display = drm_display::get_display();
-   if (!display.has_value())
+   drm_device *device = drm_device::get_device();
+   if (device == nullptr)
    {
       return VK_ERROR_SURFACE_LOST_KHR;
    }
 
-   auto display_formats = display->get_supported_formats();
+   /* Without a surface, report the formats of the primary plane of the first display. */
+   const drm_plane *plane = m_specific_surface != nullptr ? m_specific_surface->get_plane() : &device->get_plane(0);
+
+   const std::lock_guard<std::mutex> lock(m_surface_formats_cache_mutex);
+   if (m_surface_formats_cache.physical_device == physical_device)
+   {
+      return surface_properties_formats_helper(m_surface_formats_cache.formats.begin(),
+                                               m_surface_formats_cache.formats.end(), surfaceFormatCount,
+                                               surfaceFormats, extended_surface_formats);
+   }
+
+   auto display_formats = plane->get_supported_formats();
 
    uint32_t format_count = 0;
 
@@ -176,10 +214,26 @@ VkResult surface_properties::get_surface_formats(VkPhysicalDevice physical_devic
       }
    }
 
+   cache_surface_formats(physical_device, formats.data(), formats.data() + format_count);
+
    return surface_properties_formats_helper(formats.begin(), formats.begin() + format_count, surfaceFormatCount,
                                             surfaceFormats, extended_surface_formats);
 }
 
+void surface_properties::cache_surface_formats(VkPhysicalDevice physical_device,
+                                               const surface_format_properties *begin,
+                                               const surface_format_properties *end)
+{
+   m_surface_formats_cache.physical_device = VK_NULL_HANDLE;
+   m_surface_formats_cache.formats.clear();
+   if (!m_surface_formats_cache.formats.try_push_back_many(begin, end))
+   {
+      m_surface_formats_cache.formats.clear();
+      return;
+   }
+   m_surface_formats_cache.physical_device = physical_device;
+}
+
 VkResult surface_properties::get_surface_present_modes(VkPhysicalDevice physical_device, VkSurfaceKHR surface,
                                                        uint32_t *pPresentModeCount, VkPresentModeKHR *pPresentModes)
 {
@@ -238,11 +292,30 @@ CreateDisplayPlaneSurfaceKHR(VkInstance instance, const VkDisplaySurfaceCreateIn
 
    drm_display_mode *display_mode = reinterpret_cast<drm_display_mode *>(pCreateInfo->displayMode);
 
+   drm_device *device = drm_device::get_device();
+   drm_display *display = device != nullptr ? device->find_display(display_mode) : nullptr;
+   if (display == nullptr)
+   {
+      WSI_LOG_ERROR("DRM display not available.");
+      return VK_ERROR_INITIALIZATION_FAILED;
+   }
+
+   /* A primary plane only scans out to its own display, overlay planes to any display of their CRTCs. */
+   const uint32_t plane_index = pCreateInfo->planeIndex;
+   drm_plane *plane = plane_index < device->get_num_planes() ? &device->get_plane(plane_index) : nullptr;
+   const bool plane_usable = plane != nullptr && (plane->is_primary() ? plane == &display->get_primary_plane() :
+                                                                        plane->can_scan_out(*display));
+   if (!plane_usable)
+   {
+      WSI_LOG_ERROR("Plane %u cannot be used with the display.", plane_index);
+      return VK_ERROR_INITIALIZATION_FAILED;
+   }
+
    VkResult res = instance_data.disp.CreateDisplayPlaneSurfaceKHR(instance, pCreateInfo, pAllocator, pSurface);
    if (res == VK_SUCCESS)
    {
 
-      auto wsi_surface = allocator.make_unique<surface>(display_mode, pCreateInfo->imageExtent);
+      auto wsi_surface = allocator.make_unique<surface>(display, plane, display_mode, pCreateInfo->imageExtent);
       if (wsi_surface == nullptr)
       {
          return VK_ERROR_OUT_OF_HOST_MEMORY;
@@ -314,25 +387,19 @@ GetDisplayPlaneCapabilitiesKHR(VkPhysicalDevice physicalDevice, VkDisplayModeKHR
    drm_display_mode *display_mode = reinterpret_cast<drm_display_mode *>(mode);
    assert(display_mode != nullptr);
 
-   auto &display = drm_display::get_display();
-   if (!display.has_value())
+   drm_device *device = drm_device::get_device();
+   if (device == nullptr)
    {
       WSI_LOG_ERROR("DRM display not available.");
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
 
-   /* Implementation supports only one plane for presenting
-    * images. Therefore plane index must be 0. */
-   assert(planeIndex == 0);
+   /* Implementation exposes the primary plane of each display, in the order of the displays, then the overlay
+    * planes. */
+   assert(planeIndex < device->get_num_planes());
+   const bool primary = device->get_plane(planeIndex).is_primary();
 
-   auto valid_mode =
-      std::find_if(display->get_display_modes_begin(), display->get_display_modes_end(), [&display_mode](auto &mode) {
-         return (display_mode->get_width() == mode.get_width()) && (display_mode->get_height() == mode.get_height()) &&
-                (display_mode->get_refresh_rate() == mode.get_refresh_rate());
-      });
-
-   assert(valid_mode != display->get_display_modes_end());
-   UNUSED(valid_mode);
+   assert(device->find_display(display_mode) != nullptr);
 
    VkDisplayPlaneCapabilitiesKHR planeCapabilities{};
    planeCapabilities.supportedAlpha = VK_DISPLAY_PLANE_ALPHA_OPAQUE_BIT_KHR;
@@ -343,7 +410,9 @@ GetDisplayPlaneCapabilitiesKHR(VkPhysicalDevice physicalDevice, VkDisplayModeKHR
    planeCapabilities.maxSrcExtent = { display_mode->get_width(), display_mode->get_height() };
    planeCapabilities.minDstPosition = { 0, 0 };
    planeCapabilities.maxDstPosition = { 0, 0 };
-   planeCapabilities.minDstExtent = { display_mode->get_width(), display_mode->get_height() };
+   /* Overlay planes are placed in the top left corner of the display, at the size of the swapchain images. */
+   planeCapabilities.minDstExtent = primary ? VkExtent2D{ display_mode->get_width(), display_mode->get_height() } :
+                                              VkExtent2D{ 1, 1 };
    planeCapabilities.maxDstExtent = { display_mode->get_width(), display_mode->get_height() };
 
    *pCapabilities = planeCapabilities;
@@ -358,34 +427,42 @@ GetDisplayPlaneSupportedDisplaysKHR(VkPhysicalDevice physicalDevice, uint32_t pl
    assert(physicalDevice != VK_NULL_HANDLE);
    assert(pDisplayCount != nullptr);
 
-   auto &display = drm_display::get_display();
-   if (!display.has_value())
+   drm_device *device = drm_device::get_device();
+   if (device == nullptr)
    {
       WSI_LOG_ERROR("DRM display not available.");
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
 
-   /* Implementation supports only one plane for presenting
-    * images. Therefore plane index must be 0. */
-   assert(planeIndex == 0);
+   /* A primary plane can only be used with its display, an overlay plane with the displays of its CRTCs. */
+   assert(planeIndex < device->get_num_planes());
+   const drm_plane &plane = device->get_plane(planeIndex);
 
-   if (pDisplays == nullptr)
+   uint32_t num_displays = 0;
+   uint32_t nr_displays = 0;
+   for (size_t i = 0; i < device->get_num_displays(); i++)
    {
-      /* Implementation will expose just one (the main)
-       * plane for the application to use. */
-      *pDisplayCount = 1;
-      return VK_SUCCESS;
+      drm_display &display = device->get_display(i);
+      if (plane.is_primary() ? &plane != &display.get_primary_plane() : !plane.can_scan_out(display))
+      {
+         continue;
+      }
+
+      if (pDisplays != nullptr && nr_displays < *pDisplayCount)
+      {
+         pDisplays[nr_displays++] = reinterpret_cast<VkDisplayKHR>(&display);
+      }
+      num_displays++;
    }
 
-   if (*pDisplayCount == 0)
+   if (pDisplays == nullptr)
    {
-      return VK_INCOMPLETE;
+      *pDisplayCount = num_displays;
+      return VK_SUCCESS;
    }
 
-   *pDisplays = reinterpret_cast<VkDisplayKHR>(&display.value());
-   *pDisplayCount = 1;
-
-   return VK_SUCCESS;
+   *pDisplayCount = nr_displays;
+   return nr_displays < num_displays ? VK_INCOMPLETE : VK_SUCCESS;
 }
 
 VWL_VKAPI_CALL(VkResult)
@@ -395,37 +472,44 @@ GetPhysicalDeviceDisplayPlanePropertiesKHR(VkPhysicalDevice physicalDevice, uint
    assert(physicalDevice != VK_NULL_HANDLE);
    assert(pPropertyCount != nullptr);
 
-   auto &display = drm_display::get_display();
-   if (!display.has_value())
+   drm_device *device = drm_device::get_device();
+   if (device == nullptr)
    {
       WSI_LOG_ERROR("DRM display not available.");
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
 
+   /* Implementation exposes the primary plane of each display and the overlay planes for the application to use. */
+   const uint32_t num_planes = static_cast<uint32_t>(device->get_num_planes());
    if (pProperties == nullptr)
    {
-      /* Implementation will expose just one (the main)
-       * plane for the application to use. */
-      *pPropertyCount = 1;
+      *pPropertyCount = num_planes;
       return VK_SUCCESS;
    }
 
-   if (*pPropertyCount == 0)
+   const uint32_t nr_properties = std::min(*pPropertyCount, num_planes);
+   for (uint32_t i = 0; i < nr_properties; i++)
    {
-      return VK_INCOMPLETE;
-   }
-
-   VkDisplayPlanePropertiesKHR planeProperties{};
-   planeProperties.currentDisplay = reinterpret_cast<VkDisplayKHR>(&display.value());
+      VkDisplayPlanePropertiesKHR planeProperties{};
 
-   /* Since the implementation is exposing just one plane the value for
-    * the current stack index must be 0.*/
-   planeProperties.currentStackIndex = 0;
+      /* The primary planes are at the bottom of the stack of their display, overlay planes are stacked above and
+       * are not associated with a display until a surface is created for them. */
+      if (device->get_plane(i).is_primary())
+      {
+         planeProperties.currentDisplay = reinterpret_cast<VkDisplayKHR>(&device->get_display(i));
+         planeProperties.currentStackIndex = 0;
+      }
+      else
+      {
+         planeProperties.currentDisplay = VK_NULL_HANDLE;
+         planeProperties.currentStackIndex = 1;
+      }
 
-   *pProperties = planeProperties;
-   *pPropertyCount = 1;
+      pProperties[i] = planeProperties;
+   }
+   *pPropertyCount = nr_properties;
 
-   return VK_SUCCESS;
+   return nr_properties < num_planes ? VK_INCOMPLETE : VK_SUCCESS;
 }
 
 VWL_VKAPI_CALL(VkResult)
@@ -435,39 +519,40 @@ GetPhysicalDeviceDisplayPropertiesKHR(VkPhysicalDevice physicalDevice, uint32_t
    assert(physicalDevice != VK_NULL_HANDLE);
    assert(pPropertyCount != nullptr);
 
-   auto &display = drm_display::get_display();
+   drm_device *device = drm_device::get_device();
 
-   if (!display.has_value())
+   if (device == nullptr)
    {
       *pPropertyCount = 0;
       return VK_SUCCESS;
    }
 
+   const uint32_t num_displays = static_cast<uint32_t>(device->get_num_displays());
    if (pProperties == nullptr)
    {
-      *pPropertyCount = 1;
+      *pPropertyCount = num_displays;
       return VK_SUCCESS;
    }
 
-   if (*pPropertyCount == 0)
+   const uint32_t nr_properties = std::min(*pPropertyCount, num_displays);
+   for (uint32_t i = 0; i < nr_properties; i++)
    {
-      return VK_INCOMPLETE;
+      drm_display &display = device->get_display(i);
+
+      VkDisplayPropertiesKHR display_properties = {};
+      display_properties.display = reinterpret_cast<VkDisplayKHR>(&display);
+      display_properties.displayName = "DRM display";
+      display_properties.physicalDimensions = { display.get_connector()->mmWidth, display.get_connector()->mmHeight };
+      display_properties.physicalResolution = { display.get_max_width(), display.get_max_height() };
+      display_properties.supportedTransforms = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+      display_properties.planeReorderPossible = VK_FALSE;
+      display_properties.persistentContent = VK_FALSE;
+
+      pProperties[i] = display_properties;
    }
+   *pPropertyCount = nr_properties;
 
-   *pPropertyCount = 1;
-
-   VkDisplayPropertiesKHR display_properties = {};
-   display_properties.display = reinterpret_cast<VkDisplayKHR>(&display.value());
-   display_properties.displayName = "DRM display";
-   display_properties.physicalDimensions = { display->get_connector()->mmWidth, display->get_connector()->mmHeight };
-   display_properties.physicalResolution = { display->get_max_width(), display->get_max_height() };
-   display_properties.supportedTransforms = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
-   display_properties.planeReorderPossible = VK_FALSE;
-   display_properties.persistentContent = VK_FALSE;
-
-   *pProperties = display_properties;
-
-   return VK_SUCCESS;
+   return nr_properties < num_displays ? VK_INCOMPLETE : VK_SUCCESS;
 }
 
 PFN_vkVoidFunction surface_properties::get_proc_addr(const char *name)
@@ -526,18 +611,19 @@ VkResult surface_properties::get_required_device_extensions(util::extension_list
 
 bool surface_properties::is_surface_extension_enabled(const layer::instance_private_data &instance_data)
 {
-   return instance_data.is_instance_extension_enabled(VK_KHR_SURFACE_EXTENSION_NAME);
+   return instance_data.is_instance_extension_enabled(util::known_extension::KHR_surface);
 }
 
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
 void surface_properties::get_present_timing_surface_caps(
    VkPresentTimingSurfaceCapabilitiesEXT *present_timing_surface_caps)
 {
-   present_timing_surface_caps->presentTimingSupported = VK_FALSE;
-   present_timing_surface_caps->presentAtAbsoluteTimeSupported = VK_FALSE;
-   present_timing_surface_caps->presentAtRelativeTimeSupported = VK_FALSE;
-   present_timing_surface_caps->presentStageQueries = 0;
-   present_timing_surface_caps->presentStageTargets = 0;
+   present_timing_surface_caps->presentTimingSupported = VK_TRUE;
+   present_timing_surface_caps->presentAtAbsoluteTimeSupported = VK_TRUE;
+   present_timing_surface_caps->presentAtRelativeTimeSupported = VK_TRUE;
+   present_timing_surface_caps->presentStageQueries =
+      VK_PRESENT_STAGE_QUEUE_OPERATIONS_END_BIT_EXT | VK_PRESENT_STAGE_IMAGE_FIRST_PIXEL_OUT_BIT_EXT;
+   present_timing_surface_caps->presentStageTargets = VK_PRESENT_STAGE_IMAGE_FIRST_PIXEL_OUT_BIT_EXT;
 }
 #endif
 
@@ -551,6 +637,19 @@ surface_properties &surface_properties::get_instance()
 void surface_properties::get_surface_present_scaling_and_gravity(
    VkSurfacePresentScalingCapabilitiesEXT *scaling_capabilities)
 {
+   /* Planes are scaled and positioned with the SRC_* and CRTC_* properties of atomic commits. */
+   if (m_specific_surface != nullptr && m_specific_surface->supports_present_scaling())
+   {
+      constexpr VkPresentGravityFlagsEXT all_gravity =
+         VK_PRESENT_GRAVITY_MIN_BIT_EXT | VK_PRESENT_GRAVITY_MAX_BIT_EXT | VK_PRESENT_GRAVITY_CENTERED_BIT_EXT;
+      scaling_capabilities->supportedPresentScaling = VK_PRESENT_SCALING_ONE_TO_ONE_BIT_EXT |
+                                                      VK_PRESENT_SCALING_ASPECT_RATIO_STRETCH_BIT_EXT |
+                                                      VK_PRESENT_SCALING_STRETCH_BIT_EXT;
+      scaling_capabilities->supportedPresentGravityX = all_gravity;
+      scaling_capabilities->supportedPresentGravityY = all_gravity;
+      return;
+   }
+
    scaling_capabilities->supportedPresentScaling = VK_PRESENT_SCALING_ONE_TO_ONE_BIT_EXT;
    scaling_capabilities->supportedPresentGravityX = VK_PRESENT_GRAVITY_MIN_BIT_EXT;
    scaling_capabilities->supportedPresentGravityY = VK_PRESENT_GRAVITY_MIN_BIT_EXT;
@@ -26,6 +26,8 @@
 
 #include <vulkan/vulkan_core.h>
 
+#include <mutex>
+
 #include "wsi/surface_properties.hpp"
 #include "drm_display.hpp"
 #include "wsi/compatible_present_modes.hpp"
@@ -78,10 +80,35 @@ private:
    surface *const m_specific_surface;
 
    /* List of supported presentation modes */
-   std::array<VkPresentModeKHR, 1> m_supported_modes;
+   std::array<VkPresentModeKHR, 6> m_supported_modes;
 
    /* Stores compatible presentation modes */
-   compatible_present_modes<1> m_compatible_present_modes;
+   compatible_present_modes<6> m_compatible_present_modes;
+
+   /**
+    * @brief Surface formats of the display, as last computed for a physical device.
+    *
+    * The display is opened once for the lifetime of the layer, so the formats only depend on the physical device.
+    * Applications query the formats at least twice, for the count and for the contents, so the list of the last
+    * physical device is kept instead of checking the device support of every format again.
+    */
+   struct surface_formats_cache
+   {
+      VkPhysicalDevice physical_device{ VK_NULL_HANDLE };
+      util::vector<surface_format_properties> formats{ util::allocator::get_generic() };
+   };
+
+   /* Protects m_surface_formats_cache, surfaces can be queried from any thread. */
+   std::mutex m_surface_formats_cache_mutex;
+   surface_formats_cache m_surface_formats_cache;
+
+   /**
+    * @brief Store the surface formats computed for a physical device in @ref m_surface_formats_cache.
+    *
+    * Best effort, the cache is left empty if the host is out of memory.
+    */
+   void cache_surface_formats(VkPhysicalDevice physical_device, const surface_format_properties *begin,
+                              const surface_format_properties *end);
 
    void get_surface_present_scaling_and_gravity(VkSurfacePresentScalingCapabilitiesEXT *scaling_capabilities) override;
    void populate_present_mode_compatibilities() override;
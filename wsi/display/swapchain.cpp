@@ -35,7 +35,19 @@
 #include "surface.hpp"
 #include "util/macros.hpp"
 
+#include <cinttypes>
 #include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <utility>
+#include <array>
+
+#include "layer/wsi_layer_experimental.hpp"
+#include "util/log.hpp"
+#include "util/timed_semaphore.hpp"
+#include "util/trace.hpp"
+
 namespace wsi
 {
 
@@ -46,8 +58,26 @@ swapchain::swapchain(layer::device_private_data &dev_data, const VkAllocationCal
                      surface &wsi_surface)
    : wsi::swapchain_base(dev_data, pAllocator)
    , m_wsi_allocator(nullptr)
+   , m_preallocated_buffers(m_allocator)
+   , m_display(wsi_surface.get_display())
+   , m_plane(wsi_surface.get_plane())
    , m_display_mode(wsi_surface.get_display_mode())
+   , m_surface_extent(wsi_surface.get_extent())
+   , m_plane_placement()
    , m_image_creation_parameters({}, m_allocator, {}, {})
+   , m_use_atomic_commit(false)
+   , m_use_adaptive_sync(false)
+   , m_use_async_page_flip(false)
+   , m_page_flip_in_flight(std::nullopt)
+   , m_page_flip_queue_time(0)
+   , m_last_flip_sequence(std::nullopt)
+   , m_last_flip_time(0)
+   , m_missed_vblanks(0)
+   , m_use_in_fence(false)
+   , m_use_out_fence(false)
+   , m_page_flip_waits_for_fence(false)
+   , m_presented_image_released(false)
+   , m_use_dirty_fb(true)
 {
    m_image_create_info.format = VK_FORMAT_UNDEFINED;
 }
@@ -57,22 +87,69 @@ swapchain::~swapchain()
    /* Call the base class teardown */
    teardown();
 
+   /* Leave the display at its fixed refresh rate, a later swapchain enables variable refresh rates again. */
+   if (m_use_adaptive_sync && m_display->is_adaptive_sync_enabled() &&
+       m_display->get_device().begin_page_flip(*m_plane, *m_display, 0))
+   {
+      m_display->set_adaptive_sync(false);
+      m_display->get_device().cancel_page_flip(*m_plane);
+   }
+
    /* Free WSI allocator. */
    if (m_wsi_allocator != nullptr)
    {
+      /* Buffers preallocated for images that were never created. */
+      for (const auto &buffer : m_preallocated_buffers)
+      {
+         wsialloc_release(m_wsi_allocator, get_wsialloc_heap_flags(), buffer.buffer_fds);
+      }
+      m_preallocated_buffers.clear();
+
       wsialloc_delete(m_wsi_allocator);
    }
    m_wsi_allocator = nullptr;
 }
 
-static void page_flip_event(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec, void *user_data)
+void swapchain::record_page_flip(uint32_t sequence, uint64_t vblank_time)
 {
-   UNUSED(fd);
-   UNUSED(sequence);
-   UNUSED(tv_sec);
-   UNUSED(tv_usec);
-   bool *done = (bool *)user_data;
-   *done = true;
+   /* A flip queued within a refresh cycle of the previous one should land on the very next vblank. Flips queued later
+    * only wait for the application, so their gaps are not counted as missed. */
+   if (m_last_flip_sequence.has_value() && m_page_flip_queue_time < m_last_flip_time + get_refresh_interval())
+   {
+      const uint32_t missed = sequence - *m_last_flip_sequence - 1;
+      if (missed != 0 && missed < UINT32_MAX / 2)
+      {
+         m_missed_vblanks += missed;
+         WSI_LOG_INFO("Page flip missed %u vblank(s), %" PRIu64 " missed in total.", missed, m_missed_vblanks);
+      }
+   }
+   m_last_flip_sequence = sequence;
+   m_last_flip_time = vblank_time;
+
+   if (m_page_flip_in_flight.has_value())
+   {
+      WSI_TRACE_INSTANT("page flip completed swapchain=%p present_id=%" PRIu64 " image=%u sequence=%u",
+                        static_cast<void *>(this), m_page_flip_in_flight->present_id,
+                        m_page_flip_in_flight->image_index, sequence);
+      if (m_page_flip_in_flight->present_id != 0)
+      {
+         WSI_TRACE_END_ASYNC(m_page_flip_in_flight->present_id, "frame swapchain=%p", static_cast<void *>(this));
+      }
+   }
+
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+   if (m_page_flip_in_flight.has_value())
+   {
+      if (m_page_flip_waits_for_fence)
+      {
+         /* The kernel does not report when the fence signalled, only that it had by the time of the flip. */
+         set_present_stage_time(m_page_flip_in_flight->present_id, VK_PRESENT_STAGE_QUEUE_OPERATIONS_END_BIT_EXT,
+                                vblank_time);
+      }
+      set_present_stage_time(m_page_flip_in_flight->present_id, VK_PRESENT_STAGE_IMAGE_FIRST_PIXEL_OUT_BIT_EXT,
+                             vblank_time);
+   }
+#endif
 }
 
 VkResult swapchain::init_platform(VkDevice device, const VkSwapchainCreateInfoKHR *swapchain_create_info,
@@ -86,9 +163,126 @@ VkResult swapchain::init_platform(VkDevice device, const VkSwapchainCreateInfoKH
       return VK_ERROR_INITIALIZATION_FAILED;
    }
 
+   m_use_atomic_commit = m_plane->supports_atomic_modesetting();
+   m_use_adaptive_sync = m_plane->is_primary() && m_display->supports_adaptive_sync();
+
+   const drm_device &drm_dev = m_display->get_device();
+   m_use_async_page_flip = m_plane->is_primary() &&
+                           (drm_dev.supports_async_page_flip() ||
+                            (m_use_atomic_commit && drm_dev.supports_atomic_async_page_flip()));
+
+   /* The kernel can only wait for sync FDs, which the present timeline cannot be exported to. Per image fences are
+    * preferred then, so that the page flip thread does not have to wait for the present payloads. */
+   m_use_in_fence = m_use_atomic_commit && m_plane->get_atomic_plane_properties().in_fence_fd_property != 0 &&
+                    m_device_data.is_device_extension_enabled(util::known_extension::KHR_external_fence_fd) &&
+                    sync_fd_fence_sync::is_supported(m_device_data.instance_data, m_device_data.physical_device);
+   m_use_out_fence = m_use_atomic_commit && m_display->supports_out_fence();
+
+   init_plane_placement(swapchain_create_info->imageExtent);
+
+   if (!m_use_in_fence && timeline_semaphore_sync::is_supported(m_device_data))
+   {
+      m_present_timeline = timeline_semaphore_sync::create(m_device_data);
+      if (!m_present_timeline.has_value())
+      {
+         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+   }
+
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+   /* Page flip events carry CLOCK_MONOTONIC timestamps of the vblank the image is first scanned out on. */
+   std::array<util::unique_ptr<wsi::vulkan_time_domain>, 2> time_domains_array = {
+      m_allocator.make_unique<wsi::vulkan_time_domain>(VK_PRESENT_STAGE_QUEUE_OPERATIONS_END_BIT_EXT,
+                                                       VK_TIME_DOMAIN_DEVICE_KHR, &m_device_data),
+      m_allocator.make_unique<wsi::vulkan_time_domain>(VK_PRESENT_STAGE_IMAGE_FIRST_PIXEL_OUT_BIT_EXT,
+                                                       VK_TIME_DOMAIN_CLOCK_MONOTONIC_KHR),
+   };
+
+   for (auto &time_domain : time_domains_array)
+   {
+      if (!m_time_domains.m_time_domains.try_push_back(std::move(time_domain)))
+      {
+         WSI_LOG_ERROR("Failed to add a time domain to m_time_domains.");
+         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+   }
+#endif
+
    return VK_SUCCESS;
 }
 
+void swapchain::init_plane_placement(const VkExtent2D &image_extent)
+{
+   /* Overlay planes scan out the images unscaled from the top left corner of the display. Primary planes keep the
+    * position of the mode set. */
+   m_plane_placement.source = { { 0, 0 }, image_extent };
+   m_plane_placement.destination = { { 0, 0 }, image_extent };
+   m_plane_placement.positioned = !m_plane->is_primary();
+
+   const VkExtent2D &target = m_surface_extent;
+   if (m_present_scaling.scaling_behavior == 0 ||
+       (target.width == image_extent.width && target.height == image_extent.height))
+   {
+      return;
+   }
+
+   /* The scaling behavior was validated against the capabilities of the surface, which only report scaling when
+    * the plane can be positioned with atomic commits. */
+   assert(m_plane->supports_scaling());
+
+   VkRect2D &source = m_plane_placement.source;
+   VkRect2D &destination = m_plane_placement.destination;
+   switch (m_present_scaling.scaling_behavior)
+   {
+   case VK_PRESENT_SCALING_STRETCH_BIT_EXT:
+      destination.extent = target;
+      break;
+   case VK_PRESENT_SCALING_ASPECT_RATIO_STRETCH_BIT_EXT:
+      destination.extent = get_aspect_ratio_stretch_extent(image_extent, target);
+      break;
+   case VK_PRESENT_SCALING_ONE_TO_ONE_BIT_EXT:
+      /* Images larger than the surface are cropped, keeping the part the gravity points to. */
+      source.extent.width = std::min(image_extent.width, target.width);
+      source.extent.height = std::min(image_extent.height, target.height);
+      source.offset.x =
+         get_present_gravity_offset(image_extent.width, source.extent.width, m_present_scaling.gravity_x);
+      source.offset.y =
+         get_present_gravity_offset(image_extent.height, source.extent.height, m_present_scaling.gravity_y);
+      destination.extent = source.extent;
+      break;
+   default:
+      return;
+   }
+
+   destination.offset.x =
+      get_present_gravity_offset(target.width, destination.extent.width, m_present_scaling.gravity_x);
+   destination.offset.y =
+      get_present_gravity_offset(target.height, destination.extent.height, m_present_scaling.gravity_y);
+   m_plane_placement.positioned = true;
+}
+
+uint64_t swapchain::get_refresh_interval() const
+{
+   /* The refresh rate is in mHz. */
+   const uint64_t refresh_rate = m_display_mode->get_refresh_rate();
+   return refresh_rate != 0 ? 1000000000000ull / refresh_rate : 0;
+}
+
+const void *swapchain::get_present_group(const swapchain_presentation_parameters &presentation_parameters) const
+{
+   const VkPresentModeKHR present_mode = presentation_parameters.switch_presentation_mode ?
+                                            presentation_parameters.present_mode :
+                                            m_requested_present_mode;
+   if (!m_plane->supports_atomic_modesetting() || present_mode == VK_PRESENT_MODE_MAILBOX_KHR ||
+       present_mode == VK_PRESENT_MODE_IMMEDIATE_KHR)
+   {
+      return nullptr;
+   }
+
+   /* Planes of the same device can be flipped by a single atomic commit, across displays. */
+   return &m_display->get_device();
+}
+
 VkResult swapchain::bind_swapchain_image(VkDevice &device, const VkBindImageMemoryInfo *bind_image_mem_info,
                                          const VkBindImageMemorySwapchainInfoKHR *bind_sc_info)
 {
@@ -100,96 +294,60 @@ VkResult swapchain::bind_swapchain_image(VkDevice &device, const VkBindImageMemo
 VkResult swapchain::get_surface_compatible_formats(const VkImageCreateInfo &info,
                                                    util::vector<wsialloc_format> &importable_formats,
                                                    util::vector<uint64_t> &exportable_modifers,
-                                                   util::vector<VkDrmFormatModifierPropertiesEXT> &drm_format_props)
+                                                   util::drm_format_properties_list &drm_format_props)
 {
    TRY_LOG(util::get_drm_format_properties(m_device_data.physical_device, info.format, drm_format_props),
            "Failed to get format properties");
 
-   auto &display = drm_display::get_display();
-   if (!display.has_value())
-   {
-      WSI_LOG_ERROR("DRM display not available.");
-      return VK_ERROR_OUT_OF_HOST_MEMORY;
-   }
+#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
+   VkImageCompressionControlEXT compression_control = {};
+   compression_control.sType = VK_STRUCTURE_TYPE_IMAGE_COMPRESSION_CONTROL_EXT;
+   compression_control.flags = m_image_compression_control_params.flags;
+   compression_control.compressionControlPlaneCount =
+      m_image_compression_control_params.compression_control_plane_count;
+   compression_control.pFixedRateFlags = m_image_compression_control_params.fixed_rate_flags.data();
+
+   /* Only the compression control of the pNext chain affects the query. It is left out without any request for
+    * compression, which also covers devices without the feature enabled unless the layer chose to compress. */
+   VkImageCreateInfo query_info = info;
+   query_info.pNext =
+      m_image_compression_control_params.flags != VK_IMAGE_COMPRESSION_DEFAULT_EXT ? &compression_control : nullptr;
+#else
+   const VkImageCreateInfo &query_info = info;
+#endif
 
    for (const auto &prop : drm_format_props)
    {
       drm_format_pair drm_format{ util::drm::vk_to_drm_format(info.format), prop.drmFormatModifier };
 
-      if (!display->is_format_supported(drm_format))
+      if (!m_plane->is_format_supported(drm_format))
       {
          continue;
       }
 
-      VkExternalImageFormatPropertiesKHR external_props = {};
-      external_props.sType = VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES_KHR;
-
-      VkImageFormatProperties2KHR format_props = {};
-      format_props.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2_KHR;
-      format_props.pNext = &external_props;
-
-      VkResult result = VK_SUCCESS;
-      {
-         VkPhysicalDeviceExternalImageFormatInfoKHR external_info = {};
-         external_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO_KHR;
-         external_info.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
-
-         VkPhysicalDeviceImageDrmFormatModifierInfoEXT drm_mod_info = {};
-         drm_mod_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_DRM_FORMAT_MODIFIER_INFO_EXT;
-         drm_mod_info.pNext = &external_info;
-         drm_mod_info.drmFormatModifier = prop.drmFormatModifier;
-         drm_mod_info.sharingMode = info.sharingMode;
-         drm_mod_info.queueFamilyIndexCount = info.queueFamilyIndexCount;
-         drm_mod_info.pQueueFamilyIndices = info.pQueueFamilyIndices;
-
-         VkPhysicalDeviceImageFormatInfo2KHR image_info = {};
-         image_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2_KHR;
-         image_info.pNext = &drm_mod_info;
-         image_info.format = info.format;
-         image_info.type = info.imageType;
-         image_info.tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT;
-         image_info.usage = info.usage;
-         image_info.flags = info.flags;
-
-#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
-         VkImageCompressionControlEXT compression_control = {};
-         compression_control.sType = VK_STRUCTURE_TYPE_IMAGE_COMPRESSION_CONTROL_EXT;
-         compression_control.flags = m_image_compression_control_params.flags;
-         compression_control.compressionControlPlaneCount =
-            m_image_compression_control_params.compression_control_plane_count;
-         compression_control.pFixedRateFlags = m_image_compression_control_params.fixed_rate_flags.data();
-
-         if (m_device_data.is_swapchain_compression_control_enabled())
-         {
-            compression_control.pNext = image_info.pNext;
-            image_info.pNext = &compression_control;
-         }
-#endif
-         result = m_device_data.instance_data.disp.GetPhysicalDeviceImageFormatProperties2KHR(
-            m_device_data.physical_device, &image_info, &format_props);
-      }
+      util::drm_image_format_properties props = {};
+      VkResult result = util::get_drm_image_format_properties(m_device_data.physical_device, query_info,
+                                                              prop.drmFormatModifier, props);
       if (result != VK_SUCCESS)
       {
          continue;
       }
-      if (format_props.imageFormatProperties.maxExtent.width < info.extent.width ||
-          format_props.imageFormatProperties.maxExtent.height < info.extent.height ||
-          format_props.imageFormatProperties.maxExtent.depth < info.extent.depth)
+      const VkImageFormatProperties &format_props = props.image_format_properties;
+      if (format_props.maxExtent.width < info.extent.width || format_props.maxExtent.height < info.extent.height ||
+          format_props.maxExtent.depth < info.extent.depth)
       {
          continue;
       }
-      if (format_props.imageFormatProperties.maxMipLevels < info.mipLevels ||
-          format_props.imageFormatProperties.maxArrayLayers < info.arrayLayers)
+      if (format_props.maxMipLevels < info.mipLevels || format_props.maxArrayLayers < info.arrayLayers)
       {
          continue;
       }
-      if ((format_props.imageFormatProperties.sampleCounts & info.samples) != info.samples)
+      if ((format_props.sampleCounts & info.samples) != info.samples)
       {
          continue;
       }
 
-      if (external_props.externalMemoryProperties.externalMemoryFeatures &
-          VK_EXTERNAL_MEMORY_FEATURE_EXPORTABLE_BIT_KHR)
+      if (props.external_memory_features & VK_EXTERNAL_MEMORY_FEATURE_EXPORTABLE_BIT_KHR)
       {
          if (!exportable_modifers.try_push_back(drm_format.modifier))
          {
@@ -197,8 +355,7 @@ VkResult swapchain::get_surface_compatible_formats(const VkImageCreateInfo &info
          }
       }
 
-      if (external_props.externalMemoryProperties.externalMemoryFeatures &
-          VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT_KHR)
+      if (props.external_memory_features & VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT_KHR)
       {
          uint64_t flags =
             (prop.drmFormatModifierTilingFeatures & VK_FORMAT_FEATURE_DISJOINT_BIT) ? 0 : WSIALLOC_FORMAT_NON_DISJOINT;
@@ -213,6 +370,84 @@ VkResult swapchain::get_surface_compatible_formats(const VkImageCreateInfo &info
    return VK_SUCCESS;
 }
 
+uint64_t swapchain::get_wsialloc_heap_flags() const
+{
+   /* Display swapchain images are always scanned out directly. */
+   const bool is_protected_memory = (m_image_create_info.flags & VK_IMAGE_CREATE_PROTECTED_BIT) != 0;
+   return (is_protected_memory ? WSIALLOC_ALLOCATE_PROTECTED : 0) | WSIALLOC_ALLOCATE_SCANOUT;
+}
+
+void swapchain::release_wsialloc_buffer(const std::array<int, MAX_PLANES> &buffer_fds, bool recycle)
+{
+   if (m_wsi_allocator == nullptr)
+   {
+      assert(std::all_of(buffer_fds.begin(), buffer_fds.end(), [](int fd) { return fd < 0; }));
+      return;
+   }
+
+   if (recycle)
+   {
+      wsialloc_release(m_wsi_allocator, get_wsialloc_heap_flags(), buffer_fds.data());
+      return;
+   }
+
+   for (int fd : buffer_fds)
+   {
+      if (fd >= 0)
+      {
+         close(fd);
+      }
+   }
+}
+
+VkResult swapchain::allocate_wsialloc_batch(const wsialloc_allocate_info &alloc_info, bool avoid_allocation,
+                                            wsialloc_allocate_result &alloc_result)
+{
+   /* While the swapchain is created, the images that are not created yet need buffers with the same allocation info,
+    * so they are allocated together with this one. Deferred allocations have no such images. */
+   uint32_t count = 1;
+   if (!avoid_allocation)
+   {
+      count += count_images_with_status(swapchain_image::INVALID);
+   }
+
+   util::vector<wsialloc_allocate_result> results(util::allocator(m_allocator, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND));
+   if (!results.try_resize(count))
+   {
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+   for (auto &result : results)
+   {
+      /* Clear buffer_fds and average_row_strides for error purposes */
+      std::fill(std::begin(result.buffer_fds), std::end(result.buffer_fds), -1);
+      std::fill(std::begin(result.average_row_strides), std::end(result.average_row_strides), -1);
+   }
+
+   const auto res = wsialloc_alloc_batch(m_wsi_allocator, &alloc_info, count, results.data());
+   if (res != WSIALLOC_ERROR_NONE)
+   {
+      WSI_LOG_ERROR("Failed allocation of DMA Buffer. WSI error: %d", static_cast<int>(res));
+      if (res == WSIALLOC_ERROR_NOT_SUPPORTED)
+      {
+         return VK_ERROR_FORMAT_NOT_SUPPORTED;
+      }
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+
+   alloc_result = results[0];
+   const std::lock_guard<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+   for (uint32_t i = 1; i < count; i++)
+   {
+      /* Images left without a preallocated buffer allocate their own. */
+      if (!m_preallocated_buffers.try_push_back(results[i]))
+      {
+         wsialloc_release(m_wsi_allocator, alloc_info.flags, results[i].buffer_fds);
+      }
+   }
+
+   return VK_SUCCESS;
+}
+
 VkResult swapchain::allocate_wsialloc(VkImageCreateInfo &image_create_info, display_image_data *image_data,
                                       util::vector<wsialloc_format> &importable_formats,
                                       wsialloc_format *allocated_format, bool avoid_allocation)
@@ -223,6 +458,11 @@ VkResult swapchain::allocate_wsialloc(VkImageCreateInfo &image_create_info, disp
    {
       allocation_flags |= WSIALLOC_ALLOCATE_NO_MEMORY;
    }
+   else
+   {
+      /* Swapchain images have undefined contents, so buffers of destroyed swapchains can be reused. */
+      allocation_flags |= WSIALLOC_ALLOCATE_RECYCLE | get_wsialloc_heap_flags();
+   }
 
 #if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
    if (m_image_compression_control_params.flags & VK_IMAGE_COMPRESSION_FIXED_RATE_EXPLICIT_EXT)
@@ -235,20 +475,22 @@ VkResult swapchain::allocate_wsialloc(VkImageCreateInfo &image_create_info, disp
                                          image_create_info.extent.width, image_create_info.extent.height,
                                          allocation_flags };
    wsialloc_allocate_result alloc_result = { 0 };
-   /* Clear buffer_fds and average_row_strides for error purposes */
-   for (int i = 0; i < WSIALLOC_MAX_PLANES; ++i)
-   {
-      alloc_result.buffer_fds[i] = -1;
-   }
-   const auto res = wsialloc_alloc(m_wsi_allocator, &alloc_info, &alloc_result);
-   if (res != WSIALLOC_ERROR_NONE)
+   bool preallocated = false;
+   if (!avoid_allocation)
    {
-      WSI_LOG_ERROR("Failed allocation of DMA Buffer. WSI error: %d", static_cast<int>(res));
-      if (res == WSIALLOC_ERROR_NOT_SUPPORTED)
+      const std::lock_guard<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+      preallocated = !m_preallocated_buffers.empty();
+      if (preallocated)
       {
-         return VK_ERROR_FORMAT_NOT_SUPPORTED;
+         alloc_result = m_preallocated_buffers.back();
+         m_preallocated_buffers.pop_back();
       }
-      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+
+   /* The allocation is done without holding the image status lock, as it can take long. */
+   if (!preallocated)
+   {
+      TRY_LOG_CALL(allocate_wsialloc_batch(alloc_info, avoid_allocation, alloc_result));
    }
    *allocated_format = alloc_result.format;
    auto &external_memory = image_data->external_mem;
@@ -260,6 +502,12 @@ VkResult swapchain::allocate_wsialloc(VkImageCreateInfo &image_create_info, disp
 
    if (!avoid_allocation)
    {
+      /* Keep the buffer alive after the imported memory is freed, so that it can be given back to wsialloc. */
+      if (external_memory.retain_buffer_fds() != VK_SUCCESS)
+      {
+         WSI_LOG_WARNING("Failed to retain the buffer file descriptors, the buffer will not be recycled.");
+      }
+
       uint32_t num_memory_planes = 0;
 
       for (uint32_t i = 0; i < num_planes; ++i)
@@ -278,6 +526,7 @@ VkResult swapchain::allocate_wsialloc(VkImageCreateInfo &image_create_info, disp
 
    external_memory.set_format_info(alloc_result.is_disjoint, num_planes);
    external_memory.set_memory_handle_type(VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT);
+   external_memory.set_protected_memory(is_protected_memory);
    return VK_SUCCESS;
 }
 
@@ -304,112 +553,166 @@ static VkResult fill_image_create_info(VkImageCreateInfo &image_create_info,
 VkResult swapchain::allocate_image(VkImageCreateInfo &image_create_info, display_image_data *image_data)
 {
    util::vector<wsialloc_format> importable_formats(util::allocator(m_allocator, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND));
-   auto &m_allocated_format = m_image_creation_parameters.m_allocated_format;
-   if (!importable_formats.try_push_back(m_allocated_format))
+   std::unique_lock<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+   if (!importable_formats.try_push_back(m_image_creation_parameters.m_allocated_format))
    {
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
-   TRY_LOG_CALL(allocate_wsialloc(m_image_create_info, image_data, importable_formats, &m_allocated_format, false));
+   image_status_lock.unlock();
+
+   wsialloc_format allocated_format = {};
+   TRY_LOG_CALL(allocate_wsialloc(m_image_create_info, image_data, importable_formats, &allocated_format, false));
 
+   image_status_lock.lock();
+   m_image_creation_parameters.m_allocated_format = allocated_format;
    return VK_SUCCESS;
 }
 
 VkResult swapchain::create_framebuffer(const VkImageCreateInfo &image_create_info, swapchain_image &image,
                                        display_image_data *image_data)
 {
-   VkResult ret_code = VK_SUCCESS;
-   std::array<uint32_t, util::MAX_PLANES> strides{ 0, 0, 0, 0 };
-   std::array<uint64_t, util::MAX_PLANES> modifiers{ 0, 0, 0, 0 };
    const drm_format_pair allocated_format{ m_image_creation_parameters.m_allocated_format.fourcc,
                                            m_image_creation_parameters.m_allocated_format.modifier };
 
-   auto &display = drm_display::get_display();
-   if (!display.has_value())
+   if (!m_plane->is_format_supported(allocated_format))
    {
+      WSI_LOG_ERROR("Format not supported.");
       return VK_ERROR_INITIALIZATION_FAILED;
    }
 
-   drm_gem_handle_array<util::MAX_PLANES> buffer_handles{ display->get_drm_fd() };
+   drm_framebuffer_key key{};
+   key.format = allocated_format;
+   key.width = image_create_info.extent.width;
+   key.height = image_create_info.extent.height;
+   key.num_planes = image_data->external_mem.get_num_planes();
 
    const auto &buffer_fds = image_data->external_mem.get_buffer_fds();
-
-   for (uint32_t plane = 0; plane < image_data->external_mem.get_num_planes(); plane++)
+   for (uint32_t plane = 0; plane < key.num_planes; plane++)
    {
-      assert(image_data->external_mem.get_strides()[plane] > 0);
-      strides[plane] = image_data->external_mem.get_strides()[plane];
-      modifiers[plane] = allocated_format.modifier;
-      if (drmPrimeFDToHandle(display->get_drm_fd(), buffer_fds[plane], &buffer_handles[plane]) != 0)
+      /* The inode identifies the dma-buf, so buffers recycled across swapchains map to the same framebuffer. */
+      struct stat buffer_stat = {};
+      if (fstat(buffer_fds[plane], &buffer_stat) != 0)
       {
-         WSI_LOG_ERROR("Failed to convert buffer FD to GEM handle: %s", std::strerror(errno));
+         WSI_LOG_ERROR("Failed to stat buffer FD: %s", std::strerror(errno));
          return VK_ERROR_INITIALIZATION_FAILED;
       }
-   }
-
-   if (!display->is_format_supported(allocated_format))
-   {
-      WSI_LOG_ERROR("Format not supported.");
-      return VK_ERROR_INITIALIZATION_FAILED;
-   }
 
-   int error = 0;
-   if (display->supports_fb_modifiers())
-   {
-      error = drmModeAddFB2WithModifiers(
-         display->get_drm_fd(), image_create_info.extent.width, image_create_info.extent.height,
-         allocated_format.fourcc, buffer_handles.data(), strides.data(), image_data->external_mem.get_offsets().data(),
-         modifiers.data(), &image_data->fb_id, DRM_MODE_FB_MODIFIERS);
-   }
-   else
-   {
-      error = drmModeAddFB2(display->get_drm_fd(), image_create_info.extent.width, image_create_info.extent.height,
-                            allocated_format.fourcc, buffer_handles.data(), strides.data(),
-                            image_data->external_mem.get_offsets().data(), &image_data->fb_id, 0);
-   }
-
-   if (error != 0)
-   {
-      WSI_LOG_ERROR("Failed to create framebuffer: %s", strerror(errno));
-      return VK_ERROR_INITIALIZATION_FAILED;
+      assert(image_data->external_mem.get_strides()[plane] > 0);
+      key.inodes[plane] = buffer_stat.st_ino;
+      key.strides[plane] = image_data->external_mem.get_strides()[plane];
+      key.offsets[plane] = image_data->external_mem.get_offsets()[plane];
    }
 
-   return ret_code;
+   return m_display->get_framebuffer_cache().acquire(key, buffer_fds, image_data->fb_id);
 }
 
 VkResult swapchain::allocate_and_bind_swapchain_image(VkImageCreateInfo image_create_info, swapchain_image &image)
 {
-   std::unique_lock<std::recursive_mutex> image_status_lock(m_image_status_mutex);
-   image.status = swapchain_image::FREE;
+   {
+      const std::lock_guard<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+      set_image_status(image, swapchain_image::FREE);
+   }
    assert(image.data != nullptr);
    auto image_data = static_cast<display_image_data *>(image.data);
    TRY_LOG(allocate_image(image_create_info, image_data), "Failed to allocate image");
 
-   image_status_lock.unlock();
-
    TRY_LOG(create_framebuffer(image_create_info, image, image_data), "Failed to create framebuffer");
 
    TRY_LOG(image_data->external_mem.import_memory_and_bind_swapchain_image(image.image),
            "Failed to import memory and bind swapchain image");
 
-   /* Initialize presentation fence. */
-   auto present_fence = sync_fd_fence_sync::create(m_device_data);
-   if (!present_fence.has_value())
+   /* Initialize presentation fence, the present timeline replaces it when available. */
+   if (!m_present_timeline.has_value())
+   {
+      auto present_fence = sync_fd_fence_sync::create(m_device_data);
+      if (!present_fence.has_value())
+      {
+         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+      image_data->present_fence = std::move(present_fence.value());
+   }
+
+   return VK_SUCCESS;
+}
+
+bool swapchain::supports_parallel_image_creation() const
+{
+   return true;
+}
+
+bool swapchain::supports_image_handover(const swapchain_base &ancestor) const
+{
+   UNUSED(ancestor);
+   return true;
+}
+
+VkResult swapchain::adopt_ancestor_image(swapchain_base &ancestor, swapchain_image &ancestor_image,
+                                         const VkImageCreateInfo &image_create_info, swapchain_image &image)
+{
+   auto &ancestor_swapchain = static_cast<swapchain &>(ancestor);
+   auto ancestor_data = reinterpret_cast<display_image_data *>(ancestor_image.data);
+   assert(ancestor_data != nullptr && ancestor_data->fb_id != std::numeric_limits<uint32_t>::max());
+
+   auto image_data = create_image_data<display_image_data>(image, m_device, m_object_arena.get_allocator());
+   if (image_data == nullptr)
    {
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
-   image_data->present_fence = std::move(present_fence.value());
+   image_data->external_mem.take_over(ancestor_data->external_mem);
+
+   /* The images created after the ones taken over use the format and layout of the ancestor too. */
+   const bool first_adopted = m_image_create_info.format == VK_FORMAT_UNDEFINED;
+   const auto &allocated_format = ancestor_swapchain.m_image_creation_parameters.m_allocated_format;
+   VkImageCreateInfo adopted_create_info = first_adopted ? image_create_info : m_image_create_info;
+   VkResult res = VK_SUCCESS;
+   if (first_adopted)
+   {
+      res = fill_image_create_info(adopted_create_info, m_image_creation_parameters.m_image_layout,
+                                   m_image_creation_parameters.m_drm_mod_info,
+                                   m_image_creation_parameters.m_external_info, *image_data, allocated_format.modifier);
+   }
+   if (res == VK_SUCCESS)
+   {
+      res = m_device_data.disp.CreateImage(m_device, &adopted_create_info, get_allocation_callbacks(), &image.image);
+   }
+   if (res == VK_SUCCESS)
+   {
+      res = image_data->external_mem.bind_swapchain_image_memory(image.image);
+   }
+   if (res != VK_SUCCESS)
+   {
+      /* Give the memory back, so that the ancestor image is left as it was and this image is created from scratch. */
+      if (image.image != VK_NULL_HANDLE)
+      {
+         m_device_data.disp.DestroyImage(m_device, image.image, get_allocation_callbacks());
+         image.image = VK_NULL_HANDLE;
+      }
+      ancestor_data->external_mem.take_over(image_data->external_mem);
+      destroy_image_data<display_image_data>(image);
+      return res;
+   }
+
+   if (first_adopted)
+   {
+      m_image_create_info = adopted_create_info;
+      m_image_creation_parameters.m_allocated_format = allocated_format;
+   }
 
+   /* Swapchains of the same plane either all use the present timeline, in which case there is no fence, or none. */
+   image_data->present_fence = std::move(ancestor_data->present_fence);
+   image_data->release_fence = std::move(ancestor_data->release_fence);
+   image_data->fb_id = std::exchange(ancestor_data->fb_id, std::numeric_limits<uint32_t>::max());
    return VK_SUCCESS;
 }
 
 VkResult swapchain::create_swapchain_image(VkImageCreateInfo image_create_info, swapchain_image &image)
 {
    /* Create image_data */
-   auto image_data = m_allocator.create<display_image_data>(1, m_device, m_allocator);
+   auto image_data = create_image_data<display_image_data>(image, m_device, m_object_arena.get_allocator());
    if (image_data == nullptr)
    {
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
-   image.data = image_data;
 
    if (m_image_create_info.format == VK_FORMAT_UNDEFINED)
    {
@@ -418,11 +721,20 @@ VkResult swapchain::create_swapchain_image(VkImageCreateInfo image_create_info,
       util::vector<uint64_t> exportable_modifiers(util::allocator(m_allocator, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND));
 
       /* Query supported modifers. */
-      util::vector<VkDrmFormatModifierPropertiesEXT> drm_format_props(
+      util::drm_format_properties_list drm_format_props(
          util::allocator(m_allocator, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND));
 
       TRY_LOG_CALL(
          get_surface_compatible_formats(image_create_info, importable_formats, exportable_modifiers, drm_format_props));
+#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
+      if (importable_formats.empty() && drop_automatic_compression())
+      {
+         /* None of the modifiers of the surface supports the fixed rate the layer chose, carry on uncompressed. */
+         exportable_modifiers.clear();
+         TRY_LOG_CALL(get_surface_compatible_formats(image_create_info, importable_formats, exportable_modifiers,
+                                                     drm_format_props));
+      }
+#endif
 
       /* TODO: Handle exportable images which use ICD allocated memory in preference to an external allocator. */
       if (importable_formats.empty())
@@ -453,134 +765,600 @@ VkResult swapchain::create_swapchain_image(VkImageCreateInfo image_create_info,
    return m_device_data.disp.CreateImage(m_device, &m_image_create_info, get_allocation_callbacks(), &image.image);
 }
 
-void swapchain::present_image(const pending_present_request &pending_present)
+int swapchain::queue_async_page_flip(uint32_t fb_id, const util::fd_owner &in_fence)
 {
-   int drm_res = 0;
+   if (m_use_atomic_commit && m_display->get_device().supports_atomic_async_page_flip())
+   {
+      /* Asynchronous commits may only change the framebuffer of the primary plane, and its fence. */
+      const auto &properties = m_plane->get_atomic_plane_properties();
+      drm_atomic_req_owner request{ drmModeAtomicAlloc() };
+      if (request == nullptr ||
+          drmModeAtomicAddProperty(request.get(), properties.plane_id, properties.fb_id_property, fb_id) < 0 ||
+          (in_fence.is_valid() && drmModeAtomicAddProperty(request.get(), properties.plane_id,
+                                                           properties.in_fence_fd_property, in_fence.get()) < 0))
+      {
+         errno = ENOMEM;
+         return -1;
+      }
+
+      int drm_res =
+         drmModeAtomicCommit(m_display->get_drm_fd(), request.get(),
+                             DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_PAGE_FLIP_ASYNC, m_display);
+      if (drm_res == 0 || !m_display->get_device().supports_async_page_flip())
+      {
+         return drm_res;
+      }
+   }
+
+   if (util::wait_sync_fd(in_fence, -1) < 0)
+   {
+      return -1;
+   }
+   return drmModePageFlip(m_display->get_drm_fd(), m_display->get_crtc_id(), fb_id,
+                          DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_PAGE_FLIP_ASYNC, m_display);
+}
+
+int swapchain::queue_page_flip(uint32_t fb_id, bool async, const util::fd_owner &in_fence, util::fd_owner &out_fence,
+                               bool want_out_fence)
+{
+   if (async && m_use_async_page_flip)
+   {
+      int drm_res = queue_async_page_flip(fb_id, in_fence);
+      if (drm_res == 0 || errno == EBUSY)
+      {
+         return drm_res;
+      }
+
+      /* Drivers may reject asynchronous flips, e.g. between framebuffers with different modifiers. */
+      WSI_LOG_WARNING("Async page flip failed: %s, flipping on vblank.", std::strerror(errno));
+      m_use_async_page_flip = false;
+   }
+
+   /* The display is passed with the event for kernels that do not report the CRTC of page flips. */
+   if (m_use_atomic_commit)
+   {
+      drm_atomic_req_owner request{ drmModeAtomicAlloc() };
+      if (request == nullptr)
+      {
+         errno = ENOMEM;
+         return -1;
+      }
+
+      /* The kernel stores the out fence there when the commit succeeds. */
+      int32_t out_fence_fd = -1;
+      if (!m_plane->add_to_atomic_request(request.get(), *m_display, fb_id, m_plane_placement, in_fence.get()) ||
+          (want_out_fence && !m_display->add_out_fence_to_atomic_request(request.get(), &out_fence_fd)))
+      {
+         errno = ENOMEM;
+         return -1;
+      }
+
+      int drm_res = drmModeAtomicCommit(m_display->get_drm_fd(), request.get(),
+                                        DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, m_display);
+      if (drm_res == 0)
+      {
+         out_fence = util::fd_owner{ out_fence_fd };
+      }
+      /* Legacy page flips cannot scale the framebuffer, so scaled primary planes do not fall back to them. */
+      if (drm_res == 0 || errno == EBUSY || !m_plane->is_primary() || m_plane_placement.positioned)
+      {
+         return drm_res;
+      }
+
+      /* Some drivers expose the atomic API but reject commits that only touch the primary plane. */
+      WSI_LOG_WARNING("Atomic page flip failed: %s, falling back to legacy page flips.", std::strerror(errno));
+      m_use_atomic_commit = false;
+      m_use_in_fence = false;
+      m_use_out_fence = false;
+   }
+
+   if (util::wait_sync_fd(in_fence, -1) < 0)
+   {
+      return -1;
+   }
+   return drmModePageFlip(m_display->get_drm_fd(), m_display->get_crtc_id(), fb_id, DRM_MODE_PAGE_FLIP_EVENT,
+                          m_display);
+}
+
+void swapchain::wait_for_page_flip()
+{
+   uint32_t sequence = 0;
+   uint64_t vblank_time = 0;
+   drm_device &device = m_display->get_device();
+   if (device.wait_for_page_flip(*m_plane, sequence, vblank_time))
+   {
+      record_page_flip(sequence, vblank_time);
+   }
+   else
+   {
+      /* Do not hold up the other planes of the CRTC with a page flip that is never going to complete. */
+      device.cancel_page_flip(*m_plane);
+      set_error_state(VK_ERROR_SURFACE_LOST_KHR);
+   }
+
+   m_page_flip_in_flight.reset();
+}
+
+bool swapchain::needs_adaptive_sync_update() const
+{
+   const bool enable = m_present_mode == VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+   return m_use_adaptive_sync && enable != m_display->is_adaptive_sync_enabled();
+}
+
+void swapchain::update_adaptive_sync()
+{
+   const bool enable = m_present_mode == VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+   if (needs_adaptive_sync_update() && !m_display->set_adaptive_sync(enable))
+   {
+      /* Carry on at the current refresh rate rather than trying again on every present. */
+      m_use_adaptive_sync = false;
+   }
+}
+
+void swapchain::leave_present_group(const pending_present_request &present)
+{
+   if (present.present_group_id != 0)
+   {
+      m_display->get_device().leave_page_flip_group(present.present_group_id, present.present_group_size);
+   }
+}
+
+void swapchain::complete_present(const pending_present_request &presented)
+{
+   std::unique_lock<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+
+   /* Find currently presented image */
+   uint32_t presented_index = find_image_with_status(swapchain_image::PRESENTED);
+   /* There should always be a presented image, unless there was an error or it has already been released */
+   assert(m_first_present || m_presented_image_released || presented_index < m_swapchain_images.size());
+   m_presented_image_released = false;
+
+   /* The image is on screen, change the image status to PRESENTED. */
+   set_image_status(m_swapchain_images[presented.image_index], swapchain_image::PRESENTED);
+   image_status_lock.unlock();
+
+   frame_displayed();
+   set_present_id(presented.present_id);
+
+   /* And release the old one. */
+   if (presented_index < m_swapchain_images.size())
+   {
+      unpresent_image(presented_index);
+   }
+}
+
+int swapchain::mark_framebuffer_dirty(const display_image_data &image_data, bool full_damage)
+{
+   /* The kernel takes up to DRM_MODE_FB_DIRTY_MAX_CLIPS rectangles, more are marked dirty as a whole. */
+   constexpr size_t MAX_CLIPS = 256;
+   std::array<drmModeClip, MAX_CLIPS> clips;
+   uint32_t clip_count = 0;
+   const auto clamp = [](int64_t value) { return static_cast<uint16_t>(std::clamp<int64_t>(value, 0, UINT16_MAX)); };
+   if (!full_damage && image_data.damage.size() <= MAX_CLIPS)
+   {
+      for (const auto &rect : image_data.damage)
+      {
+         drmModeClip &clip = clips[clip_count++];
+         clip.x1 = clamp(rect.offset.x);
+         clip.y1 = clamp(rect.offset.y);
+         clip.x2 = clamp(static_cast<int64_t>(rect.offset.x) + rect.extent.width);
+         clip.y2 = clamp(static_cast<int64_t>(rect.offset.y) + rect.extent.height);
+      }
+   }
+
+   /* Without rectangles the whole framebuffer is marked dirty. */
+   return drmModeDirtyFB(m_display->get_drm_fd(), image_data.fb_id, clip_count != 0 ? clips.data() : nullptr,
+                         clip_count);
+}
+
+void swapchain::present_shared_image(const pending_present_request &pending_present)
+{
+   leave_present_group(pending_present);
+
+   /* The first present of an overlay plane flips to the image, which may not have landed yet. */
+   if (m_page_flip_in_flight.has_value())
+   {
+      const pending_present_request previous = *m_page_flip_in_flight;
+      wait_for_page_flip();
+      complete_present(previous);
+   }
+
    display_image_data *image_data =
       reinterpret_cast<display_image_data *>(m_swapchain_images[pending_present.image_index].data);
-   const auto &display = drm_display::get_display();
-   if (!display.has_value())
+   const bool continuous = m_present_mode == VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR;
+
+   /* In the demand refresh mode the changed region is only read once rendering to it has completed. Marking the
+    * framebuffer dirty does not take fences, so wait for the image here. */
+   if (!continuous && presentation_engine_waits_for_present_payload())
    {
-      set_error_state(VK_ERROR_SURFACE_LOST_KHR);
+      VkResult res = image_data->present_fence.wait_payload(UINT64_MAX);
+      if (res != VK_SUCCESS)
+      {
+         set_error_state(res);
+         return;
+      }
+   }
+
+   if (m_use_dirty_fb)
+   {
+      drm_device &device = m_display->get_device();
+      if (!device.begin_page_flip(*m_plane, *m_display, 0))
+      {
+         set_error_state(VK_ERROR_SURFACE_LOST_KHR);
+         return;
+      }
+      const int drm_res = mark_framebuffer_dirty(*image_data, continuous || image_data->full_damage);
+      device.cancel_page_flip(*m_plane);
+
+      if (drm_res == -ENOSYS)
+      {
+         /* The driver scans out the framebuffer on every refresh, so the writes of the application show anyway. */
+         m_use_dirty_fb = false;
+      }
+      else if (drm_res != 0)
+      {
+         WSI_LOG_WARNING("Failed to mark the framebuffer dirty: %s", std::strerror(-drm_res));
+      }
+   }
+   WSI_TRACE_INSTANT("shared image refreshed swapchain=%p present_id=%" PRIu64, static_cast<void *>(this),
+                     pending_present.present_id);
+   if (pending_present.present_id != 0)
+   {
+      WSI_TRACE_END_ASYNC(pending_present.present_id, "frame swapchain=%p", static_cast<void *>(this));
+   }
+
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+   /* There is no event either, the changes are scanned out from the next vblank. */
+   set_present_stage_time(pending_present.present_id, VK_PRESENT_STAGE_IMAGE_FIRST_PIXEL_OUT_BIT_EXT,
+                          util::get_monotonic_time_ns());
+#endif
+   complete_present(pending_present);
+
+   if (continuous)
+   {
+      /* The page flip thread presents the image again right away, which the page flip used to hold until vblank. */
+      constexpr uint64_t DEFAULT_REFRESH_INTERVAL = 16666667; /* 60 Hz */
+      const uint64_t refresh_interval = get_refresh_interval();
+      wait_for_target_present_time(util::get_monotonic_time_ns() +
+                                   (refresh_interval != 0 ? refresh_interval : DEFAULT_REFRESH_INTERVAL));
+   }
+}
+
+void swapchain::present_image(const pending_present_request &pending_present)
+{
+   int drm_res = 0;
+   drm_device &device = m_display->get_device();
+
+   /* Once on screen, the image of a shared present mode stays there, the application renders into it directly. */
+   if (!m_first_present && (m_present_mode == VK_PRESENT_MODE_SHARED_DEMAND_REFRESH_KHR ||
+                            m_present_mode == VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR))
+   {
+      present_shared_image(pending_present);
       return;
    }
 
-   if (m_first_present)
+   /* Overlay planes are flipped onto the mode set by the swapchain of the primary plane. */
+   if (m_first_present && m_plane->is_primary())
    {
+      /* Setting the mode cannot be combined with the page flips of the other swapchains. */
+      leave_present_group(pending_present);
+
+      display_image_data *image_data =
+         reinterpret_cast<display_image_data *>(m_swapchain_images[pending_present.image_index].data);
+
+      /* Setting the mode does not take fences, wait for the image here. */
+      if (presentation_engine_waits_for_present_payload())
+      {
+         VkResult res = image_data->present_fence.wait_payload(UINT64_MAX);
+         if (res != VK_SUCCESS)
+         {
+            set_error_state(res);
+            return;
+         }
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+         set_present_stage_time(pending_present.present_id, VK_PRESENT_STAGE_QUEUE_OPERATIONS_END_BIT_EXT,
+                                util::get_monotonic_time_ns());
+#endif
+      }
+
       /* Now we can set the mode of the new swapchain. */
       drmModeModeInfo modeInfo = m_display_mode->get_drm_mode();
 
-      uint32_t connector_id = display->get_connector_id();
-      drm_res = drmModeSetCrtc(display->get_drm_fd(), display->get_crtc_id(), image_data->fb_id, 0, 0, &connector_id, 1,
-                               &modeInfo);
+      uint32_t connector_id = m_display->get_connector_id();
+      if (!device.begin_page_flip(*m_plane, *m_display, 0))
+      {
+         set_error_state(VK_ERROR_SURFACE_LOST_KHR);
+         return;
+      }
+      if (m_plane_placement.positioned)
+      {
+         /* drmModeSetCrtc scans out the framebuffer unscaled, so it has to cover the whole mode. */
+         drm_res = m_display->set_mode_atomic(*m_display_mode, *m_plane, image_data->fb_id, m_plane_placement);
+      }
+      else
+      {
+         drm_res = drmModeSetCrtc(m_display->get_drm_fd(), m_display->get_crtc_id(), image_data->fb_id, 0, 0,
+                                  &connector_id, 1, &modeInfo);
+      }
+      if (drm_res == 0)
+      {
+         update_adaptive_sync();
+      }
+      device.cancel_page_flip(*m_plane);
 
       if (drm_res != 0)
       {
-         WSI_LOG_ERROR("drmModeSetCrtc failed: %s\n", std::strerror(errno));
+         WSI_LOG_ERROR("Setting the mode failed: %s", std::strerror(errno));
          set_error_state(VK_ERROR_SURFACE_LOST_KHR);
          return;
       }
+      WSI_TRACE_INSTANT("mode set swapchain=%p present_id=%" PRIu64 " image=%u", static_cast<void *>(this),
+                        pending_present.present_id, pending_present.image_index);
+      if (pending_present.present_id != 0)
+      {
+         WSI_TRACE_END_ASYNC(pending_present.present_id, "frame swapchain=%p", static_cast<void *>(this));
+      }
+
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+      /* Setting the mode does not deliver an event, the image is scanned out from the next vblank. */
+      set_present_stage_time(pending_present.present_id, VK_PRESENT_STAGE_IMAGE_FIRST_PIXEL_OUT_BIT_EXT,
+                             util::get_monotonic_time_ns());
+#endif
+      complete_present(pending_present);
+      return;
    }
-   /* The swapchain has already started presenting. */
-   else
-   {
 
-      bool page_flip_complete = false;
+   /* Only one page flip can be in flight on a CRTC, so the previous one has to land before queuing the next. */
+   if (m_page_flip_in_flight.has_value())
+   {
+      const pending_present_request previous = *m_page_flip_in_flight;
+      wait_for_page_flip();
+      complete_present(previous);
+   }
 
-      drm_res = drmModePageFlip(display->get_drm_fd(), display->get_crtc_id(), image_data->fb_id,
-                                DRM_MODE_PAGE_FLIP_EVENT, (void *)&page_flip_complete);
+   pending_present_request present = pending_present;
+   if (m_present_mode == VK_PRESENT_MODE_MAILBOX_KHR)
+   {
+      leave_present_group(present);
+      present.present_group_id = 0;
 
-      if (drm_res != 0)
+      /* Presents queued while waiting for the previous flip replace this one, only the newest reaches the screen. */
+      VkResult res = take_latest_pending_present(present);
+      if (res != VK_SUCCESS)
       {
-         WSI_LOG_ERROR("drmModePageFlip failed: %s\n", std::strerror(errno));
-         set_error_state(VK_ERROR_SURFACE_LOST_KHR);
+         set_error_state(res);
          return;
       }
+   }
 
-      fd_set fds;
-      FD_ZERO(&fds);
-      FD_SET(display->get_drm_fd(), &fds);
+   display_image_data *image_data =
+      reinterpret_cast<display_image_data *>(m_swapchain_images[present.image_index].data);
 
-      do
+   /* The kernel waits for the image to be rendered, so the page flip is committed right away. */
+   util::fd_owner in_fence;
+   const bool waits_for_fence = presentation_engine_waits_for_present_payload();
+   if (waits_for_fence)
+   {
+      VkResult res = take_present_fence(*image_data, in_fence);
+      if (res != VK_SUCCESS)
       {
-         struct timeval t;
-         t.tv_sec = 1;
-         t.tv_usec = 0;
-         drm_res = select(display->get_drm_fd() + 1, &fds, NULL, NULL, &t);
+         leave_present_group(present);
+         set_error_state(res);
+         return;
+      }
+   }
+   m_page_flip_queue_time = util::get_monotonic_time_ns();
+
+   /* Presents to several planes in the same vkQueuePresentKHR call flip together, on the same vblank. Changing the
+    * refresh rate mode commits the CRTC on its own, so that present is flipped separately. */
+   const bool adaptive_sync_update = needs_adaptive_sync_update();
+   const bool present_mode_async = m_present_mode == VK_PRESENT_MODE_IMMEDIATE_KHR;
+   const bool group_flip = present.present_group_id != 0 && m_use_atomic_commit && !adaptive_sync_update;
+   if (!group_flip)
+   {
+      leave_present_group(present);
+   }
 
-         if (drm_res < 0)
-         {
-            if (errno != EINTR && errno != EAGAIN)
-            {
-               WSI_LOG_ERROR("select() failed with errno: %d\n", errno);
-               set_error_state(VK_ERROR_SURFACE_LOST_KHR);
-               break;
-            }
-            WSI_LOG_ERROR("select() failed with %d, carrying on with page flip\n", errno);
-         }
-         else if (drm_res == 0)
-         {
-            WSI_LOG_ERROR("select() timed out, carrying on with page flip\n");
-         }
-         else
-         {
-            int result = FD_ISSET(display->get_drm_fd(), &fds);
-            assert(result > 0);
-            UNUSED(result);
-            drmEventContext ev = {};
-            ev.version = DRM_EVENT_CONTEXT_VERSION;
-            ev.page_flip_handler = page_flip_event;
-
-            drmHandleEvent(display->get_drm_fd(), &ev);
-         }
-      } while ((drm_res == -1 && (errno == EINTR || errno == EAGAIN)) || drm_res == 0 || !page_flip_complete);
+   /* Other swapchains may flip planes of the same CRTC, which only takes one commit at a time. */
+   if (!device.begin_page_flip(*m_plane, *m_display, group_flip ? present.present_group_id : 0))
+   {
+      if (group_flip)
+      {
+         leave_present_group(present);
+      }
+      set_error_state(VK_ERROR_SURFACE_LOST_KHR);
+      return;
    }
 
-   /* Find currently presented image */
-   uint32_t presented_index = m_swapchain_images.size();
-   if (!m_first_present)
+   if (adaptive_sync_update)
+   {
+      update_adaptive_sync();
+   }
+
+   bool page_flip_queued = false;
+   if (group_flip)
    {
-      for (uint32_t i = 0; i < m_swapchain_images.size(); ++i)
+      page_flip_queued = device.queue_group_page_flip(present.present_group_id, present.present_group_size, *m_plane,
+                                                      *m_display, image_data->fb_id, m_plane_placement,
+                                                      in_fence.get());
+      if (!page_flip_queued)
       {
-         if (m_swapchain_images[i].status == swapchain_image::PRESENTED)
+         /* Flip on its own, after any commit of the group the other members got through. */
+         device.cancel_page_flip(*m_plane);
+         if (!device.begin_page_flip(*m_plane, *m_display, 0))
          {
-            presented_index = i;
-            break;
+            set_error_state(VK_ERROR_SURFACE_LOST_KHR);
+            return;
          }
       }
-      /* There should always be a presented image, unless there was an error */
-      assert(presented_index < m_swapchain_images.size());
    }
-   /* The image is on screen, change the image status to PRESENTED. */
-   m_swapchain_images[pending_present.image_index].status = swapchain_image::PRESENTED;
-   set_present_id(pending_present.present_id);
 
-   /* And release the old one. */
-   if (presented_index < m_swapchain_images.size())
+   /* The out fence of a commit shared with other planes would not tell when this plane's image is released. The
+    * shared present modes keep scanning out the same image. */
+   const bool want_out_fence = m_use_out_fence && !page_flip_queued &&
+                               m_present_mode != VK_PRESENT_MODE_SHARED_DEMAND_REFRESH_KHR &&
+                               m_present_mode != VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR;
+   util::fd_owner out_fence;
+   if (!page_flip_queued &&
+       queue_page_flip(image_data->fb_id, present_mode_async, in_fence, out_fence, want_out_fence) != 0)
    {
-      unpresent_image(presented_index);
+      device.cancel_page_flip(*m_plane);
+      WSI_LOG_ERROR("Failed to queue page flip: %s", std::strerror(errno));
+      set_error_state(VK_ERROR_SURFACE_LOST_KHR);
+      return;
+   }
+   m_page_flip_in_flight = present;
+   m_page_flip_waits_for_fence = waits_for_fence;
+   if (out_fence.is_valid())
+   {
+      /* The application can render to the replaced image as soon as it is acquired, waiting for the out fence on the
+       * GPU rather than for the page flip event here. */
+      release_presented_image(std::move(out_fence));
+   }
+   WSI_TRACE_INSTANT("page flip queued swapchain=%p present_id=%" PRIu64 " image=%u group=%" PRIu64,
+                     static_cast<void *>(this), present.present_id, present.image_index,
+                     page_flip_queued ? present.present_group_id : 0);
+
+   /* While other presents are queued, leave the flip in flight so that waiting for the next image's present fence
+    * overlaps with waiting for vblank. Otherwise wait now, so the present completes and the image it replaces is
+    * released to the application, if that has not been done already. */
+   if (m_pending_buffer_pool.size() == 0)
+   {
+      wait_for_page_flip();
+      complete_present(present);
    }
-
-   return;
 }
 
 VkResult swapchain::image_set_present_payload(swapchain_image &image, VkQueue queue,
                                               const queue_submit_semaphores &semaphores, const void *submission_pnext)
 {
    auto image_data = reinterpret_cast<display_image_data *>(image.data);
+   if (m_present_timeline.has_value())
+   {
+      return m_present_timeline->set_payload(queue, semaphores, submission_pnext, image_data->present_payload_value);
+   }
    return image_data->present_fence.set_payload(queue, semaphores, submission_pnext);
 }
 
 VkResult swapchain::image_wait_present(swapchain_image &image, uint64_t timeout)
 {
    auto data = reinterpret_cast<display_image_data *>(image.data);
+   if (m_present_timeline.has_value())
+   {
+      return m_present_timeline->wait_payload(data->present_payload_value, timeout);
+   }
    return data->present_fence.wait_payload(timeout);
 }
 
+bool swapchain::presentation_engine_waits_for_present_payload() const
+{
+   return m_use_in_fence;
+}
+
+VkResult swapchain::take_present_fence(display_image_data &image_data, util::fd_owner &in_fence)
+{
+   if (!image_data.present_fence.is_payload_set())
+   {
+      /* The payload has already been handed to an earlier page flip of the image. */
+      return VK_SUCCESS;
+   }
+
+   auto sync_fd = image_data.present_fence.export_sync_fd();
+   if (!sync_fd.has_value())
+   {
+      return image_data.present_fence.wait_payload(UINT64_MAX);
+   }
+
+   /* An invalid sync FD means that the payload has already signalled. */
+   in_fence = std::move(*sync_fd);
+   return VK_SUCCESS;
+}
+
+void swapchain::release_presented_image(util::fd_owner release_fence)
+{
+   std::unique_lock<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+   uint32_t presented_index = find_image_with_status(swapchain_image::PRESENTED);
+   if (presented_index >= m_swapchain_images.size())
+   {
+      return;
+   }
+
+   auto image_data = reinterpret_cast<display_image_data *>(m_swapchain_images[presented_index].data);
+   image_data->release_fence = std::move(release_fence);
+   m_presented_image_released = true;
+   image_status_lock.unlock();
+
+   unpresent_image(presented_index);
+}
+
+VkResult swapchain::image_set_present_region(swapchain_image &image, const VkPresentRegionKHR *region)
+{
+   auto image_data = reinterpret_cast<display_image_data *>(image.data);
+
+   /* A region without rectangles means the whole image changed. */
+   image_data->full_damage = region == nullptr || region->rectangleCount == 0 || region->pRectangles == nullptr;
+   if (image_data->full_damage)
+   {
+      return VK_SUCCESS;
+   }
+
+   /* Only the shared present modes use the damage, and only as a hint, so fall back to the whole image. */
+   if (!image_data->damage.try_resize(region->rectangleCount))
+   {
+      WSI_LOG_WARNING("Failed to store the present region, marking the whole framebuffer dirty.");
+      image_data->full_damage = true;
+      return VK_SUCCESS;
+   }
+
+   std::copy(region->pRectangles, region->pRectangles + region->rectangleCount, image_data->damage.begin());
+   return VK_SUCCESS;
+}
+
+util::fd_owner swapchain::image_take_release_fence(swapchain_image &image)
+{
+   auto image_data = reinterpret_cast<display_image_data *>(image.data);
+   if (image_data == nullptr)
+   {
+      return util::fd_owner{};
+   }
+   return std::move(image_data->release_fence);
+}
+
+bool swapchain::supports_batched_present_payload() const
+{
+   /* Only the timeline semaphore lets a submission shared with other swapchains signal the payload. */
+   return m_present_timeline.has_value();
+}
+
+void swapchain::image_get_batched_present_payload(swapchain_image &image, VkQueue queue,
+                                                  timeline_semaphore_point &signal, timeline_semaphore_point &wait)
+{
+   UNUSED(image);
+   assert(m_present_timeline.has_value());
+   m_present_timeline->get_next_payload(queue, signal, wait);
+}
+
+void swapchain::image_commit_batched_present_payload(swapchain_image &image, VkQueue queue)
+{
+   auto data = reinterpret_cast<display_image_data *>(image.data);
+   data->present_payload_value = m_present_timeline->commit_payload(queue);
+}
+
+void swapchain::presentation_engine_stopped()
+{
+   /* The page flip still in flight has to be completed before the image and framebuffer it scans out are released
+    * by destroy_image(). */
+   if (m_page_flip_in_flight.has_value())
+   {
+      wait_for_page_flip();
+   }
+}
+
 void swapchain::destroy_image(swapchain_image &image)
 {
    std::unique_lock<std::recursive_mutex> image_status_lock(m_image_status_mutex);
 
+   const swapchain_image::status status = image.status;
    if (image.status != swapchain_image::INVALID)
    {
       if (image.image != VK_NULL_HANDLE)
@@ -589,7 +1367,7 @@ void swapchain::destroy_image(swapchain_image &image)
          image.image = VK_NULL_HANDLE;
       }
 
-      image.status = swapchain_image::INVALID;
+      set_image_status(image, swapchain_image::INVALID);
    }
 
    image_status_lock.unlock();
@@ -597,20 +1375,35 @@ void swapchain::destroy_image(swapchain_image &image)
    if (image.data != nullptr)
    {
       auto image_data = reinterpret_cast<display_image_data *>(image.data);
-      auto &display = drm_display::get_display();
-      if (!display.has_value())
-      {
-         return;
-      }
+
+      /* Only a buffer the display engine has stopped scanning out can be handed out again. The image on screen stays
+       * there after the swapchain is destroyed, and an early released image is read until its release fence
+       * signals. */
+      const bool recycle = status == swapchain_image::FREE && util::wait_sync_fd(image_data->release_fence, 0) == 1;
+
       if (image_data->fb_id != std::numeric_limits<uint32_t>::max())
       {
-         int result = drmModeRmFB(display->get_drm_fd(), image_data->fb_id);
-         assert(result == 0);
-         UNUSED(result);
+         m_display->get_framebuffer_cache().release(image_data->fb_id);
       }
 
-      m_allocator.destroy(1, image_data);
-      image.data = nullptr;
+      const auto buffer_fds = image_data->external_mem.take_retained_buffer_fds();
+      destroy_image_data<display_image_data>(image);
+      release_wsialloc_buffer(buffer_fds, recycle);
+   }
+}
+
+void swapchain::add_image_memory_footprint(const swapchain_image &image, swapchain_memory_footprint &footprint) const
+{
+   if (image.data == nullptr)
+   {
+      return;
+   }
+
+   auto *image_data = reinterpret_cast<const display_image_data *>(image.data);
+   footprint.dma_buf_bytes += image_data->external_mem.get_imported_size();
+   if (image_data->fb_id != std::numeric_limits<uint32_t>::max())
+   {
+      footprint.framebuffer_count++;
    }
 }
 
@@ -34,6 +34,7 @@
 #include <vulkan/vulkan.h>
 #include <wsi/swapchain_base.hpp>
 #include "util/wsialloc/wsialloc.h"
+#include "util/format_modifiers.hpp"
 #include "drm_display.hpp"
 #include "wsi/external_memory.hpp"
 #include "surface.hpp"
@@ -49,12 +50,23 @@ struct display_image_data
    display_image_data(const VkDevice &device, const util::allocator &allocator)
       : external_mem(device, allocator)
       , fb_id(std::numeric_limits<uint32_t>::max())
+      , damage(allocator)
+      , full_damage(true)
    {
    }
 
    external_memory external_mem;
    uint32_t fb_id;
    sync_fd_fence_sync present_fence;
+   /* Value of the present timeline signalled by the latest present payload, when the timeline is used. */
+   uint64_t present_payload_value{ 0 };
+   /* Out fence of the page flip replacing the image, when the image is released before the flip completes. */
+   util::fd_owner release_fence;
+   /* Rectangles of the image that changed in the pending present of a shared present mode, used when full_damage is
+    * false. */
+   util::vector<VkRectLayerKHR> damage;
+   /* Whether the whole image changed in the pending present. */
+   bool full_damage;
 };
 
 struct image_creation_parameters
@@ -93,6 +105,19 @@ public:
 
    virtual VkResult create_swapchain_image(VkImageCreateInfo image_create_info, swapchain_image &image) override;
 
+   bool supports_parallel_image_creation() const override;
+
+   /**
+    * @brief Images can always be handed over, the framebuffers belong to the display rather than the swapchain.
+    */
+   bool supports_image_handover(const swapchain_base &ancestor) const override;
+
+   /**
+    * @brief Take over the memory, framebuffer and present fence of a free image of the ancestor swapchain.
+    */
+   VkResult adopt_ancestor_image(swapchain_base &ancestor, swapchain_image &ancestor_image,
+                                 const VkImageCreateInfo &image_create_info, swapchain_image &image) override;
+
    /**
     * @brief Method to present and image
     *
@@ -102,17 +127,77 @@ public:
     */
    void present_image(const pending_present_request &pending_present) override;
 
+   /**
+    * @brief Get the refresh interval of the display mode used by the swapchain.
+    *
+    * Page flips complete on the vblank after they are committed, so committing half a refresh cycle before a target
+    * present time flips on the vblank nearest to it.
+    *
+    * @return The refresh interval in nanoseconds, or 0 if the mode has no refresh rate.
+    */
+   uint64_t get_refresh_interval() const override;
+
+   /**
+    * @brief Swapchains on the displays of a DRM device that supports atomic mode setting flip together.
+    *
+    * Mailbox presents may be replaced by later ones until they are flipped, so they are never synchronized.
+    */
+   const void *get_present_group(const swapchain_presentation_parameters &presentation_parameters) const override;
+
    virtual VkResult image_set_present_payload(swapchain_image &image, VkQueue queue,
                                               const queue_submit_semaphores &semaphores,
                                               const void *submission_pnext) override;
 
+   VkResult image_set_present_region(swapchain_image &image, const VkPresentRegionKHR *region) override;
+
    virtual VkResult image_wait_present(swapchain_image &image, uint64_t timeout) override;
 
+   bool presentation_engine_waits_for_present_payload() const override;
+
+   util::fd_owner image_take_release_fence(swapchain_image &image) override;
+
+   bool supports_batched_present_payload() const override;
+
+   void image_get_batched_present_payload(swapchain_image &image, VkQueue queue, timeline_semaphore_point &signal,
+                                          timeline_semaphore_point &wait) override;
+
+   void image_commit_batched_present_payload(swapchain_image &image, VkQueue queue) override;
+
    void destroy_image(swapchain_image &image) override;
 
+   void presentation_engine_stopped() override;
+
+   void add_image_memory_footprint(const swapchain_image &image, swapchain_memory_footprint &footprint) const override;
+
 private:
    VkResult allocate_image(VkImageCreateInfo &image_create_info, display_image_data *image_data);
 
+   /**
+    * @brief Give the buffer of a destroyed image back to wsialloc, which may reuse it for later allocations.
+    *
+    * @param buffer_fds The file descriptors retained for the image, see external_memory::retain_buffer_fds.
+    * @param recycle    Whether the buffer can be reused. Buffers still owned by the display engine are not, and
+    *                   their file descriptors are closed instead.
+    */
+   void release_wsialloc_buffer(const std::array<int, MAX_PLANES> &buffer_fds, bool recycle);
+
+   /**
+    * @brief Get the wsialloc flags that select the heap of the swapchain buffers, which depends on their usage.
+    */
+   uint64_t get_wsialloc_heap_flags() const;
+
+   /**
+    * @brief Allocate a buffer with wsialloc, together with the buffers of the images that are still to be created.
+    *
+    * The extra buffers are kept in @ref m_preallocated_buffers for the following allocations.
+    *
+    * @param      alloc_info       The allocation info of the buffer.
+    * @param      avoid_allocation Whether to only select the format, without allocating memory.
+    * @param[out] alloc_result     The allocation result of the buffer.
+    */
+   VkResult allocate_wsialloc_batch(const wsialloc_allocate_info &alloc_info, bool avoid_allocation,
+                                    wsialloc_allocate_result &alloc_result);
+
    VkResult allocate_wsialloc(VkImageCreateInfo &image_create_info, display_image_data *image_data,
                               util::vector<wsialloc_format> &importable_formats, wsialloc_format *allocated_format,
                               bool avoid_allocation);
@@ -120,14 +205,245 @@ private:
    VkResult get_surface_compatible_formats(const VkImageCreateInfo &info,
                                            util::vector<wsialloc_format> &importable_formats,
                                            util::vector<uint64_t> &exportable_modifers,
-                                           util::vector<VkDrmFormatModifierPropertiesEXT> &drm_format_props);
+                                           util::drm_format_properties_list &drm_format_props);
 
    VkResult create_framebuffer(const VkImageCreateInfo &image_create_info, swapchain_image &image,
                                display_image_data *image_data);
 
+   /**
+    * @brief Work out where the plane scans out the swapchain images, following the present scaling of the swapchain.
+    *
+    * @param image_extent The size of the swapchain images.
+    */
+   void init_plane_placement(const VkExtent2D &image_extent);
+
+   /**
+    * @brief Queue a non-blocking page flip to a framebuffer.
+    *
+    * Uses an atomic commit when the plane supports it and falls back to the legacy page flip otherwise, which only
+    * primary planes can do. The page flip must have been started with @ref drm_device::begin_page_flip. Completion is
+    * reported by @ref wait_for_page_flip.
+    *
+    * @param      fb_id          The framebuffer to scan out.
+    * @param      async          Whether to flip without waiting for vblank, when the plane supports it.
+    * @param      in_fence       Sync FD to wait for before scanning out the framebuffer. Atomic commits hand it to
+    *                            the kernel, legacy page flips wait for it on the CPU.
+    * @param[out] out_fence      Set to a sync FD signalled once the framebuffer is scanned out, when requested with
+    *                            @p want_out_fence and the page flip is queued with an atomic commit.
+    * @param      want_out_fence Whether to ask for @p out_fence.
+    *
+    * @return 0 on success, otherwise a non-zero value with errno set.
+    */
+   int queue_page_flip(uint32_t fb_id, bool async, const util::fd_owner &in_fence, util::fd_owner &out_fence,
+                       bool want_out_fence);
+
+   /**
+    * @brief Queue a page flip that does not wait for vblank, which may tear.
+    *
+    * @param fb_id    The framebuffer to scan out.
+    * @param in_fence Sync FD to wait for before scanning out the framebuffer, see @ref queue_page_flip.
+    *
+    * @return 0 on success, otherwise a non-zero value with errno set.
+    */
+   int queue_async_page_flip(uint32_t fb_id, const util::fd_owner &in_fence);
+
+   /**
+    * @brief Take the present fence of an image as a sync FD that the kernel can wait for.
+    *
+    * Waits for the fence on the CPU instead if it cannot be exported.
+    *
+    * @param      image_data The image being presented.
+    * @param[out] in_fence   The sync FD, left invalid if there is nothing left to wait for.
+    *
+    * @return VK_SUCCESS on success, otherwise an error code.
+    */
+   VkResult take_present_fence(display_image_data &image_data, util::fd_owner &in_fence);
+
+   /**
+    * @brief Release the image on screen before the page flip replacing it has completed.
+    *
+    * @param release_fence The out fence of the page flip, which the application waits for before writing the image.
+    */
+   void release_presented_image(util::fd_owner release_fence);
+
+   /**
+    * @brief Wait until the page flip in flight has completed.
+    *
+    * Does not change any image status, see @ref complete_present.
+    */
+   void wait_for_page_flip();
+
+   /**
+    * @brief Present the image of a shared present mode once it is on screen.
+    *
+    * The image is scanned out since the first present, which the application keeps rendering into, so no page flip is
+    * needed. Demand refresh presents mark the changed region of the framebuffer dirty, so that panels with self
+    * refresh fetch it, and continuous refresh presents mark the whole framebuffer dirty once per refresh cycle.
+    *
+    * @param pending_present The present request.
+    */
+   void present_shared_image(const pending_present_request &pending_present);
+
+   /**
+    * @brief Tell the kernel that a region of the framebuffer of an image changed, with DRM_IOCTL_MODE_DIRTYFB.
+    *
+    * Must be called with a page flip of the plane started, see @ref drm_device::begin_page_flip, as the kernel may
+    * commit the damage to the plane.
+    *
+    * @param image_data  The image on screen.
+    * @param full_damage Whether to mark the whole framebuffer dirty rather than the damage of the image.
+    *
+    * @return 0 on success, otherwise a negative errno value.
+    */
+   int mark_framebuffer_dirty(const display_image_data &image_data, bool full_damage);
+
+   /**
+    * @brief Mark an image as on screen and release the image that was previously presented.
+    *
+    * @param presented The present request whose image is now on screen.
+    */
+   void complete_present(const pending_present_request &presented);
+
+   /**
+    * @brief Whether variable refresh rates have to be enabled or disabled for the present mode of the swapchain.
+    */
+   bool needs_adaptive_sync_update() const;
+
+   /**
+    * @brief Enable variable refresh rates on the display in the FIFO relaxed mode, and disable them otherwise.
+    *
+    * Must be called with a page flip of the plane started, see @ref drm_device::begin_page_flip.
+    */
+   void update_adaptive_sync();
+
+   /**
+    * @brief Leave the flip group of a present that is not flipped together with the other swapchains.
+    *
+    * @param present The present request, which does not need to belong to a flip group.
+    */
+   void leave_present_group(const pending_present_request &present);
+
+   /**
+    * @brief Record the vblank a page flip completed on.
+    *
+    * Reports the vblank time as the first pixel out time of the present in flight and counts the vblanks missed
+    * since the previous page flip.
+    *
+    * @param sequence    The vblank sequence number of the page flip.
+    * @param vblank_time CLOCK_MONOTONIC time of the vblank in nanoseconds.
+    */
+   void record_page_flip(uint32_t sequence, uint64_t vblank_time);
+
    wsialloc_allocator *m_wsi_allocator;
+
+   /**
+    * @brief Buffers allocated in a batch with an earlier image, for images that are still to be allocated.
+    */
+   util::vector<wsialloc_allocate_result> m_preallocated_buffers;
+   /**
+    * @brief The display of the surface, which outlives the swapchain.
+    */
+   drm_display *m_display;
+
+   /**
+    * @brief The plane the swapchain images are scanned out on, either the primary plane of @ref m_display or an
+    * overlay plane.
+    */
+   drm_plane *m_plane;
    drm_display_mode *m_display_mode;
+
+   /**
+    * @brief The size of the surface, which images of other sizes are scaled to when the swapchain asks for it.
+    */
+   VkExtent2D m_surface_extent;
+
+   /**
+    * @brief Where the plane scans out the swapchain images.
+    */
+   drm_plane_placement m_plane_placement;
    image_creation_parameters m_image_creation_parameters;
+
+   /**
+    * @brief Whether page flips are queued with atomic commits rather than the legacy page flip API.
+    */
+   bool m_use_atomic_commit;
+
+   /**
+    * @brief Whether the swapchain controls the variable refresh rate of the display, in the FIFO relaxed mode.
+    *
+    * Only swapchains of primary planes do, so that overlay swapchains in other modes do not toggle it.
+    */
+   bool m_use_adaptive_sync;
+
+   /**
+    * @brief Whether page flips in the immediate mode are queued without waiting for vblank.
+    *
+    * The kernel only flips primary planes this way.
+    */
+   bool m_use_async_page_flip;
+
+   /**
+    * @brief The present request whose page flip has been queued but has not completed yet.
+    *
+    * Only accessed from the page flip thread.
+    */
+   std::optional<pending_present_request> m_page_flip_in_flight;
+
+   /**
+    * @brief CLOCK_MONOTONIC time, in nanoseconds, at which the page flip in flight was queued.
+    */
+   uint64_t m_page_flip_queue_time;
+
+   /**
+    * @brief Vblank sequence number of the last completed page flip, empty before the first page flip.
+    */
+   std::optional<uint32_t> m_last_flip_sequence;
+
+   /**
+    * @brief CLOCK_MONOTONIC time, in nanoseconds, of the vblank of the last completed page flip.
+    */
+   uint64_t m_last_flip_time;
+
+   /**
+    * @brief Number of vblanks page flips missed although they were queued in time for the next vblank.
+    */
+   uint64_t m_missed_vblanks;
+
+   /**
+    * @brief Timeline semaphore signalled by the present payloads, when supported by the device.
+    *
+    * When empty, every image uses a fence for its present payload instead.
+    */
+   std::optional<timeline_semaphore_sync> m_present_timeline;
+
+   /**
+    * @brief Whether the present fences are handed to the kernel with the page flips, which waits for them itself.
+    *
+    * Only the page flip thread clears it, when falling back to legacy page flips.
+    */
+   bool m_use_in_fence;
+
+   /**
+    * @brief Whether the image replaced by a page flip is released as soon as the flip is queued, with the out fence
+    * of the commit as its release fence.
+    */
+   bool m_use_out_fence;
+
+   /**
+    * @brief Whether the kernel waits for the present fence of the page flip in flight.
+    */
+   bool m_page_flip_waits_for_fence;
+
+   /**
+    * @brief Whether the image on screen has been released when the page flip in flight was queued.
+    */
+   bool m_presented_image_released;
+
+   /**
+    * @brief Whether shared present modes mark the framebuffer dirty, cleared when the driver does not implement it
+    * because it scans out the framebuffer continuously.
+    */
+   bool m_use_dirty_fb;
 };
 
 } /* namespace display */
@@ -27,6 +27,7 @@
 #include <cassert>
 #include <cstdint>
 #include <unistd.h>
+#include <fcntl.h>
 #include <algorithm>
 
 #include "util/log.hpp"
@@ -61,6 +62,83 @@ external_memory::~external_memory()
          }
       }
    }
+
+   for (int fd : take_retained_buffer_fds())
+   {
+      if (fd >= 0)
+      {
+         close(fd);
+      }
+   }
+}
+
+VkResult external_memory::retain_buffer_fds()
+{
+   assert(std::all_of(m_retained_buffer_fds.begin(), m_retained_buffer_fds.end(), [](int fd) { return fd < 0; }));
+
+   for (uint32_t plane = 0; plane < MAX_PLANES; plane++)
+   {
+      if (m_buffer_fds[plane] < 0)
+      {
+         continue;
+      }
+
+      /* Planes sharing a file descriptor share the duplicate too. */
+      auto it = std::find(std::begin(m_buffer_fds), std::end(m_buffer_fds), m_buffer_fds[plane]);
+      const auto first_plane = static_cast<uint32_t>(std::distance(std::begin(m_buffer_fds), it));
+      if (first_plane != plane)
+      {
+         m_retained_buffer_fds[plane] = m_retained_buffer_fds[first_plane];
+         continue;
+      }
+
+      m_retained_buffer_fds[plane] = fcntl(m_buffer_fds[plane], F_DUPFD_CLOEXEC, 0);
+      if (m_retained_buffer_fds[plane] < 0)
+      {
+         for (int fd : take_retained_buffer_fds())
+         {
+            if (fd >= 0)
+            {
+               close(fd);
+            }
+         }
+         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+   }
+
+   return VK_SUCCESS;
+}
+
+std::array<int, MAX_PLANES> external_memory::take_retained_buffer_fds()
+{
+   /* Each file descriptor is only returned once, planes that share a file descriptor get -1. */
+   std::array<int, MAX_PLANES> fds{ -1, -1, -1, -1 };
+   for (uint32_t plane = 0; plane < MAX_PLANES; plane++)
+   {
+      const int fd = m_retained_buffer_fds[plane];
+      if (fd >= 0 && std::find(fds.begin(), fds.end(), fd) == fds.end())
+      {
+         fds[plane] = fd;
+      }
+      m_retained_buffer_fds[plane] = -1;
+   }
+   return fds;
+}
+
+void external_memory::take_over(external_memory &other)
+{
+   assert(m_num_planes == 0 && other.m_device == m_device);
+
+   m_buffer_fds = std::exchange(other.m_buffer_fds, { -1, -1, -1, -1 });
+   m_retained_buffer_fds = std::exchange(other.m_retained_buffer_fds, { -1, -1, -1, -1 });
+   m_memories = std::exchange(other.m_memories, { VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE });
+   m_strides = other.m_strides;
+   m_offsets = other.m_offsets;
+   m_num_planes = std::exchange(other.m_num_planes, 0);
+   m_num_memories = std::exchange(other.m_num_memories, 0);
+   m_imported_size = std::exchange(other.m_imported_size, 0);
+   m_handle_type = other.m_handle_type;
+   m_protected_memory = other.m_protected_memory;
 }
 
 uint32_t external_memory::get_num_planes()
@@ -81,6 +159,18 @@ bool external_memory::is_disjoint()
 VkResult external_memory::get_fd_mem_type_index(int fd, uint32_t *mem_idx)
 {
    auto &device_data = layer::device_private_data::get(m_device);
+
+   /* Buffers of one wsialloc heap share a memory type, so it is only queried for the first buffer of each heap. */
+   const bool cacheable = m_handle_type == VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
+   if (cacheable)
+   {
+      *mem_idx = device_data.get_dma_buf_memory_type_index(m_protected_memory);
+      if (*mem_idx != UINT32_MAX)
+      {
+         return VK_SUCCESS;
+      }
+   }
+
    VkMemoryFdPropertiesKHR mem_props = {};
    mem_props.sType = VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR;
 
@@ -97,6 +187,11 @@ VkResult external_memory::get_fd_mem_type_index(int fd, uint32_t *mem_idx)
 
    assert(*mem_idx < VK_MAX_MEMORY_TYPES);
 
+   if (cacheable)
+   {
+      device_data.set_dma_buf_memory_type_index(m_protected_memory, *mem_idx);
+   }
+
    return VK_SUCCESS;
 }
 
@@ -145,6 +240,7 @@ VkResult external_memory::import_plane_memory(int fd, VkDeviceMemory *memory)
    auto &device_data = layer::device_private_data::get(m_device);
    TRY_LOG(device_data.disp.AllocateMemory(m_device, &alloc_info, m_allocator.get_original_callbacks(), memory),
            "Failed to import device memory");
+   m_imported_size += alloc_info.allocationSize;
 
    return VK_SUCCESS;
 }
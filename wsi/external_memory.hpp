@@ -137,6 +137,14 @@ public:
       m_handle_type = handle_type;
    }
 
+   /**
+    * @brief Set whether the external memory was allocated from a protected heap.
+    */
+   void set_protected_memory(bool protected_memory)
+   {
+      m_protected_memory = protected_memory;
+   }
+
    /**
     * @brief Set the number of memory planes.
     */
@@ -212,6 +220,54 @@ public:
     */
    void fill_external_info(VkExternalMemoryImageCreateInfoKHR &external_info, void *pNext);
 
+   /**
+    * @brief Keep duplicates of the buffer file descriptors.
+    *
+    * The buffer file descriptors are owned by the device memory they are imported to. The duplicates keep the buffer
+    * alive after the memory is freed, so that it can be handed back to its allocator for reuse.
+    *
+    * @return VK_ERROR_OUT_OF_HOST_MEMORY if the file descriptors could not be duplicated, otherwise VK_SUCCESS.
+    */
+   VkResult retain_buffer_fds();
+
+   /**
+    * @brief Take the file descriptors kept by @ref retain_buffer_fds.
+    *
+    * The caller becomes responsible for closing them, ideally after this object is destroyed so that the buffer is no
+    * longer in use by the device.
+    *
+    * @return The per plane file descriptors, -1 for planes without a file descriptor.
+    */
+   std::array<int, MAX_PLANES> take_retained_buffer_fds();
+
+   /**
+    * @brief Get the file descriptors kept by @ref retain_buffer_fds, which stay owned by this object.
+    *
+    * Unlike the buffer file descriptors, they remain valid after the memory is imported.
+    */
+   const std::array<int, MAX_PLANES> &get_retained_buffer_fds() const
+   {
+      return m_retained_buffer_fds;
+   }
+
+   /**
+    * @brief Take over the buffer and the imported memory of another external memory object.
+    *
+    * Used to hand the memory of a swapchain image over to the image of another swapchain on the same device. @p other
+    * is left without memory, so destroying it releases nothing.
+    *
+    * @param other The external memory to take the resources of.
+    */
+   void take_over(external_memory &other);
+
+   /**
+    * @brief Get the size of the dma-bufs imported as device memory, in bytes.
+    */
+   uint64_t get_imported_size() const
+   {
+      return m_imported_size;
+   }
+
 private:
    VkResult get_fd_mem_type_index(int fd, uint32_t *mem_idx);
 
@@ -220,13 +276,16 @@ private:
    VkResult import_plane_memory(int fd, VkDeviceMemory *memory);
 
    std::array<int, MAX_PLANES> m_buffer_fds{ -1, -1, -1, -1 };
+   std::array<int, MAX_PLANES> m_retained_buffer_fds{ -1, -1, -1, -1 };
    std::array<int, MAX_PLANES> m_strides{ 0, 0, 0, 0 };
    std::array<uint32_t, MAX_PLANES> m_offsets{ 0, 0, 0, 0 };
    std::array<VkDeviceMemory, MAX_PLANES> m_memories = { VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE,
                                                          VK_NULL_HANDLE };
    uint32_t m_num_planes{ 0 };
    uint32_t m_num_memories{ 0 };
+   uint64_t m_imported_size{ 0 };
    VkExternalMemoryHandleTypeFlagBits m_handle_type{ VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT };
+   bool m_protected_memory{ false };
    const VkDevice &m_device;
    const util::allocator &m_allocator;
 };
@@ -38,7 +38,7 @@ frame_boundary_handler::frame_boundary_handler(const layer::device_private_data
 }
 
 std::optional<VkFrameBoundaryEXT> frame_boundary_handler::handle_frame_boundary_event(
-   const VkPresentInfoKHR *present_info, VkImage *current_image_to_be_presented)
+   const VkFrameBoundaryEXT *application_frame_boundary, VkImage *current_image_to_be_presented)
 {
    /* If frame boundary feature is not enabled by the application, the layer will
     * pass its own frame boundary events back to ICD. Otherwise, let the application
@@ -46,7 +46,7 @@ std::optional<VkFrameBoundaryEXT> frame_boundary_handler::handle_frame_boundary_
 
    /* First, check if the application passed any frame boundary events and if that's
     * the case, just forward it at queue submission. */
-   auto application_frame_boundary_event = wsi::create_frame_boundary(*present_info);
+   auto application_frame_boundary_event = wsi::create_frame_boundary(application_frame_boundary);
    if (application_frame_boundary_event.has_value())
    {
       return application_frame_boundary_event;
@@ -60,11 +60,8 @@ std::optional<VkFrameBoundaryEXT> frame_boundary_handler::handle_frame_boundary_
    return std::nullopt;
 }
 
-std::optional<VkFrameBoundaryEXT> create_frame_boundary(const VkPresentInfoKHR &present_info)
+std::optional<VkFrameBoundaryEXT> create_frame_boundary(const VkFrameBoundaryEXT *present_frame_boundary)
 {
-   auto *present_frame_boundary =
-      util::find_extension<VkFrameBoundaryEXT>(VK_STRUCTURE_TYPE_PRESENT_ID_KHR, present_info.pNext);
-
    /* Extract the VkFrameBoundaryEXT structure to avoid passing other, unrelated structures to vkQueueSubmit */
    if (present_frame_boundary != nullptr)
    {
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file gpu_timestamps.cpp
+ *
+ * @brief Contains the implementation of the recording of GPU completion times of presented images.
+ */
+
+#include "gpu_timestamps.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "layer/private_data.hpp"
+#include "util/log.hpp"
+
+namespace wsi
+{
+
+gpu_timestamps::gpu_timestamps(layer::device_private_data &device, const util::allocator &allocator,
+                               uint32_t image_count)
+   : m_device(device)
+   , m_allocator(allocator)
+   , m_image_count(image_count)
+   , m_time_domain(VK_PRESENT_STAGE_QUEUE_OPERATIONS_END_BIT_EXT, VK_TIME_DOMAIN_DEVICE_KHR, &device)
+   , m_images(allocator)
+{
+}
+
+gpu_timestamps::~gpu_timestamps()
+{
+   /* The swapchain waits for its present payloads before it is destroyed, so the command buffers are not in use. */
+   if (m_command_pool != VK_NULL_HANDLE)
+   {
+      m_device.disp.DestroyCommandPool(m_device.device, m_command_pool, m_allocator.get_original_callbacks());
+   }
+   if (m_query_pool != VK_NULL_HANDLE)
+   {
+      m_device.disp.DestroyQueryPool(m_device.device, m_query_pool, m_allocator.get_original_callbacks());
+   }
+}
+
+bool gpu_timestamps::is_enabled()
+{
+   static const bool enabled = [] {
+      const char *env = std::getenv("WSI_GPU_TIMESTAMPS");
+      return env != nullptr && strcmp(env, "1") == 0;
+   }();
+   return enabled;
+}
+
+VkResult gpu_timestamps::init(uint32_t queue_family_index)
+{
+   uint32_t family_count = 0;
+   m_device.instance_data.disp.GetPhysicalDeviceQueueFamilyProperties(m_device.physical_device, &family_count,
+                                                                      nullptr);
+   util::vector<VkQueueFamilyProperties> families(m_allocator);
+   if (queue_family_index >= family_count || !families.try_resize(family_count))
+   {
+      return VK_ERROR_INITIALIZATION_FAILED;
+   }
+   m_device.instance_data.disp.GetPhysicalDeviceQueueFamilyProperties(m_device.physical_device, &family_count,
+                                                                      families.data());
+   const uint32_t valid_bits = families[queue_family_index].timestampValidBits;
+   if (valid_bits == 0)
+   {
+      WSI_LOG_WARNING("Queue family %u does not support timestamps, GPU timestamps are disabled.", queue_family_index);
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+   }
+   m_valid_bits_mask = valid_bits >= 64 ? UINT64_MAX : (uint64_t{ 1 } << valid_bits) - 1;
+
+   if (!m_images.try_resize(m_image_count))
+   {
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+
+   const VkAllocationCallbacks *callbacks = m_allocator.get_original_callbacks();
+   VkQueryPoolCreateInfo query_pool_info = {};
+   query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+   query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+   query_pool_info.queryCount = m_image_count;
+   TRY_LOG_CALL(m_device.disp.CreateQueryPool(m_device.device, &query_pool_info, callbacks, &m_query_pool));
+
+   VkCommandPoolCreateInfo command_pool_info = {};
+   command_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+   command_pool_info.queueFamilyIndex = queue_family_index;
+   TRY_LOG_CALL(m_device.disp.CreateCommandPool(m_device.device, &command_pool_info, callbacks, &m_command_pool));
+
+   /* Each command buffer is recorded once and submitted with every payload of its image. The query is reset by the
+    * same command buffer, the previous payload of the image has completed by the time the image is presented again. */
+   for (uint32_t i = 0; i < m_image_count; i++)
+   {
+      VkCommandBufferAllocateInfo allocate_info = {};
+      allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocate_info.commandPool = m_command_pool;
+      allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      allocate_info.commandBufferCount = 1;
+      VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+      TRY_LOG_CALL(m_device.disp.AllocateCommandBuffers(m_device.device, &allocate_info, &command_buffer));
+      TRY_LOG_CALL(m_device.SetDeviceLoaderData(m_device.device, command_buffer));
+
+      VkCommandBufferBeginInfo begin_info = {};
+      begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+      TRY_LOG_CALL(m_device.disp.BeginCommandBuffer(command_buffer, &begin_info));
+      m_device.disp.CmdResetQueryPool(command_buffer, m_query_pool, i, 1);
+      m_device.disp.CmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_query_pool, i);
+      TRY_LOG_CALL(m_device.disp.EndCommandBuffer(command_buffer));
+
+      m_images[i].command_buffer = command_buffer;
+   }
+
+   return VK_SUCCESS;
+}
+
+VkCommandBuffer gpu_timestamps::get_command_buffer(VkQueue queue, uint32_t image_index, uint64_t present_id)
+{
+   const std::lock_guard<std::mutex> lock(m_mutex);
+   const uint32_t queue_family_index = m_device.get_queue_family_index(queue);
+   if (queue_family_index == UINT32_MAX)
+   {
+      return VK_NULL_HANDLE;
+   }
+
+   if (m_queue_family_index == UINT32_MAX)
+   {
+      m_queue_family_index = queue_family_index;
+      m_initialized = init(queue_family_index) == VK_SUCCESS;
+   }
+
+   if (!m_initialized || queue_family_index != m_queue_family_index)
+   {
+      return VK_NULL_HANDLE;
+   }
+
+   auto &image = m_images[image_index];
+   image.pending = true;
+   image.present_id = present_id;
+   image.present_time = 0;
+   return image.command_buffer;
+}
+
+void gpu_timestamps::set_present_time(uint32_t image_index, uint64_t present_time)
+{
+   const std::lock_guard<std::mutex> lock(m_mutex);
+   if (m_initialized && m_images[image_index].pending)
+   {
+      m_images[image_index].present_time = present_time;
+   }
+}
+
+bool gpu_timestamps::read_timestamp(uint32_t image_index, completion &result)
+{
+   if (!m_initialized || !m_images[image_index].pending)
+   {
+      return false;
+   }
+   auto &image = m_images[image_index];
+
+   /* The timestamp and its availability. */
+   uint64_t values[2] = {};
+   const VkResult res =
+      m_device.disp.GetQueryPoolResults(m_device.device, m_query_pool, image_index, 1, sizeof(values), values,
+                                        sizeof(values), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+   if ((res != VK_SUCCESS && res != VK_NOT_READY) || values[1] == 0)
+   {
+      return false;
+   }
+   image.pending = false;
+
+   /* The offset of the time domain is the device time, in nanoseconds, minus the local time. */
+   const swapchain_calibrated_time calibration = m_time_domain.calibrate();
+   const double device_ns = static_cast<double>(values[0] & m_valid_bits_mask) * m_time_domain.get_timestamp_period();
+   result.present_id = image.present_id;
+   result.gpu_time = static_cast<uint64_t>(device_ns) - calibration.offset;
+   result.present_time = image.present_time;
+   return true;
+}
+
+} /* namespace wsi */
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file gpu_timestamps.hpp
+ *
+ * @brief Contains the recording of the time at which the GPU completes the rendering of presented images.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+
+#include <vulkan/vulkan.h>
+
+#include "util/custom_allocator.hpp"
+#include "util/helpers.hpp"
+#include "time_domains.hpp"
+
+namespace layer
+{
+class device_private_data;
+} /* namespace layer */
+
+namespace wsi
+{
+
+/**
+ * @brief Records a queue timestamp in the present payload submission of each image of a swapchain.
+ *
+ * The timestamp is written once the submission's wait semaphores are signalled, that is once the application's
+ * rendering of the image is complete. The results are read without waiting, some presents later, and converted to
+ * CLOCK_MONOTONIC with a calibrated device time domain, the clock of the present stage times.
+ *
+ * Command buffers can only be submitted to queues of the family they were allocated for. The first present decides
+ * the family, presents to queues of other families record no timestamp.
+ */
+class gpu_timestamps : private util::noncopyable
+{
+public:
+   /**
+    * @brief GPU completion time of a present.
+    */
+   struct completion
+   {
+      uint64_t present_id;
+      /* CLOCK_MONOTONIC time at which the GPU completed the rendering, in nanoseconds. */
+      uint64_t gpu_time;
+      /* CLOCK_MONOTONIC time at which the image was passed to the backend, 0 if it was not. */
+      uint64_t present_time;
+   };
+
+   /**
+    * @brief Construct the timestamps of a swapchain, which allocates no Vulkan object until the first present.
+    *
+    * @param device      The device of the swapchain.
+    * @param allocator   The allocator of the swapchain.
+    * @param image_count The number of images of the swapchain.
+    */
+   gpu_timestamps(layer::device_private_data &device, const util::allocator &allocator, uint32_t image_count);
+
+   ~gpu_timestamps();
+
+   /**
+    * @brief Check whether GPU timestamps are requested with the WSI_GPU_TIMESTAMPS environment variable.
+    */
+   static bool is_enabled();
+
+   /**
+    * @brief Get the command buffer to add to the present payload submission of an image.
+    *
+    * @param queue       The queue the payload is submitted to.
+    * @param image_index The index of the presented image.
+    * @param present_id  The present ID of the present, 0 if it has none.
+    *
+    * @return The command buffer, or VK_NULL_HANDLE if no timestamp can be recorded on the queue.
+    */
+   VkCommandBuffer get_command_buffer(VkQueue queue, uint32_t image_index, uint64_t present_id);
+
+   /**
+    * @brief Record that the presentation engine passed an image to the backend.
+    *
+    * @param image_index  The index of the image.
+    * @param present_time CLOCK_MONOTONIC time of the present, in nanoseconds.
+    */
+   void set_present_time(uint32_t image_index, uint64_t present_time);
+
+   /**
+    * @brief Read the timestamps written since the last call, without waiting for the others.
+    *
+    * @param callback Called with a @ref completion for each timestamp read.
+    */
+   template <typename Callback>
+   void collect(Callback &&callback)
+   {
+      const std::lock_guard<std::mutex> lock(m_mutex);
+      for (uint32_t i = 0; i < m_images.size(); i++)
+      {
+         completion result{};
+         if (read_timestamp(i, result))
+         {
+            callback(result);
+         }
+      }
+   }
+
+private:
+   struct image_timestamp
+   {
+      VkCommandBuffer command_buffer{ VK_NULL_HANDLE };
+      /* Whether a payload carrying the timestamp was submitted and the timestamp was not read yet. */
+      bool pending{ false };
+      uint64_t present_id{ 0 };
+      uint64_t present_time{ 0 };
+   };
+
+   /**
+    * @brief Create the query pool and record the command buffers, for queues of a family.
+    */
+   VkResult init(uint32_t queue_family_index);
+
+   /**
+    * @brief Read the timestamp of an image if it is pending and available.
+    */
+   bool read_timestamp(uint32_t image_index, completion &result);
+
+   layer::device_private_data &m_device;
+   const util::allocator m_allocator;
+   const uint32_t m_image_count;
+
+   /* Converts device timestamps to CLOCK_MONOTONIC. */
+   vulkan_time_domain m_time_domain;
+   /* Mask of the bits written by timestamps on the queue family. */
+   uint64_t m_valid_bits_mask{ 0 };
+
+   /* Protects the state below, the application presents while the presentation engine collects timestamps. */
+   std::mutex m_mutex;
+   /* UINT32_MAX until the first present, then the family of the command buffers if they could be created. */
+   uint32_t m_queue_family_index{ UINT32_MAX };
+   bool m_initialized{ false };
+   util::vector<image_timestamp> m_images;
+   VkQueryPool m_query_pool{ VK_NULL_HANDLE };
+   VkCommandPool m_command_pool{ VK_NULL_HANDLE };
+};
+
+} /* namespace wsi */
@@ -193,13 +193,40 @@ VkResult surface_properties::get_required_instance_extensions(util::extension_li
       VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
       VK_KHR_EXTERNAL_FENCE_CAPABILITIES_EXTENSION_NAME,
       VK_KHR_EXTERNAL_SEMAPHORE_CAPABILITIES_EXTENSION_NAME,
+#if HEADLESS_DMA_BUF_ENABLED
+      VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME,
+#endif
    };
    return extension_list.add(required_instance_extensions.data(), required_instance_extensions.size());
 }
 
+VkResult surface_properties::get_required_device_extensions(util::extension_list &extension_list)
+{
+#if HEADLESS_DMA_BUF_ENABLED
+   /* Swapchain images are allocated as dma-bufs and imported, so that they can be handed to other devices. */
+   const std::array required_device_extensions{
+      VK_EXT_IMAGE_DRM_FORMAT_MODIFIER_EXTENSION_NAME,
+      VK_KHR_BIND_MEMORY_2_EXTENSION_NAME,
+      VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME,
+      VK_KHR_SAMPLER_YCBCR_CONVERSION_EXTENSION_NAME,
+      VK_KHR_MAINTENANCE1_EXTENSION_NAME,
+      VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME,
+      VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME,
+      VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME,
+      VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME,
+      VK_KHR_EXTERNAL_FENCE_EXTENSION_NAME,
+      VK_KHR_EXTERNAL_FENCE_FD_EXTENSION_NAME,
+   };
+   return extension_list.add(required_device_extensions.data(), required_device_extensions.size());
+#else
+   UNUSED(extension_list);
+   return VK_SUCCESS;
+#endif
+}
+
 bool surface_properties::is_surface_extension_enabled(const layer::instance_private_data &instance_data)
 {
-   return instance_data.is_instance_extension_enabled(VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME);
+   return instance_data.is_instance_extension_enabled(util::known_extension::EXT_headless_surface);
 }
 
 void surface_properties::get_surface_present_scaling_and_gravity(
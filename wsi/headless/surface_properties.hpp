@@ -56,6 +56,8 @@ public:
 
    VkResult get_required_instance_extensions(util::extension_list &extension_list) override;
 
+   VkResult get_required_device_extensions(util::extension_list &extension_list) override;
+
    bool is_surface_extension_enabled(const layer::instance_private_data &instance_data) override;
 
    static surface_properties &get_instance();
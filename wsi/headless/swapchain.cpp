@@ -28,14 +28,31 @@
  * @brief Contains the implementation for a headless swapchain.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <cinttypes>
 #include <cstdlib>
+#include <cstring>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 #include <util/timed_semaphore.hpp>
 
 #include "swapchain.hpp"
 #include "layer/wsi_layer_experimental.hpp"
 #include "util/custom_allocator.hpp"
+#include "util/log.hpp"
+#include "util/macros.hpp"
+#include "util/trace.hpp"
+
+#if HEADLESS_DMA_BUF_ENABLED
+#include <fcntl.h>
+
+#include "util/drm/drm_utils.hpp"
+#include "util/format_modifiers.hpp"
+#endif
 
 namespace wsi
 {
@@ -44,9 +61,33 @@ namespace headless
 
 struct image_data
 {
+   image_data(const VkDevice &device, const util::allocator &allocator)
+#if HEADLESS_DMA_BUF_ENABLED
+      : external_mem(device, allocator)
+#endif
+   {
+      UNUSED(device);
+      UNUSED(allocator);
+   }
+
    /* Device memory backing the image. */
    VkDeviceMemory memory{};
+   /* Size of memory, in bytes. */
+   VkDeviceSize memory_size{ 0 };
    fence_sync present_fence;
+   /* Value of the present timeline signalled by the latest present payload, when the timeline is used. */
+   uint64_t present_payload_value{ 0 };
+#if HEADLESS_DMA_BUF_ENABLED
+   /* Whether the image is backed by a dma-buf, in which case the members below replace memory and present_fence. */
+   bool is_dma_buf{ false };
+   external_memory external_mem;
+   /* Exported to the image consumer, which waits for it rather than the presentation thread. */
+   sync_fd_fence_sync dma_buf_present_fence;
+   /* Given back by the image consumer with the image, the next acquire of the image waits for it. */
+   util::fd_owner release_fence;
+   /* Whether the image consumer holds the image, protected by the image status lock. */
+   bool held_by_consumer{ false };
+#endif
 };
 
 swapchain::swapchain(layer::device_private_data &dev_data, const VkAllocationCallbacks *pAllocator)
@@ -54,6 +95,9 @@ swapchain::swapchain(layer::device_private_data &dev_data, const VkAllocationCal
 #if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
    , m_image_compression_control{}
 #endif
+#if HEADLESS_DMA_BUF_ENABLED
+   , m_image_layout(m_allocator)
+#endif
 {
 }
 
@@ -61,6 +105,14 @@ swapchain::~swapchain()
 {
    /* Call the base's teardown */
    teardown();
+
+#if HEADLESS_DMA_BUF_ENABLED
+   if (m_wsi_allocator != nullptr)
+   {
+      wsialloc_delete(m_wsi_allocator);
+      m_wsi_allocator = nullptr;
+   }
+#endif
 }
 
 VkResult swapchain::init_platform(VkDevice device, const VkSwapchainCreateInfoKHR *swapchain_create_info,
@@ -73,11 +125,27 @@ VkResult swapchain::init_platform(VkDevice device, const VkSwapchainCreateInfoKH
    else
    {
       use_presentation_thread = true;
+      TRY(init_vblank_timer());
+   }
+
+   bool use_present_timeline = timeline_semaphore_sync::is_supported(m_device_data);
+#if HEADLESS_DMA_BUF_ENABLED
+   init_dma_buf();
+   /* The present fences of dma-buf images are exported to the image consumer instead. */
+   use_present_timeline = use_present_timeline && m_wsi_allocator == nullptr;
+#endif
+   if (use_present_timeline)
+   {
+      m_present_timeline = timeline_semaphore_sync::create(m_device_data);
+      if (!m_present_timeline.has_value())
+      {
+         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
    }
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
    std::array<util::unique_ptr<wsi::vulkan_time_domain>, 4> time_domains_array = {
       m_allocator.make_unique<wsi::vulkan_time_domain>(VK_PRESENT_STAGE_QUEUE_OPERATIONS_END_BIT_EXT,
-                                                       VK_TIME_DOMAIN_DEVICE_KHR),
+                                                       VK_TIME_DOMAIN_DEVICE_KHR, &m_device_data),
       m_allocator.make_unique<wsi::vulkan_time_domain>(VK_PRESENT_STAGE_IMAGE_LATCHED_BIT_EXT,
                                                        VK_TIME_DOMAIN_CLOCK_MONOTONIC_RAW_KHR),
       m_allocator.make_unique<wsi::vulkan_time_domain>(VK_PRESENT_STAGE_IMAGE_FIRST_PIXEL_OUT_BIT_EXT,
@@ -99,8 +167,363 @@ VkResult swapchain::init_platform(VkDevice device, const VkSwapchainCreateInfoKH
    return VK_SUCCESS;
 }
 
+VkResult swapchain::init_vblank_timer()
+{
+   const char *refresh_rate_env = std::getenv("WSI_HEADLESS_REFRESH_RATE");
+   if (refresh_rate_env == nullptr)
+   {
+      return VK_SUCCESS;
+   }
+
+   char *end = nullptr;
+   const double refresh_rate = std::strtod(refresh_rate_env, &end);
+   if (end == refresh_rate_env || !(refresh_rate >= 1.0))
+   {
+      WSI_LOG_WARNING("Ignoring invalid WSI_HEADLESS_REFRESH_RATE \"%s\".", refresh_rate_env);
+      return VK_SUCCESS;
+   }
+
+   if (const char *latency_env = std::getenv("WSI_HEADLESS_COMPOSITOR_LATENCY_US"))
+   {
+      m_compositor_latency = std::strtoull(latency_env, nullptr, 10) * 1000;
+   }
+
+   m_vblank_timer = util::fd_owner(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC));
+   if (!m_vblank_timer.is_valid())
+   {
+      WSI_LOG_ERROR("Failed to create the vblank timer: %s", std::strerror(errno));
+      return VK_ERROR_INITIALIZATION_FAILED;
+   }
+
+   m_refresh_interval = static_cast<uint64_t>(1000000000.0 / refresh_rate);
+   m_vblank_phase = util::get_monotonic_time_ns();
+   return VK_SUCCESS;
+}
+
+uint64_t swapchain::wait_for_vblank(const pending_present_request &pending_present)
+{
+   constexpr uint64_t NSEC_PER_SEC = 1000000000;
+
+   if (pending_present.target_present_time != 0)
+   {
+      /* Far targets are waited for in bounded steps, so that teardown is not held up. */
+      wait_for_target_present_time(pending_present.target_present_time);
+   }
+
+   const uint64_t now = util::get_monotonic_time_ns();
+   const uint64_t ready_time =
+      std::max({ now, pending_present.queued_time + m_compositor_latency, pending_present.target_present_time });
+
+   uint64_t latch_time = ready_time;
+   const bool missed_vblank = m_last_latch_time != 0 && ready_time > m_last_latch_time + m_refresh_interval;
+   if (m_present_mode != VK_PRESENT_MODE_IMMEDIATE_KHR &&
+       !(m_present_mode == VK_PRESENT_MODE_FIFO_RELAXED_KHR && missed_vblank))
+   {
+      /* Round up to the next vblank that has not latched a present yet. */
+      const uint64_t earliest = std::max(ready_time, m_last_latch_time + 1) - m_vblank_phase;
+      latch_time = m_vblank_phase + (earliest + m_refresh_interval - 1) / m_refresh_interval * m_refresh_interval;
+   }
+
+   if (latch_time > now)
+   {
+      struct itimerspec deadline = {};
+      deadline.it_value.tv_sec = static_cast<time_t>(latch_time / NSEC_PER_SEC);
+      deadline.it_value.tv_nsec = static_cast<long>(latch_time % NSEC_PER_SEC);
+      if (timerfd_settime(m_vblank_timer.get(), TFD_TIMER_ABSTIME, &deadline, nullptr) == 0)
+      {
+         uint64_t expirations = 0;
+         while (read(m_vblank_timer.get(), &expirations, sizeof(expirations)) < 0 && errno == EINTR)
+         {
+         }
+      }
+      else
+      {
+         WSI_LOG_WARNING("Failed to arm the vblank timer: %s", std::strerror(errno));
+      }
+   }
+
+   m_last_latch_time = latch_time;
+   return latch_time;
+}
+
+#if HEADLESS_DMA_BUF_ENABLED
+void swapchain::init_dma_buf()
+{
+   if (!sync_fd_fence_sync::is_supported(m_device_data.instance_data, m_device_data.physical_device))
+   {
+      WSI_LOG_WARNING("Present fences cannot be exported as sync FDs, headless images use device memory.");
+      return;
+   }
+
+   WSIALLOC_ASSERT_VERSION();
+   if (wsialloc_new(&m_wsi_allocator) != WSIALLOC_ERROR_NONE)
+   {
+      WSI_LOG_WARNING("Failed to create wsi allocator, headless images use device memory.");
+      m_wsi_allocator = nullptr;
+   }
+}
+
+VkResult swapchain::select_dma_buf_format(VkImageCreateInfo &image_create_info)
+{
+   util::drm_format_properties_list drm_format_props(util::allocator(m_allocator, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND));
+   TRY_LOG(util::get_drm_format_properties(m_device_data.physical_device, image_create_info.format, drm_format_props),
+           "Failed to get format properties");
+
+   util::vector<wsialloc_format> importable_formats(util::allocator(m_allocator, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND));
+   const uint32_t fourcc = util::drm::vk_to_drm_format(image_create_info.format);
+   for (const auto &prop : drm_format_props)
+   {
+      util::drm_image_format_properties props = {};
+      if (fourcc == 0 || util::get_drm_image_format_properties(m_device_data.physical_device, image_create_info,
+                                                               prop.drmFormatModifier, props) != VK_SUCCESS)
+      {
+         continue;
+      }
+
+      const VkImageFormatProperties &format_props = props.image_format_properties;
+      if (format_props.maxExtent.width < image_create_info.extent.width ||
+          format_props.maxExtent.height < image_create_info.extent.height ||
+          format_props.maxArrayLayers < image_create_info.arrayLayers ||
+          (props.external_memory_features & VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT_KHR) == 0)
+      {
+         continue;
+      }
+
+      uint64_t flags =
+         (prop.drmFormatModifierTilingFeatures & VK_FORMAT_FEATURE_DISJOINT_BIT) ? 0 : WSIALLOC_FORMAT_NON_DISJOINT;
+      if (!importable_formats.try_push_back(wsialloc_format{ fourcc, prop.drmFormatModifier, flags }))
+      {
+         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+   }
+
+   if (importable_formats.empty())
+   {
+      WSI_LOG_WARNING("The swapchain format cannot be imported from a dma-buf, headless images use device memory.");
+      wsialloc_delete(m_wsi_allocator);
+      m_wsi_allocator = nullptr;
+      return VK_SUCCESS;
+   }
+
+   /* Lay out the planes without allocating memory, all the images are then allocated with the selected format. */
+   const bool is_protected_memory = (image_create_info.flags & VK_IMAGE_CREATE_PROTECTED_BIT) != 0;
+   wsialloc_allocate_info alloc_info = { importable_formats.data(), static_cast<unsigned>(importable_formats.size()),
+                                         image_create_info.extent.width, image_create_info.extent.height,
+                                         WSIALLOC_ALLOCATE_NO_MEMORY |
+                                            (is_protected_memory ? WSIALLOC_ALLOCATE_PROTECTED : 0) };
+   wsialloc_allocate_result alloc_result = {};
+   std::fill(std::begin(alloc_result.buffer_fds), std::end(alloc_result.buffer_fds), -1);
+   const auto res = wsialloc_alloc(m_wsi_allocator, &alloc_info, &alloc_result);
+   if (res != WSIALLOC_ERROR_NONE)
+   {
+      WSI_LOG_ERROR("Failed to select a dma-buf format. WSI error: %d", static_cast<int>(res));
+      return res == WSIALLOC_ERROR_NOT_SUPPORTED ? VK_ERROR_FORMAT_NOT_SUPPORTED : VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+   m_allocated_format = alloc_result.format;
+
+   external_memory layout(m_device, m_allocator);
+   layout.set_strides(alloc_result.average_row_strides);
+   layout.set_offsets(alloc_result.offsets);
+   for (const auto &prop : drm_format_props)
+   {
+      if (prop.drmFormatModifier == m_allocated_format.modifier)
+      {
+         layout.set_num_memories(prop.drmFormatModifierPlaneCount);
+      }
+   }
+   layout.set_format_info(alloc_result.is_disjoint, util::drm::drm_fourcc_format_get_num_planes(fourcc));
+   layout.set_memory_handle_type(VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT);
+   TRY_LOG_CALL(layout.fill_image_plane_layouts(m_image_layout));
+
+   if (layout.is_disjoint())
+   {
+      image_create_info.flags |= VK_IMAGE_CREATE_DISJOINT_BIT;
+   }
+   layout.fill_drm_mod_info(image_create_info.pNext, m_drm_mod_info, m_image_layout, m_allocated_format.modifier);
+   layout.fill_external_info(m_external_info, &m_drm_mod_info);
+   image_create_info.pNext = &m_external_info;
+   image_create_info.tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT;
+   return VK_SUCCESS;
+}
+
+VkResult swapchain::allocate_and_bind_dma_buf(swapchain_image &image)
+{
+   const std::lock_guard<std::recursive_mutex> lock(m_image_status_mutex);
+
+   auto *data = create_image_data<image_data>(image, m_device, m_object_arena.get_allocator());
+   if (data == nullptr)
+   {
+      m_device_data.disp.DestroyImage(m_device, image.image, get_allocation_callbacks());
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+   set_image_status(image, wsi::swapchain_image::FREE);
+   data->is_dma_buf = true;
+
+   const bool is_protected_memory = (m_image_create_info.flags & VK_IMAGE_CREATE_PROTECTED_BIT) != 0;
+   wsialloc_allocate_info alloc_info = { &m_allocated_format, 1, m_image_create_info.extent.width,
+                                         m_image_create_info.extent.height,
+                                         is_protected_memory ? WSIALLOC_ALLOCATE_PROTECTED : 0 };
+   wsialloc_allocate_result alloc_result = {};
+   std::fill(std::begin(alloc_result.buffer_fds), std::end(alloc_result.buffer_fds), -1);
+   const auto alloc_res = wsialloc_alloc(m_wsi_allocator, &alloc_info, &alloc_result);
+   if (alloc_res != WSIALLOC_ERROR_NONE)
+   {
+      WSI_LOG_ERROR("Failed allocation of DMA Buffer. WSI error: %d", static_cast<int>(alloc_res));
+      destroy_image(image);
+      return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+   }
+
+   auto &external_memory = data->external_mem;
+   external_memory.set_strides(alloc_result.average_row_strides);
+   external_memory.set_buffer_fds(alloc_result.buffer_fds);
+   external_memory.set_offsets(alloc_result.offsets);
+
+   /* The buffer file descriptors are owned by the imported memory, the consumer is handed duplicates. */
+   VkResult res = external_memory.retain_buffer_fds();
+   if (res != VK_SUCCESS)
+   {
+      destroy_image(image);
+      return res;
+   }
+
+   const uint32_t num_planes = util::drm::drm_fourcc_format_get_num_planes(alloc_result.format.fourcc);
+   uint32_t num_memory_planes = 0;
+   for (uint32_t i = 0; i < num_planes; ++i)
+   {
+      auto it = std::find(std::begin(alloc_result.buffer_fds) + i + 1, std::end(alloc_result.buffer_fds),
+                          alloc_result.buffer_fds[i]);
+      if (it == std::end(alloc_result.buffer_fds))
+      {
+         num_memory_planes++;
+      }
+   }
+   external_memory.set_num_memories(num_memory_planes);
+   external_memory.set_format_info(alloc_result.is_disjoint, num_planes);
+   external_memory.set_memory_handle_type(VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT);
+   external_memory.set_protected_memory(is_protected_memory);
+
+   res = external_memory.import_memory_and_bind_swapchain_image(image.image);
+   if (res != VK_SUCCESS)
+   {
+      WSI_LOG_ERROR("Failed to import memory and bind swapchain image.");
+      destroy_image(image);
+      return res;
+   }
+
+   auto present_fence = sync_fd_fence_sync::create(m_device_data);
+   if (!present_fence.has_value())
+   {
+      destroy_image(image);
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+   data->dma_buf_present_fence = std::move(present_fence.value());
+
+   return VK_SUCCESS;
+}
+
+bool swapchain::hand_over_image(const pending_present_request &pending_present)
+{
+   auto &image = m_swapchain_images[pending_present.image_index];
+   auto *data = reinterpret_cast<image_data *>(image.data);
+   if (!data->is_dma_buf || m_present_mode == VK_PRESENT_MODE_SHARED_DEMAND_REFRESH_KHR ||
+       m_present_mode == VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR)
+   {
+      return false;
+   }
+
+   /* The lock is held while the consumer runs, so that no image is handed over once the consumer is unregistered. */
+   const std::lock_guard<std::mutex> consumer_lock(m_image_consumer_mutex);
+   if (m_image_consumer == nullptr)
+   {
+      return false;
+   }
+
+   VkSwapchainImageDmaBufARM dma_buf = {};
+   dma_buf.imageIndex = pending_present.image_index;
+   dma_buf.presentId = pending_present.present_id;
+   dma_buf.width = m_image_create_info.extent.width;
+   dma_buf.height = m_image_create_info.extent.height;
+   dma_buf.drmFourcc = m_allocated_format.fourcc;
+   dma_buf.drmFormatModifier = m_allocated_format.modifier;
+   dma_buf.planeCount = data->external_mem.get_num_planes();
+   const auto &plane_fds = data->external_mem.get_retained_buffer_fds();
+   for (uint32_t plane = 0; plane < VK_SWAPCHAIN_IMAGE_MAX_PLANES_ARM; plane++)
+   {
+      const bool valid_plane = plane < dma_buf.planeCount;
+      dma_buf.planeFds[plane] = valid_plane ? plane_fds[plane] : -1;
+      dma_buf.planeOffsets[plane] = valid_plane ? data->external_mem.get_offsets()[plane] : 0;
+      dma_buf.planeStrides[plane] = valid_plane ? static_cast<uint32_t>(data->external_mem.get_strides()[plane]) : 0;
+   }
+
+   /* The presentation thread has usually waited for rendering already, the sync FD is then signalled or -1. */
+   auto acquire_fence = data->dma_buf_present_fence.export_sync_fd();
+   dma_buf.acquireSyncFd =
+      acquire_fence.has_value() && acquire_fence->is_valid() ? fcntl(acquire_fence->get(), F_DUPFD_CLOEXEC, 0) : -1;
+
+   {
+      const std::lock_guard<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+      set_image_status(image, swapchain_image::PRESENTED);
+      data->held_by_consumer = true;
+   }
+
+   m_image_consumer(m_image_consumer_user_data, &dma_buf);
+   return true;
+}
+
+VkResult swapchain::set_image_consumer(PFN_vkSwapchainImageConsumerARM consumer, void *user_data)
+{
+   if (m_wsi_allocator == nullptr)
+   {
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+   }
+
+   const std::lock_guard<std::mutex> consumer_lock(m_image_consumer_mutex);
+   m_image_consumer = consumer;
+   m_image_consumer_user_data = user_data;
+   return VK_SUCCESS;
+}
+
+VkResult swapchain::release_consumer_image(uint32_t image_index, int release_fd)
+{
+   std::unique_lock<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+   if (image_index >= m_swapchain_images.size() || m_swapchain_images[image_index].data == nullptr)
+   {
+      return VK_ERROR_VALIDATION_FAILED_EXT;
+   }
+
+   auto *data = reinterpret_cast<image_data *>(m_swapchain_images[image_index].data);
+   if (!data->held_by_consumer)
+   {
+      return VK_ERROR_VALIDATION_FAILED_EXT;
+   }
+   data->held_by_consumer = false;
+   data->release_fence = util::fd_owner(release_fd);
+   image_status_lock.unlock();
+
+   unpresent_image(image_index);
+   return VK_SUCCESS;
+}
+
+util::fd_owner swapchain::image_take_release_fence(swapchain_image &image)
+{
+   auto *data = reinterpret_cast<image_data *>(image.data);
+   if (data == nullptr || !data->is_dma_buf)
+   {
+      return util::fd_owner{};
+   }
+   return std::move(data->release_fence);
+}
+#endif
+
 VkResult swapchain::allocate_and_bind_swapchain_image(VkImageCreateInfo image_create, swapchain_image &image)
 {
+#if HEADLESS_DMA_BUF_ENABLED
+   if (m_wsi_allocator != nullptr)
+   {
+      return allocate_and_bind_dma_buf(image);
+   }
+#endif
+
    VkResult res = VK_SUCCESS;
    const std::lock_guard<std::recursive_mutex> lock(m_image_status_mutex);
 
@@ -126,14 +549,13 @@ VkResult swapchain::allocate_and_bind_swapchain_image(VkImageCreateInfo image_cr
    image_data *data = nullptr;
 
    /* Create image_data */
-   data = m_allocator.create<image_data>(1);
+   data = create_image_data<image_data>(image, m_device, m_object_arena.get_allocator());
    if (data == nullptr)
    {
       m_device_data.disp.DestroyImage(m_device, image.image, get_allocation_callbacks());
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
-   image.data = reinterpret_cast<void *>(data);
-   image.status = wsi::swapchain_image::FREE;
+   set_image_status(image, wsi::swapchain_image::FREE);
 
    res = m_device_data.disp.AllocateMemory(m_device, &mem_info, get_allocation_callbacks(), &data->memory);
    assert(VK_SUCCESS == res);
@@ -142,6 +564,7 @@ VkResult swapchain::allocate_and_bind_swapchain_image(VkImageCreateInfo image_cr
       destroy_image(image);
       return res;
    }
+   data->memory_size = mem_info.allocationSize;
 
    res = m_device_data.disp.BindImageMemory(m_device, image.image, data->memory, 0);
    assert(VK_SUCCESS == res);
@@ -151,20 +574,31 @@ VkResult swapchain::allocate_and_bind_swapchain_image(VkImageCreateInfo image_cr
       return res;
    }
 
-   /* Initialize presentation fence. */
-   auto present_fence = fence_sync::create(m_device_data);
-   if (!present_fence.has_value())
+   /* Initialize presentation fence, the present timeline replaces it when available. */
+   if (!m_present_timeline.has_value())
    {
-      destroy_image(image);
-      return VK_ERROR_OUT_OF_HOST_MEMORY;
+      auto present_fence = fence_sync::create(m_device_data);
+      if (!present_fence.has_value())
+      {
+         destroy_image(image);
+         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+      data->present_fence = std::move(present_fence.value());
    }
-   data->present_fence = std::move(present_fence.value());
 
    return res;
 }
 
 VkResult swapchain::create_swapchain_image(VkImageCreateInfo image_create_info, swapchain_image &image)
 {
+#if HEADLESS_DMA_BUF_ENABLED
+   if (m_wsi_allocator != nullptr && m_allocated_format.fourcc != 0)
+   {
+      /* The first image set up m_image_create_info to import dma-bufs of the selected format. */
+      return m_device_data.disp.CreateImage(m_device, &m_image_create_info, get_allocation_callbacks(), &image.image);
+   }
+#endif
+
    m_image_create_info = image_create_info;
 #if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
    if (m_device_data.is_swapchain_compression_control_enabled())
@@ -181,12 +615,63 @@ VkResult swapchain::create_swapchain_image(VkImageCreateInfo image_create_info,
    }
 #endif
 
+#if HEADLESS_DMA_BUF_ENABLED
+   if (m_wsi_allocator != nullptr)
+   {
+      TRY_LOG_CALL(select_dma_buf_format(m_image_create_info));
+   }
+#endif
+
    return m_device_data.disp.CreateImage(m_device, &m_image_create_info, get_allocation_callbacks(), &image.image);
 }
 
-void swapchain::present_image(const pending_present_request &pending_present)
+void swapchain::present_image(const pending_present_request &queued_present)
 {
+   pending_present_request pending_present = queued_present;
+   uint64_t present_time = 0;
+   if (m_vblank_timer.is_valid())
+   {
+      present_time = wait_for_vblank(pending_present);
+      if (m_present_mode == VK_PRESENT_MODE_MAILBOX_KHR)
+      {
+         /* Presents queued while waiting for the vblank replace this one, only the newest is latched. */
+         VkResult res = take_latest_pending_present(pending_present);
+         if (res != VK_SUCCESS)
+         {
+            set_error_state(res);
+            return;
+         }
+      }
+   }
+   else
+   {
+      /* Without a display, the image is considered shown as soon as it is presented. */
+      present_time = util::get_monotonic_time_ns();
+   }
+
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+   set_present_stage_time(pending_present.present_id, VK_PRESENT_STAGE_IMAGE_LATCHED_BIT_EXT, present_time);
+   set_present_stage_time(pending_present.present_id, VK_PRESENT_STAGE_IMAGE_FIRST_PIXEL_OUT_BIT_EXT, present_time);
+   set_present_stage_time(pending_present.present_id, VK_PRESENT_STAGE_IMAGE_FIRST_PIXEL_VISIBLE_BIT_EXT,
+                          present_time);
+#else
+   UNUSED(present_time);
+#endif
+   WSI_TRACE_INSTANT("image presented swapchain=%p present_id=%" PRIu64 " image=%u", static_cast<void *>(this),
+                     pending_present.present_id, pending_present.image_index);
+   if (pending_present.present_id != 0)
+   {
+      WSI_TRACE_END_ASYNC(pending_present.present_id, "frame swapchain=%p", static_cast<void *>(this));
+   }
+   frame_displayed();
    set_present_id(pending_present.present_id);
+#if HEADLESS_DMA_BUF_ENABLED
+   if (hand_over_image(pending_present))
+   {
+      /* The image is unpresented when the consumer releases it. */
+      return;
+   }
+#endif
    unpresent_image(pending_present.image_index);
 }
 
@@ -201,7 +686,7 @@ void swapchain::destroy_image(wsi::swapchain_image &image)
          image.image = VK_NULL_HANDLE;
       }
 
-      image.status = wsi::swapchain_image::INVALID;
+      set_image_status(image, wsi::swapchain_image::INVALID);
    }
 
    image_status_lock.unlock();
@@ -214,31 +699,96 @@ void swapchain::destroy_image(wsi::swapchain_image &image)
          m_device_data.disp.FreeMemory(m_device, data->memory, get_allocation_callbacks());
          data->memory = VK_NULL_HANDLE;
       }
-      m_allocator.destroy(1, data);
-      image.data = nullptr;
+      destroy_image_data<image_data>(image);
    }
 }
 
+void swapchain::add_image_memory_footprint(const wsi::swapchain_image &image,
+                                           wsi::swapchain_memory_footprint &footprint) const
+{
+   if (image.data == nullptr)
+   {
+      return;
+   }
+
+   auto *data = reinterpret_cast<const image_data *>(image.data);
+#if HEADLESS_DMA_BUF_ENABLED
+   if (data->is_dma_buf)
+   {
+      footprint.dma_buf_bytes += data->external_mem.get_imported_size();
+      return;
+   }
+#endif
+   footprint.device_memory_bytes += data->memory_size;
+}
+
 VkResult swapchain::image_set_present_payload(swapchain_image &image, VkQueue queue,
                                               const queue_submit_semaphores &semaphores, const void *submission_pnext)
 {
    auto data = reinterpret_cast<image_data *>(image.data);
+   if (m_present_timeline.has_value())
+   {
+      return m_present_timeline->set_payload(queue, semaphores, submission_pnext, data->present_payload_value);
+   }
+#if HEADLESS_DMA_BUF_ENABLED
+   if (data->is_dma_buf)
+   {
+      return data->dma_buf_present_fence.set_payload(queue, semaphores, submission_pnext);
+   }
+#endif
    return data->present_fence.set_payload(queue, semaphores, submission_pnext);
 }
 
 VkResult swapchain::image_wait_present(swapchain_image &image, uint64_t timeout)
 {
    auto data = reinterpret_cast<image_data *>(image.data);
+   if (m_present_timeline.has_value())
+   {
+      return m_present_timeline->wait_payload(data->present_payload_value, timeout);
+   }
+#if HEADLESS_DMA_BUF_ENABLED
+   if (data->is_dma_buf)
+   {
+      return data->dma_buf_present_fence.wait_payload(timeout);
+   }
+#endif
    return data->present_fence.wait_payload(timeout);
 }
 
+bool swapchain::supports_batched_present_payload() const
+{
+   /* Only the timeline semaphore lets a submission shared with other swapchains signal the payload. */
+   return m_present_timeline.has_value();
+}
+
+void swapchain::image_get_batched_present_payload(swapchain_image &image, VkQueue queue,
+                                                  timeline_semaphore_point &signal, timeline_semaphore_point &wait)
+{
+   UNUSED(image);
+   assert(m_present_timeline.has_value());
+   m_present_timeline->get_next_payload(queue, signal, wait);
+}
+
+void swapchain::image_commit_batched_present_payload(swapchain_image &image, VkQueue queue)
+{
+   auto data = reinterpret_cast<image_data *>(image.data);
+   data->present_payload_value = m_present_timeline->commit_payload(queue);
+}
+
 VkResult swapchain::bind_swapchain_image(VkDevice &device, const VkBindImageMemoryInfo *bind_image_mem_info,
                                          const VkBindImageMemorySwapchainInfoKHR *bind_sc_info)
 {
    auto &device_data = layer::device_private_data::get(device);
 
    const wsi::swapchain_image &swapchain_image = m_swapchain_images[bind_sc_info->imageIndex];
-   VkDeviceMemory memory = reinterpret_cast<image_data *>(swapchain_image.data)->memory;
+   auto *data = reinterpret_cast<image_data *>(swapchain_image.data);
+#if HEADLESS_DMA_BUF_ENABLED
+   if (data->is_dma_buf)
+   {
+      return data->external_mem.bind_swapchain_image_memory(bind_image_mem_info->image);
+   }
+#endif
+   VkDeviceMemory memory = data->memory;
 
    return device_data.disp.BindImageMemory(device, bind_image_mem_info->image, memory, 0);
 }
@@ -33,17 +33,35 @@
 #include <vulkan/vk_icd.h>
 #include <vulkan/vulkan.h>
 #include <wsi/swapchain_base.hpp>
+#include "util/file_descriptor.hpp"
+
+#if HEADLESS_DMA_BUF_ENABLED
+#include <mutex>
+
+#include "util/wsialloc/wsialloc.h"
+#include "wsi/external_memory.hpp"
+#endif
 
 namespace wsi
 {
 namespace headless
 {
 
+struct image_data;
+
 /**
  * @brief Headless swapchain class.
  *
  * This class is mostly empty, because all the swapchain stuff is handled by the swapchain class,
  * which we inherit. This class only provides a way to create an image and page-flip ops.
+ *
+ * Images are shown as soon as they are presented, unless the WSI_HEADLESS_REFRESH_RATE environment variable sets
+ * the refresh rate of a simulated display. Presents are then latched on its vblanks, which are paced with a timerfd,
+ * and WSI_HEADLESS_COMPOSITOR_LATENCY_US sets how long a simulated compositor holds a present before it can be
+ * latched.
+ *
+ * When built with HEADLESS_DMA_BUF_ENABLED, images are allocated as dma-bufs through wsialloc so that presented images
+ * can be handed to a consumer registered with @ref set_image_consumer without copying them.
  */
 class swapchain : public wsi::swapchain_base
 {
@@ -52,6 +70,12 @@ public:
 
    ~swapchain();
 
+#if HEADLESS_DMA_BUF_ENABLED
+   VkResult set_image_consumer(PFN_vkSwapchainImageConsumerARM consumer, void *user_data) override;
+
+   VkResult release_consumer_image(uint32_t image_index, int release_fd) override;
+#endif
+
 protected:
    /**
     * @brief Platform specific init
@@ -97,6 +121,9 @@ protected:
     */
    void destroy_image(wsi::swapchain_image &image);
 
+   void add_image_memory_footprint(const wsi::swapchain_image &image,
+                                   wsi::swapchain_memory_footprint &footprint) const override;
+
    /**
     * @brief Sets the present payload for a swapchain image.
     *
@@ -112,6 +139,17 @@ protected:
 
    VkResult image_wait_present(swapchain_image &image, uint64_t timeout) override;
 
+   bool supports_batched_present_payload() const override;
+
+   void image_get_batched_present_payload(swapchain_image &image, VkQueue queue, timeline_semaphore_point &signal,
+                                          timeline_semaphore_point &wait) override;
+
+   void image_commit_batched_present_payload(swapchain_image &image, VkQueue queue) override;
+
+#if HEADLESS_DMA_BUF_ENABLED
+   util::fd_owner image_take_release_fence(swapchain_image &image) override;
+#endif
+
    /**
     * @brief Bind image to a swapchain
     *
@@ -125,10 +163,126 @@ protected:
    VkResult bind_swapchain_image(VkDevice &device, const VkBindImageMemoryInfo *bind_image_mem_info,
                                  const VkBindImageMemorySwapchainInfoKHR *bind_sc_info) override;
 
+   uint64_t get_refresh_interval() const override
+   {
+      return m_refresh_interval;
+   }
+
+   bool schedules_target_present_time() const override
+   {
+      return m_vblank_timer.is_valid();
+   }
+
 private:
+   /**
+    * @brief Read the simulated display parameters from the environment and start its vblank timer.
+    *
+    * @return VK_SUCCESS on success, or VK_ERROR_INITIALIZATION_FAILED if the timer cannot be created.
+    */
+   VkResult init_vblank_timer();
+
+   /**
+    * @brief Wait for the vblank of the simulated display that latches a present.
+    *
+    * The present is latched on the first vblank after its target present time and after the compositor has held
+    * it, and at most one present is latched on each vblank. In immediate mode, and in FIFO relaxed mode when the
+    * previous vblank was missed, it is latched as soon as it is ready instead.
+    *
+    * @param pending_present The present request to latch.
+    *
+    * @return The CLOCK_MONOTONIC time of the vblank, in nanoseconds.
+    */
+   uint64_t wait_for_vblank(const pending_present_request &pending_present);
+
+   /**
+    * @brief Refresh interval of the simulated display in nanoseconds, or 0 if images are shown immediately.
+    */
+   uint64_t m_refresh_interval{ 0 };
+
+   /**
+    * @brief Time a simulated compositor holds a present before it can be latched, in nanoseconds.
+    */
+   uint64_t m_compositor_latency{ 0 };
+
+   /**
+    * @brief CLOCK_MONOTONIC time of a vblank of the simulated display, all the other vblanks are a whole number of
+    *        refresh intervals away from it.
+    */
+   uint64_t m_vblank_phase{ 0 };
+
+   /**
+    * @brief Time the latest present was latched, 0 before the first present.
+    */
+   uint64_t m_last_latch_time{ 0 };
+
+   /**
+    * @brief Timer used to sleep until vblanks, only valid when the display is simulated.
+    */
+   util::fd_owner m_vblank_timer;
+
+#if HEADLESS_DMA_BUF_ENABLED
+   /**
+    * @brief Create the allocator of the dma-bufs, if the device can export the present fences as sync FDs.
+    */
+   void init_dma_buf();
+
+   /**
+    * @brief Select the format of the dma-bufs and fill in the create info of images importing them.
+    *
+    * @param[in,out] image_create_info The create info of the swapchain images.
+    *
+    * @return VK_SUCCESS, also when the format cannot be imported and images fall back to device memory, or an error
+    *         code on failure.
+    */
+   VkResult select_dma_buf_format(VkImageCreateInfo &image_create_info);
+
+   /**
+    * @brief Allocate a dma-buf for an image and import it as the memory of the image.
+    */
+   VkResult allocate_and_bind_dma_buf(swapchain_image &image);
+
+   /**
+    * @brief Hand a presented image to the image consumer.
+    *
+    * @return true if the consumer holds the image, false if there is no consumer.
+    */
+   bool hand_over_image(const pending_present_request &pending_present);
+
+   /**
+    * @brief Allocator of the dma-bufs, nullptr if images use device memory.
+    */
+   wsialloc_allocator *m_wsi_allocator{ nullptr };
+
+   /**
+    * @brief Format allocated for all the images, selected when the first image is created.
+    */
+   wsialloc_format m_allocated_format{};
+
+   /**
+    * @brief Structures chained to the create info of images importing dma-bufs.
+    */
+   util::vector<VkSubresourceLayout> m_image_layout;
+   VkExternalMemoryImageCreateInfoKHR m_external_info{};
+   VkImageDrmFormatModifierExplicitCreateInfoEXT m_drm_mod_info{};
+
+   /**
+    * @brief Protects @ref m_image_consumer and @ref m_image_consumer_user_data.
+    */
+   std::mutex m_image_consumer_mutex;
+   PFN_vkSwapchainImageConsumerARM m_image_consumer{ nullptr };
+   void *m_image_consumer_user_data{ nullptr };
+#endif
+
 #if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
    VkImageCompressionControlEXT m_image_compression_control;
 #endif
+
+   /**
+    * @brief Timeline semaphore signalled by the present payloads, when supported by the device.
+    *
+    * When empty, every image uses a fence for its present payload instead.
+    */
+   std::optional<timeline_semaphore_sync> m_present_timeline;
 };
 
 } /* namespace headless */
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file latency_stats.cpp
+ *
+ * @brief Contains the implementation of the swapchain latency histograms.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "latency_stats.hpp"
+#include "util/log.hpp"
+
+namespace wsi
+{
+
+void latency_histogram::record(uint64_t duration)
+{
+   const size_t bucket = duration == 0 ? 0 : static_cast<size_t>(64 - __builtin_clzll(duration));
+   m_buckets[bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT - 1].fetch_add(1, std::memory_order_relaxed);
+   m_sample_count.fetch_add(1, std::memory_order_relaxed);
+   m_total_duration.fetch_add(duration, std::memory_order_relaxed);
+
+   uint64_t max_duration = m_max_duration.load(std::memory_order_relaxed);
+   while (duration > max_duration &&
+          !m_max_duration.compare_exchange_weak(max_duration, duration, std::memory_order_relaxed))
+   {
+   }
+}
+
+latency_histogram::snapshot latency_histogram::get_snapshot() const
+{
+   snapshot result{};
+   result.sample_count = m_sample_count.load(std::memory_order_relaxed);
+   result.total_duration = m_total_duration.load(std::memory_order_relaxed);
+   result.max_duration = m_max_duration.load(std::memory_order_relaxed);
+   for (size_t i = 0; i < BUCKET_COUNT; i++)
+   {
+      result.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+   }
+   return result;
+}
+
+/**
+ * @brief Get an upper bound of a percentile of the durations of a histogram.
+ */
+static uint64_t get_percentile_bound(const latency_histogram::snapshot &histogram, uint64_t percent)
+{
+   const uint64_t rank = (histogram.sample_count * percent + 99) / 100;
+   uint64_t count = 0;
+   for (size_t i = 0; i < latency_histogram::BUCKET_COUNT; i++)
+   {
+      count += histogram.buckets[i];
+      if (count >= rank && count > 0)
+      {
+         const uint64_t bound = i == latency_histogram::BUCKET_COUNT - 1 ? UINT64_MAX : (UINT64_C(1) << i) - 1;
+         return std::min(bound, histogram.max_duration);
+      }
+   }
+   return histogram.max_duration;
+}
+
+void latency_stats::log_summary() const
+{
+   static constexpr const char *interval_names[] = {
+      "acquire wait", "queue present", "pending", "present wait", "backend present", "gpu to present",
+   };
+   static_assert(sizeof(interval_names) / sizeof(interval_names[0]) == static_cast<size_t>(latency_interval::count),
+                 "Every latency interval needs a name");
+
+   for (size_t i = 0; i < m_histograms.size(); i++)
+   {
+      const auto histogram = m_histograms[i].get_snapshot();
+      if (histogram.sample_count == 0)
+      {
+         continue;
+      }
+
+      WSI_LOG_INFO("Swapchain %s latency: %" PRIu64 " samples, mean %" PRIu64 " ns, p50 <= %" PRIu64
+                   " ns, p99 <= %" PRIu64 " ns, max %" PRIu64 " ns",
+                   interval_names[i], histogram.sample_count, histogram.total_duration / histogram.sample_count,
+                   get_percentile_bound(histogram, 50), get_percentile_bound(histogram, 99), histogram.max_duration);
+   }
+}
+
+} /* namespace wsi */
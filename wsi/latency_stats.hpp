@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2024 Arm Limited.
+ *
+ * SPDX-License-Identifier: MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file latency_stats.hpp
+ *
+ * @brief Contains histograms of the time spent by swapchains in their acquire and present paths.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "util/helpers.hpp"
+#include "util/timed_semaphore.hpp"
+
+namespace wsi
+{
+
+/**
+ * @brief Intervals of the acquire and present paths whose durations are recorded.
+ */
+enum class latency_interval
+{
+   /* Time spent waiting for a free image in vkAcquireNextImageKHR. */
+   acquire_wait,
+   /* CPU time spent in swapchain_base::queue_present. */
+   queue_present,
+   /* Time a present request spends queued for the page flip thread. */
+   pending,
+   /* Time spent waiting for the present payload of an image before presenting it. */
+   present_wait,
+   /* Time spent in the backend's present_image. */
+   backend_present,
+   /* Time from the GPU completing the rendering of an image to the image being passed to the backend. Only recorded
+    * with GPU timestamps, see @ref gpu_timestamps. */
+   gpu_to_present,
+   count
+};
+
+/**
+ * @brief Histogram of durations with power of 2 buckets, which can be recorded to from any thread without locking.
+ */
+class latency_histogram
+{
+public:
+   /**
+    * @brief Number of buckets. Bucket 0 counts durations of 0 ns, bucket i durations in [2^(i-1), 2^i) ns.
+    */
+   static constexpr size_t BUCKET_COUNT = 64;
+
+   struct snapshot
+   {
+      uint64_t sample_count;
+      uint64_t total_duration;
+      uint64_t max_duration;
+      std::array<uint64_t, BUCKET_COUNT> buckets;
+   };
+
+   /**
+    * @brief Record a duration in nanoseconds.
+    */
+   void record(uint64_t duration);
+
+   /**
+    * @brief Get the recorded durations. Durations recorded concurrently may only be partly included.
+    */
+   snapshot get_snapshot() const;
+
+private:
+   std::array<std::atomic<uint64_t>, BUCKET_COUNT> m_buckets{};
+   std::atomic<uint64_t> m_sample_count{ 0 };
+   std::atomic<uint64_t> m_total_duration{ 0 };
+   std::atomic<uint64_t> m_max_duration{ 0 };
+};
+
+/**
+ * @brief Latency histograms of a swapchain, one per @ref latency_interval.
+ */
+class latency_stats
+{
+public:
+   void record(latency_interval interval, uint64_t duration)
+   {
+      m_histograms[static_cast<size_t>(interval)].record(duration);
+   }
+
+   const latency_histogram &get_histogram(latency_interval interval) const
+   {
+      return m_histograms[static_cast<size_t>(interval)];
+   }
+
+   /**
+    * @brief Log a summary of each histogram at info level.
+    */
+   void log_summary() const;
+
+private:
+   std::array<latency_histogram, static_cast<size_t>(latency_interval::count)> m_histograms;
+};
+
+/**
+ * @brief Records the time between its construction and its destruction.
+ */
+class latency_scope : private util::noncopyable
+{
+public:
+   latency_scope(latency_stats &stats, latency_interval interval)
+      : m_stats(stats)
+      , m_interval(interval)
+      , m_start(util::get_monotonic_time_ns())
+   {
+   }
+
+   ~latency_scope()
+   {
+      m_stats.record(m_interval, util::get_monotonic_time_ns() - m_start);
+   }
+
+private:
+   latency_stats &m_stats;
+   latency_interval m_interval;
+   uint64_t m_start;
+};
+
+} /* namespace wsi */
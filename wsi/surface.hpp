@@ -30,7 +30,9 @@
 #pragma once
 
 #include <vulkan/vulkan.h>
+#include <functional>
 #include "surface_properties.hpp"
+#include "util/unordered_set.hpp"
 #include "swapchain_base.hpp"
 
 namespace wsi
@@ -43,8 +45,27 @@ struct drm_format_pair
 {
    uint32_t fourcc;
    uint64_t modifier;
+
+   bool operator==(const drm_format_pair &other) const
+   {
+      return fourcc == other.fourcc && modifier == other.modifier;
+   }
 };
 
+/**
+ * @brief Hash of a @ref drm_format_pair, for hashed sets of supported formats.
+ */
+struct drm_format_pair_hash
+{
+   size_t operator()(const drm_format_pair &format) const
+   {
+      /* Spread the fourcc over all bits, as the modifiers of a single format often only differ in a few. */
+      return std::hash<uint64_t>{}(format.modifier ^ (static_cast<uint64_t>(format.fourcc) * 0x9e3779b97f4a7c15ull));
+   }
+};
+
+using drm_format_set = util::unordered_set<drm_format_pair, drm_format_pair_hash>;
+
 /**
  * @brief A generic WSI representation of a VkSurface.
  *
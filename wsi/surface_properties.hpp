@@ -42,6 +42,10 @@
 #include "layer/wsi_layer_experimental.hpp"
 #endif
 
+#ifndef WSI_MAX_SWAPCHAIN_IMAGE_COUNT
+#define WSI_MAX_SWAPCHAIN_IMAGE_COUNT 8
+#endif
+
 namespace wsi
 {
 
@@ -103,8 +107,9 @@ public:
     */
    virtual bool is_surface_extension_enabled(const layer::instance_private_data &instance_data) = 0;
 
-   /* There is no maximum theoretically speaking however we choose 6 for practicality */
-   static constexpr uint32_t MAX_SWAPCHAIN_IMAGE_COUNT = 6;
+   /* There is no maximum theoretically speaking however we choose one at build time for practicality, as the image
+    * tables of swapchains are stored inline. */
+   static constexpr uint32_t MAX_SWAPCHAIN_IMAGE_COUNT = WSI_MAX_SWAPCHAIN_IMAGE_COUNT;
 
    /**
     * @brief Get the scaling and gravity capabilities of the surface.
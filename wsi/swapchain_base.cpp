@@ -31,21 +31,32 @@
  * that is not specific to how images are created or presented.
  */
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <chrono>
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <system_error>
 
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 #include <vulkan/vulkan.h>
 
 #include "util/log.hpp"
 #include "util/helpers.hpp"
+#include "util/trace.hpp"
 
 #include "swapchain_base.hpp"
 #include "wsi_factory.hpp"
+#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
+#include "compression_policy.hpp"
+#endif
 namespace wsi
 {
 
@@ -54,72 +65,127 @@ void swapchain_base::page_flip_thread()
    auto &sc_images = m_swapchain_images;
    VkResult vk_res = VK_SUCCESS;
    uint64_t timeout = UINT64_MAX;
-   constexpr uint64_t SEMAPHORE_TIMEOUT = 250000000; /* 250 ms. */
 
-   /* No mutex is needed for the accesses to m_page_flip_thread_run variable as after the variable is
-    * initialized it is only ever changed to false. The while loop will make the thread read the
-    * value repeatedly, and the combination of semaphores and thread joins will force any changes to
-    * the variable to be visible to this thread.
-    */
-   while (m_page_flip_thread_run)
+   while (m_page_flip_thread_run.load(std::memory_order_acquire))
    {
       pending_present_request submit_info{};
       if (m_present_mode == VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR)
       {
          /* In continuous mode the application will only make one presentation request,
           * therefore the page flip semaphore will only be signalled once. */
-         if (!m_first_present)
+         if (m_first_present)
          {
-            vk_res = VK_SUCCESS;
+            vk_res = m_page_flip_semaphore.wait(UINT64_MAX);
+            assert(vk_res == VK_SUCCESS);
          }
-         else if ((vk_res = m_page_flip_semaphore.wait(SEMAPHORE_TIMEOUT)) == VK_TIMEOUT)
+
+         if (!m_page_flip_thread_run.load(std::memory_order_acquire))
          {
-            /* Image is not ready yet. */
-            continue;
+            break;
          }
-         assert(vk_res == VK_SUCCESS);
 
          /* For continuous mode there will be only one image in the swapchain.
           * This image will always be used, and there is no pending state in this case. */
          submit_info.image_index = 0;
+         submit_info.present_mode = m_present_mode;
       }
       else
       {
-         /* Waiting for the page_flip_semaphore which will be signalled once there is an
-          * image to display.*/
-         if ((vk_res = m_page_flip_semaphore.wait(SEMAPHORE_TIMEOUT)) == VK_TIMEOUT)
+         /* Block until there is an image to display or until teardown asks the thread to exit. Both post the
+          * page_flip_semaphore so no periodic wake up is needed to observe m_page_flip_thread_run. */
+         vk_res = m_page_flip_semaphore.wait(UINT64_MAX);
+         assert(vk_res == VK_SUCCESS);
+
+         if (!m_page_flip_thread_run.load(std::memory_order_acquire))
          {
-            /* Image is not ready yet. */
-            continue;
+            break;
          }
 
          /* We want to present the oldest queued for present image from our present queue,
           * which we can find at the sc->pending_buffer_pool.head index. */
-         std::unique_lock<std::recursive_mutex> image_status_lock(m_image_status_mutex);
-
          auto pending_submission = m_pending_buffer_pool.pop_front();
          assert(pending_submission.has_value());
          submit_info = *pending_submission;
+         m_latency_stats.record(latency_interval::pending, util::get_monotonic_time_ns() - submit_info.queued_time);
+         WSI_TRACE_INSTANT("present dequeued swapchain=%p present_id=%" PRIu64 " image=%u",
+                           static_cast<void *>(this), submit_info.present_id, submit_info.image_index);
       }
 
-      /* We may need to wait for the payload of the present sync of the oldest pending image to be finished. */
-      while ((vk_res = image_wait_present(sc_images[submit_info.image_index], timeout)) == VK_TIMEOUT)
+      /* We may need to wait for the payload of the present sync of the oldest pending image to be finished, unless
+       * the presentation engine waits for it. */
+      if (!presentation_engine_waits_for_present_payload())
       {
-         WSI_LOG_WARNING("Timeout waiting for image's present fences, retrying..");
+         {
+            latency_scope present_wait_scope(m_latency_stats, latency_interval::present_wait);
+            while ((vk_res = image_wait_present(sc_images[submit_info.image_index], timeout)) == VK_TIMEOUT)
+            {
+               WSI_LOG_WARNING("Timeout waiting for image's present fences, retrying..");
+            }
+         }
+         if (vk_res != VK_SUCCESS)
+         {
+            set_error_state(vk_res);
+            m_free_image_semaphore.post();
+            continue;
+         }
+         WSI_TRACE_INSTANT("present payload signalled swapchain=%p present_id=%" PRIu64 " image=%u",
+                           static_cast<void *>(this), submit_info.present_id, submit_info.image_index);
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+         set_present_stage_time(submit_info.present_id, VK_PRESENT_STAGE_QUEUE_OPERATIONS_END_BIT_EXT,
+                                util::get_monotonic_time_ns());
+#endif
       }
-      if (vk_res != VK_SUCCESS)
+
+      if (submit_info.target_present_time != 0 && !schedules_target_present_time())
       {
-         set_error_state(vk_res);
-         m_free_image_semaphore.post();
-         continue;
+         wait_for_target_present_time(submit_info.target_present_time);
       }
 
       call_present(submit_info);
    }
 }
 
+void swapchain_base::wait_for_target_present_time(uint64_t target_present_time)
+{
+   /* Sleep in bounded steps, so that teardown is not held up by a target far in the future. */
+   constexpr uint64_t MAX_SLEEP_NS = 100000000; /* 100 milliseconds */
+   constexpr uint64_t NSEC_PER_SEC = 1000000000;
+
+   uint64_t now = util::get_monotonic_time_ns();
+   while (now < target_present_time && m_page_flip_thread_run.load(std::memory_order_acquire))
+   {
+      const uint64_t wake_time = std::min(target_present_time, now + MAX_SLEEP_NS);
+      struct timespec wake = {};
+      wake.tv_sec = static_cast<time_t>(wake_time / NSEC_PER_SEC);
+      wake.tv_nsec = static_cast<long>(wake_time % NSEC_PER_SEC);
+
+      /* EINTR simply retries with the time left. */
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, nullptr);
+      now = util::get_monotonic_time_ns();
+   }
+}
+
 void swapchain_base::call_present(const pending_present_request &pending_present)
 {
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+   m_last_present_time.store(util::get_monotonic_time_ns(), std::memory_order_relaxed);
+#endif
+#if ENABLE_INSTRUMENTATION && VULKAN_WSI_LAYER_EXPERIMENTAL
+   if (m_gpu_timestamps != nullptr)
+   {
+      m_gpu_timestamps->set_present_time(pending_present.image_index, util::get_monotonic_time_ns());
+      collect_gpu_timestamps();
+   }
+#endif
+
+   /* Switch at the present boundary, so that no image is presented with a mix of the old and the new mode. */
+   const VkPresentModeKHR previous_present_mode = m_present_mode;
+   if (pending_present.present_mode != previous_present_mode)
+   {
+      m_present_mode = pending_present.present_mode;
+      present_mode_switched(previous_present_mode);
+   }
+
    /* First present of the swapchain. If it has an ancestor, wait until all the
     * pending buffers from the ancestor have been presented. */
    if (m_first_present)
@@ -132,6 +198,7 @@ void swapchain_base::call_present(const pending_present_request &pending_present
 
       sem_post(&m_start_present_semaphore);
 
+      latency_scope backend_present_scope(m_latency_stats, latency_interval::backend_present);
       present_image(pending_present);
 
       m_first_present = false;
@@ -139,6 +206,7 @@ void swapchain_base::call_present(const pending_present_request &pending_present
    /* The swapchain has already started presenting. */
    else
    {
+      latency_scope backend_present_scope(m_latency_stats, latency_interval::backend_present);
       present_image(pending_present);
    }
 }
@@ -154,6 +222,161 @@ bool swapchain_base::has_descendant_started_presenting()
    return desc->m_started_presenting;
 }
 
+/**
+ * @brief Scheduling of the page flip thread, set with the WSI_PRESENT_THREAD_* environment variables.
+ */
+struct present_thread_config
+{
+   /** Scheduling policy, SCHED_OTHER to leave the thread with the default scheduling. */
+   int policy{ SCHED_OTHER };
+   int priority{ 0 };
+   /** CPUs the thread may run on, empty to leave the affinity of the creating thread. */
+   cpu_set_t cpus{};
+   bool has_cpus{ false };
+   /** Thread name, at most 15 characters as for pthread_setname_np. */
+   char name[16]{ "wsi-present" };
+};
+
+/**
+ * @brief Parse a list of CPUs in the format of taskset -c, for example "4-7" or "0,2,4-7".
+ *
+ * @return false if the list is malformed or names a CPU out of range.
+ */
+static bool parse_cpu_list(const char *list, cpu_set_t &cpus)
+{
+   CPU_ZERO(&cpus);
+   const char *p = list;
+   do
+   {
+      char *end = nullptr;
+      const unsigned long first = std::strtoul(p, &end, 10);
+      if (end == p)
+      {
+         return false;
+      }
+      unsigned long last = first;
+      p = end;
+      if (*p == '-')
+      {
+         last = std::strtoul(p + 1, &end, 10);
+         if (end == p + 1 || last < first)
+         {
+            return false;
+         }
+         p = end;
+      }
+      if (last >= CPU_SETSIZE)
+      {
+         return false;
+      }
+      for (unsigned long cpu = first; cpu <= last; cpu++)
+      {
+         CPU_SET(cpu, &cpus);
+      }
+   } while (*p++ == ',');
+
+   return *(p - 1) == '\0';
+}
+
+static const present_thread_config &get_present_thread_config()
+{
+   static const present_thread_config config = []() {
+      present_thread_config result{};
+      if (const char *env = std::getenv("WSI_PRESENT_THREAD_POLICY"))
+      {
+         if (strcmp(env, "fifo") == 0)
+         {
+            result.policy = SCHED_FIFO;
+         }
+         else if (strcmp(env, "rr") == 0)
+         {
+            result.policy = SCHED_RR;
+         }
+         else if (strcmp(env, "other") != 0)
+         {
+            WSI_LOG_WARNING("Ignoring invalid WSI_PRESENT_THREAD_POLICY \"%s\".", env);
+         }
+      }
+
+      if (result.policy != SCHED_OTHER)
+      {
+         const int min_priority = sched_get_priority_min(result.policy);
+         const int max_priority = sched_get_priority_max(result.policy);
+         result.priority = min_priority;
+         if (const char *env = std::getenv("WSI_PRESENT_THREAD_PRIORITY"))
+         {
+            char *end = nullptr;
+            const long priority = std::strtol(env, &end, 10);
+            if (end == env || *end != '\0' || priority < min_priority || priority > max_priority)
+            {
+               WSI_LOG_WARNING("Ignoring invalid WSI_PRESENT_THREAD_PRIORITY \"%s\", the range is %d to %d.", env,
+                               min_priority, max_priority);
+            }
+            else
+            {
+               result.priority = static_cast<int>(priority);
+            }
+         }
+      }
+
+      if (const char *env = std::getenv("WSI_PRESENT_THREAD_CPUS"))
+      {
+         result.has_cpus = parse_cpu_list(env, result.cpus);
+         if (!result.has_cpus)
+         {
+            WSI_LOG_WARNING("Ignoring invalid WSI_PRESENT_THREAD_CPUS \"%s\".", env);
+         }
+      }
+
+      if (const char *env = std::getenv("WSI_PRESENT_THREAD_NAME"))
+      {
+         /* Longer names are truncated rather than rejected by the kernel limit. */
+         std::snprintf(result.name, sizeof(result.name), "%s", env);
+      }
+      return result;
+   }();
+   return config;
+}
+
+/**
+ * @brief Apply the configured name, scheduling and CPU affinity to the page flip thread.
+ *
+ * Settings that cannot be applied, typically a realtime policy without CAP_SYS_NICE or RLIMIT_RTPRIO, are logged and
+ * the thread keeps running with what it had.
+ */
+static void configure_present_thread(std::thread &thread)
+{
+   const present_thread_config &config = get_present_thread_config();
+   const pthread_t handle = thread.native_handle();
+
+   if (config.name[0] != '\0')
+   {
+      pthread_setname_np(handle, config.name);
+   }
+
+   if (config.policy != SCHED_OTHER)
+   {
+      struct sched_param param = {};
+      param.sched_priority = config.priority;
+      const int err = pthread_setschedparam(handle, config.policy, &param);
+      if (err != 0)
+      {
+         WSI_LOG_WARNING("Failed to set the scheduling policy of the present thread, keeping the default: %s",
+                         strerror(err));
+      }
+   }
+
+   if (config.has_cpus)
+   {
+      const int err = pthread_setaffinity_np(handle, sizeof(config.cpus), &config.cpus);
+      if (err != 0)
+      {
+         WSI_LOG_WARNING("Failed to set the CPU affinity of the present thread, keeping the default: %s",
+                         strerror(err));
+      }
+   }
+}
+
 VkResult swapchain_base::init_page_flip_thread()
 {
    /* Setup semaphore for signaling pageflip thread */
@@ -161,10 +384,11 @@ VkResult swapchain_base::init_page_flip_thread()
    m_thread_sem_defined = true;
 
    /* Launch page flipping thread */
-   m_page_flip_thread_run = true;
+   m_page_flip_thread_run.store(true, std::memory_order_release);
    try
    {
       m_page_flip_thread = std::thread(&swapchain_base::page_flip_thread, this);
+      configure_present_thread(m_page_flip_thread);
    }
    catch (const std::system_error &)
    {
@@ -184,11 +408,11 @@ void swapchain_base::unpresent_image(uint32_t presented_index)
    if (m_present_mode == VK_PRESENT_MODE_SHARED_DEMAND_REFRESH_KHR ||
        m_present_mode == VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR)
    {
-      m_swapchain_images[presented_index].status = swapchain_image::ACQUIRED;
+      set_image_status(m_swapchain_images[presented_index], swapchain_image::ACQUIRED);
    }
    else
    {
-      m_swapchain_images[presented_index].status = swapchain_image::FREE;
+      set_image_status(m_swapchain_images[presented_index], swapchain_image::FREE);
    }
 
    image_status_lock.unlock();
@@ -200,17 +424,150 @@ void swapchain_base::unpresent_image(uint32_t presented_index)
    }
 }
 
+VkResult swapchain_base::take_latest_pending_present(pending_present_request &pending_present)
+{
+   bool replaced = false;
+   for (const auto *next = m_pending_buffer_pool.front();
+        next != nullptr && next->present_mode == pending_present.present_mode; next = m_pending_buffer_pool.front())
+   {
+      /* Presents queued after a present mode switch are left to be presented with their own mode. */
+      auto newer = m_pending_buffer_pool.pop_front();
+      assert(newer.has_value());
+
+      /* Each queued request posts the page flip semaphore once, so consume the post of the one taken here. The
+       * producer posts right after pushing, hence this does not block for long. */
+      VkResult res = m_page_flip_semaphore.wait(UINT64_MAX);
+      assert(res == VK_SUCCESS);
+      (void)res;
+
+      /* The skipped image cannot be handed back to the application while it may still be in use by the GPU. */
+      TRY(image_wait_present(m_swapchain_images[pending_present.image_index], UINT64_MAX));
+      unpresent_image(pending_present.image_index);
+      frame_displayed();
+      WSI_TRACE_INSTANT("present discarded swapchain=%p present_id=%" PRIu64 " image=%u", static_cast<void *>(this),
+                        pending_present.present_id, pending_present.image_index);
+      if (pending_present.present_id != 0)
+      {
+         WSI_TRACE_END_ASYNC(pending_present.present_id, "frame swapchain=%p", static_cast<void *>(this));
+      }
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+      set_present_discarded(pending_present.present_id);
+#endif
+
+      pending_present = *newer;
+      replaced = true;
+   }
+
+   if (replaced)
+   {
+      /* The page flip thread only waited for the present fence of the request it popped. */
+      TRY(image_wait_present(m_swapchain_images[pending_present.image_index], UINT64_MAX));
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+      set_present_stage_time(pending_present.present_id, VK_PRESENT_STAGE_QUEUE_OPERATIONS_END_BIT_EXT,
+                             util::get_monotonic_time_ns());
+#endif
+   }
+
+   return VK_SUCCESS;
+}
+
+static_assert(surface_properties::MAX_SWAPCHAIN_IMAGE_COUNT <= 64,
+              "swapchain image status masks cannot track more than 64 images");
+
+void swapchain_base::set_image_status(swapchain_image &image, swapchain_image::status status)
+{
+   const uint64_t bit = UINT64_C(1) << get_image_index(image);
+
+   /* The image briefly appears in neither mask, which lock-free readers treat like any other status change. */
+   m_image_status_masks[image.status].fetch_and(~bit, std::memory_order_release);
+   m_image_status_masks[status].fetch_or(bit, std::memory_order_release);
+   image.status = status;
+}
+
+uint32_t swapchain_base::find_image_with_status(swapchain_image::status status, uint64_t ignored_images) const
+{
+   const uint64_t mask = m_image_status_masks[status].load(std::memory_order_acquire) & ~ignored_images;
+   if (mask == 0)
+   {
+      return static_cast<uint32_t>(m_swapchain_images.size());
+   }
+   return static_cast<uint32_t>(__builtin_ctzll(mask));
+}
+
+uint32_t swapchain_base::count_images_with_status(swapchain_image::status status) const
+{
+   return static_cast<uint32_t>(__builtin_popcountll(m_image_status_masks[status].load(std::memory_order_acquire)));
+}
+
+swapchain_memory_footprint swapchain_base::get_memory_footprint()
+{
+   swapchain_memory_footprint footprint{};
+   footprint.host_bytes = m_object_arena.get_reserved_size();
+
+   /* The lock keeps the images from being destroyed while their memory is counted. */
+   const std::lock_guard<std::recursive_mutex> lock(m_image_status_mutex);
+   for (uint32_t i = 0; i < m_swapchain_images.size(); i++)
+   {
+      const swapchain_image &image = m_swapchain_images[i];
+      /* The image being allocated by the allocation thread is written to without the lock. */
+      if (image.status == swapchain_image::INVALID || image.status == swapchain_image::UNALLOCATED ||
+          i == m_allocating_image)
+      {
+         continue;
+      }
+      footprint.image_count++;
+      add_image_memory_footprint(image, footprint);
+   }
+   return footprint;
+}
+
+void swapchain_base::log_memory_footprint(const char *event)
+{
+   const swapchain_memory_footprint footprint = get_memory_footprint();
+   WSI_LOG_INFO("Swapchain %p %s: %u images, %" PRIu64 " bytes of dma-bufs, %" PRIu64
+                " bytes of device memory, %" PRIu64 " bytes of host memory, %u framebuffers.",
+                reinterpret_cast<void *>(this), event, footprint.image_count, footprint.dma_buf_bytes,
+                footprint.device_memory_bytes, footprint.host_bytes, footprint.framebuffer_count);
+}
+
+static uint32_t get_max_frame_latency()
+{
+   static const uint32_t max_frame_latency = []() -> uint32_t {
+      const char *env = std::getenv("WSI_MAX_FRAME_LATENCY");
+      if (env == nullptr)
+      {
+         return 0;
+      }
+
+      char *end = nullptr;
+      const unsigned long frames = std::strtoul(env, &end, 10);
+      if (end == env || *end != '\0')
+      {
+         WSI_LOG_WARNING("Ignoring invalid WSI_MAX_FRAME_LATENCY \"%s\".", env);
+         return 0;
+      }
+      /* The limit cannot be looser than the number of images, so larger values only disable it. */
+      return frames < surface_properties::MAX_SWAPCHAIN_IMAGE_COUNT ? static_cast<uint32_t>(frames) : 0;
+   }();
+   return max_frame_latency;
+}
+
 swapchain_base::swapchain_base(layer::device_private_data &dev_data, const VkAllocationCallbacks *callbacks)
    : m_device_data(dev_data)
    , m_page_flip_thread_run(false)
+   , m_allocation_thread_run(false)
+   , m_allocating_image(UINT32_MAX)
    , m_start_present_semaphore()
    , m_thread_sem_defined(false)
    , m_first_present(true)
    , m_pending_buffer_pool()
    , m_allocator(dev_data.get_allocator(), VK_SYSTEM_ALLOCATION_SCOPE_OBJECT, callbacks)
-   , m_swapchain_images(m_allocator)
+   , m_object_arena(m_allocator, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT)
+   , m_image_status_masks{}
+   , m_image_data_arena(m_object_arena.get_allocator())
    , m_surface(VK_NULL_HANDLE)
    , m_present_mode(VK_PRESENT_MODE_IMMEDIATE_KHR)
+   , m_requested_present_mode(VK_PRESENT_MODE_IMMEDIATE_KHR)
    , m_present_modes(m_allocator)
    , m_descendant(VK_NULL_HANDLE)
    , m_ancestor(VK_NULL_HANDLE)
@@ -218,8 +575,11 @@ swapchain_base::swapchain_base(layer::device_private_data &dev_data, const VkAll
    , m_queue(VK_NULL_HANDLE)
 #if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
    , m_image_compression_control_params({ VK_IMAGE_COMPRESSION_DEFAULT_EXT, 0 })
+   , m_automatic_compression(false)
 #endif
    , m_image_create_info()
+   , m_requested_image_info()
+   , m_present_scaling({ 0, 0, 0 })
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
    , m_time_domains(m_allocator)
 #endif
@@ -229,12 +589,47 @@ swapchain_base::swapchain_base(layer::device_private_data &dev_data, const VkAll
    , m_frame_boundary_handler(m_device_data)
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
    , m_presentation_timing(m_allocator)
+   , m_presentation_timing_head(0)
+   , m_presentation_timing_count(0)
+   , m_last_present_time(0)
+   , m_last_target_present_time(0)
 #endif
 {
+   m_max_frame_latency = get_max_frame_latency();
+}
+
+VkExtent2D get_aspect_ratio_stretch_extent(const VkExtent2D &image_extent, const VkExtent2D &target_extent)
+{
+   /* Scale by the smaller of the two ratios. Comparing the cross products avoids rounding the ratios. */
+   const uint64_t width = image_extent.width;
+   const uint64_t height = image_extent.height;
+   if (width * target_extent.height <= height * target_extent.width)
+   {
+      const uint64_t scaled_width = (width * target_extent.height + height / 2) / height;
+      return { static_cast<uint32_t>(std::max<uint64_t>(1, scaled_width)), target_extent.height };
+   }
+
+   const uint64_t scaled_height = (height * target_extent.width + width / 2) / width;
+   return { target_extent.width, static_cast<uint32_t>(std::max<uint64_t>(1, scaled_height)) };
+}
+
+int32_t get_present_gravity_offset(uint32_t area_size, uint32_t content_size, VkPresentGravityFlagsEXT gravity)
+{
+   assert(content_size <= area_size);
+   const uint32_t remaining = area_size - content_size;
+   if (gravity == VK_PRESENT_GRAVITY_MAX_BIT_EXT)
+   {
+      return static_cast<int32_t>(remaining);
+   }
+   else if (gravity == VK_PRESENT_GRAVITY_CENTERED_BIT_EXT)
+   {
+      return static_cast<int32_t>(remaining / 2);
+   }
+   return 0;
 }
 
 static VkResult handle_scaling_create_info(VkDevice device, const VkSwapchainCreateInfoKHR *swapchain_create_info,
-                                           const VkSurfaceKHR &surface)
+                                           const VkSurfaceKHR &surface, present_scaling_params &present_scaling)
 {
 
    auto present_scaling_create_info = util::find_extension<VkSwapchainPresentScalingCreateInfoEXT>(
@@ -258,6 +653,9 @@ static VkResult handle_scaling_create_info(VkDevice device, const VkSwapchainCre
       {
          return VK_ERROR_INITIALIZATION_FAILED;
       }
+
+      present_scaling = { present_scaling_create_info->scalingBehavior, present_scaling_create_info->presentGravityX,
+                          present_scaling_create_info->presentGravityY };
    }
    return VK_SUCCESS;
 }
@@ -292,6 +690,252 @@ VkResult swapchain_base::handle_swapchain_present_modes_create_info(
    return VK_SUCCESS;
 }
 
+VkResult swapchain_base::init_swapchain_image(const VkImageCreateInfo &image_create_info, bool deferred_allocation,
+                                              swapchain_image &image)
+{
+   /* Images taken over from the ancestor are already created and bound. */
+   if (image.status == swapchain_image::INVALID)
+   {
+      TRY(create_swapchain_image(image_create_info, image));
+
+      if (deferred_allocation)
+      {
+         const std::lock_guard<std::recursive_mutex> lock(m_image_status_mutex);
+         set_image_status(image, swapchain_image::UNALLOCATED);
+      }
+      else
+      {
+         TRY_LOG_CALL(allocate_and_bind_swapchain_image(image_create_info, image));
+      }
+   }
+
+   VkSemaphoreCreateInfo semaphore_info = {};
+   semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+   TRY_LOG_CALL(m_device_data.disp.CreateSemaphore(m_device, &semaphore_info, get_allocation_callbacks(),
+                                                   &image.present_semaphore));
+
+   VkExportSemaphoreCreateInfo export_semaphore_info = {};
+   export_semaphore_info.sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO;
+   export_semaphore_info.handleTypes = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+   if (m_present_fence_from_sync_fd)
+   {
+      semaphore_info.pNext = &export_semaphore_info;
+   }
+   TRY_LOG_CALL(m_device_data.disp.CreateSemaphore(m_device, &semaphore_info, get_allocation_callbacks(),
+                                                   &image.present_fence_wait));
+   return VK_SUCCESS;
+}
+
+VkResult swapchain_base::init_swapchain_images_parallel(const VkImageCreateInfo &image_create_info,
+                                                        bool deferred_allocation)
+{
+   /* The first image selects the format and fills m_image_create_info, which the other images are created from. */
+   TRY(init_swapchain_image(image_create_info, deferred_allocation, m_swapchain_images[0]));
+
+   const uint32_t image_count = m_swapchain_images.size();
+   std::atomic<uint32_t> next_image{ 1 };
+   std::atomic<VkResult> first_error{ VK_SUCCESS };
+   auto create_images = [&]() {
+      for (uint32_t i = next_image.fetch_add(1, std::memory_order_relaxed); i < image_count;
+           i = next_image.fetch_add(1, std::memory_order_relaxed))
+      {
+         if (first_error.load(std::memory_order_relaxed) != VK_SUCCESS)
+         {
+            break;
+         }
+
+         VkResult res = init_swapchain_image(image_create_info, deferred_allocation, m_swapchain_images[i]);
+         if (res != VK_SUCCESS)
+         {
+            VkResult expected = VK_SUCCESS;
+            first_error.compare_exchange_strong(expected, res, std::memory_order_relaxed);
+            break;
+         }
+      }
+   };
+
+   /* The calling thread creates images too, so it still makes progress if no worker thread could be started. */
+   std::array<std::thread, MAX_IMAGE_CREATION_THREADS - 1> workers;
+   const uint32_t worker_count = std::min<uint32_t>(workers.size(), image_count - 2);
+   for (uint32_t i = 0; i < worker_count; i++)
+   {
+      try
+      {
+         workers[i] = std::thread(create_images);
+      }
+      catch (const std::system_error &)
+      {
+         break;
+      }
+      catch (const std::bad_alloc &)
+      {
+         break;
+      }
+   }
+
+   create_images();
+   for (auto &worker : workers)
+   {
+      if (worker.joinable())
+      {
+         worker.join();
+      }
+   }
+
+   const VkResult res = first_error.load(std::memory_order_relaxed);
+   if (res != VK_SUCCESS)
+   {
+      /* Roll back all the images together, including those that were created successfully. */
+      for (auto &img : m_swapchain_images)
+      {
+         destroy_image(img);
+
+         m_device_data.disp.DestroySemaphore(m_device, img.present_semaphore, get_allocation_callbacks());
+         m_device_data.disp.DestroySemaphore(m_device, img.present_fence_wait, get_allocation_callbacks());
+         img.present_semaphore = VK_NULL_HANDLE;
+         img.present_fence_wait = VK_NULL_HANDLE;
+      }
+   }
+
+   return res;
+}
+
+/**
+ * @brief Check whether two swapchains allocate and free their objects with the same callbacks.
+ */
+static bool same_allocation_callbacks(const VkAllocationCallbacks *a, const VkAllocationCallbacks *b)
+{
+   if (a == nullptr || b == nullptr)
+   {
+      return a == b;
+   }
+   return a->pUserData == b->pUserData && a->pfnAllocation == b->pfnAllocation && a->pfnFree == b->pfnFree;
+}
+
+VkResult swapchain_base::adopt_ancestor_images(swapchain_base &ancestor, const VkImageCreateInfo &image_create_info)
+{
+   const VkImageCreateInfo &requested = ancestor.m_requested_image_info;
+   const bool same_images = requested.format == image_create_info.format &&
+                            requested.extent.width == image_create_info.extent.width &&
+                            requested.extent.height == image_create_info.extent.height &&
+                            requested.arrayLayers == image_create_info.arrayLayers &&
+                            requested.usage == image_create_info.usage && requested.flags == image_create_info.flags &&
+                            requested.sharingMode == VK_SHARING_MODE_EXCLUSIVE &&
+                            image_create_info.sharingMode == VK_SHARING_MODE_EXCLUSIVE;
+#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
+   const auto &ancestor_compression = ancestor.m_image_compression_control_params;
+   const auto &compression = m_image_compression_control_params;
+   const bool same_compression =
+      ancestor_compression.flags == compression.flags &&
+      ancestor_compression.compression_control_plane_count == compression.compression_control_plane_count &&
+      ancestor_compression.fixed_rate_flags == compression.fixed_rate_flags;
+#else
+   const bool same_compression = true;
+#endif
+
+   /* The memory of the images is freed by this swapchain, so it must use the callbacks it was allocated with. */
+   if (!same_images || !same_compression || ancestor.error_has_occured() ||
+       !same_allocation_callbacks(ancestor.get_allocation_callbacks(), get_allocation_callbacks()) ||
+       !supports_image_handover(ancestor))
+   {
+      return VK_SUCCESS;
+   }
+
+   const std::lock_guard<std::recursive_mutex> ancestor_lock(ancestor.m_image_status_mutex);
+   uint32_t adopted = 0;
+   for (auto &ancestor_image : ancestor.m_swapchain_images)
+   {
+      if (adopted == m_swapchain_images.size())
+      {
+         break;
+      }
+      if (ancestor_image.status != swapchain_image::FREE)
+      {
+         continue;
+      }
+
+      /* Taking over images only saves allocations. When it fails, the images left are created from scratch. */
+      auto &image = m_swapchain_images[adopted];
+      if (adopt_ancestor_image(ancestor, ancestor_image, image_create_info, image) != VK_SUCCESS)
+      {
+         WSI_LOG_WARNING("Failed to take over an image of the ancestor swapchain.");
+         break;
+      }
+      ancestor.destroy_image(ancestor_image);
+
+      const std::lock_guard<std::recursive_mutex> lock(m_image_status_mutex);
+      set_image_status(image, swapchain_image::FREE);
+      adopted++;
+   }
+
+   if (adopted > 0)
+   {
+      WSI_LOG_INFO("Took over %u images of the ancestor swapchain.", adopted);
+   }
+   return VK_SUCCESS;
+}
+
+#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
+VkResult swapchain_base::select_automatic_compression(const VkSwapchainCreateInfoKHR *swapchain_create_info)
+{
+   auto &instance = m_device_data.instance_data;
+   VkPhysicalDevice physical_device = m_device_data.physical_device;
+   if (!instance.has_image_compression_support(physical_device))
+   {
+      return VK_SUCCESS;
+   }
+
+   VkImageCompressionPropertiesEXT compression_props = { VK_STRUCTURE_TYPE_IMAGE_COMPRESSION_PROPERTIES_EXT, nullptr, 0,
+                                                         0 };
+   VkImageFormatProperties2KHR format_props = { VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2_KHR, &compression_props };
+   VkImageCompressionControlEXT compression_control = { VK_STRUCTURE_TYPE_IMAGE_COMPRESSION_CONTROL_EXT, nullptr,
+                                                        VK_IMAGE_COMPRESSION_FIXED_RATE_DEFAULT_EXT };
+   VkPhysicalDeviceImageFormatInfo2KHR format_info = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2_KHR,
+                                                       &compression_control,
+                                                       swapchain_create_info->imageFormat,
+                                                       VK_IMAGE_TYPE_2D,
+                                                       VK_IMAGE_TILING_OPTIMAL,
+                                                       swapchain_create_info->imageUsage,
+                                                       0 };
+   VkResult res =
+      instance.disp.GetPhysicalDeviceImageFormatProperties2KHR(physical_device, &format_info, &format_props);
+   if (res == VK_ERROR_FORMAT_NOT_SUPPORTED)
+   {
+      return VK_SUCCESS;
+   }
+   TRY_LOG(res, "Failed to query the fixed compression rates of the swapchain format");
+
+   const VkImageCompressionFixedRateFlagsEXT rate = select_fixed_compression_rate(
+      swapchain_create_info->imageFormat, swapchain_create_info->imageExtent, get_refresh_interval(),
+      get_compression_bandwidth_budget(), compression_props.imageCompressionFixedRateFlags);
+   if (rate == 0)
+   {
+      return VK_SUCCESS;
+   }
+
+   m_image_compression_control_params.flags = VK_IMAGE_COMPRESSION_FIXED_RATE_EXPLICIT_EXT;
+   m_image_compression_control_params.compression_control_plane_count = 1;
+   m_image_compression_control_params.fixed_rate_flags[0] = rate;
+   m_automatic_compression = true;
+   WSI_LOG_INFO("Compressing the swapchain images with fixed rate 0x%x.", rate);
+   return VK_SUCCESS;
+}
+
+bool swapchain_base::drop_automatic_compression()
+{
+   if (!m_automatic_compression)
+   {
+      return false;
+   }
+
+   WSI_LOG_INFO("The surface cannot use fixed-rate compressed images, they are left uncompressed.");
+   m_image_compression_control_params = { VK_IMAGE_COMPRESSION_DEFAULT_EXT, 0 };
+   m_automatic_compression = false;
+   return true;
+}
+#endif
+
 VkResult swapchain_base::init(VkDevice device, const VkSwapchainCreateInfoKHR *swapchain_create_info)
 {
    assert(device != VK_NULL_HANDLE);
@@ -302,6 +946,7 @@ VkResult swapchain_base::init(VkDevice device, const VkSwapchainCreateInfoKHR *s
    m_surface = swapchain_create_info->surface;
 
    m_present_mode = swapchain_create_info->presentMode;
+   m_requested_present_mode = swapchain_create_info->presentMode;
 
    TRY(handle_swapchain_present_modes_create_info(device, swapchain_create_info));
 
@@ -321,17 +966,48 @@ VkResult swapchain_base::init(VkDevice device, const VkSwapchainCreateInfoKHR *s
 #endif
 
    /* Init image to invalid values. */
+   assert(swapchain_create_info->minImageCount > 0 &&
+          swapchain_create_info->minImageCount <= surface_properties::MAX_SWAPCHAIN_IMAGE_COUNT);
    if (!m_swapchain_images.try_resize(swapchain_create_info->minImageCount))
    {
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
+   for (auto &mask : m_image_status_masks)
+   {
+      mask.store(0, std::memory_order_relaxed);
+   }
+   m_image_status_masks[swapchain_image::INVALID].store(UINT64_MAX >> (64 - m_swapchain_images.size()),
+                                                        std::memory_order_relaxed);
 
-   TRY_LOG_CALL(handle_scaling_create_info(device, swapchain_create_info, m_surface));
+   TRY_LOG_CALL(handle_scaling_create_info(device, swapchain_create_info, m_surface, m_present_scaling));
 
    /* We have allocated images, we can call the platform init function if something needs to be done. */
    bool use_presentation_thread = true;
    TRY_LOG_CALL(init_platform(device, swapchain_create_info, use_presentation_thread));
 
+#if ENABLE_INSTRUMENTATION && VULKAN_WSI_LAYER_EXPERIMENTAL
+   /* The timestamps are attached to the layer's frame boundaries, so they are only recorded when the layer emits
+    * them. */
+   if (gpu_timestamps::is_enabled() && m_device_data.should_layer_handle_frame_boundary_events())
+   {
+      m_gpu_timestamps = m_allocator.make_unique<gpu_timestamps>(m_device_data, m_allocator,
+                                                                 static_cast<uint32_t>(m_swapchain_images.size()));
+      if (m_gpu_timestamps == nullptr)
+      {
+         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+   }
+#endif
+
+#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
+   const VkImageCompressionFlagsEXT compression_flags = m_image_compression_control_params.flags;
+   if (compression_flags == VK_IMAGE_COMPRESSION_FIXED_RATE_DEFAULT_EXT ||
+       (compression_flags == VK_IMAGE_COMPRESSION_DEFAULT_EXT && get_compression_bandwidth_budget() != 0))
+   {
+      TRY_LOG_CALL(select_automatic_compression(swapchain_create_info));
+   }
+#endif
+
    if (use_presentation_thread)
    {
       TRY_LOG_CALL(init_page_flip_thread());
@@ -362,32 +1038,38 @@ VkResult swapchain_base::init(VkDevice device, const VkSwapchainCreateInfoKHR *s
       return result;
    }
 
+   m_present_fence_from_sync_fd = is_present_fence_from_sync_fd_supported();
+
+   m_requested_image_info = image_create_info;
+   m_requested_image_info.pQueueFamilyIndices = nullptr;
+   if (swapchain_create_info->oldSwapchain != VK_NULL_HANDLE)
+   {
+      TRY_LOG_CALL(adopt_ancestor_images(*reinterpret_cast<swapchain_base *>(swapchain_create_info->oldSwapchain),
+                                         image_create_info));
+   }
+
    const bool image_deferred_allocation =
       swapchain_create_info->flags & VK_SWAPCHAIN_CREATE_DEFERRED_MEMORY_ALLOCATION_BIT_EXT;
-   for (auto &img : m_swapchain_images)
+   if (PARALLEL_IMAGE_CREATION_ENABLED && supports_parallel_image_creation() && m_swapchain_images.size() > 2)
    {
-      TRY(create_swapchain_image(image_create_info, img));
-
-      if (image_deferred_allocation)
-      {
-         img.status = swapchain_image::UNALLOCATED;
-      }
-      else
+      TRY_LOG_CALL(init_swapchain_images_parallel(image_create_info, image_deferred_allocation));
+   }
+   else
+   {
+      for (auto &img : m_swapchain_images)
       {
-         TRY_LOG_CALL(allocate_and_bind_swapchain_image(image_create_info, img));
+         TRY(init_swapchain_image(image_create_info, image_deferred_allocation, img));
       }
-
-      VkSemaphoreCreateInfo semaphore_info = {};
-      semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-
-      TRY_LOG_CALL(m_device_data.disp.CreateSemaphore(m_device, &semaphore_info, get_allocation_callbacks(),
-                                                      &img.present_semaphore));
-      TRY_LOG_CALL(m_device_data.disp.CreateSemaphore(m_device, &semaphore_info, get_allocation_callbacks(),
-                                                      &img.present_fence_wait));
    }
+   TRY_LOG_CALL(swapchain_images_initialized());
 
-   m_device_data.disp.GetDeviceQueue(m_device, 0, 0, &m_queue);
-   TRY_LOG_CALL(m_device_data.SetDeviceLoaderData(m_device, m_queue));
+   /* Without a queue reserved for the layer, its submissions share the first queue with the application. */
+   m_queue = m_device_data.get_dedicated_queue();
+   if (m_queue == VK_NULL_HANDLE)
+   {
+      m_device_data.disp.GetDeviceQueue(m_device, 0, 0, &m_queue);
+      TRY_LOG_CALL(m_device_data.SetDeviceLoaderData(m_device, m_queue));
+   }
 
    int res = sem_init(&m_start_present_semaphore, 0, 0);
    /* Only programming error can cause this to fail. */
@@ -415,9 +1097,79 @@ VkResult swapchain_base::init(VkDevice device, const VkSwapchainCreateInfoKHR *s
 
    set_error_state(VK_SUCCESS);
 
+   log_memory_footprint("created");
+   if (m_ancestor != VK_NULL_HANDLE)
+   {
+      /* The ancestor holds its images until this swapchain presents, so both footprints add up until then. */
+      auto *ancestor = reinterpret_cast<swapchain_base *>(m_ancestor);
+      ancestor->log_memory_footprint("retired, held until its descendant presents");
+   }
+
+   if (image_deferred_allocation)
+   {
+      /* Creating the swapchain stays fast, while the images are likely ready by the time they are acquired. */
+      start_allocation_thread();
+   }
+
    return VK_SUCCESS;
 }
 
+void swapchain_base::start_allocation_thread()
+{
+   m_allocation_thread_run.store(true, std::memory_order_release);
+   try
+   {
+      m_allocation_thread = std::thread(&swapchain_base::allocation_thread, this);
+   }
+   catch (const std::system_error &)
+   {
+      /* Not an error, acquire_next_image allocates the images instead. */
+      m_allocation_thread_run.store(false, std::memory_order_release);
+   }
+   catch (const std::bad_alloc &)
+   {
+      m_allocation_thread_run.store(false, std::memory_order_release);
+   }
+}
+
+void swapchain_base::stop_allocation_thread()
+{
+   m_allocation_thread_run.store(false, std::memory_order_release);
+   if (m_allocation_thread.joinable())
+   {
+      m_allocation_thread.join();
+   }
+}
+
+void swapchain_base::allocation_thread()
+{
+   std::unique_lock<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+   while (m_allocation_thread_run.load(std::memory_order_acquire))
+   {
+      const uint32_t i = find_image_with_status(swapchain_image::UNALLOCATED);
+      if (i == m_swapchain_images.size())
+      {
+         break;
+      }
+
+      /* Allocate without holding the lock, so that presenting and acquiring other images is not blocked. */
+      m_allocating_image = i;
+      image_status_lock.unlock();
+      const VkResult res = allocate_and_bind_swapchain_image(m_image_create_info, m_swapchain_images[i]);
+      image_status_lock.lock();
+      m_allocating_image = UINT32_MAX;
+      m_image_allocated.notify_all();
+
+      if (res != VK_SUCCESS)
+      {
+         WSI_LOG_ERROR("Failed to allocate swapchain image in the background.");
+         set_error_state(res != VK_ERROR_INITIALIZATION_FAILED ? res : VK_ERROR_OUT_OF_HOST_MEMORY);
+         wake_up_free_image_waiter();
+         break;
+      }
+   }
+}
+
 void swapchain_base::teardown()
 {
    /* This method will block until all resources associated with this swapchain
@@ -425,6 +1177,9 @@ void swapchain_base::teardown()
     * immediately. For images in the PENDING state, we will block until the
     * presentation engine is finished with them. */
 
+   stop_allocation_thread();
+   log_memory_footprint("destroyed");
+
    if (has_descendant_started_presenting())
    {
       /* Here we wait for the start_present_semaphore, once this semaphore is up,
@@ -442,14 +1197,16 @@ void swapchain_base::teardown()
    if (m_queue != VK_NULL_HANDLE)
    {
       /* Make sure the vkFences are done signaling. */
+      auto queue_lock = m_device_data.lock_internal_queue();
       m_device_data.disp.QueueWaitIdle(m_queue);
    }
 
    /* We are safe to destroy everything. */
    if (m_thread_sem_defined)
    {
-      /* Tell flip thread to end. */
-      m_page_flip_thread_run = false;
+      /* Tell flip thread to end and wake it up, as it blocks on the semaphore without a timeout. */
+      m_page_flip_thread_run.store(false, std::memory_order_release);
+      m_page_flip_semaphore.post();
 
       if (m_page_flip_thread.joinable())
       {
@@ -461,6 +1218,10 @@ void swapchain_base::teardown()
       }
    }
 
+   presentation_engine_stopped();
+
+   m_latency_stats.log_summary();
+
    int res = sem_destroy(&m_start_present_semaphore);
    if (res != 0)
    {
@@ -487,14 +1248,43 @@ void swapchain_base::teardown()
       m_device_data.disp.DestroySemaphore(m_device, img.present_semaphore, get_allocation_callbacks());
       m_device_data.disp.DestroySemaphore(m_device, img.present_fence_wait, get_allocation_callbacks());
    }
+
+#if ENABLE_INSTRUMENTATION && VULKAN_WSI_LAYER_EXPERIMENTAL
+   /* Released with the images, whose present payloads the timestamp command buffers are part of. */
+   m_gpu_timestamps.reset();
+#endif
+}
+
+/**
+ * @brief Get the sync FD to import into an acquire semaphore or fence.
+ *
+ * @param      release_fence The release fence of the acquired image, invalid if it can be written immediately.
+ * @param[out] sync_fd       A duplicate of the release fence, or -1 for an already signalled sync FD.
+ *
+ * @return false if the release fence could not be duplicated.
+ */
+static bool get_acquire_sync_fd(const util::fd_owner &release_fence, int &sync_fd)
+{
+   sync_fd = release_fence.is_valid() ? dup(release_fence.get()) : -1;
+   return !release_fence.is_valid() || sync_fd >= 0;
 }
 
 VkResult swapchain_base::acquire_next_image(uint64_t timeout, VkSemaphore semaphore, VkFence fence,
                                             uint32_t *image_index)
 {
+   util::trace::scoped_slice trace_slice("acquire swapchain=%p", static_cast<void *>(this));
    std::unique_lock<std::mutex> acquire_lock(m_image_acquire_lock);
 
+   const uint64_t wait_start = util::get_monotonic_time_ns();
+   if (m_max_frame_latency != 0 && timeout != 0)
+   {
+      /* The time spent held back by the frame latency limit counts against the timeout. */
+      const uint64_t deadline = util::timeout_to_deadline(timeout);
+      wait_for_frame_latency(deadline);
+      timeout = util::deadline_to_timeout(deadline);
+   }
    TRY(wait_for_free_buffer(timeout));
+   m_latency_stats.record(latency_interval::acquire_wait, util::get_monotonic_time_ns() - wait_start);
    if (error_has_occured())
    {
       return get_error_state();
@@ -502,10 +1292,22 @@ VkResult swapchain_base::acquire_next_image(uint64_t timeout, VkSemaphore semaph
 
    std::unique_lock<std::recursive_mutex> image_status_lock(m_image_status_mutex);
 
-   size_t i;
-   for (i = 0; i < m_swapchain_images.size(); ++i)
+   /* Prefer images that are already backed by memory and only allocate a deferred image when none is free. The image
+    * being allocated in the background is skipped until its allocation is done. */
+   uint32_t i = static_cast<uint32_t>(m_swapchain_images.size());
+   while (i == m_swapchain_images.size())
    {
-      if (m_swapchain_images[i].status == swapchain_image::UNALLOCATED)
+      const uint64_t allocating_mask = m_allocating_image < m_swapchain_images.size() ?
+                                          UINT64_C(1) << m_allocating_image :
+                                          0;
+      i = find_image_with_status(swapchain_image::FREE, allocating_mask);
+      if (i < m_swapchain_images.size())
+      {
+         break;
+      }
+
+      i = find_image_with_status(swapchain_image::UNALLOCATED, allocating_mask);
+      if (i < m_swapchain_images.size())
       {
          auto res = allocate_and_bind_swapchain_image(m_image_create_info, m_swapchain_images[i]);
          if (res != VK_SUCCESS)
@@ -513,77 +1315,115 @@ VkResult swapchain_base::acquire_next_image(uint64_t timeout, VkSemaphore semaph
             WSI_LOG_ERROR("Failed to allocate swapchain image.");
             return res != VK_ERROR_INITIALIZATION_FAILED ? res : VK_ERROR_OUT_OF_HOST_MEMORY;
          }
+         break;
       }
 
-      if (m_swapchain_images[i].status == swapchain_image::FREE)
+      /* The only image left is still being allocated in the background. */
+      assert(allocating_mask != 0);
+      m_image_allocated.wait(image_status_lock);
+      if (error_has_occured())
       {
-         m_swapchain_images[i].status = swapchain_image::ACQUIRED;
-         *image_index = i;
-         break;
+         return get_error_state();
       }
    }
 
-   assert(i < m_swapchain_images.size());
+   assert(m_swapchain_images[i].status == swapchain_image::FREE);
+   set_image_status(m_swapchain_images[i], swapchain_image::ACQUIRED);
+   *image_index = i;
+   WSI_TRACE_INSTANT("image acquired swapchain=%p image=%u", static_cast<void *>(this), i);
+
+   const util::fd_owner release_fence = image_take_release_fence(m_swapchain_images[i]);
 
    image_status_lock.unlock();
 
-   /* Try to signal fences/semaphores with a sync FD for optimal performance. */
-   if (m_device_data.disp.get_fn<PFN_vkImportFenceFdKHR>("vkImportFenceFdKHR").has_value() &&
-       m_device_data.disp.get_fn<PFN_vkImportSemaphoreFdKHR>("vkImportSemaphoreFdKHR").has_value())
+   /* Try to signal fences/semaphores with a sync FD for optimal performance, when supported by the device. The
+    * release fence of the image is imported when there is one, otherwise an already signalled sync FD is. */
+   int sync_fd = -1;
+   if (fence != VK_NULL_HANDLE && m_device_data.is_sync_fd_fence_import_supported() &&
+       get_acquire_sync_fd(release_fence, sync_fd))
    {
-      if (fence != VK_NULL_HANDLE)
+      auto info = VkImportFenceFdInfoKHR{};
       {
-         int already_signalled_sentinel_fd = -1;
-         auto info = VkImportFenceFdInfoKHR{};
-         {
-            info.sType = VK_STRUCTURE_TYPE_IMPORT_FENCE_FD_INFO_KHR;
-            info.fence = fence;
-            info.handleType = VK_EXTERNAL_FENCE_HANDLE_TYPE_SYNC_FD_BIT;
-            info.fd = already_signalled_sentinel_fd;
-            info.flags = VK_FENCE_IMPORT_TEMPORARY_BIT;
-         }
+         info.sType = VK_STRUCTURE_TYPE_IMPORT_FENCE_FD_INFO_KHR;
+         info.fence = fence;
+         info.handleType = VK_EXTERNAL_FENCE_HANDLE_TYPE_SYNC_FD_BIT;
+         info.fd = sync_fd;
+         info.flags = VK_FENCE_IMPORT_TEMPORARY_BIT;
+      }
 
-         auto result = m_device_data.disp.ImportFenceFdKHR(m_device, &info);
-         switch (result)
+      auto result = m_device_data.disp.ImportFenceFdKHR(m_device, &info);
+      if (result != VK_SUCCESS && sync_fd >= 0)
+      {
+         /* The sync FD is only owned by the fence on success. */
+         close(sync_fd);
+      }
+      switch (result)
+      {
+      case VK_SUCCESS:
+         fence = VK_NULL_HANDLE;
+         break;
+      case VK_ERROR_INVALID_EXTERNAL_HANDLE:
+         if (!release_fence.is_valid())
          {
-         case VK_SUCCESS:
-            fence = VK_NULL_HANDLE;
-            break;
-         case VK_ERROR_INVALID_EXTERNAL_HANDLE:
-            /* Leave to fallback. */
-            break;
-         default:
-            return result;
+            /* The ICD does not accept the sentinel, do not try again for this device. */
+            m_device_data.disable_sync_fd_fence_import();
          }
+         /* Leave to fallback. */
+         break;
+      default:
+         return result;
       }
+   }
 
-      if (semaphore != VK_NULL_HANDLE)
+   if (semaphore != VK_NULL_HANDLE && m_device_data.is_sync_fd_semaphore_import_supported() &&
+       get_acquire_sync_fd(release_fence, sync_fd))
+   {
+      auto info = VkImportSemaphoreFdInfoKHR{};
       {
-         int already_signalled_sentinel_fd = -1;
-         auto info = VkImportSemaphoreFdInfoKHR{};
-         {
-            info.sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR;
-            info.semaphore = semaphore;
-            info.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
-            info.flags = VK_SEMAPHORE_IMPORT_TEMPORARY_BIT;
-            info.fd = already_signalled_sentinel_fd;
-         }
+         info.sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR;
+         info.semaphore = semaphore;
+         info.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+         info.flags = VK_SEMAPHORE_IMPORT_TEMPORARY_BIT;
+         info.fd = sync_fd;
+      }
 
-         auto result = m_device_data.disp.ImportSemaphoreFdKHR(m_device, &info);
-         switch (result)
+      auto result = m_device_data.disp.ImportSemaphoreFdKHR(m_device, &info);
+      if (result != VK_SUCCESS && sync_fd >= 0)
+      {
+         /* The sync FD is only owned by the semaphore on success. */
+         close(sync_fd);
+      }
+      switch (result)
+      {
+      case VK_SUCCESS:
+         semaphore = VK_NULL_HANDLE;
+         break;
+      case VK_ERROR_INVALID_EXTERNAL_HANDLE:
+         if (!release_fence.is_valid())
          {
-         case VK_SUCCESS:
-            semaphore = VK_NULL_HANDLE;
-            break;
-         case VK_ERROR_INVALID_EXTERNAL_HANDLE:
-            /* Leave to fallback. */
-            break;
-         default:
-            return result;
+            /* The ICD does not accept the sentinel, do not try again for this device. */
+            m_device_data.disable_sync_fd_semaphore_import();
          }
+         /* Leave to fallback. */
+         break;
+      default:
+         return result;
       }
    }
 
+   if (fence == VK_NULL_HANDLE && semaphore == VK_NULL_HANDLE)
+   {
+      /* Everything was signalled by importing sync FDs, no queue submission is needed. */
+      return VK_SUCCESS;
+   }
+
+   /* The fallback submission cannot wait for the release fence, so wait for it here. */
+   if (util::wait_sync_fd(release_fence, -1) < 0)
+   {
+      WSI_LOG_ERROR("Failed to wait for the release fence: %s", strerror(errno));
+      return VK_ERROR_SURFACE_LOST_KHR;
+   }
+
    /* Fallback for when importing fence/semaphore sync FDs is unsupported by the ICD. */
    queue_submit_semaphores semaphores = {
       nullptr,
@@ -591,6 +1431,7 @@ VkResult swapchain_base::acquire_next_image(uint64_t timeout, VkSemaphore semaph
       (semaphore != VK_NULL_HANDLE) ? &semaphore : nullptr,
       (semaphore != VK_NULL_HANDLE) ? 1u : 0,
    };
+   auto queue_lock = m_device_data.lock_internal_queue();
    TRY(sync_queue_submit(m_device_data, m_queue, fence, semaphores));
 
    return VK_SUCCESS;
@@ -648,7 +1489,7 @@ VkResult swapchain_base::get_swapchain_status()
 
 VkResult swapchain_base::notify_presentation_engine(const pending_present_request &pending_present)
 {
-   const std::lock_guard<std::recursive_mutex> lock(m_image_status_mutex);
+   std::unique_lock<std::recursive_mutex> image_status_lock(m_image_status_mutex);
 
    /* If the descendant has started presenting, we should release the image
     * however we do not want to block inside the main thread so we mark it
@@ -656,17 +1497,31 @@ VkResult swapchain_base::notify_presentation_engine(const pending_present_reques
    const bool descendant_started_presenting = has_descendant_started_presenting();
    if (descendant_started_presenting)
    {
-      m_swapchain_images[pending_present.image_index].status = swapchain_image::FREE;
+      set_image_status(m_swapchain_images[pending_present.image_index], swapchain_image::FREE);
       m_free_image_semaphore.post();
       return VK_ERROR_OUT_OF_DATE_KHR;
    }
 
-   m_swapchain_images[pending_present.image_index].status = swapchain_image::PENDING;
+   set_image_status(m_swapchain_images[pending_present.image_index], swapchain_image::PENDING);
    m_started_presenting = true;
+   frame_queued();
+
+   WSI_TRACE_INSTANT("present queued swapchain=%p present_id=%" PRIu64 " image=%u", static_cast<void *>(this),
+                     pending_present.present_id, pending_present.image_index);
+   if (pending_present.present_id != 0)
+   {
+      /* Frames are keyed by present ID, as presents without one cannot be told apart once they are shown. */
+      WSI_TRACE_BEGIN_ASYNC(pending_present.present_id, "frame swapchain=%p", static_cast<void *>(this));
+   }
 
    if (m_page_flip_thread_run)
    {
-      bool buffer_pool_res = m_pending_buffer_pool.push_back(pending_present);
+      /* The pending buffer pool does not need the image status lock, as this is its only producer. */
+      image_status_lock.unlock();
+
+      pending_present_request queued_present = pending_present;
+      queued_present.queued_time = util::get_monotonic_time_ns();
+      bool buffer_pool_res = m_pending_buffer_pool.push_back(queued_present);
       (void)buffer_pool_res;
       assert(buffer_pool_res);
       m_page_flip_semaphore.post();
@@ -679,38 +1534,43 @@ VkResult swapchain_base::notify_presentation_engine(const pending_present_reques
    return VK_SUCCESS;
 }
 
-VkResult swapchain_base::queue_present(VkQueue queue, const VkPresentInfoKHR *present_info,
-                                       const swapchain_presentation_parameters &submit_info)
+VkResult swapchain_base::begin_present(const swapchain_presentation_parameters &submit_info,
+                                       pending_present_request &pending_present)
 {
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
-   if (submit_info.present_timing_info)
+   /* Timings are matched to presents by their present ID, so presents without one cannot be reported. */
+   if (submit_info.present_timing_info && submit_info.pending_present.present_id != 0)
    {
-      wsi::swapchain_presentation_entry presentation_entry = {};
-      presentation_entry.present_id = submit_info.pending_present.present_id;
-      if ((m_presentation_timing.size()) >= m_presentation_timing.capacity())
+      const VkPresentStageFlagsEXT requested_stages =
+         submit_info.present_timing_info->presentStageQueries & get_reportable_present_stages();
+
+      const std::lock_guard<std::mutex> lock(m_presentation_timing_mutex);
+      if (m_presentation_timing_count >= m_presentation_timing.size())
       {
          return VK_ERROR_PRESENT_TIMING_QUEUE_FULL_EXT;
       }
 
-      if (!m_presentation_timing.try_push_back(presentation_entry))
-      {
-         return VK_ERROR_OUT_OF_HOST_MEMORY;
-      }
+      const size_t slot = (m_presentation_timing_head + m_presentation_timing_count) % m_presentation_timing.size();
+      m_presentation_timing[slot] = swapchain_presentation_entry{};
+      m_presentation_timing[slot].present_id = submit_info.pending_present.present_id;
+      m_presentation_timing[slot].requested_stages = requested_stages;
+      m_presentation_timing_count++;
    }
 #endif
 
-   if (submit_info.switch_presentation_mode)
+   pending_present = submit_info.pending_present;
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+   if (submit_info.present_timing_info)
    {
-      TRY(handle_switching_presentation_mode(submit_info.present_mode));
+      pending_present.target_present_time = resolve_target_present_time(*submit_info.present_timing_info);
    }
+#endif
 
-   const VkSemaphore *wait_semaphores = &m_swapchain_images[submit_info.pending_present.image_index].present_semaphore;
-   uint32_t sem_count = 1;
-   if (!submit_info.use_image_present_semaphore)
+   if (submit_info.switch_presentation_mode)
    {
-      wait_semaphores = present_info->pWaitSemaphores;
-      sem_count = present_info->waitSemaphoreCount;
+      TRY(handle_switching_presentation_mode(submit_info.present_mode));
    }
+   pending_present.present_mode = m_requested_present_mode;
 
    if (!m_page_flip_thread_run)
    {
@@ -720,16 +1580,94 @@ VkResult swapchain_base::queue_present(VkQueue queue, const VkPresentInfoKHR *pr
          image_wait_present(m_swapchain_images[submit_info.pending_present.image_index], WAIT_PRESENT_TIMEOUT));
    }
 
+   TRY_LOG_CALL(image_set_present_region(m_swapchain_images[submit_info.pending_present.image_index],
+                                         submit_info.present_region));
+   return VK_SUCCESS;
+}
+
+present_extensions find_present_extensions(const VkPresentInfoKHR &present_info)
+{
+   present_extensions extensions{};
+   for (auto *entry = reinterpret_cast<const VkBaseInStructure *>(present_info.pNext); entry != nullptr;
+        entry = entry->pNext)
+   {
+      /* Keep the first structure of each type, as util::find_extension does. */
+      switch (entry->sType)
+      {
+      case VK_STRUCTURE_TYPE_PRESENT_ID_KHR:
+         if (extensions.present_ids == nullptr)
+         {
+            extensions.present_ids = reinterpret_cast<const VkPresentIdKHR *>(entry);
+         }
+         break;
+      case VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT:
+         if (extensions.present_fence_info == nullptr)
+         {
+            extensions.present_fence_info = reinterpret_cast<const VkSwapchainPresentFenceInfoEXT *>(entry);
+         }
+         break;
+      case VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_MODE_INFO_EXT:
+         if (extensions.present_mode_info == nullptr)
+         {
+            extensions.present_mode_info = reinterpret_cast<const VkSwapchainPresentModeInfoEXT *>(entry);
+         }
+         break;
+      case VK_STRUCTURE_TYPE_PRESENT_REGIONS_KHR:
+         if (extensions.present_regions == nullptr)
+         {
+            extensions.present_regions = reinterpret_cast<const VkPresentRegionsKHR *>(entry);
+         }
+         break;
+      case VK_STRUCTURE_TYPE_FRAME_BOUNDARY_EXT:
+         if (extensions.frame_boundary == nullptr)
+         {
+            extensions.frame_boundary = reinterpret_cast<const VkFrameBoundaryEXT *>(entry);
+         }
+         break;
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+      case VK_STRUCTURE_TYPE_PRESENT_TIMINGS_INFO_EXT:
+         if (extensions.present_timings_info == nullptr)
+         {
+            extensions.present_timings_info = reinterpret_cast<const VkPresentTimingsInfoEXT *>(entry);
+         }
+         break;
+#endif
+      default:
+         break;
+      }
+   }
+   return extensions;
+}
+
+VkResult swapchain_base::queue_present(VkQueue queue, const VkPresentInfoKHR *present_info,
+                                       const swapchain_presentation_parameters &submit_info)
+{
+   latency_scope queue_present_scope(m_latency_stats, latency_interval::queue_present);
+
+   pending_present_request pending_present{};
+   TRY(begin_present(submit_info, pending_present));
+
+   const VkSemaphore *wait_semaphores = &m_swapchain_images[submit_info.pending_present.image_index].present_semaphore;
+   uint32_t sem_count = 1;
+   if (!submit_info.use_image_present_semaphore)
+   {
+      wait_semaphores = present_info->pWaitSemaphores;
+      sem_count = present_info->waitSemaphoreCount;
+   }
+
    void *submission_pnext = nullptr;
    std::optional<VkFrameBoundaryEXT> frame_boundary;
    /* Do not handle the event if it was handled before reaching this point */
    if (submit_info.handle_present_frame_boundary_event)
    {
       frame_boundary = m_frame_boundary_handler.handle_frame_boundary_event(
-         present_info, &m_swapchain_images[submit_info.pending_present.image_index].image);
+         submit_info.frame_boundary, &m_swapchain_images[submit_info.pending_present.image_index].image);
       if (frame_boundary.has_value())
       {
          submission_pnext = &frame_boundary.value();
+         WSI_TRACE_INSTANT("frame boundary swapchain=%p present_id=%" PRIu64 " frame_id=%" PRIu64,
+                           static_cast<void *>(this), submit_info.pending_present.present_id,
+                           frame_boundary->frameID);
       }
    }
 
@@ -741,27 +1679,166 @@ VkResult swapchain_base::queue_present(VkQueue queue, const VkPresentInfoKHR *pr
          nullptr,
       (submit_info.present_fence != VK_NULL_HANDLE) ? 1u : 0,
    };
+#if ENABLE_INSTRUMENTATION && VULKAN_WSI_LAYER_EXPERIMENTAL
+   VkCommandBuffer timestamp_command_buffer = VK_NULL_HANDLE;
+   if (m_gpu_timestamps != nullptr && frame_boundary.has_value())
+   {
+      timestamp_command_buffer = m_gpu_timestamps->get_command_buffer(
+         queue, submit_info.pending_present.image_index, submit_info.pending_present.present_id);
+      if (timestamp_command_buffer != VK_NULL_HANDLE)
+      {
+         semaphores.command_buffers = &timestamp_command_buffer;
+         semaphores.command_buffers_count = 1;
+      }
+   }
+#endif
    TRY_LOG_CALL(image_set_present_payload(m_swapchain_images[submit_info.pending_present.image_index], queue,
                                           semaphores, submission_pnext));
 
    if (submit_info.present_fence != VK_NULL_HANDLE)
    {
-      const queue_submit_semaphores wait_semaphores = {
-         &m_swapchain_images[submit_info.pending_present.image_index].present_fence_wait, 1, nullptr, 0
-      };
-      /*
-       * Here we chain wait_semaphores with present_fence through present_fence_wait.
-       */
-      TRY(sync_queue_submit(m_device_data, queue, submit_info.present_fence, wait_semaphores));
+      TRY(signal_present_fence(queue, submit_info.present_fence,
+                               m_swapchain_images[submit_info.pending_present.image_index].present_fence_wait));
    }
 
-   TRY(notify_presentation_engine(submit_info.pending_present));
+   TRY(notify_presentation_engine(pending_present));
+
+   return VK_SUCCESS;
+}
+
+bool swapchain_base::can_batch_present(const swapchain_presentation_parameters &presentation_parameters) const
+{
+   /* A shared submission can carry a single frame boundary, so presents generating their own are not batched. */
+   if (presentation_parameters.handle_present_frame_boundary_event &&
+       m_frame_boundary_handler.should_layer_handle_frame_boundary_events())
+   {
+      return false;
+   }
+   return supports_batched_present_payload();
+}
 
+VkResult swapchain_base::prepare_batched_present(VkQueue queue,
+                                                 const swapchain_presentation_parameters &presentation_parameters,
+                                                 batched_present &present)
+{
+   assert(can_batch_present(presentation_parameters));
+   present.start_time = util::get_monotonic_time_ns();
+   TRY(begin_present(presentation_parameters, present.pending_present));
+
+   auto &image = m_swapchain_images[presentation_parameters.pending_present.image_index];
+   image_get_batched_present_payload(image, queue, present.payload_signal, present.payload_wait);
+   present.present_fence_wait =
+      (presentation_parameters.present_fence != VK_NULL_HANDLE) ? image.present_fence_wait : VK_NULL_HANDLE;
    return VK_SUCCESS;
 }
 
+VkResult swapchain_base::finish_batched_present(VkQueue queue,
+                                                const swapchain_presentation_parameters &presentation_parameters,
+                                                const batched_present &present)
+{
+   auto &image = m_swapchain_images[presentation_parameters.pending_present.image_index];
+   image_commit_batched_present_payload(image, queue);
+
+   VkResult res = VK_SUCCESS;
+   if (presentation_parameters.present_fence != VK_NULL_HANDLE)
+   {
+      res = signal_present_fence(queue, presentation_parameters.present_fence, image.present_fence_wait);
+   }
+   if (res == VK_SUCCESS)
+   {
+      res = notify_presentation_engine(present.pending_present);
+   }
+
+   m_latency_stats.record(latency_interval::queue_present, util::get_monotonic_time_ns() - present.start_time);
+   return res;
+}
+
+bool swapchain_base::is_present_fence_from_sync_fd_supported() const
+{
+   using entrypoint_index = layer::device_dispatch_table::entrypoint_index;
+   using instance_entrypoint_index = layer::instance_dispatch_table::entrypoint_index;
+   auto &instance = m_device_data.instance_data;
+   if (!m_device_data.disp.get_fn<PFN_vkGetSemaphoreFdKHR>(entrypoint_index::GetSemaphoreFdKHR).has_value() ||
+       !m_device_data.disp.get_fn<PFN_vkImportFenceFdKHR>(entrypoint_index::ImportFenceFdKHR).has_value() ||
+       !instance.disp
+           .get_fn<PFN_vkGetPhysicalDeviceExternalSemaphorePropertiesKHR>(
+              instance_entrypoint_index::GetPhysicalDeviceExternalSemaphorePropertiesKHR)
+           .has_value() ||
+       !instance.disp
+           .get_fn<PFN_vkGetPhysicalDeviceExternalFencePropertiesKHR>(
+              instance_entrypoint_index::GetPhysicalDeviceExternalFencePropertiesKHR)
+           .has_value())
+   {
+      return false;
+   }
+
+   VkPhysicalDeviceExternalSemaphoreInfo external_semaphore_info = {};
+   external_semaphore_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO;
+   external_semaphore_info.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+   VkExternalSemaphoreProperties semaphore_properties = {};
+   semaphore_properties.sType = VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES;
+   instance.disp.GetPhysicalDeviceExternalSemaphorePropertiesKHR(m_device_data.physical_device,
+                                                                 &external_semaphore_info, &semaphore_properties);
+
+   VkPhysicalDeviceExternalFenceInfo external_fence_info = {};
+   external_fence_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_FENCE_INFO;
+   external_fence_info.handleType = VK_EXTERNAL_FENCE_HANDLE_TYPE_SYNC_FD_BIT;
+   VkExternalFenceProperties fence_properties = {};
+   fence_properties.sType = VK_STRUCTURE_TYPE_EXTERNAL_FENCE_PROPERTIES;
+   instance.disp.GetPhysicalDeviceExternalFencePropertiesKHR(m_device_data.physical_device, &external_fence_info,
+                                                             &fence_properties);
+
+   return (semaphore_properties.externalSemaphoreFeatures & VK_EXTERNAL_SEMAPHORE_FEATURE_EXPORTABLE_BIT) &&
+          (fence_properties.externalFenceFeatures & VK_EXTERNAL_FENCE_FEATURE_IMPORTABLE_BIT);
+}
+
+VkResult swapchain_base::signal_present_fence(VkQueue queue, VkFence present_fence, VkSemaphore present_fence_wait)
+{
+   if (m_present_fence_from_sync_fd)
+   {
+      /* Exporting the sync FD consumes the pending signal of present_fence_wait, like a wait would. Importing it into
+       * the application fence signals the fence when the present payload is done, saving a queue submission. */
+      VkSemaphoreGetFdInfoKHR get_fd_info = {};
+      get_fd_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR;
+      get_fd_info.semaphore = present_fence_wait;
+      get_fd_info.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+
+      int sync_fd = -1;
+      if (m_device_data.disp.GetSemaphoreFdKHR(m_device, &get_fd_info, &sync_fd) == VK_SUCCESS)
+      {
+         VkImportFenceFdInfoKHR import_info = {};
+         import_info.sType = VK_STRUCTURE_TYPE_IMPORT_FENCE_FD_INFO_KHR;
+         import_info.fence = present_fence;
+         import_info.flags = VK_FENCE_IMPORT_TEMPORARY_BIT;
+         import_info.handleType = VK_EXTERNAL_FENCE_HANDLE_TYPE_SYNC_FD_BIT;
+         import_info.fd = sync_fd;
+
+         /* A successful import takes ownership of the sync FD. The semaphore was consumed, so there is no fallback. */
+         VkResult res = m_device_data.disp.ImportFenceFdKHR(m_device, &import_info);
+         if (res != VK_SUCCESS && sync_fd >= 0)
+         {
+            close(sync_fd);
+         }
+         return res != VK_ERROR_INVALID_EXTERNAL_HANDLE ? res : VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+   }
+
+   /* Chain the present payload with present_fence through present_fence_wait. The chaining submission goes to the
+    * layer's queue when it has one, leaving only the payload on the application's queue. */
+   const queue_submit_semaphores wait_semaphores = { &present_fence_wait, 1, nullptr, 0 };
+   if (m_device_data.get_dedicated_queue() != VK_NULL_HANDLE)
+   {
+      auto queue_lock = m_device_data.lock_internal_queue();
+      return sync_queue_submit(m_device_data, m_queue, present_fence, wait_semaphores);
+   }
+   return sync_queue_submit(m_device_data, queue, present_fence, wait_semaphores);
+}
+
 void swapchain_base::deprecate(VkSwapchainKHR descendant)
 {
+   /* The remaining deferred images will never be acquired, and free images are destroyed below. */
+   stop_allocation_thread();
+
    for (auto &img : m_swapchain_images)
    {
       if (img.status == swapchain_image::FREE)
@@ -778,16 +1855,8 @@ void swapchain_base::wait_for_pending_buffers()
 {
    std::unique_lock<std::mutex> acquire_lock(m_image_acquire_lock);
    int wait;
-   int acquired_images = 0;
    std::unique_lock<std::recursive_mutex> image_status_lock(m_image_status_mutex);
-
-   for (auto &img : m_swapchain_images)
-   {
-      if (img.status == swapchain_image::ACQUIRED)
-      {
-         acquired_images++;
-      }
-   }
+   const int acquired_images = static_cast<int>(count_images_with_status(swapchain_image::ACQUIRED));
 
    /* Waiting for free images waits for both free and pending. One pending image may be presented and acquired by a
     * compositor. The WSI backend may not necessarily know which pending image is presented to change its state. It may
@@ -816,6 +1885,9 @@ void swapchain_base::clear_descendant()
 VkResult swapchain_base::wait_for_free_buffer(uint64_t timeout)
 {
    VkResult retval;
+   /* Work out the deadline up front, so that the time spent in get_free_buffer() counts against the timeout. */
+   const uint64_t deadline = util::timeout_to_deadline(timeout);
+
    /* first see if a buffer is already marked as free */
    retval = m_free_image_semaphore.wait(0);
    if (retval == VK_NOT_READY)
@@ -828,8 +1900,8 @@ VkResult swapchain_base::wait_for_free_buffer(uint64_t timeout)
       if (retval == VK_SUCCESS)
       {
          /* the sub-implementation has done it's thing, so re-check the
-          * semaphore */
-         retval = m_free_image_semaphore.wait(timeout);
+          * semaphore. A zero timeout means the semaphore is not expected to block. */
+         retval = (timeout == 0) ? m_free_image_semaphore.wait(0) : m_free_image_semaphore.wait_until(deadline);
       }
    }
 
@@ -864,7 +1936,9 @@ VkResult swapchain_base::handle_switching_presentation_mode(VkPresentModeKHR swa
       WSI_LOG_ERROR("unable to switch presentation mode");
       return VK_ERROR_SURFACE_LOST_KHR;
    }
-   m_present_mode = swapchain_present_mode;
+
+   /* The presents already queued keep their mode, the presentation engine switches when this present reaches it. */
+   m_requested_present_mode = swapchain_present_mode;
    return VK_SUCCESS;
 }
 
@@ -872,52 +1946,347 @@ void swapchain_base::set_present_id(uint64_t value)
 {
    if (value != 0)
    {
+      const std::lock_guard<std::mutex> lock(m_present_id_mutex);
       assert(value > m_present_id);
       m_present_id = value;
+      m_present_id_condition.notify_all();
+   }
+}
+
+void swapchain_base::frame_queued()
+{
+   /* Shared presentable images are never waiting to be displayed, they are scanned out as they are rendered. */
+   if (m_max_frame_latency == 0 || m_present_mode == VK_PRESENT_MODE_SHARED_DEMAND_REFRESH_KHR ||
+       m_present_mode == VK_PRESENT_MODE_SHARED_CONTINUOUS_REFRESH_KHR)
+   {
+      return;
+   }
+
+   const std::lock_guard<std::mutex> lock(m_frame_latency_mutex);
+   if (m_frames_queued - m_frames_displayed == m_frame_queue_times.size())
+   {
+      /* A backend fell behind in reporting, forget the oldest present rather than its queue time. */
+      m_frames_displayed++;
+      m_frame_latency_condition.notify_all();
+   }
+   m_frame_queue_times[m_frames_queued % m_frame_queue_times.size()] = util::get_monotonic_time_ns();
+   m_frames_queued++;
+}
+
+void swapchain_base::frame_displayed()
+{
+   if (m_max_frame_latency == 0)
+   {
+      return;
+   }
+
+   const std::lock_guard<std::mutex> lock(m_frame_latency_mutex);
+   if (m_frames_displayed == m_frames_queued)
+   {
+      /* Presents that were not counted, such as those of shared presentable images. */
+      return;
+   }
+
+   const uint64_t queue_time = m_frame_queue_times[m_frames_displayed % m_frame_queue_times.size()];
+   const uint64_t now = util::get_monotonic_time_ns();
+   const uint64_t sample = now > queue_time ? now - queue_time : 0;
+   /* Exponential moving average with a weight of 1/8 for the new sample, as a display rate change settles fast. */
+   m_present_to_display_time =
+      m_present_to_display_time == 0 ? sample : m_present_to_display_time - m_present_to_display_time / 8 + sample / 8;
+   m_frames_displayed++;
+   m_frame_latency_condition.notify_all();
+}
+
+void swapchain_base::wait_for_frame_latency(uint64_t deadline)
+{
+   /* How long a present may go unreported before it is assumed displayed, when its display time is not known. */
+   constexpr uint64_t UNMEASURED_DISPLAY_TIMEOUT_NS = 100000000; /* 100 milliseconds */
+
+   std::unique_lock<std::mutex> lock(m_frame_latency_mutex);
+   while (m_frames_queued - m_frames_displayed >= m_max_frame_latency && !error_has_occured())
+   {
+      /* The present that has to be displayed before the limit lets the next one through. */
+      const uint64_t frame = m_frames_queued - m_max_frame_latency;
+      const uint64_t queue_time = m_frame_queue_times[frame % m_frame_queue_times.size()];
+
+      /* Allow twice the measured time, so that ordinary jitter still waits for the report and only a lost one is
+       * skipped. */
+      const uint64_t expected_wait =
+         m_present_to_display_time != 0 ? 2 * m_present_to_display_time : UNMEASURED_DISPLAY_TIMEOUT_NS;
+      const uint64_t wake_time = std::min(deadline, queue_time + expected_wait);
+
+      const uint64_t time_left = util::deadline_to_timeout(wake_time);
+      if (time_left == 0)
+      {
+         if (wake_time == deadline)
+         {
+            /* Leave the timeout to the wait for a free image. */
+            return;
+         }
+
+         WSI_LOG_WARNING("Present was not reported displayed in time, no longer waiting for it.");
+         m_frames_displayed = frame + 1;
+         break;
+      }
+      m_frame_latency_condition.wait_for(lock, std::chrono::nanoseconds(time_left));
+   }
+}
+
+VkResult swapchain_base::wait_for_present_id(uint64_t present_id, uint64_t timeout)
+{
+   const uint64_t deadline = util::timeout_to_deadline(timeout);
+
+   std::unique_lock<std::mutex> lock(m_present_id_mutex);
+   while (m_present_id < present_id)
+   {
+      if (error_has_occured())
+      {
+         return get_error_state();
+      }
+
+      if (deadline == UINT64_MAX)
+      {
+         m_present_id_condition.wait(lock);
+         continue;
+      }
+
+      const uint64_t time_left = util::deadline_to_timeout(deadline);
+      if (time_left == 0)
+      {
+         return VK_TIMEOUT;
+      }
+      m_present_id_condition.wait_for(lock, std::chrono::nanoseconds(time_left));
    }
+
+   return VK_SUCCESS;
 }
 
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
 VkResult swapchain_base::presentation_timing_queue_set_size(size_t queue_size)
 {
-   if (presentation_timing_get_num_outstanding_results() > queue_size)
+   const std::lock_guard<std::mutex> lock(m_presentation_timing_mutex);
+   if (m_presentation_timing_count > queue_size)
    {
       return VK_NOT_READY;
    }
 
    util::vector<swapchain_presentation_entry> presentation_timing(
       util::allocator(m_allocator, VK_SYSTEM_ALLOCATION_SCOPE_DEVICE));
-   if (!presentation_timing.try_reserve(queue_size))
+   if (!presentation_timing.try_resize(queue_size))
    {
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
 
-   for (auto iter : m_presentation_timing)
+   /* Move the outstanding entries to the start of the new ring, keeping their order. */
+   for (size_t i = 0; i < m_presentation_timing_count; i++)
    {
-      if (iter.is_outstanding)
-      {
-         if (!presentation_timing.try_push_back(iter))
-         {
-            return VK_ERROR_OUT_OF_HOST_MEMORY;
-         }
-      }
+      presentation_timing[i] = m_presentation_timing[(m_presentation_timing_head + i) % m_presentation_timing.size()];
    }
    m_presentation_timing.swap(presentation_timing);
+   m_presentation_timing_head = 0;
    return VK_SUCCESS;
 }
 
-size_t swapchain_base::presentation_timing_get_num_outstanding_results()
+swapchain_presentation_entry *swapchain_base::find_presentation_timing_entry(uint64_t present_id)
+{
+   for (size_t i = 0; i < m_presentation_timing_count; i++)
+   {
+      auto &entry = m_presentation_timing[(m_presentation_timing_head + i) % m_presentation_timing.size()];
+      if (entry.present_id == present_id)
+      {
+         return &entry;
+      }
+   }
+   return nullptr;
+}
+
+#if ENABLE_INSTRUMENTATION
+void swapchain_base::collect_gpu_timestamps()
+{
+   m_gpu_timestamps->collect([this](const gpu_timestamps::completion &completion) {
+      WSI_TRACE_INSTANT("gpu complete swapchain=%p present_id=%" PRIu64 " time=%" PRIu64, static_cast<void *>(this),
+                        completion.present_id, completion.gpu_time);
+      set_present_stage_time(completion.present_id, VK_PRESENT_STAGE_QUEUE_OPERATIONS_END_BIT_EXT,
+                             completion.gpu_time);
+      if (completion.present_time >= completion.gpu_time)
+      {
+         m_latency_stats.record(latency_interval::gpu_to_present, completion.present_time - completion.gpu_time);
+      }
+   });
+}
+#endif
+
+void swapchain_base::set_present_stage_time(uint64_t present_id, VkPresentStageFlagBitsEXT stage, uint64_t time)
+{
+   if (present_id == 0)
+   {
+      return;
+   }
+
+   const std::lock_guard<std::mutex> lock(m_presentation_timing_mutex);
+   auto *entry = find_presentation_timing_entry(present_id);
+   if (entry != nullptr && (entry->requested_stages & stage) != 0)
+   {
+      entry->stage_times[__builtin_ctz(stage)] = time;
+      entry->reported_stages |= stage;
+   }
+}
+
+void swapchain_base::set_present_discarded(uint64_t present_id)
+{
+   if (present_id == 0)
+   {
+      return;
+   }
+
+   const std::lock_guard<std::mutex> lock(m_presentation_timing_mutex);
+   auto *entry = find_presentation_timing_entry(present_id);
+   if (entry != nullptr)
+   {
+      entry->reported_stages |= entry->requested_stages;
+   }
+}
+
+VkPresentStageFlagsEXT swapchain_base::get_reportable_present_stages()
+{
+   VkPresentStageFlagsEXT stages = 0;
+   for (const auto &domain : m_time_domains.m_time_domains)
+   {
+      stages |= domain->get_present_stages();
+   }
+
+   if (!m_page_flip_thread_run)
+   {
+      stages &= ~static_cast<VkPresentStageFlagsEXT>(VK_PRESENT_STAGE_QUEUE_OPERATIONS_END_BIT_EXT);
+   }
+   return stages;
+}
+
+uint64_t swapchain_base::resolve_target_present_time(const VkPresentTimingInfoEXT &timing_info)
+{
+   if (timing_info.time.targetPresentTime == 0)
+   {
+      return 0;
+   }
+
+   uint64_t target_present_time = timing_info.time.targetPresentTime;
+   if (timing_info.presentAtRelativeTime)
+   {
+      const uint64_t previous_present =
+         std::max(m_last_target_present_time, m_last_present_time.load(std::memory_order_relaxed));
+      if (previous_present == 0)
+      {
+         /* Nothing has been presented yet, so the first present is shown as soon as possible. */
+         return 0;
+      }
+      target_present_time = previous_present + timing_info.time.presentDuration;
+   }
+   m_last_target_present_time = target_present_time;
+
+   if (timing_info.presentAtNearestRefreshCycle)
+   {
+      /* The image is shown on the first refresh after it is scheduled, so scheduling it half a refresh cycle early
+       * shows it on the refresh nearest to the target. */
+      const uint64_t half_refresh_interval = get_refresh_interval() / 2;
+      target_present_time = target_present_time > half_refresh_interval ?
+                               target_present_time - half_refresh_interval :
+                               1;
+   }
+   return target_present_time;
+}
+
+VkResult swapchain_base::get_past_presentation_timing(VkPastPresentationTimingPropertiesEXT *properties)
 {
-   size_t num_outstanding = 0;
+   m_time_domains.set_swapchain_time_domain_properties(nullptr, &properties->timeDomainsCounter);
+   properties->timingPropertiesCounter = 0;
+
+   /* Stage times are converted to the calibrated Vulkan time domain of their stage. When all the stages of a timing
+    * share one, it is reported in that domain so it can be compared with other timestamps of the domain directly. */
+   std::array<std::optional<swapchain_calibrated_time>, PRESENT_STAGE_COUNT> calibrations;
+   const VkPresentStageFlagsEXT reportable_stages = get_reportable_present_stages();
+   for (size_t stage = 0; stage < PRESENT_STAGE_COUNT; stage++)
+   {
+      const auto stage_bit = static_cast<VkPresentStageFlagBitsEXT>(1u << stage);
+      swapchain_calibrated_time calibrated_time = {};
+      if ((reportable_stages & stage_bit) != 0 && m_time_domains.calibrate(stage_bit, &calibrated_time) == VK_SUCCESS)
+      {
+         calibrations[stage] = calibrated_time;
+      }
+   }
+
+   const std::lock_guard<std::mutex> lock(m_presentation_timing_mutex);
+   uint32_t available = 0;
+   for (size_t i = 0; i < m_presentation_timing_count; i++)
+   {
+      if (m_presentation_timing[(m_presentation_timing_head + i) % m_presentation_timing.size()].is_complete())
+      {
+         available++;
+      }
+   }
 
-   for (const auto &iter : m_presentation_timing)
+   if (properties->pPresentationTimings == nullptr)
    {
-      if (iter.is_outstanding)
+      properties->presentationTimingCount = available;
+      return VK_SUCCESS;
+   }
+
+   /* Return the complete entries in present order and compact the ring over them. */
+   uint32_t returned = 0;
+   size_t kept = 0;
+   for (size_t i = 0; i < m_presentation_timing_count; i++)
+   {
+      const auto entry = m_presentation_timing[(m_presentation_timing_head + i) % m_presentation_timing.size()];
+      if (entry.is_complete() && returned < properties->presentationTimingCount)
       {
-         num_outstanding++;
+         std::optional<VkTimeDomainKHR> common_domain;
+         bool calibrated = true;
+         for (size_t stage = 0; stage < PRESENT_STAGE_COUNT; stage++)
+         {
+            if ((entry.requested_stages & (1u << stage)) == 0)
+            {
+               continue;
+            }
+            if (!calibrations[stage].has_value() ||
+                (common_domain.has_value() && *common_domain != calibrations[stage]->time_domain))
+            {
+               calibrated = false;
+               break;
+            }
+            common_domain = calibrations[stage]->time_domain;
+         }
+         calibrated = calibrated && common_domain.has_value();
+
+         auto &timing = properties->pPresentationTimings[returned++];
+         timing.presentId = entry.present_id;
+         timing.timeDomain = calibrated ? *common_domain : VK_TIME_DOMAIN_PRESENT_STAGE_LOCAL_EXT;
+         timing.timeDomainId = 0;
+         timing.reportComplete = VK_TRUE;
+
+         uint32_t stage_count = 0;
+         for (size_t stage = 0; stage < PRESENT_STAGE_COUNT; stage++)
+         {
+            const VkPresentStageFlagsEXT stage_bit = 1u << stage;
+            if ((entry.requested_stages & stage_bit) != 0 && stage_count < timing.presentStageCount)
+            {
+               timing.pPresentStages[stage_count].stage = stage_bit;
+               /* 0 marks a stage the present did not reach and is not converted. */
+               timing.pPresentStages[stage_count].time = (calibrated && entry.stage_times[stage] != 0) ?
+                                                            entry.stage_times[stage] + calibrations[stage]->offset :
+                                                            entry.stage_times[stage];
+               stage_count++;
+            }
+         }
+         timing.presentStageCount = stage_count;
+         continue;
       }
+
+      m_presentation_timing[(m_presentation_timing_head + kept) % m_presentation_timing.size()] = entry;
+      kept++;
    }
-   return num_outstanding;
+   m_presentation_timing_count = kept;
+   properties->presentationTimingCount = returned;
+
+   return returned < available ? VK_INCOMPLETE : VK_SUCCESS;
 }
 
 VkResult swapchain_base::set_swapchain_time_domain_properties(
@@ -925,6 +2294,34 @@ VkResult swapchain_base::set_swapchain_time_domain_properties(
 {
    return m_time_domains.set_swapchain_time_domain_properties(pSwapchainTimeDomainProperties, pTimeDomainsCounter);
 }
+
+static_assert(static_cast<size_t>(latency_interval::count) == VK_SWAPCHAIN_LATENCY_INTERVAL_COUNT_ARM &&
+                 latency_histogram::BUCKET_COUNT == VK_SWAPCHAIN_LATENCY_HISTOGRAM_BUCKET_COUNT_ARM,
+              "Latency statistics do not match the experimental interface");
+
+VkResult swapchain_base::get_latency_statistics(uint32_t *count, VkSwapchainLatencyStatisticsARM *statistics) const
+{
+   assert(count != nullptr);
+   if (statistics == nullptr)
+   {
+      *count = VK_SWAPCHAIN_LATENCY_INTERVAL_COUNT_ARM;
+      return VK_SUCCESS;
+   }
+
+   const uint32_t written = std::min<uint32_t>(*count, VK_SWAPCHAIN_LATENCY_INTERVAL_COUNT_ARM);
+   for (uint32_t i = 0; i < written; i++)
+   {
+      const auto histogram = m_latency_stats.get_histogram(static_cast<latency_interval>(i)).get_snapshot();
+      statistics[i].interval = static_cast<VkSwapchainLatencyIntervalARM>(i);
+      statistics[i].sampleCount = histogram.sample_count;
+      statistics[i].totalDuration = histogram.total_duration;
+      statistics[i].maxDuration = histogram.max_duration;
+      std::copy(histogram.buckets.begin(), histogram.buckets.end(), statistics[i].histogram);
+   }
+   *count = written;
+
+   return written < VK_SWAPCHAIN_LATENCY_INTERVAL_COUNT_ARM ? VK_INCOMPLETE : VK_SUCCESS;
+}
 #endif
 
 } /* namespace wsi */
@@ -35,16 +35,30 @@
 #include <vulkan/vulkan.h>
 #include <thread>
 #include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <mutex>
 
 #include <layer/private_data.hpp>
 #include <util/timed_semaphore.hpp>
 #include <util/custom_allocator.hpp>
-#include <util/ring_buffer.hpp>
+#include <util/arena_allocator.hpp>
+#include <util/spsc_ring_buffer.hpp>
+#include <util/small_vector.hpp>
+#include <util/static_vector.hpp>
 #include "surface_properties.hpp"
 #include "wsi/synchronization.hpp"
 #include "wsi/frame_boundary.hpp"
 #include "util/helpers.hpp"
+#include "util/macros.hpp"
 #include "time_domains.hpp"
+#include "latency_stats.hpp"
+#if ENABLE_INSTRUMENTATION && VULKAN_WSI_LAYER_EXPERIMENTAL
+#include "gpu_timestamps.hpp"
+#endif
 #include "layer/wsi_layer_experimental.hpp"
 
 namespace wsi
@@ -64,6 +78,9 @@ struct swapchain_image
       UNALLOCATED,
    };
 
+   /* Number of values in @ref status. */
+   static constexpr size_t status_count = UNALLOCATED + 1;
+
    /* Implementation specific data */
    void *data{ nullptr };
 
@@ -73,6 +90,23 @@ struct swapchain_image
    VkSemaphore present_fence_wait{ VK_NULL_HANDLE };
 };
 
+/**
+ * @brief Memory held by a swapchain, see @ref swapchain_base::get_memory_footprint.
+ */
+struct swapchain_memory_footprint
+{
+   /* Bytes of the dma-bufs allocated for the images and imported as device memory. */
+   uint64_t dma_buf_bytes{ 0 };
+   /* Bytes of device memory allocated for the images, other than the imported dma-bufs. */
+   uint64_t device_memory_bytes{ 0 };
+   /* Bytes of the host memory the swapchain allocated for its objects. */
+   uint64_t host_bytes{ 0 };
+   /* Number of framebuffers created for the images, which keep their buffers alive on the display. */
+   uint32_t framebuffer_count{ 0 };
+   /* Number of images holding memory. */
+   uint32_t image_count{ 0 };
+};
+
 struct pending_present_request
 {
    /* The index of the pending image to use for present. */
@@ -83,8 +117,59 @@ struct pending_present_request
     * If 0, no present ID has been assigned to this request.
     */
    uint64_t present_id;
+
+   /**
+    * CLOCK_MONOTONIC time, in nanoseconds, before which the image should not be shown.
+    * If 0, the image is shown as soon as possible.
+    */
+   uint64_t target_present_time;
+
+   /* CLOCK_MONOTONIC time, in nanoseconds, at which the request was queued for the page flip thread. */
+   uint64_t queued_time;
+
+   /**
+    * Id of the group of presents of a vkQueuePresentKHR call that are shown together, see
+    * swapchain_base::get_present_group. If 0, the present does not belong to a group.
+    */
+   uint64_t present_group_id;
+
+   /* Number of presents in the group. */
+   uint32_t present_group_size;
+
+   /**
+    * Present mode the request was queued with. The swapchain switches to it when the request reaches the presentation
+    * engine, so that presents queued before a switch keep the mode they were queued with.
+    */
+   VkPresentModeKHR present_mode;
+};
+
+/**
+ * @brief The extension structures of a VkPresentInfoKHR handled by the layer.
+ *
+ * Filled by @ref find_present_extensions with a single walk of the pNext chain, and shared by the presents to all the
+ * swapchains of the call. Members are nullptr for the structures the application did not pass.
+ */
+struct present_extensions
+{
+   const VkPresentIdKHR *present_ids{ nullptr };
+   const VkSwapchainPresentFenceInfoEXT *present_fence_info{ nullptr };
+   const VkSwapchainPresentModeInfoEXT *present_mode_info{ nullptr };
+   const VkPresentRegionsKHR *present_regions{ nullptr };
+   const VkFrameBoundaryEXT *frame_boundary{ nullptr };
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+   const VkPresentTimingsInfoEXT *present_timings_info{ nullptr };
+#endif
 };
 
+/**
+ * @brief Find the extension structures of a present handled by the layer.
+ *
+ * @param present_info The present info.
+ *
+ * @return The structures, the first of each type in the pNext chain of @p present_info.
+ */
+present_extensions find_present_extensions(const VkPresentInfoKHR &present_info);
+
 struct swapchain_presentation_parameters
 {
    /* Fence supplied by the application with VkSwapchainPresentFenceInfoEXT. */
@@ -107,12 +192,21 @@ struct swapchain_presentation_parameters
    /* Contains details about the pending present request */
    pending_present_request pending_present{};
 
+   /**
+    * Region of the image that changed since the last present, from VkPresentRegionsKHR.
+    * If nullptr, the whole image may have changed.
+    */
+   const VkPresentRegionKHR *present_region{ nullptr };
+
    /**
     * Flag that indicates whether a frame boundary should be passed
     * to underlying layers/ICD if the feature is enabled.
     */
    VkBool32 handle_present_frame_boundary_event{ true };
 
+   /* Frame boundary passed by the application with VkFrameBoundaryEXT, nullptr if none. */
+   const VkFrameBoundaryEXT *frame_boundary{ nullptr };
+
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
    /**
     * Pointer to the present timing info.
@@ -121,17 +215,60 @@ struct swapchain_presentation_parameters
 #endif
 };
 
+/**
+ * @brief A present whose payload is signalled by a submission shared with the presents to other swapchains.
+ */
+struct batched_present
+{
+   /* Timeline semaphore value the shared submission signals for the present payload of the image. */
+   timeline_semaphore_point payload_signal{};
+
+   /* Timeline semaphore value the shared submission waits for, with a null semaphore if none. */
+   timeline_semaphore_point payload_wait{};
+
+   /* Semaphore the shared submission signals for the present fence, VK_NULL_HANDLE without a present fence. */
+   VkSemaphore present_fence_wait{ VK_NULL_HANDLE };
+
+   /* The present request, with its target present time resolved. */
+   pending_present_request pending_present{};
+
+   /* CLOCK_MONOTONIC time, in nanoseconds, at which the present started. */
+   uint64_t start_time{ 0 };
+};
+
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
+/**
+ * @brief Number of present stages defined by VkPresentStageFlagBitsEXT.
+ */
+static constexpr size_t PRESENT_STAGE_COUNT = 4;
+
 struct swapchain_presentation_entry
 {
-   /**
-    * Whether this entry is an outstanding result or not.
-    */
-   bool is_outstanding{ false };
    /**
     * The present id.
     */
    uint64_t present_id{ 0 };
+   /**
+    * Present stages the application asked the timing of.
+    */
+   VkPresentStageFlagsEXT requested_stages{ 0 };
+   /**
+    * Present stages the presentation engine has reported a time for.
+    */
+   VkPresentStageFlagsEXT reported_stages{ 0 };
+   /**
+    * Time at which each stage was reached, in nanoseconds, indexed by the bit position of the stage. 0 if the present
+    * was discarded before reaching the stage.
+    */
+   std::array<uint64_t, PRESENT_STAGE_COUNT> stage_times{};
+
+   /**
+    * @brief Whether a time has been reported for all the requested stages.
+    */
+   bool is_complete() const
+   {
+      return (reported_stages & requested_stages) == requested_stages;
+   }
 };
 #endif
 
@@ -144,6 +281,37 @@ struct image_compression_control_params
 };
 #endif
 
+/**
+ * @brief How the swapchain images are placed on a surface of a different size, from
+ *        VkSwapchainPresentScalingCreateInfoEXT. 0 where the application left it to the implementation.
+ */
+struct present_scaling_params
+{
+   VkPresentScalingFlagsEXT scaling_behavior;
+   VkPresentGravityFlagsEXT gravity_x;
+   VkPresentGravityFlagsEXT gravity_y;
+};
+
+/**
+ * @brief Get the size an image is stretched to so that it fits in a target while keeping its aspect ratio.
+ *
+ * @param image_extent  The size of the image.
+ * @param target_extent The size of the area the image is stretched to.
+ */
+VkExtent2D get_aspect_ratio_stretch_extent(const VkExtent2D &image_extent, const VkExtent2D &target_extent);
+
+/**
+ * @brief Get the offset along one axis of content placed in a larger area, following a present gravity.
+ *
+ * Also gives the offset of the part of an image that is kept when it is cropped to a smaller area.
+ *
+ * @param area_size    The size of the area along the axis.
+ * @param content_size The size of the content along the axis, at most @p area_size.
+ * @param gravity      The present gravity along the axis, 0 for the implementation's choice, which is
+ *                     VK_PRESENT_GRAVITY_MIN_BIT_EXT.
+ */
+int32_t get_present_gravity_offset(uint32_t area_size, uint32_t content_size, VkPresentGravityFlagsEXT gravity);
+
 /**
  * @brief Base swapchain class
  *
@@ -169,6 +337,14 @@ public:
     */
    VkResult init(VkDevice device, const VkSwapchainCreateInfoKHR *swapchain_create_info);
 
+   /**
+    * @brief Get the memory the swapchain holds.
+    *
+    * Images the swapchain has released, or not allocated yet, are not counted. The images of a retired swapchain are
+    * held until its descendant presents, so the footprints of both add up until then.
+    */
+   swapchain_memory_footprint get_memory_footprint();
+
    /**
     * @brief Acquires a free image.
     *
@@ -217,6 +393,59 @@ public:
    VkResult queue_present(VkQueue queue, const VkPresentInfoKHR *present_info,
                           const swapchain_presentation_parameters &presentation_parameters);
 
+   /**
+    * @brief Checks whether a present can be batched with the presents to other swapchains.
+    *
+    * Batched presents have their payloads signalled by a single submission, which the caller makes between
+    * @ref prepare_batched_present and @ref finish_batched_present, instead of a submission per swapchain.
+    *
+    * @param presentation_parameters Presentation parameters.
+    *
+    * @return true if the present can be batched, false if it must go through @ref queue_present.
+    */
+   bool can_batch_present(const swapchain_presentation_parameters &presentation_parameters) const;
+
+   /**
+    * @brief Starts a batched present.
+    *
+    * @param      queue                   The queue the shared submission will be made to.
+    * @param      presentation_parameters Presentation parameters, for which @ref can_batch_present returned true.
+    * @param[out] present                 The semaphore operations the shared submission must include.
+    *
+    * @return VK_SUCCESS on success, otherwise an error code, in which case the present must not be finished.
+    */
+   VkResult prepare_batched_present(VkQueue queue, const swapchain_presentation_parameters &presentation_parameters,
+                                    batched_present &present);
+
+   /**
+    * @brief Finishes a batched present once the shared submission has been made, and notifies the presentation
+    * engine.
+    *
+    * @param queue                   The queue the shared submission was made to.
+    * @param presentation_parameters Presentation parameters.
+    * @param present                 The present returned by @ref prepare_batched_present.
+    *
+    * @return VK_SUCCESS on success, VK_ERROR_OUT_OF_DATE_KHR if the swapchain has a descendant who started
+    * presenting, otherwise an error code.
+    */
+   VkResult finish_batched_present(VkQueue queue, const swapchain_presentation_parameters &presentation_parameters,
+                                   const batched_present &present);
+
+   /**
+    * @brief Get the group of swapchains that can show their presents of the same vkQueuePresentKHR call together.
+    *
+    * Presents to swapchains returning the same group are tagged with a common pending_present_request
+    * present_group_id, which the presentation engine uses to show them at the same time.
+    *
+    * @param presentation_parameters Presentation parameters.
+    *
+    * @return An opaque key identifying the group, or nullptr if the present is shown independently.
+    */
+   virtual const void *get_present_group(const swapchain_presentation_parameters &presentation_parameters) const
+   {
+      return nullptr;
+   }
+
    /**
     * @brief Get the allocator
     *
@@ -279,6 +508,20 @@ public:
     */
    VkResult get_swapchain_status();
 
+   /**
+    * @brief Wait until a present ID has been presented.
+    *
+    * This feature is provided by the VK_KHR_present_wait extension.
+    *
+    * @param present_id The present ID to wait for.
+    * @param timeout    Time to wait in nanoseconds. 0 doesn't block, UINT64_MAX waits indefinitely.
+    *
+    * @retval VK_SUCCESS once a present with an ID of at least @p present_id has been presented.
+    * @retval VK_TIMEOUT if the timeout expired first.
+    * @return Otherwise the error that occurred in the swapchain.
+    */
+   VkResult wait_for_present_id(uint64_t present_id, uint64_t timeout);
+
    /**
     * @brief Release all images not belonging to the device
     * by making them available to be acquired again
@@ -318,6 +561,59 @@ public:
     */
    VkResult set_swapchain_time_domain_properties(VkSwapchainTimeDomainPropertiesEXT *pSwapchainTimeDomainProperties,
                                                  uint64_t *pTimeDomainsCounter);
+
+   /**
+    * @brief Return the timing of past presents that the presentation engine has fully reported.
+    *
+    * Returned results are removed from the presentation timing queue, results that are still being reported stay.
+    *
+    * @param properties The properties to fill. If pPresentationTimings is nullptr, only the number of available
+    *                   results is returned.
+    *
+    * @return VK_SUCCESS, or VK_INCOMPLETE if more results are available than fit in pPresentationTimings.
+    */
+   VkResult get_past_presentation_timing(VkPastPresentationTimingPropertiesEXT *properties);
+
+   /**
+    * @brief Get the latency histograms of the acquire and present paths of the swapchain.
+    *
+    * @param[in,out] count      Number of elements of @p statistics. Set to the number of histograms written, or
+    *                           available if @p statistics is nullptr.
+    * @param[out]    statistics The histograms, one per VkSwapchainLatencyIntervalARM, or nullptr.
+    *
+    * @return VK_SUCCESS, or VK_INCOMPLETE if more histograms are available than fit in @p statistics.
+    */
+   VkResult get_latency_statistics(uint32_t *count, VkSwapchainLatencyStatisticsARM *statistics) const;
+
+   /**
+    * @brief Register the consumer that presented images are handed to as dma-bufs.
+    *
+    * While a consumer is registered, presented images are held until the consumer releases them with
+    * @ref release_consumer_image.
+    *
+    * @param consumer  The consumer, or nullptr to stop handing images over.
+    * @param user_data Passed to the consumer.
+    *
+    * @return VK_SUCCESS, or VK_ERROR_FEATURE_NOT_PRESENT if the images of the swapchain cannot be handed over.
+    */
+   virtual VkResult set_image_consumer(PFN_vkSwapchainImageConsumerARM, void *)
+   {
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+   }
+
+   /**
+    * @brief Give an image handed to the consumer back to the swapchain.
+    *
+    * @param image_index  Index of the image.
+    * @param release_fd   Sync FD the next acquire of the image waits for, or -1. Owned by the swapchain on success.
+    *
+    * @return VK_SUCCESS, VK_ERROR_VALIDATION_FAILED_EXT if the consumer does not hold the image, or
+    *         VK_ERROR_FEATURE_NOT_PRESENT if the images of the swapchain cannot be handed over.
+    */
+   virtual VkResult release_consumer_image(uint32_t, int)
+   {
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+   }
 #endif
 
 protected:
@@ -330,8 +626,33 @@ protected:
 
    /**
     * @brief Whether the page flip thread has to continue running or terminate.
+    *
+    * The flag is only ever cleared by teardown(), which then posts @ref m_page_flip_semaphore so that the page flip
+    * thread, blocked without a timeout, wakes up and observes the new value.
     */
-   bool m_page_flip_thread_run;
+   std::atomic<bool> m_page_flip_thread_run;
+
+   /**
+    * @brief Handle to the thread allocating the images of swapchains created with deferred memory allocation.
+    */
+   std::thread m_allocation_thread;
+
+   /**
+    * @brief Whether the allocation thread has to continue allocating images.
+    */
+   std::atomic<bool> m_allocation_thread_run;
+
+   /**
+    * @brief Index of the image being allocated by the allocation thread, or UINT32_MAX if there is none.
+    *
+    * Protected by @ref m_image_status_mutex. The image is not available to acquire until its allocation is done.
+    */
+   uint32_t m_allocating_image;
+
+   /**
+    * @brief Signalled, with @ref m_image_status_mutex held, when the allocation thread finishes allocating an image.
+    */
+   std::condition_variable_any m_image_allocated;
 
    /**
     * @brief A semaphore to be signalled once a page flip event occurs.
@@ -368,12 +689,19 @@ protected:
 
    /**
     * @brief In order to present the images in a FIFO order we implement
-    * a ring buffer to hold the images queued for presentation. Since the
-    * two pointers (head and tail) are used by different
-    * threads and we do not allow the application to acquire more images
-    * than we have we eliminate race conditions.
+    * a ring buffer to hold the images queued for presentation. The
+    * presenting thread is the only producer and the page flip thread the
+    * only consumer, so the ring buffer is lock-free and does not need
+    * @ref m_image_status_mutex. We do not allow the application to acquire
+    * more images than we have, so the ring buffer never overflows.
+    */
+   util::spsc_ring_buffer<pending_present_request, wsi::surface_properties::MAX_SWAPCHAIN_IMAGE_COUNT>
+      m_pending_buffer_pool;
+
+   /**
+    * @brief Latency histograms of the acquire and present paths, logged when the swapchain is destroyed.
     */
-   util::ring_buffer<pending_present_request, wsi::surface_properties::MAX_SWAPCHAIN_IMAGE_COUNT> m_pending_buffer_pool;
+   latency_stats m_latency_stats;
 
    /**
     * @brief User provided memory allocation callbacks.
@@ -381,9 +709,30 @@ protected:
    const util::allocator m_allocator;
 
    /**
-    * @brief Vector of images in the swapchain.
+    * @brief Arena for the allocations that live as long as the swapchain, such as the backend data of the images.
+    *
+    * Its memory is only released when the swapchain is destroyed, so it must not be used for per-frame allocations.
+    */
+   util::arena_allocator m_object_arena;
+
+   /**
+    * @brief Vector of images in the swapchain, stored inline as it is accessed on every acquire and present.
+    */
+   util::static_vector<swapchain_image, wsi::surface_properties::MAX_SWAPCHAIN_IMAGE_COUNT> m_swapchain_images;
+
+   /**
+    * @brief Bitmask of the images in each status, where bit i stands for m_swapchain_images[i].
+    *
+    * Lets the swapchain find an image with a given status in constant time instead of scanning
+    * @ref m_swapchain_images. Only updated through @ref set_image_status with @ref m_image_status_mutex held, but
+    * may be read without it.
+    */
+   std::array<std::atomic<uint64_t>, swapchain_image::status_count> m_image_status_masks;
+
+   /**
+    * @brief Storage for the backend data of the images, see @ref create_image_data.
     */
-   util::vector<swapchain_image> m_swapchain_images;
+   util::vector<std::max_align_t> m_image_data_arena;
 
    /**
     * @brief Handle to the surface object this swapchain will present images to.
@@ -391,14 +740,25 @@ protected:
    VkSurfaceKHR m_surface;
 
    /**
-    * @brief Present mode currently being used for this swapchain
+    * @brief Present mode currently being used for this swapchain.
+    *
+    * Only changed by the thread presenting the images, when a present queued with a different mode reaches the
+    * presentation engine.
     */
-   VkPresentModeKHR m_present_mode;
+   std::atomic<VkPresentModeKHR> m_present_mode;
+
+   /**
+    * @brief Present mode of the latest vkQueuePresentKHR call, which the next presents are queued with.
+    *
+    * Only used by the application thread presenting to the swapchain, it leads @ref m_present_mode by the presents
+    * still pending.
+    */
+   VkPresentModeKHR m_requested_present_mode;
 
    /**
     * @brief Possible presentation modes this swapchain is allowed to present with VkSwapchainPresentModesCreateInfoEXT
     */
-   util::vector<VkPresentModeKHR> m_present_modes;
+   util::small_vector<VkPresentModeKHR, 8> m_present_modes;
 
    /**
     * @brief Descendant of this swapchain.
@@ -432,6 +792,12 @@ protected:
     *
     */
    image_compression_control_params m_image_compression_control_params;
+
+   /**
+    * @brief Whether the compression was selected by the layer from the bandwidth budget, rather than by the
+    *        application.
+    */
+   bool m_automatic_compression;
 #endif
 
    /**
@@ -439,11 +805,51 @@ protected:
     */
    VkImageCreateInfo m_image_create_info;
 
+   /**
+    * @brief Image properties requested by the application, before the backend chose how to create the images.
+    *
+    * Images are only handed over to a descendant swapchain that requests the same properties.
+    */
+   VkImageCreateInfo m_requested_image_info;
+
+   /**
+    * @brief Scaling requested by the application, validated against the capabilities of the surface.
+    */
+   present_scaling_params m_present_scaling;
+
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
    /**
     *  @brief Handle the backend specific time domains for each present stage.
     */
    swapchain_time_domains m_time_domains;
+
+   /**
+    * @brief Record the time at which a present reached a present stage.
+    *
+    * Does nothing if the application did not request the timing of the stage for the present.
+    *
+    * @param present_id The present ID of the present request.
+    * @param stage      The present stage that was reached.
+    * @param time       Time at which the stage was reached in nanoseconds, or 0 if the present was discarded.
+    */
+   void set_present_stage_time(uint64_t present_id, VkPresentStageFlagBitsEXT stage, uint64_t time);
+
+   /**
+    * @brief Record that a present was discarded, reporting 0 for the stages it did not reach.
+    *
+    * @param present_id The present ID of the present request.
+    */
+   void set_present_discarded(uint64_t present_id);
+
+   /**
+    * @brief Get the present stages whose timing this swapchain can report.
+    *
+    * These are the stages backed by a time domain. The page flip thread reports when the queue operations of a
+    * present end, so that stage is only available when the swapchain uses it.
+    *
+    * @return The present stages.
+    */
+   VkPresentStageFlagsEXT get_reportable_present_stages();
 #endif
 
    /**
@@ -506,6 +912,13 @@ protected:
     */
    void teardown();
 
+   /**
+    * @brief Log the memory the swapchain holds.
+    *
+    * @param event What happened to the swapchain, for the log message.
+    */
+   void log_memory_footprint(const char *event);
+
    /**
     * @brief Allocates and binds a new swapchain image.
     *
@@ -528,6 +941,68 @@ protected:
     */
    virtual VkResult create_swapchain_image(VkImageCreateInfo image_create_info, swapchain_image &image) = 0;
 
+   /**
+    * @brief Whether the images of the swapchain can be created concurrently.
+    *
+    * Only the first image is created on its own. Backends returning true must allow @ref create_swapchain_image and
+    * @ref allocate_and_bind_swapchain_image to be called from several threads for the remaining images, which share
+    * the image create info set up for the first one.
+    *
+    * @return true if the images can be created concurrently.
+    */
+   virtual bool supports_parallel_image_creation() const
+   {
+      return false;
+   }
+
+   /**
+    * @brief Whether the free images of an ancestor swapchain can be handed over to this swapchain.
+    *
+    * Only called once the image properties requested for both swapchains were found to match. The ancestor presents
+    * to the same surface, so it is a swapchain of the same backend.
+    *
+    * @param ancestor The ancestor swapchain.
+    *
+    * @return true if @ref adopt_ancestor_image can be used with the images of @p ancestor.
+    */
+   virtual bool supports_image_handover(const swapchain_base &) const
+   {
+      return false;
+   }
+
+   /**
+    * @brief Take over the buffer, memory and presentation resources of a free image of the ancestor swapchain.
+    *
+    * Creates the image of this swapchain and binds it to the memory of @p ancestor_image, instead of allocating new
+    * memory. On success, what is left in @p ancestor_image is destroyed by the ancestor afterwards. On failure, the
+    * resources are given back to @p ancestor_image and anything created for @p image is released, so that it can be
+    * created from scratch. Called with the image status lock of the ancestor held.
+    *
+    * @param ancestor          The ancestor swapchain.
+    * @param ancestor_image    A FREE image of the ancestor.
+    * @param image_create_info Data to be used to create the image.
+    * @param image             The image of this swapchain receiving the resources.
+    *
+    * @return VK_SUCCESS on success, otherwise an appropriate error code.
+    */
+   virtual VkResult adopt_ancestor_image(swapchain_base &, swapchain_image &, const VkImageCreateInfo &,
+                                         swapchain_image &)
+   {
+      return VK_ERROR_INITIALIZATION_FAILED;
+   }
+
+   /**
+    * @brief Called once all the images of the swapchain have been initialized.
+    *
+    * Lets backends submit the work queued while creating the images in one go, rather than once per image.
+    *
+    * @return VK_SUCCESS on success, otherwise an appropriate error code.
+    */
+   virtual VkResult swapchain_images_initialized()
+   {
+      return VK_SUCCESS;
+   }
+
    /**
     * @brief Method to present and image
     *
@@ -537,6 +1012,18 @@ protected:
     */
    virtual void present_image(const pending_present_request &pending_present) = 0;
 
+   /**
+    * @brief Called when the present mode of the swapchain changes, right before presenting the first image with it.
+    *
+    * Called by the thread presenting the images with @ref m_present_mode already set to the new mode, so that
+    * backends can set up or tear down the pacing they only use in some of the present modes. Must not allocate.
+    *
+    * @param previous_present_mode The present mode the previous image was presented with.
+    */
+   virtual void present_mode_switched(VkPresentModeKHR)
+   {
+   }
+
    /**
     * @brief Transition a presented image to free.
     *
@@ -546,6 +1033,110 @@ protected:
     */
    void unpresent_image(uint32_t presented_index);
 
+   /**
+    * @brief Replace a present request with the newest one queued for the page flip thread.
+    *
+    * Implements VK_PRESENT_MODE_MAILBOX_KHR on top of the page flip thread. Every older request is skipped
+    * and its image goes back to FREE as soon as its present fence has signalled. Requests queued with another present
+    * mode are not taken. Must only be called from the page flip thread.
+    *
+    * @param pending_present The request about to be presented. Replaced with the newest queued request, if any.
+    *
+    * @return VK_SUCCESS, or the error returned while waiting for the present fences of the images involved.
+    */
+   VkResult take_latest_pending_present(pending_present_request &pending_present);
+
+   /**
+    * @brief Change the status of a swapchain image.
+    *
+    * All status changes must go through this method so that @ref m_image_status_masks stays in sync with the images.
+    * The caller must hold @ref m_image_status_mutex, which orders status changes with the semaphores and condition
+    * variables that track them.
+    *
+    * @param image  The image whose status is changed. Must be an element of @ref m_swapchain_images.
+    * @param status The new status of the image.
+    */
+   void set_image_status(swapchain_image &image, swapchain_image::status status);
+
+   /**
+    * @brief Get the index of a swapchain image.
+    *
+    * @param image An element of @ref m_swapchain_images.
+    */
+   uint32_t get_image_index(const swapchain_image &image) const
+   {
+      const size_t index = static_cast<size_t>(&image - m_swapchain_images.data());
+      assert(index < m_swapchain_images.size());
+      return static_cast<uint32_t>(index);
+   }
+
+   /**
+    * @brief Construct the backend data of an image in the image data arena of the swapchain.
+    *
+    * The arena holds the data of all the images in one allocation, made when the data of the first image is created,
+    * so that backends reach the data of neighbouring images without chasing separate allocations. The first image
+    * is always created on its own, so images created concurrently afterwards never allocate the arena.
+    *
+    * @param image The image the data belongs to, its data pointer is set to the new object.
+    * @param args  Arguments forwarded to the constructor of the data.
+    *
+    * @return The new data, or nullptr if the arena could not be allocated.
+    */
+   template <typename T, typename... arg_types>
+   T *create_image_data(swapchain_image &image, arg_types &&...args)
+   {
+      static_assert(alignof(T) <= alignof(std::max_align_t), "image data cannot be over-aligned");
+      constexpr size_t stride = (sizeof(T) + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+
+      if (m_image_data_arena.size() == 0 && !m_image_data_arena.try_resize(stride * m_swapchain_images.size()))
+      {
+         return nullptr;
+      }
+      assert(m_image_data_arena.size() == stride * m_swapchain_images.size());
+
+      void *slot = &m_image_data_arena[get_image_index(image) * stride];
+      T *data = new (slot) T(std::forward<arg_types>(args)...);
+      image.data = data;
+      return data;
+   }
+
+   /**
+    * @brief Destroy the backend data of an image created with @ref create_image_data.
+    *
+    * @param image The image whose data is destroyed, its data pointer is reset.
+    */
+   template <typename T>
+   void destroy_image_data(swapchain_image &image)
+   {
+      reinterpret_cast<T *>(image.data)->~T();
+      image.data = nullptr;
+   }
+
+   /**
+    * @brief Find an image with a given status without scanning the swapchain images.
+    *
+    * Reads the status masks atomically. Callers that need the result to stay valid, e.g. to change the status of the
+    * image found, must hold @ref m_image_status_mutex.
+    *
+    * @param status         The status to look for.
+    * @param ignored_images Mask of the image indices to skip.
+    *
+    * @return The lowest index of an image with @p status, or the number of swapchain images if there is none.
+    */
+   uint32_t find_image_with_status(swapchain_image::status status, uint64_t ignored_images = 0) const;
+
+   /**
+    * @brief Count the images with a given status.
+    *
+    * Reads the status masks atomically. Callers that need the result to stay valid must hold
+    * @ref m_image_status_mutex.
+    *
+    * @param status The status to count.
+    *
+    * @return The number of swapchain images with @p status.
+    */
+   uint32_t count_images_with_status(swapchain_image::status status) const;
+
    /**
     * @brief Method to release a swapchain image
     *
@@ -555,6 +1146,31 @@ protected:
     */
    virtual void destroy_image(swapchain_image &image){};
 
+   /**
+    * @brief Called by @ref teardown once the page flip thread has stopped, before the images are destroyed.
+    *
+    * Backends whose presentation engine may still be reading an image after its last present has been handed over,
+    * such as a page flip still in flight, wait for it here. The default implementation does nothing.
+    */
+   virtual void presentation_engine_stopped()
+   {
+   }
+
+   /**
+    * @brief Add the memory held by an image to a footprint.
+    *
+    * Called with @ref m_image_status_mutex held, for allocated images only. Backends allocating memory for their
+    * images implement it, the default implementation adds nothing.
+    *
+    * @param         image     The image.
+    * @param[in,out] footprint The footprint to add to.
+    */
+   virtual void add_image_memory_footprint(const swapchain_image &image, swapchain_memory_footprint &footprint) const
+   {
+      UNUSED(image);
+      UNUSED(footprint);
+   }
+
    /**
     * @brief Hook for any actions to free up a buffer for acquire
     *
@@ -573,6 +1189,22 @@ protected:
       return VK_SUCCESS;
    }
 
+   /**
+    * @brief Hook for backends that can limit presentation to the changed region of an image.
+    *
+    * Called before the present request is queued. The region is owned by the application and is not valid after
+    * vkQueuePresentKHR returns, so backends must copy anything they want to use when presenting the image.
+    *
+    * @param[in] image  The swapchain image being presented.
+    * @param[in] region The changed region of the image, or nullptr if the whole image may have changed.
+    *
+    * @return VK_SUCCESS on success or an error code otherwise.
+    */
+   virtual VkResult image_set_present_region(swapchain_image &image, const VkPresentRegionKHR *region)
+   {
+      return VK_SUCCESS;
+   }
+
    /**
     * @brief Sets the present payload for a swapchain image.
     *
@@ -601,9 +1233,114 @@ protected:
     */
    virtual VkResult image_wait_present(swapchain_image &image, uint64_t timeout) = 0;
 
+   /**
+    * @brief Whether the presentation engine waits for the present payload of the images itself.
+    *
+    * When true, the page flip thread hands the images to @ref present_image without waiting for their present
+    * payload with @ref image_wait_present first, so that the wait happens off the CPU. Only queried from the page flip
+    * thread.
+    */
+   virtual bool presentation_engine_waits_for_present_payload() const
+   {
+      return false;
+   }
+
+   /**
+    * @brief Whether the present payloads of the swapchain can be signalled by a submission made by the caller.
+    *
+    * Implementations returning true must implement @ref image_get_batched_present_payload and
+    * @ref image_commit_batched_present_payload.
+    */
+   virtual bool supports_batched_present_payload() const
+   {
+      return false;
+   }
+
+   /**
+    * @brief Gets the semaphore operations of the next present payload of an image, for a shared submission.
+    *
+    * @param      image  The swapchain image for which to set a present payload.
+    * @param      queue  The queue the shared submission will be made to.
+    * @param[out] signal The timeline semaphore value the submission must signal.
+    * @param[out] wait   The timeline semaphore value the submission must wait for, with a null semaphore if none.
+    */
+   virtual void image_get_batched_present_payload(swapchain_image &image, VkQueue queue,
+                                                  timeline_semaphore_point &signal, timeline_semaphore_point &wait)
+   {
+   }
+
+   /**
+    * @brief Records that the shared submission carrying the present payload of an image was made.
+    *
+    * @param image The swapchain image.
+    * @param queue The queue the shared submission was made to.
+    */
+   virtual void image_commit_batched_present_payload(swapchain_image &image, VkQueue queue)
+   {
+   }
+
+   /**
+    * @brief Takes the fence the presentation engine signals once it has stopped reading an image.
+    *
+    * Called with the image status lock held when the image is acquired. The fence is imported into the semaphore and
+    * fence passed to acquire, so the application can only wait for it on the GPU rather than on the CPU.
+    *
+    * @param[in] image The swapchain image being acquired.
+    *
+    * @return A sync FD for the release fence, or an invalid file descriptor if the image can be written immediately.
+    */
+   virtual util::fd_owner image_take_release_fence(swapchain_image &)
+   {
+      return util::fd_owner{};
+   }
+
+   /**
+    * @brief Get the refresh interval of the presentation engine.
+    *
+    * Presents that may be shown on the refresh cycle nearest to their target are scheduled half a refresh cycle
+    * before the target.
+    *
+    * @return The refresh interval in nanoseconds, or 0 if it is unknown.
+    */
+   virtual uint64_t get_refresh_interval() const
+   {
+      return 0;
+   }
+
+   /**
+    * @brief Whether the presentation engine holds images until their target present time.
+    *
+    * When it does not, the page flip thread waits for the target present time before presenting the image.
+    *
+    * @return true if @ref present_image schedules images with a target present time itself.
+    */
+   virtual bool schedules_target_present_time() const
+   {
+      return false;
+   }
+
+   /**
+    * @brief Wait until an image with a target present time should be handed to the presentation engine.
+    *
+    * Returns early if the page flip thread is asked to exit.
+    *
+    * @param target_present_time CLOCK_MONOTONIC time, in nanoseconds, before which the image should not be shown.
+    */
+   void wait_for_target_present_time(uint64_t target_present_time);
+
    /**
     * @brief Returns true if an error has occurred.
     */
+#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
+   /**
+    * @brief Give up on the compression selected by the layer, for surfaces that cannot use compressed images.
+    *
+    * @return true if the images were to be compressed by the layer's choice and no longer are, false if the
+    *         compression was chosen by the application and is kept.
+    */
+   bool drop_automatic_compression();
+#endif
+
    bool error_has_occured() const
    {
       return m_error_state != VK_SUCCESS;
@@ -614,6 +1351,14 @@ protected:
       return m_error_state;
    }
 
+   /**
+    * @brief Wake up a thread waiting for a free image, so that it observes an error set by another thread.
+    */
+   void wake_up_free_image_waiter()
+   {
+      m_free_image_semaphore.post();
+   }
+
    /*
     * @brief Set the error state.
     *
@@ -625,6 +1370,10 @@ protected:
    void set_error_state(VkResult state)
    {
       m_error_state = state;
+
+      /* Present waits return the error, rather than waiting for presents that will not happen. */
+      const std::lock_guard<std::mutex> lock(m_present_id_mutex);
+      m_present_id_condition.notify_all();
    }
 
    /**
@@ -634,6 +1383,15 @@ protected:
     */
    void set_present_id(uint64_t value);
 
+   /**
+    * @brief Report that the oldest present handed to the backend has been displayed, or is never going to be.
+    *
+    * Backends call this once for each present passed to present_image, as close as they can tell to when it reaches
+    * the screen. It paces acquires under the frame latency limit, see @ref wait_for_frame_latency. The presents
+    * discarded by @ref take_latest_pending_present are reported by it.
+    */
+   void frame_displayed();
+
 private:
    std::mutex m_image_acquire_lock;
    /**
@@ -677,7 +1435,9 @@ private:
     *    should release the image and continue.
     *
     * The function always waits on the page_flip_semaphore of the
-    * swapchain. Once it passes that we must wait for the fence of the
+    * swapchain without a timeout, so an idle swapchain does not wake up
+    * periodically. The semaphore is also posted on teardown to stop the
+    * thread. Once it passes that we must wait for the fence of the
     * oldest pending image to be signalled, this means that the gpu has
     * finished rendering to it and we can present it. From there on the
     * logic splits into the above 3 cases and if an image has been
@@ -708,6 +1468,82 @@ private:
     */
    VkResult init_page_flip_thread();
 
+   /**
+    * @brief Maximum number of threads, including the calling thread, creating swapchain images concurrently.
+    */
+   static constexpr uint32_t MAX_IMAGE_CREATION_THREADS = 4;
+
+   /**
+    * @brief Create a swapchain image, allocate its memory unless allocation is deferred and create its semaphores.
+    *
+    * @param image_create_info   Data to be used to create the image.
+    * @param deferred_allocation Whether the memory allocation of the image is deferred to its first acquire.
+    * @param image               The swapchain image.
+    *
+    * @return VK_SUCCESS on success or an error code otherwise.
+    */
+   VkResult init_swapchain_image(const VkImageCreateInfo &image_create_info, bool deferred_allocation,
+                                 swapchain_image &image);
+
+   /**
+    * @brief Initialize all the swapchain images, creating all but the first one on a pool of worker threads.
+    *
+    * The first error stops the workers from starting new images. Once all of them finished, every image is destroyed
+    * so that a failed creation does not leave a partially created set of images behind.
+    *
+    * @param image_create_info   Data to be used to create the images.
+    * @param deferred_allocation Whether the memory allocation of the images is deferred to their first acquire.
+    *
+    * @return VK_SUCCESS on success or the first error that occurred otherwise.
+    */
+   VkResult init_swapchain_images_parallel(const VkImageCreateInfo &image_create_info, bool deferred_allocation);
+
+   /**
+    * @brief Take over the free images of the ancestor swapchain, when it was created with the same image properties.
+    *
+    * Recreating a swapchain with the same images, e.g. to change the present mode, then neither allocates new
+    * buffers nor holds the memory of two sets of images. The images taken over start FREE, the remaining ones are
+    * created as usual by @ref init_swapchain_image.
+    *
+    * @param ancestor          The ancestor swapchain.
+    * @param image_create_info Data to be used to create the images.
+    *
+    * @return VK_SUCCESS on success or an error code otherwise.
+    */
+   VkResult adopt_ancestor_images(swapchain_base &ancestor, const VkImageCreateInfo &image_create_info);
+
+#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
+   /**
+    * @brief Select fixed-rate compression for the images, as they fit the bandwidth budget of
+    *        @ref get_compression_bandwidth_budget.
+    *
+    * Used when the application lets the implementation choose the fixed rate, or does not ask for any compression
+    * while a budget is set. Must be called after @ref init_platform, which sets up the refresh interval.
+    *
+    * @param swapchain_create_info The create info of the swapchain.
+    *
+    * @return VK_SUCCESS on success or an error code otherwise.
+    */
+   VkResult select_automatic_compression(const VkSwapchainCreateInfoKHR *swapchain_create_info);
+#endif
+
+   /**
+    * @brief Start allocating the unallocated images of the swapchain in the background.
+    *
+    * An image that fails to be allocated puts the swapchain in an error state, which acquire_next_image returns.
+    */
+   void start_allocation_thread();
+
+   /**
+    * @brief Stop the allocation thread, waiting for the image allocation in progress to finish.
+    */
+   void stop_allocation_thread();
+
+   /**
+    * @brief Thread function allocating the unallocated images one after the other.
+    */
+   void allocation_thread();
+
    /**
     * @brief Notify the presentation engine with the next image to be presented.
     *
@@ -721,6 +1557,19 @@ private:
     */
    VkResult notify_presentation_engine(const pending_present_request &submit_info);
 
+   /**
+    * @brief Performs the steps of a present that precede setting its payload.
+    *
+    * Reserves its present timing slot, switches the presentation mode and sets the present region if requested.
+    *
+    * @param      submit_info     Presentation parameters.
+    * @param[out] pending_present The present request, with its target present time resolved.
+    *
+    * @return VK_SUCCESS on success or an error code otherwise.
+    */
+   VkResult begin_present(const swapchain_presentation_parameters &submit_info,
+                          pending_present_request &pending_present);
+
    /**
     * @brief A flag to track if swapchain has started presenting.
     */
@@ -755,27 +1604,167 @@ private:
 
    /**
     * @brief Current present ID for this swapchain.
+    *
+    * Protected by @ref m_present_id_mutex.
     */
    uint64_t m_present_id{ 0 };
 
+   /**
+    * @brief Protects @ref m_present_id, which the presentation engine updates while the application waits for it.
+    */
+   std::mutex m_present_id_mutex;
+
+   /**
+    * @brief Signalled when @ref m_present_id advances or an error occurs in the swapchain.
+    */
+   std::condition_variable m_present_id_condition;
+
+   /**
+    * @brief Record a present handed to the presentation engine, for the frame latency limit.
+    */
+   void frame_queued();
+
+   /**
+    * @brief Block while the frame latency limit of presents are waiting to be displayed.
+    *
+    * Sleeps until the oldest present over the limit is reported displayed, or until it is expected to be from the
+    * measured present to display times, so that a missing report does not stall the application.
+    *
+    * @param deadline CLOCK_MONOTONIC deadline of the acquire, UINT64_MAX for none.
+    */
+   void wait_for_frame_latency(uint64_t deadline);
+
+   /**
+    * @brief Maximum number of presents waiting to be displayed once the next acquired image is presented, 0 for no
+    * limit. Set with WSI_MAX_FRAME_LATENCY.
+    */
+   uint32_t m_max_frame_latency{ 0 };
+
+   /**
+    * @brief Number of presents handed to the presentation engine, and of those reported displayed.
+    *
+    * Protected by @ref m_frame_latency_mutex, as are the other frame latency members.
+    */
+   uint64_t m_frames_queued{ 0 };
+   uint64_t m_frames_displayed{ 0 };
+
+   /**
+    * @brief CLOCK_MONOTONIC times the presents waiting to be displayed were queued at, indexed by their count.
+    */
+   std::array<uint64_t, surface_properties::MAX_SWAPCHAIN_IMAGE_COUNT> m_frame_queue_times{};
+
+   /**
+    * @brief Moving average of the time from present to display in nanoseconds, 0 until a present is displayed.
+    */
+   uint64_t m_present_to_display_time{ 0 };
+
+   std::mutex m_frame_latency_mutex;
+
+   /**
+    * @brief Signalled when a present is reported displayed.
+    */
+   std::condition_variable m_frame_latency_condition;
+
+   /**
+    * @brief Whether application present fences are signalled by moving the sync FD of the present payload into them,
+    * instead of with a queue submission waiting on @ref swapchain_image::present_fence_wait.
+    */
+   bool m_present_fence_from_sync_fd{ false };
+
+   /**
+    * @brief Check whether @ref m_present_fence_from_sync_fd can be used on this device.
+    */
+   bool is_present_fence_from_sync_fd_supported() const;
+
+   /**
+    * @brief Signal an application present fence once the present payload of an image is done.
+    *
+    * @param queue              The queue the present payload was submitted to.
+    * @param present_fence      The application fence to signal.
+    * @param present_fence_wait The semaphore signalled by the present payload.
+    *
+    * @return VK_SUCCESS on success or an error code otherwise.
+    */
+   VkResult signal_present_fence(VkQueue queue, VkFence present_fence, VkSemaphore present_fence_wait);
+
    /**
     * @brief Handler for frame boundary events
     *
     */
    frame_boundary_handler m_frame_boundary_handler;
 
+#if ENABLE_INSTRUMENTATION && VULKAN_WSI_LAYER_EXPERIMENTAL
+   /**
+    * @brief GPU completion times of the presented images, when requested with WSI_GPU_TIMESTAMPS.
+    */
+   util::unique_ptr<gpu_timestamps> m_gpu_timestamps;
+
+   /**
+    * @brief Publish the GPU completion times read since the last call.
+    *
+    * The time replaces the queue operations end time of the present and, for images passed to the backend, the time
+    * until then is recorded as @ref latency_interval::gpu_to_present.
+    */
+   void collect_gpu_timestamps();
+#endif
+
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
    /**
-    * @brief Queue for presentation timings.
+    * @brief Ring of the presentation timings that have not been returned to the application, in present order.
+    *
+    * The ring has one slot per entry the application allowed with vkSetSwapchainPresentTimingQueueSizeEXT.
     */
    util::vector<swapchain_presentation_entry> m_presentation_timing;
 
    /**
-    * @brief Get the size of the presentation timing queue
+    * @brief Slot of @ref m_presentation_timing holding the oldest entry.
+    */
+   size_t m_presentation_timing_head;
+
+   /**
+    * @brief Number of entries in @ref m_presentation_timing.
+    */
+   size_t m_presentation_timing_count;
+
+   /**
+    * @brief Get the entry of the presentation timing ring for a present.
+    *
+    * The caller must hold @ref m_presentation_timing_mutex.
     *
-    * @return queue size of the presentation timestamp queue.
+    * @param present_id The present ID of the present request.
+    *
+    * @return The entry, or nullptr if the present has no entry.
     */
-   size_t presentation_timing_get_num_outstanding_results();
+   swapchain_presentation_entry *find_presentation_timing_entry(uint64_t present_id);
+
+   /**
+    * @brief Protects @ref m_presentation_timing, which the presentation engine updates from the thread that
+    * presents while the application queues new presents.
+    */
+   std::mutex m_presentation_timing_mutex;
+
+   /**
+    * @brief CLOCK_MONOTONIC time, in nanoseconds, at which the last image was handed to the presentation engine.
+    */
+   std::atomic<uint64_t> m_last_present_time;
+
+   /**
+    * @brief Target present time of the last present that had one, 0 if there was none.
+    */
+   uint64_t m_last_target_present_time;
+
+   /**
+    * @brief Convert the target time of a present to a CLOCK_MONOTONIC time.
+    *
+    * Relative times are counted from the later of the previous target and the previous present. Targets are
+    * expected in the present stage local time domain, which is CLOCK_MONOTONIC.
+    *
+    * @param timing_info The present timing info of the present.
+    *
+    * @return The target present time in nanoseconds, or 0 if the present has no target.
+    */
+   uint64_t resolve_target_present_time(const VkPresentTimingInfoEXT &timing_info);
+
 #endif
 };
 
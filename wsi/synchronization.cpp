@@ -37,6 +37,18 @@
 namespace wsi
 {
 
+/**
+ * @brief Get the stage at which a payload submission waits for its semaphores.
+ *
+ * A submission without commands only forwards the semaphores, so it does not block later work on them. Commands it
+ * carries must run after the wait, otherwise they would not observe the end of the application's rendering.
+ */
+static VkPipelineStageFlags get_payload_wait_stage(const queue_submit_semaphores &semaphores)
+{
+   return semaphores.command_buffers_count != 0 ? VK_PIPELINE_STAGE_ALL_COMMANDS_BIT :
+                                                  VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+}
+
 fence_sync::fence_sync(layer::device_private_data &device, VkFence vk_fence)
    : fence{ vk_fence }
    , has_payload{ false }
@@ -169,14 +181,164 @@ std::optional<util::fd_owner> sync_fd_fence_sync::export_sync_fd()
    return std::nullopt;
 }
 
+timeline_semaphore_sync::timeline_semaphore_sync(layer::device_private_data &device, VkSemaphore vk_semaphore)
+   : semaphore{ vk_semaphore }
+   , dev{ &device }
+{
+}
+
+bool timeline_semaphore_sync::is_supported(const layer::device_private_data &device)
+{
+   return device.is_timeline_semaphore_enabled();
+}
+
+std::optional<timeline_semaphore_sync> timeline_semaphore_sync::create(layer::device_private_data &device)
+{
+   VkSemaphoreTypeCreateInfo type_info = {};
+   type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+   type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+   type_info.initialValue = 0;
+   VkSemaphoreCreateInfo semaphore_info = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, &type_info, 0 };
+   VkSemaphore semaphore = VK_NULL_HANDLE;
+   VkResult res = device.disp.CreateSemaphore(device.device, &semaphore_info,
+                                              device.get_allocator().get_original_callbacks(), &semaphore);
+   if (res != VK_SUCCESS)
+   {
+      return std::nullopt;
+   }
+   return timeline_semaphore_sync{ device, semaphore };
+}
+
+timeline_semaphore_sync::timeline_semaphore_sync(timeline_semaphore_sync &&rhs)
+{
+   *this = std::move(rhs);
+}
+
+timeline_semaphore_sync &timeline_semaphore_sync::operator=(timeline_semaphore_sync &&rhs)
+{
+   std::swap(semaphore, rhs.semaphore);
+   std::swap(last_value, rhs.last_value);
+   std::swap(last_queue, rhs.last_queue);
+   std::swap(dev, rhs.dev);
+   return *this;
+}
+
+timeline_semaphore_sync::~timeline_semaphore_sync()
+{
+   if (semaphore != VK_NULL_HANDLE)
+   {
+      wait_payload(last_value, UINT64_MAX);
+      dev->disp.DestroySemaphore(dev->device, semaphore, dev->get_allocator().get_original_callbacks());
+   }
+}
+
+VkResult timeline_semaphore_sync::wait_payload(uint64_t payload_value, uint64_t timeout)
+{
+   if (payload_value == 0)
+   {
+      return VK_SUCCESS;
+   }
+
+   VkSemaphoreWaitInfo wait_info = {};
+   wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+   wait_info.semaphoreCount = 1;
+   wait_info.pSemaphores = &semaphore;
+   wait_info.pValues = &payload_value;
+   return dev->disp.WaitSemaphoresKHR(dev->device, &wait_info, timeout);
+}
+
+VkResult timeline_semaphore_sync::set_payload(VkQueue queue, const queue_submit_semaphores &semaphores,
+                                              const void *submission_pnext, uint64_t &payload_value)
+{
+   timeline_semaphore_point signal;
+   timeline_semaphore_point wait;
+   get_next_payload(queue, signal, wait);
+
+   const bool wait_last_value = wait.semaphore != VK_NULL_HANDLE;
+   const uint32_t wait_count = semaphores.wait_semaphores_count + (wait_last_value ? 1 : 0);
+   const uint32_t signal_count = semaphores.signal_semaphores_count + 1;
+
+   util::allocator allocator(dev->get_allocator(), VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   util::vector<VkSemaphore> wait_semaphores(allocator);
+   util::vector<uint64_t> wait_values(allocator);
+   util::vector<VkPipelineStageFlags> wait_stages(allocator);
+   util::vector<VkSemaphore> signal_semaphores(allocator);
+   util::vector<uint64_t> signal_values(allocator);
+   if (!wait_semaphores.try_resize(wait_count) || !wait_values.try_resize(wait_count, 0) ||
+       !wait_stages.try_resize(wait_count, get_payload_wait_stage(semaphores)) ||
+       !signal_semaphores.try_resize(signal_count) || !signal_values.try_resize(signal_count, 0))
+   {
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+
+   /* Values for binary semaphores are ignored. */
+   std::copy(semaphores.wait_semaphores, semaphores.wait_semaphores + semaphores.wait_semaphores_count,
+             wait_semaphores.begin());
+   if (wait_last_value)
+   {
+      wait_semaphores.back() = wait.semaphore;
+      wait_values.back() = wait.value;
+   }
+   std::copy(semaphores.signal_semaphores, semaphores.signal_semaphores + semaphores.signal_semaphores_count,
+             signal_semaphores.begin());
+   signal_semaphores.back() = signal.semaphore;
+   signal_values.back() = signal.value;
+
+   VkTimelineSemaphoreSubmitInfo timeline_info = {};
+   timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+   timeline_info.pNext = submission_pnext;
+   timeline_info.waitSemaphoreValueCount = wait_count;
+   timeline_info.pWaitSemaphoreValues = wait_values.data();
+   timeline_info.signalSemaphoreValueCount = signal_count;
+   timeline_info.pSignalSemaphoreValues = signal_values.data();
+
+   VkSubmitInfo submit_info = { VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                                &timeline_info,
+                                wait_count,
+                                wait_semaphores.data(),
+                                wait_stages.data(),
+                                semaphores.command_buffers_count,
+                                semaphores.command_buffers,
+                                signal_count,
+                                signal_semaphores.data() };
+
+   TRY(dev->disp.QueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE));
+
+   payload_value = commit_payload(queue);
+   return VK_SUCCESS;
+}
+
+void timeline_semaphore_sync::get_next_payload(VkQueue queue, timeline_semaphore_point &signal,
+                                               timeline_semaphore_point &wait) const
+{
+   signal = { semaphore, last_value + 1 };
+
+   /* Signal operations on a timeline semaphore must execute in increasing order. Payloads on the same queue are
+    * ordered by submission, when the queue changes the new payload also waits for the previous one.
+    */
+   wait = {};
+   if (last_value != 0 && queue != last_queue)
+   {
+      wait = { semaphore, last_value };
+   }
+}
+
+uint64_t timeline_semaphore_sync::commit_payload(VkQueue queue)
+{
+   last_value++;
+   last_queue = queue;
+   return last_value;
+}
+
 VkResult sync_queue_submit(const layer::device_private_data &device, VkQueue queue, VkFence fence,
                            const queue_submit_semaphores &semaphores, const void *submission_pnext)
 {
    /* When the semaphore that comes in is signalled, we know that all work is done. So, we do not
     * want to block any future Vulkan queue work on it. So, we pass in BOTTOM_OF_PIPE bit as the
-    * wait flag.
+    * wait flag, unless the submission has commands of its own that must run after the wait.
     */
-   VkPipelineStageFlags pipeline_stage_flag = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+   const VkPipelineStageFlags wait_stage = get_payload_wait_stage(semaphores);
+   VkPipelineStageFlags pipeline_stage_flag = wait_stage;
    VkPipelineStageFlags *pipeline_stage_flag_data = &pipeline_stage_flag;
 
    util::vector<VkPipelineStageFlags> pipeline_stage_flags_vector{ util::allocator(
@@ -188,8 +350,7 @@ VkResult sync_queue_submit(const layer::device_private_data &device, VkQueue que
       {
          return VK_ERROR_OUT_OF_HOST_MEMORY;
       }
-      std::fill(pipeline_stage_flags_vector.begin(), pipeline_stage_flags_vector.end(),
-                VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+      std::fill(pipeline_stage_flags_vector.begin(), pipeline_stage_flags_vector.end(), wait_stage);
       pipeline_stage_flag_data = pipeline_stage_flags_vector.data();
    }
 
@@ -198,8 +359,8 @@ VkResult sync_queue_submit(const layer::device_private_data &device, VkQueue que
                                 semaphores.wait_semaphores_count,
                                 semaphores.wait_semaphores,
                                 pipeline_stage_flag_data,
-                                0,
-                                nullptr,
+                                semaphores.command_buffers_count,
+                                semaphores.command_buffers,
                                 semaphores.signal_semaphores_count,
                                 semaphores.signal_semaphores };
 
@@ -51,6 +51,9 @@ struct queue_submit_semaphores
    uint32_t wait_semaphores_count;
    const VkSemaphore *signal_semaphores;
    uint32_t signal_semaphores_count;
+   /* Command buffers executed once the wait semaphores are signalled, such as one recording a GPU timestamp. */
+   const VkCommandBuffer *command_buffers{ nullptr };
+   uint32_t command_buffers_count{ 0 };
 };
 
 /**
@@ -103,6 +106,14 @@ public:
    VkResult set_payload(VkQueue queue, const queue_submit_semaphores &semaphores,
                         const void *submission_pnext = nullptr);
 
+   /**
+    * Whether a payload is set, which is no longer the case once it has been exported.
+    */
+   bool is_payload_set() const
+   {
+      return has_payload;
+   }
+
 protected:
    /**
     * Non-public constructor to initialize the object with valid data.
@@ -184,6 +195,121 @@ private:
    sync_fd_fence_sync(layer::device_private_data &device, VkFence vk_fence);
 };
 
+/**
+ * A value of a Vulkan timeline semaphore.
+ */
+struct timeline_semaphore_point
+{
+   VkSemaphore semaphore{ VK_NULL_HANDLE };
+   uint64_t value{ 0 };
+};
+
+/**
+ * Synchronization of the present payloads of a swapchain using a single Vulkan timeline semaphore.
+ *
+ * Each payload signals the next value of the timeline semaphore, so waiting on an image only needs the value of its
+ * latest payload. Unlike @ref fence_sync, no per-image fence has to be reset before a new payload is set.
+ */
+class timeline_semaphore_sync
+{
+public:
+   /**
+    * Checks if a Vulkan device can use timeline semaphores for present synchronization.
+    *
+    * @param device The device private data to check support for.
+    *
+    * @return true if supported, false otherwise.
+    */
+   static bool is_supported(const layer::device_private_data &device);
+
+   /**
+    * Creates a new timeline semaphore synchronization object.
+    *
+    * @param device The device private data for which to create it.
+    *
+    * @return Empty optional on failure or initialized timeline semaphore.
+    */
+   static std::optional<timeline_semaphore_sync> create(layer::device_private_data &device);
+
+   timeline_semaphore_sync() = default;
+   timeline_semaphore_sync(const timeline_semaphore_sync &) = delete;
+   timeline_semaphore_sync &operator=(const timeline_semaphore_sync &) = delete;
+
+   timeline_semaphore_sync(timeline_semaphore_sync &&rhs);
+   timeline_semaphore_sync &operator=(timeline_semaphore_sync &&rhs);
+
+   ~timeline_semaphore_sync();
+
+   /**
+    * Waits for a payload to complete execution.
+    *
+    * @note This method can be called concurrently with @ref set_payload.
+    *
+    * @param payload_value The value returned by @ref set_payload for the payload, 0 if no payload was set.
+    * @param timeout       Timeout for waiting in nanoseconds.
+    *
+    * @return VK_SUCCESS on success or if the payload has completed.
+    *         Other error code on failure or timeout.
+    */
+   VkResult wait_payload(uint64_t payload_value, uint64_t timeout);
+
+   /**
+    * Sets a new payload signalling the next value of the timeline semaphore.
+    *
+    * @note This method is not threadsafe.
+    *
+    * @param      queue            The Vulkan queue that may be used to submit synchronization commands.
+    * @param      semaphores       The wait and signal semaphores.
+    * @param      submission_pnext Chain of pointers to attach to the payload submission.
+    * @param[out] payload_value    The value signalled by the payload, to be passed to @ref wait_payload.
+    *
+    * @return VK_SUCCESS on success or other error code on failing to set the payload.
+    */
+   VkResult set_payload(VkQueue queue, const queue_submit_semaphores &semaphores, const void *submission_pnext,
+                        uint64_t &payload_value);
+
+   /**
+    * Gets the semaphore operations of the next payload, for a payload submitted by the caller.
+    *
+    * This allows a submission to carry the payloads of several swapchains. It must be followed by
+    * @ref commit_payload once the submission succeeds.
+    *
+    * @note This method is not threadsafe.
+    *
+    * @param      queue  The Vulkan queue the payload will be submitted to.
+    * @param[out] signal The value the payload must signal.
+    * @param[out] wait   The value the payload must wait for, with a null semaphore if it needs not wait.
+    */
+   void get_next_payload(VkQueue queue, timeline_semaphore_point &signal, timeline_semaphore_point &wait) const;
+
+   /**
+    * Records that the payload returned by @ref get_next_payload was submitted.
+    *
+    * @note This method is not threadsafe.
+    *
+    * @param queue The Vulkan queue the payload was submitted to.
+    *
+    * @return The value signalled by the payload, to be passed to @ref wait_payload.
+    */
+   uint64_t commit_payload(VkQueue queue);
+
+private:
+   /**
+    * Non-public constructor to initialize the object with valid data.
+    *
+    * @param device       The device private data for the semaphore.
+    * @param vk_semaphore The created Vulkan timeline semaphore.
+    */
+   timeline_semaphore_sync(layer::device_private_data &device, VkSemaphore vk_semaphore);
+
+   VkSemaphore semaphore{ VK_NULL_HANDLE };
+   /* Value signalled by the latest payload. */
+   uint64_t last_value{ 0 };
+   /* Queue the latest payload was submitted to. */
+   VkQueue last_queue{ VK_NULL_HANDLE };
+   layer::device_private_data *dev{ nullptr };
+};
+
 /**
  * @brief Submit an empty queue operation for synchronization.
  *
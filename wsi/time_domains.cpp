@@ -29,11 +29,173 @@
  */
 
 #include "time_domains.hpp"
+#include "layer/private_data.hpp"
 #include <vulkan/vulkan.h>
 namespace wsi
 {
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
 
+/**
+ * @brief Get the CPU clock matching a Vulkan time domain.
+ *
+ * @param time_domain The Vulkan time domain.
+ * @param[out] clock  The matching clock.
+ *
+ * @return true if the time domain is a CPU clock, false otherwise.
+ */
+static bool get_time_domain_clock(VkTimeDomainKHR time_domain, clockid_t &clock)
+{
+   switch (time_domain)
+   {
+   case VK_TIME_DOMAIN_CLOCK_MONOTONIC_KHR:
+      clock = CLOCK_MONOTONIC;
+      return true;
+   case VK_TIME_DOMAIN_CLOCK_MONOTONIC_RAW_KHR:
+      clock = CLOCK_MONOTONIC_RAW;
+      return true;
+   default:
+      return false;
+   }
+}
+
+static int64_t get_clock_time_ns(clockid_t clock)
+{
+   struct timespec now = {};
+   clock_gettime(clock, &now);
+   return static_cast<int64_t>(now.tv_sec) * 1000000000 + static_cast<int64_t>(now.tv_nsec);
+}
+
+vulkan_time_domain::vulkan_time_domain(VkPresentStageFlagsEXT presentStages, VkTimeDomainKHR time_domain,
+                                       layer::device_private_data *device, clockid_t local_clock)
+   : swapchain_time_domain(presentStages)
+   , m_time_domain(time_domain)
+   , m_device(device)
+   , m_local_clock(local_clock)
+   , m_timestamp_period(1.0)
+   , m_calibrated(false)
+   , m_last_sample_time(0)
+   , m_offset(0)
+   , m_drift(0.0)
+{
+   if (m_device != nullptr && m_time_domain == VK_TIME_DOMAIN_DEVICE_KHR)
+   {
+      VkPhysicalDeviceProperties properties = {};
+      m_device->instance_data.disp.GetPhysicalDeviceProperties(m_device->physical_device, &properties);
+      m_timestamp_period = properties.limits.timestampPeriod;
+   }
+}
+
+bool vulkan_time_domain::sample_offset(int64_t &local_time, int64_t &offset)
+{
+   clockid_t domain_clock;
+   if (get_time_domain_clock(m_time_domain, domain_clock))
+   {
+      /* Bracket the domain clock with two reads of the local clock and keep the tightest bracket. */
+      int64_t best_deviation = INT64_MAX;
+      for (int i = 0; i < CALIBRATION_SAMPLES; i++)
+      {
+         const int64_t before = get_clock_time_ns(m_local_clock);
+         const int64_t domain_time = get_clock_time_ns(domain_clock);
+         const int64_t after = get_clock_time_ns(m_local_clock);
+         if (after - before < best_deviation)
+         {
+            best_deviation = after - before;
+            local_time = before + (after - before) / 2;
+            offset = domain_time - local_time;
+         }
+      }
+      return true;
+   }
+
+   using entrypoint_index = layer::device_dispatch_table::entrypoint_index;
+   VkTimeDomainKHR local_domain;
+   if (m_time_domain != VK_TIME_DOMAIN_DEVICE_KHR || m_device == nullptr ||
+       !m_device->disp.get_fn<PFN_vkGetCalibratedTimestampsKHR>(entrypoint_index::GetCalibratedTimestampsKHR)
+           .has_value())
+   {
+      return false;
+   }
+
+   if (m_local_clock == CLOCK_MONOTONIC)
+   {
+      local_domain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_KHR;
+   }
+   else if (m_local_clock == CLOCK_MONOTONIC_RAW)
+   {
+      local_domain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_RAW_KHR;
+   }
+   else
+   {
+      return false;
+   }
+
+   std::array<VkCalibratedTimestampInfoKHR, 2> infos = {};
+   infos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_KHR;
+   infos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_KHR;
+   infos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_KHR;
+   infos[1].timeDomain = local_domain;
+
+   uint64_t best_deviation = UINT64_MAX;
+   for (int i = 0; i < CALIBRATION_SAMPLES; i++)
+   {
+      std::array<uint64_t, 2> timestamps = {};
+      uint64_t deviation = 0;
+      if (m_device->disp.GetCalibratedTimestampsKHR(m_device->device, infos.size(), infos.data(), timestamps.data(),
+                                                    &deviation) != VK_SUCCESS)
+      {
+         break;
+      }
+      if (deviation < best_deviation)
+      {
+         best_deviation = deviation;
+         local_time = static_cast<int64_t>(timestamps[1]);
+         offset = static_cast<int64_t>(static_cast<double>(timestamps[0]) * m_timestamp_period) - local_time;
+      }
+   }
+   return best_deviation != UINT64_MAX;
+}
+
+swapchain_calibrated_time vulkan_time_domain::calibrate()
+{
+   clockid_t domain_clock;
+   if (get_time_domain_clock(m_time_domain, domain_clock) && domain_clock == m_local_clock)
+   {
+      return { m_time_domain, 0 };
+   }
+
+   const std::lock_guard<std::mutex> lock(m_mutex);
+   const int64_t now = get_clock_time_ns(m_local_clock);
+   if (!m_calibrated || now - m_last_sample_time >= CALIBRATION_INTERVAL_NS)
+   {
+      int64_t sample_time = 0;
+      int64_t sample = 0;
+      if (sample_offset(sample_time, sample))
+      {
+         if (!m_calibrated)
+         {
+            m_offset = sample;
+            m_calibrated = true;
+         }
+         else
+         {
+            /* Alpha-beta filter: correct the extrapolated offset and the drift by a fraction of the error. */
+            const int64_t elapsed = sample_time - m_last_sample_time;
+            const int64_t predicted = m_offset + static_cast<int64_t>(m_drift * static_cast<double>(elapsed));
+            const int64_t error = sample - predicted;
+            m_offset = predicted + error / FILTER_WEIGHT;
+            if (elapsed > 0)
+            {
+               m_drift += static_cast<double>(error) / static_cast<double>(elapsed) / FILTER_WEIGHT;
+            }
+         }
+         m_last_sample_time = sample_time;
+      }
+   }
+
+   const int64_t offset = m_offset + static_cast<int64_t>(m_drift * static_cast<double>(now - m_last_sample_time));
+   return { m_time_domain, static_cast<uint64_t>(offset) };
+}
+
 VkResult swapchain_time_domains::calibrate(VkPresentStageFlagBitsEXT present_stage,
                                            swapchain_calibrated_time *calibrated_time)
 {
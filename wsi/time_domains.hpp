@@ -32,12 +32,20 @@
 #pragma once
 
 #include <cstddef>
+#include <ctime>
+#include <mutex>
 #include <vulkan/vulkan.h>
 #include <array>
 #include <vector>
 #include <util/log.hpp>
 #include "util/custom_allocator.hpp"
 #include "layer/wsi_layer_experimental.hpp"
+
+namespace layer
+{
+class device_private_data;
+} /* namespace layer */
+
 namespace wsi
 {
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
@@ -46,6 +54,7 @@ namespace wsi
 struct swapchain_calibrated_time
 {
    VkTimeDomainKHR time_domain;
+   /* Offset to add, modulo 2^64, to a present stage time to get a time in time_domain. */
    uint64_t offset;
 };
 
@@ -58,6 +67,8 @@ public:
    {
    }
 
+   virtual ~swapchain_time_domain() = default;
+
    virtual swapchain_calibrated_time calibrate() = 0;
 
    VkPresentStageFlagsEXT get_present_stages()
@@ -69,23 +80,78 @@ private:
    VkPresentStageFlagsEXT m_present_stages;
 };
 
+/**
+ * @brief Time domain relating the clock present stage times are recorded with to a Vulkan time domain.
+ *
+ * The offset between the two clocks is sampled periodically and smoothed with an alpha-beta filter, which also tracks
+ * the drift between the clocks so that the offset can be extrapolated between samples. Device timestamps are sampled
+ * with vkGetCalibratedTimestampsKHR and are expressed in nanoseconds.
+ */
 class vulkan_time_domain : public swapchain_time_domain
 {
 public:
-   vulkan_time_domain(VkPresentStageFlagsEXT presentStages, VkTimeDomainKHR time_domain)
-      : swapchain_time_domain(presentStages)
-      , m_time_domain(time_domain)
-   {
-   }
+   /**
+    * @brief Construct a time domain.
+    *
+    * @param presentStages The present stages using this time domain.
+    * @param time_domain   The Vulkan time domain to calibrate the stage times against.
+    * @param device        The device used to sample device timestamps, may be nullptr for CPU time domains.
+    * @param local_clock   The clock the present stage times are recorded with.
+    */
+   vulkan_time_domain(VkPresentStageFlagsEXT presentStages, VkTimeDomainKHR time_domain,
+                      layer::device_private_data *device = nullptr, clockid_t local_clock = CLOCK_MONOTONIC);
 
    /* The calibrate function should return a Vulkan time domain + an offset.*/
-   swapchain_calibrated_time calibrate() override
+   swapchain_calibrated_time calibrate() override;
+
+   /**
+    * @brief Get the length of a device timestamp tick in nanoseconds, 1 for other time domains.
+    */
+   double get_timestamp_period() const
    {
-      return { m_time_domain, 0 };
+      return m_timestamp_period;
    }
 
 private:
+   /**
+    * @brief Minimum time between two samples of the clocks, in nanoseconds.
+    */
+   static constexpr int64_t CALIBRATION_INTERVAL_NS = 100 * 1000 * 1000;
+
+   /**
+    * @brief Number of samples taken at each calibration. The one with the smallest deviation is kept.
+    */
+   static constexpr int CALIBRATION_SAMPLES = 3;
+
+   /**
+    * @brief Weight of the filtered estimate against a new sample.
+    */
+   static constexpr int64_t FILTER_WEIGHT = 4;
+
+   /**
+    * @brief Sample the offset between the local clock and the time domain.
+    *
+    * @param[out] local_time Time of the local clock at which the offset was sampled.
+    * @param[out] offset     The sampled offset, in nanoseconds.
+    *
+    * @return true on success, false if the clocks could not be sampled.
+    */
+   bool sample_offset(int64_t &local_time, int64_t &offset);
+
    VkTimeDomainKHR m_time_domain;
+   layer::device_private_data *m_device;
+   clockid_t m_local_clock;
+
+   /* Length of a device timestamp tick in nanoseconds. */
+   double m_timestamp_period;
+
+   /* Protects the filter state, as the application and the presentation engine may calibrate concurrently. */
+   std::mutex m_mutex;
+   bool m_calibrated;
+   int64_t m_last_sample_time;
+   int64_t m_offset;
+   /* Change of the offset per nanosecond of the local clock. */
+   double m_drift;
 };
 
 /*  Class holding multiple time domains for a swapchain*/
@@ -32,18 +32,17 @@
 #include "wl_object_owner.hpp"
 #include "wl_helpers.hpp"
 #include "util/log.hpp"
+#include "util/macros.hpp"
+
+#include <algorithm>
+#include <sys/mman.h>
+#include <unistd.h>
 
 namespace wsi
 {
 namespace wayland
 {
 
-struct formats_vector
-{
-   util::vector<drm_format_pair> *formats{ nullptr };
-   bool is_out_of_memory{ false };
-};
-
 namespace
 {
 /* Handler for format event of the zwp_linux_dmabuf_v1 interface. */
@@ -57,59 +56,217 @@ VWL_CAPI_CALL(void)
 zwp_linux_dmabuf_v1_modifier_impl(void *data, struct zwp_linux_dmabuf_v1 *dma_buf, uint32_t drm_format,
                                   uint32_t modifier_hi, uint32_t modifier_low) VWL_API_POST
 {
-   auto *drm_supported_formats = reinterpret_cast<formats_vector *>(data);
+   auto state = reinterpret_cast<dmabuf_feedback_state *>(data);
 
    drm_format_pair format = {};
    format.fourcc = drm_format;
    format.modifier = (static_cast<uint64_t>(modifier_hi) << 32) | modifier_low;
 
-   if (!drm_supported_formats->is_out_of_memory)
+   if (!state->is_out_of_memory)
+   {
+      state->is_out_of_memory = !state->supported_formats->try_push_back(format);
+   }
+}
+
+/* The listener must outlive the zwp_linux_dmabuf_v1 object, which is kept for the lifetime of the surface. */
+const zwp_linux_dmabuf_v1_listener dmabuf_listener = {
+   .format = zwp_linux_dmabuf_v1_format_impl,
+   .modifier = zwp_linux_dmabuf_v1_modifier_impl,
+};
+
+/* Append a format to a list of formats, unless it is already in it. */
+bool add_unique_format(util::vector<drm_format_pair> &formats, const drm_format_pair &format)
+{
+   auto it = std::find_if(formats.begin(), formats.end(), [&format](const drm_format_pair &other) {
+      return other.fourcc == format.fourcc && other.modifier == format.modifier;
+   });
+   return it != formats.end() || formats.try_push_back(format);
+}
+
+/* Copy a list of formats, replacing the contents of the destination. */
+bool copy_formats(const util::vector<drm_format_pair> &src, util::vector<drm_format_pair> &dst)
+{
+   if (!dst.try_resize(src.size()))
+   {
+      return false;
+   }
+   std::copy(src.begin(), src.end(), dst.begin());
+   return true;
+}
+
+/* Handler for done event of the zwp_linux_dmabuf_feedback_v1 interface. */
+VWL_CAPI_CALL(void)
+dmabuf_feedback_done(void *data, struct zwp_linux_dmabuf_feedback_v1 *feedback) VWL_API_POST
+{
+   auto state = reinterpret_cast<dmabuf_feedback_state *>(data);
+
+   /* The surface formats are reported to the application, so later feedback only updates the scanout preference. */
+   bool applied = !state->is_out_of_memory;
+   if (applied && !state->is_done)
+   {
+      applied = copy_formats(state->pending_formats, *state->supported_formats);
+   }
+   if (applied)
+   {
+      const std::lock_guard<std::mutex> lock(state->scanout_formats_mutex);
+      applied = copy_formats(state->pending_scanout_formats, state->scanout_formats);
+   }
+
+   state->last_feedback_failed = !applied;
+   state->is_done = true;
+   state->is_out_of_memory = false;
+   state->pending_formats.clear();
+   state->pending_scanout_formats.clear();
+}
+
+/* Handler for format_table event of the zwp_linux_dmabuf_feedback_v1 interface. */
+VWL_CAPI_CALL(void)
+dmabuf_feedback_format_table(void *data, struct zwp_linux_dmabuf_feedback_v1 *feedback, int32_t fd,
+                             uint32_t size) VWL_API_POST
+{
+   auto state = reinterpret_cast<dmabuf_feedback_state *>(data);
+
+   if (state->format_table != nullptr)
+   {
+      munmap(const_cast<dmabuf_feedback_state::format_table_entry *>(state->format_table), state->format_table_size);
+      state->format_table = nullptr;
+      state->format_table_size = 0;
+   }
+
+   void *table = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (table == MAP_FAILED)
+   {
+      WSI_LOG_ERROR("Failed to map the dmabuf feedback format table.");
+      state->is_out_of_memory = true;
+      return;
+   }
+
+   state->format_table = reinterpret_cast<const dmabuf_feedback_state::format_table_entry *>(table);
+   state->format_table_size = size;
+}
+
+/* Handler for main_device event of the zwp_linux_dmabuf_feedback_v1 interface. */
+VWL_CAPI_CALL(void)
+dmabuf_feedback_main_device(void *data, struct zwp_linux_dmabuf_feedback_v1 *feedback,
+                            struct wl_array *device) VWL_API_POST
+{
+}
+
+/* Handler for tranche_done event of the zwp_linux_dmabuf_feedback_v1 interface. */
+VWL_CAPI_CALL(void)
+dmabuf_feedback_tranche_done(void *data, struct zwp_linux_dmabuf_feedback_v1 *feedback) VWL_API_POST
+{
+   auto state = reinterpret_cast<dmabuf_feedback_state *>(data);
+
+   /* Tranches are sent in decreasing order of preference, so the first tranche a format is seen in wins. */
+   for (const auto &format : state->tranche_formats)
    {
-      drm_supported_formats->is_out_of_memory = !drm_supported_formats->formats->try_push_back(format);
+      if (!add_unique_format(state->pending_formats, format) ||
+          (state->tranche_is_scanout && !add_unique_format(state->pending_scanout_formats, format)))
+      {
+         state->is_out_of_memory = true;
+         break;
+      }
    }
+
+   state->tranche_formats.clear();
+   state->tranche_is_scanout = false;
 }
+
+/* Handler for tranche_target_device event of the zwp_linux_dmabuf_feedback_v1 interface. */
+VWL_CAPI_CALL(void)
+dmabuf_feedback_tranche_target_device(void *data, struct zwp_linux_dmabuf_feedback_v1 *feedback,
+                                      struct wl_array *device) VWL_API_POST
+{
+   /* Buffers are allocated for the device of the swapchain, whichever device the compositor uses them with. */
+}
+
+/* Handler for tranche_formats event of the zwp_linux_dmabuf_feedback_v1 interface. */
+VWL_CAPI_CALL(void)
+dmabuf_feedback_tranche_formats(void *data, struct zwp_linux_dmabuf_feedback_v1 *feedback,
+                                struct wl_array *indices) VWL_API_POST
+{
+   auto state = reinterpret_cast<dmabuf_feedback_state *>(data);
+
+   const size_t table_entries = state->format_table_size / sizeof(dmabuf_feedback_state::format_table_entry);
+   const auto *index = static_cast<const uint16_t *>(indices->data);
+   const size_t index_count = indices->size / sizeof(uint16_t);
+   for (size_t i = 0; i < index_count && !state->is_out_of_memory; i++)
+   {
+      if (index[i] >= table_entries)
+      {
+         WSI_LOG_WARNING("Ignoring out of range dmabuf feedback format index %u.", index[i]);
+         continue;
+      }
+
+      const auto &entry = state->format_table[index[i]];
+      state->is_out_of_memory = !state->tranche_formats.try_push_back(drm_format_pair{ entry.fourcc, entry.modifier });
+   }
+}
+
+/* Handler for tranche_flags event of the zwp_linux_dmabuf_feedback_v1 interface. */
+VWL_CAPI_CALL(void)
+dmabuf_feedback_tranche_flags(void *data, struct zwp_linux_dmabuf_feedback_v1 *feedback, uint32_t flags) VWL_API_POST
+{
+   auto state = reinterpret_cast<dmabuf_feedback_state *>(data);
+   state->tranche_is_scanout = (flags & ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT) != 0;
+}
+
+/* The listener must outlive the feedback object, which is kept for the lifetime of the surface. */
+const zwp_linux_dmabuf_feedback_v1_listener dmabuf_feedback_listener = {
+   .done = dmabuf_feedback_done,
+   .format_table = dmabuf_feedback_format_table,
+   .main_device = dmabuf_feedback_main_device,
+   .tranche_done = dmabuf_feedback_tranche_done,
+   .tranche_target_device = dmabuf_feedback_tranche_target_device,
+   .tranche_formats = dmabuf_feedback_tranche_formats,
+   .tranche_flags = dmabuf_feedback_tranche_flags,
+};
 } // namespace
 
+dmabuf_feedback_state::~dmabuf_feedback_state()
+{
+   if (format_table != nullptr)
+   {
+      munmap(const_cast<format_table_entry *>(format_table), format_table_size);
+   }
+}
+
 /*
- * @brief Get supported formats and modifiers using the zwp_linux_dmabuf_v1 interface.
+ * @brief Wait for the formats and modifiers requested by @ref surface::request_formats_and_modifiers.
+ *
+ * The formats were requested from the registry handler, so a single roundtrip also covers the events sent in reply
+ * to the other binds, such as the presentation clock.
  *
- * @param[in]  display               The wl_display that is being used.
- * @param[in]  queue                 The wl_event_queue set for the @p dmabuf_interface
- * @param[in]  dmabuf_interface      Object of the zwp_linux_dmabuf_v1 interface.
- * @param[out] supported_formats     Vector which will contain the supported drm
- *                                   formats and their modifiers.
+ * @param[in]  display      The wl_display that is being used.
+ * @param[in]  queue        The wl_event_queue of the surface objects.
+ * @param[in]  state        State receiving the formats.
+ * @param[in]  has_feedback Whether the formats come from a zwp_linux_dmabuf_feedback_v1, which ends with a done event.
  *
  * @retval VK_SUCCESS                    Indicates success.
  * @retval VK_ERROR_UNKNOWN              Indicates one of the Wayland functions failed.
- * @retval VK_ERROR_OUT_OF_DEVICE_MEMORY Indicates the host went out of memory.
+ * @retval VK_ERROR_OUT_OF_HOST_MEMORY   Indicates the host went out of memory.
  */
-static VkResult get_supported_formats_and_modifiers(wl_display *display, wl_event_queue *queue,
-                                                    zwp_linux_dmabuf_v1 *dmabuf_interface,
-                                                    util::vector<drm_format_pair> &supported_formats)
+static VkResult wait_for_formats_and_modifiers(wl_display *display, wl_event_queue *queue,
+                                               const dmabuf_feedback_state &state, bool has_feedback)
 {
-   formats_vector drm_supported_formats;
-   drm_supported_formats.formats = &supported_formats;
+   int res = wl_display_roundtrip_queue(display, queue);
 
-   const zwp_linux_dmabuf_v1_listener dma_buf_listener = {
-      .format = zwp_linux_dmabuf_v1_format_impl,
-      .modifier = zwp_linux_dmabuf_v1_modifier_impl,
-   };
-   int res = zwp_linux_dmabuf_v1_add_listener(dmabuf_interface, &dma_buf_listener, &drm_supported_formats);
-   if (res < 0)
+   /* The compositor sends the initial feedback straight away, but it is not required to fit in one roundtrip. Wait
+    * for the rest of it without sending more requests. */
+   while (res >= 0 && has_feedback && !state.is_done)
    {
-      WSI_LOG_ERROR("Failed to add zwp_linux_dmabuf_v1 listener.");
-      return VK_ERROR_UNKNOWN;
+      res = wl_display_dispatch_queue(display, queue);
    }
 
-   /* Get all modifier events. */
-   res = wl_display_roundtrip_queue(display, queue);
    if (res < 0)
    {
       WSI_LOG_ERROR("Roundtrip failed.");
       return VK_ERROR_UNKNOWN;
    }
 
-   if (drm_supported_formats.is_out_of_memory)
+   if (has_feedback ? state.last_feedback_failed : state.is_out_of_memory)
    {
       WSI_LOG_ERROR("Host got out of memory.");
       return VK_ERROR_OUT_OF_HOST_MEMORY;
@@ -129,14 +286,58 @@ surface::surface(const init_parameters &params)
    : wsi::surface()
    , wayland_display(params.display)
    , surface_queue(nullptr)
+   , surface_queue_proxy(nullptr)
    , wayland_surface(params.surf)
    , supported_formats(params.allocator)
    , properties(this, params.allocator)
+   , feedback_state(params.allocator)
+   , presentation_clock_id(CLOCK_MONOTONIC)
+   , viewport_source{}
+   , viewport_destination{}
+   , surface_extent{}
    , last_frame_callback(nullptr)
    , present_pending(false)
 {
 }
 
+/* Handler for the clock_id event of the wp_presentation interface. */
+VWL_CAPI_CALL(void)
+presentation_clock_id(void *data, wp_presentation *presentation, uint32_t clk_id) VWL_API_POST
+{
+   auto wsi_surface = reinterpret_cast<wsi::wayland::surface *>(data);
+   wsi_surface->presentation_clock_id = static_cast<clockid_t>(clk_id);
+}
+
+bool surface::request_formats_and_modifiers()
+{
+   feedback_state.supported_formats = &supported_formats;
+
+   /* Before version 4 the formats are only sent as modifier events, in reply to the bind. */
+   if (zwp_linux_dmabuf_v1_get_version(dmabuf_interface.get()) < ZWP_LINUX_DMABUF_V1_GET_SURFACE_FEEDBACK_SINCE_VERSION)
+   {
+      if (zwp_linux_dmabuf_v1_add_listener(dmabuf_interface.get(), &dmabuf_listener, &feedback_state) < 0)
+      {
+         WSI_LOG_ERROR("Failed to add zwp_linux_dmabuf_v1 listener.");
+         return false;
+      }
+      return true;
+   }
+
+   dmabuf_feedback.reset(zwp_linux_dmabuf_v1_get_surface_feedback(dmabuf_interface.get(), wayland_surface));
+   if (dmabuf_feedback.get() == nullptr)
+   {
+      WSI_LOG_ERROR("Failed to retrieve surface dmabuf feedback.");
+      return false;
+   }
+
+   if (zwp_linux_dmabuf_feedback_v1_add_listener(dmabuf_feedback.get(), &dmabuf_feedback_listener, &feedback_state) < 0)
+   {
+      WSI_LOG_ERROR("Failed to add zwp_linux_dmabuf_feedback_v1 listener.");
+      return false;
+   }
+   return true;
+}
+
 VWL_CAPI_CALL(void)
 surface_registry_handler(void *data, struct wl_registry *wl_registry, uint32_t name, const char *interface,
                          uint32_t version) VWL_API_POST
@@ -145,8 +346,10 @@ surface_registry_handler(void *data, struct wl_registry *wl_registry, uint32_t n
 
    if (!strcmp(interface, zwp_linux_dmabuf_v1_interface.name) && version >= ZWP_LINUX_DMABUF_V1_MODIFIER_SINCE_VERSION)
    {
-      zwp_linux_dmabuf_v1 *dmabuf_interface_obj = reinterpret_cast<zwp_linux_dmabuf_v1 *>(wl_registry_bind(
-         wl_registry, name, &zwp_linux_dmabuf_v1_interface, ZWP_LINUX_DMABUF_V1_MODIFIER_SINCE_VERSION));
+      /* Version 4 replaces the format and modifier events with per surface feedback. */
+      const uint32_t bind_version = std::min<uint32_t>(version, ZWP_LINUX_DMABUF_V1_GET_SURFACE_FEEDBACK_SINCE_VERSION);
+      zwp_linux_dmabuf_v1 *dmabuf_interface_obj = reinterpret_cast<zwp_linux_dmabuf_v1 *>(
+         wl_registry_bind(wl_registry, name, &zwp_linux_dmabuf_v1_interface, bind_version));
 
       if (dmabuf_interface_obj == nullptr)
       {
@@ -155,6 +358,13 @@ surface_registry_handler(void *data, struct wl_registry *wl_registry, uint32_t n
       }
 
       wsi_surface->dmabuf_interface.reset(dmabuf_interface_obj);
+
+      /* The request is sent together with the binds, so the formats arrive in the same roundtrip as their results. */
+      if (!wsi_surface->request_formats_and_modifiers())
+      {
+         wsi_surface->dmabuf_feedback.reset();
+         wsi_surface->dmabuf_interface.reset();
+      }
    }
    else if (!strcmp(interface, zwp_linux_explicit_synchronization_v1_interface.name))
    {
@@ -182,11 +392,81 @@ surface_registry_handler(void *data, struct wl_registry *wl_registry, uint32_t n
       }
 
       wsi_surface->presentation_time_interface.reset(wp_presentation_obj);
+
+      /* The compositor announces its presentation clock right after the bind, before surface initialization ends. */
+      static const wp_presentation_listener presentation_listener = { presentation_clock_id };
+      if (wp_presentation_add_listener(wp_presentation_obj, &presentation_listener, wsi_surface) < 0)
+      {
+         WSI_LOG_WARNING("Failed to add wp_presentation listener, assuming CLOCK_MONOTONIC timestamps.");
+      }
+   }
+   else if (!strcmp(interface, wp_viewporter_interface.name))
+   {
+      wp_viewporter *viewporter_obj =
+         reinterpret_cast<wp_viewporter *>(wl_registry_bind(wl_registry, name, &wp_viewporter_interface, 1));
+
+      if (viewporter_obj == nullptr)
+      {
+         WSI_LOG_ERROR("Failed to get wp_viewporter interface.");
+         return;
+      }
+
+      wsi_surface->viewporter_interface.reset(viewporter_obj);
    }
+#if WAYLAND_FIFO_PROTOCOLS_SUPPORTED
+   else if (!strcmp(interface, wp_fifo_manager_v1_interface.name))
+   {
+      wp_fifo_manager_v1 *fifo_manager_obj =
+         reinterpret_cast<wp_fifo_manager_v1 *>(wl_registry_bind(wl_registry, name, &wp_fifo_manager_v1_interface, 1));
+
+      if (fifo_manager_obj == nullptr)
+      {
+         WSI_LOG_ERROR("Failed to get wp_fifo_manager_v1 interface.");
+         return;
+      }
+
+      wsi_surface->fifo_manager_interface.reset(fifo_manager_obj);
+   }
+   else if (!strcmp(interface, wp_commit_timing_manager_v1_interface.name))
+   {
+      wp_commit_timing_manager_v1 *commit_timing_manager_obj = reinterpret_cast<wp_commit_timing_manager_v1 *>(
+         wl_registry_bind(wl_registry, name, &wp_commit_timing_manager_v1_interface, 1));
+
+      if (commit_timing_manager_obj == nullptr)
+      {
+         WSI_LOG_ERROR("Failed to get wp_commit_timing_manager_v1 interface.");
+         return;
+      }
+
+      wsi_surface->commit_timing_manager_interface.reset(commit_timing_manager_obj);
+   }
+#endif
+#if WAYLAND_TEARING_CONTROL_PROTOCOL_SUPPORTED
+   else if (!strcmp(interface, wp_tearing_control_manager_v1_interface.name))
+   {
+      wp_tearing_control_manager_v1 *tearing_control_manager_obj = reinterpret_cast<wp_tearing_control_manager_v1 *>(
+         wl_registry_bind(wl_registry, name, &wp_tearing_control_manager_v1_interface, 1));
+
+      if (tearing_control_manager_obj == nullptr)
+      {
+         WSI_LOG_ERROR("Failed to get wp_tearing_control_manager_v1 interface.");
+         return;
+      }
+
+      wsi_surface->tearing_control_manager_interface.reset(tearing_control_manager_obj);
+   }
+#endif
 }
 
 bool surface::init()
 {
+   dispatcher = display_dispatcher::acquire(wayland_display);
+   if (dispatcher == nullptr)
+   {
+      WSI_LOG_ERROR("Failed to get the wl display dispatcher.");
+      return false;
+   }
+
    surface_queue.reset(wl_display_create_queue(wayland_display));
    if (surface_queue.get() == nullptr)
    {
@@ -194,6 +474,13 @@ bool surface::init()
       return false;
    }
 
+   surface_queue_proxy = make_proxy_with_queue(wayland_surface, surface_queue.get());
+   if (surface_queue_proxy == nullptr)
+   {
+      WSI_LOG_ERROR("Failed to create wl surface proxy.");
+      return false;
+   }
+
    auto display_proxy = make_proxy_with_queue(wayland_display, surface_queue.get());
    if (display_proxy == nullptr)
    {
@@ -251,9 +538,53 @@ bool surface::init()
 
    surface_sync_interface.reset(surface_sync_obj);
 
-   VkResult vk_res = get_supported_formats_and_modifiers(wayland_display, surface_queue.get(), dmabuf_interface.get(),
-                                                         supported_formats);
-   if (vk_res != VK_SUCCESS)
+   /* Optional, without it the images are shown unscaled whatever the present scaling of the swapchain. */
+   if (viewporter_interface.get() != nullptr)
+   {
+      viewport_interface.reset(wp_viewporter_get_viewport(viewporter_interface.get(), wayland_surface));
+      if (viewport_interface.get() == nullptr)
+      {
+         WSI_LOG_WARNING("Failed to retrieve surface viewport interface.");
+      }
+   }
+
+#if WAYLAND_FIFO_PROTOCOLS_SUPPORTED
+   /* Both protocols are optional, without them FIFO presents are throttled with frame callbacks instead. */
+   if (fifo_manager_interface.get() != nullptr)
+   {
+      fifo_interface.reset(wp_fifo_manager_v1_get_fifo(fifo_manager_interface.get(), wayland_surface));
+      if (fifo_interface.get() == nullptr)
+      {
+         WSI_LOG_WARNING("Failed to retrieve surface fifo interface.");
+      }
+   }
+
+   if (commit_timing_manager_interface.get() != nullptr)
+   {
+      commit_timer_interface.reset(wp_commit_timing_manager_v1_get_timer(commit_timing_manager_interface.get(),
+                                                                         wayland_surface));
+      if (commit_timer_interface.get() == nullptr)
+      {
+         WSI_LOG_WARNING("Failed to retrieve surface commit timer interface.");
+      }
+   }
+#endif
+
+#if WAYLAND_TEARING_CONTROL_PROTOCOL_SUPPORTED
+   /* Optional, without it VK_PRESENT_MODE_IMMEDIATE_KHR is not exposed as the compositor always waits for vblank. */
+   if (tearing_control_manager_interface.get() != nullptr)
+   {
+      tearing_control_interface.reset(
+         wp_tearing_control_manager_v1_get_tearing_control(tearing_control_manager_interface.get(), wayland_surface));
+      if (tearing_control_interface.get() == nullptr)
+      {
+         WSI_LOG_WARNING("Failed to retrieve surface tearing control interface.");
+      }
+   }
+#endif
+
+   if (wait_for_formats_and_modifiers(wayland_display, surface_queue.get(), feedback_state,
+                                      dmabuf_feedback.get() != nullptr) != VK_SUCCESS)
    {
       return false;
    }
@@ -291,28 +622,25 @@ util::unique_ptr<swapchain_base> surface::allocate_swapchain(layer::device_priva
    return util::unique_ptr<swapchain_base>(alloc.make_unique<swapchain>(dev_data, allocator, *this));
 }
 
-static void frame_done(void *data, wl_callback *cb, uint32_t time)
+VWL_CAPI_CALL(void) frame_done(void *data, wl_callback *cb, uint32_t time) VWL_API_POST
 {
    (void)time;
 
-   bool *present_pending = reinterpret_cast<bool *>(data);
-   assert(present_pending);
+   auto wsi_surface = reinterpret_cast<wsi::wayland::surface *>(data);
+   assert(wsi_surface);
+   assert(wsi_surface->last_frame_callback.get() == cb);
+
+   wsi_surface->present_pending = false;
 
-   *present_pending = false;
+   /* wl_callback objects are single use, free it now rather than when the next frame is requested. */
+   wsi_surface->last_frame_callback.reset();
 }
 
 bool surface::set_frame_callback()
 {
-   /* request a hint when we can present the _next_ frame */
-   auto surface_proxy = make_proxy_with_queue(wayland_surface, surface_queue.get());
-   if (surface_proxy == nullptr)
-   {
-      WSI_LOG_ERROR("failed to create wl_surface proxy");
-      return false;
-   }
-
-   /* Reset will also destroy the previous callback object. */
-   last_frame_callback.reset(wl_surface_frame(surface_proxy.get()));
+   /* request a hint when we can present the _next_ frame. Reset will also destroy a callback object that is still
+    * outstanding. */
+   last_frame_callback.reset(wl_surface_frame(surface_queue_proxy.get()));
    if (last_frame_callback.get() == nullptr)
    {
       WSI_LOG_ERROR("Failed to create frame callback.");
@@ -321,7 +649,7 @@ bool surface::set_frame_callback()
 
    static const wl_callback_listener frame_listener = { frame_done };
    present_pending = true;
-   int res = wl_callback_add_listener(last_frame_callback.get(), &frame_listener, &present_pending);
+   int res = wl_callback_add_listener(last_frame_callback.get(), &frame_listener, this);
    if (res < 0)
    {
       WSI_LOG_ERROR("Failed to add frame done callback listener.");
@@ -331,19 +659,19 @@ bool surface::set_frame_callback()
    return true;
 }
 
-bool surface::wait_next_frame_event()
+bool surface::wait_next_frame_event(int timeout_ms)
 {
    /*
     * In a previous present call we sent a wl_surface::frame request, which will
     * trigger an event when the compositor starts a redraw using the previous frame
-    * we sent. If the compositor isn't sending us frame events at least every second
+    * we sent. If the compositor isn't sending us frame events within the timeout
     * we don't wait indefinitely so we don't block the next image presentation if
     * we are, e.g. minimised.
     */
-   const int timeout = 1000;
+   const uint64_t deadline = util::timeout_to_deadline(static_cast<uint64_t>(timeout_ms) * 1000000);
    while (present_pending)
    {
-      int res = dispatch_queue(wayland_display, surface_queue.get(), timeout);
+      int res = dispatcher->dispatch_queue(surface_queue.get(), deadline);
       if (res < 0)
       {
          WSI_LOG_ERROR("Error while waiting for the compositor to send the next frame event.");
@@ -359,5 +687,90 @@ bool surface::wait_next_frame_event()
    return true;
 }
 
+void surface::cancel_frame_callback()
+{
+   /* Destroying the callback object also drops its done event if it is already queued. */
+   last_frame_callback.reset();
+   present_pending = false;
+}
+
+void surface::set_viewport(const VkRect2D &source, const VkExtent2D &destination)
+{
+   if (!supports_viewport())
+   {
+      return;
+   }
+
+   const bool source_changed = source.offset.x != viewport_source.offset.x ||
+                               source.offset.y != viewport_source.offset.y ||
+                               source.extent.width != viewport_source.extent.width ||
+                               source.extent.height != viewport_source.extent.height;
+   if (source_changed)
+   {
+      /* A source of -1 everywhere unsets it. */
+      const bool unset = source.extent.width == 0 || source.extent.height == 0;
+      const wl_fixed_t unset_value = wl_fixed_from_int(-1);
+      wp_viewport_set_source(viewport_interface.get(), unset ? unset_value : wl_fixed_from_int(source.offset.x),
+                             unset ? unset_value : wl_fixed_from_int(source.offset.y),
+                             unset ? unset_value : wl_fixed_from_int(static_cast<int>(source.extent.width)),
+                             unset ? unset_value : wl_fixed_from_int(static_cast<int>(source.extent.height)));
+      viewport_source = source;
+   }
+
+   if (destination.width != viewport_destination.width || destination.height != viewport_destination.height)
+   {
+      const bool unset = destination.width == 0 || destination.height == 0;
+      wp_viewport_set_destination(viewport_interface.get(), unset ? -1 : static_cast<int32_t>(destination.width),
+                                  unset ? -1 : static_cast<int32_t>(destination.height));
+      viewport_destination = destination;
+   }
+}
+
+bool surface::supports_tearing() const
+{
+#if WAYLAND_TEARING_CONTROL_PROTOCOL_SUPPORTED
+   return tearing_control_interface.get() != nullptr;
+#else
+   return false;
+#endif
+}
+
+void surface::set_tearing_hint(bool allow_tearing)
+{
+#if WAYLAND_TEARING_CONTROL_PROTOCOL_SUPPORTED
+   if (!supports_tearing() || allow_tearing == tearing_hint_async)
+   {
+      return;
+   }
+
+   wp_tearing_control_v1_set_presentation_hint(tearing_control_interface.get(),
+                                               allow_tearing ? WP_TEARING_CONTROL_V1_PRESENTATION_HINT_ASYNC :
+                                                               WP_TEARING_CONTROL_V1_PRESENTATION_HINT_VSYNC);
+   tearing_hint_async = allow_tearing;
+#else
+   UNUSED(allow_tearing);
+#endif
+}
+
+bool surface::is_scanout_format(const drm_format_pair &format)
+{
+   const std::lock_guard<std::mutex> lock(feedback_state.scanout_formats_mutex);
+   return std::any_of(feedback_state.scanout_formats.begin(), feedback_state.scanout_formats.end(),
+                      [&format](const drm_format_pair &scanout_format) {
+                         return scanout_format.fourcc == format.fourcc && scanout_format.modifier == format.modifier;
+                      });
+}
+
+bool surface::dispatch_pending_events()
+{
+   if (wl_display_dispatch_queue_pending(wayland_display, surface_queue.get()) < 0)
+   {
+      WSI_LOG_ERROR("Failed to dispatch the surface queue.");
+      return false;
+   }
+
+   return true;
+}
+
 } // namespace wayland
 } // namespace wsi
@@ -32,10 +32,14 @@
 #define __STDC_VERSION__ 0
 #endif
 #include <wayland-client.h>
+#include <cassert>
+#include <ctime>
+#include <mutex>
 
 #include "wsi/surface.hpp"
 #include "surface_properties.hpp"
 #include "wl_object_owner.hpp"
+#include "wl_helpers.hpp"
 #include "util/macros.hpp"
 
 namespace wsi
@@ -50,6 +54,77 @@ VWL_CAPI_CALL(void)
 surface_registry_handler(void *data, struct wl_registry *wl_registry, uint32_t name, const char *interface,
                          uint32_t version) VWL_API_POST;
 
+/**
+ * Wayland callback for the wp_presentation clock_id event, which tells @ref wsi::wayland::surface the clock of the
+ * presentation timestamps.
+ */
+VWL_CAPI_CALL(void)
+presentation_clock_id(void *data, wp_presentation *presentation, uint32_t clk_id) VWL_API_POST;
+
+/**
+ * Wayland callback for the wl_callback done event of the frame requests made by @ref wsi::wayland::surface
+ */
+VWL_CAPI_CALL(void) frame_done(void *data, wl_callback *cb, uint32_t time) VWL_API_POST;
+
+/**
+ * @brief State of the zwp_linux_dmabuf_feedback_v1 object of a @ref wsi::wayland::surface.
+ *
+ * Tranches are accumulated as their events arrive and applied when the compositor sends the done event. Compositors
+ * without the feedback send zwp_linux_dmabuf_v1 modifier events instead, which are added to the surface formats
+ * directly.
+ */
+struct dmabuf_feedback_state
+{
+   explicit dmabuf_feedback_state(const util::allocator &allocator)
+      : supported_formats(nullptr)
+      , pending_formats(allocator)
+      , pending_scanout_formats(allocator)
+      , tranche_formats(allocator)
+      , scanout_formats(allocator)
+   {
+   }
+
+   ~dmabuf_feedback_state();
+
+   /** Entry of the format table shared by the compositor. */
+   struct format_table_entry
+   {
+      uint32_t fourcc;
+      uint32_t padding;
+      uint64_t modifier;
+   };
+
+   /** The format table mapped in memory, indexed by the tranche_formats events. */
+   const format_table_entry *format_table{ nullptr };
+   /** Size of the format table mapping in bytes. */
+   size_t format_table_size{ 0 };
+
+   /** Surface formats, filled in from the first feedback received. */
+   util::vector<drm_format_pair> *supported_formats;
+
+   /** Formats, and the subset of them in scanout tranches, of the feedback being received, in preference order. */
+   util::vector<drm_format_pair> pending_formats;
+   util::vector<drm_format_pair> pending_scanout_formats;
+
+   /** Formats and flags of the tranche being received. */
+   util::vector<drm_format_pair> tranche_formats;
+   bool tranche_is_scanout{ false };
+
+   /** Whether memory ran out while receiving the current feedback. */
+   bool is_out_of_memory{ false };
+   /** Whether the last feedback could not be applied because memory ran out. */
+   bool last_feedback_failed{ false };
+   /** Whether a complete feedback has been received. */
+   bool is_done{ false };
+
+   /**
+    * Formats the compositor can put directly on a hardware plane, from the latest feedback. Updated when feedback
+    * events are dispatched on the surface queue and read when creating swapchains, hence the lock.
+    */
+   std::mutex scanout_formats_mutex;
+   util::vector<drm_format_pair> scanout_formats;
+};
+
 class surface : public wsi::surface
 {
 public:
@@ -90,6 +165,17 @@ public:
       return wayland_surface;
    }
 
+   /**
+    * @brief Returns the event dispatcher of the Wayland display.
+    *
+    * It is shared with the other surfaces on the display and valid throughout the lifetime of this surface.
+    */
+   display_dispatcher &get_dispatcher() const
+   {
+      assert(dispatcher != nullptr);
+      return *dispatcher;
+   }
+
    /**
     * @brief Returns a pointer to the Wayland zwp_linux_dmabuf_v1 interface.
     *
@@ -111,6 +197,49 @@ public:
       return surface_sync_interface.get();
    }
 
+   /**
+    * @brief Returns a pointer to the Wayland wp_presentation interface.
+    *
+    * The raw pointer is valid throughout the lifetime of this surface. Objects created from it dispatch their
+    * events on the surface queue, see @ref dispatch_pending_events.
+    */
+   wp_presentation *get_presentation_time_interface()
+   {
+      return presentation_time_interface.get();
+   }
+
+   /**
+    * @brief Returns the clock the compositor uses for wp_presentation timestamps.
+    */
+   clockid_t get_presentation_clock_id() const
+   {
+      return presentation_clock_id;
+   }
+
+#if WAYLAND_FIFO_PROTOCOLS_SUPPORTED
+   /**
+    * @brief Returns a pointer to the wp_fifo_v1 object of the Wayland surface.
+    *
+    * The raw pointer is valid throughout the lifetime of this surface. nullptr if the compositor does not support
+    * wp_fifo_manager_v1.
+    */
+   wp_fifo_v1 *get_fifo_interface()
+   {
+      return fifo_interface.get();
+   }
+
+   /**
+    * @brief Returns a pointer to the wp_commit_timer_v1 object of the Wayland surface.
+    *
+    * The raw pointer is valid throughout the lifetime of this surface. nullptr if the compositor does not support
+    * wp_commit_timing_manager_v1.
+    */
+   wp_commit_timer_v1 *get_commit_timer_interface()
+   {
+      return commit_timer_interface.get();
+   }
+#endif
+
    /**
     * @brief Returns a reference to a list of DRM formats supported by the Wayland surface.
     *
@@ -121,6 +250,18 @@ public:
       return supported_formats;
    }
 
+   /**
+    * @brief Check whether the compositor can scan out buffers of a format directly.
+    *
+    * Based on the scanout tranches of the latest zwp_linux_dmabuf_feedback_v1 of the surface, which follow changes
+    * such as the surface becoming fullscreen. Always false if the compositor does not support the feedback.
+    *
+    * @param format The format and modifier to check.
+    *
+    * @return true if the format is in a scanout tranche.
+    */
+   bool is_scanout_format(const drm_format_pair &format);
+
    /**
     * @brief Set the next frame callback.
     *
@@ -134,9 +275,74 @@ public:
    /**
     * @brief Wait for the compositor's last requested frame event.
     *
+    * @param timeout_ms Time to wait for the frame event in milliseconds, after which the wait gives up and the
+    *                   next frame is presented anyway.
+    *
+    * @return true for success, false otherwise.
+    */
+   bool wait_next_frame_event(int timeout_ms);
+
+   /**
+    * @brief Drop the outstanding frame request, if any, so that the next present does not wait for its frame event.
+    */
+   void cancel_frame_callback();
+
+   /**
+    * @brief Whether the compositor can scale and crop the buffers of the surface, through wp_viewport.
+    */
+   bool supports_viewport() const
+   {
+      return viewport_interface.get() != nullptr;
+   }
+
+   /**
+    * @brief Set the part of the buffers shown by the following commits and the size of the surface they are shown at.
+    *
+    * The viewport is double-buffered state of the surface, applied with the next commit. It is kept across the
+    * swapchains of the surface and is only sent when it changes. Does nothing if @ref supports_viewport returns false.
+    *
+    * @param source      The part of the buffer to show, in buffer pixels. An empty rectangle shows the whole buffer.
+    * @param destination The size of the surface, an empty extent for the size of @p source.
+    */
+   void set_viewport(const VkRect2D &source, const VkExtent2D &destination);
+
+   /**
+    * @brief Get the size of the surface with the latest commit of a swapchain, 0x0 before the first one.
+    */
+   VkExtent2D get_surface_extent() const
+   {
+      return surface_extent;
+   }
+
+   /**
+    * @brief Record the size of the surface with a commit, see @ref get_surface_extent.
+    */
+   void set_surface_extent(const VkExtent2D &extent)
+   {
+      surface_extent = extent;
+   }
+
+   /**
+    * @brief Whether the compositor lets the surface tear, through wp_tearing_control_v1.
+    */
+   bool supports_tearing() const;
+
+   /**
+    * @brief Hint the compositor whether the following commits may be shown without waiting for vblank.
+    *
+    * The hint is double-buffered state of the surface, applied with the next commit. It is kept across the swapchains
+    * of the surface and is only sent when it changes. Does nothing if @ref supports_tearing returns false.
+    *
+    * @param allow_tearing Whether to ask for asynchronous presentation, which may tear.
+    */
+   void set_tearing_hint(bool allow_tearing);
+
+   /**
+    * @brief Dispatch the events already read into the surface queue, without blocking.
+    *
     * @return true for success, false otherwise.
     */
-   bool wait_next_frame_event();
+   bool dispatch_pending_events();
 
 private:
    /**
@@ -146,12 +352,27 @@ private:
     */
    bool init();
 
+   /**
+    * @brief Request the formats and modifiers supported on the surface from the bound zwp_linux_dmabuf_v1 interface.
+    *
+    * Called as soon as the interface is bound, so that the formats arrive together with the results of the other
+    * binds rather than in a roundtrip of their own.
+    *
+    * @return true on success, false otherwise.
+    */
+   bool request_formats_and_modifiers();
+
    friend void surface_registry_handler(void *data, struct wl_registry *wl_registry, uint32_t name,
                                         const char *interface, uint32_t version) VWL_API_POST;
+   friend void presentation_clock_id(void *data, wp_presentation *presentation, uint32_t clk_id) VWL_API_POST;
+   friend void frame_done(void *data, wl_callback *cb, uint32_t time) VWL_API_POST;
 
    /** The native Wayland display */
    wl_display *wayland_display;
 
+   /** Dispatcher waiting for the events of the surface and swapchain queues on @ref wayland_display. */
+   display_dispatcher_ref dispatcher;
+
    /**
     * Container for a private queue for surface events generated by the layer.
     * The queue is also used for dispatching frame callback events.
@@ -159,6 +380,12 @@ private:
     */
    wayland_owner<wl_event_queue> surface_queue;
 
+   /**
+    * Wrapper of the native surface that assigns new objects, such as frame callbacks, to the surface queue.
+    * It is created once with the surface and destroyed before the queue.
+    */
+   wayland_proxy_wrapper<wl_surface> surface_queue_proxy;
+
    /** The native Wayland surface */
    wl_surface *wayland_surface;
    /** A list of DRM formats supported by the Wayland compositor on this surface */
@@ -166,9 +393,15 @@ private:
    /** Surface properties specific to the Wayland surface. */
    surface_properties properties;
 
+   /** Formats received through dmabuf_interface or dmabuf_feedback, it must outlive both objects. */
+   dmabuf_feedback_state feedback_state;
+
    /** Container for the zwp_linux_dmabuf_v1 interface binding */
    wayland_owner<zwp_linux_dmabuf_v1> dmabuf_interface;
 
+   /** Container for the surface specific zwp_linux_dmabuf_feedback_v1 object, if the compositor supports it. */
+   wayland_owner<zwp_linux_dmabuf_feedback_v1> dmabuf_feedback;
+
    /** Container for the zwp_linux_explicit_synchronization_v1 interface binding */
    wayland_owner<zwp_linux_explicit_synchronization_v1> explicit_sync_interface;
    /** Container for the surface specific zwp_linux_surface_synchronization_v1 interface. */
@@ -177,6 +410,41 @@ private:
    /** Container for the wp_presentation interface binding */
    wayland_owner<wp_presentation> presentation_time_interface;
 
+   /** Clock of the wp_presentation timestamps, announced by the compositor when the interface is bound. */
+   clockid_t presentation_clock_id;
+
+   /** Container for the wp_viewporter interface binding */
+   wayland_owner<wp_viewporter> viewporter_interface;
+   /** Container for the surface specific wp_viewport interface. */
+   wayland_owner<wp_viewport> viewport_interface;
+   /** The source rectangle and destination size last sent with wp_viewport, empty when unset. */
+   VkRect2D viewport_source;
+   VkExtent2D viewport_destination;
+
+   /** Size of the surface with the latest commit of a swapchain. */
+   VkExtent2D surface_extent;
+
+#if WAYLAND_FIFO_PROTOCOLS_SUPPORTED
+   /** Container for the wp_fifo_manager_v1 interface binding */
+   wayland_owner<wp_fifo_manager_v1> fifo_manager_interface;
+   /** Container for the surface specific wp_fifo_v1 interface. */
+   wayland_owner<wp_fifo_v1> fifo_interface;
+
+   /** Container for the wp_commit_timing_manager_v1 interface binding */
+   wayland_owner<wp_commit_timing_manager_v1> commit_timing_manager_interface;
+   /** Container for the surface specific wp_commit_timer_v1 interface. */
+   wayland_owner<wp_commit_timer_v1> commit_timer_interface;
+#endif
+
+#if WAYLAND_TEARING_CONTROL_PROTOCOL_SUPPORTED
+   /** Container for the wp_tearing_control_manager_v1 interface binding */
+   wayland_owner<wp_tearing_control_manager_v1> tearing_control_manager_interface;
+   /** Container for the surface specific wp_tearing_control_v1 interface. */
+   wayland_owner<wp_tearing_control_v1> tearing_control_interface;
+   /** Whether the last presentation hint sent with wp_tearing_control_v1 asked for asynchronous presentation. */
+   bool tearing_hint_async{ false };
+#endif
+
    /**
     * Container for a callback object for the latest frame done event.
     *
@@ -184,6 +452,9 @@ private:
     * on the queue will be discarded. If a proxy object is destroyed after a queue,
     * it is possible in the meantime for a new event to arrive and processed.
     * This will result in a use after free error.
+    *
+    * The object is destroyed as soon as its done event is dispatched, so it is only
+    * set while a frame event is outstanding.
     */
    wayland_owner<wl_callback> last_frame_callback;
 
@@ -58,12 +58,26 @@ void surface_properties::populate_present_mode_compatibilities()
       present_mode_compatibility{ VK_PRESENT_MODE_MAILBOX_KHR, 1, { VK_PRESENT_MODE_MAILBOX_KHR } }
    };
    m_compatible_present_modes = compatible_present_modes<2>(compatible_present_modes_list);
+
+   /* Neither FIFO nor mailbox presents wait for frame events when switching to the immediate mode, or back. */
+   std::array<present_mode_compatibility, 3> tearing_compatible_present_modes_list = {
+      present_mode_compatibility{
+         VK_PRESENT_MODE_FIFO_KHR, 2, { VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR } },
+      present_mode_compatibility{
+         VK_PRESENT_MODE_MAILBOX_KHR, 2, { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR } },
+      present_mode_compatibility{
+         VK_PRESENT_MODE_IMMEDIATE_KHR,
+         3,
+         { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_MAILBOX_KHR } }
+   };
+   m_tearing_compatible_present_modes = compatible_present_modes<3>(tearing_compatible_present_modes_list);
 }
 
 surface_properties::surface_properties(surface *wsi_surface, const util::allocator &allocator)
    : specific_surface(wsi_surface)
    , supported_formats(allocator)
    , m_supported_modes({ VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_MAILBOX_KHR })
+   , m_tearing_supported_modes({ VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR })
 {
    populate_present_mode_compatibilities();
 }
@@ -97,12 +111,27 @@ VkResult surface_properties::get_surface_capabilities(VkPhysicalDevice physical_
                                                       const VkPhysicalDeviceSurfaceInfo2KHR *pSurfaceInfo,
                                                       VkSurfaceCapabilities2KHR *pSurfaceCapabilities)
 {
-   TRY(check_surface_present_mode_query_is_supported(pSurfaceInfo, m_supported_modes));
+   if (supports_tearing())
+   {
+      TRY(check_surface_present_mode_query_is_supported(pSurfaceInfo, m_tearing_supported_modes));
+   }
+   else
+   {
+      TRY(check_surface_present_mode_query_is_supported(pSurfaceInfo, m_supported_modes));
+   }
 
    /* Image count limits */
    get_surface_capabilities(physical_device, &pSurfaceCapabilities->surfaceCapabilities);
 
-   m_compatible_present_modes.get_surface_present_mode_compatibility_common(pSurfaceInfo, pSurfaceCapabilities);
+   if (supports_tearing())
+   {
+      m_tearing_compatible_present_modes.get_surface_present_mode_compatibility_common(pSurfaceInfo,
+                                                                                       pSurfaceCapabilities);
+   }
+   else
+   {
+      m_compatible_present_modes.get_surface_present_mode_compatibility_common(pSurfaceInfo, pSurfaceCapabilities);
+   }
 
    auto surface_scaling_capabilities = util::find_extension<VkSurfacePresentScalingCapabilitiesEXT>(
       VK_STRUCTURE_TYPE_SURFACE_PRESENT_SCALING_CAPABILITIES_EXT, pSurfaceCapabilities);
@@ -250,6 +279,10 @@ VkResult surface_properties::get_surface_formats(VkPhysicalDevice physical_devic
 VkResult surface_properties::get_surface_present_modes(VkPhysicalDevice physical_device, VkSurfaceKHR surface,
                                                        uint32_t *pPresentModeCount, VkPresentModeKHR *pPresentModes)
 {
+   if (supports_tearing())
+   {
+      return get_surface_present_modes_common(pPresentModeCount, pPresentModes, m_tearing_supported_modes);
+   }
    return get_surface_present_modes_common(pPresentModeCount, pPresentModes, m_supported_modes);
 }
 
@@ -405,12 +438,25 @@ PFN_vkVoidFunction surface_properties::get_proc_addr(const char *name)
 
 bool surface_properties::is_surface_extension_enabled(const layer::instance_private_data &instance_data)
 {
-   return instance_data.is_instance_extension_enabled(VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME);
+   return instance_data.is_instance_extension_enabled(util::known_extension::KHR_wayland_surface);
 }
 
 void surface_properties::get_surface_present_scaling_and_gravity(
    VkSurfacePresentScalingCapabilitiesEXT *scaling_capabilities)
 {
+   /* With wp_viewport the swapchain images can be scaled or cropped to the size of the surface. */
+   if (specific_surface != nullptr && specific_surface->supports_viewport())
+   {
+      constexpr VkPresentGravityFlagsEXT all_gravity =
+         VK_PRESENT_GRAVITY_MIN_BIT_EXT | VK_PRESENT_GRAVITY_MAX_BIT_EXT | VK_PRESENT_GRAVITY_CENTERED_BIT_EXT;
+      scaling_capabilities->supportedPresentScaling = VK_PRESENT_SCALING_ONE_TO_ONE_BIT_EXT |
+                                                      VK_PRESENT_SCALING_ASPECT_RATIO_STRETCH_BIT_EXT |
+                                                      VK_PRESENT_SCALING_STRETCH_BIT_EXT;
+      scaling_capabilities->supportedPresentGravityX = all_gravity;
+      scaling_capabilities->supportedPresentGravityY = all_gravity;
+      return;
+   }
+
    scaling_capabilities->supportedPresentScaling = VK_PRESENT_SCALING_ONE_TO_ONE_BIT_EXT;
    scaling_capabilities->supportedPresentGravityX = VK_PRESENT_GRAVITY_MIN_BIT_EXT;
    scaling_capabilities->supportedPresentGravityY = VK_PRESENT_GRAVITY_MIN_BIT_EXT;
@@ -418,18 +464,34 @@ void surface_properties::get_surface_present_scaling_and_gravity(
 
 bool surface_properties::is_compatible_present_modes(VkPresentModeKHR present_mode_a, VkPresentModeKHR present_mode_b)
 {
+   if (supports_tearing())
+   {
+      return m_tearing_compatible_present_modes.is_compatible_present_modes(present_mode_a, present_mode_b);
+   }
    return m_compatible_present_modes.is_compatible_present_modes(present_mode_a, present_mode_b);
 }
 
+bool surface_properties::supports_tearing() const
+{
+   return specific_surface != nullptr && specific_surface->supports_tearing();
+}
+
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
 void surface_properties::get_present_timing_surface_caps(
    VkPresentTimingSurfaceCapabilitiesEXT *present_timing_surface_caps)
 {
+   /* With wp_commit_timer_v1 the compositor holds commits until their target time, whatever the present mode. */
+   bool commit_timing_supported = false;
+#if WAYLAND_FIFO_PROTOCOLS_SUPPORTED
+   commit_timing_supported = specific_surface != nullptr && specific_surface->get_commit_timer_interface() != nullptr;
+#endif
+
    present_timing_surface_caps->presentTimingSupported = VK_TRUE;
-   present_timing_surface_caps->presentAtAbsoluteTimeSupported = VK_FALSE;
-   present_timing_surface_caps->presentAtRelativeTimeSupported = VK_FALSE;
+   present_timing_surface_caps->presentAtAbsoluteTimeSupported = commit_timing_supported ? VK_TRUE : VK_FALSE;
+   present_timing_surface_caps->presentAtRelativeTimeSupported = commit_timing_supported ? VK_TRUE : VK_FALSE;
    present_timing_surface_caps->presentStageQueries = VK_PRESENT_STAGE_QUEUE_OPERATIONS_END_BIT_EXT;
-   present_timing_surface_caps->presentStageTargets = 0;
+   present_timing_surface_caps->presentStageTargets =
+      commit_timing_supported ? VK_PRESENT_STAGE_IMAGE_FIRST_PIXEL_VISIBLE_BIT_EXT : 0;
 }
 #endif
 
@@ -25,6 +25,7 @@
 #pragma once
 
 #include "wsi/surface_properties.hpp"
+#include "util/unordered_map.hpp"
 #include "util/unordered_set.hpp"
 #include "wsi/compatible_present_modes.hpp"
 
@@ -93,6 +94,17 @@ private:
    /* Stores compatible presentation modes */
    compatible_present_modes<2> m_compatible_present_modes;
 
+   /* List of supported presentation modes when the compositor lets the surface tear */
+   std::array<VkPresentModeKHR, 3> m_tearing_supported_modes;
+
+   /* Stores compatible presentation modes when the compositor lets the surface tear */
+   compatible_present_modes<3> m_tearing_compatible_present_modes;
+
+   /**
+    * @brief Whether VK_PRESENT_MODE_IMMEDIATE_KHR is supported, which needs the compositor to let the surface tear.
+    */
+   bool supports_tearing() const;
+
    void populate_present_mode_compatibilities() override;
 
    void get_surface_present_scaling_and_gravity(VkSurfacePresentScalingCapabilitiesEXT *scaling_capabilities) override;
@@ -29,6 +29,7 @@
 #include "surface_properties.hpp"
 #include "layer/wsi_layer_experimental.hpp"
 
+#include <cinttypes>
 #include <cstdint>
 #include <cstring>
 #include <cassert>
@@ -37,12 +38,18 @@
 #include <cerrno>
 #include <cstdio>
 #include <climits>
+#include <ctime>
 #include <functional>
+#include <algorithm>
+#include <utility>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 #include "util/drm/drm_utils.hpp"
 #include "util/log.hpp"
 #include "util/helpers.hpp"
 #include "util/macros.hpp"
+#include "util/trace.hpp"
 #include "util/format_modifiers.hpp"
 
 namespace wsi
@@ -57,18 +64,48 @@ swapchain::swapchain(layer::device_private_data &dev_data, const VkAllocationCal
    , m_surface(wsi_surface.get_wl_surface())
    , m_wsi_surface(&wsi_surface)
    , m_buffer_queue(nullptr)
+   , m_event_thread_run(false)
+   , m_event_thread_started(false)
    , m_wsi_allocator(nullptr)
+   , m_preallocated_buffers(m_allocator)
    , m_image_creation_parameters({}, m_allocator, {}, {})
+   , m_presentation_feedbacks{}
+   , m_refresh_interval(0)
+   , m_last_present_discarded(false)
+   , m_explicit_release(false)
+   , m_viewport_source{}
+   , m_viewport_destination{}
+   , m_surface_extent{}
 {
    m_image_create_info.format = VK_FORMAT_UNDEFINED;
 }
 
 swapchain::~swapchain()
 {
+   /* Buffer releases must not be dispatched while teardown destroys the buffers. */
+   stop_event_thread();
+
    teardown();
 
+   /* Events still queued for the feedback objects are dropped once they are destroyed. */
+   for (auto &feedback : m_presentation_feedbacks)
+   {
+      if (feedback.feedback != nullptr)
+      {
+         wp_presentation_feedback_destroy(feedback.feedback);
+         feedback.feedback = nullptr;
+      }
+   }
+
    if (m_wsi_allocator != nullptr)
    {
+      /* Buffers preallocated for images that were never created. */
+      for (const auto &buffer : m_preallocated_buffers)
+      {
+         wsialloc_release(m_wsi_allocator, get_wsialloc_heap_flags(), buffer.buffer_fds);
+      }
+      m_preallocated_buffers.clear();
+
       wsialloc_delete(m_wsi_allocator);
    }
    m_wsi_allocator = nullptr;
@@ -84,7 +121,7 @@ VkResult swapchain::init_platform(VkDevice device, const VkSwapchainCreateInfoKH
 #if VULKAN_WSI_LAYER_EXPERIMENTAL
    std::array<util::unique_ptr<wsi::vulkan_time_domain>, 1> time_domains_array = {
       m_allocator.make_unique<wsi::vulkan_time_domain>(VK_PRESENT_STAGE_QUEUE_OPERATIONS_END_BIT_EXT,
-                                                       VK_TIME_DOMAIN_DEVICE_KHR),
+                                                       VK_TIME_DOMAIN_DEVICE_KHR, &m_device_data),
    };
 
    for (auto &time_domain : time_domains_array)
@@ -95,6 +132,23 @@ VkResult swapchain::init_platform(VkDevice device, const VkSwapchainCreateInfoKH
          return VK_ERROR_OUT_OF_HOST_MEMORY;
       }
    }
+
+   /* wp_presentation reports when images become visible, in a clock chosen by the compositor. */
+   const clockid_t presentation_clock = m_wsi_surface->get_presentation_clock_id();
+   if (presentation_clock == CLOCK_MONOTONIC || presentation_clock == CLOCK_MONOTONIC_RAW)
+   {
+      /* Visible times come from the compositor in the presentation clock, which is the time domain itself. */
+      auto visible_time_domain = m_allocator.make_unique<wsi::vulkan_time_domain>(
+         VK_PRESENT_STAGE_IMAGE_FIRST_PIXEL_VISIBLE_BIT_EXT,
+         presentation_clock == CLOCK_MONOTONIC ? VK_TIME_DOMAIN_CLOCK_MONOTONIC_KHR :
+                                                 VK_TIME_DOMAIN_CLOCK_MONOTONIC_RAW_KHR,
+         nullptr, presentation_clock);
+      if (!m_time_domains.m_time_domains.try_push_back(std::move(visible_time_domain)))
+      {
+         WSI_LOG_ERROR("Failed to add a time domain to m_time_domains.");
+         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+   }
 #endif
 
    if ((m_display == nullptr) || (m_surface == nullptr) || (m_wsi_surface->get_dmabuf_interface() == nullptr))
@@ -116,17 +170,172 @@ VkResult swapchain::init_platform(VkDevice device, const VkSwapchainCreateInfoKH
       return VK_ERROR_INITIALIZATION_FAILED;
    }
 
+   m_explicit_release = m_wsi_surface->get_surface_sync_interface() != nullptr;
+
+   init_viewport(swapchain_create_info->imageExtent);
+
    /*
-    * When VK_PRESENT_MODE_MAILBOX_KHR has been chosen by the application we don't
-    * initialize the page flip thread so the present_image function can be called
-    * during vkQueuePresent.
+    * When VK_PRESENT_MODE_MAILBOX_KHR or VK_PRESENT_MODE_IMMEDIATE_KHR has been chosen
+    * by the application we don't initialize the page flip thread so the present_image
+    * function can be called during vkQueuePresent. The same applies to FIFO when the compositor queues the
+    * commits behind FIFO barriers. The thread cannot be started on a present mode
+    * switch, so it is used if any of the modes the swapchain may switch to needs it.
     */
-   use_presentation_thread =
-      WAYLAND_FIFO_PRESENTATION_THREAD_ENABLED && (m_present_mode != VK_PRESENT_MODE_MAILBOX_KHR);
+   bool needs_thread = present_mode_uses_presentation_thread(m_present_mode);
+   for (const VkPresentModeKHR present_mode : m_present_modes)
+   {
+      needs_thread = needs_thread || present_mode_uses_presentation_thread(present_mode);
+   }
+   use_presentation_thread = WAYLAND_FIFO_PRESENTATION_THREAD_ENABLED && needs_thread;
+
+   return VK_SUCCESS;
+}
+
+void swapchain::init_viewport(const VkExtent2D &image_extent)
+{
+   m_viewport_source = {};
+   m_viewport_destination = {};
+   m_surface_extent = image_extent;
+
+   /* Wayland surfaces take the size of their buffers, so there is nothing to scale to on their own. The images are
+    * scaled to the size the surface had with the presents of the previous swapchain, which keeps a window the same
+    * size when an application renders at a different resolution. */
+   const VkExtent2D target = m_wsi_surface->get_surface_extent();
+   if (m_present_scaling.scaling_behavior == 0 || !m_wsi_surface->supports_viewport() || target.width == 0 ||
+       target.height == 0 || (target.width == image_extent.width && target.height == image_extent.height))
+   {
+      return;
+   }
+
+   VkRect2D source = { { 0, 0 }, image_extent };
+   VkExtent2D destination = image_extent;
+   switch (m_present_scaling.scaling_behavior)
+   {
+   case VK_PRESENT_SCALING_STRETCH_BIT_EXT:
+      destination = target;
+      break;
+   case VK_PRESENT_SCALING_ASPECT_RATIO_STRETCH_BIT_EXT:
+      destination = get_aspect_ratio_stretch_extent(image_extent, target);
+      break;
+   case VK_PRESENT_SCALING_ONE_TO_ONE_BIT_EXT:
+      /* A viewport cannot place the image within a larger surface, so the surface shrinks to the image instead and
+       * the gravity only picks the part of the image that is kept when it is cropped. */
+      source.extent.width = std::min(image_extent.width, target.width);
+      source.extent.height = std::min(image_extent.height, target.height);
+      source.offset.x =
+         get_present_gravity_offset(image_extent.width, source.extent.width, m_present_scaling.gravity_x);
+      source.offset.y =
+         get_present_gravity_offset(image_extent.height, source.extent.height, m_present_scaling.gravity_y);
+      destination = source.extent;
+      break;
+   default:
+      return;
+   }
+
+   if (source.extent.width != image_extent.width || source.extent.height != image_extent.height)
+   {
+      m_viewport_source = source;
+   }
+   if (destination.width != source.extent.width || destination.height != source.extent.height)
+   {
+      m_viewport_destination = destination;
+   }
+   m_surface_extent = destination;
+}
+
+VkResult swapchain::start_event_thread()
+{
+   m_event_thread_wakeup = util::fd_owner(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+   if (!m_event_thread_wakeup.is_valid())
+   {
+      WSI_LOG_ERROR("Failed to create the event thread wake up eventfd: %s", strerror(errno));
+      return VK_ERROR_INITIALIZATION_FAILED;
+   }
 
+   m_event_thread_run.store(true, std::memory_order_release);
+   try
+   {
+      m_event_thread = std::thread(&swapchain::event_thread, this);
+   }
+   catch (const std::system_error &)
+   {
+      m_event_thread_run.store(false, std::memory_order_release);
+      return VK_ERROR_INITIALIZATION_FAILED;
+   }
+   catch (const std::bad_alloc &)
+   {
+      m_event_thread_run.store(false, std::memory_order_release);
+      return VK_ERROR_INITIALIZATION_FAILED;
+   }
    return VK_SUCCESS;
 }
 
+void swapchain::stop_event_thread()
+{
+   if (!m_event_thread.joinable())
+   {
+      return;
+   }
+
+   m_event_thread_run.store(false, std::memory_order_release);
+   const uint64_t wake_up = 1;
+   if (write(m_event_thread_wakeup.get(), &wake_up, sizeof(wake_up)) != sizeof(wake_up))
+   {
+      WSI_LOG_ERROR("Failed to wake up the event thread: %s", strerror(errno));
+   }
+   m_event_thread.join();
+}
+
+void swapchain::event_thread()
+{
+   struct pollfd pfds[2] = {};
+   pfds[0].fd = wl_display_get_fd(m_display);
+   pfds[0].events = POLLIN;
+   pfds[1].fd = m_event_thread_wakeup.get();
+   pfds[1].events = POLLIN;
+
+   bool failed = false;
+   while (!failed && m_event_thread_run.load(std::memory_order_acquire))
+   {
+      /* Other threads may read events for the buffer queue too, e.g. while waiting for frame events, so dispatch
+       * whatever is pending before sleeping. */
+      while (wl_display_prepare_read_queue(m_display, m_buffer_queue) != 0)
+      {
+         if (wl_display_dispatch_queue_pending(m_display, m_buffer_queue) < 0)
+         {
+            failed = true;
+            break;
+         }
+      }
+      if (failed)
+      {
+         break;
+      }
+
+      int res = poll(pfds, 2, -1);
+      if (res < 0 || pfds[1].revents != 0 || (pfds[0].revents & POLLIN) == 0)
+      {
+         /* Retry when interrupted by a signal and exit when woken up, anything else is an error on the display. */
+         failed = (res < 0 && errno != EINTR) || (res > 0 && pfds[1].revents == 0);
+         wl_display_cancel_read(m_display);
+         continue;
+      }
+
+      /* Reading also queues the events of the surface queue, which the presenting thread dispatches. */
+      failed = wl_display_read_events(m_display) < 0 ||
+               wl_display_dispatch_queue_pending(m_display, m_buffer_queue) < 0;
+   }
+
+   if (failed)
+   {
+      WSI_LOG_ERROR("Error while dispatching the Wayland buffer queue, the surface is lost.");
+      set_error_state(VK_ERROR_SURFACE_LOST_KHR);
+      /* Wake up any acquire waiting for a buffer that will never be released so it can see the error. */
+      wake_up_free_image_waiter();
+   }
+   m_event_thread_run.store(false, std::memory_order_release);
+}
+
 VWL_CAPI_CALL(void) buffer_release(void *data, struct wl_buffer *wayl_buffer) VWL_API_POST
 {
    auto sc = reinterpret_cast<swapchain *>(data);
@@ -135,6 +344,14 @@ VWL_CAPI_CALL(void) buffer_release(void *data, struct wl_buffer *wayl_buffer) VW
 
 void swapchain::release_buffer(struct wl_buffer *wayl_buffer)
 {
+   if (m_explicit_release)
+   {
+      /* The image is released by the zwp_linux_buffer_release_v1 event of its commit instead. */
+      return;
+   }
+
+   /* With the event thread, releases are dispatched concurrently with images being allocated in acquire. */
+   const std::lock_guard<std::recursive_mutex> image_status_lock(m_image_status_mutex);
    uint32_t i;
    for (i = 0; i < m_swapchain_images.size(); i++)
    {
@@ -152,101 +369,317 @@ void swapchain::release_buffer(struct wl_buffer *wayl_buffer)
 
 static struct wl_buffer_listener buffer_listener = { buffer_release };
 
-VkResult swapchain::get_surface_compatible_formats(const VkImageCreateInfo &info,
-                                                   util::vector<wsialloc_format> &importable_formats,
-                                                   util::vector<uint64_t> &exportable_modifers,
-                                                   util::vector<VkDrmFormatModifierPropertiesEXT> &drm_format_props)
+VWL_CAPI_CALL(void)
+buffer_fenced_release(void *data, struct zwp_linux_buffer_release_v1 *buffer_release, int32_t fence) VWL_API_POST
 {
-   TRY_LOG(util::get_drm_format_properties(m_device_data.physical_device, info.format, drm_format_props),
-           "Failed to get format properties");
+   auto sc = reinterpret_cast<swapchain *>(data);
+   sc->explicit_release_buffer(buffer_release, fence);
+}
 
-   for (const auto &prop : drm_format_props)
-   {
-      bool is_supported = false;
-      drm_format_pair drm_format{ util::drm::vk_to_drm_format(info.format), prop.drmFormatModifier };
+VWL_CAPI_CALL(void)
+buffer_immediate_release(void *data, struct zwp_linux_buffer_release_v1 *buffer_release) VWL_API_POST
+{
+   auto sc = reinterpret_cast<swapchain *>(data);
+   sc->explicit_release_buffer(buffer_release, -1);
+}
 
-      for (const auto &format : m_wsi_surface->get_formats())
-      {
-         if (format.fourcc == drm_format.fourcc && format.modifier == drm_format.modifier)
-         {
-            is_supported = true;
-            break;
-         }
-      }
-      if (!is_supported)
+static const struct zwp_linux_buffer_release_v1_listener buffer_release_listener = { buffer_fenced_release,
+                                                                                      buffer_immediate_release };
+
+void swapchain::explicit_release_buffer(struct zwp_linux_buffer_release_v1 *buffer_release, int release_fence)
+{
+   util::fd_owner fence{ release_fence };
+
+   const std::lock_guard<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+   uint32_t i;
+   for (i = 0; i < m_swapchain_images.size(); i++)
+   {
+      auto data = reinterpret_cast<wayland_image_data *>(m_swapchain_images[i].data);
+      if (data && data->buffer_release == buffer_release)
       {
-         continue;
+         data->buffer_release = nullptr;
+         data->release_fence = std::move(fence);
+         unpresent_image(i);
+         break;
       }
+   }
 
-      VkExternalImageFormatPropertiesKHR external_props = {};
-      external_props.sType = VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES_KHR;
+   /* check we found a buffer to unpresent */
+   assert(i < m_swapchain_images.size());
 
-      VkImageFormatProperties2KHR format_props = {};
-      format_props.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2_KHR;
-      format_props.pNext = &external_props;
+   zwp_linux_buffer_release_v1_destroy(buffer_release);
+}
 
-      VkResult result = VK_SUCCESS;
-      {
-         VkPhysicalDeviceExternalImageFormatInfoKHR external_info = {};
-         external_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO_KHR;
-         external_info.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
+VWL_CAPI_CALL(void)
+presentation_feedback_sync_output(void *data, struct wp_presentation_feedback *wp_feedback,
+                                  struct wl_output *output) VWL_API_POST
+{
+}
+
+VWL_CAPI_CALL(void)
+presentation_feedback_presented(void *data, struct wp_presentation_feedback *wp_feedback, uint32_t tv_sec_hi,
+                                uint32_t tv_sec_lo, uint32_t tv_nsec, uint32_t refresh, uint32_t seq_hi,
+                                uint32_t seq_lo, uint32_t flags) VWL_API_POST
+{
+   auto feedback = reinterpret_cast<presentation_feedback *>(data);
+   const uint64_t tv_sec = (static_cast<uint64_t>(tv_sec_hi) << 32) | tv_sec_lo;
+   feedback->sc->presentation_feedback_done(*feedback, true, tv_sec * 1000000000llu + tv_nsec, refresh);
+}
+
+VWL_CAPI_CALL(void)
+presentation_feedback_discarded(void *data, struct wp_presentation_feedback *wp_feedback) VWL_API_POST
+{
+   auto feedback = reinterpret_cast<presentation_feedback *>(data);
+   feedback->sc->presentation_feedback_done(*feedback, false, 0, 0);
+}
+
+static const wp_presentation_feedback_listener presentation_feedback_listener = {
+   presentation_feedback_sync_output,
+   presentation_feedback_presented,
+   presentation_feedback_discarded,
+};
+
+bool swapchain::uses_fifo_barrier() const
+{
+#if WAYLAND_FIFO_PROTOCOLS_SUPPORTED
+   return m_present_mode == VK_PRESENT_MODE_FIFO_KHR && m_wsi_surface->get_fifo_interface() != nullptr;
+#else
+   return false;
+#endif
+}
+
+bool swapchain::present_mode_uses_presentation_thread(VkPresentModeKHR present_mode) const
+{
+   if (present_mode == VK_PRESENT_MODE_MAILBOX_KHR || present_mode == VK_PRESENT_MODE_IMMEDIATE_KHR)
+   {
+      return false;
+   }
+#if WAYLAND_FIFO_PROTOCOLS_SUPPORTED
+   return present_mode != VK_PRESENT_MODE_FIFO_KHR || m_wsi_surface->get_fifo_interface() == nullptr;
+#else
+   return true;
+#endif
+}
+
+void swapchain::present_mode_switched(VkPresentModeKHR previous_present_mode)
+{
+   /* FIFO paces presents with frame callbacks, unless it uses barriers. Leaving it, the frame requested by the last
+    * FIFO present must not hold up the first present in the new mode. Entering it, that present requests a frame. */
+   if (previous_present_mode == VK_PRESENT_MODE_FIFO_KHR && m_present_mode != VK_PRESENT_MODE_FIFO_KHR)
+   {
+      m_wsi_surface->cancel_frame_callback();
+   }
+}
+
+uint64_t swapchain::get_refresh_interval() const
+{
+   return m_refresh_interval.load(std::memory_order_relaxed);
+}
+
+bool swapchain::schedules_target_present_time() const
+{
+#if WAYLAND_FIFO_PROTOCOLS_SUPPORTED
+   return m_wsi_surface->get_commit_timer_interface() != nullptr;
+#else
+   return false;
+#endif
+}
+
+void swapchain::set_commit_timestamp(uint64_t target_present_time)
+{
+#if WAYLAND_FIFO_PROTOCOLS_SUPPORTED
+   constexpr uint64_t NSEC_PER_SEC = 1000000000;
+
+   /* Commit timestamps are in the presentation clock, which is usually, but not necessarily, CLOCK_MONOTONIC. */
+   const clockid_t presentation_clock = m_wsi_surface->get_presentation_clock_id();
+   if (presentation_clock != CLOCK_MONOTONIC)
+   {
+      struct timespec monotonic_now = {};
+      struct timespec presentation_now = {};
+      clock_gettime(CLOCK_MONOTONIC, &monotonic_now);
+      clock_gettime(presentation_clock, &presentation_now);
+      const int64_t offset = (static_cast<int64_t>(presentation_now.tv_sec) - monotonic_now.tv_sec) *
+                                static_cast<int64_t>(NSEC_PER_SEC) +
+                             (presentation_now.tv_nsec - monotonic_now.tv_nsec);
+      target_present_time = static_cast<uint64_t>(static_cast<int64_t>(target_present_time) + offset);
+   }
+
+   const uint64_t seconds = target_present_time / NSEC_PER_SEC;
+   wp_commit_timer_v1_set_timestamp(m_wsi_surface->get_commit_timer_interface(), static_cast<uint32_t>(seconds >> 32),
+                                    static_cast<uint32_t>(seconds & 0xffffffff),
+                                    static_cast<uint32_t>(target_present_time % NSEC_PER_SEC));
+#else
+   UNUSED(target_present_time);
+#endif
+}
+
+void swapchain::damage_surface(const wayland_image_data &image_data)
+{
+   /* Damage in buffer coordinates needs wl_surface version 4, which the application chose when creating the surface. */
+   const bool supports_damage_buffer =
+      wl_proxy_get_version(reinterpret_cast<wl_proxy *>(m_surface)) >= WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION;
+   if (image_data.full_damage || !supports_damage_buffer)
+   {
+      wl_surface_damage(m_surface, 0, 0, INT32_MAX, INT32_MAX);
+      return;
+   }
+
+   for (const auto &rect : image_data.damage)
+   {
+      /* Rectangles are in image coordinates which, presenting with an identity transform, match buffer coordinates.
+       * Only the first array layer is shown, so the layer of a rectangle is ignored. */
+      wl_surface_damage_buffer(m_surface, rect.offset.x, rect.offset.y, static_cast<int32_t>(rect.extent.width),
+                               static_cast<int32_t>(rect.extent.height));
+   }
+}
+
+bool swapchain::request_presentation_feedback(uint64_t present_id)
+{
+   auto slot = std::find_if(m_presentation_feedbacks.begin(), m_presentation_feedbacks.end(),
+                            [](const presentation_feedback &feedback) { return feedback.feedback == nullptr; });
+   if (slot == m_presentation_feedbacks.end())
+   {
+      return false;
+   }
 
-         VkPhysicalDeviceImageDrmFormatModifierInfoEXT drm_mod_info = {};
-         drm_mod_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_DRM_FORMAT_MODIFIER_INFO_EXT;
-         drm_mod_info.pNext = &external_info;
-         drm_mod_info.drmFormatModifier = prop.drmFormatModifier;
-         drm_mod_info.sharingMode = info.sharingMode;
-         drm_mod_info.queueFamilyIndexCount = info.queueFamilyIndexCount;
-         drm_mod_info.pQueueFamilyIndices = info.pQueueFamilyIndices;
+   /* The feedback object inherits the surface queue from the wp_presentation object. */
+   slot->feedback = wp_presentation_feedback(m_wsi_surface->get_presentation_time_interface(), m_surface);
+   if (slot->feedback == nullptr)
+   {
+      WSI_LOG_WARNING("Failed to request presentation feedback.");
+      return false;
+   }
 
-         VkPhysicalDeviceImageFormatInfo2KHR image_info = {};
-         image_info.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2_KHR;
-         image_info.pNext = &drm_mod_info;
-         image_info.format = info.format;
-         image_info.type = info.imageType;
-         image_info.tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT;
-         image_info.usage = info.usage;
-         image_info.flags = info.flags;
+   slot->sc = this;
+   slot->present_id = present_id;
+   if (wp_presentation_feedback_add_listener(slot->feedback, &presentation_feedback_listener, &*slot) < 0)
+   {
+      WSI_LOG_WARNING("Failed to add presentation feedback listener.");
+      wp_presentation_feedback_destroy(slot->feedback);
+      slot->feedback = nullptr;
+      return false;
+   }
+   return true;
+}
+
+void swapchain::presentation_feedback_done(presentation_feedback &feedback, bool presented, uint64_t time,
+                                           uint32_t refresh)
+{
+   wp_presentation_feedback_destroy(feedback.feedback);
+   feedback.feedback = nullptr;
+
+   if (presented && refresh != 0)
+   {
+      m_refresh_interval.store(refresh, std::memory_order_relaxed);
+   }
+   m_last_present_discarded = !presented;
+   frame_displayed();
+
+   WSI_TRACE_INSTANT("presentation feedback swapchain=%p present_id=%" PRIu64 " presented=%d",
+                     static_cast<void *>(this), feedback.present_id, presented ? 1 : 0);
+   if (feedback.present_id != 0)
+   {
+      WSI_TRACE_END_ASYNC(feedback.present_id, "frame swapchain=%p", static_cast<void *>(this));
+   }
+
+#if VULKAN_WSI_LAYER_EXPERIMENTAL
+   if (presented)
+   {
+      set_present_stage_time(feedback.present_id, VK_PRESENT_STAGE_IMAGE_FIRST_PIXEL_VISIBLE_BIT_EXT, time);
+   }
+   else
+   {
+      set_present_discarded(feedback.present_id);
+   }
+#else
+   UNUSED(time);
+#endif
+}
+
+int swapchain::get_frame_event_timeout() const
+{
+   /* Without a refresh rate, or when the compositor is not showing our frames, e.g. because the window is hidden,
+    * a missing frame event throttles the application to one frame per timeout. */
+   const uint64_t refresh_interval = m_refresh_interval.load(std::memory_order_relaxed);
+   if (refresh_interval == 0 || m_last_present_discarded)
+   {
+      return DEFAULT_FRAME_EVENT_TIMEOUT_MS;
+   }
+
+   /* While our frames are shown the frame event follows within a refresh or two, so do not stall much longer. */
+   const uint64_t timeout_ns = FRAME_EVENT_REFRESH_CYCLES * refresh_interval;
+   return static_cast<int>(std::min<uint64_t>((timeout_ns + 999999llu) / 1000000llu, DEFAULT_FRAME_EVENT_TIMEOUT_MS));
+}
+
+VkResult swapchain::get_surface_compatible_formats(const VkImageCreateInfo &info,
+                                                   util::vector<wsialloc_format> &importable_formats,
+                                                   util::vector<uint64_t> &exportable_modifers,
+                                                   util::drm_format_properties_list &drm_format_props)
+{
+   TRY_LOG(util::get_drm_format_properties(m_device_data.physical_device, info.format, drm_format_props),
+           "Failed to get format properties");
+
+   /* wsialloc picks the first importable format it can allocate, so formats the compositor can scan out directly
+    * are kept at the front of the list. */
+   size_t scanout_format_count = 0;
+
+   drm_format_set surface_formats(m_allocator);
+   for (const auto &format : m_wsi_surface->get_formats())
+   {
+      if (!surface_formats.try_insert(format).has_value())
+      {
+         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+   }
 
 #if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
-         VkImageCompressionControlEXT compression_control = {};
-         compression_control.sType = VK_STRUCTURE_TYPE_IMAGE_COMPRESSION_CONTROL_EXT;
-         compression_control.flags = m_image_compression_control_params.flags;
-         compression_control.compressionControlPlaneCount =
-            m_image_compression_control_params.compression_control_plane_count;
-         compression_control.pFixedRateFlags = m_image_compression_control_params.fixed_rate_flags.data();
-
-         if (m_device_data.is_swapchain_compression_control_enabled())
-         {
-            compression_control.pNext = image_info.pNext;
-            image_info.pNext = &compression_control;
-         }
+   VkImageCompressionControlEXT compression_control = {};
+   compression_control.sType = VK_STRUCTURE_TYPE_IMAGE_COMPRESSION_CONTROL_EXT;
+   compression_control.flags = m_image_compression_control_params.flags;
+   compression_control.compressionControlPlaneCount =
+      m_image_compression_control_params.compression_control_plane_count;
+   compression_control.pFixedRateFlags = m_image_compression_control_params.fixed_rate_flags.data();
+
+   /* Only the compression control of the pNext chain affects the query. It is left out without any request for
+    * compression, which also covers devices without the feature enabled unless the layer chose to compress. */
+   VkImageCreateInfo query_info = info;
+   query_info.pNext =
+      m_image_compression_control_params.flags != VK_IMAGE_COMPRESSION_DEFAULT_EXT ? &compression_control : nullptr;
+#else
+   const VkImageCreateInfo &query_info = info;
 #endif
-         result = m_device_data.instance_data.disp.GetPhysicalDeviceImageFormatProperties2KHR(
-            m_device_data.physical_device, &image_info, &format_props);
+
+   for (const auto &prop : drm_format_props)
+   {
+      drm_format_pair drm_format{ util::drm::vk_to_drm_format(info.format), prop.drmFormatModifier };
+      if (surface_formats.find(drm_format) == surface_formats.end())
+      {
+         continue;
       }
+
+      util::drm_image_format_properties props = {};
+      VkResult result = util::get_drm_image_format_properties(m_device_data.physical_device, query_info,
+                                                              prop.drmFormatModifier, props);
       if (result != VK_SUCCESS)
       {
          continue;
       }
-      if (format_props.imageFormatProperties.maxExtent.width < info.extent.width ||
-          format_props.imageFormatProperties.maxExtent.height < info.extent.height ||
-          format_props.imageFormatProperties.maxExtent.depth < info.extent.depth)
+      const VkImageFormatProperties &format_props = props.image_format_properties;
+      if (format_props.maxExtent.width < info.extent.width || format_props.maxExtent.height < info.extent.height ||
+          format_props.maxExtent.depth < info.extent.depth)
       {
          continue;
       }
-      if (format_props.imageFormatProperties.maxMipLevels < info.mipLevels ||
-          format_props.imageFormatProperties.maxArrayLayers < info.arrayLayers)
+      if (format_props.maxMipLevels < info.mipLevels || format_props.maxArrayLayers < info.arrayLayers)
       {
          continue;
       }
-      if ((format_props.imageFormatProperties.sampleCounts & info.samples) != info.samples)
+      if ((format_props.sampleCounts & info.samples) != info.samples)
       {
          continue;
       }
 
-      if (external_props.externalMemoryProperties.externalMemoryFeatures &
-          VK_EXTERNAL_MEMORY_FEATURE_EXPORTABLE_BIT_KHR)
+      if (props.external_memory_features & VK_EXTERNAL_MEMORY_FEATURE_EXPORTABLE_BIT_KHR)
       {
          if (!exportable_modifers.try_push_back(drm_format.modifier))
          {
@@ -254,8 +687,7 @@ VkResult swapchain::get_surface_compatible_formats(const VkImageCreateInfo &info
          }
       }
 
-      if (external_props.externalMemoryProperties.externalMemoryFeatures &
-          VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT_KHR)
+      if (props.external_memory_features & VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT_KHR)
       {
          uint64_t flags =
             (prop.drmFormatModifierTilingFeatures & VK_FORMAT_FEATURE_DISJOINT_BIT) ? 0 : WSIALLOC_FORMAT_NON_DISJOINT;
@@ -264,6 +696,94 @@ VkResult swapchain::get_surface_compatible_formats(const VkImageCreateInfo &info
          {
             return VK_ERROR_OUT_OF_HOST_MEMORY;
          }
+
+         if (m_wsi_surface->is_scanout_format(drm_format))
+         {
+            std::rotate(importable_formats.begin() + scanout_format_count, importable_formats.end() - 1,
+                        importable_formats.end());
+            scanout_format_count++;
+         }
+      }
+   }
+
+   return VK_SUCCESS;
+}
+
+uint64_t swapchain::get_wsialloc_heap_flags() const
+{
+   const bool is_protected_memory = (m_image_create_info.flags & VK_IMAGE_CREATE_PROTECTED_BIT) != 0;
+   uint64_t flags = is_protected_memory ? WSIALLOC_ALLOCATE_PROTECTED : 0;
+
+   /* Buffers the compositor only composites do not need scarce contiguous memory. The layer never reads them. */
+   flags |= m_scanout_allocation ? WSIALLOC_ALLOCATE_SCANOUT : WSIALLOC_ALLOCATE_NO_CPU_READ;
+   return flags;
+}
+
+void swapchain::release_wsialloc_buffer(const std::array<int, MAX_PLANES> &buffer_fds, bool recycle)
+{
+   if (m_wsi_allocator == nullptr)
+   {
+      assert(std::all_of(buffer_fds.begin(), buffer_fds.end(), [](int fd) { return fd < 0; }));
+      return;
+   }
+
+   if (recycle)
+   {
+      wsialloc_release(m_wsi_allocator, get_wsialloc_heap_flags(), buffer_fds.data());
+      return;
+   }
+
+   for (int fd : buffer_fds)
+   {
+      if (fd >= 0)
+      {
+         close(fd);
+      }
+   }
+}
+
+VkResult swapchain::allocate_wsialloc_batch(const wsialloc_allocate_info &alloc_info, bool avoid_allocation,
+                                            wsialloc_allocate_result &alloc_result)
+{
+   /* While the swapchain is created, the images that are not created yet need buffers with the same allocation info,
+    * so they are allocated together with this one. Deferred allocations have no such images. */
+   uint32_t count = 1;
+   if (!avoid_allocation)
+   {
+      count += count_images_with_status(swapchain_image::INVALID);
+   }
+
+   util::vector<wsialloc_allocate_result> results(util::allocator(m_allocator, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND));
+   if (!results.try_resize(count))
+   {
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+   for (auto &result : results)
+   {
+      /* Clear buffer_fds and average_row_strides for error purposes */
+      std::fill(std::begin(result.buffer_fds), std::end(result.buffer_fds), -1);
+      std::fill(std::begin(result.average_row_strides), std::end(result.average_row_strides), -1);
+   }
+
+   const auto res = wsialloc_alloc_batch(m_wsi_allocator, &alloc_info, count, results.data());
+   if (res != WSIALLOC_ERROR_NONE)
+   {
+      WSI_LOG_ERROR("Failed allocation of DMA Buffer. WSI error: %d", static_cast<int>(res));
+      if (res == WSIALLOC_ERROR_NOT_SUPPORTED)
+      {
+         return VK_ERROR_FORMAT_NOT_SUPPORTED;
+      }
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+
+   alloc_result = results[0];
+   const std::lock_guard<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+   for (uint32_t i = 1; i < count; i++)
+   {
+      /* Images left without a preallocated buffer allocate their own. */
+      if (!m_preallocated_buffers.try_push_back(results[i]))
+      {
+         wsialloc_release(m_wsi_allocator, alloc_info.flags, results[i].buffer_fds);
       }
    }
 
@@ -280,6 +800,11 @@ VkResult swapchain::allocate_wsialloc(VkImageCreateInfo &image_create_info, wayl
    {
       allocation_flags |= WSIALLOC_ALLOCATE_NO_MEMORY;
    }
+   else
+   {
+      /* Swapchain images have undefined contents, so buffers of destroyed swapchains can be reused. */
+      allocation_flags |= WSIALLOC_ALLOCATE_RECYCLE | get_wsialloc_heap_flags();
+   }
 
 #if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
    if (m_image_compression_control_params.flags & VK_IMAGE_COMPRESSION_FIXED_RATE_EXPLICIT_EXT)
@@ -293,21 +818,22 @@ VkResult swapchain::allocate_wsialloc(VkImageCreateInfo &image_create_info, wayl
                                          allocation_flags };
 
    wsialloc_allocate_result alloc_result = { 0 };
-   /* Clear buffer_fds and average_row_strides for error purposes */
-   for (int i = 0; i < WSIALLOC_MAX_PLANES; ++i)
-   {
-      alloc_result.buffer_fds[i] = -1;
-      alloc_result.average_row_strides[i] = -1;
-   }
-   const auto res = wsialloc_alloc(m_wsi_allocator, &alloc_info, &alloc_result);
-   if (res != WSIALLOC_ERROR_NONE)
+   bool preallocated = false;
+   if (!avoid_allocation)
    {
-      WSI_LOG_ERROR("Failed allocation of DMA Buffer. WSI error: %d", static_cast<int>(res));
-      if (res == WSIALLOC_ERROR_NOT_SUPPORTED)
+      const std::lock_guard<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+      preallocated = !m_preallocated_buffers.empty();
+      if (preallocated)
       {
-         return VK_ERROR_FORMAT_NOT_SUPPORTED;
+         alloc_result = m_preallocated_buffers.back();
+         m_preallocated_buffers.pop_back();
       }
-      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+
+   /* The allocation is done without holding the image status lock, as it can take long. */
+   if (!preallocated)
+   {
+      TRY_LOG_CALL(allocate_wsialloc_batch(alloc_info, avoid_allocation, alloc_result));
    }
    *allocated_format = alloc_result.format;
    auto &external_memory = image_data->external_mem;
@@ -319,6 +845,12 @@ VkResult swapchain::allocate_wsialloc(VkImageCreateInfo &image_create_info, wayl
 
    if (!avoid_allocation)
    {
+      /* Keep the buffer alive after the imported memory is freed, so that it can be given back to wsialloc. */
+      if (external_memory.retain_buffer_fds() != VK_SUCCESS)
+      {
+         WSI_LOG_WARNING("Failed to retain the buffer file descriptors, the buffer will not be recycled.");
+      }
+
       uint32_t num_memory_planes = 0;
 
       for (uint32_t i = 0; i < num_planes; ++i)
@@ -337,6 +869,7 @@ VkResult swapchain::allocate_wsialloc(VkImageCreateInfo &image_create_info, wayl
 
    external_memory.set_format_info(alloc_result.is_disjoint, num_planes);
    external_memory.set_memory_handle_type(VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT);
+   external_memory.set_protected_memory(is_protected_memory);
    return VK_SUCCESS;
 }
 
@@ -363,13 +896,18 @@ static VkResult fill_image_create_info(VkImageCreateInfo &image_create_info,
 VkResult swapchain::allocate_image(VkImageCreateInfo &image_create_info, wayland_image_data *image_data)
 {
    util::vector<wsialloc_format> importable_formats(util::allocator(m_allocator, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND));
-   auto &m_allocated_format = m_image_creation_parameters.m_allocated_format;
-   if (!importable_formats.try_push_back(m_allocated_format))
+   std::unique_lock<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+   if (!importable_formats.try_push_back(m_image_creation_parameters.m_allocated_format))
    {
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
-   TRY_LOG_CALL(allocate_wsialloc(m_image_create_info, image_data, importable_formats, &m_allocated_format, false));
+   image_status_lock.unlock();
+
+   wsialloc_format allocated_format = {};
+   TRY_LOG_CALL(allocate_wsialloc(m_image_create_info, image_data, importable_formats, &allocated_format, false));
 
+   image_status_lock.lock();
+   m_image_creation_parameters.m_allocated_format = allocated_format;
    return VK_SUCCESS;
 }
 
@@ -406,13 +944,14 @@ VkResult swapchain::create_wl_buffer(const VkImageCreateInfo &image_create_info,
 
 VkResult swapchain::allocate_and_bind_swapchain_image(VkImageCreateInfo image_create_info, swapchain_image &image)
 {
-   std::unique_lock<std::recursive_mutex> image_status_lock(m_image_status_mutex);
-   image.status = swapchain_image::FREE;
+   {
+      const std::lock_guard<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+      set_image_status(image, swapchain_image::FREE);
+   }
 
    assert(image.data != nullptr);
    auto image_data = static_cast<wayland_image_data *>(image.data);
    TRY_LOG(allocate_image(image_create_info, image_data), "Failed to allocate image");
-   image_status_lock.unlock();
 
    TRY_LOG(create_wl_buffer(image_create_info, image, image_data), "Failed to create wl_buffer");
 
@@ -430,15 +969,101 @@ VkResult swapchain::allocate_and_bind_swapchain_image(VkImageCreateInfo image_cr
    return VK_SUCCESS;
 }
 
+bool swapchain::supports_parallel_image_creation() const
+{
+   return true;
+}
+
+bool swapchain::supports_image_handover(const swapchain_base &ancestor) const
+{
+   /* A buffer of the ancestor could otherwise wait for a release event that this swapchain does not listen to. */
+   return static_cast<const swapchain &>(ancestor).m_explicit_release == m_explicit_release;
+}
+
+VkResult swapchain::adopt_ancestor_image(swapchain_base &ancestor, swapchain_image &ancestor_image,
+                                         const VkImageCreateInfo &image_create_info, swapchain_image &image)
+{
+   auto &ancestor_swapchain = static_cast<swapchain &>(ancestor);
+   auto ancestor_data = reinterpret_cast<wayland_image_data *>(ancestor_image.data);
+   assert(ancestor_data != nullptr && ancestor_data->buffer != nullptr && ancestor_data->buffer_release == nullptr);
+
+   auto image_data = create_image_data<wayland_image_data>(image, m_device, m_object_arena.get_allocator());
+   if (image_data == nullptr)
+   {
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+   }
+   image_data->external_mem.take_over(ancestor_data->external_mem);
+
+   /* The images created after the ones taken over use the format and layout of the ancestor too. */
+   const bool first_adopted = m_image_create_info.format == VK_FORMAT_UNDEFINED;
+   const auto &allocated_format = ancestor_swapchain.m_image_creation_parameters.m_allocated_format;
+   VkImageCreateInfo adopted_create_info = first_adopted ? image_create_info : m_image_create_info;
+   VkResult res = VK_SUCCESS;
+   if (first_adopted)
+   {
+      res = fill_image_create_info(adopted_create_info, m_image_creation_parameters.m_image_layout,
+                                   m_image_creation_parameters.m_drm_mod_info,
+                                   m_image_creation_parameters.m_external_info, *image_data, allocated_format.modifier);
+   }
+   if (res == VK_SUCCESS)
+   {
+      res = m_device_data.disp.CreateImage(m_device, &adopted_create_info, get_allocation_callbacks(), &image.image);
+   }
+   if (res == VK_SUCCESS)
+   {
+      res = image_data->external_mem.bind_swapchain_image_memory(image.image);
+   }
+   if (res != VK_SUCCESS)
+   {
+      /* Give the memory back, so that the ancestor image is left as it was and this image is created from scratch. */
+      if (image.image != VK_NULL_HANDLE)
+      {
+         m_device_data.disp.DestroyImage(m_device, image.image, get_allocation_callbacks());
+         image.image = VK_NULL_HANDLE;
+      }
+      ancestor_data->external_mem.take_over(image_data->external_mem);
+      destroy_image_data<wayland_image_data>(image);
+      return res;
+   }
+
+   if (first_adopted)
+   {
+      m_image_create_info = adopted_create_info;
+      m_image_creation_parameters.m_allocated_format = allocated_format;
+      m_scanout_allocation = ancestor_swapchain.m_scanout_allocation;
+   }
+
+   image_data->present_fence = std::move(ancestor_data->present_fence);
+   image_data->release_fence = std::move(ancestor_data->release_fence);
+
+   /* The release events of the buffer are dispatched on the queue of this swapchain from now on. */
+   image_data->buffer = std::exchange(ancestor_data->buffer, nullptr);
+   wl_proxy_set_queue(reinterpret_cast<wl_proxy *>(image_data->buffer), m_buffer_queue);
+   wl_proxy_set_user_data(reinterpret_cast<wl_proxy *>(image_data->buffer), this);
+   return VK_SUCCESS;
+}
+
+VkResult swapchain::swapchain_images_initialized()
+{
+   /* The buffers are created with create_immed, so the compositor can import them all while the application records
+    * its first frame, rather than when the first present flushes the display. A full socket buffer is not an error,
+    * the rest of the requests go out with the next flush. */
+   if (wl_display_flush(m_display) < 0 && errno != EAGAIN)
+   {
+      WSI_LOG_ERROR("error flushing the display");
+      return VK_ERROR_SURFACE_LOST_KHR;
+   }
+   return VK_SUCCESS;
+}
+
 VkResult swapchain::create_swapchain_image(VkImageCreateInfo image_create_info, swapchain_image &image)
 {
    /* Create image_data */
-   auto image_data = m_allocator.create<wayland_image_data>(1, m_device, m_allocator);
+   auto image_data = create_image_data<wayland_image_data>(image, m_device, m_object_arena.get_allocator());
    if (image_data == nullptr)
    {
       return VK_ERROR_OUT_OF_HOST_MEMORY;
    }
-   image.data = image_data;
 
    if (m_image_create_info.format == VK_FORMAT_UNDEFINED)
    {
@@ -447,11 +1072,20 @@ VkResult swapchain::create_swapchain_image(VkImageCreateInfo image_create_info,
       util::vector<uint64_t> exportable_modifiers(util::allocator(m_allocator, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND));
 
       /* Query supported modifers. */
-      util::vector<VkDrmFormatModifierPropertiesEXT> drm_format_props(
+      util::drm_format_properties_list drm_format_props(
          util::allocator(m_allocator, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND));
 
       TRY_LOG_CALL(
          get_surface_compatible_formats(image_create_info, importable_formats, exportable_modifiers, drm_format_props));
+#if WSI_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN
+      if (importable_formats.empty() && drop_automatic_compression())
+      {
+         /* None of the modifiers of the surface supports the fixed rate the layer chose, carry on uncompressed. */
+         exportable_modifiers.clear();
+         TRY_LOG_CALL(get_surface_compatible_formats(image_create_info, importable_formats, exportable_modifiers,
+                                                     drm_format_props));
+      }
+#endif
 
       /* TODO: Handle exportable images which use ICD allocated memory in preference to an external allocator. */
       if (importable_formats.empty())
@@ -477,6 +1111,8 @@ VkResult swapchain::create_swapchain_image(VkImageCreateInfo image_create_info,
 
       m_image_create_info = image_create_info;
       m_image_creation_parameters.m_allocated_format = allocated_format;
+      m_scanout_allocation =
+         m_wsi_surface->is_scanout_format(drm_format_pair{ allocated_format.fourcc, allocated_format.modifier });
    }
 
    return m_device_data.disp.CreateImage(m_device, &m_image_create_info, get_allocation_callbacks(), &image.image);
@@ -488,8 +1124,25 @@ void swapchain::present_image(const pending_present_request &pending_present)
    wayland_image_data *image_data =
       reinterpret_cast<wayland_image_data *>(m_swapchain_images[pending_present.image_index].data);
 
+   /* Buffers are only released once committed, so the event thread is started with the first present, when the
+    * swapchain is fully initialized. If it cannot be started, acquire keeps dispatching buffer releases itself. */
+   if (WAYLAND_EVENT_THREAD_ENABLED && !m_event_thread_started)
+   {
+      m_event_thread_started = true;
+      if (start_event_thread() != VK_SUCCESS)
+      {
+         WSI_LOG_WARNING("Failed to start the Wayland event thread, buffer releases are dispatched in acquire.");
+      }
+   }
+
+   /* Handle presentation feedback that was read while dispatching other queues. */
+   if (!m_wsi_surface->dispatch_pending_events())
+   {
+      set_error_state(VK_ERROR_SURFACE_LOST_KHR);
+   }
+
    /* if a frame is already pending, wait for a hint to present again */
-   if (!m_wsi_surface->wait_next_frame_event())
+   if (!m_wsi_surface->wait_next_frame_event(get_frame_event_timeout()))
    {
       set_error_state(VK_ERROR_SURFACE_LOST_KHR);
    }
@@ -508,10 +1161,41 @@ void swapchain::present_image(const pending_present_request &pending_present)
                                                              present_sync_fd->get());
    }
 
-   /* TODO: work out damage */
-   wl_surface_damage(m_surface, 0, 0, INT32_MAX, INT32_MAX);
+   if (m_explicit_release)
+   {
+      /* Ask for a release event of this commit, which carries a fence when the compositor is still reading the
+       * buffer. Acquire then waits for that fence on the GPU instead of waiting for wl_buffer.release. */
+      auto *buffer_release =
+         zwp_linux_surface_synchronization_v1_get_release(m_wsi_surface->get_surface_sync_interface());
+      if (buffer_release == nullptr)
+      {
+         WSI_LOG_ERROR("Failed to request a buffer release object.");
+         set_error_state(VK_ERROR_SURFACE_LOST_KHR);
+      }
+      else
+      {
+         wl_proxy_set_queue(reinterpret_cast<wl_proxy *>(buffer_release), m_buffer_queue);
+         zwp_linux_buffer_release_v1_add_listener(buffer_release, &buffer_release_listener, this);
+
+         const std::lock_guard<std::recursive_mutex> image_status_lock(m_image_status_mutex);
+         assert(image_data->buffer_release == nullptr);
+         image_data->buffer_release = buffer_release;
+      }
+   }
+
+   damage_surface(*image_data);
 
-   if (m_present_mode == VK_PRESENT_MODE_FIFO_KHR)
+   if (uses_fifo_barrier())
+   {
+#if WAYLAND_FIFO_PROTOCOLS_SUPPORTED
+      /* The compositor holds this commit until the previous one has been shown for a refresh cycle, so FIFO
+       * ordering is kept without waiting for frame events here. */
+      wp_fifo_v1 *fifo = m_wsi_surface->get_fifo_interface();
+      wp_fifo_v1_wait_barrier(fifo);
+      wp_fifo_v1_set_barrier(fifo);
+#endif
+   }
+   else if (m_present_mode == VK_PRESENT_MODE_FIFO_KHR)
    {
       if (!m_wsi_surface->set_frame_callback())
       {
@@ -519,7 +1203,24 @@ void swapchain::present_image(const pending_present_request &pending_present)
       }
    }
 
+   if (pending_present.target_present_time != 0 && schedules_target_present_time())
+   {
+      set_commit_timestamp(pending_present.target_present_time);
+   }
+
+   /* Only the immediate mode lets the compositor show the commit without waiting for vblank. It does not request
+    * frame events, so nothing holds up the next present either. */
+   m_wsi_surface->set_tearing_hint(m_present_mode == VK_PRESENT_MODE_IMMEDIATE_KHR);
+
+   /* Also unsets a viewport left by a previous swapchain of the surface that did scale its images. */
+   m_wsi_surface->set_viewport(m_viewport_source, m_viewport_destination);
+
+   const bool feedback_requested = request_presentation_feedback(pending_present.present_id);
+
    wl_surface_commit(m_surface);
+   m_wsi_surface->set_surface_extent(m_surface_extent);
+   WSI_TRACE_INSTANT("surface commit swapchain=%p present_id=%" PRIu64 " image=%u", static_cast<void *>(this),
+                     pending_present.present_id, pending_present.image_index);
    res = wl_display_flush(m_display);
    if (res < 0)
    {
@@ -528,6 +1229,11 @@ void swapchain::present_image(const pending_present_request &pending_present)
       set_error_state(VK_ERROR_SURFACE_LOST_KHR);
    }
 
+   if (!feedback_requested)
+   {
+      /* Without feedback, the commit is the closest the layer gets to knowing when the present is shown. */
+      frame_displayed();
+   }
    set_present_id(pending_present.present_id);
 }
 
@@ -535,6 +1241,7 @@ void swapchain::destroy_image(swapchain_image &image)
 {
    std::unique_lock<std::recursive_mutex> image_status_lock(m_image_status_mutex);
 
+   const swapchain_image::status status = image.status;
    if (image.status != swapchain_image::INVALID)
    {
       if (image.image != VK_NULL_HANDLE)
@@ -543,7 +1250,7 @@ void swapchain::destroy_image(swapchain_image &image)
          image.image = VK_NULL_HANDLE;
       }
 
-      image.status = swapchain_image::INVALID;
+      set_image_status(image, swapchain_image::INVALID);
    }
 
    image_status_lock.unlock();
@@ -551,56 +1258,74 @@ void swapchain::destroy_image(swapchain_image &image)
    if (image.data != nullptr)
    {
       auto image_data = reinterpret_cast<wayland_image_data *>(image.data);
+
+      /* Only a buffer the compositor has released, and stopped reading, can be handed out again. The compositor may
+       * still show the others, or read them after the swapchain is gone. */
+      const bool recycle = status == swapchain_image::FREE && image_data->buffer_release == nullptr &&
+                           util::wait_sync_fd(image_data->release_fence, 0) == 1;
+
+      if (image_data->buffer_release != nullptr)
+      {
+         zwp_linux_buffer_release_v1_destroy(image_data->buffer_release);
+      }
       if (image_data->buffer != nullptr)
       {
          wl_buffer_destroy(image_data->buffer);
       }
-      m_allocator.destroy(1, image_data);
-      image.data = nullptr;
+      const auto buffer_fds = image_data->external_mem.take_retained_buffer_fds();
+      destroy_image_data<wayland_image_data>(image);
+      release_wsialloc_buffer(buffer_fds, recycle);
    }
 }
 
-bool swapchain::free_image_found()
+void swapchain::add_image_memory_footprint(const swapchain_image &image, swapchain_memory_footprint &footprint) const
 {
-   for (auto &img : m_swapchain_images)
+   if (image.data == nullptr)
    {
-      if (img.status == swapchain_image::FREE)
-      {
-         return true;
-      }
+      return;
    }
-   return false;
+
+   auto *image_data = reinterpret_cast<const wayland_image_data *>(image.data);
+   footprint.dma_buf_bytes += image_data->external_mem.get_imported_size();
 }
 
-VkResult swapchain::get_free_buffer(uint64_t *timeout)
+bool swapchain::free_image_found()
 {
-   int ms_timeout, res;
+   return find_image_with_status(swapchain_image::FREE) < m_swapchain_images.size();
+}
 
-   if (*timeout >= INT_MAX * 1000llu * 1000llu)
-   {
-      ms_timeout = INT_MAX;
-   }
-   else
+VkResult swapchain::get_free_buffer(uint64_t *timeout)
+{
+   if (m_event_thread_run.load(std::memory_order_acquire))
    {
-      ms_timeout = *timeout / 1000llu / 1000llu;
+      /* The event thread posts the free image semaphore as buffers are released, so there is nothing to dispatch
+       * and the caller can wait on the semaphore for the whole timeout. */
+      return error_has_occured() ? get_error_state() : VK_SUCCESS;
    }
 
+   int res;
+   bool found;
+   const uint64_t deadline = util::timeout_to_deadline(*timeout);
+
    /* The current dispatch_queue implementation will return if any
     * events are returned, even if no events are dispatched to the buffer
-    * queue. Therefore dispatch repeatedly until a buffer has been freed.
+    * queue. Therefore dispatch repeatedly until a buffer has been freed,
+    * waiting each time only for what is left until the deadline.
     */
    do
    {
-      res = dispatch_queue(m_display, m_buffer_queue, ms_timeout);
-   } while (!free_image_found() && res > 0);
+      res = m_wsi_surface->get_dispatcher().dispatch_queue(m_buffer_queue, deadline);
+      found = free_image_found();
+   } while (!found && res > 0 && (util::deadline_to_timeout(deadline) > 0 || *timeout == 0));
 
-   if (res > 0)
+   if (found)
    {
       *timeout = 0;
       return VK_SUCCESS;
    }
-   else if (res == 0)
+   else if (res >= 0)
    {
+      /* Either nothing was dispatched or the deadline passed while dispatching unrelated events. */
       if (*timeout == 0)
       {
          return VK_NOT_READY;
@@ -623,6 +1348,39 @@ VkResult swapchain::image_set_present_payload(swapchain_image &image, VkQueue qu
    return image_data->present_fence.set_payload(queue, semaphores, submission_pnext);
 }
 
+VkResult swapchain::image_set_present_region(swapchain_image &image, const VkPresentRegionKHR *region)
+{
+   auto image_data = reinterpret_cast<wayland_image_data *>(image.data);
+
+   /* A region without rectangles means the whole image changed. */
+   image_data->full_damage = region == nullptr || region->rectangleCount == 0 || region->pRectangles == nullptr;
+   if (image_data->full_damage)
+   {
+      return VK_SUCCESS;
+   }
+
+   /* The damage is only a hint to the compositor, so fall back to damaging everything rather than failing. */
+   if (!image_data->damage.try_resize(region->rectangleCount))
+   {
+      WSI_LOG_WARNING("Failed to store the present region, damaging the whole surface.");
+      image_data->full_damage = true;
+      return VK_SUCCESS;
+   }
+
+   std::copy(region->pRectangles, region->pRectangles + region->rectangleCount, image_data->damage.begin());
+   return VK_SUCCESS;
+}
+
+util::fd_owner swapchain::image_take_release_fence(swapchain_image &image)
+{
+   auto image_data = reinterpret_cast<wayland_image_data *>(image.data);
+   if (image_data == nullptr)
+   {
+      return util::fd_owner{};
+   }
+   return std::move(image_data->release_fence);
+}
+
 VkResult swapchain::image_wait_present(swapchain_image &, uint64_t)
 {
    /* With explicit sync in use there is no need to wait for the present sync before submiting the image to the
@@ -36,8 +36,14 @@ extern "C" {
 #endif
 #include <wayland-client.h>
 #include <linux-dmabuf-unstable-v1-client-protocol.h>
+#include <presentation-time-client-protocol.h>
+#include <array>
+#include <atomic>
+#include <thread>
 #include "util/wsialloc/wsialloc.h"
 #include "util/custom_allocator.hpp"
+#include "util/file_descriptor.hpp"
+#include "util/format_modifiers.hpp"
 #include "wl_object_owner.hpp"
 #include "surface.hpp"
 #include "wsi/external_memory.hpp"
@@ -52,12 +58,25 @@ struct wayland_image_data
    wayland_image_data(const VkDevice &device, const util::allocator &allocator)
       : external_mem(device, allocator)
       , buffer(nullptr)
+      , buffer_release(nullptr)
+      , damage(allocator)
+      , full_damage(true)
    {
    }
 
    external_memory external_mem;
    wl_buffer *buffer;
    sync_fd_fence_sync present_fence;
+
+   /* Release object requested for the latest commit of the buffer, nullptr once the compositor released it. */
+   zwp_linux_buffer_release_v1 *buffer_release;
+   /* Fence signalled when the compositor stops reading the buffer, invalid if it was released immediately. */
+   util::fd_owner release_fence;
+
+   /* Rectangles of the buffer that changed in the pending present, used when full_damage is false. */
+   util::vector<VkRectLayerKHR> damage;
+   /* Whether the whole buffer needs to be damaged for the pending present. */
+   bool full_damage;
 };
 
 struct image_creation_parameters
@@ -78,6 +97,23 @@ struct image_creation_parameters
    }
 };
 
+class swapchain;
+
+/**
+ * @brief A wp_presentation_feedback request made for a present.
+ */
+struct presentation_feedback
+{
+   /* Swapchain that made the request. */
+   swapchain *sc{ nullptr };
+
+   /* The feedback object, nullptr while the request slot is free. */
+   struct wp_presentation_feedback *feedback{ nullptr };
+
+   /* Present ID of the present the feedback is for, 0 if none was given. */
+   uint64_t present_id{ 0 };
+};
+
 class swapchain : public wsi::swapchain_base
 {
 public:
@@ -89,6 +125,24 @@ public:
    /* TODO: make the buffer destructor a friend? so this can be protected */
    void release_buffer(struct wl_buffer *wl_buffer);
 
+   /**
+    * @brief Handle the compositor releasing a buffer through a zwp_linux_buffer_release_v1 object.
+    *
+    * @param buffer_release The release object requested for the commit, which is destroyed.
+    * @param release_fence  Sync FD signalled when the compositor stops reading the buffer, or -1 if already released.
+    */
+   void explicit_release_buffer(struct zwp_linux_buffer_release_v1 *buffer_release, int release_fence);
+
+   /**
+    * @brief Handle the compositor's answer to a wp_presentation_feedback request.
+    *
+    * @param feedback  The feedback request, which is destroyed and whose slot becomes free.
+    * @param presented true if the commit was shown, false if it was discarded.
+    * @param time      Time at which the commit was shown, in nanoseconds of the presentation clock.
+    * @param refresh   Refresh period of the output in nanoseconds, 0 if unknown.
+    */
+   void presentation_feedback_done(presentation_feedback &feedback, bool presented, uint64_t time, uint32_t refresh);
+
 protected:
    /**
     * @brief Initialize platform specifics.
@@ -118,6 +172,29 @@ protected:
     */
    VkResult create_swapchain_image(VkImageCreateInfo image_create_info, swapchain_image &image) override;
 
+   /**
+    * @brief Allows the images after the first one to be created concurrently.
+    *
+    * Their buffers are allocated under the image status mutex and wl_buffers can be created from several threads.
+    */
+   bool supports_parallel_image_creation() const override;
+
+   /**
+    * @brief Images are handed over when both swapchains learn about buffer releases the same way.
+    */
+   bool supports_image_handover(const swapchain_base &ancestor) const override;
+
+   /**
+    * @brief Take over the memory, wl_buffer and present fence of a free image of the ancestor swapchain.
+    */
+   VkResult adopt_ancestor_image(swapchain_base &ancestor, swapchain_image &ancestor_image,
+                                 const VkImageCreateInfo &image_create_info, swapchain_image &image) override;
+
+   /**
+    * @brief Send the requests creating the wl_buffers of all the images with a single flush.
+    */
+   VkResult swapchain_images_initialized() override;
+
    /**
     * @brief Method to present and image
     *
@@ -127,6 +204,22 @@ protected:
     */
    void present_image(const pending_present_request &pending_present) override;
 
+   void present_mode_switched(VkPresentModeKHR previous_present_mode) override;
+
+   /**
+    * @brief Get the refresh interval last reported by the compositor.
+    *
+    * @return The refresh interval in nanoseconds, or 0 if it is unknown.
+    */
+   uint64_t get_refresh_interval() const override;
+
+   /**
+    * @brief Whether commits carry their target present time to the compositor with wp_commit_timer_v1.
+    *
+    * @return true if the compositor holds commits until their target present time.
+    */
+   bool schedules_target_present_time() const override;
+
    /**
     * @brief Method to release a swapchain image
     *
@@ -134,6 +227,8 @@ protected:
     */
    void destroy_image(swapchain_image &image) override;
 
+   void add_image_memory_footprint(const swapchain_image &image, swapchain_memory_footprint &footprint) const override;
+
    /**
     * @brief Method to check if there are any free images
     *
@@ -165,8 +260,12 @@ protected:
    VkResult image_set_present_payload(swapchain_image &image, VkQueue queue, const queue_submit_semaphores &semaphores,
                                       const void *submission_pnext) override;
 
+   VkResult image_set_present_region(swapchain_image &image, const VkPresentRegionKHR *region) override;
+
    VkResult image_wait_present(swapchain_image &image, uint64_t timeout) override;
 
+   util::fd_owner image_take_release_fence(swapchain_image &image) override;
+
    /**
     * @brief Bind image to a swapchain
     *
@@ -184,10 +283,120 @@ private:
    VkResult create_wl_buffer(const VkImageCreateInfo &image_create_info, swapchain_image &image,
                              wayland_image_data *image_data);
    VkResult allocate_image(VkImageCreateInfo &image_create_info, wayland_image_data *image_data);
+
+   /**
+    * @brief Give the buffer of a destroyed image back to wsialloc, which may reuse it for later allocations.
+    *
+    * @param buffer_fds The file descriptors retained for the image, see external_memory::retain_buffer_fds.
+    * @param recycle    Whether the buffer can be reused. Buffers still owned by the compositor are not, and
+    *                   their file descriptors are closed instead.
+    */
+   void release_wsialloc_buffer(const std::array<int, MAX_PLANES> &buffer_fds, bool recycle);
+
+   /**
+    * @brief Get the wsialloc flags that select the heap of the swapchain buffers, which depends on their usage.
+    */
+   uint64_t get_wsialloc_heap_flags() const;
+
+   /**
+    * @brief Allocate a buffer with wsialloc, together with the buffers of the images that are still to be created.
+    *
+    * The extra buffers are kept in @ref m_preallocated_buffers for the following allocations.
+    *
+    * @param      alloc_info       The allocation info of the buffer.
+    * @param      avoid_allocation Whether to only select the format, without allocating memory.
+    * @param[out] alloc_result     The allocation result of the buffer.
+    */
+   VkResult allocate_wsialloc_batch(const wsialloc_allocate_info &alloc_info, bool avoid_allocation,
+                                    wsialloc_allocate_result &alloc_result);
    VkResult allocate_wsialloc(VkImageCreateInfo &image_create_info, wayland_image_data *image_data,
                               util::vector<wsialloc_format> &importable_formats, wsialloc_format *allocated_format,
                               bool avoid_allocation);
 
+   /**
+    * @brief Start the thread that dispatches the buffer queue.
+    *
+    * @return VK_SUCCESS on success, an error code otherwise.
+    */
+   VkResult start_event_thread();
+
+   /**
+    * @brief Stop the event thread, if running, and wait for it to exit.
+    */
+   void stop_event_thread();
+
+   /**
+    * @brief Body of the event thread.
+    *
+    * Reads events from the display and dispatches the buffer queue, so buffer releases mark images as free and post
+    * the free image semaphore as soon as they arrive. Events for the surface queue are read too, but are left for
+    * the presenting thread to dispatch.
+    */
+   void event_thread();
+
+   /**
+    * @brief Whether FIFO presents are ordered by wp_fifo_v1 barriers rather than frame callbacks.
+    *
+    * With barriers commits queue in the compositor, so presenting never waits for a frame event.
+    */
+   bool uses_fifo_barrier() const;
+
+   /**
+    * @brief Whether images presented with a present mode are better presented by the page flip thread than during
+    *        vkQueuePresentKHR, as presenting them may wait for the compositor.
+    *
+    * @param present_mode The present mode to check.
+    */
+   bool present_mode_uses_presentation_thread(VkPresentModeKHR present_mode) const;
+
+   /**
+    * @brief Ask the compositor to hold the next commit until its target present time.
+    *
+    * @param target_present_time CLOCK_MONOTONIC time, in nanoseconds, before which the commit should not be shown.
+    */
+   void set_commit_timestamp(uint64_t target_present_time);
+
+   /**
+    * @brief Damage the parts of the surface that changed in a present.
+    *
+    * @param image_data Data of the image being presented.
+    */
+   void damage_surface(const wayland_image_data &image_data);
+
+   /**
+    * @brief Ask the compositor for presentation feedback on the next commit.
+    *
+    * @param present_id Present ID of the present being committed.
+    *
+    * @return true if the compositor will report when the commit is shown, false otherwise.
+    */
+   bool request_presentation_feedback(uint64_t present_id);
+
+   /**
+    * @brief Get how long to wait for a frame event before presenting anyway.
+    *
+    * @return The timeout in milliseconds.
+    */
+   int get_frame_event_timeout() const;
+
+   /**
+    * @brief Frame event timeout used while the output refresh rate is unknown or frames are not being shown.
+    */
+   static constexpr int DEFAULT_FRAME_EVENT_TIMEOUT_MS = 1000;
+
+   /**
+    * @brief Number of refresh cycles to wait for a frame event while the compositor is showing frames.
+    */
+   static constexpr uint64_t FRAME_EVENT_REFRESH_CYCLES = 3;
+
+   /**
+    * @brief Maximum number of wp_presentation_feedback requests in flight.
+    *
+    * The compositor answers each request once its commit has been shown or replaced, so a couple of requests per
+    * image is enough. Presents that find no free slot go without feedback.
+    */
+   static constexpr size_t MAX_PRESENTATION_FEEDBACKS = 2 * wsi::surface_properties::MAX_SWAPCHAIN_IMAGE_COUNT;
+
    struct wl_display *m_display;
    struct wl_surface *m_surface;
    /** Raw pointer to the WSI Surface that this swapchain was created from. The Vulkan specification ensures that the
@@ -197,16 +406,92 @@ private:
    /* The queue on which we dispatch buffer related events, mostly buffer_release */
    struct wl_event_queue *m_buffer_queue;
 
+   /**
+    * @brief Thread dispatching the buffer queue, only started when WAYLAND_EVENT_THREAD_ENABLED is set.
+    */
+   std::thread m_event_thread;
+
+   /**
+    * @brief Whether the event thread should keep running.
+    */
+   std::atomic<bool> m_event_thread_run;
+
+   /**
+    * @brief Whether starting the event thread has been attempted, which happens once, on the first present.
+    */
+   bool m_event_thread_started;
+
+   /**
+    * @brief eventfd used to wake the event thread up when it has to exit.
+    */
+   util::fd_owner m_event_thread_wakeup;
+
    /**
     * @brief Handle to the WSI allocator.
     */
    wsialloc_allocator *m_wsi_allocator;
 
+   /**
+    * @brief Buffers allocated in a batch with an earlier image, for images that are still to be allocated.
+    */
+   util::vector<wsialloc_allocate_result> m_preallocated_buffers;
+
+   /**
+    * @brief Whether the buffers are allocated in a format the compositor can scan out directly.
+    */
+   bool m_scanout_allocation{ false };
+
    /**
     * @brief Image creation parameters used for all swapchain images.
     */
    struct image_creation_parameters m_image_creation_parameters;
 
+   /**
+    * @brief The wp_presentation_feedback requests, dispatched from the surface queue.
+    */
+   std::array<presentation_feedback, MAX_PRESENTATION_FEEDBACKS> m_presentation_feedbacks;
+
+   /**
+    * @brief Refresh period of the output reported by the compositor in nanoseconds, 0 if unknown.
+    *
+    * Read by the application thread when it schedules presents on the refresh nearest to their target.
+    */
+   std::atomic<uint64_t> m_refresh_interval;
+
+   /**
+    * @brief Whether the compositor discarded the last commit it gave feedback about.
+    */
+   bool m_last_present_discarded;
+
+   /**
+    * @brief Whether buffers are released through per-commit zwp_linux_buffer_release_v1 objects.
+    *
+    * wl_buffer.release events are still sent by the compositor but are ignored when this is set.
+    */
+   bool m_explicit_release;
+
+   /**
+    * @brief Part of the images shown with wp_viewport, empty to show the whole image.
+    */
+   VkRect2D m_viewport_source;
+
+   /**
+    * @brief Size of the surface set with wp_viewport, empty for the size of the shown part of the images.
+    */
+   VkExtent2D m_viewport_destination;
+
+   /**
+    * @brief Size of the surface with the presents of this swapchain.
+    */
+   VkExtent2D m_surface_extent;
+
+   /**
+    * @brief Work out how the images are scaled onto the surface for the present scaling of the swapchain.
+    *
+    * @param image_extent Size of the swapchain images.
+    */
+   void init_viewport(const VkExtent2D &image_extent);
+
    /**
     * @brief Finds what formats are compatible with the requested swapchain image Vulkan Device and Wayland surface.
     *
@@ -219,7 +504,7 @@ private:
    VkResult get_surface_compatible_formats(const VkImageCreateInfo &info,
                                            util::vector<wsialloc_format> &importable_formats,
                                            util::vector<uint64_t> &exportable_modifers,
-                                           util::vector<VkDrmFormatModifierPropertiesEXT> &drm_format_props);
+                                           util::drm_format_properties_list &drm_format_props);
 };
 } // namespace wayland
 } // namespace wsi
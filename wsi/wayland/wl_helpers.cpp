@@ -24,6 +24,8 @@
 
 #include "wl_helpers.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <memory>
 #include <poll.h>
@@ -32,56 +34,183 @@
 
 #include "wl_object_owner.hpp"
 
+#include "util/custom_allocator.hpp"
 #include "util/log.hpp"
+#include "util/timed_semaphore.hpp"
 
-int dispatch_queue(struct wl_display *display, struct wl_event_queue *queue, int timeout)
+namespace wsi
 {
-   int err;
-   struct pollfd pfd = {};
-   int retval;
+namespace wayland
+{
+
+namespace
+{
+/* Dispatchers of the displays in use, there are rarely more than one. */
+std::mutex dispatchers_mutex;
+util::vector<display_dispatcher *> dispatchers{ util::allocator::get_generic() };
+} // namespace
+
+display_dispatcher::display_dispatcher(wl_display *display)
+   : m_display(display)
+{
+}
+
+display_dispatcher_ref display_dispatcher::acquire(wl_display *display)
+{
+   const std::lock_guard<std::mutex> lock(dispatchers_mutex);
+   auto it = std::find_if(dispatchers.begin(), dispatchers.end(),
+                          [display](const display_dispatcher *dispatcher) { return dispatcher->m_display == display; });
+   if (it != dispatchers.end())
+   {
+      (*it)->m_ref_count++;
+      return display_dispatcher_ref(*it);
+   }
+
+   /* The dispatcher is shared by the surfaces of any instance, so it does not use the allocator of any of them. */
+   auto *dispatcher = util::allocator::get_generic().create<display_dispatcher>(1, display);
+   if (dispatcher == nullptr)
+   {
+      return nullptr;
+   }
+   if (!dispatchers.try_push_back(dispatcher))
+   {
+      util::allocator::get_generic().destroy(1, dispatcher);
+      return nullptr;
+   }
+
+   dispatcher->m_ref_count = 1;
+   return display_dispatcher_ref(dispatcher);
+}
+
+void display_dispatcher_deleter::operator()(display_dispatcher *dispatcher) const
+{
+   const std::lock_guard<std::mutex> lock(dispatchers_mutex);
+   assert(dispatcher->m_ref_count > 0);
+   if (--dispatcher->m_ref_count > 0)
+   {
+      return;
+   }
+
+   auto it = std::find(dispatchers.begin(), dispatchers.end(), dispatcher);
+   assert(it != dispatchers.end());
+   /* Order is irrelevant, so move the last dispatcher into the freed slot. */
+   *it = dispatchers.back();
+   dispatchers.pop_back();
+   util::allocator::get_generic().destroy(1, dispatcher);
+}
 
-   /* Before we sleep, dispatch any pending events. prepare_read_queue will return 0 whilst there are pending
-    * events to dispatch on the queue. */
-   while (0 != wl_display_prepare_read_queue(display, queue))
+int display_dispatcher::dispatch_queue(wl_event_queue *queue, uint64_t deadline)
+{
+   std::unique_lock<std::mutex> lock(m_mutex);
+   while (true)
    {
-      /* dispatch_queue_pending returns -1 on error, or the number of events dispatched otherwise. If we
-       * already dispatched some events, then we might not need to sleep, as we might have just dispatched
-       * the event we want, so return immediately. */
-      err = wl_display_dispatch_queue_pending(display, queue);
-      if (err)
+      if (!m_reading)
+      {
+         /* The read is prepared before other threads can see that this one is reading. A read made meanwhile by a
+          * thread outside the layer then waits for ours, which wakes up the waiting threads once it is done, so
+          * their events are never left queued unnoticed. prepare_read_queue fails whilst there are events pending
+          * dispatch on the queue, and as they might be the ones we are waiting for, return once dispatched. */
+         if (wl_display_prepare_read_queue(m_display, queue) != 0)
+         {
+            lock.unlock();
+            int err = wl_display_dispatch_queue_pending(m_display, queue);
+            if (err != 0)
+            {
+               return (0 > err) ? -1 : 1;
+            }
+            lock.lock();
+            continue;
+         }
+
+         m_reading = true;
+         lock.unlock();
+         int res = poll_and_read(deadline);
+         lock.lock();
+         m_reading = false;
+         m_read_count++;
+         m_read_done.notify_all();
+         lock.unlock();
+
+         /* Finally, if we read any events relevant to our queue, we can dispatch them. */
+         if (res > 0 && wl_display_dispatch_queue_pending(m_display, queue) < 0)
+         {
+            return -1;
+         }
+         return res;
+      }
+
+      /* Another thread is polling the display. Dispatch what it may already have read for this queue, then wait for
+       * it to finish reading instead of competing for the same data. */
+      const uint64_t read_count = m_read_count;
+      lock.unlock();
+      int err = wl_display_dispatch_queue_pending(m_display, queue);
+      if (err != 0)
       {
          return (0 > err) ? -1 : 1;
       }
+      lock.lock();
+
+      auto read_finished = [this, read_count]() { return m_read_count != read_count; };
+      if (deadline == UINT64_MAX)
+      {
+         m_read_done.wait(lock, read_finished);
+      }
+      else
+      {
+         /* The steady clock is CLOCK_MONOTONIC, the clock of the deadline. */
+         const auto deadline_time = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(deadline));
+         if (!m_read_done.wait_until(lock, deadline_time, read_finished))
+         {
+            return 0;
+         }
+      }
    }
+}
+
+int display_dispatcher::poll_and_read(uint64_t deadline)
+{
+   constexpr uint64_t NSEC_PER_SEC = 1000000000;
+   int err;
+   struct pollfd pfd = {};
 
    /* wl_display_read_events performs a non-blocking read. */
-   pfd.fd = wl_display_get_fd(display);
+   pfd.fd = wl_display_get_fd(m_display);
    pfd.events = POLLIN;
    while (true)
    {
-      /* Timeout is given in milliseconds. A return value of 0, or -1 with errno set to EINTR means that we
-       * should retry as the timeout was exceeded or we were interrupted by a signal, respectively. A
-       * return value of 1 means that something happened, and we should inspect the pollfd structure to see
-       * just what that was.
+      /* ppoll takes the timeout in nanoseconds, so short waits are neither cut to a busy poll nor rounded up to a
+       * whole millisecond. It is worked out from the deadline on each attempt, so that retries do not extend it.
+       * A return value of 0 means the timeout was exceeded, -1 with errno set to EINTR that we were interrupted by a
+       * signal and should retry. A return value of 1 means that something happened, and we should inspect the
+       * pollfd structure to see just what that was.
        */
-      err = poll(&pfd, 1, timeout);
+      struct timespec timeout = {};
+      const struct timespec *timeout_ptr = nullptr;
+      if (deadline != UINT64_MAX)
+      {
+         const uint64_t time_left = util::deadline_to_timeout(deadline);
+         timeout.tv_sec = static_cast<time_t>(time_left / NSEC_PER_SEC);
+         timeout.tv_nsec = static_cast<long>(time_left % NSEC_PER_SEC);
+         timeout_ptr = &timeout;
+      }
+      err = ppoll(&pfd, 1, timeout_ptr, nullptr);
       if (0 == err)
       {
          /* Timeout. */
-         wl_display_cancel_read(display);
+         wl_display_cancel_read(m_display);
          return 0;
       }
       else if (-1 == err)
       {
          if (EINTR == errno)
          {
-            /* Interrupted by a signal; restart. This resets the timeout. */
+            /* Interrupted by a signal; restart with the time left. */
             continue;
          }
          else
          {
             /* Something else bad happened; abort. */
-            wl_display_cancel_read(display);
+            wl_display_cancel_read(m_display);
             return -1;
          }
       }
@@ -95,7 +224,7 @@ int dispatch_queue(struct wl_display *display, struct wl_event_queue *queue, int
          else
          {
             /* An error occurred, e.g. file descriptor was closed from underneath us. */
-            wl_display_cancel_read(display);
+            wl_display_cancel_read(m_display);
             return -1;
          }
       }
@@ -103,15 +232,14 @@ int dispatch_queue(struct wl_display *display, struct wl_event_queue *queue, int
 
    /* Actually read the events from the display. A failure in read_events calls cancel_read internally for us,
     * so we don't need to do that here. */
-   err = wl_display_read_events(display);
+   err = wl_display_read_events(m_display);
    if (0 != err)
    {
       return -1;
    }
 
-   /* Finally, if we read any events relevant to our queue, we can dispatch them. */
-   err = wl_display_dispatch_queue_pending(display, queue);
-   retval = err < 0 ? -1 : 1;
-
-   return retval;
+   return 1;
 }
+
+} // namespace wayland
+} // namespace wsi
@@ -31,21 +31,102 @@
 #endif
 #include <wayland-client.h>
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
 #include "util/custom_allocator.hpp"
 
+namespace wsi
+{
+namespace wayland
+{
+
+class display_dispatcher;
+
 /**
- * @brief Dispatch events from a Wayland event queue
- *
- * Dispatch events from a given Wayland display event queue, including calling event handlers, and flush out any
- * requests the event handlers may have written. Specification of a timeout allows the wait to be bounded. If any
- * events are already pending dispatch (have been read from the display by another thread or event queue), they
- * will be dispatched and the function will return immediately, without waiting for new events to arrive.
+ * @brief Releases the reference held on a @ref display_dispatcher.
+ */
+struct display_dispatcher_deleter
+{
+   void operator()(display_dispatcher *dispatcher) const;
+};
+
+/**
+ * @brief Reference to the @ref display_dispatcher of a wl_display.
+ */
+using display_dispatcher_ref = std::unique_ptr<display_dispatcher, display_dispatcher_deleter>;
+
+/**
+ * @brief Event dispatcher shared by all the surfaces and swapchains of the layer on the same wl_display.
  *
- * @param  display Wayland display to dispatch events from
- * @param  queue   Event queue to dispatch events from; other event queues will not have their handlers called from
- *                 within this function
- * @param  timeout Maximum time to wait for events to arrive, in milliseconds
- * @return         1 if one or more events were dispatched on this queue, 0 if the timeout was reached without any
- *                 events being dispatched, or -1 on error.
+ * Reading the display socket queues the events of every event queue, so only one of the threads waiting for events
+ * polls and reads it. The other threads wait for that read to finish and then dispatch whatever it queued for their
+ * own queue, instead of each of them polling the same socket.
  */
-int dispatch_queue(struct wl_display *display, struct wl_event_queue *queue, int timeout);
+class display_dispatcher
+{
+public:
+   /**
+    * @brief Get the dispatcher of a display, creating it for the first reference.
+    *
+    * @param display The Wayland display.
+    *
+    * @return A reference to the dispatcher, or nullptr when out of memory.
+    */
+   static display_dispatcher_ref acquire(wl_display *display);
+
+   /**
+    * @brief Dispatch events from a Wayland event queue
+    *
+    * Dispatch events from a given Wayland display event queue, including calling event handlers, and flush out any
+    * requests the event handlers may have written. Specification of a timeout allows the wait to be bounded. If any
+    * events are already pending dispatch (have been read from the display by another thread or event queue), they
+    * will be dispatched and the function will return immediately, without waiting for new events to arrive.
+    *
+    * @param  queue    Event queue to dispatch events from; other event queues will not have their handlers called from
+    *                  within this function
+    * @param  deadline CLOCK_MONOTONIC time (ns) until which to wait for events to arrive, see
+    *                  @ref util::timeout_to_deadline. UINT64_MAX waits without a timeout.
+    * @return          1 if events were read from the display or dispatched on this queue, 0 if the deadline was reached
+    *                  without any events being dispatched, or -1 on error.
+    */
+   int dispatch_queue(wl_event_queue *queue, uint64_t deadline);
+
+   display_dispatcher(const display_dispatcher &) = delete;
+   display_dispatcher &operator=(const display_dispatcher &) = delete;
+
+   /**
+    * @brief Constructor, use @ref acquire to get the dispatcher of a display.
+    */
+   explicit display_dispatcher(wl_display *display);
+
+private:
+   friend struct display_dispatcher_deleter;
+
+   /**
+    * @brief Poll the display and read its events into their queues, after the read has been prepared.
+    *
+    * @param deadline CLOCK_MONOTONIC time (ns) until which to wait for events, UINT64_MAX to wait without a timeout.
+    *
+    * @return 1 if events were read, 0 on timeout or -1 on error. The read is cancelled unless events were read.
+    */
+   int poll_and_read(uint64_t deadline);
+
+   wl_display *m_display;
+
+   /** Number of references to the dispatcher, protected by the lock of the dispatcher list. */
+   uint32_t m_ref_count{ 0 };
+
+   /** Protects the reader state below. */
+   std::mutex m_mutex;
+   /** Signalled when the reading thread has finished reading. */
+   std::condition_variable m_read_done;
+   /** Whether a thread is polling and reading the display. */
+   bool m_reading{ false };
+   /** Incremented after each read, so waiting threads can tell that one happened. */
+   uint64_t m_read_count{ 0 };
+};
+
+} // namespace wayland
+} // namespace wsi
@@ -31,6 +31,14 @@
 #include <linux-dmabuf-unstable-v1-client-protocol.h>
 #include <linux-explicit-synchronization-unstable-v1-protocol.h>
 #include <presentation-time-client-protocol.h>
+#include <viewporter-client-protocol.h>
+#if WAYLAND_FIFO_PROTOCOLS_SUPPORTED
+#include <fifo-v1-client-protocol.h>
+#include <commit-timing-v1-client-protocol.h>
+#endif
+#if WAYLAND_TEARING_CONTROL_PROTOCOL_SUPPORTED
+#include <tearing-control-v1-client-protocol.h>
+#endif
 #include <memory.h>
 #include <functional>
 
@@ -49,6 +57,11 @@ static inline void wayland_object_destroy(zwp_linux_dmabuf_v1 *obj)
    zwp_linux_dmabuf_v1_destroy(obj);
 }
 
+static inline void wayland_object_destroy(zwp_linux_dmabuf_feedback_v1 *obj)
+{
+   zwp_linux_dmabuf_feedback_v1_destroy(obj);
+}
+
 static inline void wayland_object_destroy(zwp_linux_explicit_synchronization_v1 *obj)
 {
    zwp_linux_explicit_synchronization_v1_destroy(obj);
@@ -64,6 +77,50 @@ static inline void wayland_object_destroy(wp_presentation *obj)
    wp_presentation_destroy(obj);
 }
 
+static inline void wayland_object_destroy(wp_viewporter *obj)
+{
+   wp_viewporter_destroy(obj);
+}
+
+static inline void wayland_object_destroy(wp_viewport *obj)
+{
+   wp_viewport_destroy(obj);
+}
+
+#if WAYLAND_FIFO_PROTOCOLS_SUPPORTED
+static inline void wayland_object_destroy(wp_fifo_manager_v1 *obj)
+{
+   wp_fifo_manager_v1_destroy(obj);
+}
+
+static inline void wayland_object_destroy(wp_fifo_v1 *obj)
+{
+   wp_fifo_v1_destroy(obj);
+}
+
+static inline void wayland_object_destroy(wp_commit_timing_manager_v1 *obj)
+{
+   wp_commit_timing_manager_v1_destroy(obj);
+}
+
+static inline void wayland_object_destroy(wp_commit_timer_v1 *obj)
+{
+   wp_commit_timer_v1_destroy(obj);
+}
+#endif
+
+#if WAYLAND_TEARING_CONTROL_PROTOCOL_SUPPORTED
+static inline void wayland_object_destroy(wp_tearing_control_manager_v1 *obj)
+{
+   wp_tearing_control_manager_v1_destroy(obj);
+}
+
+static inline void wayland_object_destroy(wp_tearing_control_v1 *obj)
+{
+   wp_tearing_control_v1_destroy(obj);
+}
+#endif
+
 static inline void wayland_object_destroy(wl_callback *obj)
 {
    wl_callback_destroy(obj);
@@ -90,7 +147,10 @@ template <typename T>
 using wayland_owner = std::unique_ptr<T, wayland_deleter<T>>;
 
 template <typename T>
-static std::unique_ptr<T, std::function<void(T *)>> make_proxy_with_queue(T *object, wl_event_queue *queue)
+using wayland_proxy_wrapper = std::unique_ptr<T, std::function<void(T *)>>;
+
+template <typename T>
+static wayland_proxy_wrapper<T> make_proxy_with_queue(T *object, wl_event_queue *queue)
 {
    auto proxy = reinterpret_cast<T *>(wl_proxy_create_wrapper(object));
    if (proxy != nullptr)
@@ -100,7 +160,7 @@ static std::unique_ptr<T, std::function<void(T *)>> make_proxy_with_queue(T *obj
 
    auto delete_proxy = [](T *proxy) { wl_proxy_wrapper_destroy(reinterpret_cast<wl_proxy *>(proxy)); };
 
-   return std::unique_ptr<T, std::function<void(T *)>>(proxy, delete_proxy);
+   return wayland_proxy_wrapper<T>(proxy, delete_proxy);
 }
 
 } // namespace wayland
@@ -272,8 +272,14 @@ PFN_vkVoidFunction get_proc_addr(const char *name, const layer::instance_private
          return nullptr;
       }
 
+      /* Skip the lookup for platforms whose surface extension is not enabled. */
+      if (!props->is_surface_extension_enabled(instance_data))
+      {
+         continue;
+      }
+
       PFN_vkVoidFunction func = props->get_proc_addr(name);
-      if (props->is_surface_extension_enabled(instance_data) && func)
+      if (func)
       {
          return func;
       }